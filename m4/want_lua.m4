@@ -12,6 +12,16 @@ AC_DEFUN([DOVECOT_WANT_LUA], [
       ])
     done
 
+    dnl LuaJIT implements the Lua 5.1 API
+    AS_IF([test "$have_lua" = "no"], [
+      PKG_CHECK_MODULES([LUA], [luajit >= 2.0], [
+        have_lua=yes
+        AC_MSG_NOTICE([using library luajit])
+      ], [
+        :
+      ])
+    ])
+
     AS_IF([test "$want_lua" = "yes" && test "$have_lua" = "no"], [
       AC_MSG_ERROR([cannot build with Lua support: lua not found])
     ])
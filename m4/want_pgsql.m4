@@ -55,6 +55,12 @@ AC_DEFUN([DOVECOT_WANT_PGSQL], [
       ])
     ],, $PGSQL_LIBS)
 
+    AC_CHECK_LIB(pq, PQenterPipelineMode, [
+      AC_DEFINE(HAVE_PQENTERPIPELINEMODE,, [
+        Define if libpq has PQenterPipelineMode function
+      ])
+    ],, $PGSQL_LIBS)
+
     AC_DEFINE(HAVE_PGSQL,, [Build with PostgreSQL support])
   ])
 ])
@@ -124,10 +124,12 @@ struct connect_limit *connect_limit_init(void)
 	limit = i_new(struct connect_limit, 1);
 	limit->strings = str_table_init();
 	i_array_init(&limit->alt_username_fields, 8);
-	hash_table_create(&limit->user_hash, default_pool, 0,
-			  str_hash, strcmp);
-	hash_table_create(&limit->userip_hash, default_pool, 0,
-			  userip_hash, userip_cmp);
+	hash_table_create_flags(&limit->user_hash, default_pool, 0,
+				HASH_TABLE_FLAG_OPEN_ADDRESSING,
+				str_hash, strcmp);
+	hash_table_create_flags(&limit->userip_hash, default_pool, 0,
+				HASH_TABLE_FLAG_OPEN_ADDRESSING,
+				userip_hash, userip_cmp);
 	hash_table_create(&limit->session_hash, default_pool, 0,
 			  guid_128_hash, guid_128_cmp);
 	hash_table_create_direct(&limit->process_hash, default_pool, 0);
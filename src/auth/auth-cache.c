@@ -12,15 +12,31 @@
 
 #include <time.h>
 
+struct auth_cache_lookup_waiter {
+	struct auth_request *request;
+	auth_cache_lookup_callback_t *callback;
+};
+
+struct auth_cache_lookup {
+	char *key;
+	/* request doing the database lookup */
+	struct auth_request *request;
+	ARRAY(struct auth_cache_lookup_waiter) waiters;
+};
+
 struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
+	/* database lookups that are currently running after a cache miss */
+	HASH_TABLE(char *, struct auth_cache_lookup *) lookups;
 	struct auth_cache_node *head, *tail;
 	struct event *event;
 
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
+	unsigned int refresh_percentage;
 
-	unsigned int hit_count, miss_count;
+	unsigned int hit_count, miss_count, evict_count, refresh_count;
+	unsigned int coalesce_count;
 	unsigned int pos_entries, neg_entries;
 	unsigned long long pos_size, neg_size;
 };
@@ -189,6 +205,25 @@ auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
 	i_free(node);
 }
 
+static void auth_cache_evict_tail(struct auth_cache *cache)
+{
+	struct auth_cache_node *node;
+
+	/* Lookups only mark the nodes referenced instead of moving them to
+	   head (CLOCK-style approximate LRU). Give the referenced nodes a
+	   second chance here, so the list is relinked only on eviction.
+	   This terminates, because the referenced flags are cleared. */
+	while ((node = cache->tail)->referenced) {
+		node->referenced = FALSE;
+		if (node == cache->head)
+			break;
+		auth_cache_node_unlink(cache, node);
+		auth_cache_node_link_head(cache, node);
+	}
+	auth_cache_node_destroy(cache, node);
+	cache->evict_count++;
+}
+
 static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
@@ -204,9 +239,12 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 	size_t cache_used;
 
 	total_count = cache->hit_count + cache->miss_count;
-	e_info(cache->event, "Authentication cache hits %u/%u (%u%%)",
+	e_info(cache->event, "Authentication cache hits %u/%u (%u%%), "
+	       "%u refreshed ahead of expiration, "
+	       "%u waited for an identical lookup",
 	       cache->hit_count, total_count,
-	       total_count == 0 ? 100 : (cache->hit_count * 100 / total_count));
+	       total_count == 0 ? 100 : (cache->hit_count * 100 / total_count),
+	       cache->refresh_count, cache->coalesce_count);
 
 	e_info(cache->event, "Authentication cache inserts: "
 	       "positive: %u entries %llu bytes, "
@@ -216,28 +254,34 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 
 	cache_used = cache->max_size - cache->size_left;
 	e_info(cache->event, "Authentication cache current size: "
-	       "%zu bytes used of %zu bytes (%u%%)",
+	       "%zu bytes used of %zu bytes (%u%%), %u entries evicted",
 	       cache_used, cache->max_size,
-	       (unsigned int)(cache_used * 100ULL / cache->max_size));
+	       (unsigned int)(cache_used * 100ULL / cache->max_size),
+	       cache->evict_count);
 
 	/* reset counters */
-	cache->hit_count = cache->miss_count = 0;
+	cache->hit_count = cache->miss_count = cache->evict_count = 0;
+	cache->refresh_count = cache->coalesce_count = 0;
 	cache->pos_entries = cache->neg_entries = 0;
 	cache->pos_size = cache->neg_size = 0;
 }
 
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
-				  unsigned int neg_ttl_secs
-)
+				  unsigned int neg_ttl_secs,
+				  unsigned int refresh_percentage)
 {
 	struct auth_cache *cache;
 
 	cache = i_new(struct auth_cache, 1);
-	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create_flags(&cache->hash, default_pool, 0,
+				HASH_TABLE_FLAG_OPEN_ADDRESSING,
+				str_hash, strcmp);
+	hash_table_create(&cache->lookups, default_pool, 0, str_hash, strcmp);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
 	cache->neg_ttl_secs = neg_ttl_secs;
+	cache->refresh_percentage = refresh_percentage;
 	cache->event = event_create(auth_event);
 
 	lib_signals_set_handler(SIGHUP, LIBSIG_FLAGS_SAFE,
@@ -255,6 +299,20 @@ void auth_cache_free(struct auth_cache **_cache)
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
+	/* let the waiting requests continue on their own */
+	while (hash_table_count(cache->lookups) > 0) {
+		struct hash_iterate_context *iter;
+		struct auth_cache_lookup *lookup;
+		char *key;
+
+		iter = hash_table_iterate_init(cache->lookups);
+		if (!hash_table_iterate(iter, cache->lookups, &key, &lookup))
+			i_unreached();
+		hash_table_iterate_deinit(&iter);
+		auth_cache_lookup_finish(cache, lookup->request);
+	}
+	hash_table_destroy(&cache->lookups);
+
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
 	event_unref(&cache->event);
@@ -401,12 +459,22 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		/* TTL expired */
 		cache->miss_count++;
 		*expired_r = TRUE;
+	} else if (cache->refresh_percentage > 0 && !node->refreshing &&
+		   node->created < now - (time_t)(ttl_secs *
+			(unsigned long long)cache->refresh_percentage / 100)) {
+		/* Let this lookup refresh the record from the database.
+		   The other lookups keep using it until it's replaced by
+		   auth_cache_insert() or it expires. If the database lookup
+		   fails, this lookup can still fall back to it. */
+		e_debug(authdb_event(request),
+			"cache: refreshing record ahead of expiration");
+		node->refreshing = TRUE;
+		cache->miss_count++;
+		cache->refresh_count++;
+		*expired_r = TRUE;
 	} else {
-		/* move to head */
-		if (node != cache->head) {
-			auth_cache_node_unlink(cache, node);
-			auth_cache_node_link_head(cache, node);
-		}
+		/* moved to head lazily on eviction */
+		node->referenced = TRUE;
 		cache->hit_count++;
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
@@ -437,15 +505,16 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	alloc_size = sizeof(struct auth_cache_node) + data_size;
 
 	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-
 	node = hash_table_lookup(cache->hash, key);
 	if (node != NULL) {
 		/* key is already in cache (probably expired), remove it */
 		auth_cache_node_destroy(cache, node);
 	}
 
+	/* make sure we have enough space */
+	while (cache->size_left < alloc_size && cache->tail != NULL)
+		auth_cache_evict_tail(cache);
+
 	/* @UNSAFE */
 	node = i_malloc(alloc_size);
 	node->created = time(NULL);
@@ -481,3 +550,67 @@ void auth_cache_remove(struct auth_cache *cache,
 
 	auth_cache_node_destroy(cache, node);
 }
+
+bool auth_cache_lookup_wait(struct auth_cache *cache,
+			    struct auth_request *request, const char *key,
+			    bool userdb, auth_cache_lookup_callback_t *callback)
+{
+	struct auth_cache_lookup *lookup;
+	struct auth_cache_lookup_waiter *waiter;
+
+	if (request->cache_lookup != NULL) {
+		/* already doing another lookup */
+		return FALSE;
+	}
+
+	key = auth_request_expand_cache_key(request, key,
+					    request->fields.translated_username);
+	/* passdb and userdb lookups can't satisfy each other */
+	key = t_strconcat(userdb ? "U" : "P", key, NULL);
+	lookup = hash_table_lookup(cache->lookups, key);
+	if (lookup == NULL) {
+		lookup = i_new(struct auth_cache_lookup, 1);
+		lookup->key = i_strdup(key);
+		lookup->request = request;
+		hash_table_insert(cache->lookups, lookup->key, lookup);
+		request->cache_lookup = lookup;
+		return FALSE;
+	}
+
+	e_debug(authdb_event(request),
+		"cache: waiting for an identical lookup to finish");
+	if (!array_is_created(&lookup->waiters))
+		i_array_init(&lookup->waiters, 4);
+	waiter = array_append_space(&lookup->waiters);
+	waiter->request = request;
+	waiter->callback = callback;
+	auth_request_ref(request);
+	cache->coalesce_count++;
+	return TRUE;
+}
+
+void auth_cache_lookup_finish(struct auth_cache *cache,
+			      struct auth_request *request)
+{
+	struct auth_cache_lookup *lookup = request->cache_lookup;
+	struct auth_cache_lookup_waiter *waiter;
+
+	if (lookup == NULL)
+		return;
+	i_assert(lookup->request == request);
+
+	request->cache_lookup = NULL;
+	hash_table_remove(cache->lookups, lookup->key);
+
+	if (array_is_created(&lookup->waiters)) {
+		array_foreach_modifiable(&lookup->waiters, waiter) {
+			struct auth_request *waiting_request = waiter->request;
+
+			waiter->callback(waiting_request);
+			auth_request_unref(&waiting_request);
+		}
+		array_free(&lookup->waiters);
+	}
+	i_free(lookup->key);
+	i_free(lookup);
+}
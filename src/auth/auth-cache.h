@@ -6,9 +6,15 @@ struct auth_cache_node {
 
 	time_t created;
 	/* Total number of bytes used by this node */
-	uint32_t alloc_size:31;
+	uint32_t alloc_size:29;
 	/* TRUE if the user gave the correct password the last time. */
 	bool last_success:1;
+	/* TRUE if the node was looked up since it was last linked to head.
+	   Such nodes get a second chance instead of being evicted. */
+	bool referenced:1;
+	/* TRUE if a lookup is already refreshing this node from the
+	   database. */
+	bool refreshing:1;
 
 	char data[]; /* key \0 value \0 */
 };
@@ -16,6 +22,8 @@ struct auth_cache_node {
 struct auth_cache;
 struct auth_request;
 
+typedef void auth_cache_lookup_callback_t(struct auth_request *request);
+
 /* Parses all %x variables from query and compresses them into tab-separated
    list, so it can be used as a cache key. */
 char *auth_cache_parse_key(pool_t pool, const char *query);
@@ -23,9 +31,13 @@ char *auth_cache_parse_key(pool_t pool, const char *query);
 /* Create a new cache. max_size specifies the maximum amount of memory in
    bytes to use for cache (it's not fully exact). ttl_secs specifies time to
    live for cache record, requests older than that are not used.
-   neg_ttl_secs specifies the TTL for negative entries. */
+   neg_ttl_secs specifies the TTL for negative entries. If refresh_percentage
+   is non-zero, the first lookup after that percentage of the TTL has passed
+   is returned as expired, so it refreshes the record while other lookups
+   still use it. */
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
-				  unsigned int neg_ttl_secs);
+				  unsigned int neg_ttl_secs,
+				  unsigned int refresh_percentage);
 void auth_cache_free(struct auth_cache **cache);
 
 /* Clear the cache. Returns how many entries were removed. */
@@ -36,7 +48,8 @@ unsigned int auth_cache_clear_users(struct auth_cache *cache,
 
 /* Look key from cache. key should be the same string as returned by
    auth_cache_parse_key(). Returned node can't be used after any other
-   auth_cache_*() calls. */
+   auth_cache_*() calls. expired_r is also set when the caller should
+   refresh the record ahead of its expiration. */
 const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
@@ -50,4 +63,16 @@ void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request,
 		       const char *key);
 
+/* Called after a cache miss, before doing the database lookup. Returns TRUE
+   if an identical lookup is already running, in which case callback is
+   called after it has finished so the request can retry the cache. Otherwise
+   the request becomes the one doing the lookup, and it must call
+   auth_cache_lookup_finish() after having updated the cache. */
+bool auth_cache_lookup_wait(struct auth_cache *cache,
+			    struct auth_request *request, const char *key,
+			    bool userdb, auth_cache_lookup_callback_t *callback);
+/* Resume the requests waiting for the request's lookup. */
+void auth_cache_lookup_finish(struct auth_cache *cache,
+			      struct auth_request *request);
+
 #endif
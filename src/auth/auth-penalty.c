@@ -4,6 +4,8 @@
 #include "ioloop.h"
 #include "net.h"
 #include "crc32.h"
+#include "hash.h"
+#include "llist.h"
 #include "master-service.h"
 #include "anvil-client.h"
 #include "auth-request.h"
@@ -15,18 +17,94 @@
    tracking with tons of different IPs. */
 #define PENALTY_IPV6_MASK_BITS 48
 
+/* How long PENALTY-GET replies are remembered locally. Within this time
+   lookups for the same IP don't need to wait for anvil. */
+#define AUTH_PENALTY_CACHE_SECS 5
+/* Maximum number of IPs in the local cache */
+#define AUTH_PENALTY_CACHE_MAX_COUNT 10000
+
 struct auth_penalty_request {
+	struct auth_penalty *penalty;
 	struct auth_request *auth_request;
 	struct anvil_client *client;
 	auth_penalty_callback_t *callback;
+	char *ident;
+};
+
+struct auth_penalty_cache_rec {
+	struct auth_penalty_cache_rec *prev, *next;
+
+	char *ident;
+	unsigned int penalty;
+	time_t last_penalty;
+	time_t created;
 };
 
 struct auth_penalty {
 	struct anvil_client *client;
 
+	/* ident => rec. Contains the latest known anvil state for the IPs,
+	   ordered by the creation time. */
+	HASH_TABLE(char *, struct auth_penalty_cache_rec *) cache;
+	struct auth_penalty_cache_rec *oldest, *newest;
+	unsigned int cache_count;
+
 	bool disabled:1;
 };
 
+static void
+auth_penalty_cache_rec_free(struct auth_penalty *penalty,
+			    struct auth_penalty_cache_rec *rec)
+{
+	hash_table_remove(penalty->cache, rec->ident);
+	DLLIST2_REMOVE(&penalty->oldest, &penalty->newest, rec);
+	i_assert(penalty->cache_count > 0);
+	penalty->cache_count--;
+	i_free(rec->ident);
+	i_free(rec);
+}
+
+static void auth_penalty_cache_expire(struct auth_penalty *penalty)
+{
+	while (penalty->oldest != NULL &&
+	       (penalty->cache_count > AUTH_PENALTY_CACHE_MAX_COUNT ||
+		penalty->oldest->created + AUTH_PENALTY_CACHE_SECS <=
+		ioloop_time ||
+		penalty->oldest->created > ioloop_time))
+		auth_penalty_cache_rec_free(penalty, penalty->oldest);
+}
+
+static void
+auth_penalty_cache_set(struct auth_penalty *penalty, const char *ident,
+		       unsigned int value, time_t last_penalty)
+{
+	struct auth_penalty_cache_rec *rec;
+
+	rec = hash_table_lookup(penalty->cache, ident);
+	if (rec != NULL)
+		auth_penalty_cache_rec_free(penalty, rec);
+
+	rec = i_new(struct auth_penalty_cache_rec, 1);
+	rec->ident = i_strdup(ident);
+	rec->penalty = value;
+	rec->last_penalty = last_penalty;
+	rec->created = ioloop_time;
+	hash_table_insert(penalty->cache, rec->ident, rec);
+	DLLIST2_APPEND(&penalty->oldest, &penalty->newest, rec);
+	penalty->cache_count++;
+	auth_penalty_cache_expire(penalty);
+}
+
+static void
+auth_penalty_cache_remove(struct auth_penalty *penalty, const char *ident)
+{
+	struct auth_penalty_cache_rec *rec;
+
+	rec = hash_table_lookup(penalty->cache, ident);
+	if (rec != NULL)
+		auth_penalty_cache_rec_free(penalty, rec);
+}
+
 struct auth_penalty *auth_penalty_init(const char *path)
 {
 	struct auth_penalty *penalty;
@@ -34,6 +112,7 @@ struct auth_penalty *auth_penalty_init(const char *path)
 	penalty = i_new(struct auth_penalty, 1);
 	penalty->client = anvil_client_init(path, NULL,
 					    ANVIL_CLIENT_FLAG_HIDE_ENOENT);
+	hash_table_create(&penalty->cache, default_pool, 0, str_hash, strcmp);
 	if (anvil_client_connect(penalty->client, TRUE) < 0)
 		penalty->disabled = TRUE;
 	else {
@@ -49,6 +128,9 @@ void auth_penalty_deinit(struct auth_penalty **_penalty)
 
 	*_penalty = NULL;
 	anvil_client_deinit(&penalty->client);
+	while (penalty->oldest != NULL)
+		auth_penalty_cache_rec_free(penalty, penalty->oldest);
+	hash_table_destroy(&penalty->cache);
 	i_free(penalty);
 }
 
@@ -61,13 +143,35 @@ unsigned int auth_penalty_to_secs(unsigned int penalty)
 	return secs < AUTH_PENALTY_MAX_SECS ? secs : AUTH_PENALTY_MAX_SECS;
 }
 
+static unsigned int
+auth_penalty_decay(unsigned int penalty, time_t last_penalty)
+{
+	unsigned int secs, drop_penalty;
+
+	if (last_penalty > ioloop_time) {
+		/* time moved backwards? */
+		last_penalty = ioloop_time;
+	}
+
+	/* drop the penalty for each timeout that has passed since the
+	   last failure, starting from the longest one. */
+	drop_penalty = AUTH_PENALTY_MAX_PENALTY;
+	while (penalty > 0) {
+		secs = auth_penalty_to_secs(drop_penalty);
+		if (ioloop_time - last_penalty < secs)
+			break;
+		drop_penalty--;
+		penalty--;
+	}
+	return penalty;
+}
+
 static void
 auth_penalty_anvil_callback(const char *reply,
 			    struct auth_penalty_request *request)
 {
 	unsigned int penalty = 0;
 	unsigned long last_penalty = 0;
-	unsigned int secs, drop_penalty;
 
 	if (reply == NULL) {
 		/* internal failure. */
@@ -80,24 +184,14 @@ auth_penalty_anvil_callback(const char *reply,
 		e_error(request->auth_request->event,
 			"Invalid PENALTY-GET reply: %s", reply);
 	} else {
-		if ((time_t)last_penalty > ioloop_time) {
-			/* time moved backwards? */
-			last_penalty = ioloop_time;
-		}
-
-		/* update penalty. */
-		drop_penalty = AUTH_PENALTY_MAX_PENALTY;
-		while (penalty > 0) {
-			secs = auth_penalty_to_secs(drop_penalty);
-			if (ioloop_time - last_penalty < secs)
-				break;
-			drop_penalty--;
-			penalty--;
-		}
+		auth_penalty_cache_set(request->penalty, request->ident,
+				       penalty, (time_t)last_penalty);
+		penalty = auth_penalty_decay(penalty, (time_t)last_penalty);
 	}
 
 	request->callback(penalty, request->auth_request);
 	auth_request_unref(&request->auth_request);
+	i_free(request->ident);
 	i_free(request);
 }
 
@@ -120,6 +214,7 @@ void auth_penalty_lookup(struct auth_penalty *penalty,
 			 auth_penalty_callback_t *callback)
 {
 	struct auth_penalty_request *request;
+	struct auth_penalty_cache_rec *rec;
 	const char *ident;
 
 	ident = auth_penalty_get_ident(auth_request);
@@ -129,8 +224,18 @@ void auth_penalty_lookup(struct auth_penalty *penalty,
 		return;
 	}
 
+	auth_penalty_cache_expire(penalty);
+	rec = hash_table_lookup(penalty->cache, ident);
+	if (rec != NULL) {
+		callback(auth_penalty_decay(rec->penalty, rec->last_penalty),
+			 auth_request);
+		return;
+	}
+
 	request = i_new(struct auth_penalty_request, 1);
+	request->penalty = penalty;
 	request->auth_request = auth_request;
+	request->ident = i_strdup(ident);
 	request->client = penalty->client;
 	request->callback = callback;
 	auth_request_ref(auth_request);
@@ -166,6 +271,13 @@ void auth_penalty_update(struct auth_penalty *penalty,
 		   timestamp does. */
 		value = AUTH_PENALTY_MAX_PENALTY;
 	}
+	if (value == 0)
+		auth_penalty_cache_set(penalty, ident, 0, 0);
+	else {
+		/* anvil may ignore the increase for a repeated
+		   user+password, so ask it again next time. */
+		auth_penalty_cache_remove(penalty, ident);
+	}
 	T_BEGIN {
 		const char *cmd;
 		unsigned int checksum;
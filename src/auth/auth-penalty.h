@@ -19,6 +19,8 @@ void auth_penalty_deinit(struct auth_penalty **penalty);
 
 unsigned int auth_penalty_to_secs(unsigned int penalty);
 
+/* Look up the penalty for the request's IP. Recent anvil replies are cached
+   locally, in which case the callback is called immediately. */
 void auth_penalty_lookup(struct auth_penalty *penalty,
 			 struct auth_request *auth_request,
 			 auth_penalty_callback_t *callback);
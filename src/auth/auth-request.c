@@ -69,6 +69,14 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 						     lookup_credentials_callback_t *callback);
 static
 void auth_request_policy_check_callback(int result, void *context);
+static void auth_request_cache_lookup_finish(struct auth_request *request);
+static void
+auth_request_verify_plain_lookup(struct auth_request *request, bool coalesce);
+static void
+auth_request_lookup_credentials_lookup(struct auth_request *request,
+				       bool coalesce);
+static void
+auth_request_lookup_user_lookup(struct auth_request *request, bool coalesce);
 
 static const char *get_log_prefix_mech(struct auth_request *auth_request)
 {
@@ -334,6 +342,7 @@ void auth_request_unref(struct auth_request **_request)
 		dns_lookup_abort(&request->dns_lookup_ctx->dns_lookup);
 	timeout_remove(&request->to_abort);
 	timeout_remove(&request->to_penalty);
+	auth_request_cache_lookup_finish(request);
 
 	if (request->mech != NULL)
 		request->mech->auth_free(request);
@@ -602,6 +611,12 @@ auth_request_cache_result_to_str(enum auth_request_cache_result result)
 	}
 }
 
+static void auth_request_cache_lookup_finish(struct auth_request *request)
+{
+	if (request->cache_lookup != NULL)
+		auth_cache_lookup_finish(passdb_cache, request);
+}
+
 void auth_request_passdb_lookup_begin(struct auth_request *request)
 {
 	struct event *event;
@@ -651,6 +666,9 @@ void auth_request_passdb_lookup_end(struct auth_request *request,
 	e_debug(e->event(), "Finished passdb lookup");
 	event_unref(&event);
 	array_pop_back(&request->authdb_event);
+
+	/* the result is in cache now, if it could be cached */
+	auth_request_cache_lookup_finish(request);
 }
 
 void auth_request_userdb_lookup_begin(struct auth_request *request)
@@ -1038,8 +1056,6 @@ void auth_request_default_verify_plain_continue(struct auth_request *request,
 						verify_plain_callback_t *callback)
 {
 	struct auth_passdb *passdb;
-	enum passdb_result result;
-	const char *cache_key, *error;
 	const char *password = request->mech_password;
 
 	i_assert(request->state == AUTH_REQUEST_STATE_MECH_CONTINUE);
@@ -1073,12 +1089,31 @@ void auth_request_default_verify_plain_continue(struct auth_request *request,
 
 	auth_request_passdb_lookup_begin(request);
 	request->private_callback.verify_plain = callback;
+	auth_request_verify_plain_lookup(request, TRUE);
+}
+
+static void auth_request_verify_plain_resume(struct auth_request *request)
+{
+	auth_request_verify_plain_lookup(request, FALSE);
+}
+
+static void
+auth_request_verify_plain_lookup(struct auth_request *request, bool coalesce)
+{
+	struct auth_passdb *passdb = request->passdb;
+	const char *password = request->mech_password;
+	enum passdb_result result;
+	const char *cache_key, *error;
 
 	cache_key = passdb_cache == NULL ? NULL : passdb->cache_key;
 	if (passdb_cache_verify_plain(request, cache_key, password,
 				      &result, FALSE)) {
 		return;
 	}
+	if (coalesce && cache_key != NULL &&
+	    auth_cache_lookup_wait(passdb_cache, request, cache_key, FALSE,
+				   auth_request_verify_plain_resume))
+		return;
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_PASSDB);
 	/* In case this request had already done a credentials lookup (is it
@@ -1228,8 +1263,6 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 						     lookup_credentials_callback_t *callback)
 {
 	struct auth_passdb *passdb;
-	const char *cache_key, *cache_cred, *cache_scheme, *error;
-	enum passdb_result result;
 
 	i_assert(request->state == AUTH_REQUEST_STATE_MECH_CONTINUE);
 	if (auth_request_is_disabled_master_user(request)) {
@@ -1251,6 +1284,22 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 
 	auth_request_passdb_lookup_begin(request);
 	request->private_callback.lookup_credentials = callback;
+	auth_request_lookup_credentials_lookup(request, TRUE);
+}
+
+static void
+auth_request_lookup_credentials_resume(struct auth_request *request)
+{
+	auth_request_lookup_credentials_lookup(request, FALSE);
+}
+
+static void
+auth_request_lookup_credentials_lookup(struct auth_request *request,
+				       bool coalesce)
+{
+	struct auth_passdb *passdb = request->passdb;
+	const char *cache_key, *cache_cred, *cache_scheme, *error;
+	enum passdb_result result;
 
 	cache_key = passdb_cache == NULL ? NULL : passdb->cache_key;
 	if (cache_key != NULL) {
@@ -1266,6 +1315,10 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 		} else {
 			request->passdb_cache_result = AUTH_REQUEST_CACHE_MISS;
 		}
+		if (coalesce &&
+		    auth_cache_lookup_wait(passdb_cache, request, cache_key,
+				FALSE, auth_request_lookup_credentials_resume))
+			return;
 	}
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_PASSDB);
@@ -1470,6 +1523,7 @@ void auth_request_userdb_callback(enum userdb_result result,
 			auth_fields_rollback(request->fields.userdb_reply);
 		}
 		request->user_changed_by_lookup = FALSE;
+		auth_request_cache_lookup_finish(request);
 
 		request->userdb = next_userdb;
 		auth_request_lookup_user(request,
@@ -1526,6 +1580,7 @@ void auth_request_userdb_callback(enum userdb_result result,
 				auth_request_get_log_prefix_db(request));
 		}
 	}
+	auth_request_cache_lookup_finish(request);
 
 	 request->private_callback.userdb(result, request);
 }
@@ -1534,7 +1589,7 @@ void auth_request_lookup_user(struct auth_request *request,
 			      userdb_callback_t *callback)
 {
 	struct auth_userdb *userdb = request->userdb;
-	const char *cache_key, *error;
+	const char *error;
 
 	request->private_callback.userdb = callback;
 	request->user_changed_by_lookup = FALSE;
@@ -1557,6 +1612,19 @@ void auth_request_lookup_user(struct auth_request *request,
 	}
 
 	auth_request_userdb_lookup_begin(request);
+	auth_request_lookup_user_lookup(request, TRUE);
+}
+
+static void auth_request_lookup_user_resume(struct auth_request *request)
+{
+	auth_request_lookup_user_lookup(request, FALSE);
+}
+
+static void
+auth_request_lookup_user_lookup(struct auth_request *request, bool coalesce)
+{
+	struct auth_userdb *userdb = request->userdb;
+	const char *cache_key;
 
 	/* (for now) auth_cache is shared between passdb and userdb */
 	cache_key = passdb_cache == NULL ? NULL : userdb->cache_key;
@@ -1571,6 +1639,10 @@ void auth_request_lookup_user(struct auth_request *request,
 		} else {
 			request->userdb_cache_result = AUTH_REQUEST_CACHE_MISS;
 		}
+		if (coalesce &&
+		    auth_cache_lookup_wait(passdb_cache, request, cache_key,
+					   TRUE, auth_request_lookup_user_resume))
+			return;
 	}
 
 	if (userdb->userdb->iface->lookup == NULL) {
@@ -167,6 +167,9 @@ struct auth_request {
 
 	enum auth_request_cache_result passdb_cache_result;
 	enum auth_request_cache_result userdb_cache_result;
+	/* Set while the request is doing a database lookup that other
+	   requests with the same cache key are waiting for. */
+	struct auth_cache_lookup *cache_lookup;
 
 	/* this is a lookup on auth socket (not login socket).
 	   skip any proxying stuff if enabled. */
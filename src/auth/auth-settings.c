@@ -273,6 +273,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SIZE, cache_size),
 	DEF(TIME, cache_ttl),
 	DEF(TIME, cache_negative_ttl),
+	DEF(UINT, cache_refresh_percentage),
 	DEF(BOOL, cache_verify_password_with_worker),
 	DEF(STR, username_chars),
 	DEF(STR, username_translation),
@@ -330,6 +331,7 @@ static const struct auth_settings auth_default_settings = {
 	.cache_size = 0,
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
+	.cache_refresh_percentage = 0,
 	.cache_verify_password_with_worker = FALSE,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
@@ -474,6 +476,10 @@ static bool auth_settings_check(void *_set, pool_t pool,
 					   set->cache_size);
 		return FALSE;
 	}
+	if (set->cache_refresh_percentage >= 100) {
+		*error_r = "auth_cache_refresh_percentage must be less than 100";
+		return FALSE;
+	}
 
 	if (!auth_verify_verbose_password(set, error_r))
 		return FALSE;
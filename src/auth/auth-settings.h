@@ -44,6 +44,7 @@ struct auth_settings {
 	uoff_t cache_size;
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
+	unsigned int cache_refresh_percentage;
 	bool cache_verify_password_with_worker;
 	const char *username_chars;
 	const char *username_translation;
@@ -30,6 +30,11 @@
 #define AUTH_WORKER_DELAY_WARN_SECS 3
 #define AUTH_WORKER_DELAY_WARN_MIN_INTERVAL_SECS (5*60)
 #define AUTH_WORKER_CONNECT_RETRY_TIMEOUT_MSECS (5*1000)
+/* When all the worker processes are busy, send up to this many requests to
+   a worker before it has replied to the earlier ones. Workers with
+   asynchronous passdbs/userdbs (e.g. SQL, LDAP) handle them concurrently,
+   others handle them one at a time just like they would from the queue. */
+#define AUTH_WORKER_MAX_PIPELINED_REQUESTS 8
 
 struct auth_worker_request {
 	unsigned int id;
@@ -43,7 +48,8 @@ struct auth_worker_request {
 struct auth_worker_connection {
 	struct connection conn;
 	struct timeout *to_lookup;
-	struct auth_worker_request *request;
+	/* Requests sent to the worker, in the order they were sent */
+	ARRAY(struct auth_worker_request *) requests;
 	unsigned int id_counter;
 
 	bool received_error:1;
@@ -68,7 +74,7 @@ static void auth_worker_deinit(struct auth_worker_connection **worker,
 
 static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 {
-	i_assert(worker->request == NULL);
+	i_assert(array_count(&worker->requests) == 0);
 
 	if (idle_count > 1)
 		auth_worker_deinit(&worker, NULL, FALSE);
@@ -78,7 +84,7 @@ static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 
 static void auth_worker_call_timeout(struct auth_worker_connection *worker)
 {
-	i_assert(worker->request != NULL);
+	i_assert(array_count(&worker->requests) > 0);
 
 	auth_worker_deinit(&worker, "Lookup timed out", TRUE);
 }
@@ -125,30 +131,57 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 
 	o_stream_nsendv(worker->conn.output, iov, 3);
 
-	i_assert(worker->request == NULL);
-	worker->request = request;
-
-	timeout_remove(&worker->to_lookup);
-	worker->to_lookup = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
-					auth_worker_call_timeout, worker);
+	if (array_count(&worker->requests) == 0) {
+		/* With pipelined requests the timeout keeps running until
+		   the worker stops making progress. */
+		timeout_remove(&worker->to_lookup);
+		worker->to_lookup =
+			timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+				    auth_worker_call_timeout, worker);
 
-	i_assert(idle_count > 0);
-	idle_count--;
+		i_assert(idle_count > 0);
+		idle_count--;
+	}
+	array_push_back(&worker->requests, &request);
 	return TRUE;
 }
 
+static bool auth_worker_request_can_pipeline(struct auth_worker_request *request)
+{
+	/* LIST replies are multi-line and use flow control, so they need
+	   the connection for themselves. */
+	return !str_begins_with(request->data, "LIST\t");
+}
+
+static bool
+auth_worker_can_send(struct auth_worker_connection *worker,
+		     struct auth_worker_request *request)
+{
+	struct auth_worker_request *first;
+	unsigned int count = array_count(&worker->requests);
+
+	if (count == 0)
+		return TRUE;
+	if (count >= AUTH_WORKER_MAX_PIPELINED_REQUESTS ||
+	    worker->received_error || worker->restart || worker->shutdown ||
+	    worker->resuming || !auth_worker_request_can_pipeline(request))
+		return FALSE;
+	first = array_idx_elem(&worker->requests, 0);
+	return auth_worker_request_can_pipeline(first);
+}
+
 static void auth_worker_request_send_next(struct auth_worker_connection *worker)
 {
 	struct auth_worker_request *request;
 
-	do {
-		if (aqueue_count(worker_request_queue) == 0)
-			return;
-
+	while (aqueue_count(worker_request_queue) > 0) {
 		request = array_idx_elem(&worker_request_array,
 					 aqueue_idx(worker_request_queue, 0));
+		if (!auth_worker_can_send(worker, request))
+			return;
 		aqueue_delete_tail(worker_request_queue);
-	} while (!auth_worker_request_send(worker, request));
+		(void)auth_worker_request_send(worker, request);
+	}
 }
 
 static int auth_worker_handshake_args(struct connection *conn,
@@ -246,6 +279,7 @@ static struct auth_worker_connection *auth_worker_create(void)
 	}
 
 	event_set_append_log_prefix(worker->conn.event, "auth-worker: ");
+	i_array_init(&worker->requests, AUTH_WORKER_MAX_PIPELINED_REQUESTS);
 
 	worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
 					auth_worker_idle_timeout, worker);
@@ -267,23 +301,32 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 		auth_workers_with_errors--;
 	}
 
-	if (worker->request == NULL)
+	if (array_count(&worker->requests) == 0)
 		idle_count--;
 	else {
-		e_error(worker->conn.event, "Aborted %s request for %s: %s",
-			t_strcut(worker->request->data, '\t'),
-			worker->request->username, reason);
 		const char *const args[] = {
 			"FAIL",
 			t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
 			NULL,
 		};
-		worker->request->callback(worker, args, worker->request->context);
+		struct auth_worker_request *request;
+
+		/* don't pipeline anything more to this worker from the
+		   callbacks */
+		worker->shutdown = TRUE;
+		array_foreach_elem(&worker->requests, request) {
+			e_error(worker->conn.event,
+				"Aborted %s request for %s: %s",
+				t_strcut(request->data, '\t'),
+				request->username, reason);
+			request->callback(worker, args, request->context);
+		}
 	}
 
 	timeout_remove(&worker->to_lookup);
 	connection_deinit(&worker->conn);
 
+	array_free(&worker->requests);
 	i_free(worker);
 
 	if (idle_count == 0 && restart) {
@@ -302,7 +345,7 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	while (conn != NULL) {
 		struct auth_worker_connection *worker =
 			container_of(conn, struct auth_worker_connection, conn);
-		if (worker->request == NULL)
+		if (array_count(&worker->requests) == 0)
 			return worker;
 
 		conn = conn->next;
@@ -311,10 +354,47 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	i_unreached();
 }
 
+static struct auth_worker_connection *
+auth_worker_find_pipeline(struct auth_worker_request *request)
+{
+	struct auth_worker_connection *best = NULL;
+	struct connection *conn;
+
+	/* pick the worker with the fewest pending requests */
+	for (conn = connections->connections; conn != NULL; conn = conn->next) {
+		struct auth_worker_connection *worker =
+			container_of(conn, struct auth_worker_connection, conn);
+
+		if (auth_worker_can_send(worker, request) &&
+		    (best == NULL || array_count(&worker->requests) <
+		     array_count(&best->requests)))
+			best = worker;
+	}
+	return best;
+}
+
+static bool
+auth_worker_request_find(struct auth_worker_connection *worker,
+			 unsigned int id, unsigned int *idx_r)
+{
+	struct auth_worker_request *const *requests;
+	unsigned int i, count;
+
+	requests = array_get(&worker->requests, &count);
+	for (i = 0; i < count; i++) {
+		if (requests[i]->id == id) {
+			*idx_r = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 static int auth_worker_request_handle(struct auth_worker_connection *worker,
-				      const char *const *args)
+				      unsigned int idx, const char *const *args)
 {
-	struct auth_worker_request *_request = worker->request;
+	struct auth_worker_request *_request =
+		array_idx_elem(&worker->requests, idx);
 
 	/* lines starting with '*' denote a multi-line request
 	   if they do, reset timeouts
@@ -330,12 +410,21 @@ static int auth_worker_request_handle(struct auth_worker_connection *worker,
 		}
 	} else {
 		worker->resuming = FALSE;
-		worker->request = NULL;
+		array_delete(&worker->requests, idx, 1);
 		worker->timeout_pending_resume = FALSE;
 		timeout_remove(&worker->to_lookup);
-		worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
-						auth_worker_idle_timeout, worker);
-		idle_count++;
+		if (array_count(&worker->requests) > 0) {
+			/* the worker is making progress, restart the lookup
+			   timeout for the pipelined requests */
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+					    auth_worker_call_timeout, worker);
+		} else {
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
+					    auth_worker_idle_timeout, worker);
+			idle_count++;
+		}
 	}
 
 	if (!_request->callback(worker, args, _request->context)) {
@@ -417,13 +506,14 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 	}
 
 	int ret = 0;
-	if (worker->request != NULL && id == worker->request->id)
-		 ret = auth_worker_request_handle(worker, args + 1);
+	unsigned int idx;
+	if (auth_worker_request_find(worker, id, &idx))
+		 ret = auth_worker_request_handle(worker, idx, args + 1);
 	else {
-		if (worker->request != NULL) {
+		if (array_count(&worker->requests) > 0) {
 			e_error(conn->event,
 				"BUG: Worker sent reply with id %u, "
-				"expected %u", id, worker->request->id);
+				"which isn't pending", id);
 		} else {
 			e_error(conn->event,
 				"BUG: Worker sent reply with id %u, "
@@ -433,8 +523,9 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 		return -1;
 	}
 
-	if (worker->request != NULL) {
-		/* there's still a pending request */
+	if (array_count(&worker->requests) > 0 &&
+	    (ret < 0 || worker->restart || worker->shutdown)) {
+		/* there are still pending requests */
 	} else if (worker->restart) {
 		auth_worker_deinit(&worker, "Max requests limit", TRUE);
 		ret = 0;
@@ -501,6 +592,11 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 			/* no free connections, create a new one */
 			worker = auth_worker_create();
 		}
+		if (worker == NULL) {
+			/* all workers are busy, send it to one of them
+			   already before the earlier requests finish */
+			worker = auth_worker_find_pipeline(request);
+		}
 	}
 	if (worker != NULL) {
 		if (!auth_worker_request_send(worker, request))
@@ -513,7 +609,7 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 
 void auth_worker_connection_resume_input(struct auth_worker_connection *worker)
 {
-	if (worker->request == NULL) {
+	if (array_count(&worker->requests) == 0) {
 		/* request was just finished, don't try to resume it */
 		return;
 	}
@@ -0,0 +1,336 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "base64.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "randgen.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "dsasl-client.h"
+#include "auth-client.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define BENCH_AUTH_DEFAULT_SOCKET_PATH PKG_RUNDIR"/auth-client"
+#define BENCH_AUTH_CONNECT_TIMEOUT_MSECS (10*1000)
+
+/**
+ * Load generator for a running auth process. It connects to the auth-client
+ * socket the same way as the login processes do, and runs the given number
+ * of SASL authentications with a fixed number of them in parallel. The
+ * passdb backend (passwd-file, sql, static, ...) is whatever the running
+ * auth process is configured with - all the users are named
+ * <user prefix><number> and use the same password (or OAuth2 token).
+ *
+ * The cache hit ratio is the percentage of the logins that reuse a user that
+ * has already logged in, so that with auth_cache_size set the lookups are
+ * answered from the auth cache. The rest of the logins use users that
+ * haven't been seen before.
+ */
+
+struct bench_ctx {
+	const char *socket_path;
+	const struct dsasl_client_mech *mech;
+	const char *user_prefix;
+	const char *password;
+	unsigned int request_count;
+	unsigned int parallel_count;
+	unsigned int user_count;
+	unsigned int cache_hit_percent;
+
+	struct auth_client *client;
+	unsigned int started_count, finished_count, users_used;
+	unsigned int success_count, fail_count, internal_fail_count;
+	ARRAY(uint64_t) latencies;
+	bool connected;
+};
+
+struct bench_request {
+	struct bench_ctx *ctx;
+	struct dsasl_client *sasl_client;
+	uint64_t ts_start;
+};
+
+static void bench_request_start(struct bench_ctx *ctx);
+
+static const char *bench_next_username(struct bench_ctx *ctx)
+{
+	unsigned int user_idx;
+
+	if (ctx->users_used > 0 &&
+	    (ctx->users_used == ctx->user_count ||
+	     i_rand_limit(100) < ctx->cache_hit_percent))
+		user_idx = i_rand_limit(ctx->users_used);
+	else
+		user_idx = ctx->users_used++;
+	return t_strdup_printf("%s%u", ctx->user_prefix, user_idx + 1);
+}
+
+static void bench_request_finish(struct bench_request *request,
+				 enum auth_request_status status)
+{
+	struct bench_ctx *ctx = request->ctx;
+	uint64_t latency = i_nanoseconds() - request->ts_start;
+
+	switch (status) {
+	case AUTH_REQUEST_STATUS_OK:
+		ctx->success_count++;
+		break;
+	case AUTH_REQUEST_STATUS_FAIL:
+		ctx->fail_count++;
+		break;
+	case AUTH_REQUEST_STATUS_INTERNAL_FAIL:
+	case AUTH_REQUEST_STATUS_ABORT:
+		ctx->internal_fail_count++;
+		break;
+	case AUTH_REQUEST_STATUS_CONTINUE:
+		i_unreached();
+	}
+	array_push_back(&ctx->latencies, &latency);
+
+	dsasl_client_free(&request->sasl_client);
+	i_free(request);
+
+	ctx->finished_count++;
+	if (ctx->started_count < ctx->request_count)
+		bench_request_start(ctx);
+	else if (ctx->finished_count == ctx->request_count)
+		io_loop_stop(current_ioloop);
+}
+
+static const char *
+bench_request_sasl_output(struct bench_request *request)
+{
+	const unsigned char *output;
+	size_t output_len;
+	string_t *str;
+	const char *error;
+
+	if (dsasl_client_output(request->sasl_client, &output, &output_len,
+				&error) < 0)
+		i_fatal("SASL client failed: %s", error);
+	str = t_str_new(MAX_BASE64_ENCODED_SIZE(output_len));
+	base64_encode(output, output_len, str);
+	return str_c(str);
+}
+
+static void
+bench_request_callback(struct auth_client_request *client_request,
+		       enum auth_request_status status,
+		       const char *data_base64,
+		       const char *const *args ATTR_UNUSED, void *context)
+{
+	struct bench_request *request = context;
+	const char *error;
+	buffer_t *buf;
+
+	if (status != AUTH_REQUEST_STATUS_CONTINUE) {
+		bench_request_finish(request, status);
+		return;
+	}
+
+	buf = t_base64_decode_str(data_base64);
+	if (dsasl_client_input(request->sasl_client, buf->data, buf->used,
+			       &error) < 0)
+		i_fatal("SASL client failed: %s", error);
+	auth_client_request_continue(client_request,
+		bench_request_sasl_output(request));
+}
+
+static void bench_request_start(struct bench_ctx *ctx)
+{
+	struct bench_request *request;
+	struct auth_request_info info;
+	struct dsasl_client_settings sasl_set;
+
+	request = i_new(struct bench_request, 1);
+	request->ctx = ctx;
+
+	i_zero(&sasl_set);
+	sasl_set.authid = bench_next_username(ctx);
+	sasl_set.password = ctx->password;
+	request->sasl_client = dsasl_client_new(ctx->mech, &sasl_set);
+
+	i_zero(&info);
+	info.mech = dsasl_client_mech_get_name(ctx->mech);
+	info.service = "bench";
+	info.flags = AUTH_REQUEST_FLAG_CONN_SECURED |
+		AUTH_REQUEST_FLAG_NO_PENALTY |
+		AUTH_REQUEST_FLAG_SUPPORT_FINAL_RESP;
+	if (net_addr2ip("127.0.0.1", &info.remote_ip) < 0)
+		i_unreached();
+	info.local_ip = info.remote_ip;
+	info.initial_resp_base64 = bench_request_sasl_output(request);
+
+	ctx->started_count++;
+	request->ts_start = i_nanoseconds();
+	(void)auth_client_request_new(ctx->client, &info,
+				      bench_request_callback, request);
+}
+
+static void
+bench_connect_notify(struct auth_client *client ATTR_UNUSED,
+		     bool connected, void *context)
+{
+	struct bench_ctx *ctx = context;
+
+	if (connected) {
+		ctx->connected = TRUE;
+		io_loop_stop(current_ioloop);
+	} else if (!ctx->connected) {
+		i_fatal("Couldn't connect to auth socket %s", ctx->socket_path);
+	} else if (ctx->finished_count < ctx->request_count) {
+		i_fatal("Disconnected from auth socket %s", ctx->socket_path);
+	}
+}
+
+static int bench_latency_cmp(const uint64_t *l1, const uint64_t *l2)
+{
+	if (*l1 < *l2)
+		return -1;
+	return *l1 > *l2 ? 1 : 0;
+}
+
+static double bench_latency_percentile(struct bench_ctx *ctx,
+				       unsigned int percentile)
+{
+	unsigned int count = array_count(&ctx->latencies);
+	unsigned int idx = (count * percentile + 99) / 100;
+
+	if (idx > 0)
+		idx--;
+	return (double)array_idx_elem(&ctx->latencies, idx) / 1000.0;
+}
+
+static void bench_print(struct bench_ctx *ctx, uint64_t ts_0, uint64_t ts_1)
+{
+	double usecs = (double)(ts_1 - ts_0) / 1000.0;
+
+	array_sort(&ctx->latencies, bench_latency_cmp);
+	printf("%s logins\n\tTotal: %0.02lf ms\n\t%0.01lf logins/s\n"
+	       "\t%u succeeded, %u failed, %u internal failures\n"
+	       "\tlatency: p50 %0.03lf ms, p90 %0.03lf ms, "
+	       "p99 %0.03lf ms, max %0.03lf ms\n\n",
+	       dsasl_client_mech_get_name(ctx->mech), usecs / 1000.0,
+	       usecs == 0 ? 0 : (double)ctx->request_count * 1000000.0 / usecs,
+	       ctx->success_count, ctx->fail_count, ctx->internal_fail_count,
+	       bench_latency_percentile(ctx, 50) / 1000.0,
+	       bench_latency_percentile(ctx, 90) / 1000.0,
+	       bench_latency_percentile(ctx, 99) / 1000.0,
+	       bench_latency_percentile(ctx, 100) / 1000.0);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-a auth socket path] [-m mech] "
+		"[-u user prefix] [-p password] [-n logins] [-c parallel] "
+		"[-U users] [-h cache hit %%]\n", prog);
+	fprintf(stderr, "Runs 10000 PLAIN logins for users user1..user1000 "
+		"with password \"pass\", 10 in parallel and 90%% of them for "
+		"already seen users, against %s if nothing given\n",
+		BENCH_AUTH_DEFAULT_SOCKET_PATH);
+	fprintf(stderr, "With OAUTHBEARER and XOAUTH2 the password is used "
+		"as the token\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_ctx ctx = {
+		.socket_path = BENCH_AUTH_DEFAULT_SOCKET_PATH,
+		.user_prefix = "user",
+		.password = "pass",
+		.request_count = 10000,
+		.parallel_count = 10,
+		.user_count = 1000,
+		.cache_hit_percent = 90,
+	};
+	const char *mech_name = "PLAIN";
+	struct ioloop *ioloop;
+	uint64_t ts_0, ts_1;
+	int c;
+
+	lib_init();
+	dsasl_clients_init();
+
+	while ((c = getopt(argc, argv, "a:m:u:p:n:c:U:h:")) > 0) {
+		switch (c) {
+		case 'a':
+			ctx.socket_path = optarg;
+			break;
+		case 'm':
+			mech_name = t_str_ucase(optarg);
+			break;
+		case 'u':
+			ctx.user_prefix = optarg;
+			break;
+		case 'p':
+			ctx.password = optarg;
+			break;
+		case 'n':
+			if (str_to_uint(optarg, &ctx.request_count) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'c':
+			if (str_to_uint(optarg, &ctx.parallel_count) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'U':
+			if (str_to_uint(optarg, &ctx.user_count) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'h':
+			if (str_to_uint(optarg, &ctx.cache_hit_percent) < 0 ||
+			    ctx.cache_hit_percent > 100)
+				print_usage(argv[0]);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (optind != argc || ctx.request_count == 0 ||
+	    ctx.parallel_count == 0 || ctx.user_count == 0)
+		print_usage(argv[0]);
+	ctx.mech = dsasl_client_mech_find(mech_name);
+	if (ctx.mech == NULL)
+		i_fatal("Unsupported SASL mechanism: %s", mech_name);
+
+	ioloop = io_loop_create();
+	i_array_init(&ctx.latencies, ctx.request_count);
+	ctx.client = auth_client_init(ctx.socket_path, getpid(), FALSE);
+	auth_client_set_connect_timeout(ctx.client,
+					BENCH_AUTH_CONNECT_TIMEOUT_MSECS);
+	auth_client_set_connect_notify(ctx.client, bench_connect_notify, &ctx);
+	auth_client_connect(ctx.client);
+	if (auth_client_is_disconnected(ctx.client))
+		i_fatal("Couldn't connect to auth socket %s", ctx.socket_path);
+	if (!auth_client_is_connected(ctx.client))
+		io_loop_run(ioloop);
+	if (auth_client_find_mech(ctx.client, mech_name) == NULL)
+		i_fatal("Auth process doesn't support mechanism %s", mech_name);
+
+	printf("%u logins for %u users with %u%% cache hit ratio, "
+	       "%u in parallel\n\n", ctx.request_count, ctx.user_count,
+	       ctx.cache_hit_percent, ctx.parallel_count);
+
+	ts_0 = i_nanoseconds();
+	for (unsigned int i = 0; i < ctx.parallel_count &&
+	     ctx.started_count < ctx.request_count; i++) T_BEGIN {
+		bench_request_start(&ctx);
+	} T_END;
+	io_loop_run(ioloop);
+	ts_1 = i_nanoseconds();
+
+	bench_print(&ctx, ts_0, ts_1);
+
+	auth_client_deinit(&ctx.client);
+	array_free(&ctx.latencies);
+	io_loop_destroy(&ioloop);
+	dsasl_clients_deinit();
+	lib_deinit();
+	return 0;
+}
@@ -123,6 +123,7 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(pass_filter),
 	DEF_STR(iterate_attrs),
 	DEF_STR(iterate_filter),
+	DEF_INT(iterate_page_size),
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
@@ -160,6 +161,7 @@ static struct ldap_settings default_ldap_settings = {
 	.pass_filter = "(&(objectClass=posixAccount)(uid=%u))",
 	.iterate_attrs = "uid=user",
 	.iterate_filter = "(objectClass=posixAccount)",
+	.iterate_page_size = 0,
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
 	.blocking = FALSE
@@ -168,6 +170,10 @@ static struct ldap_settings default_ldap_settings = {
 static struct ldap_connection *ldap_connections = NULL;
 
 static int db_ldap_bind(struct ldap_connection *conn);
+static void
+db_ldap_request_coalesced_callback(struct ldap_connection *conn,
+				   struct ldap_request *request,
+				   LDAPMessage *entry, LDAPMessage *res);
 static void db_ldap_conn_close(struct ldap_connection *conn);
 struct db_ldap_result_iterate_context *
 db_ldap_result_iterate_init_full(struct ldap_connection *conn,
@@ -342,6 +348,30 @@ static int db_ldap_request_search(struct ldap_connection *conn,
 	i_assert(conn->conn_state == LDAP_CONN_STATE_BOUND_DEFAULT);
 	i_assert(request->msgid == -1);
 
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+	if (srequest->multi_entry && conn->set.iterate_page_size > 0) {
+		LDAPControl *page_ctrl, *ctrls[2];
+		int ret;
+
+		/* The control isn't critical, so servers not supporting it
+		   simply return all the results at once. */
+		ret = ldap_create_page_control(conn->ld,
+			conn->set.iterate_page_size, srequest->page_cookie,
+			0, &page_ctrl);
+		if (ret == LDAP_SUCCESS) {
+			ctrls[0] = page_ctrl;
+			ctrls[1] = NULL;
+			ret = ldap_search_ext(conn->ld,
+				*srequest->base == '\0' ? NULL :
+				srequest->base, conn->set.ldap_scope,
+				srequest->filter, srequest->attributes, 0,
+				ctrls, NULL, NULL, 0, &request->msgid);
+			ldap_control_free(page_ctrl);
+		}
+		if (ret != LDAP_SUCCESS)
+			request->msgid = -1;
+	} else
+#endif
 	request->msgid =
 		ldap_search(conn->ld, *srequest->base == '\0' ? NULL :
 			    srequest->base, conn->set.ldap_scope,
@@ -436,6 +466,7 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 	} else {
 		/* broken request, remove from queue */
 		aqueue_delete_tail(conn->request_queue);
+		db_ldap_request_coalesced_callback(conn, request, NULL, NULL);
 		request->callback(conn, request, NULL);
 		return TRUE;
 	}
@@ -462,9 +493,79 @@ db_ldap_check_hanging(struct ldap_connection *conn)
 	}
 }
 
+static bool
+db_ldap_search_can_coalesce(const struct ldap_request_search *request)
+{
+	const struct ldap_field *field;
+
+	/* The results of the searches doing further lookups for DN fields
+	   are request specific. */
+	if (request->multi_entry)
+		return FALSE;
+	array_foreach(request->attr_map, field) {
+		if (field->value_is_dn)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static struct ldap_request_search *
+db_ldap_find_coalesce_request(struct ldap_connection *conn,
+			      const struct ldap_request_search *request)
+{
+	struct ldap_request *const *requests, *queued;
+	struct ldap_request_search *srequest;
+	unsigned int i, count;
+
+	if (!db_ldap_search_can_coalesce(request))
+		return NULL;
+
+	requests = array_front(&conn->request_array);
+	count = aqueue_count(conn->request_queue);
+	for (i = 0; i < count; i++) {
+		queued = requests[aqueue_idx(conn->request_queue, i)];
+		if (queued->type != LDAP_REQUEST_TYPE_SEARCH || queued->failed)
+			continue;
+		srequest = (struct ldap_request_search *)queued;
+		if (!srequest->multi_entry &&
+		    srequest->attributes == request->attributes &&
+		    srequest->attr_map == request->attr_map &&
+		    strcmp(srequest->base, request->base) == 0 &&
+		    strcmp(srequest->filter, request->filter) == 0)
+			return srequest;
+	}
+	return NULL;
+}
+
+static void
+db_ldap_request_coalesced_callback(struct ldap_connection *conn,
+				   struct ldap_request *request,
+				   LDAPMessage *entry, LDAPMessage *res)
+{
+	struct ldap_request_search *srequest, *coalesced;
+
+	if (request->type != LDAP_REQUEST_TYPE_SEARCH)
+		return;
+	srequest = (struct ldap_request_search *)request;
+	if (!array_is_created(&srequest->coalesced_requests))
+		return;
+
+	/* the request is already removed from the queue, so nothing more
+	   gets added to the array by the callbacks */
+	array_foreach_elem(&srequest->coalesced_requests, coalesced) {
+		if (entry != NULL)
+			coalesced->request.callback(conn, &coalesced->request,
+						    entry);
+		coalesced->request.callback(conn, &coalesced->request, res);
+	}
+	array_clear(&srequest->coalesced_requests);
+}
+
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request)
 {
+	struct ldap_request_search *srequest, *queued;
+
 	i_assert(request->auth_request != NULL);
 
 	request->msgid = -1;
@@ -472,6 +573,24 @@ void db_ldap_request(struct ldap_connection *conn,
 
 	db_ldap_check_hanging(conn);
 
+	if (request->type == LDAP_REQUEST_TYPE_SEARCH) {
+		srequest = (struct ldap_request_search *)request;
+		queued = db_ldap_find_coalesce_request(conn, srequest);
+		if (queued != NULL) {
+			/* an identical search is already in the queue */
+			e_debug(authdb_event(request->auth_request),
+				"Using the results of an identical LDAP search "
+				"already in progress");
+			if (!array_is_created(&queued->coalesced_requests)) {
+				p_array_init(&queued->coalesced_requests,
+					     queued->request.auth_request->pool,
+					     4);
+			}
+			array_push_back(&queued->coalesced_requests, &srequest);
+			return;
+		}
+	}
+
 	aqueue_append(conn->request_queue, &request);
 	(void)db_ldap_request_queue_next(conn);
 }
@@ -544,6 +663,7 @@ static bool db_ldap_abort_requests(struct ldap_connection *conn,
 			e_info(authdb_event(request->auth_request),
 			       "%s", reason);
 		}
+		db_ldap_request_coalesced_callback(conn, request, NULL, NULL);
 		request->callback(conn, request, NULL);
 		max_count--;
 		aborts = TRUE;
@@ -760,6 +880,67 @@ static int db_ldap_search_next_subsearch(struct ldap_connection *conn,
 	return 0;
 }
 
+static int
+db_ldap_search_next_page(struct ldap_connection *conn,
+			 struct ldap_request_search *request,
+			 struct db_ldap_result *res)
+{
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+	struct auth_request *auth_request = request->request.auth_request;
+	LDAPControl **ctrls = NULL, *page_ctrl;
+	struct berval cookie;
+	ber_int_t count;
+	int ret;
+
+	if (conn->set.iterate_page_size == 0)
+		return 0;
+
+	ret = ldap_parse_result(conn->ld, res->msg, NULL, NULL, NULL, NULL,
+				&ctrls, 0);
+	if (ret != LDAP_SUCCESS || ctrls == NULL)
+		return 0;
+	page_ctrl = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, ctrls, NULL);
+	i_zero(&cookie);
+	if (page_ctrl != NULL) {
+		ret = ldap_parse_pageresponse_control(conn->ld, page_ctrl,
+						      &count, &cookie);
+	}
+	ldap_controls_free(ctrls);
+	if (page_ctrl == NULL)
+		return 0;
+	if (ret != LDAP_SUCCESS) {
+		e_error(authdb_event(auth_request),
+			"ldap_search(base=%s filter=%s) failed: "
+			"Invalid paged results control: %s",
+			request->base, request->filter, ldap_err2string(ret));
+		return -1;
+	}
+	if (cookie.bv_len == 0) {
+		/* this was the last page */
+		ber_memfree(cookie.bv_val);
+		return 0;
+	}
+
+	/* Keep the cookie in the request's pool, so it doesn't need to be
+	   freed if the request is aborted. */
+	request->page_cookie = p_new(auth_request->pool, struct berval, 1);
+	request->page_cookie->bv_len = cookie.bv_len;
+	request->page_cookie->bv_val =
+		p_memdup(auth_request->pool, cookie.bv_val, cookie.bv_len);
+	ber_memfree(cookie.bv_val);
+
+	/* each page is a new request to the server, so don't treat the
+	   whole iteration as hanging */
+	request->request.create_time = ioloop_time;
+	request->request.msgid = -1;
+	if (db_ldap_request_search(conn, &request->request) <= 0)
+		return -1;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 static bool
 db_ldap_handle_request_result(struct ldap_connection *conn,
 			      struct ldap_request *request, unsigned int idx,
@@ -847,12 +1028,32 @@ db_ldap_handle_request_result(struct ldap_connection *conn,
 	}
 	if (request->failed)
 		res = NULL;
+	if (final_result && res != NULL && srequest != NULL &&
+	    srequest->multi_entry) {
+		switch (db_ldap_search_next_page(conn, srequest, res)) {
+		case 1:
+			/* continuing with the next page */
+			return FALSE;
+		case 0:
+			break;
+		default:
+			res = NULL;
+			break;
+		}
+	}
 	if (final_result) {
 		conn->pending_count--;
 		aqueue_delete(conn->request_queue, idx);
 	}
 
 	T_BEGIN {
+		if (final_result) {
+			db_ldap_request_coalesced_callback(conn, request,
+				res != NULL && srequest != NULL &&
+				srequest->result != NULL ?
+				srequest->result->msg : NULL,
+				res == NULL ? NULL : res->msg);
+		}
 		if (res != NULL && srequest != NULL && srequest->result != NULL)
 			request->callback(conn, request, srequest->result->msg);
 
@@ -891,6 +1092,7 @@ db_ldap_request_free(struct ldap_request *request)
 
 		if (srequest->result != NULL)
 			db_ldap_result_unref(&srequest->result);
+		srequest->page_cookie = NULL;
 
 		if (array_is_created(&srequest->named_results)) {
 			array_foreach_modifiable(&srequest->named_results, named_res) {
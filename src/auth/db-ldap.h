@@ -64,6 +64,7 @@ struct ldap_settings {
 	const char *pass_filter;
 	const char *iterate_attrs;
 	const char *iterate_filter;
+	unsigned int iterate_page_size;
 
 	const char *default_pass_scheme;
 	bool userdb_warning_disable; /* deprecated for now at least */
@@ -135,6 +136,12 @@ struct ldap_request_search {
 	struct db_ldap_result *result;
 	ARRAY(struct ldap_request_named_result) named_results;
 	unsigned int name_idx;
+	/* Identical searches requested while this one was in the queue.
+	   They're not sent to the server, but get the same results. */
+	ARRAY(struct ldap_request_search *) coalesced_requests;
+	/* Paged results cookie for requesting the next page of
+	   multi_entry results, or NULL for the first page. */
+	struct berval *page_cookie;
 
 	bool multi_entry;
 };
@@ -3,6 +3,10 @@
 #include "auth-common.h"
 #include "array.h"
 #include "str.h"
+#include "hash.h"
+#include "hex-binary.h"
+#include "sha2.h"
+#include "ioloop.h"
 #include "var-expand.h"
 #include "env-util.h"
 #include "var-expand.h"
@@ -22,6 +26,9 @@
 
 #include <stddef.h>
 
+/* Upper limit for the number of cached token validation results */
+#define DB_OAUTH2_TOKEN_CACHE_MAX_ENTRIES 10000
+
 struct passdb_oauth2_settings {
 	/* tokeninfo endpoint, format https://endpoint/somewhere?token= */
 	const char *tokeninfo_url;
@@ -77,6 +84,9 @@ struct passdb_oauth2_settings {
 	unsigned int max_idle_time_msecs;
 	unsigned int max_parallel_connections;
 	unsigned int max_pipelined_requests;
+	/* Max time to cache successful token validation results, 0 = no
+	   caching. Results are never cached past the token's expiration. */
+	unsigned int token_cache_max_secs;
 	bool tls_allow_invalid_cert;
 
 	bool debug;
@@ -87,6 +97,12 @@ struct passdb_oauth2_settings {
 	bool use_grant_password;
 };
 
+struct db_oauth2_token_cache_entry {
+	pool_t pool;
+	time_t expires;
+	ARRAY_TYPE(oauth2_field) fields;
+};
+
 struct db_oauth2 {
 	struct db_oauth2 *prev,*next;
 
@@ -99,6 +115,8 @@ struct db_oauth2 {
 	struct oauth2_settings oauth2_set;
 
 	struct db_oauth2_request *head;
+	/* sha256(token) => struct db_oauth2_token_cache_entry */
+	HASH_TABLE(char *, struct db_oauth2_token_cache_entry *) token_cache;
 
 	unsigned int refcount;
 };
@@ -134,6 +152,7 @@ static struct setting_def setting_defs[] = {
 	DEF_INT(max_idle_time_msecs),
 	DEF_INT(max_parallel_connections),
 	DEF_INT(max_pipelined_requests),
+	DEF_INT(token_cache_max_secs),
 	DEF_BOOL(send_auth_headers),
 	DEF_BOOL(use_grant_password),
 
@@ -173,6 +192,7 @@ static struct passdb_oauth2_settings default_oauth2_settings = {
 	.max_idle_time_msecs = 60000,
 	.max_parallel_connections = 10,
 	.max_pipelined_requests = 1,
+	.token_cache_max_secs = 0,
 	.tls_ca_cert_file = NULL,
 	.tls_ca_cert_dir = NULL,
 	.tls_cert_file = NULL,
@@ -305,6 +325,12 @@ struct db_oauth2 *db_oauth2_init(const char *config_path)
 		(void)dcrypt_initialize(NULL, NULL, &error);
 		/* initialize key cache */
 		db->oauth2_set.key_cache = oauth2_validation_key_cache_init();
+	} else if (db->set.token_cache_max_secs > 0 &&
+		   !db->set.use_grant_password) {
+		/* Tokens validated by a remote server can be cached. Local
+		   validation doesn't need a network round trip anyway. */
+		hash_table_create(&db->token_cache, default_pool, 0,
+				  str_hash, strcmp);
 	}
 
 	if (*db->set.issuers != '\0')
@@ -326,6 +352,117 @@ struct db_oauth2 *db_oauth2_init(const char *config_path)
 	return db;
 }
 
+static void db_oauth2_token_cache_clear(struct db_oauth2 *db)
+{
+	struct hash_iterate_context *iter;
+	struct db_oauth2_token_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(db->token_cache);
+	while (hash_table_iterate(iter, db->token_cache, &key, &entry)) {
+		i_free(key);
+		pool_unref(&entry->pool);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(db->token_cache, FALSE);
+}
+
+static void db_oauth2_token_cache_purge_expired(struct db_oauth2 *db)
+{
+	struct hash_iterate_context *iter;
+	struct db_oauth2_token_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(db->token_cache);
+	while (hash_table_iterate(iter, db->token_cache, &key, &entry)) {
+		if (entry->expires > ioloop_time)
+			continue;
+		hash_table_remove(db->token_cache, key);
+		i_free(key);
+		pool_unref(&entry->pool);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static const char *db_oauth2_token_cache_key(const char *token)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+
+	/* don't keep the tokens themselves in memory */
+	sha256_get_digest(token, strlen(token), digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+static void db_oauth2_token_cache_add(struct db_oauth2_request *req)
+{
+	struct db_oauth2 *db = req->db;
+	struct db_oauth2_token_cache_entry *entry;
+	const ARRAY_TYPE(auth_field) *fields;
+	const struct auth_field *field;
+	struct oauth2_field *cfield;
+	const char *key;
+	char *orig_key;
+	time_t expires;
+
+	if (!hash_table_is_created(db->token_cache) || req->token == NULL ||
+	    req->fields == NULL || req->from_token_cache)
+		return;
+
+	expires = ioloop_time + db->set.token_cache_max_secs;
+	if (req->expires_at != 0 && req->expires_at < expires)
+		expires = req->expires_at;
+	if (expires <= ioloop_time)
+		return;
+
+	key = db_oauth2_token_cache_key(req->token);
+	if (hash_table_lookup_full(db->token_cache, key, &orig_key, &entry)) {
+		hash_table_remove(db->token_cache, key);
+		i_free(orig_key);
+		pool_unref(&entry->pool);
+	} else if (hash_table_count(db->token_cache) >=
+		   DB_OAUTH2_TOKEN_CACHE_MAX_ENTRIES) {
+		db_oauth2_token_cache_purge_expired(db);
+		if (hash_table_count(db->token_cache) >=
+		    DB_OAUTH2_TOKEN_CACHE_MAX_ENTRIES)
+			return;
+	}
+
+	pool_t pool = pool_alloconly_create("oauth2 token cache entry", 512);
+	entry = p_new(pool, struct db_oauth2_token_cache_entry, 1);
+	entry->pool = pool;
+	entry->expires = expires;
+	fields = auth_fields_export(req->fields);
+	p_array_init(&entry->fields, pool, array_count(fields));
+	array_foreach(fields, field) {
+		cfield = array_append_space(&entry->fields);
+		cfield->name = p_strdup(pool, field->key);
+		cfield->value = p_strdup(pool, field->value);
+	}
+	hash_table_insert(db->token_cache, i_strdup(key), entry);
+}
+
+static struct db_oauth2_token_cache_entry *
+db_oauth2_token_cache_lookup(struct db_oauth2 *db, const char *token)
+{
+	struct db_oauth2_token_cache_entry *entry;
+	const char *key;
+	char *orig_key;
+
+	if (!hash_table_is_created(db->token_cache))
+		return NULL;
+
+	key = db_oauth2_token_cache_key(token);
+	if (!hash_table_lookup_full(db->token_cache, key, &orig_key, &entry))
+		return NULL;
+	if (entry->expires <= ioloop_time) {
+		hash_table_remove(db->token_cache, key);
+		i_free(orig_key);
+		pool_unref(&entry->pool);
+		return NULL;
+	}
+	return entry;
+}
+
 void db_oauth2_ref(struct db_oauth2 *db)
 {
 	i_assert(db->refcount > 0);
@@ -352,6 +489,10 @@ void db_oauth2_unref(struct db_oauth2 **_db)
 	while (db->head != NULL)
 		oauth2_request_abort(&db->head->req);
 
+	if (hash_table_is_created(db->token_cache)) {
+		db_oauth2_token_cache_clear(db);
+		hash_table_destroy(&db->token_cache);
+	}
 	http_client_deinit(&db->client);
 	if (db->oauth2_set.key_dict != NULL)
 		dict_deinit(&db->oauth2_set.key_dict);
@@ -530,6 +671,15 @@ db_oauth2_field_find(const ARRAY_TYPE(oauth2_field) *fields, const char *name)
 	return NULL;
 }
 
+static void
+db_oauth2_set_expires(struct db_oauth2_request *req, time_t expires_at)
+{
+	/* with multiple lookups use the earliest expiration */
+	if (expires_at != 0 &&
+	    (req->expires_at == 0 || expires_at < req->expires_at))
+		req->expires_at = expires_at;
+}
+
 static void db_oauth2_callback(struct db_oauth2_request *req,
 			       enum passdb_result result,
 			       const char *error_prefix, const char *error)
@@ -541,6 +691,8 @@ static void db_oauth2_callback(struct db_oauth2_request *req,
 
 	if (result != PASSDB_RESULT_OK)
 		db_oauth2_add_openid_config_url(req);
+	else
+		db_oauth2_token_cache_add(req);
 
 	/* Successful lookups were logged by the caller. Failed lookups will be
 	   logged either with e_error() or e_info() by the callback. */
@@ -674,6 +826,7 @@ db_oauth2_introspect_continue(struct oauth2_request_result *result,
 	} else {
 		e_debug(authdb_event(req->auth_request),
 			"Introspection succeeded");
+		db_oauth2_set_expires(req, result->expires_at);
 		db_oauth2_fields_merge(req, result->fields);
 		db_oauth2_process_fields(req, &passdb_result, &error);
 	}
@@ -773,6 +926,7 @@ db_oauth2_lookup_continue(struct oauth2_request_result *result,
 	} else {
 		e_debug(authdb_event(req->auth_request),
 			"Token validation succeeded");
+		db_oauth2_set_expires(req, result->expires_at);
 		db_oauth2_lookup_continue_valid(req, result->fields,
 						"Token validation failed: ");
 	}
@@ -819,6 +973,27 @@ db_oauth2_lookup_passwd_grant(struct oauth2_request_result *result,
 			   "Password grant failed: ", error);
 }
 
+static bool db_oauth2_lookup_cached(struct db_oauth2_request *req)
+{
+	struct db_oauth2_token_cache_entry *entry;
+	enum passdb_result passdb_result;
+	const char *error;
+
+	entry = db_oauth2_token_cache_lookup(req->db, req->token);
+	if (entry == NULL)
+		return FALSE;
+
+	e_debug(authdb_event(req->auth_request),
+		"Using cached token validation result");
+	req->from_token_cache = TRUE;
+	DLLIST_PREPEND(&req->db->head, req);
+	db_oauth2_fields_merge(req, &entry->fields);
+	db_oauth2_process_fields(req, &passdb_result, &error);
+	db_oauth2_callback(req, passdb_result,
+			   "Cached token validation failed: ", error);
+	return TRUE;
+}
+
 #undef db_oauth2_lookup
 void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 		      const char *token, struct auth_request *request,
@@ -844,6 +1019,8 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 	input.real_remote_port = req->auth_request->fields.real_remote_port;
 	input.service = req->auth_request->fields.service;
 
+	if (db_oauth2_lookup_cached(req))
+		return;
 	if (db->oauth2_set.introspection_mode == INTROSPECTION_MODE_LOCAL &&
 	    !db_oauth2_uses_password_grant(db)) {
 		/* try to validate token locally */
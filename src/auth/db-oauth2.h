@@ -23,10 +23,15 @@ struct db_oauth2_request {
 
 	struct auth_request *auth_request;
 	struct auth_fields *fields;
+	/* when the validated token expires, 0 if unknown */
+	time_t expires_at;
 
 	db_oauth2_lookup_callback_t *callback;
 	void *context;
 	verify_plain_callback_t *verify_callback;
+
+	/* result was looked up from the token cache */
+	bool from_token_cache:1;
 };
 
 
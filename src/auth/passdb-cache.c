@@ -68,6 +68,15 @@ passdb_cache_verify_plain_callback(struct auth_worker_connection *conn ATTR_UNUS
 	return TRUE;
 }
 
+static bool passdb_cache_password_is_expensive(const char *cached_pw)
+{
+	const char *scheme;
+
+	scheme = password_get_scheme(&cached_pw);
+	i_assert(scheme != NULL);
+	return password_scheme_is_expensive(scheme);
+}
+
 bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 			       const char *password,
 			       enum passdb_result *result_r, bool use_expired)
@@ -100,7 +109,11 @@ bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 		e_info(authdb_event(request),
 		       "Cached NULL password access");
 		ret = PASSDB_RESULT_OK;
-	} else if (request->set->cache_verify_password_with_worker) {
+	} else if (request->set->cache_verify_password_with_worker &&
+		   passdb_cache_password_is_expensive(cached_pw)) {
+		/* Only CPU intensive schemes are worth the worker round trip.
+		   Cheap ones are faster to verify here, and this also keeps
+		   the cache expiration handling for password mismatches. */
 		string_t *str;
 
 		str = t_str_new(128);
@@ -201,7 +214,8 @@ void passdb_cache_init(const struct auth_settings *set)
 			  (uoff_t)(limit/1024/1024));
 	}
 	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
-				      set->cache_negative_ttl);
+				      set->cache_negative_ttl,
+				      set->cache_refresh_percentage);
 }
 
 void passdb_cache_deinit(void)
@@ -39,6 +39,16 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 	return var_expand(dest, str, auth_request_var_expand_static_tab, error_r);
 }
 
+void auth_request_ref(struct auth_request *request ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+void auth_request_unref(struct auth_request **request ATTR_UNUSED)
+{
+	i_unreached();
+}
+
 static void test_auth_cache_parse_key(void)
 {
 	static const struct {
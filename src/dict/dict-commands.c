@@ -13,6 +13,7 @@
 #include "dict-settings.h"
 #include "dict-connection.h"
 #include "dict-commands.h"
+#include "dict-write-behind.h"
 #include "main.h"
 
 #define DICT_OUTPUT_OPTIMAL_SIZE 1024
@@ -373,6 +374,7 @@ dict_connection_transaction_array_remove(struct dict_connection *conn,
 	for (i = 0; i < count; i++) {
 		if (transactions[i].id == id) {
 			i_assert(transactions[i].ctx == NULL);
+			i_assert(transactions[i].wb_trans == NULL);
 			array_delete(&conn->transactions, i, 1);
 			return;
 		}
@@ -413,10 +415,23 @@ static int cmd_begin(struct dict_connection_cmd *cmd, const char *const *args)
 	trans = array_append_space(&cmd->conn->transactions);
 	trans->id = id;
 	trans->conn = cmd->conn;
-	trans->ctx = dict_transaction_begin(cmd->conn->dict, &set);
+	if (cmd->conn->write_behind_mode != DICT_WRITE_BEHIND_MODE_NO) {
+		trans->wb_trans =
+			dict_write_behind_transaction_begin(cmd->conn, &set);
+	} else {
+		trans->ctx = dict_transaction_begin(cmd->conn->dict, &set);
+	}
 	return 0;
 }
 
+static const char *
+dict_connection_transaction_get_username(struct dict_connection_transaction *trans)
+{
+	if (trans->wb_trans != NULL)
+		return dict_write_behind_transaction_get_username(trans->wb_trans);
+	return trans->ctx->set.username;
+}
+
 static int
 dict_connection_transaction_lookup_parse(struct dict_connection *conn,
 					 const char *id_str,
@@ -499,10 +514,17 @@ cmd_commit(struct dict_connection_cmd *cmd, const char *const *args)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
 	cmd->trans_id = trans->id;
-	event_add_str(cmd->event, "user", trans->ctx->set.username);
+	event_add_str(cmd->event, "user",
+		      dict_connection_transaction_get_username(trans));
 
 	dict_connection_cmd_async(cmd);
-	dict_transaction_commit_async(&trans->ctx, cmd_commit_callback, cmd);
+	if (trans->wb_trans != NULL) {
+		dict_write_behind_transaction_commit(&trans->wb_trans,
+						     cmd_commit_callback, cmd);
+	} else {
+		dict_transaction_commit_async(&trans->ctx,
+					      cmd_commit_callback, cmd);
+	}
 	return 1;
 }
 
@@ -514,8 +536,10 @@ cmd_rollback(struct dict_connection_cmd *cmd, const char *const *args)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
 
-	event_add_str(cmd->event, "user", trans->ctx->set.username);
+	event_add_str(cmd->event, "user",
+		      dict_connection_transaction_get_username(trans));
 	dict_transaction_rollback(&trans->ctx);
+	dict_write_behind_transaction_rollback(&trans->wb_trans);
 	dict_connection_transaction_array_remove(cmd->conn, trans->id);
 	return 0;
 }
@@ -532,8 +556,12 @@ static int cmd_set(struct dict_connection_cmd *cmd, const char *const *args)
 
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
-	event_add_str(cmd->event, "user", trans->ctx->set.username);
-        dict_set(trans->ctx, args[1], args[2]);
+	event_add_str(cmd->event, "user",
+		      dict_connection_transaction_get_username(trans));
+	if (trans->wb_trans != NULL)
+		dict_write_behind_set(trans->wb_trans, args[1], args[2]);
+	else
+		dict_set(trans->ctx, args[1], args[2]);
 	return 0;
 }
 
@@ -549,7 +577,10 @@ static int cmd_unset(struct dict_connection_cmd *cmd, const char *const *args)
 
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
-        dict_unset(trans->ctx, args[1]);
+	if (trans->wb_trans != NULL)
+		dict_write_behind_unset(trans->wb_trans, args[1]);
+	else
+		dict_unset(trans->ctx, args[1]);
 	return 0;
 }
 
@@ -569,7 +600,10 @@ cmd_atomic_inc(struct dict_connection_cmd *cmd, const char *const *args)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
 
-        dict_atomic_inc(trans->ctx, args[1], diff);
+	if (trans->wb_trans != NULL)
+		dict_write_behind_atomic_inc(trans->wb_trans, args[1], diff);
+	else
+		dict_atomic_inc(trans->ctx, args[1], diff);
 	return 0;
 }
 
@@ -594,7 +628,10 @@ static int cmd_timestamp(struct dict_connection_cmd *cmd, const char *const *arg
 		.tv_sec = tv_sec,
 		.tv_nsec = tv_nsec
 	};
-        dict_transaction_set_timestamp(trans->ctx, &ts);
+	if (trans->wb_trans != NULL)
+		dict_write_behind_set_timestamp(trans->wb_trans, &ts);
+	else
+		dict_transaction_set_timestamp(trans->ctx, &ts);
 	return 0;
 }
 
@@ -615,7 +652,10 @@ cmd_hide_log_values(struct dict_connection_cmd *cmd, const char *const *args)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
 
-	dict_transaction_set_hide_log_values(trans->ctx, value);
+	if (trans->wb_trans != NULL)
+		dict_write_behind_set_hide_log_values(trans->wb_trans, value);
+	else
+		dict_transaction_set_hide_log_values(trans->ctx, value);
 	return 0;
 }
 
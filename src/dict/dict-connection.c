@@ -102,6 +102,7 @@ static int dict_connection_dict_init(struct dict_connection *conn)
 			conn->name, error);
 		return -1;
 	}
+	conn->write_behind_mode = dict_write_behind_get_mode(conn->name);
 	return 0;
 }
 
@@ -158,8 +159,10 @@ bool dict_connection_unref(struct dict_connection *conn)
 	/* we should have only transactions that haven't been committed or
 	   rollbacked yet. close those before dict is deinitialized. */
 	if (array_is_created(&conn->transactions)) {
-		array_foreach_modifiable(&conn->transactions, transaction)
+		array_foreach_modifiable(&conn->transactions, transaction) {
 			dict_transaction_rollback(&transaction->ctx);
+			dict_write_behind_transaction_rollback(&transaction->wb_trans);
+		}
 	}
 
 	if (conn->dict != NULL)
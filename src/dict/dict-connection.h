@@ -3,11 +3,14 @@
 
 #include "dict.h"
 #include "connection.h"
+#include "dict-write-behind.h"
 
 struct dict_connection_transaction {
 	unsigned int id;
 	struct dict_connection *conn;
 	struct dict_transaction_context *ctx;
+	/* Used instead of ctx when the dict has write-behind enabled */
+	struct dict_write_behind_transaction *wb_trans;
 };
 
 struct dict_connection {
@@ -19,6 +22,7 @@ struct dict_connection {
 	char *name;
 	struct dict *dict;
 	enum dict_data_type value_type;
+	enum dict_write_behind_mode write_behind_mode;
 
 	struct timeout *to_unref;
 
@@ -121,6 +121,26 @@ static void dict_removal_timeout(void *context ATTR_UNUSED)
 	destroy_unrefed();
 }
 
+static struct dict_init_cache_list *dict_init_cache_find_dict(struct dict *dict)
+{
+	struct dict_init_cache_list *listp;
+
+	for (listp = dicts; listp != NULL; listp = listp->next) {
+		if (listp->dict == dict)
+			break;
+	}
+	i_assert(listp != NULL && listp->dict == dict);
+	return listp;
+}
+
+void dict_init_cache_ref(struct dict *dict)
+{
+	struct dict_init_cache_list *listp = dict_init_cache_find_dict(dict);
+
+	i_assert(listp->refcount > 0);
+	listp->refcount++;
+}
+
 void dict_init_cache_unref(struct dict **_dict)
 {
 	struct dict *dict = *_dict;
@@ -130,12 +150,7 @@ void dict_init_cache_unref(struct dict **_dict)
 		return;
 
 	*_dict = NULL;
-	for (listp = dicts; listp != NULL; listp = listp->next) {
-		if (listp->dict == dict)
-			break;
-	}
-
-	i_assert(listp != NULL && listp->dict == dict);
+	listp = dict_init_cache_find_dict(dict);
 	i_assert(listp->refcount > 0);
 
 	listp->refcount--;
@@ -4,6 +4,8 @@
 int dict_init_cache_get(const char *dict_name, const char *uri,
 			const struct dict_settings *set,
 			struct dict **dict_r, const char **error_r);
+/* Add a reference to a dict returned by dict_init_cache_get(). */
+void dict_init_cache_ref(struct dict *dict);
 void dict_init_cache_unref(struct dict **dict);
 
 void dict_init_cache_wait_all(void);
@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
 #include "settings-parser.h"
 #include "service-settings.h"
@@ -36,6 +37,31 @@ static struct file_listener_settings *dict_async_unix_listeners[] = {
 static buffer_t dict_async_unix_listeners_buf = {
 	{ { dict_async_unix_listeners, sizeof(dict_async_unix_listeners) } }
 };
+
+static bool dict_settings_check(void *_set, pool_t pool ATTR_UNUSED,
+				const char **error_r)
+{
+	struct dict_server_settings *set = _set;
+	const char *const *strlist;
+	unsigned int i, count;
+
+	if (!array_is_created(&set->write_behind))
+		return TRUE;
+
+	strlist = array_get(&set->write_behind, &count);
+	for (i = 0; i < count; i += 2) {
+		if (strcmp(strlist[i+1], "no") != 0 &&
+		    strcmp(strlist[i+1], "batch") != 0 &&
+		    strcmp(strlist[i+1], "async") != 0) {
+			*error_r = t_strdup_printf(
+				"dict_write_behind: Invalid value for %s: '%s' "
+				"(use no, batch or async)",
+				strlist[i], strlist[i+1]);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
 /* </settings checks> */
 
 struct service_settings dict_service_settings = {
@@ -122,8 +148,12 @@ struct service_settings dict_expire_service_settings = {
 static const struct setting_define dict_setting_defines[] = {
 	DEF(STR, base_dir),
 	DEF(BOOL, verbose_proctitle),
+	DEF(TIME_MSECS, dict_write_behind_interval),
+	DEF(UINT, dict_write_behind_max_changes),
 	{ .type = SET_STRLIST, .key = "dict",
 	  .offset = offsetof(struct dict_server_settings, dicts) },
+	{ .type = SET_STRLIST, .key = "dict_write_behind",
+	  .offset = offsetof(struct dict_server_settings, write_behind) },
 
 	SETTING_DEFINE_LIST_END
 };
@@ -131,7 +161,10 @@ static const struct setting_define dict_setting_defines[] = {
 const struct dict_server_settings dict_default_settings = {
 	.base_dir = PKG_RUNDIR,
 	.verbose_proctitle = FALSE,
-	.dicts = ARRAY_INIT
+	.dict_write_behind_interval = 100,
+	.dict_write_behind_max_changes = 1000,
+	.dicts = ARRAY_INIT,
+	.write_behind = ARRAY_INIT
 };
 
 const struct setting_parser_info dict_setting_parser_info = {
@@ -142,7 +175,8 @@ const struct setting_parser_info dict_setting_parser_info = {
 	.type_offset = SIZE_MAX,
 	.struct_size = sizeof(struct dict_server_settings),
 
-	.parent_offset = SIZE_MAX
+	.parent_offset = SIZE_MAX,
+	.check_func = dict_settings_check
 };
 
 const struct dict_server_settings *dict_settings;
@@ -4,7 +4,10 @@
 struct dict_server_settings {
 	const char *base_dir;
 	bool verbose_proctitle;
+	unsigned int dict_write_behind_interval;
+	unsigned int dict_write_behind_max_changes;
 	ARRAY(const char *) dicts;
+	ARRAY(const char *) write_behind;
 };
 
 extern const struct setting_parser_info dict_setting_parser_info;
@@ -0,0 +1,329 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "ioloop.h"
+#include "str.h"
+#include "strescape.h"
+#include "dict-transaction-memory.h"
+#include "dict-settings.h"
+#include "dict-init-cache.h"
+#include "dict-connection.h"
+#include "dict-write-behind.h"
+
+struct dict_write_behind_transaction {
+	pool_t pool;
+	struct dict_connection *conn;
+	struct dict_op_settings set;
+	ARRAY(struct dict_transaction_memory_change) changes;
+
+	struct timespec timestamp;
+	bool hide_log_values;
+};
+
+struct dict_write_behind_waiter {
+	dict_transaction_commit_callback_t *callback;
+	void *context;
+};
+
+struct dict_write_behind_batch {
+	char *key;
+	struct dict *dict;
+	struct event *event;
+	enum dict_write_behind_mode mode;
+
+	struct dict_transaction_context *ctx;
+	unsigned int transactions_count;
+	unsigned int changes_count;
+	/* Commit callbacks waiting for the batch to be committed */
+	ARRAY(struct dict_write_behind_waiter) waiters;
+
+	struct timeout *to;
+};
+
+/* dict name + username + expire_secs => batch still accepting changes */
+static HASH_TABLE(char *, struct dict_write_behind_batch *) batches;
+
+enum dict_write_behind_mode dict_write_behind_get_mode(const char *dict_name)
+{
+	const char *const *strlist;
+	unsigned int i, count;
+
+	if (!array_is_created(&dict_settings->write_behind))
+		return DICT_WRITE_BEHIND_MODE_NO;
+
+	strlist = array_get(&dict_settings->write_behind, &count);
+	for (i = 0; i < count; i += 2) {
+		if (strcmp(strlist[i], dict_name) != 0)
+			continue;
+		if (strcmp(strlist[i+1], "batch") == 0)
+			return DICT_WRITE_BEHIND_MODE_BATCH;
+		if (strcmp(strlist[i+1], "async") == 0)
+			return DICT_WRITE_BEHIND_MODE_ASYNC;
+		break;
+	}
+	return DICT_WRITE_BEHIND_MODE_NO;
+}
+
+struct dict_write_behind_transaction *
+dict_write_behind_transaction_begin(struct dict_connection *conn,
+				    const struct dict_op_settings *set)
+{
+	struct dict_write_behind_transaction *trans;
+	pool_t pool;
+
+	pool = pool_alloconly_create("dict write-behind transaction", 512);
+	trans = p_new(pool, struct dict_write_behind_transaction, 1);
+	trans->pool = pool;
+	trans->conn = conn;
+	trans->set.username = p_strdup(pool, set->username);
+	trans->set.expire_secs = set->expire_secs;
+	p_array_init(&trans->changes, pool, 4);
+	return trans;
+}
+
+const char *
+dict_write_behind_transaction_get_username(struct dict_write_behind_transaction *trans)
+{
+	return trans->set.username;
+}
+
+static struct dict_transaction_memory_change *
+dict_write_behind_add_change(struct dict_write_behind_transaction *trans,
+			     enum dict_change_type type, const char *key)
+{
+	struct dict_transaction_memory_change *change;
+
+	change = array_append_space(&trans->changes);
+	change->type = type;
+	change->key = p_strdup(trans->pool, key);
+	return change;
+}
+
+void dict_write_behind_set(struct dict_write_behind_transaction *trans,
+			   const char *key, const char *value)
+{
+	struct dict_transaction_memory_change *change =
+		dict_write_behind_add_change(trans, DICT_CHANGE_TYPE_SET, key);
+	change->value.str = p_strdup(trans->pool, value);
+}
+
+void dict_write_behind_unset(struct dict_write_behind_transaction *trans,
+			     const char *key)
+{
+	(void)dict_write_behind_add_change(trans, DICT_CHANGE_TYPE_UNSET, key);
+}
+
+void dict_write_behind_atomic_inc(struct dict_write_behind_transaction *trans,
+				  const char *key, long long diff)
+{
+	struct dict_transaction_memory_change *change =
+		dict_write_behind_add_change(trans, DICT_CHANGE_TYPE_INC, key);
+	change->value.diff = diff;
+}
+
+void dict_write_behind_set_timestamp(struct dict_write_behind_transaction *trans,
+				     const struct timespec *ts)
+{
+	trans->timestamp = *ts;
+}
+
+void dict_write_behind_set_hide_log_values(struct dict_write_behind_transaction *trans,
+					   bool hide_log_values)
+{
+	trans->hide_log_values = hide_log_values;
+}
+
+static void
+dict_write_behind_apply_changes(struct dict_write_behind_transaction *trans,
+				struct dict_transaction_context *ctx)
+{
+	const struct dict_transaction_memory_change *change;
+
+	array_foreach(&trans->changes, change) {
+		switch (change->type) {
+		case DICT_CHANGE_TYPE_SET:
+			dict_set(ctx, change->key, change->value.str);
+			break;
+		case DICT_CHANGE_TYPE_UNSET:
+			dict_unset(ctx, change->key);
+			break;
+		case DICT_CHANGE_TYPE_INC:
+			dict_atomic_inc(ctx, change->key, change->value.diff);
+			break;
+		}
+	}
+}
+
+static void
+dict_write_behind_batch_commit_callback(const struct dict_commit_result *result,
+					struct dict_write_behind_batch *batch)
+{
+	const struct dict_write_behind_waiter *waiter;
+
+	switch (result->ret) {
+	case DICT_COMMIT_RET_OK:
+		e_debug(batch->event, "Write-behind batch committed");
+		break;
+	case DICT_COMMIT_RET_NOTFOUND:
+		if (batch->mode == DICT_WRITE_BEHIND_MODE_ASYNC) {
+			e_warning(batch->event, "Write-behind batch committed, "
+				  "but some atomic increments were done to "
+				  "nonexistent keys");
+		}
+		break;
+	case DICT_COMMIT_RET_FAILED:
+	case DICT_COMMIT_RET_WRITE_UNCERTAIN:
+		e_error(batch->event, "Write-behind commit of %u transactions "
+			"failed: %s", batch->transactions_count, result->error);
+		break;
+	}
+
+	array_foreach(&batch->waiters, waiter)
+		waiter->callback(result, waiter->context);
+
+	array_free(&batch->waiters);
+	event_unref(&batch->event);
+	dict_init_cache_unref(&batch->dict);
+	i_free(batch->key);
+	i_free(batch);
+}
+
+static void dict_write_behind_batch_flush(struct dict_write_behind_batch *batch)
+{
+	hash_table_remove(batches, batch->key);
+	timeout_remove(&batch->to);
+
+	e_debug(batch->event, "Committing write-behind batch with "
+		"%u transactions and %u changes",
+		batch->transactions_count, batch->changes_count);
+	dict_transaction_commit_async(&batch->ctx,
+		dict_write_behind_batch_commit_callback, batch);
+}
+
+static struct dict_write_behind_batch *
+dict_write_behind_batch_get(struct dict_write_behind_transaction *trans)
+{
+	struct dict_connection *conn = trans->conn;
+	struct dict_write_behind_batch *batch;
+	const char *key;
+
+	key = t_strdup_printf("%s\t%c%s\t%u", str_tabescape(conn->name),
+			      trans->set.username == NULL ? '-' : '+',
+			      trans->set.username == NULL ? "" :
+			      str_tabescape(trans->set.username),
+			      trans->set.expire_secs);
+	if (!hash_table_is_created(batches))
+		hash_table_create(&batches, default_pool, 0, str_hash, strcmp);
+	batch = hash_table_lookup(batches, key);
+	if (batch != NULL)
+		return batch;
+
+	batch = i_new(struct dict_write_behind_batch, 1);
+	batch->key = i_strdup(key);
+	batch->dict = conn->dict;
+	dict_init_cache_ref(batch->dict);
+	batch->event = event_create(conn->conn.event);
+	batch->mode = conn->write_behind_mode;
+	batch->ctx = dict_transaction_begin(batch->dict, &trans->set);
+	i_array_init(&batch->waiters, 8);
+	batch->to = timeout_add(dict_settings->dict_write_behind_interval,
+				dict_write_behind_batch_flush, batch);
+	hash_table_insert(batches, batch->key, batch);
+	return batch;
+}
+
+static void
+dict_write_behind_transaction_free(struct dict_write_behind_transaction **_trans)
+{
+	struct dict_write_behind_transaction *trans = *_trans;
+
+	*_trans = NULL;
+	pool_unref(&trans->pool);
+}
+
+#undef dict_write_behind_transaction_commit
+void dict_write_behind_transaction_commit(struct dict_write_behind_transaction **_trans,
+					  dict_transaction_commit_callback_t *callback,
+					  void *context)
+{
+	struct dict_write_behind_transaction *trans = *_trans;
+	struct dict_write_behind_batch *batch;
+	struct dict_transaction_context *ctx;
+	const struct dict_commit_result ok_result = {
+		.ret = DICT_COMMIT_RET_OK,
+	};
+
+	*_trans = NULL;
+	if (trans->timestamp.tv_sec != 0 || trans->timestamp.tv_nsec != 0 ||
+	    trans->hide_log_values) {
+		ctx = dict_transaction_begin(trans->conn->dict, &trans->set);
+		if (trans->timestamp.tv_sec != 0 ||
+		    trans->timestamp.tv_nsec != 0)
+			dict_transaction_set_timestamp(ctx, &trans->timestamp);
+		dict_transaction_set_hide_log_values(ctx, trans->hide_log_values);
+		dict_write_behind_apply_changes(trans, ctx);
+		dict_write_behind_transaction_free(&trans);
+		(dict_transaction_commit_async)(&ctx, callback, context);
+		return;
+	}
+	if (array_count(&trans->changes) == 0) {
+		dict_write_behind_transaction_free(&trans);
+		callback(&ok_result, context);
+		return;
+	}
+
+	batch = dict_write_behind_batch_get(trans);
+	dict_write_behind_apply_changes(trans, batch->ctx);
+	batch->transactions_count++;
+	batch->changes_count += array_count(&trans->changes);
+	dict_write_behind_transaction_free(&trans);
+
+	if (batch->mode == DICT_WRITE_BEHIND_MODE_ASYNC)
+		callback(&ok_result, context);
+	else {
+		struct dict_write_behind_waiter *waiter =
+			array_append_space(&batch->waiters);
+		waiter->callback = callback;
+		waiter->context = context;
+	}
+
+	if (batch->changes_count >= dict_settings->dict_write_behind_max_changes)
+		dict_write_behind_batch_flush(batch);
+}
+
+void dict_write_behind_transaction_rollback(struct dict_write_behind_transaction **trans)
+{
+	if (*trans != NULL)
+		dict_write_behind_transaction_free(trans);
+}
+
+void dict_write_behind_flush_all(void)
+{
+	struct hash_iterate_context *iter;
+	struct dict_write_behind_batch *batch;
+	ARRAY(struct dict_write_behind_batch *) flush_batches;
+	char *key;
+
+	if (!hash_table_is_created(batches))
+		return;
+
+	t_array_init(&flush_batches, hash_table_count(batches));
+	iter = hash_table_iterate_init(batches);
+	while (hash_table_iterate(iter, batches, &key, &batch))
+		array_push_back(&flush_batches, &batch);
+	hash_table_iterate_deinit(&iter);
+
+	array_foreach_elem(&flush_batches, batch)
+		dict_write_behind_batch_flush(batch);
+}
+
+void dict_write_behind_deinit(void)
+{
+	if (!hash_table_is_created(batches))
+		return;
+
+	i_assert(hash_table_count(batches) == 0);
+	hash_table_destroy(&batches);
+}
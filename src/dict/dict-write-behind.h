@@ -0,0 +1,60 @@
+#ifndef DICT_WRITE_BEHIND_H
+#define DICT_WRITE_BEHIND_H
+
+#include "dict.h"
+
+struct dict_connection;
+
+enum dict_write_behind_mode {
+	/* Commit each transaction to the backend separately */
+	DICT_WRITE_BEHIND_MODE_NO = 0,
+	/* Group transactions into batches. The commit is replied to only
+	   after the batch is committed to the backend. */
+	DICT_WRITE_BEHIND_MODE_BATCH,
+	/* Group transactions into batches. The commit is replied to as soon
+	   as the transaction is queued, so failures can only be logged. */
+	DICT_WRITE_BEHIND_MODE_ASYNC,
+};
+
+/* Returns the configured write-behind mode for the dict. */
+enum dict_write_behind_mode dict_write_behind_get_mode(const char *dict_name);
+
+/* Begin a transaction whose changes are queued in memory until commit. */
+struct dict_write_behind_transaction *
+dict_write_behind_transaction_begin(struct dict_connection *conn,
+				    const struct dict_op_settings *set);
+const char *
+dict_write_behind_transaction_get_username(struct dict_write_behind_transaction *trans);
+
+void dict_write_behind_set(struct dict_write_behind_transaction *trans,
+			   const char *key, const char *value);
+void dict_write_behind_unset(struct dict_write_behind_transaction *trans,
+			     const char *key);
+void dict_write_behind_atomic_inc(struct dict_write_behind_transaction *trans,
+				  const char *key, long long diff);
+/* These apply to the whole backend transaction, so a transaction using them
+   is committed separately instead of being added to a batch. */
+void dict_write_behind_set_timestamp(struct dict_write_behind_transaction *trans,
+				     const struct timespec *ts);
+void dict_write_behind_set_hide_log_values(struct dict_write_behind_transaction *trans,
+					   bool hide_log_values);
+
+/* Add the transaction's changes to the current batch of the dict. The batch
+   is committed after dict_write_behind_interval, or earlier if it grows to
+   dict_write_behind_max_changes. */
+void dict_write_behind_transaction_commit(struct dict_write_behind_transaction **trans,
+					  dict_transaction_commit_callback_t *callback,
+					  void *context);
+#define dict_write_behind_transaction_commit(trans, callback, context) \
+	dict_write_behind_transaction_commit(trans, \
+		(dict_transaction_commit_callback_t *)(callback), \
+		1 ? (context) : \
+		CALLBACK_TYPECHECK(callback, \
+			void (*)(const struct dict_commit_result *, typeof(context))))
+void dict_write_behind_transaction_rollback(struct dict_write_behind_transaction **trans);
+
+/* Commit all the pending batches immediately. */
+void dict_write_behind_flush_all(void);
+void dict_write_behind_deinit(void);
+
+#endif
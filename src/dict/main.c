@@ -18,6 +18,7 @@
 #include "dict-connection.h"
 #include "dict-settings.h"
 #include "dict-init-cache.h"
+#include "dict-write-behind.h"
 #include "main.h"
 
 #include <math.h>
@@ -124,8 +125,11 @@ static void main_init(void)
 
 static void main_deinit(void)
 {
-	/* wait for all dict operations to finish */
+	/* commit the pending write-behind batches and wait for all dict
+	   operations to finish */
+	dict_write_behind_flush_all();
 	dict_init_cache_wait_all();
+	dict_write_behind_deinit();
 	/* connections should no longer have any extra refcounts */
 	dict_connections_destroy_all();
 	dict_init_cache_destroy_all();
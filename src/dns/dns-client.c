@@ -8,9 +8,15 @@
 #include "connection.h"
 #include "restrict-access.h"
 #include "master-service.h"
+#include "dns-cache.h"
 
 #include <unistd.h>
 
+/* getaddrinfo() doesn't return the TTLs, so cache the successful lookups
+   only briefly. This is mainly to avoid repeating the same lookups for
+   bursts of e.g. proxied connections to the same backend. */
+#define DNS_CLIENT_CACHE_TTL_MSECS (10*1000)
+
 static struct event_category event_category_dns = {
 	.name = "dns-worker"
 };
@@ -20,6 +26,8 @@ static struct connection_list *dns_clients = NULL;
 static int dns_client_input_args(struct connection *client, const char *const *args)
 {
 	struct ip_addr *ips, ip;
+	const struct ip_addr *result_ips;
+	struct timeval cached_expires;
 	const char *name;
 	struct event *event;
 	unsigned int i, ips_count;
@@ -46,10 +54,21 @@ static int dns_client_input_args(struct connection *client, const char *const *a
 		add_str("name", args[1]);
 
 	if (strcmp(args[0], "IP") == 0) {
-		ret = net_gethostbyname(args[1], &ips, &ips_count);
-		if (ret == 0 && ips_count == 0) {
-			/* shouldn't happen, but fix it anyway.. */
-			ret = EAI_NONAME;
+		if (dns_cache_lookup(args[1], &result_ips, &ips_count,
+				     &cached_expires)) {
+			e->add_str("cached", "yes");
+			ret = 0;
+		} else {
+			ret = net_gethostbyname(args[1], &ips, &ips_count);
+			if (ret == 0 && ips_count == 0) {
+				/* shouldn't happen, but fix it anyway.. */
+				ret = EAI_NONAME;
+			}
+			if (ret == 0) {
+				dns_cache_update(args[1], ips, ips_count,
+						 DNS_CLIENT_CACHE_TTL_MSECS);
+			}
+			result_ips = ips;
 		}
 		/* update timestamp after hostname lookup so the event duration
 		   field gets set correctly */
@@ -66,7 +85,7 @@ static int dns_client_input_args(struct connection *client, const char *const *a
 			t_array_init(&tmp, ips_count);
 			o_stream_nsend_str(client->output, "0\t");
 			for (i = 0; i < ips_count; i++) {
-				const char *ip = net_ip2addr(&ips[i]);
+				const char *ip = net_ip2addr(&result_ips[i]);
 				array_push_back(&tmp, &ip);
 			}
 			array_append_zero(&tmp);
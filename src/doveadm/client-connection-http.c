@@ -46,6 +46,15 @@ enum client_request_parse_state {
 	CLIENT_REQUEST_PARSE_DONE
 };
 
+/* Command parsed from a streaming request, executed once the whole request
+   has been read. */
+struct client_request_http_cmd {
+	const struct doveadm_cmd_ver2 *cmd;
+	ARRAY_TYPE(doveadm_cmd_param_arr_t) pargv;
+	char *method_id;
+	int method_err;
+};
+
 struct client_request_http {
 	pool_t pool;
 	struct client_connection_http *conn;
@@ -62,10 +71,17 @@ struct client_request_http {
 	struct doveadm_cmd_param *cmd_param;
 	struct ioloop *ioloop;
 	ARRAY_TYPE(doveadm_cmd_param_arr_t) pargv;
+	ARRAY(struct client_request_http_cmd) stream_cmds;
 	int method_err;
 	char *method_id;
 	bool first_row;
 	bool value_is_array;
+	/* Response is sent as NDJSON with rows written as they are printed */
+	bool stream_output;
+	/* req->output is the response payload owned by
+	   doveadm_http_server_stream_commands() */
+	bool stream_output_running;
+	bool destroyed;
 
 	enum client_request_parse_state parse_state;
 };
@@ -146,6 +162,8 @@ static void doveadm_http_server_json_error(void *context, const char *error)
 		o_stream_nsend_str(output, str_c(escaped));
 	}
 	o_stream_nsend_str(output, "\"]");
+	if (req->stream_output)
+		o_stream_nsend_str(output, "\n");
 }
 
 static void doveadm_http_server_json_success(void *context, struct istream *result)
@@ -157,20 +175,27 @@ static void doveadm_http_server_json_success(void *context, struct istream *resu
 	escaped = str_new(req->pool, 10);
 
 	o_stream_nsend_str(output, "[\"doveadmResponse\",");
-	o_stream_nsend_istream(output, result);
+	if (result != NULL)
+		o_stream_nsend_istream(output, result);
+	else {
+		/* the rows were already streamed before this line */
+		o_stream_nsend_str(output, "[]");
+	}
 	o_stream_nsend_str(output, ",\"");
 	if (req->method_id != NULL) {
 		json_append_escaped(escaped, req->method_id);
 		o_stream_nsend_str(output, str_c(escaped));
 	}
 	o_stream_nsend_str(output, "\"]");
+	if (req->stream_output)
+		o_stream_nsend_str(output, "\n");
 }
 
 static void
 doveadm_http_server_command_execute(struct client_request_http *req)
 {
 	struct client_connection_http *conn = req->conn;
-	struct istream *is;
+	struct istream *is = NULL;
 	const char *user;
 	struct ioloop *ioloop, *prev_ioloop;
 
@@ -201,11 +226,20 @@ doveadm_http_server_command_execute(struct client_request_http *req)
 	cctx->output = req->output;
 
 	// create iostream
-	doveadm_print_ostream = iostream_temp_create("/tmp/doveadm.", 0);
+	if (req->stream_output) {
+		/* rows are written directly to the response payload */
+		doveadm_print_ostream = req->output;
+		o_stream_ref(doveadm_print_ostream);
+	} else {
+		doveadm_print_ostream = iostream_temp_create("/tmp/doveadm.", 0);
+	}
 	cctx->cmd = req->cmd;
 
-	if ((cctx->cmd->flags & CMD_FLAG_NO_PRINT) == 0)
-		doveadm_print_init(DOVEADM_PRINT_TYPE_JSON);
+	if ((cctx->cmd->flags & CMD_FLAG_NO_PRINT) == 0) {
+		doveadm_print_init(req->stream_output ?
+				   DOVEADM_PRINT_TYPE_NDJSON :
+				   DOVEADM_PRINT_TYPE_JSON);
+	}
 
 	/* then call it */
 	doveadm_cmd_params_null_terminate_arrays(&req->pargv);
@@ -236,17 +270,28 @@ doveadm_http_server_command_execute(struct client_request_http *req)
 
 	if ((cctx->cmd->flags & CMD_FLAG_NO_PRINT) == 0)
 		doveadm_print_deinit();
-	if (o_stream_finish(doveadm_print_ostream) < 0) {
-		e_info(cctx->event, "Error writing output in command %s: %s",
-		       req->cmd->name, o_stream_get_error(req->output));
-		doveadm_exit_code = EX_TEMPFAIL;
+	if (req->stream_output) {
+		if (o_stream_flush(doveadm_print_ostream) < 0) {
+			e_info(cctx->event,
+			       "Error writing output in command %s: %s",
+			       req->cmd->name,
+			       o_stream_get_error(doveadm_print_ostream));
+			doveadm_exit_code = EX_TEMPFAIL;
+		}
+		o_stream_unref(&doveadm_print_ostream);
+	} else {
+		if (o_stream_finish(doveadm_print_ostream) < 0) {
+			e_info(cctx->event,
+			       "Error writing output in command %s: %s",
+			       req->cmd->name, o_stream_get_error(req->output));
+			doveadm_exit_code = EX_TEMPFAIL;
+		}
+		is = iostream_temp_finish(&doveadm_print_ostream, 4096);
 	}
 
-	is = iostream_temp_finish(&doveadm_print_ostream, 4096);
-
 	if (req->first_row == TRUE)
 		req->first_row = FALSE;
-	else
+	else if (!req->stream_output)
 		o_stream_nsend_str(req->output,",");
 
 	if (cctx->referral != NULL) {
@@ -266,6 +311,78 @@ doveadm_http_server_command_execute(struct client_request_http *req)
 	doveadm_cmd_context_unref(&cctx);
 }
 
+static void
+doveadm_http_server_command_queue(struct client_request_http *req)
+{
+	struct client_request_http_cmd *qcmd;
+
+	/* The response can't be started before the whole request payload
+	   is read, so remember the command and run it later. The parameters
+	   are moved to the queued command. */
+	qcmd = array_append_space(&req->stream_cmds);
+	qcmd->cmd = req->cmd;
+	qcmd->pargv = req->pargv;
+	qcmd->method_id = req->method_id;
+	qcmd->method_err = req->method_err;
+
+	p_array_init(&req->pargv, req->pool, 5);
+	req->method_id = NULL;
+}
+
+static void
+doveadm_http_server_stream_commands(struct client_request_http *req)
+{
+	struct client_connection_http *conn = req->conn;
+	struct http_server_response *http_resp;
+	struct client_request_http_cmd *qcmd;
+	struct ostream *output;
+	pool_t pool = req->pool, conn_pool = conn->conn.pool;
+	struct event *conn_event = conn->conn.event;
+
+	http_resp = http_server_response_create(req->http_request, 200, "OK");
+	http_server_response_add_header(http_resp, "Content-Type",
+		"application/x-ndjson; charset=utf-8");
+	/* Blocking output: printing more rows waits until the client has
+	   read the previous ones, so the commands' memory usage stays
+	   bounded regardless of how much they output. */
+	output = http_server_response_get_payload_output(
+		http_resp, IO_BLOCK_SIZE, TRUE);
+	o_stream_destroy(&req->output);
+	req->output = output;
+	req->stream_output_running = TRUE;
+
+	/* The client may disconnect while we're waiting for it to read the
+	   output, which destroys the request and connection. Keep them
+	   allocated until we're done. */
+	pool_ref(pool);
+	pool_ref(conn_pool);
+	event_ref(conn_event);
+
+	array_foreach_modifiable(&req->stream_cmds, qcmd) {
+		if (req->destroyed || output->stream_errno != 0)
+			break;
+		req->cmd = qcmd->cmd;
+		req->pargv = qcmd->pargv;
+		req->method_id = qcmd->method_id;
+		req->method_err = qcmd->method_err;
+		doveadm_http_server_command_execute(req);
+		doveadm_cmd_params_clean(&req->pargv);
+	}
+
+	if (!req->destroyed && o_stream_finish(output) < 0) {
+		e_info(conn_event, "error writing output: %s",
+		       o_stream_get_error(output));
+	}
+	req->stream_output_running = FALSE;
+	if (!req->destroyed)
+		req->output = NULL;
+	o_stream_destroy(&output);
+
+	event_unref(&conn_event);
+	pool_unref(&conn_pool);
+	pool_unref(&pool);
+}
+
 static int
 request_json_parse_init(struct client_request_http *req)
 {
@@ -284,7 +401,8 @@ request_json_parse_init(struct client_request_http *req)
 		return -1;
 	}
 	req->first_row = TRUE;
-	o_stream_nsend_str(req->output,"[");
+	if (!req->stream_output)
+		o_stream_nsend_str(req->output,"[");
 
 	/* next: parse the next command */
 	req->parse_state = CLIENT_REQUEST_PARSE_CMD;
@@ -656,7 +774,10 @@ request_json_parse_cmd_done(struct client_request_http *req)
 	}
 
 	/* execute command */
-	doveadm_http_server_command_execute(req);
+	if (req->stream_output)
+		doveadm_http_server_command_queue(req);
+	else
+		doveadm_http_server_command_execute(req);
 
 	/* next: parse next command */
 	req->parse_state = CLIENT_REQUEST_PARSE_CMD;
@@ -768,6 +889,10 @@ doveadm_http_server_read_request_v1(struct client_request_http *req)
 	}
 
 	i_stream_destroy(&req->input);
+	if (req->stream_output) {
+		doveadm_http_server_stream_commands(req);
+		return;
+	}
 	o_stream_nsend_str(req->output,"]");
 
 	doveadm_http_server_send_response(req);
@@ -980,15 +1105,27 @@ doveadm_http_server_request_destroy(struct client_request_http *req)
 		(void)json_parser_deinit(&req->json_parser, &error);
 		// we've already failed, ignore error
 	}
-	if (req->output != NULL)
+	if (array_is_created(&req->stream_cmds)) {
+		struct client_request_http_cmd *qcmd;
+
+		array_foreach_modifiable(&req->stream_cmds, qcmd)
+			doveadm_cmd_params_clean(&qcmd->pargv);
+	}
+	if (req->stream_output_running) {
+		/* the payload output is still being written */
 		o_stream_set_no_error_handling(req->output, TRUE);
+	} else {
+		if (req->output != NULL)
+			o_stream_set_no_error_handling(req->output, TRUE);
+		o_stream_destroy(&req->output);
+	}
 	io_remove(&req->io);
-	o_stream_destroy(&req->output);
 	i_stream_destroy(&req->input);
 
 	http_server_request_unref(&req->http_request);
 	http_server_switch_ioloop(doveadm_http_server);
 
+	req->destroyed = TRUE;
 	pool_unref(&req->pool);
 	conn->request = NULL;
 }
@@ -1106,6 +1243,26 @@ doveadm_http_server_authorize_request(struct client_request_http *req)
 	return auth;
 }
 
+static bool
+doveadm_http_server_accepts_ndjson(const struct http_request *http_req)
+{
+	const char *accept, *const *types, *type, *p;
+
+	accept = http_request_header_get(http_req, "Accept");
+	if (accept == NULL)
+		return FALSE;
+	for (types = t_strsplit(accept, ","); *types != NULL; types++) {
+		type = *types;
+		p = strchr(type, ';');
+		if (p != NULL)
+			type = t_strdup_until(type, p);
+		if (strcasecmp(t_str_trim(type, " \t"),
+			       "application/x-ndjson") == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 static void
 doveadm_http_server_handle_request(void *context,
 				   struct http_server_request *http_sreq)
@@ -1167,6 +1324,10 @@ doveadm_http_server_handle_request(void *context,
 		req->output = iostream_temp_create_named(
 			"/tmp/doveadm.", 0, net_ip2addr(&conn->conn.remote_ip));
 		p_array_init(&req->pargv, req->pool, 5);
+		if (doveadm_http_server_accepts_ndjson(http_req)) {
+			req->stream_output = TRUE;
+			p_array_init(&req->stream_cmds, req->pool, 4);
+		}
 		ep->handler(req);
 	} else {
 		req->output = iostream_temp_create_named(
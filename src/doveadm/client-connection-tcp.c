@@ -255,6 +255,8 @@ client_handle_options(struct client_connection_tcp *conn,
 		if (strcmp(options[i], "log-passthrough") == 0) {
 			if (conn->log_out == NULL)
 				client_connection_log_passthrough(conn);
+		} else if (strcmp(options[i], "dsync-keep-connection") == 0) {
+			conn->conn.dsync_keep_connection = TRUE;
 		} else {
 			/* unknown option - ignore */
 		}
@@ -17,6 +17,10 @@ struct client_connection {
 	const struct doveadm_settings *set;
 
 	void (*free)(struct client_connection *conn);
+
+	/* Client wants the connection to stay open after a successful
+	   dsync-server command. */
+	bool dsync_keep_connection:1;
 };
 
 extern struct client_connection *doveadm_client;
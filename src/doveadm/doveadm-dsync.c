@@ -96,10 +96,14 @@ struct dsync_cmd_context {
 
 	enum dsync_run_type run_type;
 	struct doveadm_client *tcp_conn;
+	/* TCP connection that is kept open after the dsync, if possible */
+	struct doveadm_client *keep_conn;
+	const char *keep_conn_location;
 	const char *error;
 
 	unsigned int lock_timeout;
 	unsigned int import_commit_msgs_interval;
+	uoff_t import_commit_msgs_size;
 
 	bool lock:1;
 	bool purge_remote:1;
@@ -115,11 +119,21 @@ struct dsync_cmd_context {
 	bool exited:1;
 	bool empty_hdr_workaround:1;
 	bool no_header_hashes:1;
+	bool mail_guid_lookup:1;
 	bool err_line_continues:1;
+	bool keep_connection:1;
+	bool keep_connection_ok:1;
+	bool tcp_disconnected:1;
 };
 
 static bool legacy_dsync = FALSE;
 
+/* Connection to a remote doveadm server left open after a successful dsync,
+   so the next user synced to the same location doesn't need to connect
+   again. */
+static struct doveadm_client *dsync_idle_conn = NULL;
+static char *dsync_idle_conn_location = NULL;
+
 static void dsync_cmd_switch_ioloop_to(struct dsync_cmd_context *ctx,
 				       struct ioloop *ioloop)
 {
@@ -616,6 +630,8 @@ static struct dsync_ibc *
 cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 			  const char *name, const char *temp_prefix)
 {
+	struct dsync_ibc *ibc;
+
 	if (ctx->input == NULL) {
 		fd_set_nonblock(ctx->fd_in, TRUE);
 		fd_set_nonblock(ctx->fd_out, TRUE);
@@ -634,8 +650,20 @@ cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 		iostream_rawlog_create_path(ctx->rawlog_path,
 					    &ctx->input, &ctx->output);
 	}
-	return dsync_ibc_init_stream(ctx->input, ctx->output,
-				     name, temp_prefix, ctx->io_timeout_secs);
+	ibc = dsync_ibc_init_stream(ctx->input, ctx->output,
+				    name, temp_prefix, ctx->io_timeout_secs);
+	if (ctx->keep_connection)
+		dsync_ibc_stream_keep_streams(ibc);
+	else if (ctx->rawlog_path == NULL &&
+		 doveadm_settings->dsync_compression[0] != '\0') {
+		const char *error;
+
+		if (dsync_ibc_stream_set_compression(ibc,
+				doveadm_settings->dsync_compression, &error) < 0)
+			e_warning(ctx->ctx.cctx->event,
+				  "dsync_compression: %s", error);
+	}
+	return ibc;
 }
 
 static void
@@ -697,6 +725,82 @@ static void dsync_errors_finish(struct dsync_cmd_context *ctx)
 	i_close_fd(&ctx->fd_err);
 }
 
+static void dsync_idle_conn_close(void)
+{
+	if (dsync_idle_conn == NULL)
+		return;
+	doveadm_client_unref(&dsync_idle_conn);
+	i_free(dsync_idle_conn_location);
+}
+
+static void
+dsync_keep_conn_reply_callback(const struct doveadm_server_reply *reply,
+			       void *context)
+{
+	struct dsync_cmd_context *ctx = context;
+
+	ctx->keep_connection_ok = reply->exit_code == 0;
+	if (!ctx->keep_connection_ok) {
+		e_debug(ctx->ctx.cctx->event,
+			"Not reusing the dsync-server connection: %s",
+			reply->error);
+	}
+	io_loop_stop(current_ioloop);
+}
+
+static void dsync_keep_conn_release(struct dsync_cmd_context *ctx,
+				    bool success)
+{
+	struct doveadm_client *conn = ctx->keep_conn;
+	struct ioloop *prev_ioloop, *ioloop;
+
+	ctx->keep_conn = NULL;
+	ctx->keep_connection = FALSE;
+	if (!success) {
+		/* the iostreams are closed by the caller */
+		doveadm_client_unref(&conn);
+		doveadm_clients_destroy_all();
+		return;
+	}
+
+	/* log the remaining remote errors with this user's prefix */
+	if (ctx->err_stream != NULL)
+		remote_error_input(ctx);
+	io_remove(&ctx->io_err);
+	i_stream_set_max_buffer_size(ctx->input, ctx->input_orig_bufsize);
+	o_stream_set_max_buffer_size(ctx->output, ctx->output_orig_bufsize);
+
+	/* give the iostreams back to the connection and wait for the
+	   dsync-server command to finish */
+	prev_ioloop = current_ioloop;
+	ioloop = io_loop_create();
+	dsync_cmd_switch_ioloop_to(ctx, ioloop);
+	if (ctx->err_stream != NULL)
+		i_stream_switch_ioloop_to(ctx->err_stream, ioloop);
+	doveadm_client_switch_ioloop(conn);
+	doveadm_client_restore(conn, ctx->input, ctx->err_stream, ctx->output,
+			       ctx->ssl_iostream,
+			       dsync_keep_conn_reply_callback, ctx);
+	ctx->input = NULL;
+	ctx->err_stream = NULL;
+	ctx->output = NULL;
+	ctx->ssl_iostream = NULL;
+	ctx->fd_in = ctx->fd_out = -1;
+	ctx->keep_connection_ok = FALSE;
+	io_loop_run(ioloop);
+	io_loop_destroy(&ioloop);
+	i_assert(current_ioloop == prev_ioloop);
+
+	if (!ctx->keep_connection_ok)
+		doveadm_client_unref(&conn);
+	else {
+		doveadm_client_switch_ioloop(conn);
+		i_assert(dsync_idle_conn == NULL);
+		dsync_idle_conn = conn;
+		dsync_idle_conn_location = i_strdup(ctx->keep_conn_location);
+	}
+}
+
 static int
 cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 {
@@ -745,6 +849,7 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 	memcpy(set.sync_box_guid, ctx->mailbox_guid, sizeof(set.sync_box_guid));
 	set.lock_timeout_secs = ctx->lock_timeout;
 	set.import_commit_msgs_interval = ctx->import_commit_msgs_interval;
+	set.import_commit_msgs_size = ctx->import_commit_msgs_size;
 	set.state = ctx->state_input;
 	set.mailbox_alt_char = doveadm_settings->dsync_alt_char[0];
 	if (*doveadm_settings->dsync_hashed_headers == '\0') {
@@ -805,6 +910,8 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 		brain_flags |= DSYNC_BRAIN_FLAG_EMPTY_HDR_WORKAROUND;
 	if (ctx->no_header_hashes)
 		brain_flags |= DSYNC_BRAIN_FLAG_NO_HEADER_HASHES;
+	if (ctx->mail_guid_lookup)
+		brain_flags |= DSYNC_BRAIN_FLAG_MAIL_GUID_LOOKUP;
 	if (doveadm_debug)
 		brain_flags |= DSYNC_BRAIN_FLAG_DEBUG;
 
@@ -864,6 +971,8 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 	dsync_ibc_deinit(&ibc);
 	if (ibc2 != NULL)
 		dsync_ibc_deinit(&ibc2);
+	if (ctx->keep_conn != NULL)
+		dsync_keep_conn_release(ctx, ret == 0);
 	if (ctx->run_type != DSYNC_RUN_TYPE_CMD)
 		dsync_errors_finish(ctx);
 	ssl_iostream_destroy(&ctx->ssl_iostream);
@@ -913,6 +1022,7 @@ static void dsync_connected_callback(const struct doveadm_server_reply *reply,
 		break;
 	case DOVEADM_CLIENT_EXIT_CODE_DISCONNECTED:
 		ctx->ctx.exit_code = EX_TEMPFAIL;
+		ctx->tcp_disconnected = TRUE;
 		ctx->error = p_strdup_printf(ctx->ctx.pool,
 			"Disconnected from remote: %s", reply->error);
 		break;
@@ -967,9 +1077,9 @@ dsync_connect_tcp(struct dsync_cmd_context *ctx,
 		  const char *target, bool ssl, const char **error_r)
 {
 	struct doveadm_client_settings conn_set;
-	struct doveadm_client *conn;
+	struct doveadm_client *conn = NULL;
 	struct ioloop *prev_ioloop, *ioloop;
-	const char *p, *error;
+	const char *p, *location, *error;
 
 	i_zero(&conn_set);
 	if (strchr(target, '/') != NULL)
@@ -1004,32 +1114,83 @@ dsync_connect_tcp(struct dsync_cmd_context *ctx,
 	conn_set.username = ctx->ctx.set->doveadm_username;
 	conn_set.password = ctx->ctx.set->doveadm_password;
 	conn_set.log_passthrough = TRUE;
+	/* Keep the connection open for the following users. With doveadm
+	   server there may be more commands coming for this process. */
+	conn_set.dsync_keep_connection = ctx->rawlog_path == NULL &&
+		(!ctx->ctx.iterate_single_user ||
+		 ctx->ctx.cctx->conn_type != DOVEADM_CONNECTION_TYPE_CLI);
+
+	location = t_strdup_printf("%s:%s", ssl ? "tcps" : "tcp", target);
+	if (dsync_idle_conn != NULL &&
+	    (!conn_set.dsync_keep_connection ||
+	     strcmp(dsync_idle_conn_location, location) != 0))
+		dsync_idle_conn_close();
 
 	prev_ioloop = current_ioloop;
 	ioloop = io_loop_create();
 	dsync_cmd_switch_ioloop_to(ctx, ioloop);
 
-	if (doveadm_verbose_proctitle) {
-		process_title_set(t_strdup_printf(
-			"[dsync - connecting to %s]", target));
-	}
-	if (doveadm_client_create(&conn_set, &conn, &error) < 0) {
-		ctx->error = p_strdup_printf(ctx->ctx.pool,
-			"Couldn't create server connection: %s", error);
-	} else {
+	ctx->tcp_disconnected = FALSE;
+	if (dsync_idle_conn != NULL) {
+		conn = dsync_idle_conn;
+		dsync_idle_conn = NULL;
+		i_free(dsync_idle_conn_location);
+		doveadm_client_switch_ioloop(conn);
+
 		if (doveadm_verbose_proctitle) {
 			process_title_set(t_strdup_printf(
 				"[dsync - running dsync-server on %s]", target));
 		}
-
 		dsync_server_run_command(ctx, conn);
-		doveadm_client_unref(&conn);
+		if (ctx->tcp_disconnected) {
+			/* the server closed the idle connection - try again
+			   with a new connection */
+			e_debug(ctx->ctx.cctx->event,
+				"Kept connection to %s was closed: %s",
+				target, ctx->error);
+			doveadm_client_unref(&conn);
+			ctx->ctx.exit_code = 0;
+			ctx->error = NULL;
+		}
+	}
+	if (conn != NULL) {
+		/* reused the kept connection */
+	} else {
+		if (doveadm_verbose_proctitle) {
+			process_title_set(t_strdup_printf(
+				"[dsync - connecting to %s]", target));
+		}
+		if (doveadm_client_create(&conn_set, &conn, &error) < 0) {
+			ctx->error = p_strdup_printf(ctx->ctx.pool,
+				"Couldn't create server connection: %s", error);
+		} else {
+			if (doveadm_verbose_proctitle) {
+				process_title_set(t_strdup_printf(
+					"[dsync - running dsync-server on %s]",
+					target));
+			}
+			dsync_server_run_command(ctx, conn);
+		}
+	}
+	if (conn != NULL) {
+		if (ctx->error == NULL && ctx->input != NULL &&
+		    doveadm_client_is_dsync_connection_kept(conn)) {
+			ctx->keep_conn = conn;
+			ctx->keep_conn_location =
+				p_strdup(ctx->ctx.pool, location);
+			ctx->keep_connection = TRUE;
+		} else {
+			doveadm_client_unref(&conn);
+		}
 	}
 
-	doveadm_clients_destroy_all();
+	if (ctx->keep_conn == NULL)
+		doveadm_clients_destroy_all();
 
 	dsync_cmd_switch_ioloop_to(ctx, prev_ioloop);
 	io_loop_destroy(&ioloop);
+	if (ctx->keep_conn != NULL)
+		doveadm_client_switch_ioloop(ctx->keep_conn);
 
 	if (ctx->error != NULL) {
 		ssl_iostream_context_unref(&ctx->ssl_ctx);
@@ -1270,7 +1431,10 @@ static struct doveadm_mail_cmd_context *cmd_dsync_alloc(void)
                 ctx->empty_hdr_workaround = TRUE;
         if ((doveadm_settings->parsed_features & DSYNC_FEATURE_NO_HEADER_HASHES) != 0)
                 ctx->no_header_hashes = TRUE;
+	if ((doveadm_settings->parsed_features & DSYNC_FEATURE_MAIL_GUID_LOOKUP) != 0)
+		ctx->mail_guid_lookup = TRUE;
 	ctx->import_commit_msgs_interval = doveadm_settings->dsync_commit_msgs_interval;
+	ctx->import_commit_msgs_size = doveadm_settings->dsync_commit_msgs_size;
 	return &ctx->ctx;
 }
 
@@ -1298,6 +1462,7 @@ cmd_dsync_server_run(struct doveadm_mail_cmd_context *_ctx,
 	string_t *temp_prefix, *state_str = NULL;
 	enum dsync_brain_sync_type sync_type;
 	const char *name, *process_title_prefix = "";
+	char *prev_failure_prefix = NULL;
 	enum mail_error mail_error;
 
 	if (!cli) {
@@ -1318,6 +1483,10 @@ cmd_dsync_server_run(struct doveadm_mail_cmd_context *_ctx,
 		o_stream_ref(ctx->output);
 		o_stream_set_finish_also_parent(ctx->output, FALSE);
 		o_stream_nsend(ctx->output, "\n+\n", 3);
+		ctx->keep_connection = doveadm_client != NULL &&
+			doveadm_client->dsync_keep_connection;
+		if (ctx->keep_connection)
+			prev_failure_prefix = i_strdup(i_get_failure_prefix());
 		i_set_failure_prefix("dsync-server(%s): ", user->username);
 		name = i_stream_get_name(ctx->input);
 
@@ -1356,11 +1525,23 @@ cmd_dsync_server_run(struct doveadm_mail_cmd_context *_ctx,
 		doveadm_mail_failed_error(_ctx, mail_error);
 	dsync_ibc_deinit(&ibc);
 
-	if (!cli) {
+	if (cli) {
+		/* nothing to do */
+	} else if (ctx->keep_connection && _ctx->exit_code == 0 &&
+		   !ctx->input->closed && !ctx->output->closed) {
+		/* the generic doveadm connection code sends the reply and
+		   continues reading more commands */
+		i_stream_set_max_buffer_size(ctx->input,
+					     ctx->input_orig_bufsize);
+		o_stream_set_max_buffer_size(ctx->output,
+					     ctx->output_orig_bufsize);
+		i_set_failure_prefix("%s", prev_failure_prefix);
+	} else {
 		/* make sure nothing more is written by the generic doveadm
 		   connection code */
 		o_stream_close(cctx->output);
 	}
+	i_free(prev_failure_prefix);
 	i_stream_unref(&ctx->input);
 	o_stream_unref(&ctx->output);
 
@@ -1463,3 +1644,8 @@ DOVEADM_CMD_PARAM('U', "replicator-notify", CMD_PARAM_BOOL, 0)
 DOVEADM_CMD_PARAM('\0', "ignore-arg", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+void doveadm_dsync_deinit(void)
+{
+	dsync_idle_conn_close();
+}
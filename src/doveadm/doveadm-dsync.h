@@ -5,4 +5,7 @@ extern struct doveadm_cmd_ver2 doveadm_cmd_dsync_mirror;
 extern struct doveadm_cmd_ver2 doveadm_cmd_dsync_backup;
 extern struct doveadm_cmd_ver2 doveadm_cmd_dsync_server;
 
+/* Close the connection kept open for syncing more users. */
+void doveadm_dsync_deinit(void);
+
 #endif
@@ -0,0 +1,265 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "istream.h"
+#include "str.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+#include "mail-storage.h"
+#include "zstd-dictionary.h"
+#include "doveadm-print.h"
+#include "doveadm-mailbox-list-iter.h"
+#include "doveadm-mail-iter.h"
+#include "doveadm-mail.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sysexits.h>
+
+/* zstd's default dictionary size */
+#define COMPRESS_DICT_DEFAULT_SIZE (110*1024)
+/* zstd recommends around 100x more sample data than the dictionary size */
+#define COMPRESS_DICT_SAMPLES_SIZE_MULTIPLIER 100
+/* Dictionaries are useful for small mails, so only the beginning of
+   larger mails is used as a sample */
+#define COMPRESS_DICT_MAX_SAMPLE_SIZE (128*1024)
+
+struct compress_dict_cmd_context {
+	struct doveadm_mail_cmd_context ctx;
+
+	const char *path;
+	uint64_t dict_size;
+
+	buffer_t *samples;
+	ARRAY(size_t) sample_sizes;
+	bool have_users:1;
+};
+
+static bool compress_dict_samples_full(struct compress_dict_cmd_context *ctx)
+{
+	return ctx->samples->used >=
+		ctx->dict_size * COMPRESS_DICT_SAMPLES_SIZE_MULTIPLIER;
+}
+
+static int
+cmd_compress_dict_add_sample(struct compress_dict_cmd_context *ctx,
+			     struct mail *mail)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size, sample_size = 0;
+	enum mail_error error;
+	const char *errstr;
+	int ret;
+
+	if (mail_get_stream(mail, NULL, NULL, &input) < 0) {
+		errstr = mail_get_last_internal_error(mail, &error);
+		if (error == MAIL_ERROR_EXPUNGED)
+			return 0;
+		e_error(ctx->ctx.cctx->event, "Couldn't read UID=%u: %s",
+			mail->uid, errstr);
+		doveadm_mail_failed_error(&ctx->ctx, error);
+		return -1;
+	}
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		size = I_MIN(size, COMPRESS_DICT_MAX_SAMPLE_SIZE - sample_size);
+		buffer_append(ctx->samples, data, size);
+		sample_size += size;
+		if (sample_size == COMPRESS_DICT_MAX_SAMPLE_SIZE)
+			break;
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		e_error(ctx->ctx.cctx->event, "read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		buffer_set_used_size(ctx->samples,
+				     ctx->samples->used - sample_size);
+		doveadm_mail_failed_error(&ctx->ctx, MAIL_ERROR_TEMP);
+		return -1;
+	}
+	if (sample_size > 0)
+		array_push_back(&ctx->sample_sizes, &sample_size);
+	return 0;
+}
+
+static int
+cmd_compress_dict_box(struct compress_dict_cmd_context *ctx,
+		      const struct mailbox_info *info)
+{
+	struct doveadm_mail_iter *iter;
+	struct mail *mail;
+	int ret;
+
+	ret = doveadm_mail_iter_init(&ctx->ctx, info, ctx->ctx.search_args,
+				     MAIL_FETCH_STREAM_HEADER |
+				     MAIL_FETCH_STREAM_BODY, NULL, 0, &iter);
+	if (ret <= 0)
+		return ret;
+
+	ret = 0;
+	while (!compress_dict_samples_full(ctx) &&
+	       doveadm_mail_iter_next(iter, &mail)) {
+		if (cmd_compress_dict_add_sample(ctx, mail) < 0)
+			ret = -1;
+	}
+	if (doveadm_mail_iter_deinit(&iter) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int
+cmd_compress_dict_run(struct doveadm_mail_cmd_context *_ctx,
+		      struct mail_user *user)
+{
+	struct compress_dict_cmd_context *ctx =
+		container_of(_ctx, struct compress_dict_cmd_context, ctx);
+	const enum mailbox_list_iter_flags iter_flags =
+		MAILBOX_LIST_ITER_NO_AUTO_BOXES |
+		MAILBOX_LIST_ITER_RETURN_NO_FLAGS;
+	struct doveadm_mailbox_list_iter *iter;
+	const struct mailbox_info *info;
+	int ret = 0;
+
+	ctx->have_users = TRUE;
+	iter = doveadm_mailbox_list_iter_init(_ctx, user, _ctx->search_args,
+					      iter_flags);
+	while (!compress_dict_samples_full(ctx) &&
+	       (info = doveadm_mailbox_list_iter_next(iter)) != NULL) T_BEGIN {
+		if (cmd_compress_dict_box(ctx, info) < 0)
+			ret = -1;
+	} T_END;
+	if (doveadm_mailbox_list_iter_deinit(&iter) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int
+cmd_compress_dict_write(struct compress_dict_cmd_context *ctx,
+			const buffer_t *dict)
+{
+	string_t *temp_path = t_str_new(128);
+	int fd;
+
+	str_printfa(temp_path, "%s.", ctx->path);
+	fd = safe_mkstemp(temp_path, 0644, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		e_error(ctx->ctx.cctx->event,
+			"safe_mkstemp(%s) failed: %m", str_c(temp_path));
+		return -1;
+	}
+	if (write_full(fd, dict->data, dict->used) < 0) {
+		e_error(ctx->ctx.cctx->event,
+			"write(%s) failed: %m", str_c(temp_path));
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	if (close(fd) < 0) {
+		e_error(ctx->ctx.cctx->event,
+			"close(%s) failed: %m", str_c(temp_path));
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	if (rename(str_c(temp_path), ctx->path) < 0) {
+		e_error(ctx->ctx.cctx->event, "rename(%s, %s) failed: %m",
+			str_c(temp_path), ctx->path);
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	return 0;
+}
+
+static void cmd_compress_dict_train(struct compress_dict_cmd_context *ctx)
+{
+	buffer_t *dict_buf;
+	const char *error;
+
+	if (array_is_empty(&ctx->sample_sizes)) {
+		e_error(ctx->ctx.cctx->event, "No mails found for samples");
+		ctx->ctx.exit_code = DOVEADM_EX_NOTFOUND;
+		return;
+	}
+
+	dict_buf = buffer_create_dynamic(default_pool, ctx->dict_size);
+	if (zstd_dictionary_train(ctx->samples,
+				  array_front(&ctx->sample_sizes),
+				  array_count(&ctx->sample_sizes),
+				  ctx->dict_size, dict_buf, &error) < 0) {
+		e_error(ctx->ctx.cctx->event, "%s", error);
+		ctx->ctx.exit_code = DOVEADM_EX_NOTPOSSIBLE;
+	} else if (cmd_compress_dict_write(ctx, dict_buf) < 0) {
+		ctx->ctx.exit_code = EX_CANTCREAT;
+	} else {
+		doveadm_print(dec2str(dict_buf->used));
+		doveadm_print(dec2str(array_count(&ctx->sample_sizes)));
+		doveadm_print(dec2str(ctx->samples->used));
+	}
+	buffer_free(&dict_buf);
+}
+
+static void cmd_compress_dict_deinit(struct doveadm_mail_cmd_context *_ctx)
+{
+	struct compress_dict_cmd_context *ctx =
+		container_of(_ctx, struct compress_dict_cmd_context, ctx);
+
+	if (ctx->samples == NULL)
+		return;
+	/* samples are collected from all the users */
+	if (ctx->have_users && _ctx->exit_code == 0)
+		cmd_compress_dict_train(ctx);
+	array_free(&ctx->sample_sizes);
+	buffer_free(&ctx->samples);
+}
+
+static void cmd_compress_dict_init(struct doveadm_mail_cmd_context *_ctx)
+{
+	struct doveadm_cmd_context *cctx = _ctx->cctx;
+	struct compress_dict_cmd_context *ctx =
+		container_of(_ctx, struct compress_dict_cmd_context, ctx);
+	const char *const *query;
+
+	if (!doveadm_cmd_param_str(cctx, "output", &ctx->path) ||
+	    !doveadm_cmd_param_array(cctx, "query", &query))
+		doveadm_mail_help_name("compress dictionary train");
+	if (!doveadm_cmd_param_uint64(cctx, "size", &ctx->dict_size))
+		ctx->dict_size = COMPRESS_DICT_DEFAULT_SIZE;
+	if (ctx->dict_size == 0 || ctx->dict_size > 1024*1024)
+		i_fatal_status(EX_USAGE, "Invalid dictionary size");
+	ctx->path = p_strdup(_ctx->pool, ctx->path);
+
+	_ctx->search_args = doveadm_mail_build_search_args(query);
+
+	ctx->samples = buffer_create_dynamic(default_pool, 1024*1024);
+	i_array_init(&ctx->sample_sizes, 1024);
+
+	doveadm_print_header_simple("size");
+	doveadm_print_header_simple("samples");
+	doveadm_print_header_simple("samples_size");
+}
+
+static struct doveadm_mail_cmd_context *cmd_compress_dict_alloc(void)
+{
+	struct compress_dict_cmd_context *ctx;
+
+	ctx = doveadm_mail_cmd_alloc(struct compress_dict_cmd_context);
+	ctx->ctx.v.init = cmd_compress_dict_init;
+	ctx->ctx.v.run = cmd_compress_dict_run;
+	ctx->ctx.v.deinit = cmd_compress_dict_deinit;
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	return &ctx->ctx;
+}
+
+struct doveadm_cmd_ver2 doveadm_cmd_compress_dictionary_train_ver2 = {
+	.name = "compress dictionary train",
+	.mail_cmd = cmd_compress_dict_alloc,
+	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX
+		"-o <path> [-s <max size>] <search query>",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('o', "output", CMD_PARAM_STR, 0)
+DOVEADM_CMD_PARAM('s', "size", CMD_PARAM_INT64, CMD_PARAM_FLAG_UNSIGNED)
+DOVEADM_CMD_PARAM('\0', "query", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
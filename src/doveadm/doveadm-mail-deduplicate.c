@@ -21,6 +21,7 @@ cmd_deduplicate_box(struct doveadm_mail_cmd_context *_ctx,
 	struct deduplicate_cmd_context *ctx =
 		container_of(_ctx, struct deduplicate_cmd_context, ctx);
 
+	static const char *const msgid_headers[] = { "Message-ID", NULL };
 	struct doveadm_mail_iter *iter;
 	struct mail *mail;
 	enum mail_error error;
@@ -28,8 +29,13 @@ cmd_deduplicate_box(struct doveadm_mail_cmd_context *_ctx,
 	HASH_TABLE(const char *, void *) hash;
 	const char *key, *errstr;
 
-	int ret = doveadm_mail_iter_init(_ctx, info, search_args, 0, NULL, 0,
-					 &iter);
+	/* Tell the storage which field is wanted, so it can be prefetched
+	   (e.g. from the cache file) rather than looked up separately for
+	   each mail. */
+	int ret = doveadm_mail_iter_init(_ctx, info, search_args,
+					 ctx->by_msgid ? 0 : MAIL_FETCH_GUID,
+					 ctx->by_msgid ? msgid_headers : NULL,
+					 0, &iter);
 	if (ret <= 0)
 		return ret;
 
@@ -0,0 +1,352 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "strescape.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "iostream-temp.h"
+#include "execv-const.h"
+#include "env-util.h"
+#include "master-interface.h"
+#include "doveadm-settings.h"
+#include "doveadm-print.h"
+#include "doveadm-mail.h"
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Maximum number of users whose output is kept waiting for an earlier user's
+   worker to finish, per allowed worker. */
+#define DOVEADM_MAIL_WORKERS_PENDING_FACTOR 16
+
+struct doveadm_mail_worker {
+	char *username;
+	pid_t pid;
+	int fd;
+	struct io *io;
+	/* The worker's output, buffered until all the previous users'
+	   output has been printed. */
+	struct ostream *output;
+	int exit_status;
+	bool finished;
+};
+
+static ARRAY(struct doveadm_mail_worker *) doveadm_mail_workers;
+static unsigned int doveadm_mail_workers_running = 0;
+
+bool doveadm_mail_workers_enabled(struct doveadm_mail_cmd_context *ctx)
+{
+	return ctx->set->doveadm_local_worker_count > 0 &&
+		ctx->set->doveadm_worker_count == 0 &&
+		ctx->cctx->conn_type == DOVEADM_CONNECTION_TYPE_CLI &&
+		!ctx->iterate_single_user && ctx->cmd_input == NULL;
+}
+
+static void doveadm_mail_worker_free(struct doveadm_mail_worker **_worker)
+{
+	struct doveadm_mail_worker *worker = *_worker;
+
+	*_worker = NULL;
+	io_remove(&worker->io);
+	i_close_fd(&worker->fd);
+	o_stream_destroy(&worker->output);
+	i_free(worker->username);
+	i_free(worker);
+}
+
+static void doveadm_mail_worker_finish(struct doveadm_mail_worker *worker)
+{
+	int status;
+
+	io_remove(&worker->io);
+	i_close_fd(&worker->fd);
+
+	/* the worker closed its stdout, so it's exiting */
+	while (waitpid(worker->pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			i_error("waitpid(%ld) failed: %m", (long)worker->pid);
+			status = EX_TEMPFAIL << 8;
+			break;
+		}
+	}
+	if (WIFSIGNALED(status)) {
+		i_error("doveadm worker for user %s killed by signal %d",
+			worker->username, WTERMSIG(status));
+		worker->exit_status = EX_TEMPFAIL;
+	} else {
+		worker->exit_status = WEXITSTATUS(status);
+	}
+	worker->finished = TRUE;
+
+	i_assert(doveadm_mail_workers_running > 0);
+	doveadm_mail_workers_running--;
+	io_loop_stop(current_ioloop);
+}
+
+static void doveadm_mail_worker_input(struct doveadm_mail_worker *worker)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	ssize_t ret;
+
+	ret = read(worker->fd, buf, sizeof(buf));
+	if (ret > 0) {
+		o_stream_nsend(worker->output, buf, ret);
+		return;
+	}
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		i_error("read(doveadm worker for user %s) failed: %m",
+			worker->username);
+	}
+	doveadm_mail_worker_finish(worker);
+}
+
+static const char *const *
+doveadm_mail_worker_get_args(struct doveadm_mail_cmd_context *ctx,
+			     const char *username)
+{
+	ARRAY_TYPE(const_string) args;
+	const char *const *cmd_args;
+
+	t_array_init(&args, 16);
+	const char *bin_path = BINDIR"/doveadm";
+	array_push_back(&args, &bin_path);
+	if (doveadm_debug) {
+		const char *arg = "-D";
+		array_push_back(&args, &arg);
+	} else if (doveadm_verbose) {
+		const char *arg = "-v";
+		array_push_back(&args, &arg);
+	}
+	const char *format_args[] = { "-f", DOVEADM_PRINT_TYPE_SERVER };
+	array_append(&args, format_args, N_ELEMENTS(format_args));
+
+	/* doveadm_cmdv2_wrapper_generate_args() leaves out all the user
+	   selection parameters */
+	const char *const *cmd_name = t_strsplit_spaces(ctx->cmd->name, " ");
+	array_append(&args, cmd_name, str_array_length(cmd_name));
+	const char *user_args[] = { "-u", username };
+	array_append(&args, user_args, N_ELEMENTS(user_args));
+	cmd_args = doveadm_cmdv2_wrapper_generate_args(ctx);
+	array_append(&args, cmd_args, str_array_length(cmd_args));
+	array_append_zero(&args);
+	return array_front(&args);
+}
+
+static int
+doveadm_mail_worker_start(struct doveadm_mail_cmd_context *ctx,
+			  const char *username)
+{
+	struct doveadm_mail_worker *worker;
+	const char *const *args;
+	int fd[2];
+	pid_t pid;
+
+	args = doveadm_mail_worker_get_args(ctx, username);
+	if (pipe(fd) < 0) {
+		e_error(ctx->cctx->event, "pipe() failed: %m");
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		e_error(ctx->cctx->event, "fork() failed: %m");
+		i_close_fd(&fd[0]);
+		i_close_fd(&fd[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		/* child: run the command for the single user with output
+		   going to the pipe. Use the already parsed configuration,
+		   similarly to dsync. */
+		if (dup2(fd[1], STDOUT_FILENO) < 0)
+			i_fatal("dup2() failed: %m");
+		i_close_fd(&fd[0]);
+		i_close_fd(&fd[1]);
+
+		int config_fd = doveadm_settings_get_config_fd();
+		fd_close_on_exec(config_fd, FALSE);
+		env_put(DOVECOT_CONFIG_FD_ENV, dec2str(config_fd));
+		execv_const(args[0], args);
+	}
+	i_close_fd(&fd[1]);
+	net_set_nonblock(fd[0], TRUE);
+	fd_close_on_exec(fd[0], TRUE);
+
+	worker = i_new(struct doveadm_mail_worker, 1);
+	worker->username = i_strdup(username);
+	worker->pid = pid;
+	worker->fd = fd[0];
+	worker->output = iostream_temp_create("/tmp/doveadm.", 0);
+	worker->io = io_add(worker->fd, IO_READ,
+			    doveadm_mail_worker_input, worker);
+	array_push_back(&doveadm_mail_workers, &worker);
+	doveadm_mail_workers_running++;
+	return 0;
+}
+
+static void
+doveadm_mail_worker_print_value(const unsigned char *data, size_t size,
+				bool finished, bool *streaming)
+{
+	string_t *str = t_str_new(size);
+
+	/* The worker output is in doveadm-server's print format, so this
+	   works the same way as printing doveadm-server's replies. */
+	if (!finished) {
+		*streaming = TRUE;
+		str_append_tabunescaped(str, data, size);
+		doveadm_print_stream(str->data, str->used);
+	} else if (*streaming) {
+		*streaming = FALSE;
+		if (size > 0) {
+			str_append_tabunescaped(str, data, size);
+			doveadm_print_stream(str->data, str->used);
+		}
+		doveadm_print_stream("", 0);
+	} else {
+		str_append_tabunescaped(str, data, size);
+		doveadm_print(str_c(str));
+	}
+}
+
+static void
+doveadm_mail_worker_print(struct doveadm_mail_cmd_context *ctx,
+			  struct doveadm_mail_worker *worker)
+{
+	struct istream *input;
+	const unsigned char *data, *p;
+	unsigned int values = 0, row_values;
+	bool streaming = FALSE;
+	size_t size;
+
+	input = iostream_temp_finish(&worker->output, IO_BLOCK_SIZE);
+	if (!doveadm_print_is_initialized()) {
+		/* the command doesn't print anything via doveadm-print */
+		o_stream_nsend_istream(doveadm_print_ostream, input);
+		i_stream_unref(&input);
+		return;
+	}
+
+	/* all the headers except the sticky username */
+	row_values = doveadm_print_get_headers_count() - 1;
+	doveadm_print_sticky("username", worker->username);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		p = memchr(data, '\t', size);
+		if (p != NULL) {
+			T_BEGIN {
+				doveadm_mail_worker_print_value(data, p - data,
+								TRUE, &streaming);
+			} T_END;
+			i_stream_skip(input, p - data + 1);
+			values++;
+			continue;
+		}
+		/* partial value - don't split an escape sequence */
+		if (data[size-1] == '\001')
+			size--;
+		if (size == 0) {
+			if (i_stream_read(input) <= 0)
+				break;
+			continue;
+		}
+		T_BEGIN {
+			doveadm_mail_worker_print_value(data, size, FALSE,
+							&streaming);
+		} T_END;
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		e_error(ctx->cctx->event,
+			"read(%s) failed: %s", i_stream_get_name(input),
+			i_stream_get_error(input));
+	}
+	if (streaming) {
+		doveadm_print_stream("", 0);
+		values++;
+	}
+	if (row_values > 0 && values % row_values != 0) {
+		/* the worker died in the middle of a row - keep the
+		   following users' rows aligned */
+		e_error(ctx->cctx->event,
+			"doveadm worker for user %s output a partial row",
+			worker->username);
+		for (; values % row_values != 0; values++)
+			doveadm_print("");
+		if (worker->exit_status == 0)
+			worker->exit_status = EX_TEMPFAIL;
+	}
+	i_stream_unref(&input);
+}
+
+static void
+doveadm_mail_workers_print_finished(struct doveadm_mail_cmd_context *ctx)
+{
+	struct doveadm_mail_worker *worker;
+
+	/* print the output in the same order as the users were iterated */
+	while (array_count(&doveadm_mail_workers) > 0) {
+		worker = array_idx_elem(&doveadm_mail_workers, 0);
+		if (!worker->finished)
+			break;
+		array_pop_front(&doveadm_mail_workers);
+
+		doveadm_mail_worker_print(ctx, worker);
+		switch (worker->exit_status) {
+		case 0:
+			break;
+		case EX_NOUSER:
+			e_info(ctx->cctx->event,
+			       "User %s no longer exists, skipping",
+			       worker->username);
+			break;
+		default:
+			e_error(ctx->cctx->event,
+				"doveadm worker for user %s failed "
+				"with exit code %d",
+				worker->username, worker->exit_status);
+			ctx->exit_code = worker->exit_status;
+			break;
+		}
+		doveadm_mail_worker_free(&worker);
+	}
+}
+
+int doveadm_mail_workers_user(struct doveadm_mail_cmd_context *ctx,
+			      const char *username)
+{
+	unsigned int limit = ctx->set->doveadm_local_worker_count;
+
+	if (!array_is_created(&doveadm_mail_workers))
+		i_array_init(&doveadm_mail_workers, limit * 2);
+
+	/* wait until there's space for a new worker */
+	while (doveadm_mail_workers_running >= limit ||
+	       (doveadm_mail_workers_running > 0 &&
+		array_count(&doveadm_mail_workers) >=
+		limit * DOVEADM_MAIL_WORKERS_PENDING_FACTOR)) {
+		io_loop_run(current_ioloop);
+		doveadm_mail_workers_print_finished(ctx);
+	}
+	if (doveadm_mail_worker_start(ctx, username) < 0)
+		return -1;
+	doveadm_mail_workers_print_finished(ctx);
+	return 0;
+}
+
+void doveadm_mail_workers_flush(struct doveadm_mail_cmd_context *ctx)
+{
+	if (!array_is_created(&doveadm_mail_workers))
+		return;
+
+	while (doveadm_mail_workers_running > 0) {
+		io_loop_run(current_ioloop);
+		doveadm_mail_workers_print_finished(ctx);
+	}
+	doveadm_mail_workers_print_finished(ctx);
+	i_assert(array_count(&doveadm_mail_workers) == 0);
+	array_free(&doveadm_mail_workers);
+}
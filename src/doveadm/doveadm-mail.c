@@ -523,6 +523,7 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 	struct doveadm_cmd_context *cctx = ctx->cctx;
 	unsigned int user_idx;
 	const char *ip, *user, *error;
+	bool workers = doveadm_mail_workers_enabled(ctx);
 	int ret;
 
 	ctx->service_flags |= MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP;
@@ -551,7 +552,17 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 				continue;
 		}
 		cctx->username = user;
-		T_BEGIN {
+		if (workers && strpbrk(user, "*?") == NULL) {
+			/* the worker looks up the user itself */
+			if (doveadm_mail_workers_user(ctx, user) < 0) {
+				ret = -1;
+				break;
+			}
+		} else T_BEGIN {
+			if (workers) {
+				/* keep the output in order */
+				doveadm_mail_workers_flush(ctx);
+			}
 			ret = doveadm_mail_next_user(ctx, &error);
 			if (ret < 0)
 				e_error(ctx->cctx->event, "%s", error);
@@ -572,6 +583,8 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 			break;
 		}
 	}
+	if (workers)
+		doveadm_mail_workers_flush(ctx);
 	if (doveadm_verbose)
 		printf("\n");
 	ip = net_ip2addr(&cctx->remote_ip);
@@ -782,6 +795,7 @@ static struct doveadm_cmd_ver2 *mail_commands_ver2[] = {
 	&doveadm_cmd_index_ver2,
 	&doveadm_cmd_altmove_ver2,
 	&doveadm_cmd_deduplicate_ver2,
+	&doveadm_cmd_compress_dictionary_train_ver2,
 	&doveadm_cmd_expunge_ver2,
 	&doveadm_cmd_flags_add_ver2,
 	&doveadm_cmd_flags_remove_ver2,
@@ -132,6 +132,16 @@ void doveadm_mail_server_handle(struct doveadm_server *server,
 				const char *username, bool print_username);
 void doveadm_mail_server_flush(struct doveadm_mail_cmd_context *ctx);
 
+/* Returns TRUE if the users should be handled by local doveadm worker
+   processes (doveadm_local_worker_count). */
+bool doveadm_mail_workers_enabled(struct doveadm_mail_cmd_context *ctx);
+/* Run the command for the user in a new worker process. Waits until there
+   is a free worker slot. Returns 0 if the worker was started, -1 if not. */
+int doveadm_mail_workers_user(struct doveadm_mail_cmd_context *ctx,
+			      const char *username);
+/* Wait for all the workers to finish and print their output. */
+void doveadm_mail_workers_flush(struct doveadm_mail_cmd_context *ctx);
+
 int doveadm_cmd_pass_lookup(struct doveadm_mail_cmd_context *ctx,
 			    const char *const *extra_fields, pool_t pool,
 			    const char *const **fields_r,
@@ -189,6 +199,7 @@ extern struct doveadm_cmd_ver2 doveadm_cmd_save_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_index_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_altmove_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_deduplicate_ver2;
+extern struct doveadm_cmd_ver2 doveadm_cmd_compress_dictionary_train_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_expunge_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_flags_add_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_flags_remove_ver2;
@@ -16,6 +16,9 @@ struct doveadm_print_json_context {
 	bool first_row;
 	bool in_stream;
 	bool flushed;
+	/* Print each row as a separate JSON object on its own line instead
+	   of a single JSON array */
+	bool ndjson;
 	ARRAY(struct doveadm_print_header) headers;
 	pool_t pool;
 	string_t *str;
@@ -35,6 +38,12 @@ static void doveadm_print_json_init(void)
 	ctx.in_stream = FALSE;
 }
 
+static void doveadm_print_ndjson_init(void)
+{
+	doveadm_print_json_init();
+	ctx.ndjson = TRUE;
+}
+
 static void
 doveadm_print_json_header(const struct doveadm_print_header *hdr)
 {
@@ -50,7 +59,9 @@ doveadm_print_json_value_header(const struct doveadm_print_header *hdr)
 {
 	// get header name
 	if (ctx.header_idx == 0) {
-		if (ctx.first_row == TRUE) {
+		if (ctx.ndjson) {
+			/* no separators between rows */
+		} else if (ctx.first_row == TRUE) {
 			ctx.first_row = FALSE;
 			str_append_c(ctx.str, '[');
 		} else {
@@ -72,6 +83,8 @@ doveadm_print_json_value_footer(void) {
 	if (++ctx.header_idx == ctx.header_count) {
 		ctx.header_idx = 0;
 		str_append_c(ctx.str, '}');
+		if (ctx.ndjson)
+			str_append_c(ctx.str, '\n');
 		doveadm_print_json_flush_internal();
 	}
 }
@@ -133,7 +146,9 @@ static void doveadm_print_json_flush(void)
 		return;
 	ctx.flushed = TRUE;
 
-	if (ctx.first_row == FALSE)
+	if (ctx.ndjson) {
+		/* rows were already written */
+	} else if (ctx.first_row == FALSE)
 		str_append_c(ctx.str,']');
 	else {
 		str_append_c(ctx.str,'[');
@@ -158,3 +173,13 @@ struct doveadm_print_vfuncs doveadm_print_json_vfuncs = {
 	doveadm_print_json_flush
 };
 
+struct doveadm_print_vfuncs doveadm_print_ndjson_vfuncs = {
+	"ndjson",
+
+	doveadm_print_ndjson_init,
+	doveadm_print_json_deinit,
+	doveadm_print_json_header,
+	doveadm_print_json_print,
+	doveadm_print_json_print_stream,
+	doveadm_print_json_flush
+};
@@ -7,6 +7,7 @@
 #define DOVEADM_PRINT_TYPE_TABLE "table"
 #define DOVEADM_PRINT_TYPE_SERVER "server"
 #define DOVEADM_PRINT_TYPE_JSON "json"
+#define DOVEADM_PRINT_TYPE_NDJSON "ndjson"
 #define DOVEADM_PRINT_TYPE_FORMATTED "formatted"
 
 enum doveadm_print_header_flags {
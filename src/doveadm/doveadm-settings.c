@@ -78,6 +78,7 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(STR, auth_socket_path),
 	DEF(STR, doveadm_socket_path),
 	DEF(UINT, doveadm_worker_count),
+	DEF(UINT, doveadm_local_worker_count),
 	DEF(IN_PORT, doveadm_port),
 	{ .type = SET_ALIAS, .key = "doveadm_proxy_port" },
 	DEF(ENUM, doveadm_ssl),
@@ -89,8 +90,10 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(STR, doveadm_api_key),
 	DEF(STR, dsync_features),
 	DEF(UINT, dsync_commit_msgs_interval),
+	DEF(SIZE, dsync_commit_msgs_size),
 	DEF(STR, doveadm_http_rawlog_dir),
 	DEF(STR, dsync_hashed_headers),
+	DEF(STR, dsync_compression),
 
 	{ .type = SET_STRLIST, .key = "plugin",
 	  .offset = offsetof(struct doveadm_settings, plugin_envs) },
@@ -108,6 +111,7 @@ const struct doveadm_settings doveadm_default_settings = {
 	.auth_socket_path = "auth-userdb",
 	.doveadm_socket_path = "doveadm-server",
 	.doveadm_worker_count = 0,
+	.doveadm_local_worker_count = 0,
 	.doveadm_port = 0,
 	.doveadm_ssl = "no:ssl:starttls",
 	.doveadm_username = "doveadm",
@@ -117,7 +121,9 @@ const struct doveadm_settings doveadm_default_settings = {
 	.dsync_remote_cmd = "ssh -l%{login} %{host} doveadm dsync-server -u%u -U",
 	.dsync_features = "",
 	.dsync_hashed_headers = "Date Message-ID",
+	.dsync_compression = "",
 	.dsync_commit_msgs_interval = 100,
+	.dsync_commit_msgs_size = 0,
 	.doveadm_api_key = "",
 	.doveadm_http_rawlog_dir = "",
 
@@ -161,6 +167,7 @@ struct dsync_feature_list {
 static const struct dsync_feature_list dsync_feature_list[] = {
 	{ "empty-header-workaround", DSYNC_FEATURE_EMPTY_HDR_WORKAROUND },
 	{ "no-header-hashes", DSYNC_FEATURE_NO_HEADER_HASHES },
+	{ "mail-guid-lookup", DSYNC_FEATURE_MAIL_GUID_LOOKUP },
 	{ NULL, 0 }
 };
 
@@ -9,6 +9,7 @@ struct ssl_iostream_settings;
 enum dsync_features {
 	DSYNC_FEATURE_EMPTY_HDR_WORKAROUND = 0x1,
 	DSYNC_FEATURE_NO_HEADER_HASHES = 0x2,
+	DSYNC_FEATURE_MAIL_GUID_LOOKUP = 0x4,
 };
 /* </settings checks> */
 
@@ -22,6 +23,7 @@ struct doveadm_settings {
 	const char *auth_socket_path;
 	const char *doveadm_socket_path;
 	unsigned int doveadm_worker_count;
+	unsigned int doveadm_local_worker_count;
 	in_port_t doveadm_port;
 	const char *doveadm_ssl;
 	const char *doveadm_username;
@@ -32,7 +34,9 @@ struct doveadm_settings {
 	const char *doveadm_api_key;
 	const char *dsync_features;
 	const char *dsync_hashed_headers;
+	const char *dsync_compression;
 	unsigned int dsync_commit_msgs_interval;
+	uoff_t dsync_commit_msgs_size;
 	const char *doveadm_http_rawlog_dir;
 	enum dsync_features parsed_features;
 	ARRAY(const char *) plugin_envs;
@@ -26,7 +26,10 @@ const struct doveadm_print_vfuncs *doveadm_print_vfuncs_all[] = {
 	&doveadm_print_table_vfuncs,
 	&doveadm_print_pager_vfuncs,
 	&doveadm_print_json_vfuncs,
+	&doveadm_print_ndjson_vfuncs,
 	&doveadm_print_formatted_vfuncs,
+	/* used by doveadm_local_worker_count workers */
+	&doveadm_print_server_vfuncs,
 	NULL
 };
 
@@ -375,6 +378,7 @@ int main(int argc, char *argv[])
 		i_fatal("Command requested referral: %s", cctx->referral);
 
 	doveadm_cmd_context_unref(&cctx);
+	doveadm_dsync_deinit();
 	if (!quick_init) {
 		doveadm_mail_deinit();
 		doveadm_dump_deinit();
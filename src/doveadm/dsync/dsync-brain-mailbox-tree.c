@@ -1,7 +1,11 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
+#include "strescape.h"
+#include "hex-binary.h"
+#include "sha2.h"
 #include "mail-namespace.h"
 #include "mailbox-list-private.h"
 #include "dsync-ibc.h"
@@ -84,13 +88,106 @@ void dsync_brain_mailbox_trees_init(struct dsync_brain *brain)
 		dsync_mailbox_tree_iter_init(brain->local_mailbox_tree);
 }
 
+static const char *
+dsync_brain_mailbox_tree_get_digest(struct dsync_brain *brain)
+{
+	struct dsync_mailbox_tree_iter *iter;
+	struct dsync_mailbox_node *node;
+	ARRAY_TYPE(const_string) lines;
+	const char *full_name, *line, *const *parts;
+	struct sha256_ctx ctx;
+	unsigned char digest[SHA256_RESULTLEN];
+	string_t *str;
+
+	/* The digest covers everything that would be sent for the tree
+	   nodes. The nodes are sorted, since the iteration order depends on
+	   the order in which the mailboxes were listed. */
+	t_array_init(&lines, 128);
+	iter = dsync_mailbox_tree_iter_init(brain->local_mailbox_tree);
+	while (dsync_mailbox_tree_iter_next(iter, &full_name, &node)) {
+		if (node->ns == NULL)
+			continue;
+
+		str = t_str_new(128);
+		parts = dsync_mailbox_name_to_parts(full_name,
+						    brain->hierarchy_sep,
+						    brain->escape_char);
+		for (; *parts != NULL; parts++) {
+			str_append_tabescaped(str, *parts);
+			str_append_c(str, '\t');
+		}
+		str_printfa(str, "%d %s", node->existence,
+			    dsync_mailbox_node_to_string(node));
+		line = str_c(str);
+		array_push_back(&lines, &line);
+	}
+	dsync_mailbox_tree_iter_deinit(&iter);
+	array_sort(&lines, i_strcmp_p);
+
+	sha256_init(&ctx);
+	array_foreach_elem(&lines, line)
+		sha256_loop(&ctx, line, strlen(line) + 1);
+	sha256_result(&ctx, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+bool dsync_brain_recv_mailbox_tree_digest(struct dsync_brain *brain)
+{
+	const char *remote_digest;
+
+	if (dsync_ibc_recv_mailbox_tree_digest(brain->ibc,
+					       &remote_digest) == 0)
+		return FALSE;
+
+	/* Both sides see the same two digests, so they both either skip
+	   sending their trees or send them. */
+	brain->mailbox_tree_unchanged =
+		strcmp(remote_digest, brain->mailbox_tree_digest_local) == 0;
+	e_debug(brain->event, "Mailbox tree digests %s",
+		brain->mailbox_tree_unchanged ? "match" : "differ");
+	brain->state = DSYNC_STATE_SEND_MAILBOX_TREE;
+	return TRUE;
+}
+
+static void
+dsync_brain_copy_local_mailbox_tree(struct dsync_brain *brain)
+{
+	struct dsync_mailbox_tree_iter *iter;
+	struct dsync_mailbox_node *node, *remote_node;
+	const char *full_name;
+
+	/* The remote's tree is identical to ours. Fill the remote tree the
+	   same way as if the nodes had been received. */
+	iter = dsync_mailbox_tree_iter_init(brain->local_mailbox_tree);
+	while (dsync_mailbox_tree_iter_next(iter, &full_name, &node)) {
+		if (node->ns == NULL)
+			continue;
+		remote_node = dsync_mailbox_tree_get(brain->remote_mailbox_tree,
+						     full_name);
+		remote_node->ns = node->ns;
+		dsync_mailbox_node_copy_data(remote_node, node);
+	}
+	dsync_mailbox_tree_iter_deinit(&iter);
+}
+
 void dsync_brain_send_mailbox_tree(struct dsync_brain *brain)
 {
 	struct dsync_mailbox_node *node;
 	enum dsync_ibc_send_ret ret;
 	const char *full_name;
 
-	while (dsync_mailbox_tree_iter_next(brain->local_tree_iter,
+	if (brain->mailbox_tree_digest && !brain->mailbox_tree_digest_sent) {
+		brain->mailbox_tree_digest_local = p_strdup(brain->pool,
+			dsync_brain_mailbox_tree_get_digest(brain));
+		dsync_ibc_send_mailbox_tree_digest(brain->ibc,
+			brain->mailbox_tree_digest_local);
+		brain->mailbox_tree_digest_sent = TRUE;
+		brain->state = DSYNC_STATE_RECV_MAILBOX_TREE_DIGEST;
+		return;
+	}
+
+	while (!brain->mailbox_tree_unchanged &&
+	       dsync_mailbox_tree_iter_next(brain->local_tree_iter,
 					    &full_name, &node)) {
 		if (node->ns == NULL) {
 			/* This node was created when adding a namespace prefix
@@ -454,6 +551,8 @@ bool dsync_brain_recv_mailbox_tree(struct dsync_brain *brain)
 	if (ret != DSYNC_IBC_RECV_RET_FINISHED)
 		return changed;
 
+	if (brain->mailbox_tree_unchanged)
+		dsync_brain_copy_local_mailbox_tree(brain);
 	if (dsync_mailbox_tree_build_guid_hash(brain->remote_mailbox_tree,
 					       &dup_node1, &dup_node2) < 0) {
 		e_error(brain->event,
@@ -223,6 +223,7 @@ dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
 	brain->box_importer = brain->backup_send ? NULL :
 		dsync_mailbox_import_init(brain->box,
 					  brain->virtual_all_box,
+					  brain->mail_guid_index,
 					  brain->log_scan,
 					  last_common_uid, last_common_modseq,
 					  last_common_pvt_modseq,
@@ -235,11 +236,35 @@ dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
 					  brain->sync_max_size,
 					  brain->sync_flag,
 					  brain->import_commit_msgs_interval,
+					  brain->import_commit_msgs_size,
 					  import_flags, brain->hdr_hash_version,
 					  brain->hashed_headers,
 					  brain->event);
 }
 
+static bool
+dsync_brain_can_export_modseq_changes(struct dsync_brain *brain,
+				      const struct mailbox_status *status)
+{
+	const struct dsync_mailbox_state *state = &brain->mailbox_state;
+	uint32_t seq1, seq2, count;
+
+	/* The transaction log no longer has all the changes since the last
+	   sync. Flag changes can still be found by looking up the messages'
+	   modseqs, but expunges can't. No new messages can show up below
+	   last_common_uid, so if the number of messages up to it is still the
+	   same as after the last sync, nothing was expunged either. */
+	if (status->nonpermanent_modseqs || brain->box->view_pvt != NULL ||
+	    state->last_common_uid == 0 || state->last_common_modseq == 0 ||
+	    state->last_messages_count == 0)
+		return FALSE;
+
+	mailbox_get_seq_range(brain->box, 1, state->last_common_uid,
+			      &seq1, &seq2);
+	count = seq1 == 0 ? 0 : seq2 - seq1 + 1;
+	return count == state->last_messages_count;
+}
+
 int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 				  const struct dsync_mailbox *remote_dsync_box)
 {
@@ -248,7 +273,7 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 	uint32_t last_common_uid, highest_wanted_uid;
 	uint64_t last_common_modseq, last_common_pvt_modseq;
 	const char *desync_reason = "";
-	bool pvt_too_old;
+	bool pvt_too_old, modseq_changes = FALSE;
 	int ret;
 
 	i_assert(brain->log_scan == NULL);
@@ -275,6 +300,14 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 	mailbox_get_open_status(brain->box, STATUS_UIDNEXT |
 				STATUS_HIGHESTMODSEQ |
 				STATUS_HIGHESTPVTMODSEQ, &status);
+	if (ret == 0 && !pvt_too_old &&
+	    dsync_brain_can_export_modseq_changes(brain, &status)) {
+		e_debug(brain->event, "Modseq %"PRIu64" no longer in transaction "
+			"log for mailbox %s, looking up changes from modseqs",
+			last_common_modseq, mailbox_get_vname(brain->box));
+		modseq_changes = TRUE;
+		ret = 1;
+	}
 	if (status.nonpermanent_modseqs)
 		status.highest_modseq = 0;
 	if (ret == 0) {
@@ -337,6 +370,8 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_TIMESTAMPS;
 	if (brain->sync_max_size > 0)
 		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_VSIZES;
+	if (modseq_changes)
+		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_MODSEQ_CHANGES;
 	if (remote_dsync_box->messages_count == 0 ||
 	    brain->no_header_hashes) {
 		/* remote mailbox is empty - we don't really need to export
@@ -347,7 +382,7 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 
 	brain->box_exporter = brain->backup_recv ? NULL :
 		dsync_mailbox_export_init(brain->box, brain->log_scan,
-					  last_common_uid,
+					  last_common_uid, last_common_modseq,
 					  exporter_flags,
 					  brain->hdr_hash_version,
 					  brain->hashed_headers,
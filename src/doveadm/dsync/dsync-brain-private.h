@@ -20,8 +20,11 @@ enum dsync_state {
 	DSYNC_STATE_MASTER_SEND_LAST_COMMON,
 	DSYNC_STATE_SLAVE_RECV_LAST_COMMON,
 
-	/* both sides send their mailbox trees */
+	/* both sides send their mailbox trees. if both sides support it,
+	   tree digests are exchanged first and the trees are sent only if
+	   the digests differ. */
 	DSYNC_STATE_SEND_MAILBOX_TREE,
+	DSYNC_STATE_RECV_MAILBOX_TREE_DIGEST,
 	DSYNC_STATE_SEND_MAILBOX_TREE_DELETES,
 	DSYNC_STATE_RECV_MAILBOX_TREE,
 	DSYNC_STATE_RECV_MAILBOX_TREE_DELETES,
@@ -57,6 +60,7 @@ struct dsync_brain {
 	ARRAY(struct mail_namespace *) sync_namespaces;
 	const char *sync_box;
 	struct mailbox *virtual_all_box;
+	struct dsync_mail_guid_index *mail_guid_index;
 	guid_128_t sync_box_guid;
 	const char *const *exclude_mailboxes;
 	enum dsync_brain_sync_type sync_type;
@@ -66,6 +70,7 @@ struct dsync_brain {
 	const char *sync_flag;
 	char alt_char;
 	unsigned int import_commit_msgs_interval;
+	uoff_t import_commit_msgs_size;
 	unsigned int hdr_hash_version;
 
 	unsigned int lock_timeout;
@@ -108,6 +113,8 @@ struct dsync_brain {
 	enum mail_error mail_error;
 
 	const char *const *hashed_headers;
+	/* digest of the local mailbox tree sent to remote */
+	const char *mailbox_tree_digest_local;
 
 	bool master_brain:1;
 	bool mail_requests:1;
@@ -126,12 +133,16 @@ struct dsync_brain {
 	bool failed:1;
 	bool empty_hdr_workaround:1;
 	bool no_header_hashes:1;
+	bool mailbox_tree_digest:1;
+	bool mailbox_tree_digest_sent:1;
+	bool mailbox_tree_unchanged:1;
 };
 
 extern const char *dsync_box_state_names[DSYNC_BOX_STATE_DONE+1];
 
 void dsync_brain_mailbox_trees_init(struct dsync_brain *brain);
 void dsync_brain_send_mailbox_tree(struct dsync_brain *brain);
+bool dsync_brain_recv_mailbox_tree_digest(struct dsync_brain *brain);
 void dsync_brain_send_mailbox_tree_deletes(struct dsync_brain *brain);
 bool dsync_brain_recv_mailbox_tree(struct dsync_brain *brain);
 bool dsync_brain_recv_mailbox_tree_deletes(struct dsync_brain *brain);
@@ -16,6 +16,7 @@
 #include "dsync-brain-private.h"
 #include "dsync-mailbox-import.h"
 #include "dsync-mailbox-export.h"
+#include "dsync-mail-guid-index.h"
 
 #include <sys/stat.h>
 
@@ -30,6 +31,7 @@ static const char *dsync_state_names[] = {
 	"master_send_last_common",
 	"slave_recv_last_common",
 	"send_mailbox_tree",
+	"recv_mailbox_tree_digest",
 	"send_mailbox_tree_deletes",
 	"recv_mailbox_tree",
 	"recv_mailbox_tree_deletes",
@@ -191,6 +193,19 @@ dsync_brain_open_virtual_all_box(struct dsync_brain *brain,
 		mailbox_alloc(ns->list, vname, MAILBOX_FLAG_READONLY);
 }
 
+static void
+dsync_brain_init_mail_lookups(struct dsync_brain *brain,
+			      const char *virtual_all_box,
+			      enum dsync_brain_flags flags)
+{
+	if (virtual_all_box != NULL)
+		dsync_brain_open_virtual_all_box(brain, virtual_all_box);
+	else if ((flags & DSYNC_BRAIN_FLAG_MAIL_GUID_LOOKUP) != 0) {
+		brain->mail_guid_index =
+			dsync_mail_guid_index_init(brain->user, brain->event);
+	}
+}
+
 struct dsync_brain *
 dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 			enum dsync_brain_sync_type sync_type,
@@ -241,12 +256,12 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 		brain->mailbox_lock_timeout_secs =
 			DSYNC_MAILBOX_DEFAULT_LOCK_TIMEOUT_SECS;
 	brain->import_commit_msgs_interval = set->import_commit_msgs_interval;
+	brain->import_commit_msgs_size = set->import_commit_msgs_size;
 	brain->hashed_headers =
 		(const char*const*)p_strarray_dup(brain->pool, set->hashed_headers);
 	dsync_brain_set_flags(brain, flags);
 
-	if (set->virtual_all_box != NULL)
-		dsync_brain_open_virtual_all_box(brain, set->virtual_all_box);
+	dsync_brain_init_mail_lookups(brain, set->virtual_all_box, flags);
 
 	if (sync_type != DSYNC_BRAIN_SYNC_TYPE_STATE)
 		;
@@ -281,6 +296,7 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 	ibc_set.hdr_hash_v2 = TRUE;
 	ibc_set.lock_timeout = set->lock_timeout_secs;
 	ibc_set.import_commit_msgs_interval = set->import_commit_msgs_interval;
+	ibc_set.import_commit_msgs_size = set->import_commit_msgs_size;
 	ibc_set.hashed_headers = set->hashed_headers;
 	/* reverse the backup direction for the slave */
 	ibc_set.brain_flags = flags & ENUM_NEGATE(DSYNC_BRAIN_FLAG_BACKUP_SEND |
@@ -377,6 +393,8 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 		dsync_brain_sync_mailbox_deinit(brain);
 	if (brain->virtual_all_box != NULL)
 		mailbox_free(&brain->virtual_all_box);
+	if (brain->mail_guid_index != NULL)
+		dsync_mail_guid_index_deinit(&brain->mail_guid_index);
 	if (brain->local_tree_iter != NULL)
 		dsync_mailbox_tree_iter_deinit(&brain->local_tree_iter);
 	if (brain->local_mailbox_tree != NULL)
@@ -497,6 +515,7 @@ static bool dsync_brain_master_recv_handshake(struct dsync_brain *brain)
 		}
 	}
 	dsync_brain_set_hdr_hash_version(brain, ibc_set);
+	brain->mailbox_tree_digest = ibc_set->mailbox_tree_digest;
 
 	brain->state = brain->sync_type == DSYNC_BRAIN_SYNC_TYPE_STATE ?
 		DSYNC_STATE_MASTER_SEND_LAST_COMMON :
@@ -515,6 +534,7 @@ static bool dsync_brain_slave_recv_handshake(struct dsync_brain *brain)
 	if (dsync_ibc_recv_handshake(brain->ibc, &ibc_set) == 0)
 		return FALSE;
 	dsync_brain_set_hdr_hash_version(brain, ibc_set);
+	brain->mailbox_tree_digest = ibc_set->mailbox_tree_digest;
 
 	if (ibc_set->lock_timeout > 0) {
 		brain->lock_timeout = ibc_set->lock_timeout;
@@ -554,6 +574,9 @@ static bool dsync_brain_slave_recv_handshake(struct dsync_brain *brain)
 	brain->sync_since_timestamp = ibc_set->sync_since_timestamp;
 	brain->sync_until_timestamp = ibc_set->sync_until_timestamp;
 	brain->sync_max_size = ibc_set->sync_max_size;
+	brain->import_commit_msgs_interval =
+		ibc_set->import_commit_msgs_interval;
+	brain->import_commit_msgs_size = ibc_set->import_commit_msgs_size;
 	brain->sync_flag = p_strdup(brain->pool, ibc_set->sync_flags);
 	memcpy(brain->sync_box_guid, ibc_set->sync_box_guid,
 	       sizeof(brain->sync_box_guid));
@@ -570,8 +593,8 @@ static bool dsync_brain_slave_recv_handshake(struct dsync_brain *brain)
 	brain->purge = (ibc_set->brain_flags &
 			DSYNC_BRAIN_FLAG_PURGE_REMOTE) != 0;
 
-	if (ibc_set->virtual_all_box != NULL)
-		dsync_brain_open_virtual_all_box(brain, ibc_set->virtual_all_box);
+	dsync_brain_init_mail_lookups(brain, ibc_set->virtual_all_box,
+				      ibc_set->brain_flags);
 	dsync_brain_mailbox_trees_init(brain);
 
 	if (brain->sync_type == DSYNC_BRAIN_SYNC_TYPE_STATE)
@@ -699,6 +722,9 @@ static bool dsync_brain_run_real(struct dsync_brain *brain, bool *changed_r)
 		dsync_brain_send_mailbox_tree(brain);
 		changed = TRUE;
 		break;
+	case DSYNC_STATE_RECV_MAILBOX_TREE_DIGEST:
+		changed = dsync_brain_recv_mailbox_tree_digest(brain);
+		break;
 	case DSYNC_STATE_RECV_MAILBOX_TREE:
 		changed = dsync_brain_recv_mailbox_tree(brain);
 		break;
@@ -40,6 +40,10 @@ enum dsync_brain_flags {
 	   less safe, but can have huge performance improvement with imapc
 	   if the remote server doesn't have a fast header cache. */
 	DSYNC_BRAIN_FLAG_NO_HEADER_HASHES	= 0x1000,
+	/* Without virtual_all_box, look up mails missing from a mailbox by
+	   their GUIDs from all the other local mailboxes and copy them from
+	   there instead of requesting them from the remote. */
+	DSYNC_BRAIN_FLAG_MAIL_GUID_LOOKUP	= 0x2000,
 };
 
 enum dsync_brain_sync_type {
@@ -89,6 +93,9 @@ struct dsync_brain_settings {
 	/* If non-zero, importing will attempt to commit transaction after
 	   saving this many messages. */
 	unsigned int import_commit_msgs_interval;
+	/* If non-zero, importing will also attempt to commit transaction
+	   after saving this many bytes of messages. */
+	uoff_t import_commit_msgs_size;
 	/* Input state for DSYNC_BRAIN_SYNC_TYPE_STATE */
 	const char *state;
 };
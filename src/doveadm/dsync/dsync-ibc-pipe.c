@@ -13,6 +13,7 @@ enum item_type {
 	ITEM_END_OF_LIST,
 	ITEM_HANDSHAKE,
 	ITEM_MAILBOX_STATE,
+	ITEM_MAILBOX_TREE_DIGEST,
 	ITEM_MAILBOX_TREE_NODE,
 	ITEM_MAILBOX_DELETE,
 	ITEM_MAILBOX,
@@ -30,6 +31,7 @@ struct item {
 	union {
 		struct dsync_ibc_settings set;
 		struct dsync_mailbox_state state;
+		const char *digest;
 		struct dsync_mailbox_node node;
 		guid_128_t mailbox_guid;
 		struct dsync_mailbox dsync_box;
@@ -92,6 +94,7 @@ dsync_ibc_pipe_push_item(struct dsync_ibc_pipe *pipe, enum item_type type)
 		break;
 	case ITEM_HANDSHAKE:
 	case ITEM_MAILBOX:
+	case ITEM_MAILBOX_TREE_DIGEST:
 	case ITEM_MAILBOX_TREE_NODE:
 	case ITEM_MAILBOX_ATTRIBUTE:
 	case ITEM_MAIL_CHANGE:
@@ -250,6 +253,32 @@ dsync_ibc_pipe_recv_mailbox_state(struct dsync_ibc *ibc,
 	return DSYNC_IBC_RECV_RET_OK;
 }
 
+static void
+dsync_ibc_pipe_send_mailbox_tree_digest(struct dsync_ibc *ibc,
+					const char *digest)
+{
+	struct dsync_ibc_pipe *pipe = (struct dsync_ibc_pipe *)ibc;
+	struct item *item;
+
+	item = dsync_ibc_pipe_push_item(pipe->remote, ITEM_MAILBOX_TREE_DIGEST);
+	item->u.digest = p_strdup(item->pool, digest);
+}
+
+static enum dsync_ibc_recv_ret
+dsync_ibc_pipe_recv_mailbox_tree_digest(struct dsync_ibc *ibc,
+					const char **digest_r)
+{
+	struct dsync_ibc_pipe *pipe = (struct dsync_ibc_pipe *)ibc;
+	struct item *item;
+
+	item = dsync_ibc_pipe_pop_item(pipe, ITEM_MAILBOX_TREE_DIGEST);
+	if (item == NULL)
+		return DSYNC_IBC_RECV_RET_TRYAGAIN;
+
+	*digest_r = item->u.digest;
+	return DSYNC_IBC_RECV_RET_OK;
+}
+
 static void
 dsync_ibc_pipe_send_mailbox_tree_node(struct dsync_ibc *ibc,
 				      const char *const *name,
@@ -553,6 +582,8 @@ static const struct dsync_ibc_vfuncs dsync_ibc_pipe_vfuncs = {
 	dsync_ibc_pipe_send_end_of_list,
 	dsync_ibc_pipe_send_mailbox_state,
 	dsync_ibc_pipe_recv_mailbox_state,
+	dsync_ibc_pipe_send_mailbox_tree_digest,
+	dsync_ibc_pipe_recv_mailbox_tree_digest,
 	dsync_ibc_pipe_send_mailbox_tree_node,
 	dsync_ibc_pipe_recv_mailbox_tree_node,
 	dsync_ibc_pipe_send_mailbox_deletes,
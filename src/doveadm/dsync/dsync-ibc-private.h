@@ -21,6 +21,12 @@ struct dsync_ibc_vfuncs {
 		(*recv_mailbox_state)(struct dsync_ibc *ibc,
 				      struct dsync_mailbox_state *state_r);
 
+	void (*send_mailbox_tree_digest)(struct dsync_ibc *ibc,
+					 const char *digest);
+	enum dsync_ibc_recv_ret
+		(*recv_mailbox_tree_digest)(struct dsync_ibc *ibc,
+					    const char **digest_r);
+
 	void (*send_mailbox_tree_node)(struct dsync_ibc *ibc,
 				       const char *const *name,
 				       const struct dsync_mailbox_node *node);
@@ -10,6 +10,7 @@
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
+#include "compression.h"
 #include "master-service.h"
 #include "mail-cache.h"
 #include "mail-storage-private.h"
@@ -25,14 +26,16 @@
 #define DSYNC_IBC_STREAM_OUTBUF_THROTTLE_SIZE (1024*128)
 
 #define DSYNC_PROTOCOL_VERSION_MAJOR 3
-#define DSYNC_PROTOCOL_VERSION_MINOR 5
-#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t5\n"
+#define DSYNC_PROTOCOL_VERSION_MINOR 7
+#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t7\n"
 
 #define DSYNC_PROTOCOL_MINOR_HAVE_ATTRIBUTES 1
 #define DSYNC_PROTOCOL_MINOR_HAVE_SAVE_GUID 2
 #define DSYNC_PROTOCOL_MINOR_HAVE_FINISH 3
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2 4
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3 5
+#define DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION 6
+#define DSYNC_PROTOCOL_MINOR_HAVE_TREE_DIGEST 7
 
 enum item_type {
 	ITEM_NONE,
@@ -51,11 +54,21 @@ enum item_type {
 	ITEM_FINISH,
 
 	ITEM_MAILBOX_CACHE_FIELD,
+	ITEM_MAILBOX_TREE_DIGEST,
 
 	ITEM_END_OF_LIST
 };
 
 #define END_OF_LIST_LINE "."
+/* "Z<mechanism>" line tells that everything after it is compressed */
+#define COMPRESSION_START_CHR 'Z'
+
+/* Compression mechanisms that can be flushed mid-stream, in the order of
+   preference. */
+static const char *const dsync_compression_mechanisms[] = {
+	"zstd", "deflate", NULL
+};
+
 static const struct {
 	/* full human readable name of the item */
 	const char *name;
@@ -79,7 +92,8 @@ static const struct {
 	  	"no_mail_sync no_backup_overwrite purge_remote "
 		"no_notify sync_since_timestamp sync_max_size sync_flags sync_until_timestamp "
 		"virtual_all_box empty_hdr_workaround import_commit_msgs_interval "
-		"hashed_headers alt_char"
+		"hashed_headers alt_char compression mail_guid_lookup "
+		"import_commit_msgs_size"
 	},
 	{ .name = "mailbox_state",
 	  .chr = 'S',
@@ -136,6 +150,11 @@ static const struct {
 	  .required_keys = "name decision",
 	  .optional_keys = "last_used"
 	},
+	{ .name = "mailbox_tree_digest",
+	  .chr = 'T',
+	  .required_keys = "digest",
+	  .min_minor_version = DSYNC_PROTOCOL_MINOR_HAVE_TREE_DIGEST
+	},
 
 	{ "end_of_list", '\0', NULL, NULL, 0 }
 };
@@ -150,6 +169,7 @@ struct dsync_ibc_stream {
 	struct ostream *output;
 	struct io *io;
 	struct timeout *to;
+	const struct compression_handler *compress_handler;
 
 	unsigned int minor_version;
 	struct dsync_serializer *serializers[ITEM_END_OF_LIST];
@@ -171,8 +191,12 @@ struct dsync_ibc_stream {
 	bool handshake_received:1;
 	bool has_pending_data:1;
 	bool finish_received:1;
+	bool finish_sent:1;
 	bool done_received:1;
 	bool stopped:1;
+	bool keep_streams:1;
+	bool input_compressed:1;
+	bool output_compressed:1;
 };
 
 static const char *dsync_ibc_stream_get_state(struct dsync_ibc_stream *ibc)
@@ -369,7 +393,17 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 		dsync_deserializer_decode_finish(&ibc->cur_decoder);
 	if (ibc->value_output != NULL)
 		i_stream_unref(&ibc->value_output);
-	else {
+	else if (ibc->keep_streams) {
+		/* The connection is used for something else afterwards.
+		   Once the finish has been sent or received the remote
+		   won't read anything more from us. */
+		if (!ibc->done_received && !ibc->finish_received &&
+		    !ibc->finish_sent) {
+			o_stream_nsend_str(ibc->output,
+				t_strdup_printf("%c\n", items[ITEM_DONE].chr));
+		}
+		(void)o_stream_flush(ibc->output);
+	} else {
 		/* If the remote has not told us that they are closing we
 		   notify remote that we're closing. this is mainly to avoid
 		   "read() failed: EOF" errors on failing dsyncs.
@@ -391,15 +425,21 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 
 	timeout_remove(&ibc->to);
 	io_remove(&ibc->io);
-	i_stream_destroy(&ibc->input);
-	o_stream_destroy(&ibc->output);
+	if (ibc->keep_streams) {
+		o_stream_unset_flush_callback(ibc->output);
+		i_stream_unref(&ibc->input);
+		o_stream_unref(&ibc->output);
+	} else {
+		i_stream_destroy(&ibc->input);
+		o_stream_destroy(&ibc->output);
+	}
 	pool_unref(&ibc->ret_pool);
 	i_free(ibc->temp_path_prefix);
 	i_free(ibc->name);
 	i_free(ibc);
 }
 
-static int dsync_ibc_stream_next_line(struct dsync_ibc_stream *ibc,
+static int dsync_ibc_stream_read_line(struct dsync_ibc_stream *ibc,
 				      const char **line_r)
 {
 	string_t *error;
@@ -438,6 +478,71 @@ static int dsync_ibc_stream_next_line(struct dsync_ibc_stream *ibc,
 	return 1;
 }
 
+static int
+dsync_ibc_stream_decompress_input(struct dsync_ibc_stream *ibc,
+				  const char *mechanism)
+{
+	const struct compression_handler *handler;
+	struct istream *input;
+
+	if (!str_array_find(dsync_compression_mechanisms, mechanism) ||
+	    compression_lookup_handler(mechanism, &handler) <= 0) {
+		i_error("dsync(%s): Remote started unsupported compression: %s",
+			ibc->name, mechanism);
+		dsync_ibc_stream_stop(ibc);
+		return -1;
+	}
+	/* the rest of the already buffered input is read via the
+	   decompression stream */
+	input = handler->create_istream(ibc->input);
+	i_stream_unref(&ibc->input);
+	ibc->input = input;
+	io_remove(&ibc->io);
+	ibc->io = io_add_istream(ibc->input, dsync_ibc_stream_input, ibc);
+	ibc->input_compressed = TRUE;
+	return 0;
+}
+
+static int dsync_ibc_stream_next_line(struct dsync_ibc_stream *ibc,
+				      const char **line_r)
+{
+	int ret;
+
+	while ((ret = dsync_ibc_stream_read_line(ibc, line_r)) > 0) {
+		if (!ibc->handshake_received || ibc->input_compressed ||
+		    (*line_r)[0] != COMPRESSION_START_CHR)
+			break;
+		if (dsync_ibc_stream_decompress_input(ibc, *line_r + 1) < 0)
+			return -1;
+	}
+	return ret;
+}
+
+static void
+dsync_ibc_stream_compress_output(struct dsync_ibc_stream *ibc)
+{
+	const struct compression_handler *handler = ibc->compress_handler;
+	struct ostream *output;
+	bool corked = o_stream_is_corked(ibc->output);
+
+	i_assert(ibc->value_output == NULL);
+
+	o_stream_nsend_str(ibc->output, t_strdup_printf("%c%s\n",
+		COMPRESSION_START_CHR, handler->name));
+	if (corked)
+		o_stream_uncork(ibc->output);
+	output = handler->create_ostream(ibc->output,
+					 handler->get_default_level());
+	o_stream_set_no_error_handling(output, TRUE);
+	o_stream_unset_flush_callback(ibc->output);
+	o_stream_set_flush_callback(output, dsync_ibc_stream_output, ibc);
+	o_stream_unref(&ibc->output);
+	ibc->output = output;
+	if (corked)
+		o_stream_cork(ibc->output);
+	ibc->output_compressed = TRUE;
+}
+
 static void ATTR_FORMAT(3, 4) ATTR_NULL(2)
 dsync_ibc_input_error(struct dsync_ibc_stream *ibc,
 		      struct dsync_deserializer_decoder *decoder,
@@ -475,19 +580,13 @@ static int seekable_fd_callback(const char **path_r, void *context)
 
 	path = t_str_new(128);
 	str_append(path, ibc->temp_path_prefix);
-	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	/* we just want the fd, so create it unlinked */
+	fd = safe_mkstemp_hostpid_unlinked(path, 0600);
 	if (fd == -1) {
 		i_error("safe_mkstemp(%s) failed: %m", str_c(path));
 		return -1;
 	}
 
-	/* we just want the fd, unlink it */
-	if (i_unlink(str_c(path)) < 0) {
-		/* shouldn't happen.. */
-		i_close_fd(&fd);
-		return -1;
-	}
-
 	*path_r = str_c(path);
 	return fd;
 }
@@ -711,6 +810,10 @@ dsync_ibc_stream_send_handshake(struct dsync_ibc *_ibc,
 		dsync_serializer_encode_add(encoder, "import_commit_msgs_interval",
 			t_strdup_printf("%u", set->import_commit_msgs_interval));
 	}
+	if (set->import_commit_msgs_size > 0) {
+		dsync_serializer_encode_add(encoder, "import_commit_msgs_size",
+			dec2str(set->import_commit_msgs_size));
+	}
 	if (set->sync_since_timestamp > 0) {
 		dsync_serializer_encode_add(encoder, "sync_since_timestamp",
 			t_strdup_printf("%ld", (long)set->sync_since_timestamp));
@@ -751,6 +854,8 @@ dsync_ibc_stream_send_handshake(struct dsync_ibc *_ibc,
 		dsync_serializer_encode_add(encoder, "no_notify", "");
 	if ((set->brain_flags & DSYNC_BRAIN_FLAG_EMPTY_HDR_WORKAROUND) != 0)
 		dsync_serializer_encode_add(encoder, "empty_hdr_workaround", "");
+	if ((set->brain_flags & DSYNC_BRAIN_FLAG_MAIL_GUID_LOOKUP) != 0)
+		dsync_serializer_encode_add(encoder, "mail_guid_lookup", "");
 	/* this can be NULL in slave */
 	string_t *str2 = t_str_new(32);
 	if (set->hashed_headers != NULL) {
@@ -760,6 +865,25 @@ dsync_ibc_stream_send_handshake(struct dsync_ibc *_ibc,
 		}
 	}
 	dsync_serializer_encode_add(encoder, "hashed_headers", str_c(str2));
+	if (!ibc->keep_streams) {
+		/* tell which compression mechanisms we can read. The
+		   connection can't be reused after compression is started. */
+		const char *const *mech = dsync_compression_mechanisms;
+		const struct compression_handler *handler;
+		string_t *str3 = t_str_new(32);
+
+		for (; *mech != NULL; mech++) {
+			if (compression_lookup_handler(*mech, &handler) <= 0)
+				continue;
+			if (str_len(str3) > 0)
+				str_append_c(str3, ' ');
+			str_append(str3, handler->name);
+		}
+		if (str_len(str3) > 0) {
+			dsync_serializer_encode_add(encoder, "compression",
+						    str_c(str3));
+		}
+	}
 	dsync_serializer_encode_finish(&encoder, str);
 	dsync_ibc_stream_send_string(ibc, str);
 }
@@ -845,6 +969,14 @@ dsync_ibc_stream_recv_handshake(struct dsync_ibc *_ibc,
 			return DSYNC_IBC_RECV_RET_TRYAGAIN;
 		}
 	}
+	if (dsync_deserializer_decode_try(decoder, "import_commit_msgs_size", &value)) {
+		if (str_to_uoff(value, &set->import_commit_msgs_size) < 0 ||
+		    set->import_commit_msgs_size == 0) {
+			dsync_ibc_input_error(ibc, decoder,
+				"Invalid import_commit_msgs_size: %s", value);
+			return DSYNC_IBC_RECV_RET_TRYAGAIN;
+		}
+	}
 	if (dsync_deserializer_decode_try(decoder, "sync_since_timestamp", &value)) {
 		if (str_to_time(value, &set->sync_since_timestamp) < 0 ||
 		    set->sync_since_timestamp == 0) {
@@ -893,10 +1025,21 @@ dsync_ibc_stream_recv_handshake(struct dsync_ibc *_ibc,
 		set->brain_flags |= DSYNC_BRAIN_FLAG_NO_NOTIFY;
 	if (dsync_deserializer_decode_try(decoder, "empty_hdr_workaround", &value))
 		set->brain_flags |= DSYNC_BRAIN_FLAG_EMPTY_HDR_WORKAROUND;
+	if (dsync_deserializer_decode_try(decoder, "mail_guid_lookup", &value))
+		set->brain_flags |= DSYNC_BRAIN_FLAG_MAIL_GUID_LOOKUP;
 	if (dsync_deserializer_decode_try(decoder, "hashed_headers", &value))
 		set->hashed_headers = (const char*const*)p_strsplit_tabescaped(pool, value);
 	set->hdr_hash_v2 = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2;
 	set->hdr_hash_v3 = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3;
+	set->mailbox_tree_digest =
+		ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_TREE_DIGEST;
+
+	if (ibc->compress_handler != NULL && !ibc->keep_streams &&
+	    !ibc->output_compressed &&
+	    dsync_deserializer_decode_try(decoder, "compression", &value) &&
+	    str_array_find(t_strsplit_spaces(value, " "),
+			   ibc->compress_handler->name))
+		dsync_ibc_stream_compress_output(ibc);
 
 	*set_r = set;
 	return DSYNC_IBC_RECV_RET_OK;
@@ -1002,6 +1145,42 @@ dsync_ibc_stream_recv_mailbox_state(struct dsync_ibc *_ibc,
 	return DSYNC_IBC_RECV_RET_OK;
 }
 
+static void
+dsync_ibc_stream_send_mailbox_tree_digest(struct dsync_ibc *_ibc,
+					  const char *digest)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+	struct dsync_serializer_encoder *encoder;
+	string_t *str;
+
+	str = t_str_new(128);
+	str_append_c(str, items[ITEM_MAILBOX_TREE_DIGEST].chr);
+
+	encoder = dsync_ibc_send_encode_begin(ibc, ITEM_MAILBOX_TREE_DIGEST);
+	dsync_serializer_encode_add(encoder, "digest", digest);
+	dsync_serializer_encode_finish(&encoder, str);
+	dsync_ibc_stream_send_string(ibc, str);
+}
+
+static enum dsync_ibc_recv_ret
+dsync_ibc_stream_recv_mailbox_tree_digest(struct dsync_ibc *_ibc,
+					  const char **digest_r)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+	struct dsync_deserializer_decoder *decoder;
+	enum dsync_ibc_recv_ret ret;
+
+	ret = dsync_ibc_stream_input_next(ibc, ITEM_MAILBOX_TREE_DIGEST,
+					  &decoder);
+	if (ret != DSYNC_IBC_RECV_RET_OK)
+		return ret;
+
+	p_clear(ibc->ret_pool);
+	*digest_r = p_strdup(ibc->ret_pool,
+		dsync_deserializer_decode_get(decoder, "digest"));
+	return DSYNC_IBC_RECV_RET_OK;
+}
+
 static void
 dsync_ibc_stream_send_mailbox_tree_node(struct dsync_ibc *_ibc,
 					const char *const *name,
@@ -2017,6 +2196,7 @@ dsync_ibc_stream_send_finish(struct dsync_ibc *_ibc, const char *error,
 		dsync_serializer_encode_add(encoder, "require_full_resync", "");
 	dsync_serializer_encode_finish(&encoder, str);
 	dsync_ibc_stream_send_string(ibc, str);
+	ibc->finish_sent = TRUE;
 }
 
 static enum dsync_ibc_recv_ret
@@ -2098,6 +2278,8 @@ static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
 	dsync_ibc_stream_send_end_of_list,
 	dsync_ibc_stream_send_mailbox_state,
 	dsync_ibc_stream_recv_mailbox_state,
+	dsync_ibc_stream_send_mailbox_tree_digest,
+	dsync_ibc_stream_recv_mailbox_tree_digest,
 	dsync_ibc_stream_send_mailbox_tree_node,
 	dsync_ibc_stream_recv_mailbox_tree_node,
 	dsync_ibc_stream_send_mailbox_deletes,
@@ -2139,3 +2321,33 @@ dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 	dsync_ibc_stream_init(ibc);
 	return &ibc->ibc;
 }
+
+void dsync_ibc_stream_keep_streams(struct dsync_ibc *_ibc)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+
+	ibc->keep_streams = TRUE;
+}
+
+int dsync_ibc_stream_set_compression(struct dsync_ibc *_ibc,
+				     const char *mechanism,
+				     const char **error_r)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+	const struct compression_handler *handler;
+	int ret;
+
+	if (!str_array_find(dsync_compression_mechanisms, mechanism)) {
+		*error_r = t_strdup_printf(
+			"Compression mechanism can't be used for dsync: %s",
+			mechanism);
+		return -1;
+	}
+	if ((ret = compression_lookup_handler(mechanism, &handler)) <= 0) {
+		*error_r = t_strdup_printf("%s compression mechanism: %s",
+			ret == 0 ? "Unsupported" : "Unknown", mechanism);
+		return -1;
+	}
+	ibc->compress_handler = handler;
+	return 0;
+}
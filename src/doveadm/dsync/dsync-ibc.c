@@ -64,6 +64,22 @@ dsync_ibc_recv_mailbox_state(struct dsync_ibc *ibc,
 	return ibc->v.recv_mailbox_state(ibc, state_r);
 }
 
+enum dsync_ibc_send_ret
+dsync_ibc_send_mailbox_tree_digest(struct dsync_ibc *ibc, const char *digest)
+{
+	T_BEGIN {
+		ibc->v.send_mailbox_tree_digest(ibc, digest);
+	} T_END;
+	return dsync_ibc_send_ret(ibc);
+}
+
+enum dsync_ibc_recv_ret
+dsync_ibc_recv_mailbox_tree_digest(struct dsync_ibc *ibc,
+				   const char **digest_r)
+{
+	return ibc->v.recv_mailbox_tree_digest(ibc, digest_r);
+}
+
 enum dsync_ibc_send_ret
 dsync_ibc_send_mailbox_tree_node(struct dsync_ibc *ibc,
 				 const char *const *name,
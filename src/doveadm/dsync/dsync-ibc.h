@@ -72,8 +72,11 @@ struct dsync_ibc_settings {
 	enum dsync_brain_flags brain_flags;
 	bool hdr_hash_v2;
 	bool hdr_hash_v3;
+	/* Remote supports exchanging mailbox tree digests */
+	bool mailbox_tree_digest;
 	unsigned int lock_timeout;
 	unsigned int import_commit_msgs_interval;
+	uoff_t import_commit_msgs_size;
 };
 
 void dsync_ibc_init_pipe(struct dsync_ibc **ibc1_r,
@@ -82,6 +85,14 @@ struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
 		      unsigned int timeout_secs);
+/* Don't close the stream ibc's iostreams on deinit, so the connection can
+   still be used after the dsync has finished. */
+void dsync_ibc_stream_keep_streams(struct dsync_ibc *ibc);
+/* Compress the data sent to remote with the given mechanism, if the remote
+   supports it. Returns -1 if the mechanism can't be used. */
+int dsync_ibc_stream_set_compression(struct dsync_ibc *ibc,
+				     const char *mechanism,
+				     const char **error_r);
 void dsync_ibc_deinit(struct dsync_ibc **ibc);
 
 /* I/O callback is called whenever new data is available. It's also called on
@@ -105,6 +116,12 @@ enum dsync_ibc_recv_ret
 dsync_ibc_recv_mailbox_state(struct dsync_ibc *ibc,
 			     struct dsync_mailbox_state *state_r);
 
+enum dsync_ibc_send_ret ATTR_NOWARN_UNUSED_RESULT
+dsync_ibc_send_mailbox_tree_digest(struct dsync_ibc *ibc, const char *digest);
+enum dsync_ibc_recv_ret
+dsync_ibc_recv_mailbox_tree_digest(struct dsync_ibc *ibc,
+				   const char **digest_r);
+
 enum dsync_ibc_send_ret ATTR_NOWARN_UNUSED_RESULT
 dsync_ibc_send_mailbox_tree_node(struct dsync_ibc *ibc,
 				 const char *const *name,
@@ -0,0 +1,216 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "hash.h"
+#include "guid.h"
+#include "mail-namespace.h"
+#include "mail-storage.h"
+#include "mail-search-build.h"
+#include "mailbox-list-iter.h"
+#include "dsync-mail-guid-index.h"
+
+struct dsync_mail_guid_index_box {
+	struct mail_namespace *ns;
+	guid_128_t mailbox_guid;
+};
+
+struct dsync_mail_guid_location {
+	const struct dsync_mail_guid_index_box *box;
+	uint32_t uid;
+};
+
+struct dsync_mail_guid_index {
+	pool_t pool;
+	struct mail_user *user;
+	struct event *event;
+
+	/* GUID => struct dsync_mail_guid_location */
+	HASH_TABLE(const char *, struct dsync_mail_guid_location *) guids;
+
+	/* currently opened mailbox for lookups */
+	const struct dsync_mail_guid_index_box *cur_index_box;
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+
+	bool built:1;
+};
+
+struct dsync_mail_guid_index *
+dsync_mail_guid_index_init(struct mail_user *user, struct event *event)
+{
+	struct dsync_mail_guid_index *index;
+	pool_t pool;
+
+	pool = pool_alloconly_create(MEMPOOL_GROWING"dsync mail guid index",
+				     1024*32);
+	index = p_new(pool, struct dsync_mail_guid_index, 1);
+	index->pool = pool;
+	index->user = user;
+	index->event = event;
+	hash_table_create(&index->guids, pool, 0, str_hash, strcmp);
+	return index;
+}
+
+static void
+dsync_mail_guid_index_close_box(struct dsync_mail_guid_index *index)
+{
+	if (index->mail != NULL)
+		mail_free(&index->mail);
+	if (index->trans != NULL)
+		(void)mailbox_transaction_commit(&index->trans);
+	mailbox_free(&index->box);
+	index->cur_index_box = NULL;
+}
+
+void dsync_mail_guid_index_deinit(struct dsync_mail_guid_index **_index)
+{
+	struct dsync_mail_guid_index *index = *_index;
+
+	*_index = NULL;
+
+	if (index->box != NULL)
+		dsync_mail_guid_index_close_box(index);
+	hash_table_destroy(&index->guids);
+	pool_unref(&index->pool);
+}
+
+static void
+dsync_mail_guid_index_add_mailbox(struct dsync_mail_guid_index *index,
+				  struct mail_namespace *ns, const char *vname)
+{
+	struct dsync_mail_guid_index_box *index_box;
+	struct dsync_mail_guid_location *loc;
+	struct mailbox_metadata metadata;
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *search_args;
+	struct mail *mail;
+	enum mail_error error;
+	const char *guid, *errstr;
+
+	box = mailbox_alloc(ns->list, vname, MAILBOX_FLAG_READONLY);
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) < 0) {
+		errstr = mailbox_get_last_internal_error(box, &error);
+		if (error != MAIL_ERROR_NOTFOUND &&
+		    error != MAIL_ERROR_NOTPOSSIBLE) {
+			e_error(index->event,
+				"Couldn't get mailbox '%s' GUID: %s",
+				vname, errstr);
+		}
+		mailbox_free(&box);
+		return;
+	}
+	index_box = p_new(index->pool, struct dsync_mail_guid_index_box, 1);
+	index_box->ns = ns;
+	guid_128_copy(index_box->mailbox_guid, metadata.guid);
+
+	search_args = mail_search_build_init();
+	mail_search_build_add_all(search_args);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, search_args, NULL,
+					 MAIL_FETCH_GUID, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (mail_get_special(mail, MAIL_FETCH_GUID, &guid) < 0 ||
+		    *guid == '\0') {
+			/* ignore errors */
+			continue;
+		}
+		if (hash_table_lookup(index->guids, guid) != NULL)
+			continue;
+		loc = p_new(index->pool, struct dsync_mail_guid_location, 1);
+		loc->box = index_box;
+		loc->uid = mail->uid;
+		guid = p_strdup(index->pool, guid);
+		hash_table_insert(index->guids, guid, loc);
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0) {
+		e_error(index->event, "Couldn't search mailbox '%s': %s",
+			vname, mailbox_get_last_internal_error(box, NULL));
+	}
+	(void)mailbox_transaction_commit(&trans);
+	mailbox_free(&box);
+}
+
+static void dsync_mail_guid_index_build(struct dsync_mail_guid_index *index)
+{
+	static const char *const patterns[] = { "*", NULL };
+	struct mailbox_list_iterate_context *iter;
+	const struct mailbox_info *info;
+
+	index->built = TRUE;
+
+	iter = mailbox_list_iter_init_namespaces(index->user->namespaces,
+						 patterns,
+						 MAIL_NAMESPACE_TYPE_PRIVATE,
+						 MAILBOX_LIST_ITER_SKIP_ALIASES |
+						 MAILBOX_LIST_ITER_NO_AUTO_BOXES);
+	while ((info = mailbox_list_iter_next(iter)) != NULL) {
+		if ((info->flags & (MAILBOX_NOSELECT |
+				    MAILBOX_NONEXISTENT)) != 0)
+			continue;
+		T_BEGIN {
+			dsync_mail_guid_index_add_mailbox(index, info->ns,
+							  info->vname);
+		} T_END;
+	}
+	if (mailbox_list_iter_deinit(&iter) < 0) {
+		e_error(index->event, "Couldn't list mailboxes: %s",
+			mailbox_list_get_last_internal_error(
+				index->user->namespaces->list, NULL));
+	}
+	e_debug(index->event, "Mail GUID index has %u mails",
+		hash_table_count(index->guids));
+}
+
+static bool
+dsync_mail_guid_index_is_box(const struct dsync_mail_guid_index_box *index_box,
+			     struct mailbox *box)
+{
+	struct mailbox_metadata metadata;
+
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) < 0)
+		return FALSE;
+	return guid_128_equals(index_box->mailbox_guid, metadata.guid);
+}
+
+int dsync_mail_guid_index_lookup(struct dsync_mail_guid_index *index,
+				 struct mailbox *exclude_box, const char *guid,
+				 struct mail **mail_r, uint32_t *uid_r)
+{
+	struct dsync_mail_guid_location *loc;
+
+	if (!index->built)
+		dsync_mail_guid_index_build(index);
+
+	loc = hash_table_lookup(index->guids, guid);
+	if (loc == NULL || dsync_mail_guid_index_is_box(loc->box, exclude_box))
+		return 0;
+
+	if (index->cur_index_box != loc->box) {
+		if (index->box != NULL)
+			dsync_mail_guid_index_close_box(index);
+		index->box = mailbox_alloc_guid(loc->box->ns->list,
+						loc->box->mailbox_guid,
+						MAILBOX_FLAG_READONLY);
+		if (mailbox_open(index->box) < 0) {
+			/* most likely deleted during the sync */
+			e_debug(index->event, "Couldn't open mailbox %s: %s",
+				guid_128_to_string(loc->box->mailbox_guid),
+				mailbox_get_last_internal_error(index->box, NULL));
+			mailbox_free(&index->box);
+			return 0;
+		}
+		index->trans = mailbox_transaction_begin(index->box, 0,
+							 __func__);
+		index->mail = mail_alloc(index->trans, 0, NULL);
+		index->cur_index_box = loc->box;
+	}
+	*mail_r = index->mail;
+	*uid_r = loc->uid;
+	return 1;
+}
@@ -0,0 +1,23 @@
+#ifndef DSYNC_MAIL_GUID_INDEX_H
+#define DSYNC_MAIL_GUID_INDEX_H
+
+struct mail;
+struct mailbox;
+struct mail_user;
+
+/* Index of mail GUID => mailbox/UID for all the user's private mailboxes.
+   This allows copying mails that already exist in another local mailbox
+   without a virtual \All mailbox, instead of requesting them from the
+   remote. The index is built when the first lookup is done. */
+struct dsync_mail_guid_index *
+dsync_mail_guid_index_init(struct mail_user *user, struct event *event);
+void dsync_mail_guid_index_deinit(struct dsync_mail_guid_index **index);
+
+/* Find a mail with the given GUID from mailboxes other than exclude_box.
+   Returns 1 if found, 0 if not. The returned mail isn't yet set to the UID.
+   It's valid until the next lookup. */
+int dsync_mail_guid_index_lookup(struct dsync_mail_guid_index *index,
+				 struct mailbox *exclude_box, const char *guid,
+				 struct mail **mail_r, uint32_t *uid_r);
+
+#endif
@@ -24,6 +24,7 @@ struct dsync_mailbox_exporter {
 	struct mailbox *box;
 	struct dsync_transaction_log_scan *log_scan;
 	uint32_t last_common_uid;
+	uint64_t last_common_modseq;
 
 	struct mailbox_header_lookup_ctx *wanted_headers;
 	struct mailbox_transaction_context *trans;
@@ -68,6 +69,7 @@ struct dsync_mailbox_exporter {
 	bool export_received_timestamps:1;
 	bool export_virtual_sizes:1;
 	bool no_hdr_hashes:1;
+	bool modseq_changes:1;
 };
 
 static int dsync_mail_error(struct dsync_mailbox_exporter *exporter,
@@ -368,6 +370,52 @@ dsync_mailbox_export_drop_expunged_flag_changes(struct dsync_mailbox_exporter *e
 	hash_table_iterate_deinit(&iter);
 }
 
+static int
+dsync_mailbox_export_modseq_changes(struct dsync_mailbox_exporter *exporter)
+{
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *search_args;
+	struct mail_search_arg *sarg;
+	struct dsync_mail_change *change;
+	struct mail *mail;
+
+	/* the modseqs can be looked up from the index without accessing the
+	   messages, so this stays cheap even for large mailboxes. */
+	search_args = mail_search_build_init();
+	sarg = mail_search_build_add(search_args, SEARCH_UIDSET);
+	p_array_init(&sarg->value.seqset, search_args->pool, 1);
+	seq_range_array_add_range(&sarg->value.seqset, 1,
+				  exporter->last_common_uid);
+	sarg = mail_search_build_add(search_args, SEARCH_MODSEQ);
+	sarg->value.modseq = p_new(search_args->pool,
+				   struct mail_search_modseq, 1);
+	sarg->value.modseq->modseq = exporter->last_common_modseq + 1;
+
+	search_ctx = mailbox_search_init(exporter->trans, search_args, NULL,
+					 0, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (mailbox_search_next(search_ctx, &mail)) {
+		i_assert(hash_table_lookup(exporter->changes,
+					   POINTER_CAST(mail->uid)) == NULL);
+		change = p_new(exporter->pool, struct dsync_mail_change, 1);
+		change->uid = mail->uid;
+		change->type = DSYNC_MAIL_CHANGE_TYPE_FLAG_CHANGE;
+		hash_table_insert(exporter->changes,
+				  POINTER_CAST(mail->uid), change);
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0) {
+		exporter->error = p_strdup_printf(exporter->pool,
+			"Mail modseq search failed: %s",
+			mailbox_get_last_internal_error(exporter->box,
+							&exporter->mail_error));
+		return -1;
+	}
+	e_debug(exporter->event, "Found %u changed mails by modseq",
+		hash_table_count(exporter->changes));
+	return 0;
+}
+
 static void
 dsync_mailbox_export_search(struct dsync_mailbox_exporter *exporter)
 {
@@ -379,6 +427,13 @@ dsync_mailbox_export_search(struct dsync_mailbox_exporter *exporter)
 	struct mailbox_header_lookup_ctx *wanted_headers = NULL;
 	int ret = 0;
 
+	exporter->trans = mailbox_transaction_begin(exporter->box,
+						MAILBOX_TRANSACTION_FLAG_SYNC,
+						__func__);
+	if (exporter->modseq_changes &&
+	    dsync_mailbox_export_modseq_changes(exporter) < 0)
+		return;
+
 	search_args = mail_search_build_init();
 	sarg = mail_search_build_add(search_args, SEARCH_UIDSET);
 	p_array_init(&sarg->value.seqset, search_args->pool, 1);
@@ -403,9 +458,6 @@ dsync_mailbox_export_search(struct dsync_mailbox_exporter *exporter)
 		wanted_headers = exporter->wanted_headers;
 	}
 
-	exporter->trans = mailbox_transaction_begin(exporter->box,
-						MAILBOX_TRANSACTION_FLAG_SYNC,
-						__func__);
 	search_ctx = mailbox_search_init(exporter->trans, search_args, NULL,
 					 wanted_fields, wanted_headers);
 	mail_search_args_unref(&search_args);
@@ -479,7 +531,8 @@ dsync_mailbox_export_log_scan(struct dsync_mailbox_exporter *exporter,
 	struct dsync_mail_change *change, *dup_change;
 
 	log_changes = dsync_transaction_log_scan_get_hash(log_scan);
-	if (dsync_transaction_log_scan_has_all_changes(log_scan)) {
+	if (dsync_transaction_log_scan_has_all_changes(log_scan) &&
+	    !exporter->modseq_changes) {
 		/* we tried to access too old/invalid modseqs. to make sure
 		   no changes get lost, we need to send all of the messages */
 		exporter->return_all_mails = TRUE;
@@ -490,6 +543,13 @@ dsync_mailbox_export_log_scan(struct dsync_mailbox_exporter *exporter,
 				 hash_table_count(log_changes));
 	iter = hash_table_iterate_init(log_changes);
 	while (hash_table_iterate(iter, log_changes, &key, &change)) {
+		if (exporter->modseq_changes &&
+		    change->uid <= exporter->last_common_uid) {
+			/* the log may have old changes from before the last
+			   sync, but not all of the newer ones. these are
+			   looked up from modseqs instead. */
+			continue;
+		}
 		dup_change = p_new(exporter->pool, struct dsync_mail_change, 1);
 		*dup_change = *change;
 		hash_table_insert(exporter->changes, key, dup_change);
@@ -503,6 +563,7 @@ struct dsync_mailbox_exporter *
 dsync_mailbox_export_init(struct mailbox *box,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
+			  uint64_t last_common_modseq,
 			  enum dsync_mailbox_exporter_flags flags,
 			  unsigned int hdr_hash_version,
 			  const char *const *hashed_headers,
@@ -518,6 +579,7 @@ dsync_mailbox_export_init(struct mailbox *box,
 	exporter->box = box;
 	exporter->log_scan = log_scan;
 	exporter->last_common_uid = last_common_uid;
+	exporter->last_common_modseq = last_common_modseq;
 	exporter->auto_export_mails =
 		(flags & DSYNC_MAILBOX_EXPORTER_FLAG_AUTO_EXPORT_MAILS) != 0;
 	exporter->mails_have_guids =
@@ -531,6 +593,10 @@ dsync_mailbox_export_init(struct mailbox *box,
 	exporter->hdr_hash_version = hdr_hash_version;
 	exporter->no_hdr_hashes =
 		(flags & DSYNC_MAILBOX_EXPORTER_FLAG_NO_HDR_HASHES) != 0;
+	exporter->modseq_changes =
+		(flags & DSYNC_MAILBOX_EXPORTER_FLAG_MODSEQ_CHANGES) != 0;
+	i_assert(!exporter->modseq_changes ||
+		 (last_common_uid != 0 && last_common_modseq != 0));
 	exporter->hashed_headers = hashed_headers;
 	exporter->event = event_create(parent_event);
 
@@ -605,7 +671,10 @@ dsync_mailbox_export_iter_next_attr(struct dsync_mailbox_exporter *exporter)
 	struct mail_attribute_value value;
 	bool export_all_attrs;
 
+	/* attribute changes can't be found from modseqs, but there usually
+	   aren't many attributes */
 	export_all_attrs = exporter->return_all_mails ||
+		exporter->modseq_changes ||
 		exporter->last_common_uid == 0;
 	attr_changes = dsync_transaction_log_scan_get_attr_hash(exporter->log_scan);
 	lookup_attr.type = exporter->attr_type;
@@ -8,12 +8,19 @@ enum dsync_mailbox_exporter_flags {
 	DSYNC_MAILBOX_EXPORTER_FLAG_TIMESTAMPS		= 0x08,
 	DSYNC_MAILBOX_EXPORTER_FLAG_NO_HDR_HASHES	= 0x20,
 	DSYNC_MAILBOX_EXPORTER_FLAG_VSIZES		= 0x40,
+	/* The transaction log doesn't have all the changes since
+	   last_common_modseq, but it's known that no messages up to
+	   last_common_uid have been expunged since. Find the flag changes
+	   by looking up the messages' modseqs instead of exporting all
+	   messages. */
+	DSYNC_MAILBOX_EXPORTER_FLAG_MODSEQ_CHANGES	= 0x80,
 };
 
 struct dsync_mailbox_exporter *
 dsync_mailbox_export_init(struct mailbox *box,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
+			  uint64_t last_common_modseq,
 			  enum dsync_mailbox_exporter_flags flags,
 			  unsigned int hdr_hash_version,
 			  const char *const *hashed_headers,
@@ -11,6 +11,7 @@
 #include "mail-storage-private.h"
 #include "mail-search-build.h"
 #include "dsync-transaction-log-scan.h"
+#include "dsync-mail-guid-index.h"
 #include "dsync-mail.h"
 #include "dsync-mailbox.h"
 #include "dsync-mailbox-import.h"
@@ -69,6 +70,7 @@ struct dsync_mailbox_importer {
 	enum mailbox_transaction_flags transaction_flags;
 	unsigned int hdr_hash_version;
 	unsigned int commit_msgs_interval;
+	uoff_t commit_msgs_size;
 
 	const char *const *hashed_headers;
 
@@ -84,6 +86,8 @@ struct dsync_mailbox_importer {
 	struct mailbox_transaction_context *virtual_trans;
 	struct mail *virtual_mail;
 
+	struct dsync_mail_guid_index *mail_guid_index;
+
 	struct mail *cur_mail;
 	const char *cur_guid;
 	const char *cur_hdr_hash;
@@ -112,6 +116,7 @@ struct dsync_mailbox_importer {
 	uint64_t local_initial_highestmodseq, local_initial_highestpvtmodseq;
 	unsigned int import_pos, import_count;
 	unsigned int first_unsaved_idx, saves_since_commit;
+	uoff_t saved_bytes_since_commit;
 
 	enum mail_error mail_error;
 
@@ -205,6 +210,7 @@ dsync_mailbox_import_transaction_begin(struct dsync_mailbox_importer *importer)
 struct dsync_mailbox_importer *
 dsync_mailbox_import_init(struct mailbox *box,
 			  struct mailbox *virtual_all_box,
+			  struct dsync_mail_guid_index *mail_guid_index,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
 			  uint64_t last_common_modseq,
@@ -218,6 +224,7 @@ dsync_mailbox_import_init(struct mailbox *box,
 			  uoff_t sync_max_size,
 			  const char *sync_flag,
 			  unsigned int commit_msgs_interval,
+			  uoff_t commit_msgs_size,
 			  enum dsync_mailbox_import_flags flags,
 			  unsigned int hdr_hash_version,
 			  const char *const *hashed_headers,
@@ -237,6 +244,7 @@ dsync_mailbox_import_init(struct mailbox *box,
 
 	importer->box = box;
 	importer->virtual_all_box = virtual_all_box;
+	importer->mail_guid_index = mail_guid_index;
 	importer->last_common_uid = last_common_uid;
 	importer->last_common_modseq = last_common_modseq;
 	importer->last_common_pvt_modseq = last_common_pvt_modseq;
@@ -263,6 +271,7 @@ dsync_mailbox_import_init(struct mailbox *box,
 			importer->sync_keyword = p_strdup(pool, sync_flag);
 	}
 	importer->commit_msgs_interval = commit_msgs_interval;
+	importer->commit_msgs_size = commit_msgs_size;
 	importer->transaction_flags = MAILBOX_TRANSACTION_FLAG_SYNC;
 	if ((flags & DSYNC_MAILBOX_IMPORT_FLAG_NO_NOTIFY) != 0)
 		importer->transaction_flags |= MAILBOX_TRANSACTION_FLAG_NO_NOTIFY;
@@ -1974,13 +1983,24 @@ dsync_mailbox_import_update_first_saved(struct dsync_mailbox_importer *importer)
 
 static void
 dsync_mailbox_import_saved_newmail(struct dsync_mailbox_importer *importer,
-				   struct importer_new_mail *newmail)
+				   struct importer_new_mail *newmail,
+				   uoff_t saved_bytes)
 {
+	bool commit;
+
 	dsync_mailbox_import_saved_uid(importer, newmail->final_uid);
 	newmail->saved = TRUE;
 
 	dsync_mailbox_import_update_first_saved(importer);
 	importer->saves_since_commit++;
+	importer->saved_bytes_since_commit += saved_bytes;
+	/* Committing also after enough bytes have been saved makes sure that
+	   a failure in the middle of a mailbox with large mails doesn't lose
+	   much of the transferred data. The committed mails are found by
+	   GUID on the next sync and don't need to be transferred again. */
+	commit = importer->saves_since_commit >= importer->commit_msgs_interval ||
+		(importer->commit_msgs_size > 0 &&
+		 importer->saved_bytes_since_commit >= importer->commit_msgs_size);
 	/* we can commit only if all the upcoming mails will have UIDs that
 	   are larger than we're committing.
 
@@ -1989,11 +2009,12 @@ dsync_mailbox_import_saved_newmail(struct dsync_mailbox_importer *importer,
 	   an intermediate commit. It's too much extra work to try to handle
 	   that situation. So here this never happens, because then
 	   array_count(wanted_uids) is always higher than first_unsaved_idx. */
-	if (importer->saves_since_commit >= importer->commit_msgs_interval &&
+	if (commit &&
 	    importer->first_unsaved_idx == array_count(&importer->wanted_uids)) {
 		if (dsync_mailbox_import_commit(importer, FALSE) < 0)
 			importer->failed = TRUE;
 		importer->saves_since_commit = 0;
+		importer->saved_bytes_since_commit = 0;
 	}
 }
 
@@ -2156,6 +2177,29 @@ dsync_mailbox_import_try_virtual_all(struct dsync_mailbox_importer *importer,
 	return FALSE;
 }
 
+static bool
+dsync_mailbox_import_try_guid_index(struct dsync_mailbox_importer *importer,
+				    struct importer_new_mail *all_newmails)
+{
+	struct dsync_mail dmail;
+	struct mail *mail;
+	uint32_t uid;
+
+	if (importer->mail_guid_index == NULL || *all_newmails->guid == '\0')
+		return FALSE;
+
+	if (dsync_mail_guid_index_lookup(importer->mail_guid_index,
+					 importer->box, all_newmails->guid,
+					 &mail, &uid) > 0 &&
+	    dsync_mailbox_import_local_uid(importer, mail, uid,
+					   all_newmails->guid, &dmail) > 0) {
+		if (dsync_mailbox_save_newmails(importer, &dmail,
+						all_newmails, FALSE))
+			return TRUE;
+	}
+	return FALSE;
+}
+
 static bool
 dsync_mailbox_import_handle_mail(struct dsync_mailbox_importer *importer,
 				 struct importer_new_mail *all_newmails)
@@ -2189,7 +2233,8 @@ dsync_mailbox_import_handle_mail(struct dsync_mailbox_importer *importer,
 
 	if (!dsync_mailbox_import_try_local(importer, all_newmails,
 					    &local_uids, &wanted_uids) &&
-	    !dsync_mailbox_import_try_virtual_all(importer, all_newmails)) {
+	    !dsync_mailbox_import_try_virtual_all(importer, all_newmails) &&
+	    !dsync_mailbox_import_try_guid_index(importer, all_newmails)) {
 		/* no local instance. request from remote */
 		IMPORTER_DEBUG_CHANGE(importer);
 		if (importer->want_mail_requests) {
@@ -2492,7 +2537,7 @@ dsync_mailbox_save_body(struct dsync_mailbox_importer *importer,
 	}
 	if (ret > 0) {
 		i_assert(save_ctx == NULL);
-		dsync_mailbox_import_saved_newmail(importer, newmail);
+		dsync_mailbox_import_saved_newmail(importer, newmail, 0);
 		return TRUE;
 	}
 	/* fallback to saving from remote stream */
@@ -2568,7 +2613,8 @@ dsync_mailbox_save_body(struct dsync_mailbox_importer *importer,
 					importer->box, &importer->mail_error));
 			importer->failed = TRUE;
 		} else {
-			dsync_mailbox_import_saved_newmail(importer, newmail);
+			dsync_mailbox_import_saved_newmail(importer, newmail,
+							   input->v_offset);
 		}
 	}
 	return TRUE;
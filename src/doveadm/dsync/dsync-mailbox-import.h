@@ -19,10 +19,12 @@ struct dsync_mailbox_attribute;
 struct dsync_mail;
 struct dsync_mail_change;
 struct dsync_transaction_log_scan;
+struct dsync_mail_guid_index;
 
 struct dsync_mailbox_importer *
 dsync_mailbox_import_init(struct mailbox *box,
 			  struct mailbox *virtual_all_box,
+			  struct dsync_mail_guid_index *mail_guid_index,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
 			  uint64_t last_common_modseq,
@@ -36,6 +38,7 @@ dsync_mailbox_import_init(struct mailbox *box,
 			  uoff_t sync_max_size,
 			  const char *sync_flag,
 			  unsigned int commit_msgs_interval,
+			  uoff_t commit_msgs_size,
 			  enum dsync_mailbox_import_flags flags,
 			  unsigned int hdr_hash_version,
 			  const char *const *hashed_headers,
@@ -12,12 +12,14 @@
 #include "doveadm-settings.h"
 #include "doveadm-dump.h"
 #include "doveadm-mail.h"
+#include "doveadm-dsync.h"
 #include "doveadm-print-private.h"
 #include "ostream.h"
 
 const struct doveadm_print_vfuncs *doveadm_print_vfuncs_all[] = {
 	&doveadm_print_server_vfuncs,
 	&doveadm_print_json_vfuncs,
+	&doveadm_print_ndjson_vfuncs,
 	NULL
 };
 
@@ -88,6 +90,7 @@ static void main_init(void)
 static void main_deinit(void)
 {
 	doveadm_server_deinit();
+	doveadm_dsync_deinit();
 	doveadm_mail_deinit();
 	doveadm_dump_deinit();
 	doveadm_unload_modules();
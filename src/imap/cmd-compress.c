@@ -98,7 +98,17 @@ bool cmd_compress(struct client_command_context *cmd)
 		i_assert(client->input->v_offset == prev_in_offset);
 	}
 
-	level = handler->get_default_level();
+	level = client->set->parsed_compress_level;
+	if (level < 0)
+		level = handler->get_default_level();
+	else if (level < handler->get_min_level() ||
+		 level > handler->get_max_level()) {
+		e_warning(client->event, "imap_compress_level=%d is invalid "
+			  "for %s compression (must be between %d..%d) - "
+			  "using the default level", level, handler->name,
+			  handler->get_min_level(), handler->get_max_level());
+		level = handler->get_default_level();
+	}
 	old_input = client->input;
 	old_output = client->output;
 	client->input = handler->create_istream(old_input);
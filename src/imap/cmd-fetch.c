@@ -99,6 +99,71 @@ fetch_parse_args(struct imap_fetch_context *ctx,
 	return TRUE;
 }
 
+static bool
+fetch_parse_simple_line(const char *line, const char **messageset_r,
+			const char *const **names_r, bool *list_r)
+{
+	const char *p, *names;
+	size_t len;
+
+	/* <messageset> <atom> or <messageset> (<atom> ...) without
+	   BODY[] sections, partials or modifiers. SEARCHRES may need to wait
+	   for unambiguity, which requires the generic parser to return the
+	   same args again. */
+	p = strchr(line, ' ');
+	if (p == NULL || p == line)
+		return FALSE;
+	*messageset_r = t_strdup_until(line, p);
+	if (strchr(*messageset_r, '$') != NULL)
+		return FALSE;
+	names = p + 1;
+	*list_r = names[0] == '(';
+	if (*list_r) {
+		len = strlen(names);
+		if (len < 3 || names[len-1] != ')')
+			return FALSE;
+		names = t_strndup(names + 1, len - 2);
+	}
+	if (names[0] == '\0' || strpbrk(names, "()[]<>") != NULL)
+		return FALSE;
+	*names_r = t_strsplit(t_str_ucase(names), " ");
+	for (unsigned int i = 0; (*names_r)[i] != NULL; i++) {
+		if ((*names_r)[i][0] == '\0')
+			return FALSE;
+	}
+	return *list_r || (*names_r)[1] == NULL;
+}
+
+static bool
+fetch_parse_simple_args(struct imap_fetch_context *ctx,
+			struct client_command_context *cmd,
+			const char *const *names, bool list)
+{
+	static const struct imap_arg eol_arg = { .type = IMAP_ARG_EOL };
+	const struct imap_arg *arg = &eol_arg;
+	const char *const *macro = NULL;
+
+	if (cmd->uid) {
+		if (!imap_fetch_cmd_init_handler(ctx, cmd, "UID", &arg))
+			return FALSE;
+	}
+	if (!list) {
+		if (strcmp(names[0], "ALL") == 0)
+			macro = all_macro;
+		else if (strcmp(names[0], "FAST") == 0)
+			macro = fast_macro;
+		else if (strcmp(names[0], "FULL") == 0)
+			macro = full_macro;
+	}
+	if (macro != NULL)
+		names = macro;
+	for (; *names != NULL; names++) {
+		if (!imap_fetch_cmd_init_handler(ctx, cmd, *names, &arg))
+			return FALSE;
+	}
+	return TRUE;
+}
+
 static bool
 fetch_parse_modifier(struct imap_fetch_context *ctx,
 		     struct client_command_context *cmd,
@@ -330,20 +395,27 @@ bool cmd_fetch(struct client_command_context *cmd)
 	const struct imap_arg *args, *next_arg, *list_arg;
 	struct mail_search_args *search_args;
 	struct imap_fetch_qresync_args qresync_args;
-	const char *messageset;
-	bool send_vanished = FALSE;
+	const char *line, *messageset, *const *simple_names = NULL;
+	bool simple_list = FALSE, send_vanished = FALSE;
 	int ret;
 
-	if (!client_read_args(cmd, 0, 0, &args))
+	if (client_peek_simple_args(cmd, &line) &&
+	    fetch_parse_simple_line(line, &messageset, &simple_names,
+				    &simple_list)) {
+		/* fast path - no need to build the imap_arg tree */
+		client_simple_args_finished(cmd, line);
+		args = NULL;
+	} else if (!client_read_args(cmd, 0, 0, &args))
 		return FALSE;
 
 	if (!client_verify_open_mailbox(cmd))
 		return TRUE;
 
 	/* <messageset> <field(s)> [(modifiers)] */
-	if (!imap_arg_get_atom(&args[0], &messageset) ||
-	    (args[1].type != IMAP_ARG_LIST && args[1].type != IMAP_ARG_ATOM) ||
-	    (!IMAP_ARG_IS_EOL(&args[2]) && args[2].type != IMAP_ARG_LIST)) {
+	if (args != NULL &&
+	    (!imap_arg_get_atom(&args[0], &messageset) ||
+	     (args[1].type != IMAP_ARG_LIST && args[1].type != IMAP_ARG_ATOM) ||
+	     (!IMAP_ARG_IS_EOL(&args[2]) && args[2].type != IMAP_ARG_LIST))) {
 		client_send_command_error(cmd, "Invalid arguments.");
 		return TRUE;
 	}
@@ -357,10 +429,12 @@ bool cmd_fetch(struct client_command_context *cmd)
 	ctx = imap_fetch_alloc(client, cmd->pool,
 			       imap_client_command_get_reason(cmd));
 
-	if (!fetch_parse_args(ctx, cmd, &args[1], &next_arg) ||
-	    (imap_arg_get_list(next_arg, &list_arg) &&
-	     !fetch_parse_modifiers(ctx, cmd, search_args, list_arg,
-				    &send_vanished))) {
+	if (args == NULL ?
+	    !fetch_parse_simple_args(ctx, cmd, simple_names, simple_list) :
+	    (!fetch_parse_args(ctx, cmd, &args[1], &next_arg) ||
+	     (imap_arg_get_list(next_arg, &list_arg) &&
+	      !fetch_parse_modifiers(ctx, cmd, search_args, list_arg,
+				     &send_vanished)))) {
 		imap_fetch_free(&ctx);
 		mail_search_args_unref(&search_args);
 		return TRUE;
@@ -9,9 +9,23 @@ bool cmd_search(struct client_command_context *cmd)
 	struct imap_search_context *ctx;
 	struct mail_search_args *sargs;
 	const struct imap_arg *args;
-	const char *charset;
+	const char *line, *charset;
 	int ret;
 
+	if (client_peek_simple_args(cmd, &line) &&
+	    imap_search_args_build_simple(cmd, line, &sargs)) {
+		/* fast path - no need to build the imap_arg tree */
+		client_simple_args_finished(cmd, line);
+		/* the mailbox was already checked, this adds it to the event */
+		if (!client_verify_open_mailbox(cmd))
+			i_unreached();
+
+		ctx = p_new(cmd->pool, struct imap_search_context, 1);
+		ctx->cmd = cmd;
+		ctx->return_options = SEARCH_RETURN_ALL;
+		return imap_search_start(ctx, sargs, NULL);
+	}
+
 	if (!client_read_args(cmd, 0, 0, &args))
 		return FALSE;
 
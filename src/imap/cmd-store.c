@@ -7,6 +7,8 @@
 #include "imap-search-args.h"
 #include "imap-util.h"
 
+#include <ctype.h>
+
 
 struct imap_store_context {
 	struct client_command_context *cmd;
@@ -76,6 +78,22 @@ store_parse_modifiers(struct imap_store_context *ctx,
 	return TRUE;
 }
 
+static bool store_create_keywords(struct imap_store_context *ctx,
+				  const char *const *keywords_list)
+{
+	struct client_command_context *cmd = ctx->cmd;
+
+	if (keywords_list != NULL || ctx->modify_type == MODIFY_REPLACE) {
+		if (mailbox_keywords_create(cmd->client->mailbox, keywords_list,
+					    &ctx->keywords) < 0) {
+			/* invalid keywords */
+			client_send_box_error(cmd, cmd->client->mailbox);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 static bool
 store_parse_args(struct imap_store_context *ctx, const struct imap_arg *args)
 {
@@ -108,13 +126,68 @@ store_parse_args(struct imap_store_context *ctx, const struct imap_arg *args)
 			return FALSE;
 	}
 
-	if (keywords_list != NULL || ctx->modify_type == MODIFY_REPLACE) {
-		if (mailbox_keywords_create(cmd->client->mailbox, keywords_list,
-					    &ctx->keywords) < 0) {
-			/* invalid keywords */
-			client_send_box_error(cmd, cmd->client->mailbox);
+	return store_create_keywords(ctx, keywords_list);
+}
+
+static bool
+store_parse_simple_line(struct imap_store_context *ctx, const char *line,
+			const char **set_r, const char *const **keywords_r)
+{
+	ARRAY_TYPE(const_string) keywords;
+	const char *p, *type, *flags, *const *tokens;
+	enum mail_flags flag;
+	size_t len;
+
+	/* <set> <type> <flag> or <set> <type> (<flag> ...) without
+	   modifiers. SEARCHRES may need to wait for unambiguity, which
+	   requires the generic parser to return the same args again. */
+	p = strchr(line, ' ');
+	if (p == NULL || p == line)
+		return FALSE;
+	*set_r = t_strdup_until(line, p);
+	if (strchr(*set_r, '$') != NULL)
+		return FALSE;
+	ctx->max_modseq = (uint64_t)-1;
+	type = p + 1;
+	p = strchr(type, ' ');
+	if (p == NULL || !get_modify_type(ctx, t_strdup_until(type, p)))
+		return FALSE;
+	flags = p + 1;
+	if (flags[0] == '(') {
+		len = strlen(flags);
+		if (flags[len-1] != ')')
+			return FALSE;
+		flags = t_strndup(flags + 1, len - 2);
+	} else if (flags[0] == '\0' || strchr(flags, ' ') != NULL) {
+		return FALSE;
+	}
+
+	*keywords_r = NULL;
+	if (flags[0] == '\0')
+		return TRUE;
+
+	t_array_init(&keywords, 8);
+	for (tokens = t_strsplit(flags, " "); *tokens != NULL; tokens++) {
+		p = *tokens;
+		if (p[0] == '\0')
 			return FALSE;
+		if (p[0] == '\\') {
+			flag = imap_parse_system_flag(p);
+			if (flag == 0 || flag == MAIL_RECENT)
+				return FALSE;
+			ctx->flags |= flag;
+			continue;
 		}
+		/* plain keywords only, lib-storage checks their validity */
+		for (; *p != '\0'; p++) {
+			if (!i_isalnum(*p) && strchr("$_-.", *p) == NULL)
+				return FALSE;
+		}
+		array_push_back(&keywords, tokens);
+	}
+	if (array_count(&keywords) > 0) {
+		array_append_zero(&keywords);
+		*keywords_r = array_front(&keywords);
 	}
 	return TRUE;
 }
@@ -131,19 +204,31 @@ bool cmd_store(struct client_command_context *cmd)
 	ARRAY_TYPE(seq_range) modified_set, uids;
 	enum mailbox_transaction_flags flags = 0;
 	enum imap_sync_flags imap_sync_flags = 0;
-	const char *set, *reply, *tagged_reply;
+	const char *line, *set, *reply, *tagged_reply;
+	const char *const *keywords_list = NULL;
 	string_t *str;
 	int ret;
 	bool update_deletes;
 	unsigned int deleted_count;
 
-	if (!client_read_args(cmd, 0, 0, &args))
-		return FALSE;
+	i_zero(&ctx);
+	ctx.cmd = cmd;
+	if (client_peek_simple_args(cmd, &line) &&
+	    store_parse_simple_line(&ctx, line, &set, &keywords_list)) {
+		/* fast path - no need to build the imap_arg tree */
+		client_simple_args_finished(cmd, line);
+		args = NULL;
+	} else {
+		i_zero(&ctx);
+		ctx.cmd = cmd;
+		if (!client_read_args(cmd, 0, 0, &args))
+			return FALSE;
+	}
 
 	if (!client_verify_open_mailbox(cmd))
 		return TRUE;
 
-	if (!imap_arg_get_atom(args, &set)) {
+	if (args != NULL && !imap_arg_get_atom(args, &set)) {
 		client_send_command_error(cmd, "Invalid arguments.");
 		return TRUE;
 	}
@@ -151,9 +236,8 @@ bool cmd_store(struct client_command_context *cmd)
 	if (ret <= 0)
 		return ret < 0;
 
-	i_zero(&ctx);
-	ctx.cmd = cmd;
-	if (!store_parse_args(&ctx, ++args)) {
+	if (args == NULL ? !store_create_keywords(&ctx, keywords_list) :
+	    !store_parse_args(&ctx, ++args)) {
 		mail_search_args_unref(&search_args);
 		return TRUE;
 	}
@@ -844,6 +844,37 @@ void client_args_finished(struct client_command_context *cmd,
 	event_add_str(cmd->event, "cmd_human_args", cmd->human_args);
 }
 
+bool client_peek_simple_args(struct client_command_context *cmd,
+			     const char **line_r)
+{
+	const unsigned char *data;
+	size_t size;
+
+	if (!imap_parser_peek_simple_line(cmd->parser, &data, &size))
+		return FALSE;
+	*line_r = t_strndup(data, size);
+	return TRUE;
+}
+
+void client_simple_args_finished(struct client_command_context *cmd,
+				 const char *line)
+{
+	i_assert(cmd->client->input_lock == NULL ||
+		 cmd->client->input_lock == cmd);
+
+	imap_parser_skip_simple_line(cmd->parser, strlen(line));
+	/* without quoted strings and literals the line is the same for
+	   both */
+	if (cmd->args != NULL && cmd->args[0] != '\0')
+		cmd->args = p_strconcat(cmd->pool, cmd->args, " ", line, NULL);
+	else
+		cmd->args = p_strdup(cmd->pool, line);
+	cmd->human_args = cmd->args;
+	event_add_str(cmd->event, "cmd_args", cmd->args);
+	event_add_str(cmd->event, "cmd_human_args", cmd->human_args);
+	cmd->client->input_lock = NULL;
+}
+
 static struct client_command_context *
 client_command_find_with_flags(struct client_command_context *new_cmd,
 			       enum command_flags flags,
@@ -1028,6 +1059,12 @@ void client_command_free(struct client_command_context **_cmd)
 			  &cmd->stats.last_run_timeval);
 	event_add_int(cmd->event, "running_usecs", cmd->stats.running_usecs);
 	event_add_int(cmd->event, "lock_wait_usecs", cmd->stats.lock_wait_usecs);
+	event_add_int(cmd->event, "sync_usecs", cmd->stats.sync_usecs);
+	event_add_int(cmd->event, "cache_lookup_usecs",
+		      cmd->stats.cache_lookup_usecs);
+	event_add_int(cmd->event, "mail_read_usecs", cmd->stats.mail_read_usecs);
+	event_add_int(cmd->event, "output_stall_usecs",
+		      cmd->stats.output_stall_usecs);
 	event_add_int(cmd->event, "net_in_bytes", cmd->stats.bytes_in);
 	event_add_int(cmd->event, "net_out_bytes", cmd->stats.bytes_out);
 
@@ -65,6 +65,12 @@ struct client_command_stats {
 	uint64_t running_usecs;
 	/* how many usecs this command itself has spent waiting for locks */
 	uint64_t lock_wait_usecs;
+	/* how many usecs of running_usecs this command has spent syncing
+	   mailboxes, looking up cache fields and reading mails */
+	uint64_t sync_usecs, cache_lookup_usecs, mail_read_usecs;
+	/* how many usecs this command has spent waiting for the client to
+	   read its output */
+	uint64_t output_stall_usecs;
 	/* how many bytes of client input/output command has used */
 	uint64_t bytes_in, bytes_out;
 };
@@ -72,6 +78,9 @@ struct client_command_stats {
 struct client_command_stats_start {
 	struct timeval timeval;
 	uint64_t lock_wait_usecs;
+	uint64_t sync_usecs, cache_lookup_usecs, mail_read_usecs;
+	/* time when the command started waiting for output, or 0 */
+	struct timeval output_stall_timeval;
 	uint64_t bytes_in, bytes_out;
 };
 
@@ -319,6 +328,15 @@ bool client_read_string_args(struct client_command_context *cmd,
 			     unsigned int count, ...);
 void client_args_finished(struct client_command_context *cmd,
 			  const struct imap_arg *args);
+/* Fast path for commands whose parameters are only atoms and lists of atoms:
+   Returns TRUE and the rest of the command line if it's already fully
+   buffered, without building an imap_arg tree. Nothing is consumed yet, so if
+   the command can't handle the line it can still use client_read_args().
+   Otherwise it must call client_simple_args_finished() after parsing. */
+bool client_peek_simple_args(struct client_command_context *cmd,
+			     const char **line_r);
+void client_simple_args_finished(struct client_command_context *cmd,
+				 const char *line);
 
 /* SEARCHRES extension: Call if $ is being used/updated, returns TRUE if we
    have to wait for an existing SEARCH SAVE to finish. */
@@ -163,6 +163,12 @@ void command_stats_start(struct client_command_context *cmd)
 {
 	cmd->stats_start.timeval = ioloop_timeval;
 	cmd->stats_start.lock_wait_usecs = file_lock_wait_get_total_usecs();
+	cmd->stats_start.sync_usecs =
+		mail_storage_timing_get_total_usecs(MAIL_STORAGE_TIMING_SYNC);
+	cmd->stats_start.cache_lookup_usecs =
+		mail_storage_timing_get_total_usecs(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+	cmd->stats_start.mail_read_usecs =
+		mail_storage_timing_get_total_usecs(MAIL_STORAGE_TIMING_MAIL_READ);
 	cmd->stats_start.bytes_in = i_stream_get_absolute_offset(cmd->client->input);
 	cmd->stats_start.bytes_out = cmd->client->output->offset;
 }
@@ -175,6 +181,15 @@ void command_stats_flush(struct client_command_context *cmd)
 	cmd->stats.lock_wait_usecs +=
 		file_lock_wait_get_total_usecs() -
 		cmd->stats_start.lock_wait_usecs;
+	cmd->stats.sync_usecs +=
+		mail_storage_timing_get_total_usecs(MAIL_STORAGE_TIMING_SYNC) -
+		cmd->stats_start.sync_usecs;
+	cmd->stats.cache_lookup_usecs +=
+		mail_storage_timing_get_total_usecs(MAIL_STORAGE_TIMING_CACHE_LOOKUP) -
+		cmd->stats_start.cache_lookup_usecs;
+	cmd->stats.mail_read_usecs +=
+		mail_storage_timing_get_total_usecs(MAIL_STORAGE_TIMING_MAIL_READ) -
+		cmd->stats_start.mail_read_usecs;
 	cmd->stats.bytes_in += i_stream_get_absolute_offset(cmd->client->input) -
 		cmd->stats_start.bytes_in;
 	cmd->stats.bytes_out += cmd->client->prev_output_size +
@@ -192,6 +207,11 @@ bool command_exec(struct client_command_context *cmd)
 
 	io_loop_time_refresh();
 	command_stats_start(cmd);
+	if (cmd->stats_start.output_stall_timeval.tv_sec != 0) {
+		cmd->stats.output_stall_usecs += timeval_diff_usecs(
+			&ioloop_timeval, &cmd->stats_start.output_stall_timeval);
+		cmd->stats_start.output_stall_timeval.tv_sec = 0;
+	}
 
 	event_push_global(cmd->global_event);
 	cmd->executing = TRUE;
@@ -206,6 +226,8 @@ bool command_exec(struct client_command_context *cmd)
 		finished = TRUE;
 
 	command_stats_flush(cmd);
+	if (!finished && cmd->state == CLIENT_COMMAND_STATE_WAIT_OUTPUT)
+		cmd->stats_start.output_stall_timeval = ioloop_timeval;
 	return finished;
 }
 
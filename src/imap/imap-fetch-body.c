@@ -459,9 +459,8 @@ bool imap_fetch_binary_init(struct imap_fetch_init_context *ctx)
 	return TRUE;
 }
 
-static int ATTR_NULL(3)
-fetch_rfc822_size(struct imap_fetch_context *ctx, struct mail *mail,
-		  void *context ATTR_UNUSED)
+int imap_fetch_rfc822_size(struct imap_fetch_context *ctx, struct mail *mail,
+			   void *context ATTR_UNUSED)
 {
 	uoff_t size;
 
@@ -576,7 +575,7 @@ bool imap_fetch_rfc822_init(struct imap_fetch_init_context *ctx)
 	if (strcmp(name+6, ".SIZE") == 0) {
 		ctx->fetch_ctx->fetch_data |= MAIL_FETCH_VIRTUAL_SIZE;
 		imap_fetch_add_handler(ctx, IMAP_FETCH_HANDLER_FLAG_BUFFERED,
-				       "0", fetch_rfc822_size, NULL);
+				       "0", imap_fetch_rfc822_size, NULL);
 		return TRUE;
 	}
 	if (strcmp(name+6, ".HEADER") == 0) {
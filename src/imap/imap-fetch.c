@@ -22,8 +22,39 @@
 #define ENVELOPE_NIL_REPLY \
 	"(NIL NIL NIL NIL NIL NIL NIL NIL NIL NIL)"
 
+/* Send the template-encoded FETCH lines to client after this many bytes */
+#define IMAP_FETCH_TEMPLATE_MAX_BUFFER_SIZE 8192
+
+enum imap_fetch_template_field {
+	IMAP_FETCH_TEMPLATE_FIELD_UID,
+	IMAP_FETCH_TEMPLATE_FIELD_FLAGS,
+	IMAP_FETCH_TEMPLATE_FIELD_MODSEQ,
+	IMAP_FETCH_TEMPLATE_FIELD_INTERNALDATE,
+	IMAP_FETCH_TEMPLATE_FIELD_RFC822_SIZE,
+	IMAP_FETCH_TEMPLATE_FIELD_ENVELOPE,
+};
+
+struct imap_fetch_template {
+	/* Fields in the same order as ctx->handlers */
+	ARRAY(enum imap_fetch_template_field) fields;
+	/* Full FETCH lines that haven't been sent to client yet */
+	string_t *output;
+
+	/* FLAGS of the previous message. Usually many messages have the
+	   same flags, so this avoids looking up the keyword names and
+	   writing the flags again for each one of them. */
+	enum mail_flags last_flags;
+	ARRAY_TYPE(keyword_indexes) last_keywords;
+	string_t *last_flags_str;
+	bool last_flags_set;
+};
+
 static ARRAY(struct imap_fetch_handler) fetch_handlers;
 
+static void imap_fetch_template_init(struct imap_fetch_context *ctx);
+static bool
+imap_fetch_template_write(struct imap_fetch_context *ctx, struct mail *mail);
+
 static int imap_fetch_handler_cmp(const struct imap_fetch_handler *h1,
 				  const struct imap_fetch_handler *h2)
 {
@@ -360,6 +391,7 @@ static void imap_fetch_init(struct imap_fetch_context *ctx)
 	if ((ctx->fetch_data &
 	     (MAIL_FETCH_STREAM_HEADER | MAIL_FETCH_STREAM_BODY)) != 0)
 		ctx->fetch_data |= MAIL_FETCH_NUL_STATE;
+	imap_fetch_template_init(ctx);
 }
 
 void imap_fetch_begin(struct imap_fetch_context *ctx, struct mailbox *box,
@@ -374,6 +406,10 @@ void imap_fetch_begin(struct imap_fetch_context *ctx, struct mailbox *box,
 
         imap_fetch_init(ctx);
         i_zero(&ctx->state);
+	if (ctx->template != NULL) {
+		/* keyword indexes are mailbox-specific */
+		ctx->template->last_flags_set = FALSE;
+	}
 
 	if (array_count(&ctx->all_headers) > 0 &&
 	    ((ctx->fetch_data & (MAIL_FETCH_STREAM_HEADER |
@@ -436,6 +472,21 @@ static int imap_fetch_flush_buffer(struct imap_fetch_context *ctx)
 	return 0;
 }
 
+static void imap_fetch_template_send(struct imap_fetch_context *ctx)
+{
+	string_t *output;
+
+	if (ctx->template == NULL)
+		return;
+
+	output = ctx->template->output;
+	if (str_len(output) > 0) {
+		o_stream_nsend(ctx->client->output,
+			       str_data(output), str_len(output));
+		str_truncate(output, 0);
+	}
+}
+
 static int imap_fetch_send_nil_reply(struct imap_fetch_context *ctx)
 {
 	const struct imap_fetch_context_handler *handler;
@@ -524,19 +575,43 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 	for (;;) {
 		if (o_stream_get_buffer_used_size(client->output) >=
 		    CLIENT_OUTPUT_OPTIMAL_SIZE) {
+			imap_fetch_template_send(ctx);
 			ret = o_stream_flush(client->output);
 			if (ret <= 0)
 				return ret;
 		}
 
 		if (state->cur_mail == NULL) {
-			if (cancel)
+			if (cancel) {
+				imap_fetch_template_send(ctx);
 				return 1;
+			}
 
 			if (!mailbox_search_next(state->search_ctx,
 						 &state->cur_mail))
 				break;
 
+			if (ctx->template != NULL) {
+				bool written;
+
+				T_BEGIN {
+					written = imap_fetch_template_write(
+						ctx, state->cur_mail);
+				} T_END;
+				if (written) {
+					ctx->fetched_mails_count++;
+					client->last_output = ioloop_time;
+					state->cur_mail = NULL;
+					if (str_len(ctx->template->output) >=
+					    IMAP_FETCH_TEMPLATE_MAX_BUFFER_SIZE)
+						imap_fetch_template_send(ctx);
+					continue;
+				}
+				/* some field lookup failed - let the
+				   handlers deal with the error */
+				imap_fetch_template_send(ctx);
+			}
+
 			str_printfa(state->cur_str, "* %u FETCH (",
 				    state->cur_mail->seq);
 			ctx->fetched_mails_count++;
@@ -602,6 +677,7 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 		state->cur_handler = 0;
 		state->line_partial = FALSE;
 	}
+	imap_fetch_template_send(ctx);
 
 	return ctx->failures ? -1 : 1;
 }
@@ -654,6 +730,7 @@ int imap_fetch_end(struct imap_fetch_context *ctx)
 
 	if (ctx->state.fetching) {
 		ctx->state.fetching = FALSE;
+		imap_fetch_template_send(ctx);
 		if (state->line_partial) {
 			imap_fetch_fix_empty_reply(ctx);
 			if (imap_fetch_flush_buffer(ctx) < 0)
@@ -696,6 +773,11 @@ void imap_fetch_free(struct imap_fetch_context **_ctx)
 		if (handler->want_deinit)
 			handler->handler(ctx, NULL, handler->context);
 	}
+	if (ctx->template != NULL) {
+		str_free(&ctx->template->output);
+		str_free(&ctx->template->last_flags_str);
+		array_free(&ctx->template->last_keywords);
+	}
 	pool_unref(&ctx->ctx_pool);
 }
 
@@ -1027,6 +1109,177 @@ imap_fetch_default_handlers[] = {
 	{ "X-SAVEDATE", fetch_x_savedate_init }
 };
 
+static const struct {
+	imap_fetch_handler_t *handler;
+	enum imap_fetch_template_field field;
+} imap_fetch_template_handlers[] = {
+	{ fetch_uid, IMAP_FETCH_TEMPLATE_FIELD_UID },
+	{ fetch_flags, IMAP_FETCH_TEMPLATE_FIELD_FLAGS },
+	{ fetch_modseq, IMAP_FETCH_TEMPLATE_FIELD_MODSEQ },
+	{ fetch_internaldate, IMAP_FETCH_TEMPLATE_FIELD_INTERNALDATE },
+	{ imap_fetch_rfc822_size, IMAP_FETCH_TEMPLATE_FIELD_RFC822_SIZE },
+	{ fetch_envelope, IMAP_FETCH_TEMPLATE_FIELD_ENVELOPE },
+};
+
+static bool
+imap_fetch_template_field_find(const struct imap_fetch_context_handler *handler,
+			       enum imap_fetch_template_field *field_r)
+{
+	unsigned int i;
+
+	if (handler->context != NULL || handler->want_deinit)
+		return FALSE;
+	for (i = 0; i < N_ELEMENTS(imap_fetch_template_handlers); i++) {
+		if (imap_fetch_template_handlers[i].handler == handler->handler) {
+			*field_r = imap_fetch_template_handlers[i].field;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void imap_fetch_template_init(struct imap_fetch_context *ctx)
+{
+	struct imap_fetch_template *template;
+	const struct imap_fetch_context_handler *handler;
+	enum imap_fetch_template_field field;
+
+	/* Use the template only when all the fields are simple ones that
+	   don't need anything else than lookups from the mail. This is the
+	   common case with e.g. FETCH (UID FLAGS) resyncs done by clients. */
+	if (ctx->flags_update_seen || ctx->flags_show_only_seen_changes ||
+	    array_is_empty(&ctx->handlers))
+		return;
+	array_foreach(&ctx->handlers, handler) {
+		if (!imap_fetch_template_field_find(handler, &field))
+			return;
+	}
+
+	template = p_new(ctx->ctx_pool, struct imap_fetch_template, 1);
+	p_array_init(&template->fields, ctx->ctx_pool,
+		     array_count(&ctx->handlers));
+	array_foreach(&ctx->handlers, handler) {
+		if (!imap_fetch_template_field_find(handler, &field))
+			i_unreached();
+		array_push_back(&template->fields, &field);
+	}
+	template->output = str_new(default_pool,
+				   IMAP_FETCH_TEMPLATE_MAX_BUFFER_SIZE + 512);
+	template->last_flags_str = str_new(default_pool, 64);
+	i_array_init(&template->last_keywords, 8);
+	ctx->template = template;
+}
+
+static void
+imap_fetch_template_write_flags(struct imap_fetch_context *ctx,
+				struct mail *mail, string_t *str)
+{
+	struct imap_fetch_template *template = ctx->template;
+	const ARRAY_TYPE(keyword_indexes) *keyword_indexes;
+	const char *const *keywords;
+	enum mail_flags flags;
+
+	flags = mail_get_flags(mail);
+	keyword_indexes = mail_get_keyword_indexes(mail);
+	if (!template->last_flags_set || template->last_flags != flags ||
+	    !array_cmp(&template->last_keywords, keyword_indexes)) {
+		keywords = client_get_keyword_names(ctx->client,
+			&ctx->tmp_keywords, keyword_indexes);
+		str_truncate(template->last_flags_str, 0);
+		imap_write_flags(template->last_flags_str, flags, keywords);
+
+		template->last_flags = flags;
+		array_clear(&template->last_keywords);
+		array_append_array(&template->last_keywords, keyword_indexes);
+		template->last_flags_set = TRUE;
+	}
+	str_append(str, "FLAGS (");
+	str_append_str(str, template->last_flags_str);
+	str_append_c(str, ')');
+}
+
+static bool
+imap_fetch_template_write_field(struct imap_fetch_context *ctx,
+				struct mail *mail,
+				enum imap_fetch_template_field field,
+				string_t *str)
+{
+	char num[MAX_INT_STRLEN];
+	const char *value;
+	uint64_t modseq;
+	time_t date;
+	uoff_t size;
+
+	switch (field) {
+	case IMAP_FETCH_TEMPLATE_FIELD_UID:
+		str_append(str, "UID ");
+		str_append(str, dec2str_buf(num, mail->uid));
+		return TRUE;
+	case IMAP_FETCH_TEMPLATE_FIELD_FLAGS:
+		imap_fetch_template_write_flags(ctx, mail, str);
+		return TRUE;
+	case IMAP_FETCH_TEMPLATE_FIELD_MODSEQ:
+		modseq = mail_get_modseq(mail);
+		if (ctx->client->highest_fetch_modseq < modseq)
+			ctx->client->highest_fetch_modseq = modseq;
+		str_append(str, "MODSEQ (");
+		str_append(str, dec2str_buf(num, modseq));
+		str_append_c(str, ')');
+		return TRUE;
+	case IMAP_FETCH_TEMPLATE_FIELD_INTERNALDATE:
+		if (mail_get_received_date(mail, &date) < 0)
+			return FALSE;
+		str_append(str, "INTERNALDATE \"");
+		str_append(str, imap_to_datetime(date));
+		str_append_c(str, '"');
+		return TRUE;
+	case IMAP_FETCH_TEMPLATE_FIELD_RFC822_SIZE:
+		if (mail_get_virtual_size(mail, &size) < 0)
+			return FALSE;
+		str_append(str, "RFC822.SIZE ");
+		str_append(str, dec2str_buf(num, size));
+		return TRUE;
+	case IMAP_FETCH_TEMPLATE_FIELD_ENVELOPE:
+		if (mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE,
+				     &value) < 0)
+			return FALSE;
+		str_append(str, "ENVELOPE (");
+		str_append(str, value);
+		str_append_c(str, ')');
+		return TRUE;
+	}
+	i_unreached();
+}
+
+/* Write the full FETCH line for the mail. Returns FALSE if some lookup
+   failed, in which case nothing is written and the mail must be handled via
+   the fetch handlers. */
+static bool
+imap_fetch_template_write(struct imap_fetch_context *ctx, struct mail *mail)
+{
+	string_t *str = ctx->template->output;
+	const enum imap_fetch_template_field *fields;
+	char num[MAX_INT_STRLEN];
+	size_t start_pos = str_len(str);
+	unsigned int i, count;
+
+	str_append(str, "* ");
+	str_append(str, dec2str_buf(num, mail->seq));
+	str_append(str, " FETCH (");
+	fields = array_get(&ctx->template->fields, &count);
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append_c(str, ' ');
+		if (!imap_fetch_template_write_field(ctx, mail,
+						     fields[i], str)) {
+			str_truncate(str, start_pos);
+			return FALSE;
+		}
+	}
+	str_append(str, ")\r\n");
+	return TRUE;
+}
+
 void imap_fetch_handlers_init(void)
 {
 	i_array_init(&fetch_handlers, 32);
@@ -87,6 +87,9 @@ struct imap_fetch_context {
 	unsigned int buffered_handlers_count;
 
 	ARRAY_TYPE(keywords) tmp_keywords;
+	/* Non-NULL if all the fetched fields can be written directly
+	   without going through the handlers. */
+	struct imap_fetch_template *template;
 
 	struct imap_fetch_state state;
 	ARRAY_TYPE(seq_range) fetch_failed_uids;
@@ -159,6 +162,8 @@ bool imap_fetch_rfc822_init(struct imap_fetch_init_context *ctx);
 bool imap_fetch_binary_init(struct imap_fetch_init_context *ctx);
 bool imap_fetch_preview_init(struct imap_fetch_init_context *ctx);
 bool imap_fetch_snippet_init(struct imap_fetch_init_context *ctx);
+int imap_fetch_rfc822_size(struct imap_fetch_context *ctx, struct mail *mail,
+			   void *context) ATTR_NULL(3);
 
 void imap_fetch_handlers_init(void);
 void imap_fetch_handlers_deinit(void);
@@ -8,6 +8,8 @@
 #include "imap-parser.h"
 #include "imap-seqset.h"
 
+#include <ctype.h>
+
 
 struct search_build_data {
 	pool_t pool;
@@ -89,6 +91,90 @@ int imap_search_args_build(struct client_command_context *cmd,
 	return 1;
 }
 
+static const struct {
+	const char *name;
+	enum mail_flags flag;
+	bool match_not;
+} imap_search_simple_flag_keys[] = {
+	{ "ANSWERED", MAIL_ANSWERED, FALSE },
+	{ "UNANSWERED", MAIL_ANSWERED, TRUE },
+	{ "DELETED", MAIL_DELETED, FALSE },
+	{ "UNDELETED", MAIL_DELETED, TRUE },
+	{ "DRAFT", MAIL_DRAFT, FALSE },
+	{ "UNDRAFT", MAIL_DRAFT, TRUE },
+	{ "FLAGGED", MAIL_FLAGGED, FALSE },
+	{ "UNFLAGGED", MAIL_FLAGGED, TRUE },
+	{ "SEEN", MAIL_SEEN, FALSE },
+	{ "UNSEEN", MAIL_SEEN, TRUE },
+};
+
+static bool
+imap_search_simple_add_flag_key(struct mail_search_args *sargs,
+				const char *key)
+{
+	struct mail_search_arg *sarg;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(imap_search_simple_flag_keys); i++) {
+		if (strcmp(imap_search_simple_flag_keys[i].name, key) == 0) {
+			sarg = mail_search_build_add(sargs, SEARCH_FLAGS);
+			sarg->value.flags = imap_search_simple_flag_keys[i].flag;
+			sarg->match_not = imap_search_simple_flag_keys[i].match_not;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+bool imap_search_args_build_simple(struct client_command_context *cmd,
+				   const char *line,
+				   struct mail_search_args **search_args_r)
+{
+	struct mail_search_args *sargs;
+	struct mail_search_arg *sarg;
+	const char *const *keys, *key;
+
+	/* no lists, and no SEARCHRES since it may need to wait for
+	   unambiguity */
+	if (cmd->client->mailbox == NULL || line[0] == '\0' ||
+	    strpbrk(line, "()$") != NULL)
+		return FALSE;
+
+	sargs = mail_search_build_init();
+	for (keys = t_strsplit(line, " "); *keys != NULL; keys++) {
+		key = t_str_ucase(*keys);
+		if (strcmp(key, "ALL") == 0) {
+			(void)mail_search_build_add(sargs, SEARCH_ALL);
+			continue;
+		}
+		if (imap_search_simple_add_flag_key(sargs, key))
+			continue;
+
+		if (strcmp(key, "UID") == 0 && keys[1] != NULL) {
+			keys++;
+			sarg = mail_search_build_add(sargs, SEARCH_UIDSET);
+			sarg->value.str = p_strdup(sargs->pool, *keys);
+		} else if (key[0] == '*' || i_isdigit(key[0])) {
+			sarg = mail_search_build_add(sargs, SEARCH_SEQSET);
+		} else {
+			/* not a simple search */
+			mail_search_args_unref(&sargs);
+			return FALSE;
+		}
+		p_array_init(&sarg->value.seqset, sargs->pool, 16);
+		if (imap_seq_set_parse(*keys, &sarg->value.seqset) < 0) {
+			/* let the generic parser give the error */
+			mail_search_args_unref(&sargs);
+			return FALSE;
+		}
+	}
+
+	mail_search_args_init(sargs, cmd->client->mailbox, TRUE,
+			      &cmd->client->search_saved_uidset);
+	*search_args_r = sargs;
+	return TRUE;
+}
+
 static bool
 msgset_is_valid(ARRAY_TYPE(seq_range) *seqset, uint32_t messages_count)
 {
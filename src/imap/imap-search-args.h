@@ -14,6 +14,15 @@ int imap_search_args_build(struct client_command_context *cmd,
 			   const struct imap_arg *args, const char *charset,
 			   struct mail_search_args **search_args_r);
 
+/* Fast path for the most common searches: Build search arguments directly
+   from a command line containing only ALL, system flag keys (e.g. UNSEEN),
+   UID <set> and <seqset> keys. Returns FALSE without sending anything to the
+   client if the line isn't this simple, and imap_search_args_build() must be
+   used instead. */
+bool imap_search_args_build_simple(struct client_command_context *cmd,
+				   const char *line,
+				   struct mail_search_args **search_args_r);
+
 /* Returns -1 if set is invalid, 0 if we have to wait for unambiguity,
    1 if we were successful. search_args_r is set to contain either a seqset
    or uidset. */
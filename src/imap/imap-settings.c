@@ -98,6 +98,7 @@ static const struct setting_define imap_setting_defines[] = {
 	DEF(BOOL, imap_metadata),
 	DEF(BOOL, imap_literal_minus),
 	DEF(TIME, imap_hibernate_timeout),
+	DEF(STR, imap_compress_level),
 
 	DEF(STR, imap_urlauth_host),
 	DEF(IN_PORT, imap_urlauth_port),
@@ -125,6 +126,7 @@ static const struct imap_settings imap_default_settings = {
 	.imap_metadata = FALSE,
 	.imap_literal_minus = FALSE,
 	.imap_hibernate_timeout = 0,
+	.imap_compress_level = "",
 
 	.imap_urlauth_host = "",
 	.imap_urlauth_port = 143
@@ -210,6 +212,16 @@ imap_settings_verify(void *_set, pool_t pool ATTR_UNUSED, const char **error_r)
 					   set->imap_fetch_failure);
 		return FALSE;
 	}
+
+	if (set->imap_compress_level[0] == '\0')
+		set->parsed_compress_level = -1;
+	else if (str_to_int(set->imap_compress_level,
+			    &set->parsed_compress_level) < 0 ||
+		 set->parsed_compress_level < 0) {
+		*error_r = t_strdup_printf("Invalid imap_compress_level: %s",
+					   set->imap_compress_level);
+		return FALSE;
+	}
 	return TRUE;
 }
 /* </settings checks> */
@@ -34,6 +34,7 @@ struct imap_settings {
 	bool imap_metadata;
 	bool imap_literal_minus;
 	unsigned int imap_hibernate_timeout;
+	const char *imap_compress_level;
 
 	/* imap urlauth: */
 	const char *imap_urlauth_host;
@@ -41,6 +42,8 @@ struct imap_settings {
 
 	enum imap_client_workarounds parsed_workarounds;
 	enum imap_client_fetch_failure parsed_fetch_failure;
+	/* -1 = use the compression mechanism's default level */
+	int parsed_compress_level;
 };
 
 extern const struct setting_parser_info imap_setting_parser_info;
@@ -346,6 +346,19 @@ import_send_expunges(struct client *client,
 			state->uidnext, state->highest_modseq);
 		return -1;
 	}
+	if (array_count(&expunged_uids) == 0) {
+		uint32_t seq1, seq2;
+
+		/* Nothing was expunged. If the old UID range still contains
+		   the same number of messages, they're the same messages and
+		   there's no need to go through all of them to verify the UIDs
+		   CRC32. This is the common case when a new mail wakes up an
+		   IDLEing client. */
+		mailbox_get_seq_range(client->mailbox, 1, state->uidnext-1,
+				      &seq1, &seq2);
+		if (seq1 == 1 && seq2 == state->messages)
+			return 0;
+	}
 	seq_range_array_iter_init(&iter, &expunged_uids);
 
 	search_args = mail_search_build_init();
@@ -652,7 +665,9 @@ import_state_mailbox_open(struct client *client,
 	} else {
 		client_send_mailbox_flags(client, TRUE);
 	}
-	if (import_send_flag_changes(client, state, &flag_change_count) < 0) {
+	/* flags can't have changed if HIGHESTMODSEQ hasn't */
+	if (status.highest_modseq != state->highest_modseq &&
+	    import_send_flag_changes(client, state, &flag_change_count) < 0) {
 		*error_r = "Couldn't send flag changes";
 		return -1;
 	}
@@ -567,6 +567,9 @@ int main(int argc, char *argv[])
 	storage_service =
 		mail_storage_service_init(master_service,
 					  set_roots, storage_service_flags);
+	/* imap_command_finished events have a breakdown of where the time
+	   was spent */
+	mail_storage_timing_enable();
 	master_service_init_finish(master_service);
 	/* NOTE: login_set.*_socket_path are now invalid due to data stack
 	   having been freed */
@@ -15,7 +15,11 @@ struct indexer_queue {
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
 	/* username -> indexer_request */
 	HASH_TABLE(char *, struct indexer_request *) users;
+	/* All queued requests, ordered by priority */
 	struct indexer_request *head, *tail;
+	/* The last queued request of each priority, or NULL if there are
+	   none. */
+	struct indexer_request *priority_tails[INDEXER_REQUEST_PRIORITY_COUNT];
 };
 
 struct indexer_queue_iter {
@@ -83,6 +87,61 @@ indexer_queue_lookup(struct indexer_queue *queue,
 	return hash_table_lookup(queue->requests, &lookup_request);
 }
 
+static void indexer_queue_link(struct indexer_queue *queue,
+			       struct indexer_request *request, bool append)
+{
+	struct indexer_request **tailp =
+		&queue->priority_tails[request->priority];
+	struct indexer_request *after = NULL;
+	unsigned int i;
+
+	if (append && *tailp != NULL)
+		after = *tailp;
+	else {
+		/* add after the last request with a higher priority */
+		for (i = request->priority; i > 0 && after == NULL; i--)
+			after = queue->priority_tails[i-1];
+	}
+
+	if (after == NULL)
+		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	else
+		DLLIST2_INSERT_AFTER(&queue->head, &queue->tail, after, request);
+	if (append || *tailp == NULL)
+		*tailp = request;
+}
+
+static void indexer_queue_unlink(struct indexer_queue *queue,
+				 struct indexer_request *request)
+{
+	struct indexer_request **tailp =
+		&queue->priority_tails[request->priority];
+
+	if (*tailp == request) {
+		*tailp = request->prev != NULL &&
+			request->prev->priority == request->priority ?
+			request->prev : NULL;
+	}
+	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+}
+
+static enum indexer_request_priority
+indexer_request_get_priority(bool append, const char *session_id,
+			     unsigned int max_recent_msgs)
+{
+	if (!append) {
+		/* someone is waiting for this */
+		return INDEXER_REQUEST_PRIORITY_INTERACTIVE;
+	}
+	/* The indexer has no access to the mailbox, so the cost can only be
+	   estimated from how the request was made: max_recent_msgs limits
+	   how much work is done, and a session ID means the request came
+	   from a user session after new mails were added. */
+	if (session_id != NULL || max_recent_msgs > 0)
+		return INDEXER_REQUEST_PRIORITY_APPEND;
+	return INDEXER_REQUEST_PRIORITY_BACKGROUND;
+}
+
 static void request_add_context(struct indexer_request *request, void *context)
 {
 	if (context == NULL)
@@ -95,6 +154,7 @@ static void request_add_context(struct indexer_request *request, void *context)
 
 static struct indexer_request *
 indexer_queue_append_request(struct indexer_queue *queue, bool append,
+			     enum indexer_request_priority priority,
 			     const char *username, const char *mailbox,
 			     const char *session_id,
 			     unsigned int max_recent_msgs, void *context)
@@ -108,19 +168,27 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 			request->max_recent_msgs = max_recent_msgs;
 		request_add_context(request, context);
 		if (request->working) {
-			/* we're already indexing this mailbox. */
+			/* we're already indexing this mailbox. The
+			   reindexing gets the priority of the requests that
+			   came after the work started. */
+			if (!request->reindex_head && !request->reindex_tail)
+				request->priority = priority;
+			else if (request->priority > priority)
+				request->priority = priority;
 			if (append)
 				request->reindex_tail = TRUE;
 			else
 				request->reindex_head = TRUE;
+		} else if (!append || request->priority > priority) {
+			/* move request to the beginning of the queue, or
+			   to the end of the requests with the higher
+			   priority */
+			indexer_queue_unlink(queue, request);
+			if (request->priority > priority)
+				request->priority = priority;
+			indexer_queue_link(queue, request, append);
 		} else {
-			if (append) {
-				/* keep the request in its old position */
-			} else {
-				/* move request to beginning of the queue */
-				DLLIST2_REMOVE(&queue->head, &queue->tail, request);
-				DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-			}
+			/* keep the request in its old position */
 		}
 		return request;
 	}
@@ -130,6 +198,7 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 	request->mailbox = i_strdup(mailbox);
 	request->session_id = i_strdup(session_id);
 	request->max_recent_msgs = max_recent_msgs;
+	request->priority = priority;
 	request_add_context(request, context);
 	hash_table_insert(queue->requests, request, request);
 
@@ -143,10 +212,7 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 		hash_table_update(queue->users, first_username, request);
 	}
 
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	indexer_queue_link(queue, request, append);
 	return request;
 }
 
@@ -162,9 +228,13 @@ void indexer_queue_append(struct indexer_queue *queue, bool append,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context)
 {
+	enum indexer_request_priority priority =
+		indexer_request_get_priority(append, session_id,
+					     max_recent_msgs);
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, append, username, mailbox,
+	request = indexer_queue_append_request(queue, append, priority,
+					       username, mailbox,
 					       session_id, max_recent_msgs,
 					       context);
 	request->type = INDEXER_REQUEST_TYPE_INDEX;
@@ -177,8 +247,10 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, TRUE, username, mailbox,
-					       NULL, 0, context);
+	request = indexer_queue_append_request(queue, TRUE,
+					       INDEXER_REQUEST_PRIORITY_BACKGROUND,
+					       username, mailbox, NULL, 0,
+					       context);
 	request->type = INDEXER_REQUEST_TYPE_OPTIMIZE;
 	indexer_queue_append_finish(queue);
 }
@@ -194,7 +266,44 @@ void indexer_queue_request_remove(struct indexer_queue *queue)
 
 	i_assert(request != NULL);
 
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_unlink(queue, request);
+}
+
+void indexer_queue_request_dequeue(struct indexer_queue *queue,
+				   struct indexer_request *request)
+{
+	i_assert(!request->working);
+
+	indexer_queue_unlink(queue, request);
+}
+
+unsigned int
+indexer_queue_request_get_user_batch(struct indexer_queue *queue,
+				     struct indexer_request *request,
+				     struct indexer_request **requests,
+				     unsigned int max_count)
+{
+	struct indexer_request *user_request;
+	unsigned int count = 0;
+
+	i_assert(!request->working);
+	i_assert(max_count > 0);
+
+	requests[count++] = request;
+	user_request = hash_table_lookup(queue->users, request->username);
+	i_assert(user_request != NULL);
+
+	/* The user's list has the newest request first. Prefer the older
+	   requests. */
+	while (user_request->user_next != NULL)
+		user_request = user_request->user_next;
+	for (; user_request != NULL && count < max_count;
+	     user_request = user_request->user_prev) {
+		if (user_request != request && !user_request->working &&
+		    user_request->priority == request->priority)
+			requests[count++] = user_request;
+	}
+	return count;
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -221,10 +330,32 @@ void indexer_queue_request_status(struct indexer_queue *queue,
 
 void indexer_queue_move_head_to_tail(struct indexer_queue *queue)
 {
-	struct indexer_request *request = queue->head;
+	indexer_queue_move_to_tail(queue, queue->head);
+}
 
-	indexer_queue_request_remove(queue);
-	DLLIST2_APPEND(&queue->head, &queue->tail, request);
+void indexer_queue_move_to_tail(struct indexer_queue *queue,
+				struct indexer_request *request)
+{
+	indexer_queue_unlink(queue, request);
+	indexer_queue_link(queue, request, TRUE);
+}
+
+static void
+indexer_queue_user_move_to_tail(struct indexer_queue *queue,
+				struct indexer_request *first_request,
+				enum indexer_request_priority priority)
+{
+	struct indexer_request *request, *last_request = first_request;
+
+	/* The user's list has the newest request first. Move the requests
+	   starting from the oldest one to preserve their order. */
+	while (last_request->user_next != NULL)
+		last_request = last_request->user_next;
+	for (request = last_request; request != NULL;
+	     request = request->user_prev) {
+		if (!request->working && request->priority == priority)
+			indexer_queue_move_to_tail(queue, request);
+	}
 }
 
 void indexer_queue_request_work(struct indexer_request *request)
@@ -253,10 +384,7 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		indexer_queue_link(queue, request, !request->reindex_head);
 		request->reindex_head = FALSE;
 		request->reindex_tail = FALSE;
 		return;
@@ -266,9 +394,16 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 				    &first_username, &first_request))
 		i_unreached();
 	DLLIST_REMOVE_FULL(&first_request, request, user_prev, user_next);
-	if (first_request != NULL)
+	if (first_request != NULL) {
 		hash_table_update(queue->users, first_username, first_request);
-	else {
+		/* Let other users' requests with the same priority go
+		   first, so a user with lots of mailboxes to index can't
+		   starve the others. */
+		if (request->working) {
+			indexer_queue_user_move_to_tail(queue, first_request,
+							request->priority);
+		}
+	} else {
 		hash_table_remove(queue->users, first_username);
 		i_free(first_username);
 	}
@@ -291,7 +426,7 @@ indexer_queue_request_cancel(struct indexer_queue *queue,
 
 	*_request = NULL;
 	request->reindex_head = request->reindex_tail = FALSE;
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_unlink(queue, request);
 	indexer_queue_request_finish(queue, &request, FALSE);
 }
 
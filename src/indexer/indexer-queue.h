@@ -12,6 +12,22 @@ enum indexer_request_type {
 	INDEXER_REQUEST_TYPE_OPTIMIZE,
 };
 
+/* Requests are handled in this order. Within the same priority the requests
+   are handled in FIFO order, except that a user's remaining requests are moved
+   behind other users' requests whenever one of them finishes. */
+enum indexer_request_priority {
+	/* a client is waiting for the indexing to finish (e.g. SEARCH) */
+	INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+	/* new mails were added to the mailbox in a user session, or the
+	   indexing is capped with max_recent_msgs, so it should be cheap */
+	INDEXER_REQUEST_PRIORITY_APPEND,
+	/* optimizing or indexing potentially large mailboxes in the background
+	   (e.g. doveadm index -q) */
+	INDEXER_REQUEST_PRIORITY_BACKGROUND,
+
+	INDEXER_REQUEST_PRIORITY_COUNT
+};
+
 struct indexer_request {
 	/* Linked list of all requests - highest priority first */
 	struct indexer_request *prev, *next;
@@ -24,6 +40,7 @@ struct indexer_request {
 	unsigned int max_recent_msgs;
 
 	enum indexer_request_type type;
+	enum indexer_request_priority priority;
 
 	/* currently indexing this mailbox */
 	bool working:1;
@@ -69,12 +86,29 @@ struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue);
 /* Remove the next request from the queue. You must call
    indexer_queue_request_finish() to free its memory. */
 void indexer_queue_request_remove(struct indexer_queue *queue);
+/* Remove the given request from the queue. The request must not be currently
+   worked on. */
+void indexer_queue_request_dequeue(struct indexer_queue *queue,
+				   struct indexer_request *request);
+/* Fill requests with the given queued request followed by other queued
+   requests for the same user with the same priority, up to max_count. This
+   allows indexing them using the same user initialization. Returns the number
+   of requests. They still need to be removed from the queue. */
+unsigned int
+indexer_queue_request_get_user_batch(struct indexer_queue *queue,
+				     struct indexer_request *request,
+				     struct indexer_request **requests,
+				     unsigned int max_count);
 /* Give a status update about how far the indexing is going on. */
 void indexer_queue_request_status(struct indexer_queue *queue,
 				  struct indexer_request *request,
 				  int percentage);
-/* Move the next request to the end of the queue. */
+/* Move the next request to the end of the requests with the same priority. */
 void indexer_queue_move_head_to_tail(struct indexer_queue *queue);
+/* Move the given queued request to the end of the requests with the same
+   priority. */
+void indexer_queue_move_to_tail(struct indexer_queue *queue,
+				struct indexer_request *request);
 /* Start working on a request */
 void indexer_queue_request_work(struct indexer_request *request);
 /* Finish the request and free its memory. */
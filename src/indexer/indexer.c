@@ -10,6 +10,9 @@
 #include "indexer-queue.h"
 #include "worker-connection.h"
 
+/* Maximum number of requests for the same user sent to a worker at once */
+#define INDEXER_WORKER_MAX_BATCH_REQUESTS 20
+
 static const struct master_service_settings *set;
 static struct indexer_queue *queue;
 
@@ -41,41 +44,77 @@ static void client_connected(struct master_service_connection *conn)
 
 static bool worker_send_request(struct indexer_request *request)
 {
-	if (worker_connection_try_create("indexer-worker", request,
+	struct indexer_request *requests[INDEXER_WORKER_MAX_BATCH_REQUESTS];
+	unsigned int i, count;
+
+	/* Send the user's other queued requests to the same worker, so the
+	   user is initialized only once for all of them. */
+	count = indexer_queue_request_get_user_batch(queue, request, requests,
+						     N_ELEMENTS(requests));
+	if (worker_connection_try_create("indexer-worker", requests, count,
 					 worker_status_callback,
 					 worker_avail_callback) <= 0)
 		return FALSE;
-	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	for (i = 0; i < count; i++) {
+		indexer_queue_request_dequeue(queue, requests[i]);
+		indexer_queue_request_work(requests[i]);
+	}
 	return TRUE;
 }
 
+static bool worker_available_for(struct indexer_request *request)
+{
+	unsigned int process_limit = worker_connections_get_process_limit();
+
+	if (request->priority != INDEXER_REQUEST_PRIORITY_BACKGROUND ||
+	    process_limit == 1)
+		return TRUE;
+	/* Leave one worker free for the higher priority requests, so they
+	   don't have to wait for background indexing to finish. */
+	return worker_connections_get_count() + 1 < process_limit;
+}
+
 static void queue_try_send_more(struct indexer_queue *queue)
 {
 	struct worker_connection *worker;
-	struct indexer_request *request, *first_moved_request = NULL;
-
-	while ((request = indexer_queue_request_peek(queue)) != NULL) {
+	struct indexer_request *request, *next;
+	struct indexer_request *first_moved_requests[INDEXER_REQUEST_PRIORITY_COUNT];
+	bool moved_all[INDEXER_REQUEST_PRIORITY_COUNT];
+
+	i_zero(&first_moved_requests);
+	i_zero(&moved_all);
+	for (request = indexer_queue_request_peek(queue); request != NULL;
+	     request = next) {
+		next = request->next;
 		worker = worker_connections_find_user(request->username);
 		if (worker != NULL) {
 			/* There is already a connection handling a request
 			 * for this user. Move the request to the back of the
-			 * queue and handle requests from other users.
-			 * Terminate if we went through all requests. */
-			if (request == first_moved_request) {
-				/* all requests are waiting for existing users
-				   to finish. */
-				break;
-			}
-			if (first_moved_request == NULL)
-				first_moved_request = request;
-			indexer_queue_move_head_to_tail(queue);
+			 * requests with the same priority and handle requests
+			 * from other users. Once the first moved request is
+			 * seen again, the rest are waiting for existing users
+			 * to finish. */
+			if (request == first_moved_requests[request->priority])
+				moved_all[request->priority] = TRUE;
+			if (moved_all[request->priority])
+				continue;
+			if (first_moved_requests[request->priority] == NULL)
+				first_moved_requests[request->priority] = request;
+			indexer_queue_move_to_tail(queue, request);
 			continue;
 		}
 
+		/* The queue is sorted by priority, so none of the following
+		   requests can be sent either. */
+		if (!worker_available_for(request))
+			break;
 		/* create a new connection to a worker */
 		if (!worker_send_request(request))
 			break;
+		if (next != NULL && next->working) {
+			/* the next request was sent in the same batch */
+			next = indexer_queue_request_peek(queue);
+		}
 	}
 }
 
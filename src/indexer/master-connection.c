@@ -32,6 +32,13 @@ struct master_connection {
 	struct connection conn;
 	struct mail_storage_service_ctx *storage_service;
 
+	/* User kept initialized between requests for the same user */
+	char *username;
+	struct mail_user *user;
+	struct master_service_anvil_session anvil_session;
+	guid_128_t anvil_conn_guid;
+	bool anvil_sent;
+
 	bool version_received:1;
 };
 
@@ -251,15 +258,11 @@ index_mailbox(struct master_connection *conn, struct mail_user *user,
 }
 
 static int
-master_connection_cmd_index(struct master_connection *conn,
-			    const char *username, const char *mailbox,
-			    const char *session_id,
-			    unsigned int max_recent_msgs, const char *what)
+master_connection_user_init(struct master_connection *conn,
+			    const char *username, const char *session_id)
 {
 	struct mail_storage_service_input input;
-	struct mail_user *user;
 	const char *error;
-	int ret;
 
 	i_zero(&input);
 	input.service = "indexer-worker";
@@ -272,36 +275,64 @@ master_connection_cmd_index(struct master_connection *conn,
 		input.session_id_prefix = session_id;
 
 	if (mail_storage_service_lookup_next(conn->storage_service, &input,
-					     &user, &error) <= 0) {
+					     &conn->user, &error) <= 0) {
 		e_error(conn->conn.event, "User %s lookup failed: %s",
 			username, error);
 		return -1;
 	}
+	conn->username = i_strdup(username);
 
-	struct master_service_anvil_session anvil_session;
-	guid_128_t anvil_conn_guid;
-	bool anvil_sent = FALSE;
-	mail_user_get_anvil_session(user, &anvil_session);
-	if (master_service_anvil_connect(master_service, &anvil_session,
-					 TRUE, anvil_conn_guid))
-		anvil_sent = TRUE;
+	mail_user_get_anvil_session(conn->user, &conn->anvil_session);
+	if (master_service_anvil_connect(master_service, &conn->anvil_session,
+					 TRUE, conn->anvil_conn_guid))
+		conn->anvil_sent = TRUE;
+	return 0;
+}
+
+static void master_connection_user_deinit(struct master_connection *conn)
+{
+	if (conn->user == NULL)
+		return;
 
-	indexer_worker_refresh_proctitle(user->username, mailbox, 0, 0);
-	struct event_reason *reason =
-		event_reason_begin("indexer:index_mailbox");
-	ret = index_mailbox(conn, user, mailbox, max_recent_msgs, what);
-	event_reason_end(&reason);
 	/* refresh proctitle before a potentially long-running
 	   user unref */
-	indexer_worker_refresh_proctitle(user->username, "(deinit)", 0, 0);
+	indexer_worker_refresh_proctitle(conn->user->username, "(deinit)", 0, 0);
 
-	if (anvil_sent) {
-		master_service_anvil_disconnect(master_service, &anvil_session,
-						anvil_conn_guid);
+	if (conn->anvil_sent) {
+		master_service_anvil_disconnect(master_service,
+						&conn->anvil_session,
+						conn->anvil_conn_guid);
+		conn->anvil_sent = FALSE;
 	}
 
-	mail_user_deinit(&user);
+	mail_user_deinit(&conn->user);
+	i_free(conn->username);
 	indexer_worker_refresh_proctitle(NULL, NULL, 0, 0);
+}
+
+static int
+master_connection_cmd_index(struct master_connection *conn,
+			    const char *username, const char *mailbox,
+			    const char *session_id,
+			    unsigned int max_recent_msgs, const char *what)
+{
+	int ret;
+
+	if (conn->user != NULL && strcmp(conn->username, username) != 0)
+		master_connection_user_deinit(conn);
+	if (conn->user == NULL &&
+	    master_connection_user_init(conn, username, session_id) < 0)
+		return -1;
+
+	indexer_worker_refresh_proctitle(conn->user->username, mailbox, 0, 0);
+	struct event_reason *reason =
+		event_reason_begin("indexer:index_mailbox");
+	ret = index_mailbox(conn, conn->user, mailbox, max_recent_msgs, what);
+	event_reason_end(&reason);
+
+	/* 'k' means that more requests follow for the same user */
+	if (strchr(what, 'k') == NULL)
+		master_connection_user_deinit(conn);
 	return ret;
 }
 
@@ -314,7 +345,7 @@ master_connection_input_args(struct connection *_conn, const char *const *args)
 	unsigned int max_recent_msgs;
 	int ret;
 
-	/* <username> <mailbox> <session ID> <max_recent_msgs> [i][o] */
+	/* <username> <mailbox> <session ID> <max_recent_msgs> [i][o][k] */
 	if (str_array_length(args) != 5 ||
 	    str_to_uint(args[3], &max_recent_msgs) < 0 || args[4][0] == '\0') {
 		e_error(conn->conn.event, "Invalid input from master: %s",
@@ -331,11 +362,20 @@ master_connection_input_args(struct connection *_conn, const char *const *args)
 
 	str = ret < 0 ? "-1\n" : "100\n";
 	o_stream_nsend_str(conn->conn.output, str);
+	if (strchr(what, 'k') != NULL) {
+		/* a failure with one mailbox doesn't prevent indexing the
+		   user's other mailboxes */
+		return 1;
+	}
 	return ret;
 }
 
 static void master_connection_destroy(struct connection *connection)
 {
+	struct master_connection *conn =
+		container_of(connection, struct master_connection, conn);
+
+	master_connection_user_deinit(conn);
 	connection_deinit(connection);
 	i_free(connection);
 	master_service_client_connection_destroyed(master_service);
@@ -35,9 +35,9 @@ static void test_indexer_queue(void)
 		const char *mailbox;
 	} expected[] = {
 		{ "user2", "mailbox2" },
+		{ "user1", "mailbox1" },
 		{ "user2", "mailbox3" },
 		{ "user1", "mailbox4" },
-		{ "user1", "mailbox1" },
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
 		request = indexer_queue_request_peek(queue);
@@ -196,6 +196,175 @@ static void test_indexer_queue_cancel(void)
 	test_end();
 }
 
+static void test_indexer_queue_priority(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+
+	test_begin("indexer queue priority");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append_optimize(queue, "user1", "optimize1", NULL);
+	indexer_queue_append(queue, TRUE, "user1", "backfill1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "newmail1", "session2", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "capped1", NULL, 10, NULL);
+	indexer_queue_append(queue, FALSE, "user3", "search1", "session3", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user3", "newmail2", "session3", 0, NULL);
+	/* a search for a mailbox queued for backfill moves it up */
+	indexer_queue_append(queue, FALSE, "user4", "backfill2", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user4", "backfill3", NULL, 0, NULL);
+	indexer_queue_append(queue, FALSE, "user4", "backfill3", NULL, 0, NULL);
+	/* a new mail doesn't make a search request any less urgent */
+	indexer_queue_append(queue, TRUE, "user3", "search1", "session3", 0, NULL);
+
+	struct {
+		const char *mailbox;
+		enum indexer_request_priority priority;
+	} expected[] = {
+		{ "backfill3", INDEXER_REQUEST_PRIORITY_INTERACTIVE },
+		{ "backfill2", INDEXER_REQUEST_PRIORITY_INTERACTIVE },
+		{ "search1", INDEXER_REQUEST_PRIORITY_INTERACTIVE },
+		{ "newmail1", INDEXER_REQUEST_PRIORITY_APPEND },
+		{ "capped1", INDEXER_REQUEST_PRIORITY_APPEND },
+		{ "newmail2", INDEXER_REQUEST_PRIORITY_APPEND },
+		{ "optimize1", INDEXER_REQUEST_PRIORITY_BACKGROUND },
+		{ "backfill1", INDEXER_REQUEST_PRIORITY_BACKGROUND },
+	};
+	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
+		request = indexer_queue_request_peek(queue);
+		test_assert_strcmp_idx(request->mailbox, expected[i].mailbox, i);
+		test_assert_idx(request->priority == expected[i].priority, i);
+
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_finish(queue, &request, TRUE);
+	}
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+
+	/* moving to tail keeps the request within its priority */
+	indexer_queue_append(queue, TRUE, "user1", "newmail1", "session1", 0, NULL);
+	indexer_queue_append(queue, FALSE, "user1", "search1", "session1", 0, NULL);
+	indexer_queue_append(queue, FALSE, "user2", "search2", "session2", 0, NULL);
+	indexer_queue_move_head_to_tail(queue);
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->mailbox, "search1");
+	test_assert_strcmp(request->next->mailbox, "search2");
+	test_assert_strcmp(request->next->next->mailbox, "newmail1");
+
+	/* a higher priority request for a mailbox being worked on is
+	   requeued with the higher priority */
+	request = indexer_queue_request_peek(queue)->next->next;
+	indexer_queue_request_dequeue(queue, request);
+	indexer_queue_request_work(request);
+	indexer_queue_append(queue, FALSE, "user1", "newmail1", "session1", 0, NULL);
+	test_assert(request->reindex_head);
+	indexer_queue_request_finish(queue, &request, TRUE);
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->mailbox, "newmail1");
+	test_assert(request->priority == INDEXER_REQUEST_PRIORITY_INTERACTIVE);
+
+	indexer_queue_cancel_all(queue);
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_user_fairness(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+
+	test_begin("indexer queue user fairness");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, TRUE, "user1", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox2", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox3", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user3", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user3", "mailbox2", NULL, 0, NULL);
+
+	/* after each finished request the user's remaining requests are moved
+	   after the other users' requests */
+	struct {
+		const char *username;
+		const char *mailbox;
+	} expected[] = {
+		{ "user1", "mailbox1" },
+		{ "user2", "mailbox1" },
+		{ "user3", "mailbox1" },
+		{ "user1", "mailbox2" },
+		{ "user3", "mailbox2" },
+		{ "user1", "mailbox3" },
+	};
+	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
+		request = indexer_queue_request_peek(queue);
+		test_assert_strcmp_idx(request->username, expected[i].username, i);
+		test_assert_strcmp_idx(request->mailbox, expected[i].mailbox, i);
+
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_work(request);
+		indexer_queue_request_finish(queue, &request, TRUE);
+	}
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_user_batch(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *requests[3], *batch[3];
+	unsigned int count;
+
+	test_begin("indexer queue user batch");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, TRUE, "user1", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox2", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox3", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox4", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox5", NULL, 0, NULL);
+
+	/* mailbox3 has a higher priority, so it's alone in its batch */
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->mailbox, "mailbox3");
+	count = indexer_queue_request_get_user_batch(queue, request, requests,
+						     N_ELEMENTS(requests));
+	test_assert(count == 1);
+
+	/* only the same user's requests with the same priority are batched,
+	   oldest first */
+	request = request->next;
+	count = indexer_queue_request_get_user_batch(queue, request, requests,
+						     N_ELEMENTS(requests));
+	test_assert(count == 3);
+	test_assert_strcmp(requests[0]->mailbox, "mailbox1");
+	test_assert_strcmp(requests[1]->mailbox, "mailbox2");
+	test_assert_strcmp(requests[2]->mailbox, "mailbox4");
+	for (unsigned int i = 0; i < count; i++) {
+		test_assert_strcmp_idx(requests[i]->username, "user1", i);
+		indexer_queue_request_dequeue(queue, requests[i]);
+		indexer_queue_request_work(requests[i]);
+	}
+
+	/* requests being worked on aren't batched again */
+	request = indexer_queue_request_peek(queue)->next;
+	test_assert_strcmp(request->username, "user2");
+	request = request->next;
+	test_assert_strcmp(request->mailbox, "mailbox5");
+	count = indexer_queue_request_get_user_batch(queue, request, batch,
+						     N_ELEMENTS(batch));
+	test_assert(count == 1);
+	test_assert(batch[0] == request);
+
+	indexer_queue_cancel_all(queue);
+	for (unsigned int i = 0; i < N_ELEMENTS(requests); i++)
+		indexer_queue_request_finish(queue, &requests[i], TRUE);
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
 static void test_indexer_queue_iter(void)
 {
 	struct indexer_queue *queue;
@@ -264,6 +433,9 @@ int main(void)
 		test_indexer_queue_repeated_prepend,
 		test_indexer_queue_reindex,
 		test_indexer_queue_cancel,
+		test_indexer_queue_priority,
+		test_indexer_queue_user_fairness,
+		test_indexer_queue_user_batch,
 		test_indexer_queue_iter,
 		NULL
 	};
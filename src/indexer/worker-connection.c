@@ -30,7 +30,9 @@ struct worker_connection {
 
 	pid_t pid;
 	char *request_username;
-	struct indexer_request *request;
+	/* Requests sent to the worker. The first one is currently being
+	   indexed. */
+	ARRAY(struct indexer_request *) requests;
 };
 
 static unsigned int worker_last_process_limit = 0;
@@ -39,10 +41,15 @@ static struct connection_list *worker_connections;
 static void worker_connection_call_callback(struct worker_connection *worker,
 					    int percentage)
 {
-	if (worker->request != NULL)
-		worker->callback(percentage, worker->request);
+	struct indexer_request *request;
+
+	if (array_count(&worker->requests) == 0)
+		return;
+
+	request = array_idx_elem(&worker->requests, 0);
 	if (percentage < 0 || percentage == 100)
-		worker->request = NULL;
+		array_pop_front(&worker->requests);
+	worker->callback(percentage, request);
 }
 
 static void worker_connection_destroy(struct connection *conn)
@@ -50,7 +57,9 @@ static void worker_connection_destroy(struct connection *conn)
 	struct worker_connection *worker =
 		container_of(conn, struct worker_connection, conn);
 
-	worker_connection_call_callback(worker, -1);
+	while (array_count(&worker->requests) > 0)
+		worker_connection_call_callback(worker, -1);
+	array_free(&worker->requests);
 	i_free_and_null(worker->request_username);
 	connection_deinit(conn);
 
@@ -105,12 +114,9 @@ worker_connection_input_args(struct connection *conn, const char *const *args)
 		return -1;
 	}
 
-	if (percentage < 0)
-		ret = -1;
-
 	worker_connection_call_callback(worker, percentage);
-	if (worker->request == NULL) {
-		/* disconnect after each request */
+	if (array_count(&worker->requests) == 0) {
+		/* disconnect after the last request */
 		ret = -1;
 	}
 
@@ -119,11 +125,8 @@ worker_connection_input_args(struct connection *conn, const char *const *args)
 
 static void
 worker_connection_send_request(struct worker_connection *worker,
-			       struct indexer_request *request)
+			       struct indexer_request *request, bool last)
 {
-	worker->request_username = i_strdup(request->username);
-	worker->request = request;
-
 	T_BEGIN {
 		string_t *str = t_str_new(128);
 
@@ -142,6 +145,11 @@ worker_connection_send_request(struct worker_connection *worker,
 			str_append_c(str, 'o');
 			break;
 		}
+		if (!last) {
+			/* more requests follow for the same user - keep the
+			   user initialized */
+			str_append_c(str, 'k');
+		}
 		str_append_c(str, '\n');
 		o_stream_nsend(worker->conn.output, str_data(str), str_len(str));
 	} T_END;
@@ -176,27 +184,38 @@ void worker_connections_deinit(void)
 }
 
 int worker_connection_try_create(const char *socket_path,
-				 struct indexer_request *request,
+				 struct indexer_request *const *requests,
+				 unsigned int requests_count,
 				 indexer_status_callback_t *callback,
 				 worker_available_callback_t *avail_callback)
 {
 	struct worker_connection *conn;
-	unsigned int max_connections;
+	unsigned int i, max_connections;
+
+	i_assert(requests_count > 0);
 
-	max_connections = I_MAX(1, worker_last_process_limit);
+	max_connections = worker_connections_get_process_limit();
 	if (worker_connections->connections_count >= max_connections)
 		return 0;
 
 	conn = i_new(struct worker_connection, 1);
 	conn->callback = callback;
 	conn->avail_callback = avail_callback;
+	i_array_init(&conn->requests, requests_count);
 	connection_init_client_unix(worker_connections, &conn->conn,
 				    socket_path);
 	if (connection_client_connect(&conn->conn) < 0) {
 		worker_connection_destroy(&conn->conn);
 		return -1;
 	}
-	worker_connection_send_request(conn, request);
+	conn->request_username = i_strdup(requests[0]->username);
+	for (i = 0; i < requests_count; i++) {
+		i_assert(strcmp(requests[i]->username,
+				conn->request_username) == 0);
+		array_push_back(&conn->requests, &requests[i]);
+		worker_connection_send_request(conn, requests[i],
+					       i + 1 == requests_count);
+	}
 	return 1;
 }
 
@@ -205,6 +224,11 @@ unsigned int worker_connections_get_count(void)
 	return worker_connections->connections_count;
 }
 
+unsigned int worker_connections_get_process_limit(void)
+{
+	return I_MAX(1, worker_last_process_limit);
+}
+
 struct worker_connection *worker_connections_find_user(const char *username)
 {
 	struct connection *conn;
@@ -8,16 +8,21 @@ struct worker_connection;
 
 typedef void worker_available_callback_t(void);
 
-/* Try to create a new worker connection and send a new indexing request for
-   the given username+mailbox. The status callback is called as necessary.
-   Returns 1 if successful, 0 if indexer-worker service's process_limit was
-   already reached, -1 on connect error. */
+/* Try to create a new worker connection and send new indexing requests for
+   the given username+mailboxes. All the requests must be for the same user,
+   which allows the worker to initialize the user only once. They are indexed
+   in the given order. The status callback is called as necessary for each
+   request. Returns 1 if successful, 0 if indexer-worker service's
+   process_limit was already reached, -1 on connect error. */
 int worker_connection_try_create(const char *socket_path,
-				 struct indexer_request *request,
+				 struct indexer_request *const *requests,
+				 unsigned int requests_count,
 				 indexer_status_callback_t *callback,
 				 worker_available_callback_t *avail_callback);
 
 unsigned int worker_connections_get_count(void);
+/* Returns the maximum number of worker connections. */
+unsigned int worker_connections_get_process_limit(void);
 struct worker_connection *worker_connections_find_user(const char *username);
 
 void worker_connections_init(void);
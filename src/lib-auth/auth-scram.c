@@ -31,7 +31,7 @@ void auth_scram_hi(const struct hash_method *hmethod,
 		   const unsigned char *salt, size_t salt_size, unsigned int i,
 		   unsigned char *result)
 {
-	struct hmac_context ctx;
+	struct hmac_context key_ctx, ctx;
 	unsigned char U[hmethod->digest_size];
 	unsigned int j, k;
 
@@ -50,8 +50,13 @@ void auth_scram_hi(const struct hash_method *hmethod,
 	    significant octet first.
 	*/
 
+	/* The HMAC key stays the same for all the iterations, so set up the
+	   keyed context only once and copy it for each round. This avoids
+	   hashing the ipad/opad blocks again on every iteration. */
+	hmac_init(&key_ctx, str, str_size, hmethod);
+
 	/* Calculate U1 */
-	hmac_init(&ctx, str, str_size, hmethod);
+	ctx = key_ctx;
 	hmac_update(&ctx, salt, salt_size);
 	hmac_update(&ctx, "\0\0\0\1", 4);
 	hmac_final(&ctx, U);
@@ -60,12 +65,15 @@ void auth_scram_hi(const struct hash_method *hmethod,
 
 	/* Calculate U2 to Ui and Hi */
 	for (j = 2; j <= i; j++) {
-		hmac_init(&ctx, str, str_size, hmethod);
+		ctx = key_ctx;
 		hmac_update(&ctx, U, sizeof(U));
 		hmac_final(&ctx, U);
 		for (k = 0; k < hmethod->digest_size; k++)
 			result[k] ^= U[k];
 	}
+	safe_memset(&key_ctx, 0, sizeof(key_ctx));
+	safe_memset(&ctx, 0, sizeof(ctx));
+	safe_memset(U, 0, sizeof(U));
 }
 
 void auth_scram_generate_key_data(const struct hash_method *hmethod,
@@ -266,6 +266,15 @@ const char *password_generate_salt(size_t len)
 	return salt;
 }
 
+bool password_scheme_is_expensive(const char *scheme)
+{
+	const struct password_scheme *s;
+	enum password_encoding encoding;
+
+	s = password_scheme_lookup(scheme, &encoding);
+	return s != NULL && s->expensive;
+}
+
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2)
 {
 	const struct password_scheme *s1 = NULL, *s2 = NULL;
@@ -932,6 +941,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "PBKDF2",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.expensive = TRUE,
 		.password_verify = pbkdf2_verify,
 		.password_generate = pbkdf2_generate,
 	},
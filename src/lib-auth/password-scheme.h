@@ -25,6 +25,8 @@ struct password_scheme {
 	unsigned int raw_password_len;
 	/* If set, then this scheme is weak */
 	bool weak;
+	/* If set, verifying the password is intentionally CPU intensive */
+	bool expensive;
 
 	int (*password_verify)(const char *plaintext,
 			       const struct password_generate_params *params,
@@ -72,6 +74,10 @@ bool password_generate_encoded(const char *plaintext,
 			       const struct password_generate_params *params,
 			       const char *scheme, const char **password_r);
 
+/* Returns TRUE if verifying passwords with the scheme is CPU intensive.
+   Unknown schemes return FALSE. */
+bool password_scheme_is_expensive(const char *scheme);
+
 /* Returns TRUE if schemes are equivalent. */
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2);
 
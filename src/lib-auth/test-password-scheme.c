@@ -126,12 +126,28 @@ static void test_password_schemes(void)
 #endif
 }
 
+static void test_password_scheme_is_expensive(void)
+{
+	test_begin("password_scheme_is_expensive()");
+	test_assert(password_scheme_is_expensive("BLF-CRYPT"));
+	test_assert(password_scheme_is_expensive("SHA512-CRYPT"));
+	test_assert(password_scheme_is_expensive("PBKDF2"));
+#ifdef HAVE_LIBSODIUM
+	test_assert(password_scheme_is_expensive("ARGON2I"));
+#endif
+	test_assert(!password_scheme_is_expensive("PLAIN"));
+	test_assert(!password_scheme_is_expensive("SHA256.hex"));
+	test_assert(!password_scheme_is_expensive("SSHA512"));
+	test_assert(!password_scheme_is_expensive("NONEXISTENT"));
+	test_end();
+}
 
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_password_schemes,
 		test_password_failures,
+		test_password_scheme_is_expensive,
 		NULL
 	};
 	password_schemes_init();
@@ -1,17 +1,27 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
-#include "istream.h"
-#include "ostream.h"
+#include "istream-private.h"
+#include "istream-crlf.h"
+#include "istream-base64.h"
+#include "istream-qp.h"
+#include "ostream-private.h"
 #include "randgen.h"
 #include "time-util.h"
 #include "strnum.h"
+#include "dcrypt.h"
+#include "dcrypt-iostream.h"
+#include "istream-decrypt.h"
+#include "ostream-encrypt.h"
 #include "compression.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 /**
  * Generates semi-compressible data in blocks of given size, to mimic emails
@@ -92,18 +102,502 @@ static void bench_compression_speed(const struct compression_handler *handler,
 
 }
 
+/**
+ * Pipeline benchmark: Reads real mails from the given files and directories
+ * and runs them through the iostream stacks used when saving and reading
+ * mails - CRLF conversion, compression, mail-crypt encryption and
+ * base64/QP coding. Each mail is processed with its own stream stack.
+ * For each layer and for the full stacks it reports the throughput, and
+ * how many read() calls were done to the bottom istream and write() calls
+ * to the bottom ostream. Many small reads/writes point to buffer sizes that
+ * are too small, or to layers that don't pass their input through in large
+ * enough blocks.
+ */
+
+struct bench_corpus {
+	buffer_t *data;
+	/* size of each mail in data */
+	ARRAY(size_t) sizes;
+};
+
+struct bench_stats {
+	uint64_t reads;
+	uint64_t writes;
+};
+
+struct bench_istream {
+	struct istream_private istream;
+	size_t size;
+	struct bench_stats *stats;
+};
+
+struct bench_ostream {
+	struct ostream_private ostream;
+	buffer_t *output;
+	struct bench_stats *stats;
+};
+
+enum bench_layer {
+	BENCH_LAYER_CRLF,
+	BENCH_LAYER_LF,
+	BENCH_LAYER_BASE64_ENCODE,
+	BENCH_LAYER_BASE64_DECODE,
+	BENCH_LAYER_QP_ENCODE,
+	BENCH_LAYER_QP_DECODE,
+	BENCH_LAYER_COMPRESS,
+	BENCH_LAYER_DECOMPRESS,
+	BENCH_LAYER_ENCRYPT,
+	BENCH_LAYER_DECRYPT,
+};
+
+static const struct compression_handler *bench_handler;
+static int bench_level;
+static struct dcrypt_keypair bench_keypair;
+static bool bench_have_dcrypt;
+
+static ssize_t bench_istream_read(struct istream_private *stream)
+{
+	struct bench_istream *bstream =
+		container_of(stream, struct bench_istream, istream);
+	size_t pos;
+	ssize_t ret;
+
+	/* behave like a file read with IO_BLOCK_SIZE buffer */
+	bstream->stats->reads++;
+	if (stream->pos == bstream->size) {
+		stream->istream.eof = TRUE;
+		return -1;
+	}
+	pos = I_MIN(stream->pos + IO_BLOCK_SIZE, bstream->size);
+	ret = pos - stream->pos;
+	stream->pos = pos;
+	return ret;
+}
+
+static void bench_istream_seek(struct istream_private *stream, uoff_t v_offset,
+			       bool mark ATTR_UNUSED)
+{
+	stream->skip = stream->pos = v_offset;
+	stream->istream.v_offset = v_offset;
+}
+
+static struct istream *
+bench_istream_create(const void *data, size_t size, struct bench_stats *stats)
+{
+	struct bench_istream *bstream;
+
+	bstream = i_new(struct bench_istream, 1);
+	bstream->size = size;
+	bstream->stats = stats;
+	bstream->istream.buffer = data;
+	bstream->istream.max_buffer_size = SIZE_MAX;
+	bstream->istream.read = bench_istream_read;
+	bstream->istream.seek = bench_istream_seek;
+	bstream->istream.istream.blocking = TRUE;
+	bstream->istream.istream.seekable = TRUE;
+	bstream->istream.statbuf.st_size = size;
+	return i_stream_create(&bstream->istream, NULL, -1, 0);
+}
+
+static ssize_t
+bench_ostream_sendv(struct ostream_private *stream,
+		    const struct const_iovec *iov, unsigned int iov_count)
+{
+	struct bench_ostream *bstream =
+		container_of(stream, struct bench_ostream, ostream);
+	unsigned int i;
+	size_t ret = 0;
+
+	/* behave like a file writev() */
+	bstream->stats->writes++;
+	for (i = 0; i < iov_count; i++) {
+		buffer_append(bstream->output, iov[i].iov_base,
+			      iov[i].iov_len);
+		ret += iov[i].iov_len;
+	}
+	stream->ostream.offset += ret;
+	return ret;
+}
+
+static struct ostream *
+bench_ostream_create(buffer_t *output, struct bench_stats *stats)
+{
+	struct bench_ostream *bstream;
+
+	bstream = i_new(struct bench_ostream, 1);
+	bstream->output = output;
+	bstream->stats = stats;
+	bstream->ostream.ostream.blocking = TRUE;
+	bstream->ostream.sendv = bench_ostream_sendv;
+	return o_stream_create(&bstream->ostream, NULL, -1);
+}
+
+static void bench_corpus_init(struct bench_corpus *corpus)
+{
+	corpus->data = buffer_create_dynamic(default_pool, 1024*1024);
+	i_array_init(&corpus->sizes, 1024);
+}
+
+static void bench_corpus_deinit(struct bench_corpus *corpus)
+{
+	buffer_free(&corpus->data);
+	array_free(&corpus->sizes);
+}
+
+static void bench_corpus_add_file(struct bench_corpus *corpus,
+				  const char *path)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size, old_used = corpus->data->used;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		buffer_append(corpus->data, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0)
+		i_fatal("read(%s) failed: %s", path, i_stream_get_error(input));
+	i_stream_unref(&input);
+
+	size = corpus->data->used - old_used;
+	if (size > 0)
+		array_push_back(&corpus->sizes, &size);
+}
+
+static void bench_corpus_add_path(struct bench_corpus *corpus,
+				  const char *path)
+{
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st) < 0)
+		i_fatal("stat(%s) failed: %m", path);
+	if (!S_ISDIR(st.st_mode)) {
+		bench_corpus_add_file(corpus, path);
+		return;
+	}
+
+	if ((dir = opendir(path)) == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	while ((d = readdir(dir)) != NULL) T_BEGIN {
+		/* skip also Dovecot's index and other metadata files in
+		   mail directories */
+		if (d->d_name[0] != '.' &&
+		    !str_begins_with(d->d_name, "dovecot")) {
+			bench_corpus_add_path(corpus,
+				t_strconcat(path, "/", d->d_name, NULL));
+		}
+	} T_END;
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", path);
+}
+
+static struct istream *
+bench_istream_layer(enum bench_layer layer, struct istream *input)
+{
+	switch (layer) {
+	case BENCH_LAYER_CRLF:
+		return i_stream_create_crlf(input);
+	case BENCH_LAYER_LF:
+		return i_stream_create_lf(input);
+	case BENCH_LAYER_BASE64_ENCODE:
+		return i_stream_create_base64_encoder(input, 76, TRUE);
+	case BENCH_LAYER_BASE64_DECODE:
+		return i_stream_create_base64_decoder(input);
+	case BENCH_LAYER_QP_ENCODE:
+		return i_stream_create_qp_encoder(input, 0);
+	case BENCH_LAYER_QP_DECODE:
+		return i_stream_create_qp_decoder(input);
+	case BENCH_LAYER_DECOMPRESS:
+		return bench_handler->create_istream(input);
+	case BENCH_LAYER_DECRYPT:
+		return i_stream_create_decrypt(input, bench_keypair.priv);
+	case BENCH_LAYER_COMPRESS:
+	case BENCH_LAYER_ENCRYPT:
+		break;
+	}
+	i_unreached();
+}
+
+static struct ostream *
+bench_ostream_layer(enum bench_layer layer, struct ostream *output)
+{
+	switch (layer) {
+	case BENCH_LAYER_COMPRESS:
+		return bench_handler->create_ostream(output, bench_level);
+	case BENCH_LAYER_ENCRYPT:
+		return o_stream_create_encrypt(output, "aes-256-gcm-sha256",
+					       bench_keypair.pub,
+					       IO_STREAM_ENC_INTEGRITY_AEAD);
+	default:
+		break;
+	}
+	i_unreached();
+}
+
+static bool bench_layer_is_ostream(enum bench_layer layer)
+{
+	return layer == BENCH_LAYER_COMPRESS || layer == BENCH_LAYER_ENCRYPT;
+}
+
+/* Run each mail in the input corpus through the layers. istream layers are
+   stacked on top of the input, and ostream layers are stacked so that the
+   first one is the topmost. */
+static void
+bench_pipeline_run(const char *name, const struct bench_corpus *input_corpus,
+		   const enum bench_layer *layers, unsigned int layers_count,
+		   struct bench_corpus *output_corpus)
+{
+	struct bench_stats stats;
+	struct istream *input, *layer_input;
+	struct ostream *output, *layer_output;
+	const size_t *sizep;
+	size_t offset = 0, used;
+	uint64_t ts_0, ts_1;
+	unsigned int i, mail_count = array_count(&input_corpus->sizes);
+	double secs;
+
+	i_zero(&stats);
+	ts_0 = i_nanoseconds();
+	array_foreach(&input_corpus->sizes, sizep) {
+		used = output_corpus->data->used;
+		input = bench_istream_create(
+			CONST_PTR_OFFSET(input_corpus->data->data, offset),
+			*sizep, &stats);
+		output = bench_ostream_create(output_corpus->data, &stats);
+		offset += *sizep;
+
+		for (i = layers_count; i > 0; i--) {
+			if (!bench_layer_is_ostream(layers[i-1]))
+				continue;
+			layer_output = bench_ostream_layer(layers[i-1], output);
+			o_stream_unref(&output);
+			output = layer_output;
+		}
+		for (i = 0; i < layers_count; i++) {
+			if (bench_layer_is_ostream(layers[i]))
+				continue;
+			layer_input = bench_istream_layer(layers[i], input);
+			i_stream_unref(&input);
+			input = layer_input;
+		}
+
+		if (o_stream_send_istream(output, input) !=
+		    OSTREAM_SEND_ISTREAM_RESULT_FINISHED) {
+			i_fatal("%s: %s", name, input->stream_errno != 0 ?
+				i_stream_get_error(input) :
+				o_stream_get_error(output));
+		}
+		if (o_stream_finish(output) < 0)
+			i_fatal("%s: %s", name, o_stream_get_error(output));
+		o_stream_unref(&output);
+		i_stream_unref(&input);
+
+		used = output_corpus->data->used - used;
+		array_push_back(&output_corpus->sizes, &used);
+	}
+	ts_1 = i_nanoseconds();
+
+	secs = (double)(ts_1 - ts_0) / 1000000000.0;
+	if (secs == 0)
+		secs = 0.000000001;
+	printf("%-30s %9.2lf %9.2lf %9.2lf %9.1lf %9.1lf\n", name,
+	       (double)input_corpus->data->used / (1024*1024),
+	       (double)output_corpus->data->used / (1024*1024),
+	       (double)input_corpus->data->used / (1024*1024) / secs,
+	       (double)stats.reads / mail_count,
+	       (double)stats.writes / mail_count);
+}
+
+static void
+bench_pipeline_layer(const char *name, const struct bench_corpus *input_corpus,
+		     enum bench_layer layer, struct bench_corpus *output_corpus)
+{
+	bench_pipeline_run(name, input_corpus, &layer, 1, output_corpus);
+}
+
+static void bench_dcrypt_init(void)
+{
+	struct dcrypt_settings set = {
+		/* the benchmark isn't installed, so try the build directory
+		   first */
+		.module_dir = "../lib-dcrypt/.libs",
+	};
+	const char *error;
+
+	if (!dcrypt_initialize("openssl", &set, &error) &&
+	    !dcrypt_initialize("openssl", NULL, &error)) {
+		printf("Skipping encryption: %s\n", error);
+		return;
+	}
+	if (!dcrypt_keypair_generate(&bench_keypair, DCRYPT_KEY_EC, 0,
+				     "prime256v1", &error)) {
+		printf("Skipping encryption: %s\n", error);
+		dcrypt_deinitialize();
+		return;
+	}
+	bench_have_dcrypt = TRUE;
+}
+
+static void bench_pipeline(const char *const *paths)
+{
+	struct bench_corpus mails, crlf, lf, encoded, decoded;
+	struct bench_corpus compressed, encrypted, out;
+	const enum bench_layer write_stack[] = {
+		BENCH_LAYER_LF, BENCH_LAYER_COMPRESS, BENCH_LAYER_ENCRYPT
+	};
+	const enum bench_layer read_stack[] = {
+		BENCH_LAYER_DECRYPT, BENCH_LAYER_DECOMPRESS, BENCH_LAYER_CRLF
+	};
+	unsigned int stack_skip = bench_have_dcrypt ? 0 : 1;
+
+	bench_corpus_init(&mails);
+	for (; *paths != NULL; paths++)
+		bench_corpus_add_path(&mails, *paths);
+	if (array_is_empty(&mails.sizes))
+		i_fatal("No mails found");
+	printf("Read %u mails, %zu bytes\n", array_count(&mails.sizes),
+	       mails.data->used);
+	printf("Compression: %s level %d\n\n", bench_handler->name,
+	       bench_level);
+
+	printf("%-30s %9s %9s %9s %9s %9s\n", "layer", "in MB", "out MB",
+	       "MB/s", "reads", "writes");
+
+	bench_corpus_init(&crlf);
+	bench_corpus_init(&lf);
+	bench_pipeline_layer("crlf", &mails, BENCH_LAYER_CRLF, &crlf);
+	bench_pipeline_layer("lf", &crlf, BENCH_LAYER_LF, &lf);
+
+	bench_corpus_init(&encoded);
+	bench_corpus_init(&decoded);
+	bench_pipeline_layer("base64 encode", &lf, BENCH_LAYER_BASE64_ENCODE,
+			     &encoded);
+	bench_pipeline_layer("base64 decode", &encoded,
+			     BENCH_LAYER_BASE64_DECODE, &decoded);
+	bench_corpus_deinit(&encoded);
+	bench_corpus_deinit(&decoded);
+
+	bench_corpus_init(&encoded);
+	bench_corpus_init(&decoded);
+	bench_pipeline_layer("qp encode", &lf, BENCH_LAYER_QP_ENCODE,
+			     &encoded);
+	bench_pipeline_layer("qp decode", &encoded, BENCH_LAYER_QP_DECODE,
+			     &decoded);
+	bench_corpus_deinit(&encoded);
+	bench_corpus_deinit(&decoded);
+
+	bench_corpus_init(&compressed);
+	bench_corpus_init(&out);
+	bench_pipeline_layer("compress", &lf, BENCH_LAYER_COMPRESS,
+			     &compressed);
+	bench_pipeline_layer("decompress", &compressed,
+			     BENCH_LAYER_DECOMPRESS, &out);
+	bench_corpus_deinit(&out);
+
+	bench_corpus_init(&encrypted);
+	if (bench_have_dcrypt) {
+		bench_corpus_init(&out);
+		bench_pipeline_layer("encrypt", &compressed,
+				     BENCH_LAYER_ENCRYPT, &encrypted);
+		bench_pipeline_layer("decrypt", &encrypted,
+				     BENCH_LAYER_DECRYPT, &out);
+		bench_corpus_deinit(&out);
+		bench_corpus_deinit(&encrypted);
+		bench_corpus_init(&encrypted);
+	}
+
+	/* full stacks: saving CRLF input from client and reading it back */
+	printf("\n");
+	bench_pipeline_run(bench_have_dcrypt ? "save: lf+compress+encrypt" :
+			   "save: lf+compress", &crlf, write_stack,
+			   N_ELEMENTS(write_stack) - stack_skip, &encrypted);
+	bench_corpus_init(&out);
+	bench_pipeline_run(bench_have_dcrypt ? "read: decrypt+decompress+crlf" :
+			   "read: decompress+crlf", &encrypted,
+			   read_stack + stack_skip,
+			   N_ELEMENTS(read_stack) - stack_skip, &out);
+	if (out.data->used != crlf.data->used ||
+	    memcmp(out.data->data, crlf.data->data, out.data->used) != 0)
+		i_error("Read stack output doesn't match the saved input");
+
+	bench_corpus_deinit(&out);
+	bench_corpus_deinit(&encrypted);
+	bench_corpus_deinit(&compressed);
+	bench_corpus_deinit(&lf);
+	bench_corpus_deinit(&crlf);
+	bench_corpus_deinit(&mails);
+}
+
 static void print_usage(const char *prog)
 {
 	fprintf(stderr, "Usage: %s block_size count level\n", prog);
 	fprintf(stderr, "Runs with 1000 8k blocks using level 6 if nothing given\n");
+	fprintf(stderr, "   or: %s -p [-c handler] [-l level] <mail file or dir> [...]\n", prog);
+	fprintf(stderr, "Runs the mails through the save and read iostream pipelines\n");
 	lib_exit(1);
 }
 
+static int bench_pipeline_main(int argc, char *argv[])
+{
+	const char *handler_name = NULL;
+	bool level_set = FALSE;
+	int c;
+
+	while ((c = getopt(argc, argv, "pc:l:")) > 0) {
+		switch (c) {
+		case 'p':
+			break;
+		case 'c':
+			handler_name = optarg;
+			break;
+		case 'l':
+			if (str_to_int(optarg, &bench_level) < 0)
+				print_usage(argv[0]);
+			level_set = TRUE;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		print_usage(argv[0]);
+	if (handler_name == NULL) {
+		/* zstd by default, gz for builds without zstd */
+		handler_name = compression_lookup_handler("zstd",
+					&bench_handler) > 0 ? "zstd" : "gz";
+	}
+	if (compression_lookup_handler(handler_name, &bench_handler) <= 0)
+		i_fatal("Compression handler %s not supported", handler_name);
+	if (!level_set)
+		bench_level = bench_handler->get_default_level();
+	else if (bench_level < bench_handler->get_min_level() ||
+		 bench_level > bench_handler->get_max_level()) {
+		i_fatal("Level must be between %d..%d",
+			bench_handler->get_min_level(),
+			bench_handler->get_max_level());
+	}
+
+	bench_dcrypt_init();
+	bench_pipeline((const char *const *)argv + optind);
+	if (bench_have_dcrypt) {
+		dcrypt_keypair_unref(&bench_keypair);
+		dcrypt_deinitialize();
+	}
+	lib_deinit();
+	return 0;
+}
+
 int main(int argc, const char *argv[])
 {
 	unsigned int level = 6;
 	lib_init();
 
+	if (argc >= 2 && strcmp(argv[1], "-p") == 0)
+		return bench_pipeline_main(argc, (char **)argv);
+
 	unsigned long block_size = 8192UL;
 	unsigned long block_count = 1000UL;
 
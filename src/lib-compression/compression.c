@@ -24,6 +24,7 @@
 #ifndef HAVE_ZSTD
 #  define i_stream_create_zstd NULL
 #  define o_stream_create_zstd NULL
+#  define o_stream_create_zstd_workers NULL
 #  define compression_get_min_level_zstd NULL
 #  define compression_get_default_level_zstd NULL
 #  define compression_get_max_level_zstd NULL
@@ -190,6 +191,7 @@ const struct compression_handler compression_handlers[] = {
 		.is_compressed = is_compressed_zstd,
 		.create_istream = i_stream_create_zstd,
 		.create_ostream = o_stream_create_zstd,
+		.create_ostream_workers = o_stream_create_zstd_workers,
 		.get_min_level = compression_get_min_level_zstd,
 		.get_default_level = compression_get_default_level_zstd,
 		.get_max_level = compression_get_max_level_zstd,
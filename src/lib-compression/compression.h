@@ -13,6 +13,12 @@ struct compression_handler {
 	bool (*is_compressed)(struct istream *input);
 	struct istream *(*create_istream)(struct istream *input);
 	struct ostream *(*create_ostream)(struct ostream *output, int level);
+	/* Like create_ostream(), but compress using the given number of
+	   worker threads. NULL if the format doesn't support it. If the
+	   library doesn't support threads, this works like create_ostream(). */
+	struct ostream *(*create_ostream_workers)(struct ostream *output,
+						  int level,
+						  unsigned int workers);
 	/* returns minimum level */
 	int (*get_min_level)(void);
 	/* the default can be -1 (e.g. gz), so the return value of this has to
@@ -1,6 +1,21 @@
 #ifndef IOSTREAM_ZSTD_PRIVATE_H
 #define IOSTREAM_ZSTD_PRIVATE_H 1
 
+/* ZSTD_CCtx_refCDict() and ZSTD_DCtx_refDDict() */
+#if ZSTD_VERSION_NUMBER >= 10400
+#  define HAVE_ZSTD_DICTIONARIES
+#endif
+
+#ifdef HAVE_ZSTD_DICTIONARIES
+struct zstd_dictionary;
+
+/* Returns TRUE if any dictionaries have been loaded */
+bool zstd_dictionaries_loaded(void);
+const ZSTD_CDict *
+zstd_dictionary_get_cdict(struct zstd_dictionary *dict, int level);
+const ZSTD_DDict *zstd_dictionary_get_ddict(struct zstd_dictionary *dict);
+#endif
+
 /* a horrible hack to fix issues when the installed libzstd is lot
    newer than what we were compiled against. */
 static inline ZSTD_ErrorCode zstd_version_errcode(ZSTD_ErrorCode err)
@@ -1,6 +1,7 @@
 /* Copyright (c) 2010-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "crc32.h"
 #include "istream-private.h"
 #include "istream-zlib.h"
@@ -8,6 +9,16 @@
 
 #define CHUNK_SIZE (1024*64)
 
+/* inflateGetDictionary() is needed for the access points */
+#if ZLIB_VERNUM >= 0x1271
+#  define HAVE_ZLIB_ACCESS_POINTS
+#endif
+/* Initial number of uncompressed bytes between access points. This is
+   doubled whenever the maximum number of access points is reached. */
+#define ZLIB_ACCESS_POINT_INITIAL_SPAN (1024*1024)
+#define ZLIB_ACCESS_POINTS_MAX 16
+#define ZLIB_WINDOW_SIZE 32768
+
 #define GZ_HEADER_MIN_SIZE 10
 #define GZ_TRAILER_SIZE 8
 
@@ -18,6 +29,19 @@
 #define GZ_FLAG_FNAME	0x08
 #define GZ_FLAG_FCOMMENT 0x10
 
+/* Decompression state at a deflate block boundary. Seeking can restart
+   decompression from here instead of from the beginning. */
+struct zlib_access_point {
+	uoff_t v_offset;
+	uoff_t parent_offset;
+	uint32_t crc32;
+	/* number of bits from the previous input byte still to be used */
+	unsigned int bits;
+	unsigned char prev_byte;
+	unsigned int window_size;
+	unsigned char window[ZLIB_WINDOW_SIZE];
+};
+
 struct zlib_istream {
 	struct istream_private istream;
 
@@ -27,6 +51,10 @@ struct zlib_istream {
 	uint32_t crc32;
 	struct stat last_parent_statbuf;
 
+	/* sorted by v_offset */
+	ARRAY(struct zlib_access_point *) access_points;
+	uoff_t access_point_span;
+
 	bool gz:1;
 	bool marked:1;
 	bool header_read:1;
@@ -37,6 +65,17 @@ struct zlib_istream {
 
 static void i_stream_zlib_init(struct zlib_istream *zstream);
 
+static void i_stream_zlib_access_points_free(struct zlib_istream *zstream)
+{
+	struct zlib_access_point *point;
+
+	if (!array_is_created(&zstream->access_points))
+		return;
+	array_foreach_elem(&zstream->access_points, point)
+		i_free(point);
+	array_free(&zstream->access_points);
+}
+
 static void i_stream_zlib_close(struct iostream_private *stream,
 				bool close_parent)
 {
@@ -46,10 +85,94 @@ static void i_stream_zlib_close(struct iostream_private *stream,
 		(void)inflateEnd(&zstream->zs);
 		zstream->zs_closed = TRUE;
 	}
+	i_stream_zlib_access_points_free(zstream);
 	if (close_parent)
 		i_stream_close(zstream->istream.parent);
 }
 
+static bool i_stream_zlib_want_access_point(struct zlib_istream *zstream)
+{
+#ifdef HAVE_ZLIB_ACCESS_POINTS
+	struct istream_private *stream = &zstream->istream;
+	struct zlib_access_point *last_point;
+	uoff_t last_offset = 0;
+
+	if (!stream->istream.seekable)
+		return FALSE;
+	if (array_is_created(&zstream->access_points) &&
+	    array_not_empty(&zstream->access_points)) {
+		last_point = array_idx_elem(&zstream->access_points,
+			array_count(&zstream->access_points) - 1);
+		last_offset = last_point->v_offset;
+	}
+	return stream->istream.v_offset + (stream->pos - stream->skip) >=
+		last_offset + zstream->access_point_span;
+#else
+	(void)zstream;
+	return FALSE;
+#endif
+}
+
+static void
+i_stream_zlib_add_access_point(struct zlib_istream *zstream,
+			       const unsigned char *input, size_t consumed)
+{
+#ifdef HAVE_ZLIB_ACCESS_POINTS
+	struct istream_private *stream = &zstream->istream;
+	struct zlib_access_point *point, **points;
+	unsigned int i, count, bits = zstream->zs.data_type & 7;
+	uInt window_size = ZLIB_WINDOW_SIZE;
+
+	if ((zstream->zs.data_type & 128) == 0 ||
+	    (zstream->zs.data_type & 64) != 0) {
+		/* not at a block boundary, or it's the last block */
+		return;
+	}
+	if (bits > 0 && consumed == 0) {
+		/* the partial byte was consumed earlier - try again at the
+		   next block boundary */
+		return;
+	}
+
+	if (!array_is_created(&zstream->access_points))
+		i_array_init(&zstream->access_points, ZLIB_ACCESS_POINTS_MAX);
+	else if (array_count(&zstream->access_points) ==
+		 ZLIB_ACCESS_POINTS_MAX) {
+		/* drop every other access point */
+		points = array_get_modifiable(&zstream->access_points, &count);
+		for (i = 0; i < count; i++) {
+			if (i % 2 == 0)
+				points[i / 2] = points[i];
+			else
+				i_free(points[i]);
+		}
+		array_delete(&zstream->access_points, (count + 1) / 2,
+			     count - (count + 1) / 2);
+		zstream->access_point_span *= 2;
+	}
+
+	point = i_new(struct zlib_access_point, 1);
+	point->v_offset = stream->istream.v_offset +
+		(stream->pos - stream->skip);
+	point->parent_offset = stream->parent->v_offset;
+	point->crc32 = zstream->crc32;
+	point->bits = bits;
+	if (bits > 0)
+		point->prev_byte = input[consumed - 1];
+	if (inflateGetDictionary(&zstream->zs, point->window,
+				 &window_size) != Z_OK) {
+		i_free(point);
+		return;
+	}
+	point->window_size = window_size;
+	array_push_back(&zstream->access_points, &point);
+#else
+	(void)zstream;
+	(void)input;
+	(void)consumed;
+#endif
+}
+
 static void zlib_read_error(struct zlib_istream *zstream, const char *error)
 {
 	io_stream_set_error(&zstream->istream.iostream,
@@ -261,7 +384,10 @@ static ssize_t i_stream_zlib_read(struct istream_private *stream)
 
 	zstream->zs.next_out = stream->w_buffer + stream->pos;
 	zstream->zs.avail_out = out_size;
-	ret = inflate(&zstream->zs, Z_SYNC_FLUSH);
+	/* Stop at the next block boundary if we want to add an access point
+	   there. */
+	bool want_access_point = i_stream_zlib_want_access_point(zstream);
+	ret = inflate(&zstream->zs, want_access_point ? Z_BLOCK : Z_SYNC_FLUSH);
 
 	out_size -= zstream->zs.avail_out;
 	zstream->crc32 = crc32_data_more(zstream->crc32,
@@ -271,6 +397,8 @@ static ssize_t i_stream_zlib_read(struct istream_private *stream)
 
 	size_t bytes_consumed = size - zstream->zs.avail_in;
 	i_stream_skip(stream->parent, bytes_consumed);
+	if (want_access_point && ret == Z_OK)
+		i_stream_zlib_add_access_point(zstream, data, bytes_consumed);
 	if (i_stream_get_data_size(stream->parent) > 0 &&
 	    (bytes_consumed > 0 || out_size > 0)) {
 		/* Parent stream was only partially consumed. Set the stream's
@@ -357,16 +485,90 @@ static void i_stream_zlib_reset(struct zlib_istream *zstream)
 	i_stream_zlib_init(zstream);
 }
 
+static struct zlib_access_point *
+i_stream_zlib_find_access_point(struct zlib_istream *zstream, uoff_t v_offset)
+{
+	struct zlib_access_point *const *points;
+	unsigned int idx, left_idx, right_idx, count;
+
+	if (!array_is_created(&zstream->access_points))
+		return NULL;
+
+	/* find the last access point at or before v_offset */
+	points = array_get(&zstream->access_points, &count);
+	left_idx = 0; right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (points[idx]->v_offset <= v_offset)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	return left_idx == 0 ? NULL : points[left_idx - 1];
+}
+
+static void
+i_stream_zlib_restore_access_point(struct zlib_istream *zstream,
+				   const struct zlib_access_point *point)
+{
+	struct istream_private *stream = &zstream->istream;
+	int ret;
+
+	i_stream_seek(stream->parent, point->parent_offset);
+	zstream->eof_offset = UOFF_T_MAX;
+	zstream->crc32 = point->crc32;
+
+	zstream->zs.next_in = NULL;
+	zstream->zs.avail_in = 0;
+
+	stream->parent_expected_offset = point->parent_offset;
+	stream->skip = stream->pos = 0;
+	stream->istream.v_offset = point->v_offset;
+	stream->high_pos = 0;
+	zstream->prev_size = 0;
+	zstream->starting_concated_output = FALSE;
+
+	(void)inflateEnd(&zstream->zs);
+	i_stream_zlib_init(zstream);
+	/* we're in the middle of the deflate stream */
+	zstream->header_read = TRUE;
+	zstream->trailer_read = FALSE;
+
+	ret = Z_OK;
+	if (point->bits > 0) {
+		ret = inflatePrime(&zstream->zs, point->bits,
+				   point->prev_byte >> (8 - point->bits));
+	}
+	if (ret == Z_OK) {
+		ret = inflateSetDictionary(&zstream->zs, point->window,
+					   point->window_size);
+	}
+	if (ret != Z_OK)
+		i_panic("zlib: Failed to restore access point: %d", ret);
+}
+
 static void
 i_stream_zlib_seek(struct istream_private *stream, uoff_t v_offset, bool mark)
 {
 	struct zlib_istream *zstream = (struct zlib_istream *) stream;
-
-	if (i_stream_nonseekable_try_seek(stream, v_offset))
+	const struct zlib_access_point *point;
+	uoff_t high_offset = stream->istream.v_offset +
+		(stream->pos - stream->skip);
+
+	point = i_stream_zlib_find_access_point(zstream, v_offset);
+	if (point != NULL && point->v_offset > high_offset) {
+		/* an earlier read got further than we are now */
+		i_stream_zlib_restore_access_point(zstream, point);
+	} else if (i_stream_nonseekable_try_seek(stream, v_offset)) {
 		return;
-
-	/* have to seek backwards - reset state and retry */
-	i_stream_zlib_reset(zstream);
+	} else if (point != NULL) {
+		/* have to seek backwards - continue from the nearest
+		   access point */
+		i_stream_zlib_restore_access_point(zstream, point);
+	} else {
+		/* have to seek backwards - reset state and retry */
+		i_stream_zlib_reset(zstream);
+	}
 	if (!i_stream_nonseekable_try_seek(stream, v_offset))
 		i_unreached();
 
@@ -388,6 +590,8 @@ static void i_stream_zlib_sync(struct istream_private *stream)
 		}
 		zstream->last_parent_statbuf = *st;
 	}
+	i_stream_zlib_access_points_free(zstream);
+	zstream->access_point_span = ZLIB_ACCESS_POINT_INITIAL_SPAN;
 	i_stream_zlib_reset(zstream);
 }
 
@@ -399,6 +603,7 @@ i_stream_create_zlib(struct istream *input, bool gz)
 	zstream = i_new(struct zlib_istream, 1);
 	zstream->eof_offset = UOFF_T_MAX;
 	zstream->gz = gz;
+	zstream->access_point_span = ZLIB_ACCESS_POINT_INITIAL_SPAN;
 
 	i_stream_zlib_init(zstream);
 
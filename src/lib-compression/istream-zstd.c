@@ -7,11 +7,15 @@
 #include "buffer.h"
 #include "istream-private.h"
 #include "istream-zlib.h"
+#include "zstd-dictionary.h"
 
 #include "zstd.h"
 #include "zstd_errors.h"
 #include "iostream-zstd-private.h"
 
+/* ZSTD_FRAMEHEADERSIZE_MAX is only available with ZSTD_STATIC_LINKING_ONLY */
+#define ZSTD_FRAME_HEADER_MAX_SIZE 18
+
 #ifndef HAVE_ZSTD_GETERRORCODE
 ZSTD_ErrorCode ZSTD_getErrorCode(size_t functionResult)
 {
@@ -40,7 +44,11 @@ struct zstd_istream {
 	/* storage for data */
 	buffer_t *data_buffer;
 
+	/* dictionary used by the first frame */
+	struct zstd_dictionary *dict;
+
 	bool hdr_read:1;
+	bool dict_checked:1;
 	bool marked:1;
 	bool zs_closed:1;
 	/* is there data remaining */
@@ -63,6 +71,7 @@ static void i_stream_zstd_init(struct zstd_istream *zstream)
 	else
 		buffer_set_used_size(zstream->data_buffer, 0);
 	zstream->zs_closed = FALSE;
+	zstream->dict_checked = FALSE;
 }
 
 static void i_stream_zstd_deinit(struct zstd_istream *zstream, bool reuse_buffers)
@@ -87,6 +96,7 @@ static void i_stream_zstd_close(struct iostream_private *stream,
 	if (!zstream->zs_closed)
 		i_stream_zstd_deinit(zstream, FALSE);
 	buffer_free(&zstream->frame_buffer);
+	zstd_dictionary_unref(&zstream->dict);
 	if (close_parent)
 		i_stream_close(zstream->istream.parent);
 }
@@ -115,6 +125,73 @@ static void i_stream_zstd_read_error(struct zstd_istream *zstream, size_t err)
 			    i_stream_get_absolute_offset(&zstream->istream.istream));
 }
 
+static int i_stream_zstd_set_dictionary(struct zstd_istream *zstream)
+{
+#ifdef HAVE_ZSTD_DICTIONARIES
+	struct zstd_dictionary *dict;
+	unsigned int dict_id;
+	size_t ret;
+
+	zstream->dict_checked = TRUE;
+	if (!zstd_dictionaries_loaded()) {
+		/* if the frame needs a dictionary, decompression fails */
+		return 0;
+	}
+	dict_id = ZSTD_getDictID_fromFrame(
+		CONST_PTR_OFFSET(zstream->input.src, zstream->input.pos),
+		zstream->input.size - zstream->input.pos);
+	if (dict_id == 0)
+		return 0;
+
+	dict = zstd_dictionary_lookup(dict_id);
+	if (dict == NULL) {
+		zstream->istream.istream.stream_errno = EINVAL;
+		io_stream_set_error(&zstream->istream.iostream,
+			"zstd.read(%s): Unknown dictionary ID %u",
+			i_stream_get_name(&zstream->istream.istream), dict_id);
+		return -1;
+	}
+	ret = ZSTD_DCtx_refDDict(zstream->dstream,
+				 zstd_dictionary_get_ddict(dict));
+	if (ZSTD_isError(ret) != 0) {
+		i_stream_zstd_read_error(zstream, ret);
+		return -1;
+	}
+	if (zstream->dict != dict) {
+		zstd_dictionary_unref(&zstream->dict);
+		zstd_dictionary_ref(dict);
+		zstream->dict = dict;
+	}
+#else
+	zstream->dict_checked = TRUE;
+#endif
+	return 0;
+}
+
+static int
+i_stream_zstd_read_parent(struct zstd_istream *zstream,
+			  const unsigned char **data_r, size_t *size_r)
+{
+	struct istream *parent = zstream->istream.parent;
+	int ret;
+
+#ifdef HAVE_ZSTD_DICTIONARIES
+	if (!zstream->dict_checked && zstd_dictionaries_loaded()) {
+		/* read the full frame header so the dictionary ID can be
+		   looked up from it */
+		ret = i_stream_read_bytes(parent, data_r, size_r,
+					  ZSTD_FRAME_HEADER_MAX_SIZE);
+		if (ret <= 0 && *size_r > 0 && parent->eof &&
+		    parent->stream_errno == 0) {
+			/* the whole stream is smaller than the max header */
+			ret = 1;
+		}
+		return ret;
+	}
+#endif
+	return i_stream_read_more(parent, data_r, size_r);
+}
+
 static ssize_t i_stream_zstd_read(struct istream_private *stream)
 {
 	struct zstd_istream *zstream =
@@ -142,7 +219,7 @@ static ssize_t i_stream_zstd_read(struct istream_private *stream)
 			ssize_t ret;
 			buffer_set_used_size(zstream->frame_buffer, 0);
 			/* need to read more */
-			if ((ret = i_stream_read_more(stream->parent, &data, &size)) < 0) {
+			if ((ret = i_stream_zstd_read_parent(zstream, &data, &size)) < 0) {
 				stream->istream.stream_errno =
 					stream->parent->stream_errno;
 				stream->istream.eof = stream->parent->eof;
@@ -170,6 +247,9 @@ static ssize_t i_stream_zstd_read(struct istream_private *stream)
 
 		i_assert(zstream->input.size > 0);
 		i_assert(zstream->data_buffer->used == 0);
+		if (!zstream->dict_checked &&
+		    i_stream_zstd_set_dictionary(zstream) < 0)
+			return -1;
 		zstream->output.dst = buffer_append_space_unsafe(zstream->data_buffer,
 								 ZSTD_DStreamOutSize());
 		zstream->output.pos = 0;
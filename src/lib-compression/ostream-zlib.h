@@ -6,6 +6,9 @@ struct ostream *o_stream_create_deflate(struct ostream *output, int level);
 struct ostream *o_stream_create_bz2(struct ostream *output, int level);
 struct ostream *o_stream_create_lz4(struct ostream *output, int level);
 struct ostream *o_stream_create_zstd(struct ostream *output, int level);
+struct ostream *
+o_stream_create_zstd_workers(struct ostream *output, int level,
+			     unsigned int workers);
 
 int compression_get_min_level_gz(void);
 int compression_get_default_level_gz(void);
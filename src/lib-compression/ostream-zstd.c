@@ -7,6 +7,7 @@
 #include "ostream.h"
 #include "ostream-private.h"
 #include "ostream-zlib.h"
+#include "zstd-dictionary.h"
 
 #include "zstd.h"
 #include "zstd_errors.h"
@@ -19,6 +20,7 @@ struct zstd_ostream {
 	ZSTD_outBuffer output;
 
 	unsigned char *outbuf;
+	struct zstd_dictionary *dict;
 
 	bool flushed:1;
 	bool closed:1;
@@ -158,13 +160,19 @@ static int o_stream_zstd_send_flush(struct zstd_ostream *zstream, bool final)
 	if (!final)
 		return 1;
 
-	if (!zstream->finished) {
-		ret = ZSTD_endStream(zstream->cstream, &zstream->output);
-		if (ZSTD_isError(ret) != 0) {
-			o_stream_zstd_write_error(zstream, ret);
+	while (!zstream->finished) {
+		size_t remaining =
+			ZSTD_endStream(zstream->cstream, &zstream->output);
+		if (ZSTD_isError(remaining) != 0) {
+			o_stream_zstd_write_error(zstream, remaining);
 			return -1;
 		}
-		zstream->finished = TRUE;
+		/* With worker threads the remaining data may not fit into
+		   the output buffer at once. */
+		if (remaining == 0)
+			zstream->finished = TRUE;
+		else if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0)
+			return ret;
 	}
 
 	if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0)
@@ -206,12 +214,28 @@ static void o_stream_zstd_close(struct iostream_private *stream,
 	}
 	i_free(zstream->outbuf);
 	i_zero(&zstream->output);
+	zstd_dictionary_unref(&zstream->dict);
 	if (close_parent)
 		o_stream_close(zstream->ostream.parent);
 }
 
-struct ostream *
-o_stream_create_zstd(struct ostream *output, int level)
+static void
+o_stream_zstd_set_workers(struct zstd_ostream *zstream, unsigned int workers)
+{
+#if ZSTD_VERSION_NUMBER >= 10400
+	/* This fails if libzstd was built without multithreading support.
+	   Just keep compressing in the current thread then. */
+	(void)ZSTD_CCtx_setParameter(zstream->cstream, ZSTD_c_nbWorkers,
+				     (int)I_MIN(workers, INT_MAX));
+#else
+	(void)zstream;
+	(void)workers;
+#endif
+}
+
+static struct ostream *
+o_stream_create_zstd_full(struct ostream *output, int level,
+			  unsigned int workers, struct zstd_dictionary *dict)
 {
 	struct zstd_ostream *zstream;
 	size_t ret;
@@ -236,8 +260,46 @@ o_stream_create_zstd(struct ostream *output, int level)
 		zstream->output.dst = zstream->outbuf;
 		zstream->output.size = ZSTD_CStreamOutSize();
 	}
+	if (workers > 0 && ZSTD_isError(ret) == 0)
+		o_stream_zstd_set_workers(zstream, workers);
+#ifdef HAVE_ZSTD_DICTIONARIES
+	if (dict != NULL && ZSTD_isError(ret) == 0) {
+		/* the compression level comes from the CDict */
+		ret = ZSTD_CCtx_refCDict(zstream->cstream,
+			zstd_dictionary_get_cdict(dict, level));
+		if (ZSTD_isError(ret) != 0)
+			o_stream_zstd_write_error(zstream, ret);
+		zstd_dictionary_ref(dict);
+		zstream->dict = dict;
+	}
+#else
+	i_assert(dict == NULL);
+#endif
 	return o_stream_create(&zstream->ostream, output,
 			       o_stream_get_fd(output));
 }
 
+struct ostream *
+o_stream_create_zstd(struct ostream *output, int level)
+{
+	return o_stream_create_zstd_full(output, level, 0, NULL);
+}
+
+struct ostream *
+o_stream_create_zstd_workers(struct ostream *output, int level,
+			     unsigned int workers)
+{
+	return o_stream_create_zstd_full(output, level, workers, NULL);
+}
+
+#ifdef HAVE_ZSTD_DICTIONARIES
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  unsigned int workers, struct zstd_dictionary *dict)
+{
+	i_assert(dict != NULL);
+	return o_stream_create_zstd_full(output, level, workers, dict);
+}
+#endif
+
 #endif
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "str.h"
 #include "istream.h"
 #include "iostream-temp.h"
 #include "ostream.h"
@@ -725,6 +726,54 @@ test_compression_handler_errors(const struct compression_handler *handler,
 	test_end();
 }
 
+static void
+test_compression_handler_workers(const struct compression_handler *handler)
+{
+	buffer_t *test_data, *buffer;
+	struct ostream *test_output, *output;
+	struct istream *test_input, *input;
+	const unsigned char *data;
+	size_t size;
+	unsigned int i;
+
+	test_begin(t_strdup_printf("compression handler %s (workers)",
+				   handler->name));
+
+	/* large enough for multiple compression jobs */
+	test_data = buffer_create_dynamic(default_pool, 1024*1024*8);
+	for (i = 0; test_data->used < 1024*1024*8; i++)
+		str_printfa(test_data, "line %u %u\n", i, i_rand_limit(1000));
+
+	buffer = buffer_create_dynamic(default_pool, 1024*1024);
+	test_output = test_ostream_create(buffer);
+	output = handler->create_ostream_workers(test_output, 1, 2);
+	o_stream_unref(&test_output);
+	test_assert(o_stream_send(output, test_data->data, test_data->used) ==
+		    (ssize_t)test_data->used);
+	test_assert(o_stream_finish(output) == 1);
+	o_stream_unref(&output);
+
+	test_input = test_istream_create_data(buffer->data, buffer->used);
+	input = handler->create_istream(test_input);
+	i_stream_unref(&test_input);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		if (input->v_offset + size > test_data->used ||
+		    memcmp(data, CONST_PTR_OFFSET(test_data->data,
+						  input->v_offset), size) != 0) {
+			test_assert(FALSE);
+			break;
+		}
+		i_stream_skip(input, size);
+	}
+	test_assert(input->stream_errno == 0);
+	test_assert(input->v_offset == test_data->used);
+	i_stream_unref(&input);
+
+	buffer_free(&buffer);
+	buffer_free(&test_data);
+	test_end();
+}
+
 static void test_compression_int(bool autodetect)
 {
 	unsigned int i;
@@ -746,6 +795,9 @@ static void test_compression_int(bool autodetect)
 			test_compression_handler_random_io(&compression_handlers[i], autodetect);
 			test_compression_handler_large_random_io(&compression_handlers[i], autodetect);
 			test_compression_handler_errors(&compression_handlers[i], autodetect);
+			if (compression_handlers[i].create_ostream_workers != NULL &&
+			    !autodetect)
+				test_compression_handler_workers(&compression_handlers[i]);
 		} T_END;
 	}
 }
@@ -953,6 +1005,66 @@ static void test_gz_large_header(void)
 	test_gz_large_header_int(TRUE);
 }
 
+static void test_gz_large_seek(void)
+{
+	const struct compression_handler *gz;
+	buffer_t *test_data, *buffer;
+	struct ostream *test_output, *output;
+	struct istream *test_input, *input;
+	const unsigned char *data;
+	size_t size;
+	uoff_t offset;
+	unsigned int i;
+
+	if (compression_lookup_handler("gz", &gz) <= 0)
+		return; /* not compiled in or unknown */
+
+	test_begin("gz large seek");
+	/* large enough for the access points to get merged */
+	test_data = buffer_create_dynamic(default_pool, 1024*1024*24);
+	for (i = 0; test_data->used < 1024*1024*24; i++)
+		str_printfa(test_data, "line %u %u\n", i, i_rand_limit(1000));
+
+	buffer = buffer_create_dynamic(default_pool, 1024*1024);
+	test_output = test_ostream_create(buffer);
+	output = gz->create_ostream(test_output, 1);
+	o_stream_unref(&test_output);
+	test_assert(o_stream_send(output, test_data->data, test_data->used) ==
+		    (ssize_t)test_data->used);
+	test_assert(o_stream_finish(output) == 1);
+	o_stream_unref(&output);
+
+	test_input = test_istream_create_data(buffer->data, buffer->used);
+	input = gz->create_istream(test_input);
+	i_stream_unref(&test_input);
+
+	/* read everything once, then seek around randomly */
+	offset = 0;
+	for (i = 0; i < 100; i++) {
+		i_stream_seek(input, offset);
+		if (i_stream_read_more(input, &data, &size) <= 0 ||
+		    offset + size > test_data->used ||
+		    memcmp(data, CONST_PTR_OFFSET(test_data->data, offset),
+			   size) != 0) {
+			test_assert_idx(FALSE, i);
+			break;
+		}
+		if (i == 0) {
+			do {
+				i_stream_skip(input, size);
+			} while (i_stream_read_more(input, &data, &size) > 0);
+			test_assert(input->v_offset == test_data->used);
+		}
+		offset = i_rand_limit(test_data->used);
+	}
+	test_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+
+	buffer_free(&buffer);
+	buffer_free(&test_data);
+	test_end();
+}
+
 static void test_lz4_small_header(void)
 {
 	const struct compression_handler *lz4;
@@ -1106,6 +1218,7 @@ int main(int argc, char *argv[])
 		test_gz_no_concat,
 		test_gz_header,
 		test_gz_large_header,
+		test_gz_large_seek,
 		test_lz4_small_header,
 		test_compression_ext,
 		NULL
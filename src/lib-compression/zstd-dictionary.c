@@ -0,0 +1,285 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "llist.h"
+#include "read-full.h"
+#include "zstd-dictionary.h"
+
+#ifdef HAVE_ZSTD
+#  include "zstd.h"
+#  include "zstd_errors.h"
+#  include "zdict.h"
+#  include "iostream-zstd-private.h"
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZSTD_DICTIONARIES
+
+/* Sanity limit - trained dictionaries are usually around 100 kB */
+#define ZSTD_DICTIONARY_MAX_FILE_SIZE (1024*1024*16)
+
+struct zstd_dictionary_cdict {
+	int level;
+	ZSTD_CDict *cdict;
+};
+
+struct zstd_dictionary {
+	struct zstd_dictionary *prev, *next;
+	int refcount;
+
+	char *path;
+	unsigned int id;
+	buffer_t *data;
+
+	ZSTD_DDict *ddict;
+	/* created lazily for each used compression level */
+	ARRAY(struct zstd_dictionary_cdict) cdicts;
+};
+
+static struct zstd_dictionary *zstd_dictionaries = NULL;
+
+static int
+zstd_dictionary_read(const char *path, buffer_t *data, const char **error_r)
+{
+	struct stat st;
+	void *buf;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	if (st.st_size == 0 || st.st_size > ZSTD_DICTIONARY_MAX_FILE_SIZE) {
+		*error_r = t_strdup_printf("%s: Invalid dictionary size %"PRIuUOFF_T,
+					   path, (uoff_t)st.st_size);
+		i_close_fd(&fd);
+		return -1;
+	}
+	buf = buffer_append_space_unsafe(data, st.st_size);
+	if ((ret = read_full(fd, buf, st.st_size)) <= 0) {
+		if (ret == 0)
+			*error_r = t_strdup_printf("read(%s) failed: Unexpected EOF", path);
+		else
+			*error_r = t_strdup_printf("read(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	i_close_fd(&fd);
+	return 0;
+}
+
+int zstd_dictionary_load(const char *path, struct zstd_dictionary **dict_r,
+			 const char **error_r)
+{
+	struct zstd_dictionary *dict;
+	buffer_t *data;
+	unsigned int id;
+
+	for (dict = zstd_dictionaries; dict != NULL; dict = dict->next) {
+		if (strcmp(dict->path, path) == 0) {
+			zstd_dictionary_ref(dict);
+			*dict_r = dict;
+			return 0;
+		}
+	}
+
+	data = buffer_create_dynamic(default_pool, 1024*128);
+	if (zstd_dictionary_read(path, data, error_r) < 0) {
+		buffer_free(&data);
+		return -1;
+	}
+	/* The ID is needed to find the dictionary when decompressing, so raw
+	   content dictionaries aren't supported. */
+	id = ZSTD_getDictID_fromDict(data->data, data->used);
+	if (id == 0) {
+		*error_r = t_strdup_printf(
+			"%s: Not a zstd dictionary (missing dictionary ID)", path);
+		buffer_free(&data);
+		return -1;
+	}
+	if ((dict = zstd_dictionary_lookup(id)) != NULL) {
+		*error_r = t_strdup_printf(
+			"%s: Dictionary ID %u is already used by %s",
+			path, id, dict->path);
+		buffer_free(&data);
+		return -1;
+	}
+
+	dict = i_new(struct zstd_dictionary, 1);
+	dict->refcount = 1;
+	dict->path = i_strdup(path);
+	dict->id = id;
+	dict->data = data;
+	dict->ddict = ZSTD_createDDict(data->data, data->used);
+	if (dict->ddict == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+	i_array_init(&dict->cdicts, 2);
+	DLLIST_PREPEND(&zstd_dictionaries, dict);
+
+	*dict_r = dict;
+	return 0;
+}
+
+void zstd_dictionary_ref(struct zstd_dictionary *dict)
+{
+	i_assert(dict->refcount > 0);
+	dict->refcount++;
+}
+
+void zstd_dictionary_unref(struct zstd_dictionary **_dict)
+{
+	struct zstd_dictionary *dict = *_dict;
+	struct zstd_dictionary_cdict *cdict;
+
+	if (dict == NULL)
+		return;
+	*_dict = NULL;
+
+	i_assert(dict->refcount > 0);
+	if (--dict->refcount > 0)
+		return;
+
+	DLLIST_REMOVE(&zstd_dictionaries, dict);
+	array_foreach_modifiable(&dict->cdicts, cdict)
+		(void)ZSTD_freeCDict(cdict->cdict);
+	array_free(&dict->cdicts);
+	(void)ZSTD_freeDDict(dict->ddict);
+	buffer_free(&dict->data);
+	i_free(dict->path);
+	i_free(dict);
+}
+
+unsigned int zstd_dictionary_get_id(const struct zstd_dictionary *dict)
+{
+	return dict->id;
+}
+
+struct zstd_dictionary *zstd_dictionary_lookup(unsigned int id)
+{
+	struct zstd_dictionary *dict;
+
+	for (dict = zstd_dictionaries; dict != NULL; dict = dict->next) {
+		if (dict->id == id)
+			return dict;
+	}
+	return NULL;
+}
+
+bool zstd_dictionaries_loaded(void)
+{
+	return zstd_dictionaries != NULL;
+}
+
+const ZSTD_CDict *
+zstd_dictionary_get_cdict(struct zstd_dictionary *dict, int level)
+{
+	struct zstd_dictionary_cdict *cdict;
+
+	array_foreach_modifiable(&dict->cdicts, cdict) {
+		if (cdict->level == level)
+			return cdict->cdict;
+	}
+	cdict = array_append_space(&dict->cdicts);
+	cdict->level = level;
+	cdict->cdict = ZSTD_createCDict(dict->data->data, dict->data->used,
+					level);
+	if (cdict->cdict == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+	return cdict->cdict;
+}
+
+const ZSTD_DDict *zstd_dictionary_get_ddict(struct zstd_dictionary *dict)
+{
+	return dict->ddict;
+}
+
+int zstd_dictionary_train(const buffer_t *samples, const size_t *sample_sizes,
+			  unsigned int sample_count, size_t max_dict_size,
+			  buffer_t *dict_r, const char **error_r)
+{
+	size_t used = dict_r->used;
+	void *buf;
+	size_t ret;
+
+	buf = buffer_append_space_unsafe(dict_r, max_dict_size);
+	ret = ZDICT_trainFromBuffer(buf, max_dict_size, samples->data,
+				    sample_sizes, sample_count);
+	if (ZDICT_isError(ret) != 0) {
+		buffer_set_used_size(dict_r, used);
+		*error_r = t_strdup_printf("Failed to train dictionary: %s",
+					   ZDICT_getErrorName(ret));
+		return -1;
+	}
+	buffer_set_used_size(dict_r, used + ret);
+	return 0;
+}
+
+#else
+
+#ifdef HAVE_ZSTD
+#  define ZSTD_DICTIONARIES_UNSUPPORTED \
+	"zstd dictionaries require libzstd v1.4.0 or later"
+#else
+#  define ZSTD_DICTIONARIES_UNSUPPORTED "zstd support not compiled in"
+#endif
+
+int zstd_dictionary_load(const char *path ATTR_UNUSED,
+			 struct zstd_dictionary **dict_r ATTR_UNUSED,
+			 const char **error_r)
+{
+	*error_r = ZSTD_DICTIONARIES_UNSUPPORTED;
+	return -1;
+}
+
+void zstd_dictionary_ref(struct zstd_dictionary *dict ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+void zstd_dictionary_unref(struct zstd_dictionary **dict)
+{
+	i_assert(*dict == NULL);
+}
+
+unsigned int zstd_dictionary_get_id(const struct zstd_dictionary *dict ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+struct zstd_dictionary *zstd_dictionary_lookup(unsigned int id ATTR_UNUSED)
+{
+	return NULL;
+}
+
+int zstd_dictionary_train(const buffer_t *samples ATTR_UNUSED,
+			  const size_t *sample_sizes ATTR_UNUSED,
+			  unsigned int sample_count ATTR_UNUSED,
+			  size_t max_dict_size ATTR_UNUSED,
+			  buffer_t *dict_r ATTR_UNUSED, const char **error_r)
+{
+	*error_r = ZSTD_DICTIONARIES_UNSUPPORTED;
+	return -1;
+}
+
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output ATTR_UNUSED,
+			  int level ATTR_UNUSED,
+			  unsigned int workers ATTR_UNUSED,
+			  struct zstd_dictionary *dict ATTR_UNUSED)
+{
+	/* dictionaries can't be loaded */
+	i_unreached();
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef ZSTD_DICTIONARY_H
+#define ZSTD_DICTIONARY_H
+
+struct ostream;
+struct zstd_dictionary;
+
+/* Load a zstd dictionary from the given file. Loaded dictionaries are
+   registered for the process, so i_stream_create_zstd() can decompress
+   frames that were compressed with any of them. Loading the same path again
+   returns the already loaded dictionary. Returns 0 on success, -1 on error. */
+int zstd_dictionary_load(const char *path, struct zstd_dictionary **dict_r,
+			 const char **error_r);
+void zstd_dictionary_ref(struct zstd_dictionary *dict);
+void zstd_dictionary_unref(struct zstd_dictionary **dict);
+
+/* Returns the dictionary ID, which is written to the header of each frame
+   compressed with the dictionary. */
+unsigned int zstd_dictionary_get_id(const struct zstd_dictionary *dict);
+/* Returns the loaded dictionary with the given ID, or NULL if none. */
+struct zstd_dictionary *zstd_dictionary_lookup(unsigned int id);
+
+/* Train a dictionary of at most max_dict_size bytes. The samples are
+   concatenated in samples, and sample_sizes contains each of the
+   sample_count samples' size. Returns 0 on success, -1 on error. */
+int zstd_dictionary_train(const buffer_t *samples, const size_t *sample_sizes,
+			  unsigned int sample_count, size_t max_dict_size,
+			  buffer_t *dict_r, const char **error_r);
+
+/* Create a zstd ostream which compresses using the dictionary. */
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  unsigned int workers, struct zstd_dictionary *dict);
+
+#endif
@@ -31,6 +31,11 @@ struct file_dict {
 	bool dict_path_checked;
 	HASH_TABLE(char *, char *) hash;
 	int fd;
+	/* fd's inode, so checking if the file was replaced needs only
+	   a stat() of the path */
+	ino_t fd_ino;
+	dev_t fd_dev;
+	bool fd_ino_set;
 
 	bool refreshed;
 };
@@ -128,9 +133,23 @@ static void file_dict_deinit(struct dict *_dict)
 	i_free(dict);
 }
 
+static void file_dict_fd_opened(struct file_dict *dict)
+{
+	struct stat st;
+
+	if (fstat(dict->fd, &st) < 0) {
+		/* check it again in file_dict_need_refresh() */
+		dict->fd_ino_set = FALSE;
+		return;
+	}
+	dict->fd_ino = st.st_ino;
+	dict->fd_dev = st.st_dev;
+	dict->fd_ino_set = TRUE;
+}
+
 static bool file_dict_need_refresh(struct file_dict *dict)
 {
-	struct stat st1, st2;
+	struct stat st1;
 
 	if (dict->dict.iter_count > 0) {
 		/* Change nothing while there are iterators or they can crash
@@ -151,13 +170,18 @@ static bool file_dict_need_refresh(struct file_dict *dict)
 		return FALSE;
 	}
 
-	if (fstat(dict->fd, &st2) < 0) {
-		if (errno != ESTALE)
-			e_error(dict->dict.event, "fstat(%s) failed: %m", dict->path);
-		return TRUE;
+	if (!dict->fd_ino_set) {
+		file_dict_fd_opened(dict);
+		if (!dict->fd_ino_set) {
+			if (errno != ESTALE) {
+				e_error(dict->dict.event,
+					"fstat(%s) failed: %m", dict->path);
+			}
+			return TRUE;
+		}
 	}
-	if (st1.st_ino != st2.st_ino ||
-	    !CMP_DEV_T(st1.st_dev, st2.st_dev)) {
+	if (st1.st_ino != dict->fd_ino ||
+	    !CMP_DEV_T(st1.st_dev, dict->fd_dev)) {
 		/* file changed */
 		return TRUE;
 	}
@@ -185,6 +209,7 @@ static int file_dict_open_latest(struct file_dict *dict, const char **error_r)
 			*error_r = t_strdup_printf("open(%s) failed: %m", dict->path);
 		return -1;
 	}
+	file_dict_fd_opened(dict);
 	dict->refreshed = FALSE;
 	return 1;
 }
@@ -524,6 +549,7 @@ file_dict_lock(struct file_dict *dict, struct file_lock **lock_r,
 		if (fd_copy_parent_dir_permissions(dict->path, dict->fd,
 						   dict->path, &error) < 0)
 			e_error(dict->dict.event, "%s", error);
+		file_dict_fd_opened(dict);
 	}
 
 	*lock_r = NULL;
@@ -671,6 +697,7 @@ file_dict_write_changes(struct dict_transaction_memory_context *ctx,
 
 	i_close_fd(&dict->fd);
 	dict->fd = fd;
+	file_dict_fd_opened(dict);
 	return 0;
 }
 
@@ -45,6 +45,12 @@ struct redis_dict_reply {
 	void *context;
 };
 
+struct redis_dict_lookup {
+	/* NULL for synchronous lookups */
+	dict_lookup_callback_t *callback;
+	void *context;
+};
+
 struct redis_dict {
 	struct dict dict;
 	char *password, *key_prefix, *expire_value;
@@ -54,6 +60,11 @@ struct redis_dict {
 
 	ARRAY(enum redis_input_state) input_states;
 	ARRAY(struct redis_dict_reply) replies;
+	/* GET commands waiting for a reply, in the order they were sent */
+	ARRAY(struct redis_dict_lookup) lookups;
+	/* Running while there are asynchronous lookups waiting for replies */
+	struct timeout *to_lookup;
+	unsigned int async_lookups_count;
 
 	bool connected;
 	bool transaction_open;
@@ -90,23 +101,51 @@ static void redis_reply_callback(struct redis_connection *conn,
 		io_loop_set_current(conn->dict->dict.ioloop);
 }
 
+static void redis_lookup_callback(struct redis_connection *conn,
+				  const struct redis_dict_lookup *lookup,
+				  const struct dict_lookup_result *result)
+{
+	if (conn->dict->dict.prev_ioloop != NULL)
+		io_loop_set_current(conn->dict->dict.prev_ioloop);
+	lookup->callback(result, lookup->context);
+	if (conn->dict->dict.prev_ioloop != NULL)
+		io_loop_set_current(conn->dict->dict.ioloop);
+}
+
 static void
 redis_disconnected(struct redis_connection *conn, const char *reason)
 {
 	const struct dict_commit_result result = {
 		DICT_COMMIT_RET_FAILED, reason
 	};
+	const struct dict_lookup_result lookup_result = {
+		.ret = -1,
+		.error = reason,
+	};
 	const struct redis_dict_reply *reply;
+	const struct redis_dict_lookup *lookup;
+	ARRAY(struct redis_dict_lookup) lookups;
 
 	conn->dict->db_id_set = FALSE;
 	conn->dict->connected = FALSE;
 	connection_disconnect(&conn->conn);
+	timeout_remove(&conn->dict->to_lookup);
+	conn->dict->async_lookups_count = 0;
 
 	array_foreach(&conn->dict->replies, reply)
 		redis_reply_callback(conn, reply, &result);
 	array_clear(&conn->dict->replies);
 	array_clear(&conn->dict->input_states);
 
+	/* the callbacks may send new lookups */
+	t_array_init(&lookups, array_count(&conn->dict->lookups) + 1);
+	array_append_array(&lookups, &conn->dict->lookups);
+	array_clear(&conn->dict->lookups);
+	array_foreach(&lookups, lookup) {
+		if (lookup->callback != NULL)
+			redis_lookup_callback(conn, lookup, &lookup_result);
+	}
+
 	if (conn->dict->dict.ioloop != NULL)
 		io_loop_stop(conn->dict->dict.ioloop);
 }
@@ -149,6 +188,43 @@ static void redis_wait(struct redis_dict *dict)
 	dict->dict.prev_ioloop = NULL;
 }
 
+static void redis_input_get_finished(struct redis_connection *conn)
+{
+	struct redis_dict *dict = conn->dict;
+	struct redis_dict_lookup lookup;
+
+	redis_input_state_remove(dict);
+	i_assert(array_count(&dict->lookups) > 0);
+	lookup = *array_front(&dict->lookups);
+	array_pop_front(&dict->lookups);
+
+	if (lookup.callback == NULL) {
+		/* synchronous lookup */
+		conn->value_received = TRUE;
+		if (dict->dict.ioloop != NULL)
+			io_loop_stop(dict->dict.ioloop);
+		return;
+	}
+
+	const char *values[] = { str_c(conn->last_reply), NULL };
+	struct dict_lookup_result result = {
+		.ret = conn->value_not_found ? 0 : 1,
+	};
+	if (result.ret > 0) {
+		result.value = values[0];
+		result.values = values;
+	}
+
+	i_assert(dict->async_lookups_count > 0);
+	if (--dict->async_lookups_count == 0)
+		timeout_remove(&dict->to_lookup);
+	else {
+		/* the timeout is for waiting on the next reply */
+		timeout_reset(dict->to_lookup);
+	}
+	redis_lookup_callback(conn, &lookup, &result);
+}
+
 static int redis_input_get(struct redis_connection *conn, const char **error_r)
 {
 	const unsigned char *data;
@@ -160,12 +236,11 @@ static int redis_input_get(struct redis_connection *conn, const char **error_r)
 		line = i_stream_next_line(conn->conn.input);
 		if (line == NULL)
 			return 0;
+		str_truncate(conn->last_reply, 0);
+		conn->value_not_found = FALSE;
 		if (strcmp(line, "$-1") == 0) {
-			conn->value_received = TRUE;
 			conn->value_not_found = TRUE;
-			if (conn->dict->dict.ioloop != NULL)
-				io_loop_stop(conn->dict->dict.ioloop);
-			redis_input_state_remove(conn->dict);
+			redis_input_get_finished(conn);
 			return 1;
 		}
 		if (line[0] != '$' || str_to_uint(line+1, &conn->bytes_left) < 0) {
@@ -188,12 +263,8 @@ static int redis_input_get(struct redis_connection *conn, const char **error_r)
 		return 0;
 
 	/* reply fully read - drop trailing CRLF */
-	conn->value_received = TRUE;
 	str_truncate(conn->last_reply, str_len(conn->last_reply)-2);
-
-	if (conn->dict->dict.ioloop != NULL)
-		io_loop_stop(conn->dict->dict.ioloop);
-	redis_input_state_remove(conn->dict);
+	redis_input_get_finished(conn);
 	return 1;
 }
 
@@ -438,6 +509,7 @@ redis_dict_init(struct dict *driver, const char *uri,
 
 	i_array_init(&dict->input_states, 4);
 	i_array_init(&dict->replies, 4);
+	i_array_init(&dict->lookups, 4);
 
 	*dict_r = &dict->dict;
 	return 0;
@@ -451,8 +523,11 @@ static void redis_dict_deinit(struct dict *_dict)
 		i_assert(dict->connected);
 		redis_wait(dict);
 	}
+	i_assert(array_count(&dict->lookups) == 0);
+	timeout_remove(&dict->to_lookup);
 	connection_deinit(&dict->conn.conn);
 	str_free(&dict->conn.last_reply);
+	array_free(&dict->lookups);
 	array_free(&dict->replies);
 	array_free(&dict->input_states);
 	i_free(dict->expire_value);
@@ -472,6 +547,16 @@ static void redis_dict_wait(struct dict *_dict)
 		redis_wait(dict);
 }
 
+static bool redis_dict_switch_ioloop(struct dict *_dict)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+
+	if (dict->to_lookup != NULL)
+		dict->to_lookup = io_loop_move_timeout(&dict->to_lookup);
+	connection_switch_ioloop(&dict->conn.conn);
+	return array_count(&dict->input_states) > 0;
+}
+
 static void redis_dict_lookup_timeout(struct redis_dict *dict)
 {
 	const char *reason = t_strdup_printf(
@@ -480,6 +565,23 @@ static void redis_dict_lookup_timeout(struct redis_dict *dict)
 	redis_disconnected(&dict->conn, reason);
 }
 
+static void redis_dict_send_get(struct redis_dict *dict, const char *key,
+				dict_lookup_callback_t *callback,
+				void *context)
+{
+	struct redis_dict_lookup *lookup;
+	const char *cmd;
+
+	cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n",
+			      strlen(key), key);
+	o_stream_nsend_str(dict->conn.conn.output, cmd);
+
+	redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
+	lookup = array_append_space(&dict->lookups);
+	lookup->callback = callback;
+	lookup->context = context;
+}
+
 static const char *
 redis_dict_get_full_key(struct redis_dict *dict, const char *username,
 			const char *key)
@@ -539,7 +641,6 @@ static int redis_dict_lookup(struct dict *_dict,
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
 	struct timeout *to;
-	const char *cmd;
 
 	key = redis_dict_get_full_key(dict, set->username, key);
 
@@ -567,12 +668,8 @@ static int redis_dict_lookup(struct dict *_dict,
 
 		if (dict->connected) {
 			redis_dict_select_db(dict);
-			cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n",
-					      strlen(key), key);
-			o_stream_nsend_str(dict->conn.conn.output, cmd);
-
 			str_truncate(dict->conn.last_reply, 0);
-			redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
+			redis_dict_send_get(dict, key, NULL, NULL);
 			do {
 				io_loop_run(dict->dict.ioloop);
 			} while (array_count(&dict->input_states) > 0);
@@ -603,18 +700,8 @@ static int redis_dict_lookup(struct dict *_dict,
 	return 1;
 }
 
-static struct dict_transaction_context *
-redis_transaction_init(struct dict *_dict)
+static void redis_dict_connect(struct redis_dict *dict)
 {
-	struct redis_dict *dict = (struct redis_dict *)_dict;
-	struct redis_dict_transaction_context *ctx;
-
-	i_assert(!dict->transaction_open);
-	dict->transaction_open = TRUE;
-
-	ctx = i_new(struct redis_dict_transaction_context, 1);
-	ctx->ctx.dict = _dict;
-
 	if (dict->conn.conn.fd_in == -1 &&
 	    connection_client_connect(&dict->conn.conn) < 0) {
 		e_error(dict->conn.conn.event, "Couldn't connect");
@@ -626,6 +713,49 @@ redis_transaction_init(struct dict *_dict)
 	}
 	if (dict->connected)
 		redis_dict_select_db(dict);
+}
+
+static void
+redis_dict_lookup_async(struct dict *_dict, const struct dict_op_settings *set,
+			const char *key, dict_lookup_callback_t *callback,
+			void *context)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+
+	redis_dict_connect(dict);
+	if (!dict->connected) {
+		const struct dict_lookup_result result = {
+			.ret = -1,
+			.error = "redis: Couldn't connect",
+		};
+		callback(&result, context);
+		return;
+	}
+
+	/* The GET is sent immediately without waiting for the earlier
+	   replies. Redis replies to the commands in the same order. */
+	key = redis_dict_get_full_key(dict, set->username, key);
+	redis_dict_send_get(dict, key, callback, context);
+	dict->async_lookups_count++;
+	if (dict->to_lookup == NULL) {
+		dict->to_lookup = timeout_add(dict->timeout_msecs,
+					      redis_dict_lookup_timeout, dict);
+	}
+}
+
+static struct dict_transaction_context *
+redis_transaction_init(struct dict *_dict)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+	struct redis_dict_transaction_context *ctx;
+
+	i_assert(!dict->transaction_open);
+	dict->transaction_open = TRUE;
+
+	ctx = i_new(struct redis_dict_transaction_context, 1);
+	ctx->ctx.dict = _dict;
+
+	redis_dict_connect(dict);
 	return &ctx->ctx;
 }
 
@@ -828,5 +958,7 @@ struct dict dict_driver_redis = {
 		.set = redis_set,
 		.unset = redis_unset,
 		.atomic_inc = redis_atomic_inc,
+		.lookup_async = redis_dict_lookup_async,
+		.switch_ioloop = redis_dict_switch_ioloop,
 	}
 };
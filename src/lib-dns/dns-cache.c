@@ -0,0 +1,144 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "ioloop.h"
+#include "time-util.h"
+#include "dns-cache.h"
+
+/* Don't let a process that talks to lots of hosts grow the cache without
+   limits. Expired entries are dropped when the limit is reached. */
+#define DNS_CACHE_MAX_ENTRIES 1024
+
+struct dns_cache_entry {
+	char *host;
+	struct timeval expires;
+	unsigned int ips_count;
+	struct ip_addr *ips;
+};
+
+static HASH_TABLE(char *, struct dns_cache_entry *) dns_cache;
+
+static void dns_cache_entry_free(struct dns_cache_entry **_entry)
+{
+	struct dns_cache_entry *entry = *_entry;
+
+	*_entry = NULL;
+	i_free(entry->ips);
+	i_free(entry->host);
+	i_free(entry);
+}
+
+static bool dns_cache_entry_is_expired(const struct dns_cache_entry *entry)
+{
+	return timeval_cmp(&entry->expires, &ioloop_timeval) <= 0;
+}
+
+static void dns_cache_remove_entry(struct dns_cache_entry *entry)
+{
+	hash_table_remove(dns_cache, entry->host);
+	dns_cache_entry_free(&entry);
+}
+
+static void dns_cache_remove_expired(void)
+{
+	struct hash_iterate_context *iter;
+	struct dns_cache_entry *entry;
+	char *host;
+	ARRAY(struct dns_cache_entry *) expired;
+
+	t_array_init(&expired, 32);
+	iter = hash_table_iterate_init(dns_cache);
+	while (hash_table_iterate(iter, dns_cache, &host, &entry)) {
+		if (dns_cache_entry_is_expired(entry))
+			array_push_back(&expired, &entry);
+	}
+	hash_table_iterate_deinit(&iter);
+
+	array_foreach_elem(&expired, entry)
+		dns_cache_remove_entry(entry);
+}
+
+bool dns_cache_lookup(const char *host, const struct ip_addr **ips_r,
+		      unsigned int *ips_count_r, struct timeval *expires_r)
+{
+	struct dns_cache_entry *entry;
+
+	if (!hash_table_is_created(dns_cache))
+		return FALSE;
+	entry = hash_table_lookup(dns_cache, host);
+	if (entry == NULL)
+		return FALSE;
+	if (dns_cache_entry_is_expired(entry)) {
+		dns_cache_remove_entry(entry);
+		return FALSE;
+	}
+	*ips_r = entry->ips;
+	*ips_count_r = entry->ips_count;
+	*expires_r = entry->expires;
+	return TRUE;
+}
+
+void dns_cache_update(const char *host, const struct ip_addr *ips,
+		      unsigned int ips_count, unsigned int ttl_msecs)
+{
+	struct dns_cache_entry *entry;
+
+	i_assert(ips_count > 0);
+
+	if (ttl_msecs == 0)
+		return;
+
+	if (!hash_table_is_created(dns_cache)) {
+		hash_table_create(&dns_cache, default_pool, 0,
+				  strcase_hash, strcasecmp);
+		lib_atexit(dns_cache_deinit);
+	}
+
+	entry = hash_table_lookup(dns_cache, host);
+	if (entry != NULL)
+		dns_cache_remove_entry(entry);
+	else if (hash_table_count(dns_cache) >= DNS_CACHE_MAX_ENTRIES) {
+		T_BEGIN {
+			dns_cache_remove_expired();
+		} T_END;
+		if (hash_table_count(dns_cache) >= DNS_CACHE_MAX_ENTRIES)
+			return;
+	}
+
+	entry = i_new(struct dns_cache_entry, 1);
+	entry->host = i_strdup(host);
+	entry->expires = ioloop_timeval;
+	timeval_add_msecs(&entry->expires, ttl_msecs);
+	entry->ips_count = ips_count;
+	entry->ips = i_memdup(ips, sizeof(*ips) * ips_count);
+	hash_table_insert(dns_cache, entry->host, entry);
+}
+
+void dns_cache_remove(const char *host)
+{
+	struct dns_cache_entry *entry;
+
+	if (!hash_table_is_created(dns_cache))
+		return;
+	entry = hash_table_lookup(dns_cache, host);
+	if (entry != NULL)
+		dns_cache_remove_entry(entry);
+}
+
+void dns_cache_deinit(void)
+{
+	struct hash_iterate_context *iter;
+	struct dns_cache_entry *entry;
+	char *host;
+
+	if (!hash_table_is_created(dns_cache))
+		return;
+
+	iter = hash_table_iterate_init(dns_cache);
+	while (hash_table_iterate(iter, dns_cache, &host, &entry))
+		dns_cache_entry_free(&entry);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&dns_cache);
+}
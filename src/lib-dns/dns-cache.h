@@ -0,0 +1,24 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+/* Process-global cache for successful host name lookups. This allows
+   unrelated clients in the same process (e.g. HTTP clients with separate
+   contexts) to share the lookup results instead of each doing their own
+   lookups for the same hosts. */
+
+/* Returns TRUE if the host's IPs are cached and haven't expired yet. The
+   returned ips are valid until the next dns_cache_update() or
+   dns_cache_remove() call. */
+bool dns_cache_lookup(const char *host, const struct ip_addr **ips_r,
+		      unsigned int *ips_count_r, struct timeval *expires_r);
+/* Cache the host's IPs for ttl_msecs, replacing any existing entry. */
+void dns_cache_update(const char *host, const struct ip_addr *ips,
+		      unsigned int ips_count, unsigned int ttl_msecs);
+/* Remove the host from the cache. */
+void dns_cache_remove(const char *host);
+
+/* Free all the cached lookups. This is also called automatically at
+   exit. */
+void dns_cache_deinit(void);
+
+#endif
@@ -0,0 +1,68 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "time-util.h"
+#include "test-common.h"
+#include "dns-cache.h"
+
+static void test_dns_cache(void)
+{
+	const struct ip_addr *ips;
+	struct ip_addr ip[2];
+	struct timeval expires, now;
+	unsigned int ips_count;
+
+	test_begin("dns cache");
+	test_assert(net_addr2ip("127.0.0.1", &ip[0]) == 0);
+	test_assert(net_addr2ip("::1", &ip[1]) == 0);
+
+	test_assert(!dns_cache_lookup("example.com", &ips, &ips_count,
+				      &expires));
+	dns_cache_update("example.com", ip, 2, 1000);
+	test_assert(dns_cache_lookup("EXAMPLE.com", &ips, &ips_count,
+				     &expires));
+	test_assert(ips_count == 2);
+	test_assert(net_ip_compare(&ips[0], &ip[0]));
+	test_assert(net_ip_compare(&ips[1], &ip[1]));
+	test_assert(timeval_diff_msecs(&expires, &ioloop_timeval) == 1000);
+
+	/* replace */
+	dns_cache_update("example.com", ip + 1, 1, 1000);
+	test_assert(dns_cache_lookup("example.com", &ips, &ips_count,
+				     &expires));
+	test_assert(ips_count == 1 && net_ip_compare(&ips[0], &ip[1]));
+
+	/* expire */
+	now = ioloop_timeval;
+	timeval_add_msecs(&ioloop_timeval, 1000);
+	test_assert(!dns_cache_lookup("example.com", &ips, &ips_count,
+				      &expires));
+	ioloop_timeval = now;
+	test_assert(!dns_cache_lookup("example.com", &ips, &ips_count,
+				      &expires));
+
+	/* remove */
+	dns_cache_update("example.org", ip, 1, 1000);
+	dns_cache_remove("example.org");
+	test_assert(!dns_cache_lookup("example.org", &ips, &ips_count,
+				      &expires));
+
+	/* 0 TTL isn't cached */
+	dns_cache_update("example.net", ip, 1, 0);
+	test_assert(!dns_cache_lookup("example.net", &ips, &ips_count,
+				      &expires));
+
+	dns_cache_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_dns_cache,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -61,6 +61,7 @@ struct doveadm_client {
 	enum doveadm_client_reply_state state;
 
 	bool destroyed:1;
+	bool keep_open:1;
 	bool authenticate_sent:1;
 	bool authenticated:1;
 	bool ssl_done:1;
@@ -101,6 +102,7 @@ void doveadm_client_settings_dup(const struct doveadm_client_settings *src,
 	}
 
 	dest_r->log_passthrough = src->log_passthrough;
+	dest_r->dsync_keep_connection = src->dsync_keep_connection;
 }
 
 static void doveadm_client_set_print_pending(struct doveadm_client *conn)
@@ -379,6 +381,10 @@ static void doveadm_client_authenticated(struct doveadm_client *conn)
 	if (conn->set.log_passthrough &&
 	    conn->conn.minor_version >= DOVEADM_PROTOCOL_MIN_VERSION_LOG_PASSTHROUGH)
 		o_stream_nsend_str(conn->conn.output, "\t\tOPTION\tlog-passthrough\n");
+	if (doveadm_client_is_dsync_connection_kept(conn)) {
+		o_stream_nsend_str(conn->conn.output,
+				   "\t\tOPTION\tdsync-keep-connection\n");
+	}
 
 	if (conn->delayed_cmd != NULL) {
 		doveadm_client_send_cmd(conn, conn->delayed_cmd,
@@ -430,8 +436,10 @@ static void doveadm_client_input(struct connection *_conn)
 	const char *line;
 
 	if (i_stream_read(conn->conn.input) < 0) {
-		/* disconnected */
-		doveadm_client_log_disconnect_error(conn);
+		/* disconnected - after the handshake the error is given to
+		   the command callback */
+		if (!conn->authenticated)
+			doveadm_client_log_disconnect_error(conn);
 		doveadm_client_destroy(&conn);
 		return;
 	}
@@ -547,6 +555,17 @@ static bool doveadm_client_input_one(struct doveadm_client *conn)
 			return FALSE;
 		}
 		if (conn->callback == NULL) {
+			if (conn->conn.input == NULL) {
+				/* iostreams were extracted */
+				return FALSE;
+			}
+			if (conn->keep_open) {
+				/* wait for the next command */
+				connection_input_halt(&conn->conn);
+				io_remove(&conn->io_log);
+				doveadm_client_unref(&conn);
+				return FALSE;
+			}
 			/* we're finished, close the connection */
 			doveadm_client_destroy(&conn);
 			return FALSE;
@@ -946,6 +965,15 @@ void doveadm_client_cmd(struct doveadm_client *conn,
 	conn->context = context;
 	/* doveadm_client_destroy() will be called to unreference */
 	conn->refcount++;
+
+	if (conn->keep_open && conn->conn.io == NULL) {
+		/* input was halted while the connection was idle */
+		if (conn->log_input != NULL) {
+			conn->io_log = io_add_istream(conn->log_input,
+				doveadm_client_print_log, conn);
+		}
+		connection_input_resume(&conn->conn);
+	}
 }
 
 void doveadm_client_extract(struct doveadm_client *conn,
@@ -966,10 +994,63 @@ void doveadm_client_extract(struct doveadm_client *conn,
 	conn->conn.output = NULL;
 	conn->ssl_iostream = NULL;
 	io_remove(&conn->conn.io);
+	io_remove(&conn->io_log);
 	conn->conn.fd_in = -1;
 	conn->conn.fd_out = -1;
 }
 
+void doveadm_client_restore(struct doveadm_client *conn,
+			    struct istream *istream,
+			    struct istream *log_istream,
+			    struct ostream *ostream,
+			    struct ssl_iostream *ssl_iostream,
+			    doveadm_client_cmd_callback_t *callback,
+			    void *context)
+{
+	i_assert(conn->conn.input == NULL);
+	i_assert(conn->callback == NULL);
+	i_assert(!conn->destroyed);
+
+	conn->conn.input = istream;
+	conn->conn.output = ostream;
+	conn->conn.fd_in = i_stream_get_fd(istream);
+	conn->conn.fd_out = o_stream_get_fd(ostream);
+	conn->log_input = log_istream;
+	conn->ssl_iostream = ssl_iostream;
+	o_stream_set_flush_callback(conn->conn.output,
+				    doveadm_client_output, conn);
+
+	/* the command's reply follows the extracted data */
+	conn->state = DOVEADM_CLIENT_REPLY_STATE_PRINT;
+	conn->callback = callback;
+	conn->context = context;
+	conn->keep_open = TRUE;
+
+	if (conn->log_input != NULL) {
+		conn->io_log = io_add_istream(conn->log_input,
+					      doveadm_client_print_log, conn);
+	}
+	connection_input_resume(&conn->conn);
+}
+
+bool doveadm_client_is_dsync_connection_kept(struct doveadm_client *conn)
+{
+	return conn->set.dsync_keep_connection &&
+		conn->conn.minor_version >=
+		DOVEADM_PROTOCOL_MIN_VERSION_DSYNC_KEEP_CONNECTION;
+}
+
+void doveadm_client_switch_ioloop(struct doveadm_client *conn)
+{
+	connection_switch_ioloop(&conn->conn);
+	if (conn->io_log != NULL)
+		conn->io_log = io_loop_move_io(&conn->io_log);
+	if (conn->log_input != NULL)
+		i_stream_switch_ioloop(conn->log_input);
+	if (conn->to_destroy != NULL)
+		conn->to_destroy = io_loop_move_timeout(&conn->to_destroy);
+}
+
 unsigned int doveadm_clients_count(void)
 {
 	return doveadm_clients == NULL ? 0 : doveadm_clients->connections_count;
@@ -53,6 +53,9 @@ struct doveadm_client_settings {
 
 	/* Enable receiving logs from the server */
 	bool log_passthrough;
+	/* Ask the server to keep the connection open after a successful
+	   dsync-server command, so it can be used for more commands. */
+	bool dsync_keep_connection;
 };
 
 struct doveadm_client_cmd_settings {
@@ -93,12 +96,30 @@ void doveadm_client_cmd(struct doveadm_client *conn,
 			doveadm_client_cmd_callback_t *callback, void *context);
 
 /* Extract iostreams from connection. Afterwards the doveadm_client simply
-   waits for itself to be destroyed. */
+   waits for itself to be destroyed, unless the iostreams are given back with
+   doveadm_client_restore(). */
 void doveadm_client_extract(struct doveadm_client *conn,
 			    struct istream **istream_r,
 			    struct istream **log_istream_r,
 			    struct ostream **ostream_r,
 			    struct ssl_iostream **ssl_iostream_r);
+/* Give the iostreams extracted with doveadm_client_extract() back to the
+   connection and wait for the reply to the command that was running. The
+   connection is kept open after the reply, so more commands can be sent to
+   it. It's closed when the last reference is dropped. */
+void doveadm_client_restore(struct doveadm_client *conn,
+			    struct istream *istream,
+			    struct istream *log_istream,
+			    struct ostream *ostream,
+			    struct ssl_iostream *ssl_iostream,
+			    doveadm_client_cmd_callback_t *callback,
+			    void *context);
+/* Returns TRUE if the server was asked to keep the connection open after
+   dsync-server (see dsync_keep_connection setting) and it supports it. */
+bool doveadm_client_is_dsync_connection_kept(struct doveadm_client *conn);
+
+/* Move the connection's I/O handlers to the current ioloop. */
+void doveadm_client_switch_ioloop(struct doveadm_client *conn);
 
 unsigned int doveadm_clients_count(void);
 void doveadm_clients_destroy_all(void);
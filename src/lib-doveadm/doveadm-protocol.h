@@ -2,9 +2,9 @@
 #define DOVEADM_PROTOCOL_H
 
 #define DOVEADM_SERVER_PROTOCOL_VERSION_MAJOR 1
-#define DOVEADM_SERVER_PROTOCOL_VERSION_MINOR 3
-#define DOVEADM_SERVER_PROTOCOL_VERSION_LINE "VERSION\tdoveadm-server\t1\t3"
-#define DOVEADM_CLIENT_PROTOCOL_VERSION_LINE "VERSION\tdoveadm-client\t1\t3"
+#define DOVEADM_SERVER_PROTOCOL_VERSION_MINOR 4
+#define DOVEADM_SERVER_PROTOCOL_VERSION_LINE "VERSION\tdoveadm-server\t1\t4"
+#define DOVEADM_CLIENT_PROTOCOL_VERSION_LINE "VERSION\tdoveadm-client\t1\t4"
 #define DOVEADM_TCP_CONNECT_TIMEOUT_SECS 30
 #define DOVEADM_HANDSHAKE_TIMEOUT_SECS 5
 
@@ -12,6 +12,7 @@
 #define DOVEADM_PROTOCOL_MIN_VERSION_STARTTLS 2
 #define DOVEADM_PROTOCOL_MIN_VERSION_LOG_PASSTHROUGH 3
 #define DOVEADM_PROTOCOL_MIN_VERSION_EXTRA_FIELDS 3
+#define DOVEADM_PROTOCOL_MIN_VERSION_DSYNC_KEEP_CONNECTION 4
 
 #define DOVEADM_EX_NOTFOUND EX_NOHOST
 #define DOVEADM_EX_NOTPOSSIBLE EX_DATAERR
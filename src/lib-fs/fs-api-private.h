@@ -81,6 +81,9 @@ struct fs_vfuncs {
 
 	bool (*switch_ioloop)(struct fs *fs);
 	int (*get_nlinks)(struct fs_file *file, nlink_t *nlinks_r);
+	/* Optional. If NULL, delete_file() is called for each file. */
+	int (*delete_multi)(struct fs_file *const files[], unsigned int count,
+			    int errors_r[]);
 };
 
 struct fs {
@@ -169,8 +172,10 @@ struct fs_iter {
 extern const struct fs fs_class_dict;
 extern const struct fs fs_class_posix;
 extern const struct fs fs_class_randomfail;
+extern const struct fs fs_class_cache;
 extern const struct fs fs_class_metawrap;
 extern const struct fs fs_class_sis;
+extern const struct fs fs_class_sis_chunk;
 extern const struct fs fs_class_sis_queue;
 extern const struct fs fs_class_test;
 
@@ -195,6 +200,8 @@ int fs_get_metadata_full(struct fs_file *file,
 const char *fs_metadata_find(const ARRAY_TYPE(fs_metadata) *metadata,
 			     const char *key);
 int fs_default_copy(struct fs_file *src, struct fs_file *dest);
+int fs_default_delete_multi(struct fs_file *const files[], unsigned int count,
+			    int errors_r[]);
 
 void fs_file_timing_end(struct fs_file *file, enum fs_op op);
 
@@ -87,8 +87,10 @@ static void fs_classes_init(void)
 	fs_class_register(&fs_class_dict);
 	fs_class_register(&fs_class_posix);
 	fs_class_register(&fs_class_randomfail);
+	fs_class_register(&fs_class_cache);
 	fs_class_register(&fs_class_metawrap);
 	fs_class_register(&fs_class_sis);
+	fs_class_register(&fs_class_sis_chunk);
 	fs_class_register(&fs_class_sis_queue);
 	fs_class_register(&fs_class_test);
 	lib_atexit(fs_classes_deinit);
@@ -1223,6 +1225,71 @@ int fs_delete(struct fs_file *file)
 	return ret;
 }
 
+int fs_default_delete_multi(struct fs_file *const files[], unsigned int count,
+			    int errors_r[])
+{
+	unsigned int i, pending_count;
+	int ret;
+
+	for (i = 0; i < count; i++)
+		errors_r[i] = EAGAIN;
+	/* start all the deletes before waiting for any of them, so async
+	   backends can run them in parallel */
+	do {
+		pending_count = 0;
+		for (i = 0; i < count; i++) {
+			if (errors_r[i] != EAGAIN)
+				continue;
+			T_BEGIN {
+				ret = files[i]->fs->v.delete_file(files[i]);
+			} T_END;
+			if (ret == 0)
+				errors_r[i] = 0;
+			else {
+				errors_r[i] = errno;
+				if (errno == EAGAIN)
+					pending_count++;
+			}
+		}
+		if (pending_count > 0)
+			fs_wait_async(files[0]->fs);
+	} while (pending_count > 0);
+
+	ret = 0;
+	for (i = 0; i < count; i++) {
+		if (errors_r[i] != 0)
+			ret = -1;
+	}
+	return ret;
+}
+
+int fs_delete_multi(struct fs_file *const files[], unsigned int count,
+		    int errors_r[])
+{
+	struct fs *fs;
+	unsigned int i;
+	int ret;
+
+	if (count == 0)
+		return 0;
+	fs = files[0]->fs;
+	for (i = 0; i < count; i++) {
+		i_assert(files[i]->fs == fs);
+		fs_file_timing_start(files[i], FS_OP_DELETE);
+	}
+	T_BEGIN {
+		if (fs->v.delete_multi != NULL)
+			ret = fs->v.delete_multi(files, count, errors_r);
+		else
+			ret = fs_default_delete_multi(files, count, errors_r);
+	} T_END;
+	for (i = 0; i < count; i++) {
+		fs->stats.delete_count++;
+		fs_file_timing_end(files[i], FS_OP_DELETE);
+	}
+	return ret;
+}
+
 struct fs_iter *
 fs_iter_init(struct fs *fs, const char *path, enum fs_iter_flags flags)
 {
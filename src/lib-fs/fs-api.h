@@ -338,6 +338,15 @@ bool fs_switch_ioloop(struct fs *fs) ATTR_NOWARN_UNUSED_RESULT;
 int fs_exists(struct fs_file *file);
 /* Delete a file. Returns 0 if file was actually deleted by us, -1 if error. */
 int fs_delete(struct fs_file *file);
+/* Delete multiple files from the same fs as a batch. Backends may delete
+   them in parallel or with a single request. Files opened with
+   FS_OPEN_FLAG_ASYNC are deleted in parallel even if the backend has no
+   batch delete. This waits until all the deletes are finished. errors_r[i]
+   is set to 0 if files[i] was deleted, or to errno if it failed (the error
+   is available via fs_file_last_error()). Returns 0 if all files were
+   deleted, -1 if any of them failed. */
+int fs_delete_multi(struct fs_file *const files[], unsigned int count,
+		    int errors_r[]);
 
 /* Returns 0 if ok, -1 if error occurred (e.g. errno=ENOENT).
    All fs backends may not support all stat fields. */
@@ -0,0 +1,806 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "strnum.h"
+#include "str-parse.h"
+#include "sha1.h"
+#include "hex-binary.h"
+#include "byteorder.h"
+#include "mkdir-parents.h"
+#include "write-full.h"
+#include "istream-private.h"
+#include "ostream-private.h"
+#include "fs-api-private.h"
+
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+/* Read-through cache for slow (remote) parent filesystems:
+
+   cache:path=<dir>,size=<max size>:<parent driver>:<parent args>
+
+   Files read or written via the fs are stored in the cache directory. The
+   cached files are evicted in least recently used order when the cache
+   grows larger than the max size. The cache files are never fsynced.
+   Instead each file has a trailer containing its size, which is verified
+   before the file is used. Only a single process fills a cache file at a
+   time. Others read from the parent fs meanwhile. */
+
+#define FS_CACHE_TRAILER_MAGIC "DCfsCch1"
+#define FS_CACHE_TRAILER_MAGIC_LEN 8
+#define FS_CACHE_TRAILER_SIZE (FS_CACHE_TRAILER_MAGIC_LEN + 8)
+/* Temp files older than this are left over from crashed processes */
+#define FS_CACHE_FILL_STALE_SECS (10*60)
+/* Update cache file's mtime on access only if it's older than this */
+#define FS_CACHE_MTIME_UPDATE_SECS 60
+/* When evicting, shrink the cache to this percentage of the max size */
+#define FS_CACHE_EVICT_TARGET_PERCENT 90
+#define FS_CACHE_TEMP_SUFFIX ".tmp"
+
+struct cache_fs {
+	struct fs fs;
+	char *cache_dir;
+	uoff_t max_size;
+	/* Estimated size of the cache, UOFF_T_MAX if it hasn't been
+	   scanned yet. Other processes may be adding files as well, so this
+	   is just an estimate until the next scan. */
+	uoff_t cur_size;
+};
+
+struct cache_fs_fill {
+	struct cache_fs *fs;
+	struct event *event;
+	char *temp_path;
+	int fd;
+	uoff_t size;
+};
+
+struct cache_fs_file {
+	struct fs_file file;
+	struct cache_fs *fs;
+	struct ostream *super_output;
+	struct cache_fs_fill *write_fill;
+};
+
+struct cache_istream {
+	struct istream_private istream;
+	struct cache_fs_fill *fill;
+	char *cache_path;
+	uoff_t high_offset;
+};
+
+struct cache_ostream {
+	struct ostream_private ostream;
+	struct cache_fs_fill *fill;
+};
+
+struct cache_fs_entry {
+	const char *path;
+	time_t mtime;
+	uoff_t size;
+};
+ARRAY_DEFINE_TYPE(cache_fs_entry, struct cache_fs_entry);
+
+#define CACHE_FS(ptr)	container_of((ptr), struct cache_fs, fs)
+#define CACHE_FILE(ptr)	container_of((ptr), struct cache_fs_file, file)
+
+static struct fs *fs_cache_alloc(void)
+{
+	struct cache_fs *fs;
+
+	fs = i_new(struct cache_fs, 1);
+	fs->fs = fs_class_cache;
+	fs->cur_size = UOFF_T_MAX;
+	return &fs->fs;
+}
+
+static int
+fs_cache_parse_params(struct cache_fs *fs, const char *params,
+		      const char **error_r)
+{
+	const char *const *tmp, *key, *value, *error;
+
+	for (tmp = t_strsplit_spaces(params, ","); *tmp != NULL; tmp++) {
+		key = *tmp;
+		value = strchr(key, '=');
+		if (value == NULL) {
+			*error_r = "Missing '='";
+			return -1;
+		}
+		key = t_strdup_until(key, value++);
+		if (strcmp(key, "path") == 0) {
+			i_free(fs->cache_dir);
+			fs->cache_dir = i_strdup(value);
+		} else if (strcmp(key, "size") == 0) {
+			if (str_parse_get_size(value, &fs->max_size,
+					       &error) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid size '%s': %s", value, error);
+				return -1;
+			}
+		} else {
+			*error_r = t_strdup_printf("Unknown key '%s'", key);
+			return -1;
+		}
+	}
+	if (fs->cache_dir == NULL) {
+		*error_r = "path parameter missing";
+		return -1;
+	}
+	if (fs->max_size == 0) {
+		*error_r = "size parameter missing";
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fs_cache_init(struct fs *_fs, const char *args, const struct fs_settings *set,
+	      const char **error_r)
+{
+	struct cache_fs *fs = CACHE_FS(_fs);
+	const char *p, *parent_name, *parent_args, *error;
+
+	p = strchr(args, ':');
+	if (p == NULL) {
+		*error_r = "Cache parameters missing";
+		return -1;
+	}
+	if (fs_cache_parse_params(fs, t_strdup_until(args, p), &error) < 0) {
+		*error_r = t_strdup_printf(
+			"Invalid cache parameters: %s", error);
+		return -1;
+	}
+	args = p + 1;
+
+	if (*args == '\0') {
+		*error_r = "Parent filesystem not given as parameter";
+		return -1;
+	}
+	parent_args = strchr(args, ':');
+	if (parent_args == NULL) {
+		parent_name = args;
+		parent_args = "";
+	} else {
+		parent_name = t_strdup_until(args, parent_args);
+		parent_args++;
+	}
+	return fs_init(parent_name, parent_args, set, &_fs->parent, error_r);
+}
+
+static void fs_cache_free(struct fs *_fs)
+{
+	struct cache_fs *fs = CACHE_FS(_fs);
+
+	i_free(fs->cache_dir);
+	i_free(fs);
+}
+
+static const char *fs_cache_get_path(struct cache_fs *fs, const char *path)
+{
+	unsigned char digest[SHA1_RESULTLEN];
+	const char *hex;
+
+	sha1_get_digest(path, strlen(path), digest);
+	hex = binary_to_hex(digest, sizeof(digest));
+	return t_strdup_printf("%s/%c%c/%s", fs->cache_dir,
+			       hex[0], hex[1], hex + 2);
+}
+
+static int fs_cache_entry_cmp(const struct cache_fs_entry *e1,
+			      const struct cache_fs_entry *e2)
+{
+	if (e1->mtime < e2->mtime)
+		return -1;
+	if (e1->mtime > e2->mtime)
+		return 1;
+	return 0;
+}
+
+static void
+fs_cache_scan_subdir(struct cache_fs *fs, const char *dir,
+		     ARRAY_TYPE(cache_fs_entry) *entries, uoff_t *total_r)
+{
+	struct cache_fs_entry *entry;
+	struct dirent *d;
+	struct stat st;
+	const char *path;
+	size_t len;
+	DIR *dirp;
+
+	dirp = opendir(dir);
+	if (dirp == NULL) {
+		if (errno != ENOENT)
+			e_error(fs->fs.event, "opendir(%s) failed: %m", dir);
+		return;
+	}
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		path = t_strconcat(dir, "/", d->d_name, NULL);
+		if (lstat(path, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+		len = strlen(d->d_name);
+		if (len > strlen(FS_CACHE_TEMP_SUFFIX) &&
+		    strcmp(d->d_name + len - strlen(FS_CACHE_TEMP_SUFFIX),
+			   FS_CACHE_TEMP_SUFFIX) == 0) {
+			/* another process is filling the file */
+			if (st.st_mtime < ioloop_time - FS_CACHE_FILL_STALE_SECS)
+				i_unlink_if_exists(path);
+			continue;
+		}
+		entry = array_append_space(entries);
+		entry->path = path;
+		entry->mtime = st.st_mtime;
+		entry->size = st.st_size;
+		*total_r += st.st_size;
+	}
+	if (closedir(dirp) < 0)
+		e_error(fs->fs.event, "closedir(%s) failed: %m", dir);
+}
+
+/* Scan the cache directory to find its current size and evict the least
+   recently used files if it's over the max size. */
+static void fs_cache_scan(struct cache_fs *fs)
+{
+	ARRAY_TYPE(cache_fs_entry) entries;
+	const struct cache_fs_entry *entry;
+	struct dirent *d;
+	uoff_t total = 0, target_size;
+	DIR *dirp;
+
+	dirp = opendir(fs->cache_dir);
+	if (dirp == NULL) {
+		e_error(fs->fs.event, "opendir(%s) failed: %m", fs->cache_dir);
+		return;
+	}
+	t_array_init(&entries, 256);
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.' || strlen(d->d_name) != 2)
+			continue;
+		fs_cache_scan_subdir(fs, t_strconcat(fs->cache_dir, "/",
+						     d->d_name, NULL),
+				     &entries, &total);
+	}
+	if (closedir(dirp) < 0)
+		e_error(fs->fs.event, "closedir(%s) failed: %m", fs->cache_dir);
+
+	if (total > fs->max_size) {
+		target_size = fs->max_size / 100 *
+			FS_CACHE_EVICT_TARGET_PERCENT;
+		array_sort(&entries, fs_cache_entry_cmp);
+		array_foreach(&entries, entry) {
+			if (total <= target_size)
+				break;
+			if (i_unlink_if_exists(entry->path) >= 0)
+				total -= entry->size;
+		}
+	}
+	fs->cur_size = total;
+}
+
+static struct istream *
+fs_cache_open(struct cache_fs *fs, const char *cache_path,
+	      size_t max_buffer_size)
+{
+	unsigned char trailer[FS_CACHE_TRAILER_SIZE];
+	struct istream *input, *limit_input;
+	struct stat st;
+	uoff_t size;
+	ssize_t ret;
+	int fd;
+
+	fd = open(cache_path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(fs->fs.event, "open(%s) failed: %m",
+				cache_path);
+		}
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		e_error(fs->fs.event, "fstat(%s) failed: %m", cache_path);
+		i_close_fd(&fd);
+		return NULL;
+	}
+	if (st.st_size < FS_CACHE_TRAILER_SIZE) {
+		ret = 0;
+	} else {
+		ret = pread(fd, trailer, sizeof(trailer),
+			    st.st_size - FS_CACHE_TRAILER_SIZE);
+		if (ret < 0) {
+			e_error(fs->fs.event, "pread(%s) failed: %m",
+				cache_path);
+			i_close_fd(&fd);
+			return NULL;
+		}
+	}
+	size = (uoff_t)st.st_size - FS_CACHE_TRAILER_SIZE;
+	if (ret != FS_CACHE_TRAILER_SIZE ||
+	    memcmp(trailer, FS_CACHE_TRAILER_MAGIC,
+		   FS_CACHE_TRAILER_MAGIC_LEN) != 0 ||
+	    be64_to_cpu_unaligned(trailer + FS_CACHE_TRAILER_MAGIC_LEN) != size) {
+		/* the file wasn't fully written (e.g. a crash before it was
+		   flushed to disk) */
+		e_warning(fs->fs.event,
+			  "Deleting corrupted cache file %s", cache_path);
+		i_close_fd(&fd);
+		i_unlink_if_exists(cache_path);
+		return NULL;
+	}
+	if (st.st_mtime < ioloop_time - FS_CACHE_MTIME_UPDATE_SECS) {
+		/* mark the file recently used for LRU eviction */
+		if (utime(cache_path, NULL) < 0 && errno != ENOENT)
+			e_error(fs->fs.event, "utime(%s) failed: %m",
+				cache_path);
+	}
+
+	input = i_stream_create_fd_autoclose(&fd, max_buffer_size);
+	limit_input = i_stream_create_limit(input, size);
+	i_stream_unref(&input);
+	i_stream_set_name(limit_input, cache_path);
+	return limit_input;
+}
+
+static struct cache_fs_fill *
+fs_cache_fill_begin(struct cache_fs *fs, struct event *event,
+		    const char *cache_path)
+{
+	struct cache_fs_fill *fill;
+	const char *temp_path, *p;
+	struct stat st;
+	unsigned int i;
+	int fd = -1;
+
+	temp_path = t_strconcat(cache_path, FS_CACHE_TEMP_SUFFIX, NULL);
+	for (i = 0; i < 2 && fd == -1; i++) {
+		fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+		if (fd != -1)
+			break;
+		if (errno == ENOENT) {
+			p = strrchr(temp_path, '/');
+			if (mkdir_parents(t_strdup_until(temp_path, p),
+					  0700) < 0 && errno != EEXIST) {
+				e_error(event, "mkdir_parents(%s) failed: %m",
+					t_strdup_until(temp_path, p));
+				return NULL;
+			}
+		} else if (errno == EEXIST) {
+			/* Someone else is already filling the cache file.
+			   Don't duplicate the work, unless it's stale. */
+			if (stat(temp_path, &st) < 0 ||
+			    st.st_mtime >= ioloop_time - FS_CACHE_FILL_STALE_SECS)
+				return NULL;
+			i_unlink_if_exists(temp_path);
+		} else {
+			e_error(event, "open(%s) failed: %m", temp_path);
+			return NULL;
+		}
+	}
+	if (fd == -1)
+		return NULL;
+
+	fill = i_new(struct cache_fs_fill, 1);
+	fill->fs = fs;
+	fill->event = event_create(event);
+	fill->temp_path = i_strdup(temp_path);
+	fill->fd = fd;
+	return fill;
+}
+
+static void fs_cache_fill_abort(struct cache_fs_fill **_fill)
+{
+	struct cache_fs_fill *fill = *_fill;
+
+	if (fill == NULL)
+		return;
+	*_fill = NULL;
+
+	i_close_fd(&fill->fd);
+	i_unlink_if_exists(fill->temp_path);
+	event_unref(&fill->event);
+	i_free(fill->temp_path);
+	i_free(fill);
+}
+
+static void
+fs_cache_fill_append(struct cache_fs_fill **_fill,
+		     const void *data, size_t size)
+{
+	struct cache_fs_fill *fill = *_fill;
+
+	if (write_full(fill->fd, data, size) < 0) {
+		if (!ENOSPACE(errno)) {
+			e_error(fill->event, "write(%s) failed: %m",
+				fill->temp_path);
+		}
+		fs_cache_fill_abort(_fill);
+		return;
+	}
+	fill->size += size;
+}
+
+static void
+fs_cache_fill_finish(struct cache_fs_fill **_fill, const char *cache_path)
+{
+	struct cache_fs_fill *fill = *_fill;
+	struct cache_fs *fs = fill->fs;
+	unsigned char trailer[FS_CACHE_TRAILER_SIZE];
+
+	memcpy(trailer, FS_CACHE_TRAILER_MAGIC, FS_CACHE_TRAILER_MAGIC_LEN);
+	cpu64_to_be_unaligned(fill->size, trailer + FS_CACHE_TRAILER_MAGIC_LEN);
+	fs_cache_fill_append(_fill, trailer, sizeof(trailer));
+	if (*_fill == NULL)
+		return;
+
+	/* no fsync() - the trailer is verified when opening the file */
+	if (close(fill->fd) < 0) {
+		e_error(fill->event, "close(%s) failed: %m", fill->temp_path);
+		fs_cache_fill_abort(_fill);
+		return;
+	}
+	fill->fd = -1;
+	if (rename(fill->temp_path, cache_path) < 0) {
+		e_error(fill->event, "rename(%s, %s) failed: %m",
+			fill->temp_path, cache_path);
+		fs_cache_fill_abort(_fill);
+		return;
+	}
+
+	if (fs->cur_size != UOFF_T_MAX)
+		fs->cur_size += fill->size + FS_CACHE_TRAILER_SIZE;
+	if (fs->cur_size == UOFF_T_MAX || fs->cur_size > fs->max_size)
+		fs_cache_scan(fs);
+
+	event_unref(&fill->event);
+	i_free(fill->temp_path);
+	i_free(fill);
+	*_fill = NULL;
+}
+
+static void fs_cache_invalidate(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	i_unlink_if_exists(fs_cache_get_path(file->fs, fs_file_path(_file)));
+}
+
+static ssize_t i_stream_cache_read(struct istream_private *stream)
+{
+	struct cache_istream *cstream =
+		container_of(stream, struct cache_istream, istream);
+	const unsigned char *data;
+	size_t size;
+	uoff_t skip;
+	ssize_t ret;
+
+	i_stream_seek(stream->parent, stream->parent_start_offset +
+		      stream->istream.v_offset);
+
+	ret = i_stream_read_copy_from_parent(&stream->istream);
+	if (ret > 0 && cstream->fill != NULL) {
+		data = i_stream_get_data(&stream->istream, &size);
+		i_assert(stream->istream.v_offset <= cstream->high_offset);
+		skip = cstream->high_offset - stream->istream.v_offset;
+		if (skip < size) {
+			cstream->high_offset += size - skip;
+			fs_cache_fill_append(&cstream->fill, data + skip,
+					     size - skip);
+		}
+	} else if (ret == -1 && cstream->fill != NULL) {
+		if (stream->istream.stream_errno != 0)
+			fs_cache_fill_abort(&cstream->fill);
+		else {
+			i_assert(cstream->high_offset ==
+				 stream->istream.v_offset +
+				 (stream->pos - stream->skip));
+			fs_cache_fill_finish(&cstream->fill,
+					     cstream->cache_path);
+		}
+	}
+	return ret;
+}
+
+static void
+i_stream_cache_seek(struct istream_private *stream,
+		    uoff_t v_offset, bool mark ATTR_UNUSED)
+{
+	struct cache_istream *cstream =
+		container_of(stream, struct cache_istream, istream);
+
+	if (v_offset > cstream->high_offset) {
+		/* skipping over data - can't cache the file */
+		fs_cache_fill_abort(&cstream->fill);
+	}
+	stream->istream.v_offset = v_offset;
+	stream->skip = stream->pos = 0;
+}
+
+static void i_stream_cache_close(struct iostream_private *stream,
+				 bool close_parent)
+{
+	struct cache_istream *cstream =
+		container_of(stream, struct cache_istream, istream.iostream);
+
+	/* closed before reaching EOF */
+	fs_cache_fill_abort(&cstream->fill);
+	if (close_parent)
+		i_stream_close(cstream->istream.parent);
+}
+
+static void i_stream_cache_destroy(struct iostream_private *stream)
+{
+	struct cache_istream *cstream =
+		container_of(stream, struct cache_istream, istream.iostream);
+
+	fs_cache_fill_abort(&cstream->fill);
+	i_free(cstream->cache_path);
+	i_stream_free_buffer(&cstream->istream);
+	i_stream_unref(&cstream->istream.parent);
+}
+
+static struct istream *
+i_stream_create_cache(struct istream *input, struct cache_fs_fill *fill,
+		      const char *cache_path)
+{
+	struct cache_istream *cstream;
+
+	cstream = i_new(struct cache_istream, 1);
+	cstream->fill = fill;
+	cstream->cache_path = i_strdup(cache_path);
+	cstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	cstream->istream.stream_size_passthrough = TRUE;
+
+	cstream->istream.read = i_stream_cache_read;
+	cstream->istream.seek = i_stream_cache_seek;
+	cstream->istream.iostream.close = i_stream_cache_close;
+	cstream->istream.iostream.destroy = i_stream_cache_destroy;
+
+	cstream->istream.istream.readable_fd = FALSE;
+	cstream->istream.istream.blocking = input->blocking;
+	cstream->istream.istream.seekable = input->seekable;
+	return i_stream_create(&cstream->istream, input,
+			       i_stream_get_fd(input), 0);
+}
+
+static ssize_t
+o_stream_cache_sendv(struct ostream_private *stream,
+		     const struct const_iovec *iov, unsigned int iov_count)
+{
+	struct cache_ostream *cstream =
+		container_of(stream, struct cache_ostream, ostream);
+	unsigned int i;
+	size_t left, size;
+	ssize_t ret;
+
+	if ((ret = o_stream_sendv(stream->parent, iov, iov_count)) < 0) {
+		o_stream_copy_error_from_parent(stream);
+		return -1;
+	}
+
+	/* write to the cache only what the parent accepted */
+	left = ret;
+	for (i = 0; i < iov_count && left > 0 && cstream->fill != NULL; i++) {
+		size = I_MIN(left, iov[i].iov_len);
+		fs_cache_fill_append(&cstream->fill, iov[i].iov_base, size);
+		left -= size;
+	}
+	stream->ostream.offset += ret;
+	return ret;
+}
+
+static struct ostream *
+o_stream_create_cache(struct ostream *output, struct cache_fs_fill *fill)
+{
+	struct cache_ostream *cstream;
+
+	cstream = i_new(struct cache_ostream, 1);
+	cstream->fill = fill;
+	cstream->ostream.sendv = o_stream_cache_sendv;
+	return o_stream_create(&cstream->ostream, output,
+			       o_stream_get_fd(output));
+}
+
+static enum fs_properties fs_cache_get_properties(struct fs *_fs)
+{
+	return fs_get_properties(_fs->parent);
+}
+
+static struct fs_file *fs_cache_file_alloc(void)
+{
+	struct cache_fs_file *file = i_new(struct cache_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_cache_file_init(struct fs_file *_file, const char *path,
+		   enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	file->file.path = i_strdup(path);
+	file->fs = CACHE_FS(_file->fs);
+	file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+}
+
+static void fs_cache_file_deinit(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	fs_cache_fill_abort(&file->write_fill);
+	fs_file_free(_file);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static bool fs_cache_prefetch(struct fs_file *_file, uoff_t length)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct stat st;
+
+	if (stat(fs_cache_get_path(file->fs, fs_file_path(_file)), &st) == 0)
+		return TRUE;
+	return fs_prefetch(_file->parent, length);
+}
+
+static struct istream *
+fs_cache_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct cache_fs_fill *fill;
+	struct istream *input, *cache_input;
+	const char *cache_path;
+
+	cache_path = fs_cache_get_path(file->fs, fs_file_path(_file));
+	input = fs_cache_open(file->fs, cache_path, max_buffer_size);
+	if (input != NULL)
+		return input;
+
+	input = fs_read_stream(_file->parent, max_buffer_size);
+	if (input->stream_errno != 0)
+		return input;
+	fill = fs_cache_fill_begin(file->fs, _file->event, cache_path);
+	if (fill == NULL)
+		return input;
+	cache_input = i_stream_create_cache(input, fill, cache_path);
+	i_stream_unref(&input);
+	return cache_input;
+}
+
+static void fs_cache_write_stream(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	const char *cache_path;
+
+	i_assert(_file->output == NULL);
+
+	cache_path = fs_cache_get_path(file->fs, fs_file_path(_file));
+	i_unlink_if_exists(cache_path);
+
+	file->super_output = fs_write_stream(_file->parent);
+	file->write_fill = fs_cache_fill_begin(file->fs, _file->event,
+					       cache_path);
+	if (file->write_fill == NULL)
+		_file->output = file->super_output;
+	else {
+		_file->output = o_stream_create_cache(file->super_output,
+						      file->write_fill);
+	}
+}
+
+static int fs_cache_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct cache_ostream *cstream;
+	int ret;
+
+	if (_file->output != NULL) {
+		if (_file->output->closed)
+			success = FALSE;
+		if (_file->output == file->super_output)
+			_file->output = NULL;
+		else {
+			/* the fill may have been aborted by a write error */
+			cstream = container_of(_file->output->real_stream,
+					       struct cache_ostream, ostream);
+			if (cstream->fill == NULL)
+				fs_cache_fill_abort(&file->write_fill);
+			o_stream_unref(&_file->output);
+		}
+	}
+	if (!success) {
+		fs_cache_fill_abort(&file->write_fill);
+		if (file->super_output != NULL)
+			fs_write_stream_abort_parent(_file, &file->super_output);
+		return -1;
+	}
+
+	if (file->super_output != NULL)
+		ret = fs_write_stream_finish(_file->parent, &file->super_output);
+	else
+		ret = fs_write_stream_finish_async(_file->parent);
+	if (ret < 0)
+		fs_cache_fill_abort(&file->write_fill);
+	else if (ret > 0 && file->write_fill != NULL) {
+		/* the path may have changed with FS_METADATA_WRITE_FNAME */
+		fs_cache_fill_finish(&file->write_fill,
+			fs_cache_get_path(file->fs, fs_file_path(_file)));
+	}
+	return ret;
+}
+
+static int fs_cache_copy(struct fs_file *src, struct fs_file *dest)
+{
+	fs_cache_invalidate(dest);
+	return fs_wrapper_copy(src, dest);
+}
+
+static int fs_cache_rename(struct fs_file *src, struct fs_file *dest)
+{
+	fs_cache_invalidate(src);
+	fs_cache_invalidate(dest);
+	return fs_wrapper_rename(src, dest);
+}
+
+static int fs_cache_delete(struct fs_file *file)
+{
+	fs_cache_invalidate(file);
+	return fs_wrapper_delete(file);
+}
+
+static int
+fs_cache_delete_multi(struct fs_file *const files[], unsigned int count,
+		      int errors_r[])
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		fs_cache_invalidate(files[i]);
+	return fs_wrapper_delete_multi(files, count, errors_r);
+}
+
+const struct fs fs_class_cache = {
+	.name = "cache",
+	.v = {
+		.alloc = fs_cache_alloc,
+		.init = fs_cache_init,
+		.deinit = NULL,
+		.free = fs_cache_free,
+		.get_properties = fs_cache_get_properties,
+		.file_alloc = fs_cache_file_alloc,
+		.file_init = fs_cache_file_init,
+		.file_deinit = fs_cache_file_deinit,
+		.file_close = fs_wrapper_file_close,
+		.get_path = fs_wrapper_file_get_path,
+		.set_async_callback = fs_wrapper_set_async_callback,
+		.wait_async = fs_wrapper_wait_async,
+		.set_metadata = fs_wrapper_set_metadata,
+		.get_metadata = fs_wrapper_get_metadata,
+		.prefetch = fs_cache_prefetch,
+		.read = NULL,
+		.read_stream = fs_cache_read_stream,
+		.write = NULL,
+		.write_stream = fs_cache_write_stream,
+		.write_stream_finish = fs_cache_write_stream_finish,
+		.lock = fs_wrapper_lock,
+		.unlock = fs_wrapper_unlock,
+		.exists = fs_wrapper_exists,
+		.stat = fs_wrapper_stat,
+		.copy = fs_cache_copy,
+		.rename = fs_cache_rename,
+		.delete_file = fs_cache_delete,
+		.iter_alloc = fs_wrapper_iter_alloc,
+		.iter_init = fs_wrapper_iter_init,
+		.iter_next = fs_wrapper_iter_next,
+		.iter_deinit = fs_wrapper_iter_deinit,
+		.switch_ioloop = NULL,
+		.get_nlinks = fs_wrapper_get_nlinks,
+		.delete_multi = fs_cache_delete_multi,
+	}
+};
@@ -12,6 +12,7 @@
 #include "file-lock.h"
 #include "file-dotlock.h"
 #include "time-util.h"
+#include "hash.h"
 #include "fs-api-private.h"
 
 #include <stdio.h>
@@ -855,10 +856,9 @@ static int fs_posix_rename(struct fs_file *_src, struct fs_file *_dest)
 	return 0;
 }
 
-static int fs_posix_delete(struct fs_file *_file)
+static int fs_posix_unlink(struct posix_fs_file *file)
 {
-	struct posix_fs_file *file =
-		container_of(_file, struct posix_fs_file, file);
+	struct fs_file *_file = &file->file;
 
 	if (unlink(file->full_path) < 0) {
 		if (!UNLINK_EISDIR(errno)) {
@@ -874,10 +874,59 @@ static int fs_posix_delete(struct fs_file *_file)
 			return -1;
 		}
 	}
+	return 0;
+}
+
+static int fs_posix_delete(struct fs_file *_file)
+{
+	struct posix_fs_file *file =
+		container_of(_file, struct posix_fs_file, file);
+
+	if (fs_posix_unlink(file) < 0)
+		return -1;
 	(void)fs_posix_rmdir_parents(file, file->full_path);
 	return 0;
 }
 
+static int
+fs_posix_delete_multi(struct fs_file *const files[], unsigned int count,
+		      int errors_r[])
+{
+	HASH_TABLE(const char *, struct posix_fs_file *) dirs;
+	struct hash_iterate_context *iter;
+	struct posix_fs_file *file;
+	const char *dir, *p;
+	unsigned int i;
+	int ret = 0;
+
+	/* Try to rmdir() each parent directory only once, instead of after
+	   each unlink(). Most of the files are usually in the same
+	   directories. */
+	hash_table_create(&dirs, pool_datastack_create(), 0, str_hash, strcmp);
+	for (i = 0; i < count; i++) {
+		file = container_of(files[i], struct posix_fs_file, file);
+		if (fs_posix_unlink(file) < 0) {
+			errors_r[i] = errno;
+			ret = -1;
+			continue;
+		}
+		errors_r[i] = 0;
+		p = strrchr(file->full_path, '/');
+		if (p == NULL)
+			continue;
+		dir = t_strdup_until(file->full_path, p);
+		if (hash_table_lookup(dirs, dir) == NULL)
+			hash_table_insert(dirs, dir, file);
+	}
+
+	iter = hash_table_iterate_init(dirs);
+	while (hash_table_iterate(iter, dirs, &dir, &file))
+		(void)fs_posix_rmdir_parents(file, file->full_path);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&dirs);
+	return ret;
+}
+
 static struct fs_iter *fs_posix_iter_alloc(void)
 {
 	struct posix_fs_iter *iter = i_new(struct posix_fs_iter, 1);
@@ -1026,5 +1075,6 @@ const struct fs fs_class_posix = {
 		.iter_deinit = fs_posix_iter_deinit,
 		.switch_ioloop = NULL,
 		.get_nlinks = NULL,
+		.delete_multi = fs_posix_delete_multi,
 	}
 };
@@ -0,0 +1,800 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "str-parse.h"
+#include "hash.h"
+#include "sha2.h"
+#include "hex-binary.h"
+#include "istream.h"
+#include "istream-concat.h"
+#include "istream-sized.h"
+#include "istream-fs-file.h"
+#include "ostream-private.h"
+#include "fs-sis-chunker.h"
+#include "fs-api-private.h"
+
+#include <sys/stat.h>
+
+/* Chunk-level single instance storage:
+
+   sis-chunk:dir=<chunk dir>[,avg_size=<size>]:<parent driver>:<args>
+
+   Files are split into variable sized chunks with content-defined chunking.
+   Each chunk is stored once in the chunk index at <chunk dir>/<xx>/<sha256>.
+   The file itself is written as a manifest listing its chunks. Each file
+   has a <path>.refs/<sha256> hard link to each of its chunks. The link
+   count of the chunk index file is then its reference count, and the file's
+   data stays readable even if the chunk index file is removed.
+
+   Files that aren't manifests (e.g. written before sis-chunk was enabled)
+   are accessed as-is. */
+
+#define FS_SIS_CHUNK_REQUIRED_PROPS \
+	(FS_PROPERTY_FASTCOPY | FS_PROPERTY_STAT)
+#define FS_SIS_CHUNK_MANIFEST_MAGIC "SIS-CHUNKS 1 "
+#define FS_SIS_CHUNK_REFS_SUFFIX ".refs"
+#define FS_SIS_CHUNK_HASH_HEX_LEN (SHA256_RESULTLEN*2)
+
+struct sis_chunk_fs {
+	struct fs fs;
+	char *chunk_dir;
+	size_t avg_size;
+};
+
+struct sis_chunk_entry {
+	const char *hash;
+	uoff_t size;
+};
+ARRAY_DEFINE_TYPE(sis_chunk_entry, struct sis_chunk_entry);
+
+struct sis_chunk_fs_file {
+	struct fs_file file;
+	struct sis_chunk_fs *fs;
+	enum fs_open_mode open_mode;
+	enum fs_open_flags open_flags;
+
+	/* while writing: */
+	struct sis_chunker *chunker;
+	buffer_t *chunk_buf;
+	string_t *manifest;
+	uoff_t total_size;
+	/* chunk hashes referenced by the file written so far */
+	pool_t refs_pool;
+	HASH_TABLE(char *, void *) refs;
+	bool write_failed;
+};
+
+struct sis_chunk_ostream {
+	struct ostream_private ostream;
+	struct sis_chunk_fs_file *file;
+};
+
+#define SIS_CHUNK_FS(ptr)	container_of((ptr), struct sis_chunk_fs, fs)
+#define SIS_CHUNK_FILE(ptr)	container_of((ptr), struct sis_chunk_fs_file, file)
+
+static struct fs *fs_sis_chunk_alloc(void)
+{
+	struct sis_chunk_fs *fs;
+
+	fs = i_new(struct sis_chunk_fs, 1);
+	fs->fs = fs_class_sis_chunk;
+	fs->avg_size = SIS_CHUNKER_DEFAULT_AVG_SIZE;
+	return &fs->fs;
+}
+
+static int
+fs_sis_chunk_parse_params(struct sis_chunk_fs *fs, const char *params,
+			  const char **error_r)
+{
+	const char *const *tmp, *key, *value, *error;
+	uoff_t size;
+
+	for (tmp = t_strsplit_spaces(params, ","); *tmp != NULL; tmp++) {
+		key = *tmp;
+		value = strchr(key, '=');
+		if (value == NULL) {
+			*error_r = "Missing '='";
+			return -1;
+		}
+		key = t_strdup_until(key, value++);
+		if (strcmp(key, "dir") == 0) {
+			i_free(fs->chunk_dir);
+			fs->chunk_dir = i_strdup(value);
+		} else if (strcmp(key, "avg_size") == 0) {
+			if (str_parse_get_size(value, &size, &error) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid avg_size '%s': %s", value, error);
+				return -1;
+			}
+			if (size < 1024 || size > 16*1024*1024 ||
+			    (size & (size - 1)) != 0) {
+				*error_r = t_strdup_printf(
+					"Invalid avg_size '%s': "
+					"Must be a power of 2 between 1k and 16M",
+					value);
+				return -1;
+			}
+			fs->avg_size = size;
+		} else {
+			*error_r = t_strdup_printf("Unknown key '%s'", key);
+			return -1;
+		}
+	}
+	if (fs->chunk_dir == NULL) {
+		*error_r = "dir parameter missing";
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fs_sis_chunk_init(struct fs *_fs, const char *args,
+		  const struct fs_settings *set, const char **error_r)
+{
+	struct sis_chunk_fs *fs = SIS_CHUNK_FS(_fs);
+	enum fs_properties props;
+	const char *p, *parent_name, *parent_args, *error;
+
+	p = strchr(args, ':');
+	if (p == NULL) {
+		*error_r = "Chunk parameters missing";
+		return -1;
+	}
+	if (fs_sis_chunk_parse_params(fs, t_strdup_until(args, p),
+				      &error) < 0) {
+		*error_r = t_strdup_printf("Invalid chunk parameters: %s",
+					   error);
+		return -1;
+	}
+	args = p + 1;
+
+	if (*args == '\0') {
+		*error_r = "Parent filesystem not given as parameter";
+		return -1;
+	}
+	parent_args = strchr(args, ':');
+	if (parent_args == NULL) {
+		parent_name = args;
+		parent_args = "";
+	} else {
+		parent_name = t_strdup_until(args, parent_args);
+		parent_args++;
+	}
+	if (fs_init(parent_name, parent_args, set, &_fs->parent, error_r) < 0)
+		return -1;
+	props = fs_get_properties(_fs->parent);
+	if ((props & FS_SIS_CHUNK_REQUIRED_PROPS) != FS_SIS_CHUNK_REQUIRED_PROPS) {
+		*error_r = t_strdup_printf("%s backend can't be used with SIS",
+					   parent_name);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_sis_chunk_free(struct fs *_fs)
+{
+	struct sis_chunk_fs *fs = SIS_CHUNK_FS(_fs);
+
+	i_free(fs->chunk_dir);
+	i_free(fs);
+}
+
+static const char *
+fs_sis_chunk_get_index_path(struct sis_chunk_fs *fs, const char *hash)
+{
+	return t_strdup_printf("%s/%c%c/%s", fs->chunk_dir,
+			       hash[0], hash[1], hash);
+}
+
+static const char *
+fs_sis_chunk_get_ref_path(const char *path, const char *hash)
+{
+	return t_strdup_printf("%s"FS_SIS_CHUNK_REFS_SUFFIX"/%s", path, hash);
+}
+
+static struct fs_file *fs_sis_chunk_file_alloc(void)
+{
+	struct sis_chunk_fs_file *file = i_new(struct sis_chunk_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_sis_chunk_file_init(struct fs_file *_file, const char *path,
+		       enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct sis_chunk_fs_file *file = SIS_CHUNK_FILE(_file);
+
+	file->file.path = i_strdup(path);
+	file->fs = SIS_CHUNK_FS(_file->fs);
+	file->open_mode = mode;
+	file->open_flags = flags;
+	file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+	if (mode == FS_OPEN_MODE_APPEND)
+		fs_set_error(_file->event, ENOTSUP, "APPEND mode not supported");
+}
+
+static void fs_sis_chunk_write_state_free(struct sis_chunk_fs_file *file)
+{
+	if (file->chunker != NULL)
+		sis_chunker_deinit(&file->chunker);
+	buffer_free(&file->chunk_buf);
+	str_free(&file->manifest);
+	hash_table_destroy(&file->refs);
+	pool_unref(&file->refs_pool);
+}
+
+static void fs_sis_chunk_file_deinit(struct fs_file *_file)
+{
+	struct sis_chunk_fs_file *file = SIS_CHUNK_FILE(_file);
+
+	fs_sis_chunk_write_state_free(file);
+	fs_file_free(_file);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+/* Parse the manifest from the beginning of the input. Returns 1 if the
+   manifest was parsed, 0 if the file isn't a manifest or -1 if the read
+   failed. */
+static int
+fs_sis_chunk_manifest_parse(struct fs_file *file, struct istream *input,
+			    ARRAY_TYPE(sis_chunk_entry) *entries_r,
+			    uoff_t *total_size_r)
+{
+	struct sis_chunk_entry *entry;
+	const unsigned char *data;
+	const char *line, *p;
+	uoff_t total_size = 0;
+	size_t size;
+	int ret;
+
+	ret = i_stream_read_bytes(input, &data, &size,
+				  strlen(FS_SIS_CHUNK_MANIFEST_MAGIC));
+	if (ret < 0 && input->stream_errno != 0) {
+		fs_set_error(file->event, input->stream_errno, "read(%s) failed: %s",
+			     i_stream_get_name(input),
+			     i_stream_get_error(input));
+		return -1;
+	}
+	if (ret <= 0 || memcmp(data, FS_SIS_CHUNK_MANIFEST_MAGIC,
+			       strlen(FS_SIS_CHUNK_MANIFEST_MAGIC)) != 0)
+		return 0;
+
+	t_array_init(entries_r, 16);
+	line = i_stream_read_next_line(input);
+	if (line == NULL ||
+	    str_to_uoff(line + strlen(FS_SIS_CHUNK_MANIFEST_MAGIC),
+			total_size_r) < 0)
+		goto corrupted;
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		p = strchr(line, ' ');
+		if (p == NULL || p - line != FS_SIS_CHUNK_HASH_HEX_LEN)
+			goto corrupted;
+		entry = array_append_space(entries_r);
+		entry->hash = t_strdup_until(line, p);
+		if (str_to_uoff(p + 1, &entry->size) < 0)
+			goto corrupted;
+		total_size += entry->size;
+	}
+	if (input->stream_errno != 0) {
+		fs_set_error(file->event, input->stream_errno, "read(%s) failed: %s",
+			     i_stream_get_name(input),
+			     i_stream_get_error(input));
+		return -1;
+	}
+	if (total_size != *total_size_r)
+		goto corrupted;
+	return 1;
+
+corrupted:
+	if (input->stream_errno != 0) {
+		fs_set_error(file->event, input->stream_errno, "read(%s) failed: %s",
+			     i_stream_get_name(input),
+			     i_stream_get_error(input));
+	} else {
+		fs_set_error(file->event, EIO, "Corrupted chunk manifest %s",
+			     i_stream_get_name(input));
+	}
+	return -1;
+}
+
+static int
+fs_sis_chunk_manifest_read(struct fs_file *_file,
+			   ARRAY_TYPE(sis_chunk_entry) *entries_r,
+			   uoff_t *total_size_r)
+{
+	struct fs_file *manifest_file;
+	struct istream *input;
+	int ret;
+
+	/* Use a separate file, so the parent file's read stream isn't left
+	   at EOF for a later fs_read_stream() */
+	manifest_file = fs_file_init_parent(_file, _file->path,
+					    FS_OPEN_MODE_READONLY, 0);
+	input = fs_read_stream(manifest_file, IO_BLOCK_SIZE);
+	ret = fs_sis_chunk_manifest_parse(_file, input, entries_r,
+					  total_size_r);
+	i_stream_unref(&input);
+	fs_file_deinit(&manifest_file);
+	return ret;
+}
+
+/* Remove the file's reference to the chunk. If it was the last reference,
+   remove the chunk from the chunk index as well. */
+static void
+fs_sis_chunk_unref(struct fs_file *_file, const char *path, const char *hash)
+{
+	struct sis_chunk_fs_file *file = SIS_CHUNK_FILE(_file);
+	struct fs_file *ref_file, *index_file;
+	struct stat st1, st2;
+	bool last_ref = FALSE;
+
+	ref_file = fs_file_init_parent(_file, fs_sis_chunk_get_ref_path(path, hash),
+				       FS_OPEN_MODE_READONLY, 0);
+	index_file = fs_file_init_parent(_file,
+		fs_sis_chunk_get_index_path(file->fs, hash),
+		FS_OPEN_MODE_READONLY, 0);
+	if (fs_stat(ref_file, &st1) == 0 && st1.st_nlink == 2 &&
+	    fs_stat(index_file, &st2) == 0 &&
+	    st1.st_ino == st2.st_ino && CMP_DEV_T(st1.st_dev, st2.st_dev))
+		last_ref = TRUE;
+	if (fs_delete(ref_file) < 0 && errno != ENOENT)
+		e_error(_file->event, "%s", fs_file_last_error(ref_file));
+	else if (last_ref) {
+		/* If another file just linked to the chunk, it still has its
+		   own link to the data. The chunk just won't be deduplicated
+		   anymore. */
+		if (fs_delete(index_file) < 0 && errno != ENOENT) {
+			e_error(_file->event, "%s",
+				fs_file_last_error(index_file));
+		}
+	}
+	fs_file_deinit(&ref_file);
+	fs_file_deinit(&index_file);
+}
+
+/* Returns the entries with duplicate chunks removed. */
+static const ARRAY_TYPE(sis_chunk_entry) *
+fs_sis_chunk_entries_unique(const ARRAY_TYPE(sis_chunk_entry) *entries)
+{
+	ARRAY_TYPE(sis_chunk_entry) *unique;
+	const struct sis_chunk_entry *entry;
+	HASH_TABLE(const char *, void *) seen;
+
+	unique = t_new(ARRAY_TYPE(sis_chunk_entry), 1);
+	t_array_init(unique, array_count(entries));
+	hash_table_create(&seen, pool_datastack_create(), 0, str_hash, strcmp);
+	array_foreach(entries, entry) {
+		if (hash_table_lookup(seen, entry->hash) != NULL)
+			continue;
+		hash_table_insert(seen, entry->hash, POINTER_CAST(1));
+		array_push_back(unique, entry);
+	}
+	hash_table_destroy(&seen);
+	return unique;
+}
+
+static void
+fs_sis_chunk_unref_all(struct fs_file *_file, const char *path,
+		       const ARRAY_TYPE(sis_chunk_entry) *entries)
+{
+	const struct sis_chunk_entry *entry;
+
+	array_foreach(fs_sis_chunk_entries_unique(entries), entry)
+		fs_sis_chunk_unref(_file, path, entry->hash);
+}
+
+static struct istream *
+fs_sis_chunk_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	ARRAY_TYPE(sis_chunk_entry) entries;
+	const struct sis_chunk_entry *entry;
+	ARRAY(struct istream *) streams;
+	struct istream *input, *ref_input, **streamp;
+	struct fs_file *ref_file;
+	uoff_t total_size;
+	int ret;
+
+	input = fs_read_stream(_file->parent, max_buffer_size);
+	ret = fs_sis_chunk_manifest_parse(_file, input, &entries, &total_size);
+	if (ret == 0) {
+		/* not a manifest - return the file as-is */
+		i_stream_seek(input, 0);
+		return input;
+	}
+	if (ret < 0) {
+		if (input->stream_errno != 0)
+			return input;
+		i_stream_unref(&input);
+		return i_stream_create_error_str(errno, "%s",
+						 fs_file_last_error(_file));
+	}
+	i_stream_unref(&input);
+
+	if (array_count(&entries) == 0) {
+		input = i_stream_create_from_data("", 0);
+		i_stream_set_name(input, _file->path);
+		return input;
+	}
+	t_array_init(&streams, array_count(&entries) + 1);
+	array_foreach(&entries, entry) {
+		ref_file = fs_file_init_parent(_file,
+			fs_sis_chunk_get_ref_path(_file->path, entry->hash),
+			FS_OPEN_MODE_READONLY, 0);
+		input = i_stream_create_fs_file(&ref_file, max_buffer_size);
+		ref_input = i_stream_create_sized(input, entry->size);
+		i_stream_unref(&input);
+		array_push_back(&streams, &ref_input);
+	}
+	array_append_zero(&streams);
+
+	input = i_stream_create_concat(array_front_modifiable(&streams));
+	array_foreach_modifiable(&streams, streamp) {
+		if (*streamp != NULL)
+			i_stream_unref(streamp);
+	}
+	i_stream_set_name(input, _file->path);
+	return input;
+}
+
+static int
+fs_sis_chunk_store(struct sis_chunk_fs_file *file,
+		   const void *data, size_t size)
+{
+	struct fs_file *_file = &file->file;
+	struct fs_file *ref_file, *index_file;
+	unsigned char digest[SHA256_RESULTLEN];
+	const char *hash, *ref_path, *index_path;
+	int ret = 0;
+
+	sha256_get_digest(data, size, digest);
+	hash = binary_to_hex(digest, sizeof(digest));
+	str_printfa(file->manifest, "%s %zu\n", hash, size);
+	file->total_size += size;
+	if (hash_table_lookup(file->refs, hash) != NULL) {
+		/* the same chunk was already seen in this file */
+		return 0;
+	}
+
+	ref_path = fs_sis_chunk_get_ref_path(_file->path, hash);
+	index_path = fs_sis_chunk_get_index_path(file->fs, hash);
+	ref_file = fs_file_init_parent(_file, ref_path,
+				       FS_OPEN_MODE_REPLACE, file->open_flags);
+	index_file = fs_file_init_parent(_file, index_path,
+					 FS_OPEN_MODE_READONLY, 0);
+	/* Chunks are identified by their SHA256 hash alone. Unlike with
+	   the full file SIS, the existing data isn't compared, since reading
+	   it back would cost about as much I/O as writing it. */
+	if (fs_copy(index_file, ref_file) < 0) {
+		if (errno != ENOENT) {
+			e_error(_file->event, "%s",
+				fs_file_last_error(index_file));
+		}
+		/* not in the chunk index yet */
+		if (fs_write(ref_file, data, size) < 0) {
+			fs_set_error(_file->event, errno, "%s",
+				     fs_file_last_error(ref_file));
+			ret = -1;
+		} else {
+			fs_file_deinit(&index_file);
+			index_file = fs_file_init_parent(_file, index_path,
+				FS_OPEN_MODE_CREATE, 0);
+			if (fs_copy(ref_file, index_file) < 0 &&
+			    errno != EEXIST) {
+				/* the chunk just can't be deduplicated */
+				e_error(_file->event, "%s",
+					fs_file_last_error(ref_file));
+			}
+		}
+	}
+	if (ret == 0) {
+		char *key = p_strdup(file->refs_pool, hash);
+		hash_table_insert(file->refs, key, POINTER_CAST(1));
+	}
+	fs_file_deinit(&ref_file);
+	fs_file_deinit(&index_file);
+	return ret;
+}
+
+static int fs_sis_chunk_store_buffer(struct sis_chunk_fs_file *file)
+{
+	int ret;
+
+	if (file->chunk_buf->used == 0)
+		return 0;
+	T_BEGIN {
+		ret = fs_sis_chunk_store(file, file->chunk_buf->data,
+					 file->chunk_buf->used);
+	} T_END;
+	buffer_set_used_size(file->chunk_buf, 0);
+	return ret;
+}
+
+static ssize_t
+o_stream_sis_chunk_sendv(struct ostream_private *stream,
+			 const struct const_iovec *iov, unsigned int iov_count)
+{
+	struct sis_chunk_ostream *cstream =
+		container_of(stream, struct sis_chunk_ostream, ostream);
+	struct sis_chunk_fs_file *file = cstream->file;
+	const unsigned char *data;
+	size_t size, n, total = 0;
+	unsigned int i;
+	bool boundary;
+
+	for (i = 0; i < iov_count; i++) {
+		data = iov[i].iov_base;
+		size = iov[i].iov_len;
+		while (size > 0) {
+			n = sis_chunker_feed(file->chunker, data, size,
+					     &boundary);
+			buffer_append(file->chunk_buf, data, n);
+			data += n;
+			size -= n;
+			if (boundary && fs_sis_chunk_store_buffer(file) < 0) {
+				file->write_failed = TRUE;
+				io_stream_set_error(&stream->iostream, "%s",
+						    fs_file_last_error(&file->file));
+				stream->ostream.stream_errno = errno;
+				return -1;
+			}
+		}
+		total += iov[i].iov_len;
+	}
+	stream->ostream.offset += total;
+	return total;
+}
+
+static struct ostream *
+o_stream_create_sis_chunk(struct sis_chunk_fs_file *file)
+{
+	struct sis_chunk_ostream *cstream;
+	struct ostream *output;
+
+	cstream = i_new(struct sis_chunk_ostream, 1);
+	cstream->file = file;
+	cstream->ostream.sendv = o_stream_sis_chunk_sendv;
+	output = o_stream_create(&cstream->ostream, NULL, -1);
+	o_stream_set_name(output, file->file.path);
+	return output;
+}
+
+static void fs_sis_chunk_write_stream(struct fs_file *_file)
+{
+	struct sis_chunk_fs_file *file = SIS_CHUNK_FILE(_file);
+	size_t max_size;
+
+	i_assert(_file->output == NULL);
+
+	if (file->open_mode == FS_OPEN_MODE_APPEND) {
+		_file->output = o_stream_create_error_str(ENOTSUP,
+			"APPEND mode not supported");
+		o_stream_set_name(_file->output, _file->path);
+		return;
+	}
+
+	fs_sis_chunk_write_state_free(file);
+	file->chunker = sis_chunker_init(file->fs->avg_size);
+	max_size = sis_chunker_get_max_size(file->chunker);
+	file->chunk_buf = buffer_create_dynamic(default_pool, max_size);
+	file->manifest = str_new(default_pool, 256);
+	file->refs_pool = pool_alloconly_create("sis chunk refs", 1024);
+	hash_table_create(&file->refs, file->refs_pool, 0, str_hash, strcmp);
+	file->total_size = 0;
+	file->write_failed = FALSE;
+
+	_file->output = o_stream_create_sis_chunk(file);
+}
+
+static void fs_sis_chunk_write_abort(struct sis_chunk_fs_file *file)
+{
+	struct hash_iterate_context *iter;
+	char *hash;
+	void *value;
+
+	if (!hash_table_is_created(file->refs))
+		return;
+	iter = hash_table_iterate_init(file->refs);
+	while (hash_table_iterate(iter, file->refs, &hash, &value)) T_BEGIN {
+		fs_sis_chunk_unref(&file->file, file->file.path, hash);
+	} T_END;
+	hash_table_iterate_deinit(&iter);
+	fs_sis_chunk_write_state_free(file);
+}
+
+static int
+fs_sis_chunk_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct sis_chunk_fs_file *file = SIS_CHUNK_FILE(_file);
+	string_t *manifest;
+	int ret;
+
+	if (_file->output != NULL) {
+		if (_file->output->closed || file->write_failed)
+			success = FALSE;
+		o_stream_unref(&_file->output);
+	}
+	if (success && file->manifest == NULL) {
+		/* APPEND mode */
+		success = FALSE;
+	}
+	if (success && fs_sis_chunk_store_buffer(file) < 0)
+		success = FALSE;
+	if (!success) {
+		fs_sis_chunk_write_abort(file);
+		return -1;
+	}
+
+	manifest = t_str_new(str_len(file->manifest) + 64);
+	str_printfa(manifest, FS_SIS_CHUNK_MANIFEST_MAGIC"%"PRIuUOFF_T"\n",
+		    file->total_size);
+	str_append_str(manifest, file->manifest);
+	ret = fs_write(_file->parent, str_data(manifest), str_len(manifest));
+	if (ret < 0) {
+		fs_sis_chunk_write_abort(file);
+		return -1;
+	}
+	fs_sis_chunk_write_state_free(file);
+	return 1;
+}
+
+static int fs_sis_chunk_stat(struct fs_file *_file, struct stat *st_r)
+{
+	ARRAY_TYPE(sis_chunk_entry) entries;
+	uoff_t total_size;
+
+	if (fs_stat(_file->parent, st_r) < 0)
+		return -1;
+	if (fs_sis_chunk_manifest_read(_file, &entries, &total_size) > 0)
+		st_r->st_size = total_size;
+	return 0;
+}
+
+static int
+fs_sis_chunk_copy_refs(struct fs_file *src, struct fs_file *dest,
+		       const ARRAY_TYPE(sis_chunk_entry) *entries)
+{
+	ARRAY_TYPE(sis_chunk_entry) done_entries;
+	const struct sis_chunk_entry *entry;
+	struct fs_file *src_ref, *dest_ref;
+	int ret = 0;
+
+	entries = fs_sis_chunk_entries_unique(entries);
+	t_array_init(&done_entries, array_count(entries));
+	array_foreach(entries, entry) {
+		src_ref = fs_file_init_parent(src,
+			fs_sis_chunk_get_ref_path(src->path, entry->hash),
+			FS_OPEN_MODE_READONLY, 0);
+		dest_ref = fs_file_init_parent(dest,
+			fs_sis_chunk_get_ref_path(dest->path, entry->hash),
+			FS_OPEN_MODE_REPLACE, 0);
+		if ((ret = fs_copy(src_ref, dest_ref)) < 0) {
+			fs_set_error(dest->event, errno, "%s",
+				     fs_file_last_error(src_ref));
+		} else {
+			array_push_back(&done_entries, entry);
+		}
+		fs_file_deinit(&src_ref);
+		fs_file_deinit(&dest_ref);
+		if (ret < 0)
+			break;
+	}
+	if (ret < 0)
+		fs_sis_chunk_unref_all(dest, dest->path, &done_entries);
+	return ret;
+}
+
+static int fs_sis_chunk_copy(struct fs_file *src, struct fs_file *dest)
+{
+	ARRAY_TYPE(sis_chunk_entry) entries;
+	uoff_t total_size;
+	int ret;
+
+	if (src == NULL)
+		return fs_wrapper_copy(src, dest);
+
+	ret = fs_sis_chunk_manifest_read(src, &entries, &total_size);
+	if (ret < 0) {
+		fs_set_error(dest->event, errno, "%s", fs_file_last_error(src));
+		return -1;
+	}
+	if (ret == 0)
+		return fs_wrapper_copy(src, dest);
+
+	if (fs_sis_chunk_copy_refs(src, dest, &entries) < 0)
+		return -1;
+	if (fs_wrapper_copy(src, dest) < 0) {
+		fs_sis_chunk_unref_all(dest, dest->path, &entries);
+		return -1;
+	}
+	return 0;
+}
+
+static int fs_sis_chunk_rename(struct fs_file *src, struct fs_file *dest)
+{
+	ARRAY_TYPE(sis_chunk_entry) entries;
+	uoff_t total_size;
+	int ret;
+
+	ret = fs_sis_chunk_manifest_read(src, &entries, &total_size);
+	if (ret < 0) {
+		fs_set_error(dest->event, errno, "%s", fs_file_last_error(src));
+		return -1;
+	}
+	if (ret > 0) {
+		/* The refs can't be renamed atomically with the manifest,
+		   so link them first and delete the old ones afterwards. */
+		if (fs_sis_chunk_copy_refs(src, dest, &entries) < 0)
+			return -1;
+	}
+	if (fs_wrapper_rename(src, dest) < 0) {
+		if (ret > 0)
+			fs_sis_chunk_unref_all(dest, dest->path, &entries);
+		return -1;
+	}
+	if (ret > 0) {
+		/* the chunks are now referenced by the dest refs, so this
+		   never removes them from the chunk index */
+		fs_sis_chunk_unref_all(src, src->path, &entries);
+	}
+	return 0;
+}
+
+static int fs_sis_chunk_delete(struct fs_file *_file)
+{
+	ARRAY_TYPE(sis_chunk_entry) entries;
+	uoff_t total_size;
+	int ret;
+
+	ret = fs_sis_chunk_manifest_read(_file, &entries, &total_size);
+	if (ret < 0 && errno != ENOENT)
+		return -1;
+	if (fs_delete(_file->parent) < 0)
+		return -1;
+	if (ret > 0)
+		fs_sis_chunk_unref_all(_file, _file->path, &entries);
+	return 0;
+}
+
+const struct fs fs_class_sis_chunk = {
+	.name = "sis-chunk",
+	.v = {
+		.alloc = fs_sis_chunk_alloc,
+		.init = fs_sis_chunk_init,
+		.deinit = NULL,
+		.free = fs_sis_chunk_free,
+		.get_properties = fs_wrapper_get_properties,
+		.file_alloc = fs_sis_chunk_file_alloc,
+		.file_init = fs_sis_chunk_file_init,
+		.file_deinit = fs_sis_chunk_file_deinit,
+		.file_close = fs_wrapper_file_close,
+		.get_path = fs_wrapper_file_get_path,
+		.set_async_callback = fs_wrapper_set_async_callback,
+		.wait_async = fs_wrapper_wait_async,
+		.set_metadata = fs_wrapper_set_metadata,
+		.get_metadata = fs_wrapper_get_metadata,
+		.prefetch = fs_wrapper_prefetch,
+		.read = NULL,
+		.read_stream = fs_sis_chunk_read_stream,
+		.write = NULL,
+		.write_stream = fs_sis_chunk_write_stream,
+		.write_stream_finish = fs_sis_chunk_write_stream_finish,
+		.lock = fs_wrapper_lock,
+		.unlock = fs_wrapper_unlock,
+		.exists = fs_wrapper_exists,
+		.stat = fs_sis_chunk_stat,
+		.copy = fs_sis_chunk_copy,
+		.rename = fs_sis_chunk_rename,
+		.delete_file = fs_sis_chunk_delete,
+		.iter_alloc = fs_wrapper_iter_alloc,
+		.iter_init = fs_wrapper_iter_init,
+		.iter_next = fs_wrapper_iter_next,
+		.iter_deinit = fs_wrapper_iter_deinit,
+		.switch_ioloop = NULL,
+		.get_nlinks = fs_wrapper_get_nlinks,
+	}
+};
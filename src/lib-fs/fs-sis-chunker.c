@@ -0,0 +1,103 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "fs-sis-chunker.h"
+
+/* Gear hash: each byte shifts the hash left by one bit and adds a random
+   value for the byte. So only the last 64 bytes affect the hash. */
+
+struct sis_chunker {
+	size_t min_size, max_size;
+	uint64_t mask;
+
+	size_t chunk_size;
+	uint64_t hash;
+};
+
+static uint64_t gear_table[256];
+static bool gear_table_initialized = FALSE;
+
+static void sis_chunker_gear_table_init(void)
+{
+	uint64_t state = 0x5d588b656c078965ULL, z;
+	unsigned int i;
+
+	/* The table must be the same for everybody, or the chunk boundaries
+	   won't match. Use splitmix64 with a fixed seed to generate it. */
+	for (i = 0; i < N_ELEMENTS(gear_table); i++) {
+		state += 0x9e3779b97f4a7c15ULL;
+		z = state;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear_table[i] = z ^ (z >> 31);
+	}
+	gear_table_initialized = TRUE;
+}
+
+struct sis_chunker *sis_chunker_init(size_t avg_size)
+{
+	struct sis_chunker *chunker;
+	unsigned int bits;
+
+	i_assert(avg_size >= 64 && (avg_size & (avg_size - 1)) == 0);
+
+	if (!gear_table_initialized)
+		sis_chunker_gear_table_init();
+
+	bits = bits_required64(avg_size) - 1;
+	chunker = i_new(struct sis_chunker, 1);
+	chunker->min_size = avg_size / 4;
+	chunker->max_size = avg_size * 4;
+	/* use the high bits, since the low bits are affected only by the
+	   most recent bytes */
+	chunker->mask = ((1ULL << bits) - 1) << (64 - bits);
+	return chunker;
+}
+
+void sis_chunker_deinit(struct sis_chunker **_chunker)
+{
+	struct sis_chunker *chunker = *_chunker;
+
+	*_chunker = NULL;
+	i_free(chunker);
+}
+
+size_t sis_chunker_feed(struct sis_chunker *chunker,
+			const unsigned char *data, size_t size,
+			bool *boundary_r)
+{
+	size_t i = 0, skip;
+	uint64_t hash = chunker->hash;
+
+	*boundary_r = FALSE;
+	if (chunker->chunk_size < chunker->min_size) {
+		/* boundaries aren't allowed before min_size, but the hash
+		   must cover the bytes right before it */
+		skip = chunker->min_size - chunker->chunk_size;
+		if (skip > 64) {
+			skip = I_MIN(skip - 64, size);
+			i += skip;
+			chunker->chunk_size += skip;
+		}
+	}
+	for (; i < size; i++) {
+		hash = (hash << 1) + gear_table[data[i]];
+		chunker->chunk_size++;
+		if (chunker->chunk_size < chunker->min_size)
+			continue;
+		if ((hash & chunker->mask) == 0 ||
+		    chunker->chunk_size >= chunker->max_size) {
+			*boundary_r = TRUE;
+			chunker->chunk_size = 0;
+			chunker->hash = 0;
+			return i + 1;
+		}
+	}
+	chunker->hash = hash;
+	return size;
+}
+
+size_t sis_chunker_get_max_size(struct sis_chunker *chunker)
+{
+	return chunker->max_size;
+}
@@ -0,0 +1,26 @@
+#ifndef FS_SIS_CHUNKER_H
+#define FS_SIS_CHUNKER_H
+
+/* Content-defined chunking: chunk boundaries are chosen by a rolling hash
+   over the data, so inserting or removing bytes only changes the chunks
+   near the modification. The rest of the chunks stay identical and can be
+   deduplicated. */
+
+#define SIS_CHUNKER_DEFAULT_AVG_SIZE (64*1024)
+
+/* avg_size must be a power of 2. Chunks are between avg_size/4 and
+   avg_size*4 bytes, except the last one may be smaller. */
+struct sis_chunker *sis_chunker_init(size_t avg_size);
+void sis_chunker_deinit(struct sis_chunker **chunker);
+
+/* Returns how many bytes of data belong to the current chunk. If the chunk
+   ends within the data, *boundary_r is set to TRUE and the next call starts
+   a new chunk. */
+size_t sis_chunker_feed(struct sis_chunker *chunker,
+			const unsigned char *data, size_t size,
+			bool *boundary_r);
+
+/* Returns the largest possible chunk size. */
+size_t sis_chunker_get_max_size(struct sis_chunker *chunker);
+
+#endif
@@ -133,6 +133,18 @@ int fs_wrapper_delete(struct fs_file *file)
 	return fs_delete(file->parent);
 }
 
+int fs_wrapper_delete_multi(struct fs_file *const files[], unsigned int count,
+			    int errors_r[])
+{
+	struct fs_file **parents;
+	unsigned int i;
+
+	parents = t_new(struct fs_file *, count);
+	for (i = 0; i < count; i++)
+		parents[i] = files[i]->parent;
+	return fs_delete_multi(parents, count, errors_r);
+}
+
 struct fs_iter *fs_wrapper_iter_alloc(void)
 {
 	struct wrapper_fs_iter *iter = i_new(struct wrapper_fs_iter, 1);
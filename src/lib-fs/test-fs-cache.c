@@ -0,0 +1,296 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "sha1.h"
+#include "hex-binary.h"
+#include "unlink-directory.h"
+#include "fs-api.h"
+#include "test-common.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fs-cache"
+#define TEST_PARENT_DIR TEST_DIR"/parent"
+#define TEST_CACHE_DIR TEST_DIR"/cache"
+#define TEST_TRAILER_SIZE 16
+
+static void test_dir_init(void)
+{
+	const char *error;
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+	if (mkdir(TEST_PARENT_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_PARENT_DIR);
+	if (mkdir(TEST_CACHE_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_CACHE_DIR);
+}
+
+static void test_dir_deinit(void)
+{
+	const char *error;
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+}
+
+static struct fs *test_fs_init(const char *size)
+{
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	i_zero(&fs_set);
+	if (fs_init("cache", t_strdup_printf(
+			"path=%s,size=%s:posix:prefix=%s/",
+			TEST_CACHE_DIR, size, TEST_PARENT_DIR),
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	return fs;
+}
+
+static const char *test_cache_path(const char *path)
+{
+	unsigned char digest[SHA1_RESULTLEN];
+	const char *hex;
+
+	sha1_get_digest(path, strlen(path), digest);
+	hex = binary_to_hex(digest, sizeof(digest));
+	return t_strdup_printf("%s/%c%c/%s", TEST_CACHE_DIR,
+			       hex[0], hex[1], hex + 2);
+}
+
+static void test_write_file(struct fs *fs, const char *path, const char *data)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, data, strlen(data)) == 0);
+	fs_file_deinit(&file);
+}
+
+static void test_write_parent(const char *path, const char *data)
+{
+	const char *parent_path = t_strdup_printf("%s/%s", TEST_PARENT_DIR, path);
+	int fd;
+
+	fd = open(parent_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", parent_path);
+	if (write(fd, data, strlen(data)) != (ssize_t)strlen(data))
+		i_fatal("write(%s) failed: %m", parent_path);
+	i_close_fd(&fd);
+}
+
+static void test_read_file(struct fs *fs, const char *path, const char *data)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *rdata;
+	size_t size;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	test_assert(i_stream_read_more(input, &rdata, &size) > 0 ||
+		    *data == '\0');
+	while (i_stream_read(input) > 0) ;
+	rdata = i_stream_get_data(input, &size);
+	test_assert(size == strlen(data) && memcmp(rdata, data, size) == 0);
+	test_assert(input->stream_errno == 0 && input->eof);
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+}
+
+static bool test_cache_exists(const char *path)
+{
+	struct stat st;
+
+	return stat(test_cache_path(path), &st) == 0 &&
+		st.st_size >= TEST_TRAILER_SIZE;
+}
+
+static void test_fs_cache_read(void)
+{
+	struct fs *fs;
+	const char *cache_path;
+
+	test_begin("fs cache read");
+	test_dir_init();
+	fs = test_fs_init("1M");
+
+	test_write_parent("file1", "hello world");
+	test_assert(!test_cache_exists("file1"));
+	test_read_file(fs, "file1", "hello world");
+	test_assert(test_cache_exists("file1"));
+
+	/* the cached copy is used even when the parent changes */
+	test_write_parent("file1", "changed");
+	test_read_file(fs, "file1", "hello world");
+
+	/* a cache file with a broken trailer is ignored and replaced */
+	cache_path = test_cache_path("file1");
+	test_assert(truncate(cache_path, 5) == 0);
+	test_expect_error_string("Deleting corrupted cache file");
+	test_read_file(fs, "file1", "changed");
+	test_expect_no_more_errors();
+	test_read_file(fs, "file1", "changed");
+	test_assert(test_cache_exists("file1"));
+
+	/* empty file */
+	test_write_parent("empty", "");
+	test_read_file(fs, "empty", "");
+	test_assert(test_cache_exists("empty"));
+	test_read_file(fs, "empty", "");
+
+	fs_deinit(&fs);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fs_cache_partial_read(void)
+{
+	struct fs *fs;
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+
+	test_begin("fs cache partial read");
+	test_dir_init();
+	fs = test_fs_init("1M");
+
+	/* stream closed before EOF doesn't leave a cache file behind */
+	test_write_parent("file1", "hello world");
+	file = fs_file_init(fs, "file1", FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, 4);
+	test_assert(i_stream_read_more(input, &data, &size) > 0);
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	test_assert(!test_cache_exists("file1"));
+	test_assert(access(t_strconcat(test_cache_path("file1"), ".tmp",
+				       NULL), F_OK) < 0);
+
+	/* another process is already filling the cache */
+	test_read_file(fs, "file1", "hello world");
+	test_assert(rename(test_cache_path("file1"),
+			   t_strconcat(test_cache_path("file1"), ".tmp",
+				       NULL)) == 0);
+	test_read_file(fs, "file1", "hello world");
+	test_assert(!test_cache_exists("file1"));
+
+	fs_deinit(&fs);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fs_cache_write(void)
+{
+	struct fs *fs;
+	struct fs_file *src, *dest;
+
+	test_begin("fs cache write");
+	test_dir_init();
+	fs = test_fs_init("1M");
+
+	test_write_file(fs, "file1", "written data");
+	test_assert(test_cache_exists("file1"));
+	test_read_file(fs, "file1", "written data");
+
+	/* rewriting replaces the cached file */
+	test_write_file(fs, "file1", "rewritten");
+	test_read_file(fs, "file1", "rewritten");
+
+	/* copying and renaming invalidate the destination */
+	test_write_file(fs, "file2", "file2 data");
+	src = fs_file_init(fs, "file1", FS_OPEN_MODE_READONLY);
+	dest = fs_file_init(fs, "file2", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_copy(src, dest) == 0);
+	fs_file_deinit(&src);
+	fs_file_deinit(&dest);
+	test_assert(!test_cache_exists("file2"));
+	test_read_file(fs, "file2", "rewritten");
+
+	src = fs_file_init(fs, "file2", FS_OPEN_MODE_READONLY);
+	dest = fs_file_init(fs, "file3", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_rename(src, dest) == 0);
+	fs_file_deinit(&src);
+	fs_file_deinit(&dest);
+	test_assert(!test_cache_exists("file2"));
+
+	/* deleting removes the cached file */
+	src = fs_file_init(fs, "file1", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(src) == 0);
+	fs_file_deinit(&src);
+	test_assert(!test_cache_exists("file1"));
+
+	fs_deinit(&fs);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fs_cache_evict(void)
+{
+	struct fs *fs;
+	struct utimbuf ut;
+	const char *name;
+	char data[101];
+	unsigned int i;
+
+	test_begin("fs cache evict");
+	test_dir_init();
+	ioloop_time = time(NULL);
+	/* room for 4 files of 100+16 bytes */
+	fs = test_fs_init("500");
+
+	memset(data, 'x', sizeof(data)-1);
+	data[sizeof(data)-1] = '\0';
+	for (i = 0; i < 4; i++) {
+		name = t_strdup_printf("file%u", i);
+		test_write_file(fs, name, data);
+		test_assert_idx(test_cache_exists(name), i);
+		/* make the files' LRU order deterministic */
+		ut.actime = ut.modtime = ioloop_time - 1000 + i;
+		test_assert(utime(test_cache_path(name), &ut) == 0);
+	}
+	/* accessing file0 makes it the most recently used */
+	test_read_file(fs, "file0", data);
+
+	/* adding another file evicts file1 and file2 (down to 90%) */
+	test_write_file(fs, "file4", data);
+	test_assert(test_cache_exists("file0"));
+	test_assert(!test_cache_exists("file1"));
+	test_assert(!test_cache_exists("file2"));
+	test_assert(test_cache_exists("file3"));
+	test_assert(test_cache_exists("file4"));
+
+	/* the evicted files are still readable from the parent */
+	test_read_file(fs, "file1", data);
+	test_assert(test_cache_exists("file1"));
+
+	fs_deinit(&fs);
+	test_dir_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_cache_read,
+		test_fs_cache_partial_read,
+		test_fs_cache_write,
+		test_fs_cache_evict,
+		NULL
+	};
+	return test_run(test_functions);
+}
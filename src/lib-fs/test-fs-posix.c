@@ -125,6 +125,25 @@ static void test_fs_posix(void)
 	fs_file_deinit(&file);
 	test_end();
 
+	struct fs_file *files[3];
+	int errors[3];
+	test_begin("test-fs-posix file delete multi");
+	files[0] = fs_file_init(fs, "subdir/rename1", FS_OPEN_MODE_READONLY);
+	files[1] = fs_file_init(fs, "subdir/missing", FS_OPEN_MODE_READONLY);
+	files[2] = fs_file_init(fs, "subdir/rename2", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete_multi(files, N_ELEMENTS(files), errors) == -1);
+	test_assert(errors[0] == 0);
+	test_assert(errors[1] == ENOENT);
+	test_assert(strstr(fs_file_last_error(files[1]),
+			   "No such file or directory") != NULL);
+	test_assert(errors[2] == 0);
+	test_assert(fs_exists(files[0]) == 0);
+	test_assert(fs_exists(files[2]) == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(files); i++)
+		fs_file_deinit(&files[i]);
+	test_assert(fs_delete_multi(files, 0, errors) == 0);
+	test_end();
+
 	fs_deinit(&fs);
 
 error_no_fs:
@@ -0,0 +1,307 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "istream.h"
+#include "randgen.h"
+#include "unlink-directory.h"
+#include "fs-api.h"
+#include "fs-sis-chunker.h"
+#include "test-common.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fs-sis-chunk"
+#define TEST_CHUNK_DIR TEST_DIR"/chunks"
+#define TEST_AVG_SIZE 1024
+
+static void test_dir_init(void)
+{
+	const char *error;
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+}
+
+static void test_dir_deinit(void)
+{
+	const char *error;
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+}
+
+static void test_random_data(buffer_t *buf, size_t size)
+{
+	random_fill(buffer_append_space_unsafe(buf, size), size);
+}
+
+/* Returns the chunks' sizes */
+static void
+test_chunk(struct sis_chunker *chunker, const buffer_t *buf,
+	   ARRAY_TYPE(uint64_t) *sizes)
+{
+	const unsigned char *data = buf->data;
+	size_t pos = 0, n, chunk_size = 0;
+	bool boundary;
+
+	while (pos < buf->used) {
+		/* feed in small pieces to test chunker state handling */
+		n = I_MIN(buf->used - pos, 100);
+		n = sis_chunker_feed(chunker, data + pos, n, &boundary);
+		pos += n;
+		chunk_size += n;
+		if (boundary) {
+			uint64_t size = chunk_size;
+			array_push_back(sizes, &size);
+			chunk_size = 0;
+		}
+	}
+	if (chunk_size > 0) {
+		uint64_t size = chunk_size;
+		array_push_back(sizes, &size);
+	}
+}
+
+static void test_sis_chunker(void)
+{
+	struct sis_chunker *chunker;
+	ARRAY_TYPE(uint64_t) sizes1, sizes2;
+	buffer_t *buf;
+	const uint64_t *size;
+	unsigned int i, count1, count2, same = 0;
+
+	test_begin("sis chunker");
+	buf = t_buffer_create(64*1024);
+	test_random_data(buf, 64*1024);
+
+	t_array_init(&sizes1, 64);
+	t_array_init(&sizes2, 64);
+	chunker = sis_chunker_init(TEST_AVG_SIZE);
+	test_chunk(chunker, buf, &sizes1);
+	sis_chunker_deinit(&chunker);
+
+	/* chunk sizes are within the limits */
+	array_foreach(&sizes1, size) {
+		test_assert(*size <= TEST_AVG_SIZE*4);
+		if (size != array_back(&sizes1))
+			test_assert(*size >= TEST_AVG_SIZE/4);
+	}
+	count1 = array_count(&sizes1);
+	test_assert(count1 > 64*1024 / (TEST_AVG_SIZE*4));
+
+	/* inserting data at the beginning keeps the rest of the
+	   boundaries */
+	buffer_insert(buf, 0, "inserted", 8);
+	chunker = sis_chunker_init(TEST_AVG_SIZE);
+	test_chunk(chunker, buf, &sizes2);
+	sis_chunker_deinit(&chunker);
+	count2 = array_count(&sizes2);
+	for (i = 1; i <= count1 && i <= count2; i++) {
+		if (array_idx_elem(&sizes1, count1 - i) ==
+		    array_idx_elem(&sizes2, count2 - i))
+			same++;
+	}
+	test_assert(same + 2 >= count1);
+	test_end();
+}
+
+static struct fs *test_fs_init(void)
+{
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	i_zero(&fs_set);
+	if (fs_init("sis-chunk", "dir="TEST_CHUNK_DIR",avg_size=1k:posix:",
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	return fs;
+}
+
+static void test_write_file(struct fs *fs, const char *path,
+			    const buffer_t *data)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, data->data, data->used) == 0);
+	fs_file_deinit(&file);
+}
+
+static void test_read_file(struct fs *fs, const char *path,
+			   const buffer_t *data)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *rdata;
+	struct stat st;
+	buffer_t *buf;
+	size_t size;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	test_assert(fs_stat(file, &st) == 0 &&
+		    (size_t)st.st_size == data->used);
+	buf = t_buffer_create(data->used);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &rdata, &size) > 0) {
+		buffer_append(buf, rdata, size);
+		i_stream_skip(input, size);
+	}
+	test_assert(input->stream_errno == 0);
+	test_assert(buffer_cmp(buf, data));
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+}
+
+static void test_delete_file(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+}
+
+static unsigned int test_count_chunks(void)
+{
+	DIR *dirp, *subdirp;
+	struct dirent *d, *d2;
+	unsigned int count = 0;
+
+	dirp = opendir(TEST_CHUNK_DIR);
+	if (dirp == NULL)
+		return 0;
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		subdirp = opendir(t_strconcat(TEST_CHUNK_DIR"/",
+					      d->d_name, NULL));
+		if (subdirp == NULL)
+			continue;
+		while ((d2 = readdir(subdirp)) != NULL) {
+			if (d2->d_name[0] != '.')
+				count++;
+		}
+		closedir(subdirp);
+	}
+	closedir(dirp);
+	return count;
+}
+
+static void test_fs_sis_chunk(void)
+{
+	struct fs *fs;
+	struct fs_file *src, *dest;
+	buffer_t *data1, *data2, *data3;
+	unsigned int count1, count2;
+
+	test_begin("fs sis-chunk");
+	test_dir_init();
+	fs = test_fs_init();
+
+	data1 = t_buffer_create(32*1024);
+	test_random_data(data1, 32*1024);
+	test_write_file(fs, TEST_DIR"/file1", data1);
+	test_read_file(fs, TEST_DIR"/file1", data1);
+	count1 = test_count_chunks();
+	test_assert(count1 > 1);
+
+	/* a slightly modified copy shares most of the chunks */
+	data2 = t_buffer_create(32*1024 + 4);
+	buffer_append_buf(data2, data1, 0, SIZE_MAX);
+	buffer_insert(data2, 16*1024, "mod!", 4);
+	test_write_file(fs, TEST_DIR"/file2", data2);
+	test_read_file(fs, TEST_DIR"/file2", data2);
+	count2 = test_count_chunks();
+	test_assert(count2 > count1 && count2 <= count1 + 3);
+
+	/* copy and rename keep the data readable */
+	src = fs_file_init(fs, TEST_DIR"/file2", FS_OPEN_MODE_READONLY);
+	dest = fs_file_init(fs, TEST_DIR"/file3", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_copy(src, dest) == 0);
+	fs_file_deinit(&src);
+	fs_file_deinit(&dest);
+	test_read_file(fs, TEST_DIR"/file3", data2);
+
+	src = fs_file_init(fs, TEST_DIR"/file3", FS_OPEN_MODE_READONLY);
+	dest = fs_file_init(fs, TEST_DIR"/file4", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_rename(src, dest) == 0);
+	fs_file_deinit(&src);
+	fs_file_deinit(&dest);
+	test_read_file(fs, TEST_DIR"/file4", data2);
+	test_assert(test_count_chunks() == count2);
+
+	/* deleting removes only the chunks that are no longer referenced */
+	test_delete_file(fs, TEST_DIR"/file1");
+	test_read_file(fs, TEST_DIR"/file2", data2);
+	test_assert(test_count_chunks() < count2);
+	test_delete_file(fs, TEST_DIR"/file2");
+	test_read_file(fs, TEST_DIR"/file4", data2);
+	test_delete_file(fs, TEST_DIR"/file4");
+	test_assert(test_count_chunks() == 0);
+
+	/* repeated chunks within a file */
+	data3 = t_buffer_create(32*1024);
+	buffer_append_zero(data3, 32*1024);
+	test_write_file(fs, TEST_DIR"/file5", data3);
+	test_read_file(fs, TEST_DIR"/file5", data3);
+	test_assert(test_count_chunks() <= 2);
+	test_delete_file(fs, TEST_DIR"/file5");
+	test_assert(test_count_chunks() == 0);
+
+	/* empty file */
+	buffer_set_used_size(data3, 0);
+	test_write_file(fs, TEST_DIR"/file6", data3);
+	test_read_file(fs, TEST_DIR"/file6", data3);
+	test_delete_file(fs, TEST_DIR"/file6");
+
+	fs_deinit(&fs);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fs_sis_chunk_plain_file(void)
+{
+	struct fs *fs, *posix_fs;
+	struct fs_settings fs_set;
+	const char *error;
+	buffer_t *data;
+
+	test_begin("fs sis-chunk plain file");
+	test_dir_init();
+	fs = test_fs_init();
+
+	/* files written without sis-chunk are read as-is */
+	i_zero(&fs_set);
+	if (fs_init("posix", "", &fs_set, &posix_fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	data = t_buffer_create(128);
+	buffer_append(data, "plain file contents", 19);
+	test_write_file(posix_fs, TEST_DIR"/plain", data);
+	fs_deinit(&posix_fs);
+
+	test_read_file(fs, TEST_DIR"/plain", data);
+	test_delete_file(fs, TEST_DIR"/plain");
+
+	fs_deinit(&fs);
+	test_dir_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_sis_chunker,
+		test_fs_sis_chunk,
+		test_fs_sis_chunk_plain_file,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -18,3 +18,26 @@ void fts_filter_truncate_token(string_t *token, size_t max_length)
 	str_truncate(token, len);
 	i_assert(len <= max_length);
 }
+
+bool fts_filter_ascii_lcase(string_t *dest, const char *token,
+			    bool remove_spaces)
+{
+	size_t i, len;
+
+	for (len = 0; token[len] != '\0'; len++) {
+		if ((unsigned char)token[len] >= 0x80)
+			return FALSE;
+	}
+
+	str_truncate(dest, 0);
+	unsigned char *p = buffer_append_space_unsafe(dest, len);
+	for (i = 0; i < len; i++) {
+		if (remove_spaces && token[i] == ' ')
+			continue;
+		/* not using tolower(), since it depends on the locale */
+		*p++ = token[i] >= 'A' && token[i] <= 'Z' ?
+			token[i] - 'A' + 'a' : token[i];
+	}
+	str_truncate(dest, p - str_data(dest));
+	return TRUE;
+}
@@ -2,5 +2,11 @@
 #define FTS_FILTER_COMMON_H
 
 void fts_filter_truncate_token(string_t *token, size_t max_length);
+/* If the token contains only ASCII characters, write it lowercased to dest
+   and return TRUE. If remove_spaces is TRUE, the spaces are dropped. Returns
+   FALSE without modifying dest if the token has non-ASCII characters. This
+   allows skipping the much slower Unicode handling for the common case. */
+bool fts_filter_ascii_lcase(string_t *dest, const char *token,
+			    bool remove_spaces);
 
 #endif
@@ -49,8 +49,10 @@ fts_filter_lowercase_filter(struct fts_filter *filter ATTR_UNUSED,
                             const char **error_r ATTR_UNUSED)
 {
 #ifdef HAVE_LIBICU
-	str_truncate(filter->token, 0);
-	fts_icu_lcase(filter->token, *token);
+	if (!fts_filter_ascii_lcase(filter->token, *token, FALSE)) {
+		str_truncate(filter->token, 0);
+		fts_icu_lcase(filter->token, *token);
+	}
 	fts_filter_truncate_token(filter->token, filter->max_length);
 	*token = str_c(filter->token);
 #else
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "mempool.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "unichar.h"
 #include "fts-icu.h"
@@ -12,6 +13,8 @@
 #include <unicode/uclean.h>
 
 static struct UCaseMap *icu_csm = NULL;
+/* id => transliterator */
+static HASH_TABLE(char *, UTransliterator *) icu_transliterators;
 
 static struct UCaseMap *fts_icu_csm(void)
 {
@@ -166,6 +169,20 @@ void fts_icu_lcase(string_t *dest_utf8, const char *src_utf8)
 
 void fts_icu_deinit(void)
 {
+	struct hash_iterate_context *iter;
+	UTransliterator *transliterator;
+	char *id;
+
+	if (hash_table_is_created(icu_transliterators)) {
+		iter = hash_table_iterate_init(icu_transliterators);
+		while (hash_table_iterate(iter, icu_transliterators,
+					  &id, &transliterator)) {
+			utrans_close(transliterator);
+			i_free(id);
+		}
+		hash_table_iterate_deinit(&iter);
+		hash_table_destroy(&icu_transliterators);
+	}
 	if (icu_csm != NULL) {
 		ucasemap_close(icu_csm);
 		icu_csm = NULL;
@@ -202,3 +219,25 @@ int fts_icu_transliterator_create(const char *id,
 	}
 	return 0;
 }
+
+int fts_icu_transliterator_get(const char *id,
+			       UTransliterator **transliterator_r,
+			       const char **error_r)
+{
+	UTransliterator *transliterator;
+
+	if (!hash_table_is_created(icu_transliterators)) {
+		hash_table_create(&icu_transliterators, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	transliterator = hash_table_lookup(icu_transliterators, id);
+	if (transliterator == NULL) {
+		if (fts_icu_transliterator_create(id, &transliterator,
+						  error_r) < 0)
+			return -1;
+		hash_table_insert(icu_transliterators, i_strdup(id),
+				  transliterator);
+	}
+	*transliterator_r = transliterator;
+	return 0;
+}
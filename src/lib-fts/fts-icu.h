@@ -25,4 +25,11 @@ void fts_icu_deinit(void);
 int fts_icu_transliterator_create(const char *id,
                                   UTransliterator **transliterator_r,
                                   const char **error_r) ;
+/* Like fts_icu_transliterator_create(), but the transliterator is cached and
+   shared by all the callers until fts_icu_deinit(). Creating a transliterator
+   is slow, so this should be used by anything created for each user. The
+   returned transliterator must not be closed. */
+int fts_icu_transliterator_get(const char *id,
+			       UTransliterator **transliterator_r,
+			       const char **error_r);
 #endif
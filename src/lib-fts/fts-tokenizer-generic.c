@@ -32,6 +32,8 @@ static unsigned char fts_ascii_word_breaks[128] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0  /* 112-127: {|}~ */
 };
 
+static void letter_type_ascii_init(void);
+
 static int
 fts_tokenizer_generic_create(const char *const *settings,
 			     struct fts_tokenizer **tokenizer_r,
@@ -92,10 +94,12 @@ fts_tokenizer_generic_create(const char *const *settings,
 	}
 
 	tok = i_new(struct generic_fts_tokenizer, 1);
-	if (algo == BOUNDARY_ALGORITHM_TR29)
+	if (algo == BOUNDARY_ALGORITHM_TR29) {
+		letter_type_ascii_init();
 		tok->tokenizer.v = &generic_tokenizer_vfuncs_tr29;
-	else
+	} else {
 		tok->tokenizer.v = &generic_tokenizer_vfuncs_simple;
+	}
 	tok->max_length = max_length;
 	tok->algorithm = algo;
 	tok->wb5a = wb5a;
@@ -355,8 +359,14 @@ fts_tokenizer_generic_simple_next(struct fts_tokenizer *_tok,
 
 	start = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start; i < size; i += char_size) {
-		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
-		i_assert(char_size > 0);
+		if (data[i] < 0x80) {
+			/* ASCII - no need to decode UTF-8 */
+			c = data[i];
+			char_size = 1;
+		} else {
+			char_size = uni_utf8_get_char_n(data + i, size - i, &c);
+			i_assert(char_size > 0);
+		}
 
 		apostrophe = IS_APOSTROPHE(c);
 		if ((tok->prefixsplat && IS_PREFIX_SPLAT(c)) &&
@@ -458,6 +468,28 @@ static enum letter_type letter_type(unichar_t c)
 	return LETTER_TYPE_OTHER;
 }
 
+/* letter_type() for ASCII characters, filled by letter_type_ascii_init() */
+static enum letter_type letter_types_ascii[128];
+static bool letter_types_ascii_initialized = FALSE;
+
+static void letter_type_ascii_init(void)
+{
+	unichar_t c;
+
+	if (letter_types_ascii_initialized)
+		return;
+	for (c = 0; c < N_ELEMENTS(letter_types_ascii); c++)
+		letter_types_ascii[c] = letter_type(c);
+	letter_types_ascii_initialized = TRUE;
+}
+
+static inline enum letter_type letter_type_fast(unichar_t c)
+{
+	if (c < N_ELEMENTS(letter_types_ascii))
+		return letter_types_ascii[c];
+	return letter_type(c);
+}
+
 static bool letter_panic(struct generic_fts_tokenizer *tok ATTR_UNUSED)
 {
 	i_panic("Letter type should not be used.");
@@ -739,7 +771,7 @@ static void wb5a_reinsert(struct generic_fts_tokenizer *tok)
 
 	uni_ucs4_to_utf8_c(tok->letter, utf8_str);
 	buffer_insert(tok->token, 0, str_data(utf8_str), str_len(utf8_str));
-	tok->prev_type = letter_type(tok->letter);
+	tok->prev_type = letter_type_fast(tok->letter);
 	tok->letter = 0;
 	tok->prev_letter = 0;
 	tok->seen_wb5a = FALSE;
@@ -812,10 +844,16 @@ fts_tokenizer_generic_tr29_next(struct fts_tokenizer *_tok,
 	start_pos = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start_pos; i < size; ) {
 		char_start_i = i;
-		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
-		i_assert(char_size > 0);
+		if (data[i] < 0x80) {
+			/* ASCII - no need to decode UTF-8 */
+			c = data[i];
+			char_size = 1;
+		} else {
+			char_size = uni_utf8_get_char_n(data + i, size - i, &c);
+			i_assert(char_size > 0);
+		}
 		i += char_size;
-		lt = letter_type(c);
+		lt = letter_type_fast(c);
 
 		/* The WB5a break is detected only when the "after
 		   break" char is inspected. That char needs to be
@@ -748,6 +748,52 @@ static void test_fts_filter_normalizer_truncation(void)
 	test_end();
 }
 
+static void test_fts_filter_normalizer_ascii(void)
+{
+	/* the same as the default ID, but doesn't use the ASCII fast path */
+	const char *settings[] =
+		{"id", "Any-Lower; NFKD; [: Nonspacing Mark :] Remove; NFC; [\\x20] Remove;",
+		 "maxlen", "20", NULL};
+	const char *input[] = {
+		"Hello World", "   ", "ABCDEFGHIJKLMNOPQRSTUVWXYZ", "a\tB\rc\n",
+		"\x7F~}|{", NULL
+	};
+	struct fts_filter *norm, *norm_icu;
+	const char *error, *token, *token_icu;
+	char all_ascii[128], single[2] = { '\0', '\0' };
+	unsigned int i;
+	int ret;
+
+	test_begin("fts filter normalizer ASCII");
+	test_assert(fts_filter_create(fts_filter_normalizer_icu, NULL, NULL,
+				      &settings[2], &norm, &error) == 0);
+	test_assert(fts_filter_create(fts_filter_normalizer_icu, NULL, NULL,
+				      settings, &norm_icu, &error) == 0);
+	for (i = 1; i < sizeof(all_ascii); i++)
+		all_ascii[i-1] = i;
+	all_ascii[i-1] = '\0';
+	input[N_ELEMENTS(input)-1] = all_ascii;
+
+	for (i = 0; i < N_ELEMENTS(input); i++) {
+		token = token_icu = input[i];
+		ret = fts_filter_filter(norm, &token, &error);
+		test_assert_idx(ret == fts_filter_filter(norm_icu, &token_icu,
+							 &error), i);
+		test_assert_idx(ret <= 0 || strcmp(token, token_icu) == 0, i);
+	}
+	for (i = 1; i < 128; i++) {
+		single[0] = i;
+		token = token_icu = single;
+		ret = fts_filter_filter(norm, &token, &error);
+		test_assert_idx(ret == fts_filter_filter(norm_icu, &token_icu,
+							 &error), i);
+		test_assert_idx(ret <= 0 || strcmp(token, token_icu) == 0, i);
+	}
+	fts_filter_unref(&norm);
+	fts_filter_unref(&norm_icu);
+	test_end();
+}
+
 #ifdef HAVE_FTS_STEMMER
 static void test_fts_filter_normalizer_stopwords_stemmer_eng(void)
 {
@@ -1007,6 +1053,7 @@ int main(void)
 		test_fts_filter_normalizer_invalid_id,
 		test_fts_filter_normalizer_oversized,
 		test_fts_filter_normalizer_truncation,
+		test_fts_filter_normalizer_ascii,
 #ifdef HAVE_FTS_STEMMER
 		test_fts_filter_normalizer_stopwords_stemmer_eng,
 		test_fts_filter_stopwords_normalizer_stemmer_no,
@@ -143,6 +143,25 @@ static void test_fts_icu_translate_resize(void)
 	test_end();
 }
 
+static void test_fts_icu_transliterator_get(void)
+{
+	UTransliterator *translit1, *translit2;
+	const char *error;
+
+	test_begin("fts_icu_transliterator_get");
+	test_assert(fts_icu_transliterator_get("Any-Lower", &translit1,
+					       &error) == 0);
+	test_assert(fts_icu_transliterator_get("Any-Lower", &translit2,
+					       &error) == 0);
+	test_assert(translit1 == translit2);
+	test_assert(fts_icu_transliterator_get("Any-Hex", &translit2,
+					       &error) == 0);
+	test_assert(translit1 != translit2);
+	test_assert(fts_icu_transliterator_get("Invalid-Id", &translit2,
+					       &error) < 0);
+	test_end();
+}
+
 static void test_fts_icu_lcase(void)
 {
 	const char *src = "aBcD\xC3\x84\xC3\xA4";
@@ -191,6 +210,7 @@ int main(void)
 		test_fts_icu_utf16_to_utf8_resize,
 		test_fts_icu_translate,
 		test_fts_icu_translate_resize,
+		test_fts_icu_transliterator_get,
 		test_fts_icu_lcase,
 		test_fts_icu_lcase_resize,
 		test_fts_icu_lcase_resize_invalid_utf8,
@@ -0,0 +1,346 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "ostream-null.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "http-client.h"
+#include "http-server.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define BENCH_HTTP_TARGET "/bench"
+
+/**
+ * Runs an http-server and an http-client in the same process and ioloop, and
+ * measures how fast the client gets through the given number of requests.
+ * Each "peer" is a separate listener port on 127.0.0.1, so the client keeps
+ * a separate host, peer and queue for each of them. The requests are
+ * distributed to the peers round-robin. With a request payload size the
+ * requests are POSTs whose payload the server reads fully before
+ * responding.
+ *
+ * The CPU time is for the whole process, so it includes both the client and
+ * the server side.
+ */
+
+struct bench_ctx {
+	unsigned int request_count;
+	unsigned int max_pending;
+	unsigned int peer_count;
+	unsigned int max_connections;
+	unsigned int max_pipelined;
+	unsigned int request_size, response_size;
+
+	struct http_server *server;
+	int *fds_listen;
+	struct io **ios_listen;
+	in_port_t *ports;
+
+	struct http_client *client;
+	unsigned char *request_data, *response_data;
+	unsigned int started_count, finished_count, failed_count;
+};
+
+struct bench_server_request {
+	struct bench_ctx *ctx;
+	struct http_server_request *req;
+	struct ostream *payload_output;
+};
+
+static struct bench_ctx *bench_ctx;
+
+static void bench_client_request_start(struct bench_ctx *ctx);
+
+static void
+bench_server_respond(struct bench_ctx *ctx, struct http_server_request *req)
+{
+	struct http_server_response *resp;
+	struct istream *input;
+
+	resp = http_server_response_create(req, 200, "OK");
+	input = i_stream_create_from_data(ctx->response_data,
+					  ctx->response_size);
+	http_server_response_set_payload(resp, input);
+	i_stream_unref(&input);
+	http_server_response_submit(resp);
+}
+
+static void
+bench_server_payload_finished(struct bench_server_request *sreq)
+{
+	if (sreq->payload_output->offset != sreq->ctx->request_size) {
+		i_fatal("Server received %"PRIuUOFF_T" bytes of payload, "
+			"expected %u", sreq->payload_output->offset,
+			sreq->ctx->request_size);
+	}
+	o_stream_unref(&sreq->payload_output);
+	bench_server_respond(sreq->ctx, sreq->req);
+}
+
+static void
+bench_server_handle_request(void *context ATTR_UNUSED,
+			    struct http_server_request *req)
+{
+	struct bench_server_request *sreq;
+	pool_t pool;
+
+	if (bench_ctx->request_size == 0) {
+		/* GET request */
+		bench_server_respond(bench_ctx, req);
+		return;
+	}
+
+	pool = http_server_request_get_pool(req);
+	sreq = p_new(pool, struct bench_server_request, 1);
+	sreq->ctx = bench_ctx;
+	sreq->req = req;
+	/* read the whole payload, but don't spend time storing it */
+	sreq->payload_output = o_stream_create_null();
+	http_server_request_forward_payload(req, sreq->payload_output,
+					    bench_ctx->request_size,
+					    bench_server_payload_finished, sreq);
+}
+
+static const struct http_server_callbacks bench_server_callbacks = {
+	.handle_request = bench_server_handle_request,
+};
+
+static void bench_server_accept(int *fd_listen)
+{
+	int fd;
+
+	for (;;) {
+		if ((fd = net_accept(*fd_listen, NULL, NULL)) < 0) {
+			if (errno == EAGAIN)
+				break;
+			if (errno == ECONNABORTED)
+				continue;
+			i_fatal("accept() failed: %m");
+		}
+		net_set_nonblock(fd, TRUE);
+		(void)http_server_connection_create(bench_ctx->server, fd, fd,
+						    FALSE,
+						    &bench_server_callbacks,
+						    NULL);
+	}
+}
+
+static void bench_server_init(struct bench_ctx *ctx)
+{
+	struct http_server_settings server_set;
+	struct ip_addr ip;
+
+	i_zero(&server_set);
+	server_set.max_pipelined_requests = ctx->max_pipelined;
+	server_set.request_limits.max_payload_size = ctx->request_size;
+	ctx->server = http_server_init(&server_set);
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	ctx->fds_listen = i_new(int, ctx->peer_count);
+	ctx->ios_listen = i_new(struct io *, ctx->peer_count);
+	ctx->ports = i_new(in_port_t, ctx->peer_count);
+	for (unsigned int i = 0; i < ctx->peer_count; i++) {
+		ctx->fds_listen[i] = net_listen(&ip, &ctx->ports[i], 128);
+		if (ctx->fds_listen[i] == -1)
+			i_fatal("listen(%s) failed: %m", net_ip2addr(&ip));
+		net_set_nonblock(ctx->fds_listen[i], TRUE);
+		ctx->ios_listen[i] = io_add(ctx->fds_listen[i], IO_READ,
+					    bench_server_accept,
+					    &ctx->fds_listen[i]);
+	}
+}
+
+static void bench_server_deinit(struct bench_ctx *ctx)
+{
+	for (unsigned int i = 0; i < ctx->peer_count; i++) {
+		io_remove(&ctx->ios_listen[i]);
+		i_close_fd(&ctx->fds_listen[i]);
+	}
+	http_server_deinit(&ctx->server);
+	i_free(ctx->fds_listen);
+	i_free(ctx->ios_listen);
+	i_free(ctx->ports);
+}
+
+static void
+bench_client_response(const struct http_response *resp,
+		      struct bench_ctx *ctx)
+{
+	if (resp->status != 200) {
+		i_error("Request failed: %u %s", resp->status, resp->reason);
+		ctx->failed_count++;
+	}
+	/* the response payload is read and discarded by http-client */
+	ctx->finished_count++;
+	if (ctx->started_count < ctx->request_count)
+		bench_client_request_start(ctx);
+	else if (ctx->finished_count == ctx->request_count)
+		io_loop_stop(current_ioloop);
+}
+
+static void bench_client_request_start(struct bench_ctx *ctx)
+{
+	struct http_client_request *hreq;
+	unsigned int peer_idx = ctx->started_count % ctx->peer_count;
+
+	hreq = http_client_request(ctx->client,
+				   ctx->request_size > 0 ? "POST" : "GET",
+				   "127.0.0.1", BENCH_HTTP_TARGET,
+				   bench_client_response, ctx);
+	http_client_request_set_port(hreq, ctx->ports[peer_idx]);
+	if (ctx->request_size > 0) {
+		http_client_request_set_payload_data(hreq, ctx->request_data,
+						     ctx->request_size);
+	}
+	ctx->started_count++;
+	http_client_request_submit(hreq);
+}
+
+static void bench_client_init(struct bench_ctx *ctx)
+{
+	struct http_client_settings client_set;
+
+	i_zero(&client_set);
+	client_set.max_parallel_connections = ctx->max_connections;
+	client_set.max_pipelined_requests = ctx->max_pipelined;
+	client_set.max_attempts = 1;
+	client_set.max_redirects = 0;
+	client_set.max_idle_time_msecs = 5*1000;
+	ctx->client = http_client_init(&client_set);
+}
+
+static uint64_t bench_cpu_usecs(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		i_fatal("getrusage() failed: %m");
+	return timeval_to_usecs(&usage.ru_utime) +
+		timeval_to_usecs(&usage.ru_stime);
+}
+
+static void bench_print(struct bench_ctx *ctx, uint64_t ts_0, uint64_t ts_1,
+			uint64_t cpu_usecs)
+{
+	double usecs = (double)(ts_1 - ts_0) / 1000.0;
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		i_fatal("getrusage() failed: %m");
+	printf("http-client requests\n\tTotal: %0.02lf ms\n\t%0.01lf req/s\n"
+	       "\t%0.03lf us CPU/req\n\tmax RSS: %ld kB\n\t%u failed\n\n",
+	       usecs / 1000.0,
+	       usecs == 0 ? 0 : (double)ctx->request_count * 1000000.0 / usecs,
+	       (double)cpu_usecs / (double)ctx->request_count,
+	       usage.ru_maxrss, ctx->failed_count);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n requests] [-c pending] [-P peers] "
+		"[-C connections per peer] [-p pipelined requests] "
+		"[-q request size] [-r response size]\n", prog);
+	fprintf(stderr, "Runs 100000 GET requests to 4 peers with 4 "
+		"connections per peer, 10 pipelined requests, 100 pending "
+		"requests and 1024 byte responses if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_ctx ctx = {
+		.request_count = 100000,
+		.max_pending = 100,
+		.peer_count = 4,
+		.max_connections = 4,
+		.max_pipelined = 10,
+		.request_size = 0,
+		.response_size = 1024,
+	};
+	struct ioloop *ioloop;
+	uint64_t ts_0, ts_1, cpu_0, cpu_1;
+	int c;
+
+	lib_init();
+	while ((c = getopt(argc, argv, "n:c:P:C:p:q:r:")) > 0) {
+		switch (c) {
+		case 'n':
+			if (str_to_uint(optarg, &ctx.request_count) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'c':
+			if (str_to_uint(optarg, &ctx.max_pending) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'P':
+			if (str_to_uint(optarg, &ctx.peer_count) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'C':
+			if (str_to_uint(optarg, &ctx.max_connections) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'p':
+			if (str_to_uint(optarg, &ctx.max_pipelined) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'q':
+			if (str_to_uint(optarg, &ctx.request_size) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'r':
+			if (str_to_uint(optarg, &ctx.response_size) < 0)
+				print_usage(argv[0]);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (optind != argc || ctx.request_count == 0 ||
+	    ctx.max_pending == 0 || ctx.peer_count == 0 ||
+	    ctx.max_connections == 0 || ctx.max_pipelined == 0)
+		print_usage(argv[0]);
+
+	ctx.request_data = i_malloc(I_MAX(ctx.request_size, 1));
+	memset(ctx.request_data, 'q', ctx.request_size);
+	ctx.response_data = i_malloc(I_MAX(ctx.response_size, 1));
+	memset(ctx.response_data, 'r', ctx.response_size);
+	bench_ctx = &ctx;
+
+	ioloop = io_loop_create();
+	bench_server_init(&ctx);
+	bench_client_init(&ctx);
+
+	printf("%u requests to %u peers, %u connections per peer, "
+	       "%u pipelined, %u pending, %u byte requests, "
+	       "%u byte responses\n\n", ctx.request_count, ctx.peer_count,
+	       ctx.max_connections, ctx.max_pipelined, ctx.max_pending,
+	       ctx.request_size, ctx.response_size);
+
+	cpu_0 = bench_cpu_usecs();
+	ts_0 = i_nanoseconds();
+	for (unsigned int i = 0; i < ctx.max_pending &&
+	     ctx.started_count < ctx.request_count; i++)
+		bench_client_request_start(&ctx);
+	io_loop_run(ioloop);
+	ts_1 = i_nanoseconds();
+	cpu_1 = bench_cpu_usecs();
+
+	bench_print(&ctx, ts_0, ts_1, cpu_1 - cpu_0);
+
+	http_client_deinit(&ctx.client);
+	bench_server_deinit(&ctx);
+	io_loop_destroy(&ioloop);
+	i_free(ctx.request_data);
+	i_free(ctx.response_data);
+	lib_deinit();
+	return ctx.failed_count == 0 ? 0 : 1;
+}
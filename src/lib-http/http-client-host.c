@@ -11,6 +11,7 @@
 #include "ostream.h"
 #include "time-util.h"
 #include "dns-lookup.h"
+#include "dns-cache.h"
 #include "http-response-parser.h"
 
 #include "http-client-private.h"
@@ -127,6 +128,8 @@ http_client_host_shared_dns_callback(const struct dns_lookup_result *result,
 
 	http_client_host_shared_lookup_success(hshared, result->ips,
 					       result->ips_count);
+	dns_cache_update(hshared->name, result->ips, result->ips_count,
+			 hshared->cctx->dns_ttl_msecs);
 
 	/* Notify all sessions */
 	host = hshared->hosts_list;
@@ -141,11 +144,26 @@ http_client_host_shared_lookup(struct http_client_host_shared *hshared)
 {
 	struct http_client_context *cctx = hshared->cctx;
 	struct dns_lookup_settings dns_set;
+	const struct ip_addr *cached_ips;
+	unsigned int cached_ips_count;
+	struct timeval cached_expires;
 	int ret;
 
 	i_assert(!hshared->explicit_ip);
 	i_assert(hshared->dns_lookup == NULL);
 
+	/* Other clients in this process may have already looked up the
+	   host, even when they use a different client context. */
+	if (dns_cache_lookup(hshared->name, &cached_ips, &cached_ips_count,
+			     &cached_expires)) {
+		e_debug(hshared->event, "Using cached DNS lookup result");
+		http_client_host_shared_lookup_success(hshared, cached_ips,
+						       cached_ips_count);
+		if (timeval_cmp(&cached_expires, &hshared->ips_timeout) < 0)
+			hshared->ips_timeout = cached_expires;
+		return;
+	}
+
 	if (cctx->dns_client != NULL) {
 		e_debug(hshared->event, "Performing asynchronous DNS lookup");
 		(void)dns_client_lookup(cctx->dns_client, hshared->name,
@@ -175,6 +193,8 @@ http_client_host_shared_lookup(struct http_client_host_shared *hshared)
 		}
 
 		http_client_host_shared_lookup_success(hshared, ips, ips_count);
+		dns_cache_update(hshared->name, ips, ips_count,
+				 cctx->dns_ttl_msecs);
 	}
 }
 
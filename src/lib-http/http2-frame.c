@@ -0,0 +1,444 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "byteorder.h"
+#include "http2-hpack.h"
+#include "http2-frame.h"
+
+#define HTTP2_SETTING_SIZE 6
+#define HTTP2_PRIORITY_SIZE 5
+#define HTTP2_STREAM_ID_MASK 0x7fffffffU
+
+static const char *const http2_error_code_names[] = {
+	"NO_ERROR",
+	"PROTOCOL_ERROR",
+	"INTERNAL_ERROR",
+	"FLOW_CONTROL_ERROR",
+	"SETTINGS_TIMEOUT",
+	"STREAM_CLOSED",
+	"FRAME_SIZE_ERROR",
+	"REFUSED_STREAM",
+	"CANCEL",
+	"COMPRESSION_ERROR",
+	"CONNECT_ERROR",
+	"ENHANCE_YOUR_CALM",
+	"INADEQUATE_SECURITY",
+	"HTTP_1_1_REQUIRED",
+};
+static_assert_array_size(http2_error_code_names,
+			 HTTP2_ERROR_HTTP_1_1_REQUIRED + 1);
+
+const char *http2_error_code_to_str(enum http2_error_code code)
+{
+	if ((unsigned int)code < N_ELEMENTS(http2_error_code_names))
+		return http2_error_code_names[code];
+	return t_strdup_printf("0x%x", (unsigned int)code);
+}
+
+void http2_settings_init_default(struct http2_settings *set_r)
+{
+	i_zero(set_r);
+	set_r->header_table_size = HPACK_DEFAULT_HEADER_TABLE_SIZE;
+	set_r->enable_push = TRUE;
+	set_r->max_concurrent_streams = (uint32_t)-1;
+	set_r->initial_window_size = HTTP2_DEFAULT_WINDOW_SIZE;
+	set_r->max_frame_size = HTTP2_DEFAULT_MAX_FRAME_SIZE;
+	set_r->max_header_list_size = (uint32_t)-1;
+}
+
+int http2_frame_header_parse(const unsigned char *data, size_t size,
+			     struct http2_frame_header *hdr_r)
+{
+	if (size < HTTP2_FRAME_HEADER_SIZE)
+		return 0;
+
+	hdr_r->length = ((uint32_t)data[0] << 16) |
+		((uint32_t)data[1] << 8) | data[2];
+	hdr_r->type = data[3];
+	hdr_r->flags = data[4];
+	/* the reserved bit is ignored */
+	hdr_r->stream_id = be32_to_cpu_unaligned(data + 5) &
+		HTTP2_STREAM_ID_MASK;
+	return 1;
+}
+
+int http2_frame_header_check(const struct http2_frame_header *hdr,
+			     uint32_t max_frame_size,
+			     enum http2_error_code *error_code_r,
+			     const char **error_r)
+{
+	bool stream_frame;
+	int valid_length = -1;
+
+	if (hdr->length > max_frame_size) {
+		*error_code_r = HTTP2_ERROR_FRAME_SIZE_ERROR;
+		*error_r = t_strdup_printf(
+			"Frame is too large (%u > %u bytes)",
+			hdr->length, max_frame_size);
+		return -1;
+	}
+
+	switch (hdr->type) {
+	case HTTP2_FRAME_DATA:
+	case HTTP2_FRAME_HEADERS:
+	case HTTP2_FRAME_PUSH_PROMISE:
+	case HTTP2_FRAME_CONTINUATION:
+		stream_frame = TRUE;
+		break;
+	case HTTP2_FRAME_PRIORITY:
+		stream_frame = TRUE;
+		valid_length = HTTP2_PRIORITY_SIZE;
+		break;
+	case HTTP2_FRAME_RST_STREAM:
+		stream_frame = TRUE;
+		valid_length = 4;
+		break;
+	case HTTP2_FRAME_SETTINGS:
+		stream_frame = FALSE;
+		if ((hdr->flags & HTTP2_FRAME_FLAG_ACK) != 0)
+			valid_length = 0;
+		else if (hdr->length % HTTP2_SETTING_SIZE != 0) {
+			*error_code_r = HTTP2_ERROR_FRAME_SIZE_ERROR;
+			*error_r = "Invalid SETTINGS frame size";
+			return -1;
+		}
+		break;
+	case HTTP2_FRAME_PING:
+		stream_frame = FALSE;
+		valid_length = 8;
+		break;
+	case HTTP2_FRAME_GOAWAY:
+		stream_frame = FALSE;
+		if (hdr->length < 8) {
+			*error_code_r = HTTP2_ERROR_FRAME_SIZE_ERROR;
+			*error_r = "GOAWAY frame is too small";
+			return -1;
+		}
+		break;
+	case HTTP2_FRAME_WINDOW_UPDATE:
+		/* valid for both the connection and streams */
+		if (hdr->length != 4) {
+			*error_code_r = HTTP2_ERROR_FRAME_SIZE_ERROR;
+			*error_r = "Invalid WINDOW_UPDATE frame size";
+			return -1;
+		}
+		return 0;
+	default:
+		/* unknown frame types are ignored */
+		return 0;
+	}
+
+	if (stream_frame && hdr->stream_id == 0) {
+		*error_code_r = HTTP2_ERROR_PROTOCOL_ERROR;
+		*error_r = t_strdup_printf("Frame type %u without a stream",
+					   hdr->type);
+		return -1;
+	}
+	if (!stream_frame && hdr->stream_id != 0) {
+		*error_code_r = HTTP2_ERROR_PROTOCOL_ERROR;
+		*error_r = t_strdup_printf("Frame type %u for stream %u",
+					   hdr->type, hdr->stream_id);
+		return -1;
+	}
+	if (valid_length >= 0 && hdr->length != (uint32_t)valid_length) {
+		*error_code_r = HTTP2_ERROR_FRAME_SIZE_ERROR;
+		*error_r = t_strdup_printf("Frame type %u has invalid size %u",
+					   hdr->type, hdr->length);
+		return -1;
+	}
+	return 0;
+}
+
+int http2_frame_payload_unpad(const struct http2_frame_header *hdr,
+			      const unsigned char **payload,
+			      size_t *size, const char **error_r)
+{
+	size_t pad_len = 0;
+
+	i_assert(hdr->type == HTTP2_FRAME_DATA ||
+		 hdr->type == HTTP2_FRAME_HEADERS ||
+		 hdr->type == HTTP2_FRAME_PUSH_PROMISE);
+
+	if ((hdr->flags & HTTP2_FRAME_FLAG_PADDED) != 0) {
+		if (*size == 0) {
+			*error_r = "Missing pad length";
+			return -1;
+		}
+		pad_len = (*payload)[0];
+		*payload += 1;
+		*size -= 1;
+	}
+	if (hdr->type == HTTP2_FRAME_HEADERS &&
+	    (hdr->flags & HTTP2_FRAME_FLAG_PRIORITY) != 0) {
+		if (*size < HTTP2_PRIORITY_SIZE) {
+			*error_r = "Truncated HEADERS priority";
+			return -1;
+		}
+		*payload += HTTP2_PRIORITY_SIZE;
+		*size -= HTTP2_PRIORITY_SIZE;
+	}
+	if (pad_len > *size) {
+		*error_r = "Padding is larger than the payload";
+		return -1;
+	}
+	*size -= pad_len;
+	return 0;
+}
+
+int http2_settings_parse(struct http2_settings *set,
+			 const unsigned char *payload, size_t size,
+			 enum http2_error_code *error_code_r,
+			 const char **error_r)
+{
+	uint16_t id;
+	uint32_t value;
+
+	i_assert(size % HTTP2_SETTING_SIZE == 0);
+
+	for (; size > 0; payload += HTTP2_SETTING_SIZE,
+			 size -= HTTP2_SETTING_SIZE) {
+		id = be16_to_cpu_unaligned(payload);
+		value = be32_to_cpu_unaligned(payload + 2);
+
+		switch ((enum http2_setting_id)id) {
+		case HTTP2_SETTING_HEADER_TABLE_SIZE:
+			set->header_table_size = value;
+			break;
+		case HTTP2_SETTING_ENABLE_PUSH:
+			if (value > 1) {
+				*error_code_r = HTTP2_ERROR_PROTOCOL_ERROR;
+				*error_r = "Invalid SETTINGS_ENABLE_PUSH";
+				return -1;
+			}
+			set->enable_push = value == 1;
+			break;
+		case HTTP2_SETTING_MAX_CONCURRENT_STREAMS:
+			set->max_concurrent_streams = value;
+			break;
+		case HTTP2_SETTING_INITIAL_WINDOW_SIZE:
+			if (value > HTTP2_MAX_WINDOW_SIZE) {
+				*error_code_r = HTTP2_ERROR_FLOW_CONTROL_ERROR;
+				*error_r = "Invalid SETTINGS_INITIAL_WINDOW_SIZE";
+				return -1;
+			}
+			set->initial_window_size = value;
+			break;
+		case HTTP2_SETTING_MAX_FRAME_SIZE:
+			if (value < HTTP2_DEFAULT_MAX_FRAME_SIZE ||
+			    value > HTTP2_MAX_FRAME_SIZE_LIMIT) {
+				*error_code_r = HTTP2_ERROR_PROTOCOL_ERROR;
+				*error_r = "Invalid SETTINGS_MAX_FRAME_SIZE";
+				return -1;
+			}
+			set->max_frame_size = value;
+			break;
+		case HTTP2_SETTING_MAX_HEADER_LIST_SIZE:
+			set->max_header_list_size = value;
+			break;
+		default:
+			/* unknown settings are ignored */
+			break;
+		}
+	}
+	return 0;
+}
+
+int http2_frame_parse_window_update(const unsigned char *payload,
+				    uint32_t *increment_r,
+				    const char **error_r)
+{
+	*increment_r = be32_to_cpu_unaligned(payload) & HTTP2_MAX_WINDOW_SIZE;
+	if (*increment_r == 0) {
+		*error_r = "WINDOW_UPDATE with zero increment";
+		return -1;
+	}
+	return 0;
+}
+
+enum http2_error_code
+http2_frame_parse_rst_stream(const unsigned char *payload)
+{
+	return be32_to_cpu_unaligned(payload);
+}
+
+void http2_frame_parse_goaway(const unsigned char *payload, size_t size,
+			      struct http2_goaway *goaway_r)
+{
+	i_assert(size >= 8);
+
+	goaway_r->last_stream_id = be32_to_cpu_unaligned(payload) &
+		HTTP2_STREAM_ID_MASK;
+	goaway_r->error_code = be32_to_cpu_unaligned(payload + 4);
+	goaway_r->debug_data = payload + 8;
+	goaway_r->debug_data_size = size - 8;
+}
+
+void http2_frame_header_write(buffer_t *output, enum http2_frame_type type,
+			      uint8_t flags, uint32_t stream_id,
+			      size_t length)
+{
+	unsigned char *hdr;
+
+	i_assert(length <= HTTP2_MAX_FRAME_SIZE_LIMIT);
+	i_assert(stream_id <= HTTP2_MAX_STREAM_ID);
+
+	hdr = buffer_append_space_unsafe(output, HTTP2_FRAME_HEADER_SIZE);
+	hdr[0] = (length >> 16) & 0xff;
+	hdr[1] = (length >> 8) & 0xff;
+	hdr[2] = length & 0xff;
+	hdr[3] = type;
+	hdr[4] = flags;
+	cpu32_to_be_unaligned(stream_id, hdr + 5);
+}
+
+static void
+http2_setting_write(buffer_t *output, enum http2_setting_id id,
+		    uint32_t value)
+{
+	unsigned char *setting;
+
+	setting = buffer_append_space_unsafe(output, HTTP2_SETTING_SIZE);
+	cpu16_to_be_unaligned(id, setting);
+	cpu32_to_be_unaligned(value, setting + 2);
+}
+
+void http2_frame_write_settings(buffer_t *output,
+				const struct http2_settings *set)
+{
+	struct http2_settings defaults;
+	unsigned char payload[HTTP2_SETTING_SIZE * 6];
+	buffer_t buf;
+
+	http2_settings_init_default(&defaults);
+	buffer_create_from_data(&buf, payload, sizeof(payload));
+
+	if (set->header_table_size != defaults.header_table_size) {
+		http2_setting_write(&buf, HTTP2_SETTING_HEADER_TABLE_SIZE,
+				    set->header_table_size);
+	}
+	if (set->enable_push != defaults.enable_push) {
+		http2_setting_write(&buf, HTTP2_SETTING_ENABLE_PUSH,
+				    set->enable_push ? 1 : 0);
+	}
+	if (set->max_concurrent_streams != defaults.max_concurrent_streams) {
+		http2_setting_write(&buf, HTTP2_SETTING_MAX_CONCURRENT_STREAMS,
+				    set->max_concurrent_streams);
+	}
+	if (set->initial_window_size != defaults.initial_window_size) {
+		http2_setting_write(&buf, HTTP2_SETTING_INITIAL_WINDOW_SIZE,
+				    set->initial_window_size);
+	}
+	if (set->max_frame_size != defaults.max_frame_size) {
+		http2_setting_write(&buf, HTTP2_SETTING_MAX_FRAME_SIZE,
+				    set->max_frame_size);
+	}
+	if (set->max_header_list_size != defaults.max_header_list_size) {
+		http2_setting_write(&buf, HTTP2_SETTING_MAX_HEADER_LIST_SIZE,
+				    set->max_header_list_size);
+	}
+
+	http2_frame_header_write(output, HTTP2_FRAME_SETTINGS, 0, 0, buf.used);
+	buffer_append_buf(output, &buf, 0, SIZE_MAX);
+}
+
+void http2_frame_write_settings_ack(buffer_t *output)
+{
+	http2_frame_header_write(output, HTTP2_FRAME_SETTINGS,
+				 HTTP2_FRAME_FLAG_ACK, 0, 0);
+}
+
+void http2_frame_write_ping(buffer_t *output, bool ack,
+			    const unsigned char opaque_data[STATIC_ARRAY 8])
+{
+	http2_frame_header_write(output, HTTP2_FRAME_PING,
+				 ack ? HTTP2_FRAME_FLAG_ACK : 0, 0, 8);
+	buffer_append(output, opaque_data, 8);
+}
+
+void http2_frame_write_window_update(buffer_t *output, uint32_t stream_id,
+				     uint32_t increment)
+{
+	unsigned char *payload;
+
+	i_assert(increment > 0 && increment <= HTTP2_MAX_WINDOW_SIZE);
+
+	http2_frame_header_write(output, HTTP2_FRAME_WINDOW_UPDATE, 0,
+				 stream_id, 4);
+	payload = buffer_append_space_unsafe(output, 4);
+	cpu32_to_be_unaligned(increment, payload);
+}
+
+void http2_frame_write_rst_stream(buffer_t *output, uint32_t stream_id,
+				  enum http2_error_code error_code)
+{
+	unsigned char *payload;
+
+	i_assert(stream_id != 0);
+
+	http2_frame_header_write(output, HTTP2_FRAME_RST_STREAM, 0,
+				 stream_id, 4);
+	payload = buffer_append_space_unsafe(output, 4);
+	cpu32_to_be_unaligned(error_code, payload);
+}
+
+void http2_frame_write_goaway(buffer_t *output, uint32_t last_stream_id,
+			      enum http2_error_code error_code,
+			      const char *debug_data)
+{
+	size_t debug_len = debug_data == NULL ? 0 : strlen(debug_data);
+	unsigned char *payload;
+
+	http2_frame_header_write(output, HTTP2_FRAME_GOAWAY, 0, 0,
+				 8 + debug_len);
+	payload = buffer_append_space_unsafe(output, 8);
+	cpu32_to_be_unaligned(last_stream_id, payload);
+	cpu32_to_be_unaligned(error_code, payload + 4);
+	buffer_append(output, debug_data, debug_len);
+}
+
+void http2_frame_write_data(buffer_t *output, uint32_t stream_id,
+			    const void *data, size_t size, bool end_stream,
+			    uint32_t max_frame_size)
+{
+	const unsigned char *p = data;
+	size_t len;
+
+	i_assert(stream_id != 0);
+
+	do {
+		len = I_MIN(size, max_frame_size);
+		http2_frame_header_write(output, HTTP2_FRAME_DATA,
+			end_stream && len == size ?
+			HTTP2_FRAME_FLAG_END_STREAM : 0, stream_id, len);
+		buffer_append(output, p, len);
+		p += len;
+		size -= len;
+	} while (size > 0);
+}
+
+void http2_frame_write_headers(buffer_t *output, uint32_t stream_id,
+			       const void *header_block, size_t size,
+			       bool end_stream, uint32_t max_frame_size)
+{
+	const unsigned char *p = header_block;
+	enum http2_frame_type type = HTTP2_FRAME_HEADERS;
+	uint8_t flags;
+	size_t len;
+
+	i_assert(stream_id != 0);
+
+	do {
+		len = I_MIN(size, max_frame_size);
+		flags = len == size ? HTTP2_FRAME_FLAG_END_HEADERS : 0;
+		/* END_STREAM belongs to the HEADERS frame even when
+		   CONTINUATION frames follow */
+		if (type == HTTP2_FRAME_HEADERS && end_stream)
+			flags |= HTTP2_FRAME_FLAG_END_STREAM;
+		http2_frame_header_write(output, type, flags, stream_id, len);
+		buffer_append(output, p, len);
+		p += len;
+		size -= len;
+		type = HTTP2_FRAME_CONTINUATION;
+	} while (size > 0);
+}
@@ -0,0 +1,167 @@
+#ifndef HTTP2_FRAME_H
+#define HTTP2_FRAME_H
+
+/* HTTP/2 framing layer (RFC 9113, Sections 4 and 6) */
+
+/* Sent by the client before anything else */
+#define HTTP2_CONNECTION_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+#define HTTP2_FRAME_HEADER_SIZE 9
+#define HTTP2_DEFAULT_MAX_FRAME_SIZE 16384
+#define HTTP2_MAX_FRAME_SIZE_LIMIT ((1U << 24) - 1)
+#define HTTP2_DEFAULT_WINDOW_SIZE 65535
+#define HTTP2_MAX_WINDOW_SIZE 0x7fffffffU
+#define HTTP2_MAX_STREAM_ID 0x7fffffffU
+
+enum http2_frame_type {
+	HTTP2_FRAME_DATA = 0x0,
+	HTTP2_FRAME_HEADERS = 0x1,
+	HTTP2_FRAME_PRIORITY = 0x2,
+	HTTP2_FRAME_RST_STREAM = 0x3,
+	HTTP2_FRAME_SETTINGS = 0x4,
+	HTTP2_FRAME_PUSH_PROMISE = 0x5,
+	HTTP2_FRAME_PING = 0x6,
+	HTTP2_FRAME_GOAWAY = 0x7,
+	HTTP2_FRAME_WINDOW_UPDATE = 0x8,
+	HTTP2_FRAME_CONTINUATION = 0x9,
+};
+
+enum http2_frame_flags {
+	HTTP2_FRAME_FLAG_END_STREAM = 0x01,
+	/* SETTINGS and PING */
+	HTTP2_FRAME_FLAG_ACK = 0x01,
+	HTTP2_FRAME_FLAG_END_HEADERS = 0x04,
+	HTTP2_FRAME_FLAG_PADDED = 0x08,
+	HTTP2_FRAME_FLAG_PRIORITY = 0x20,
+};
+
+enum http2_setting_id {
+	HTTP2_SETTING_HEADER_TABLE_SIZE = 0x1,
+	HTTP2_SETTING_ENABLE_PUSH = 0x2,
+	HTTP2_SETTING_MAX_CONCURRENT_STREAMS = 0x3,
+	HTTP2_SETTING_INITIAL_WINDOW_SIZE = 0x4,
+	HTTP2_SETTING_MAX_FRAME_SIZE = 0x5,
+	HTTP2_SETTING_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+enum http2_error_code {
+	HTTP2_ERROR_NO_ERROR = 0x0,
+	HTTP2_ERROR_PROTOCOL_ERROR = 0x1,
+	HTTP2_ERROR_INTERNAL_ERROR = 0x2,
+	HTTP2_ERROR_FLOW_CONTROL_ERROR = 0x3,
+	HTTP2_ERROR_SETTINGS_TIMEOUT = 0x4,
+	HTTP2_ERROR_STREAM_CLOSED = 0x5,
+	HTTP2_ERROR_FRAME_SIZE_ERROR = 0x6,
+	HTTP2_ERROR_REFUSED_STREAM = 0x7,
+	HTTP2_ERROR_CANCEL = 0x8,
+	HTTP2_ERROR_COMPRESSION_ERROR = 0x9,
+	HTTP2_ERROR_CONNECT_ERROR = 0xa,
+	HTTP2_ERROR_ENHANCE_YOUR_CALM = 0xb,
+	HTTP2_ERROR_INADEQUATE_SECURITY = 0xc,
+	HTTP2_ERROR_HTTP_1_1_REQUIRED = 0xd,
+};
+
+struct http2_frame_header {
+	uint32_t length;
+	enum http2_frame_type type;
+	uint8_t flags;
+	uint32_t stream_id;
+};
+
+struct http2_settings {
+	uint32_t header_table_size;
+	bool enable_push;
+	/* (uint32_t)-1 = unlimited */
+	uint32_t max_concurrent_streams;
+	uint32_t initial_window_size;
+	uint32_t max_frame_size;
+	/* (uint32_t)-1 = unlimited */
+	uint32_t max_header_list_size;
+};
+
+struct http2_goaway {
+	uint32_t last_stream_id;
+	enum http2_error_code error_code;
+	/* opaque debug data from the frame */
+	const unsigned char *debug_data;
+	size_t debug_data_size;
+};
+
+/* Returns a human readable name for the error code. */
+const char *http2_error_code_to_str(enum http2_error_code code);
+
+/* Fill the settings with the initial values each endpoint assumes for its
+   peer before receiving its SETTINGS frame. */
+void http2_settings_init_default(struct http2_settings *set_r);
+
+/* Parse the fixed size frame header. Returns 1 if the header was parsed,
+   0 if more data is needed. */
+int http2_frame_header_parse(const unsigned char *data, size_t size,
+			     struct http2_frame_header *hdr_r);
+/* Check that the frame's size and stream identifier are valid for its type
+   (unknown types are always valid and must be ignored). max_frame_size is
+   the SETTINGS_MAX_FRAME_SIZE that was advertised to the peer. Returns 0
+   if the frame is valid, -1 if it's a connection error of the returned
+   type. */
+int http2_frame_header_check(const struct http2_frame_header *hdr,
+			     uint32_t max_frame_size,
+			     enum http2_error_code *error_code_r,
+			     const char **error_r);
+
+/* Remove the padding from a DATA, HEADERS or PUSH_PROMISE frame payload.
+   HEADERS frames' priority fields are skipped as well. Returns 0 on success,
+   -1 if the padding is invalid (a PROTOCOL_ERROR). */
+int http2_frame_payload_unpad(const struct http2_frame_header *hdr,
+			      const unsigned char **payload,
+			      size_t *size, const char **error_r);
+
+/* Apply the payload of a SETTINGS frame (without the ACK flag) to set.
+   Returns 0 on success, -1 if it's a connection error of the returned
+   type. */
+int http2_settings_parse(struct http2_settings *set,
+			 const unsigned char *payload, size_t size,
+			 enum http2_error_code *error_code_r,
+			 const char **error_r);
+/* Parse the payload of a WINDOW_UPDATE frame. Returns 0 on success, -1 if
+   the increment is 0 (a PROTOCOL_ERROR). */
+int http2_frame_parse_window_update(const unsigned char *payload,
+				    uint32_t *increment_r,
+				    const char **error_r);
+/* Parse the payload of a RST_STREAM frame. */
+enum http2_error_code
+http2_frame_parse_rst_stream(const unsigned char *payload);
+/* Parse the payload of a GOAWAY frame. */
+void http2_frame_parse_goaway(const unsigned char *payload, size_t size,
+			      struct http2_goaway *goaway_r);
+
+/* Append a frame header to output. The caller appends the payload. */
+void http2_frame_header_write(buffer_t *output, enum http2_frame_type type,
+			      uint8_t flags, uint32_t stream_id,
+			      size_t length);
+/* Append a SETTINGS frame containing those settings in set that differ
+   from the protocol defaults. */
+void http2_frame_write_settings(buffer_t *output,
+				const struct http2_settings *set);
+void http2_frame_write_settings_ack(buffer_t *output);
+void http2_frame_write_ping(buffer_t *output, bool ack,
+			    const unsigned char opaque_data[STATIC_ARRAY 8]);
+void http2_frame_write_window_update(buffer_t *output, uint32_t stream_id,
+				     uint32_t increment);
+void http2_frame_write_rst_stream(buffer_t *output, uint32_t stream_id,
+				  enum http2_error_code error_code);
+void http2_frame_write_goaway(buffer_t *output, uint32_t last_stream_id,
+			      enum http2_error_code error_code,
+			      const char *debug_data);
+/* Append DATA frames, split by max_frame_size. END_STREAM is set on the
+   last frame if end_stream is TRUE. The caller is responsible for flow
+   control. */
+void http2_frame_write_data(buffer_t *output, uint32_t stream_id,
+			    const void *data, size_t size, bool end_stream,
+			    uint32_t max_frame_size);
+/* Append a HEADERS frame with the given header block, followed by
+   CONTINUATION frames if it doesn't fit into max_frame_size. */
+void http2_frame_write_headers(buffer_t *output, uint32_t stream_id,
+			       const void *header_block, size_t size,
+			       bool end_stream, uint32_t max_frame_size);
+
+#endif
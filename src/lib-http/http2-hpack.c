@@ -0,0 +1,606 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "http2-huffman.h"
+#include "http2-hpack.h"
+
+/* RFC 7541, Section 4.1 */
+#define HPACK_ENTRY_OVERHEAD 32
+/* Limits decoded integers, which are used for indexes and lengths */
+#define HPACK_INT_MAX_CONTINUATION_SHIFT 21
+
+struct hpack_static_entry {
+	const char *name;
+	const char *value;
+};
+
+/* RFC 7541, Appendix A */
+static const struct hpack_static_entry hpack_static_table[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+#define HPACK_STATIC_TABLE_COUNT N_ELEMENTS(hpack_static_table)
+
+struct hpack_table_entry {
+	/* name and value are in the same allocation */
+	char *name;
+	const char *value;
+	size_t name_len, value_len;
+};
+
+struct hpack_table {
+	/* oldest entry first */
+	ARRAY(struct hpack_table_entry) entries;
+	size_t size, max_size;
+};
+
+struct hpack_decoder {
+	struct hpack_table table;
+	/* upper limit for the table size updates */
+	size_t max_table_size;
+	size_t max_header_list_size;
+	buffer_t *strbuf;
+};
+
+struct hpack_encoder {
+	struct hpack_table table;
+	/* our own limit for the table size */
+	size_t max_table_size;
+	/* smallest table size since the last header block */
+	size_t pending_min_table_size;
+	bool table_size_changed;
+};
+
+/*
+ * Dynamic table
+ */
+
+static void hpack_table_init(struct hpack_table *table, size_t max_size)
+{
+	i_array_init(&table->entries, 32);
+	table->max_size = max_size;
+}
+
+static void hpack_table_evict_oldest(struct hpack_table *table)
+{
+	struct hpack_table_entry *entry = array_front_modifiable(&table->entries);
+
+	table->size -= entry->name_len + entry->value_len +
+		HPACK_ENTRY_OVERHEAD;
+	i_free(entry->name);
+	array_pop_front(&table->entries);
+}
+
+static void hpack_table_deinit(struct hpack_table *table)
+{
+	while (array_count(&table->entries) > 0)
+		hpack_table_evict_oldest(table);
+	array_free(&table->entries);
+}
+
+static void hpack_table_set_max_size(struct hpack_table *table,
+				     size_t max_size)
+{
+	table->max_size = max_size;
+	while (table->size > table->max_size)
+		hpack_table_evict_oldest(table);
+}
+
+static void
+hpack_table_add(struct hpack_table *table,
+		const char *name, size_t name_len,
+		const char *value, size_t value_len)
+{
+	struct hpack_table_entry *entry;
+	size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	char *data;
+
+	/* Adding an entry larger than the table just empties it
+	   (RFC 7541, Section 4.4). */
+	while (table->size + size > table->max_size &&
+	       array_count(&table->entries) > 0)
+		hpack_table_evict_oldest(table);
+	if (size > table->max_size)
+		return;
+
+	/* name and value may point to an entry that was just evicted, but
+	   they've been copied to the caller's pool or buffer already. */
+	data = i_malloc(name_len + 1 + value_len + 1);
+	memcpy(data, name, name_len);
+	memcpy(data + name_len + 1, value, value_len);
+
+	entry = array_append_space(&table->entries);
+	entry->name = data;
+	entry->value = data + name_len + 1;
+	entry->name_len = name_len;
+	entry->value_len = value_len;
+	table->size += size;
+}
+
+static unsigned int hpack_table_count(const struct hpack_table *table)
+{
+	return HPACK_STATIC_TABLE_COUNT + array_count(&table->entries);
+}
+
+static void
+hpack_table_get(const struct hpack_table *table, unsigned int idx,
+		const char **name_r, const char **value_r)
+{
+	const struct hpack_table_entry *entry;
+	unsigned int count = array_count(&table->entries);
+
+	i_assert(idx > 0 && idx <= hpack_table_count(table));
+
+	if (idx <= HPACK_STATIC_TABLE_COUNT) {
+		*name_r = hpack_static_table[idx - 1].name;
+		*value_r = hpack_static_table[idx - 1].value;
+	} else {
+		/* the newest dynamic entry has the lowest index */
+		entry = array_idx(&table->entries,
+				  count - (idx - HPACK_STATIC_TABLE_COUNT));
+		*name_r = entry->name;
+		*value_r = entry->value;
+	}
+}
+
+/* Returns the index of an entry matching both the name and the value, or
+   0 if there is none. In that case name_idx_r is set to the index of an
+   entry with a matching name, or 0 if there is none. */
+static unsigned int
+hpack_table_find(const struct hpack_table *table,
+		 const char *name, const char *value,
+		 unsigned int *name_idx_r)
+{
+	const struct hpack_table_entry *entries;
+	unsigned int i, count;
+
+	*name_idx_r = 0;
+	for (i = 0; i < HPACK_STATIC_TABLE_COUNT; i++) {
+		if (strcmp(hpack_static_table[i].name, name) != 0)
+			continue;
+		if (strcmp(hpack_static_table[i].value, value) == 0)
+			return i + 1;
+		if (*name_idx_r == 0)
+			*name_idx_r = i + 1;
+	}
+	entries = array_get(&table->entries, &count);
+	for (i = count; i > 0; i--) {
+		if (strcmp(entries[i - 1].name, name) != 0)
+			continue;
+		if (strcmp(entries[i - 1].value, value) == 0)
+			return HPACK_STATIC_TABLE_COUNT + count - i + 1;
+		if (*name_idx_r == 0)
+			*name_idx_r = HPACK_STATIC_TABLE_COUNT + count - i + 1;
+	}
+	return 0;
+}
+
+/*
+ * Primitive types (RFC 7541, Section 5)
+ */
+
+static int
+hpack_decode_int(const unsigned char **data, const unsigned char *end,
+		 unsigned int prefix_bits, size_t *num_r, const char **error_r)
+{
+	const unsigned int prefix_max = (1U << prefix_bits) - 1;
+	unsigned int shift = 0;
+	size_t num;
+	unsigned char c;
+
+	i_assert(*data < end);
+
+	num = **data & prefix_max;
+	(*data)++;
+	if (num < prefix_max) {
+		*num_r = num;
+		return 0;
+	}
+	do {
+		if (*data == end) {
+			*error_r = "Truncated integer";
+			return -1;
+		}
+		if (shift > HPACK_INT_MAX_CONTINUATION_SHIFT) {
+			*error_r = "Integer is too large";
+			return -1;
+		}
+		c = **data;
+		(*data)++;
+		num += (size_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while ((c & 0x80) != 0);
+
+	*num_r = num;
+	return 0;
+}
+
+static void
+hpack_encode_int(buffer_t *output, unsigned char first_byte,
+		 unsigned int prefix_bits, size_t num)
+{
+	const unsigned int prefix_max = (1U << prefix_bits) - 1;
+
+	if (num < prefix_max) {
+		buffer_append_c(output, first_byte | num);
+		return;
+	}
+	buffer_append_c(output, first_byte | prefix_max);
+	num -= prefix_max;
+	while (num >= 0x80) {
+		buffer_append_c(output, (num & 0x7f) | 0x80);
+		num >>= 7;
+	}
+	buffer_append_c(output, num);
+}
+
+static int
+hpack_decode_string(struct hpack_decoder *decoder,
+		    const unsigned char **data, const unsigned char *end,
+		    pool_t pool, const char **str_r, size_t *len_r,
+		    const char **error_r)
+{
+	bool huffman;
+	size_t len;
+
+	if (*data == end) {
+		*error_r = "Missing string literal";
+		return -1;
+	}
+	huffman = (**data & 0x80) != 0;
+	if (hpack_decode_int(data, end, 7, &len, error_r) < 0)
+		return -1;
+	if (len > (size_t)(end - *data)) {
+		*error_r = "Truncated string literal";
+		return -1;
+	}
+
+	buffer_set_used_size(decoder->strbuf, 0);
+	if (!huffman)
+		buffer_append(decoder->strbuf, *data, len);
+	else if (http2_huffman_decode(decoder->strbuf, *data, len,
+				      error_r) < 0)
+		return -1;
+	*data += len;
+
+	/* HTTP/2 doesn't allow these in field names or values
+	   (RFC 9113, Section 8.2.1) */
+	if (memchr(decoder->strbuf->data, '\0', decoder->strbuf->used) != NULL ||
+	    memchr(decoder->strbuf->data, '\r', decoder->strbuf->used) != NULL ||
+	    memchr(decoder->strbuf->data, '\n', decoder->strbuf->used) != NULL) {
+		*error_r = "String literal contains NUL, CR or LF";
+		return -1;
+	}
+	*str_r = p_strndup(pool, decoder->strbuf->data, decoder->strbuf->used);
+	*len_r = decoder->strbuf->used;
+	return 0;
+}
+
+static void
+hpack_encode_string(buffer_t *output, const char *str)
+{
+	size_t len = strlen(str);
+	size_t huffman_len =
+		http2_huffman_encoded_length((const unsigned char *)str, len);
+
+	if (huffman_len <= len) {
+		hpack_encode_int(output, 0x80, 7, huffman_len);
+		http2_huffman_encode(output, (const unsigned char *)str, len);
+	} else {
+		hpack_encode_int(output, 0x00, 7, len);
+		buffer_append(output, str, len);
+	}
+}
+
+/*
+ * Decoder
+ */
+
+struct hpack_decoder *
+hpack_decoder_init(size_t max_table_size, size_t max_header_list_size)
+{
+	struct hpack_decoder *decoder;
+
+	decoder = i_new(struct hpack_decoder, 1);
+	/* the encoder starts with the initial table size and signals a
+	   smaller size with a table size update */
+	hpack_table_init(&decoder->table, HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	decoder->max_table_size = max_table_size;
+	decoder->max_header_list_size = max_header_list_size;
+	decoder->strbuf = buffer_create_dynamic(default_pool, 256);
+	return decoder;
+}
+
+void hpack_decoder_deinit(struct hpack_decoder **_decoder)
+{
+	struct hpack_decoder *decoder = *_decoder;
+
+	if (decoder == NULL)
+		return;
+	*_decoder = NULL;
+
+	hpack_table_deinit(&decoder->table);
+	buffer_free(&decoder->strbuf);
+	i_free(decoder);
+}
+
+void hpack_decoder_set_max_table_size(struct hpack_decoder *decoder,
+				      size_t max_table_size)
+{
+	decoder->max_table_size = max_table_size;
+	if (decoder->table.max_size > max_table_size)
+		hpack_table_set_max_size(&decoder->table, max_table_size);
+}
+
+static int
+hpack_decode_literal(struct hpack_decoder *decoder,
+		     const unsigned char **data, const unsigned char *end,
+		     unsigned int prefix_bits, pool_t pool,
+		     struct hpack_header *header_r, size_t *name_len_r,
+		     size_t *value_len_r, const char **error_r)
+{
+	const char *value;
+	size_t name_idx;
+
+	if (hpack_decode_int(data, end, prefix_bits, &name_idx, error_r) < 0)
+		return -1;
+	if (name_idx == 0) {
+		if (hpack_decode_string(decoder, data, end, pool,
+					&header_r->name, name_len_r,
+					error_r) < 0)
+			return -1;
+		if (*name_len_r == 0) {
+			*error_r = "Empty header field name";
+			return -1;
+		}
+	} else if (name_idx > hpack_table_count(&decoder->table)) {
+		*error_r = t_strdup_printf("Invalid name index %zu", name_idx);
+		return -1;
+	} else {
+		hpack_table_get(&decoder->table, name_idx,
+				&header_r->name, &value);
+		header_r->name = p_strdup(pool, header_r->name);
+		*name_len_r = strlen(header_r->name);
+	}
+	return hpack_decode_string(decoder, data, end, pool,
+				   &header_r->value, value_len_r, error_r);
+}
+
+int hpack_decode(struct hpack_decoder *decoder,
+		 const unsigned char *data, size_t size, pool_t pool,
+		 ARRAY_TYPE(hpack_header) *headers, const char **error_r)
+{
+	const unsigned char *end = data + size;
+	struct hpack_header header;
+	size_t idx, name_len, value_len, list_size = 0;
+	bool fields_seen = FALSE;
+	unsigned char c;
+
+	while (data < end) {
+		i_zero(&header);
+		c = *data;
+		if ((c & 0x80) != 0) {
+			/* indexed header field */
+			if (hpack_decode_int(&data, end, 7, &idx, error_r) < 0)
+				return -1;
+			if (idx == 0 ||
+			    idx > hpack_table_count(&decoder->table)) {
+				*error_r = t_strdup_printf(
+					"Invalid index %zu", idx);
+				return -1;
+			}
+			hpack_table_get(&decoder->table, idx,
+					&header.name, &header.value);
+			name_len = strlen(header.name);
+			value_len = strlen(header.value);
+			header.name = p_strndup(pool, header.name, name_len);
+			header.value = p_strndup(pool, header.value, value_len);
+		} else if ((c & 0xc0) == 0x40) {
+			/* literal header field with incremental indexing */
+			if (hpack_decode_literal(decoder, &data, end, 6, pool,
+						 &header, &name_len,
+						 &value_len, error_r) < 0)
+				return -1;
+			hpack_table_add(&decoder->table,
+					header.name, name_len,
+					header.value, value_len);
+		} else if ((c & 0xe0) == 0x20) {
+			/* dynamic table size update */
+			if (fields_seen) {
+				*error_r = "Dynamic table size update "
+					"after header fields";
+				return -1;
+			}
+			if (hpack_decode_int(&data, end, 5, &idx, error_r) < 0)
+				return -1;
+			if (idx > decoder->max_table_size) {
+				*error_r = t_strdup_printf(
+					"Dynamic table size update %zu "
+					"exceeds the limit %zu",
+					idx, decoder->max_table_size);
+				return -1;
+			}
+			hpack_table_set_max_size(&decoder->table, idx);
+			continue;
+		} else {
+			/* literal header field without indexing (0000) or
+			   never indexed (0001) */
+			header.sensitive = (c & 0x10) != 0;
+			if (hpack_decode_literal(decoder, &data, end, 4, pool,
+						 &header, &name_len,
+						 &value_len, error_r) < 0)
+				return -1;
+		}
+
+		fields_seen = TRUE;
+		list_size += name_len + value_len + HPACK_ENTRY_OVERHEAD;
+		if (decoder->max_header_list_size > 0 &&
+		    list_size > decoder->max_header_list_size) {
+			*error_r = t_strdup_printf(
+				"Header list is too large (> %zu bytes)",
+				decoder->max_header_list_size);
+			return -1;
+		}
+		array_push_back(headers, &header);
+	}
+	return 0;
+}
+
+/*
+ * Encoder
+ */
+
+struct hpack_encoder *hpack_encoder_init(size_t max_table_size)
+{
+	struct hpack_encoder *encoder;
+
+	encoder = i_new(struct hpack_encoder, 1);
+	encoder->max_table_size = max_table_size;
+	hpack_table_init(&encoder->table, HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	hpack_encoder_set_max_table_size(encoder,
+					 HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	return encoder;
+}
+
+void hpack_encoder_deinit(struct hpack_encoder **_encoder)
+{
+	struct hpack_encoder *encoder = *_encoder;
+
+	if (encoder == NULL)
+		return;
+	*_encoder = NULL;
+
+	hpack_table_deinit(&encoder->table);
+	i_free(encoder);
+}
+
+void hpack_encoder_set_max_table_size(struct hpack_encoder *encoder,
+				      size_t max_table_size)
+{
+	size_t size = I_MIN(max_table_size, encoder->max_table_size);
+
+	if (size == encoder->table.max_size)
+		return;
+	if (!encoder->table_size_changed ||
+	    size < encoder->pending_min_table_size)
+		encoder->pending_min_table_size = size;
+	encoder->table_size_changed = TRUE;
+	hpack_table_set_max_size(&encoder->table, size);
+}
+
+static void
+hpack_encode_header(struct hpack_encoder *encoder, buffer_t *output,
+		    const struct hpack_header *header)
+{
+	const char *name = t_str_lcase(header->name);
+	unsigned int idx, name_idx;
+
+	idx = hpack_table_find(&encoder->table, name, header->value,
+			       &name_idx);
+	if (idx != 0 && !header->sensitive) {
+		/* indexed header field */
+		hpack_encode_int(output, 0x80, 7, idx);
+		return;
+	}
+
+	if (header->sensitive) {
+		/* literal header field never indexed */
+		if (idx != 0)
+			name_idx = idx;
+		hpack_encode_int(output, 0x10, 4, name_idx);
+	} else {
+		/* literal header field with incremental indexing */
+		hpack_encode_int(output, 0x40, 6, name_idx);
+		hpack_table_add(&encoder->table, name, strlen(name),
+				header->value, strlen(header->value));
+	}
+	if (name_idx == 0)
+		hpack_encode_string(output, name);
+	hpack_encode_string(output, header->value);
+}
+
+void hpack_encode(struct hpack_encoder *encoder, buffer_t *output,
+		  const struct hpack_header *headers, unsigned int count)
+{
+	unsigned int i;
+
+	if (encoder->table_size_changed) {
+		/* signal the smallest size since the previous header block,
+		   so the peer evicts the same entries (RFC 7541,
+		   Section 4.2) */
+		if (encoder->pending_min_table_size <
+		    encoder->table.max_size) {
+			hpack_encode_int(output, 0x20, 5,
+					 encoder->pending_min_table_size);
+		}
+		hpack_encode_int(output, 0x20, 5, encoder->table.max_size);
+		encoder->table_size_changed = FALSE;
+	}
+
+	T_BEGIN {
+		for (i = 0; i < count; i++)
+			hpack_encode_header(encoder, output, &headers[i]);
+	} T_END;
+}
@@ -0,0 +1,62 @@
+#ifndef HTTP2_HPACK_H
+#define HTTP2_HPACK_H
+
+/* HPACK header compression for HTTP/2 (RFC 7541) */
+
+/* Initial size of the dynamic table for both peers */
+#define HPACK_DEFAULT_HEADER_TABLE_SIZE 4096
+
+struct hpack_header {
+	/* HTTP/2 header field names are lowercase */
+	const char *name;
+	const char *value;
+	/* The field must never be added to a dynamic table - not by us nor
+	   by any intermediary. Use for e.g. authorization credentials. */
+	bool sensitive;
+};
+ARRAY_DEFINE_TYPE(hpack_header, struct hpack_header);
+
+/*
+ * Decoder
+ */
+
+/* max_table_size is the SETTINGS_HEADER_TABLE_SIZE advertised to the
+   peer. max_header_list_size limits the decoded size of a single header
+   block as defined for SETTINGS_MAX_HEADER_LIST_SIZE (0 = unlimited). */
+struct hpack_decoder *
+hpack_decoder_init(size_t max_table_size, size_t max_header_list_size);
+void hpack_decoder_deinit(struct hpack_decoder **_decoder);
+
+/* Change the advertised SETTINGS_HEADER_TABLE_SIZE. */
+void hpack_decoder_set_max_table_size(struct hpack_decoder *decoder,
+				      size_t max_table_size);
+
+/* Decode a complete header block (i.e. the concatenated HEADERS and
+   CONTINUATION frame payloads) and append the header fields to the headers
+   array. The strings are allocated from the given pool. Returns 0 on
+   success, -1 on error. Errors are connection errors of type
+   COMPRESSION_ERROR, because the decoder state is now unknown. */
+int hpack_decode(struct hpack_decoder *decoder,
+		 const unsigned char *data, size_t size, pool_t pool,
+		 ARRAY_TYPE(hpack_header) *headers, const char **error_r);
+
+/*
+ * Encoder
+ */
+
+/* max_table_size limits the size of the dynamic table used by the encoder,
+   even if the peer allows a larger one. */
+struct hpack_encoder *hpack_encoder_init(size_t max_table_size);
+void hpack_encoder_deinit(struct hpack_encoder **_encoder);
+
+/* Set the SETTINGS_HEADER_TABLE_SIZE received from the peer. The change is
+   signalled to the peer at the beginning of the next header block. */
+void hpack_encoder_set_max_table_size(struct hpack_encoder *encoder,
+				      size_t max_table_size);
+
+/* Encode the given header fields as a complete header block and append
+   it to output. */
+void hpack_encode(struct hpack_encoder *encoder, buffer_t *output,
+		  const struct hpack_header *headers, unsigned int count);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HTTP2_HUFFMAN_H
+#define HTTP2_HUFFMAN_H
+
+/* Huffman code used by HPACK for string literals (RFC 7541, Section 5.2) */
+
+/* Returns the size of the data once it's Huffman encoded. */
+size_t http2_huffman_encoded_length(const unsigned char *data, size_t size);
+/* Append the Huffman encoded data to output. */
+void http2_huffman_encode(buffer_t *output, const unsigned char *data,
+			  size_t size);
+/* Append the decoded data to output. Returns 0 on success, -1 if the input
+   isn't validly encoded. */
+int http2_huffman_decode(buffer_t *output, const unsigned char *data,
+			 size_t size, const char **error_r);
+
+#endif
@@ -0,0 +1,272 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "buffer.h"
+#include "hex-binary.h"
+#include "http2-frame.h"
+
+static void test_http2_frame_header(void)
+{
+	struct http2_frame_header hdr;
+	buffer_t *output;
+
+	test_begin("http2 frame header");
+	output = t_buffer_create(64);
+	http2_frame_header_write(output, HTTP2_FRAME_HEADERS,
+				 HTTP2_FRAME_FLAG_END_HEADERS, 3, 0x012345);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "012345010400000003");
+	test_assert(http2_frame_header_parse(output->data, output->used - 1,
+					     &hdr) == 0);
+	test_assert(http2_frame_header_parse(output->data, output->used,
+					     &hdr) == 1);
+	test_assert(hdr.length == 0x012345);
+	test_assert(hdr.type == HTTP2_FRAME_HEADERS);
+	test_assert(hdr.flags == HTTP2_FRAME_FLAG_END_HEADERS);
+	test_assert(hdr.stream_id == 3);
+
+	/* the reserved bit is ignored */
+	buffer_set_used_size(output, 0);
+	test_assert(hex_to_binary("000000000080000005", output) == 0);
+	test_assert(http2_frame_header_parse(output->data, output->used,
+					     &hdr) == 1);
+	test_assert(hdr.stream_id == 5);
+	test_end();
+}
+
+static void test_http2_frame_header_check(void)
+{
+	static const struct {
+		struct http2_frame_header hdr;
+		int ret;
+		enum http2_error_code error_code;
+	} tests[] = {
+		{ { 16384, HTTP2_FRAME_DATA, 0, 1 }, 0, 0 },
+		{ { 16385, HTTP2_FRAME_DATA, 0, 1 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 10, HTTP2_FRAME_DATA, 0, 0 },
+		  -1, HTTP2_ERROR_PROTOCOL_ERROR },
+		{ { 10, HTTP2_FRAME_HEADERS, 0, 0 },
+		  -1, HTTP2_ERROR_PROTOCOL_ERROR },
+		{ { 5, HTTP2_FRAME_PRIORITY, 0, 1 }, 0, 0 },
+		{ { 4, HTTP2_FRAME_PRIORITY, 0, 1 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 4, HTTP2_FRAME_RST_STREAM, 0, 1 }, 0, 0 },
+		{ { 4, HTTP2_FRAME_RST_STREAM, 0, 0 },
+		  -1, HTTP2_ERROR_PROTOCOL_ERROR },
+		{ { 12, HTTP2_FRAME_SETTINGS, 0, 0 }, 0, 0 },
+		{ { 7, HTTP2_FRAME_SETTINGS, 0, 0 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 6, HTTP2_FRAME_SETTINGS, HTTP2_FRAME_FLAG_ACK, 0 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 0, HTTP2_FRAME_SETTINGS, 0, 1 },
+		  -1, HTTP2_ERROR_PROTOCOL_ERROR },
+		{ { 8, HTTP2_FRAME_PING, 0, 0 }, 0, 0 },
+		{ { 8, HTTP2_FRAME_PING, 0, 1 },
+		  -1, HTTP2_ERROR_PROTOCOL_ERROR },
+		{ { 9, HTTP2_FRAME_PING, 0, 0 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 8, HTTP2_FRAME_GOAWAY, 0, 0 }, 0, 0 },
+		{ { 7, HTTP2_FRAME_GOAWAY, 0, 0 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 4, HTTP2_FRAME_WINDOW_UPDATE, 0, 0 }, 0, 0 },
+		{ { 4, HTTP2_FRAME_WINDOW_UPDATE, 0, 7 }, 0, 0 },
+		{ { 5, HTTP2_FRAME_WINDOW_UPDATE, 0, 7 },
+		  -1, HTTP2_ERROR_FRAME_SIZE_ERROR },
+		{ { 0, HTTP2_FRAME_CONTINUATION, 0, 0 },
+		  -1, HTTP2_ERROR_PROTOCOL_ERROR },
+		/* unknown frame type */
+		{ { 100, 0xfa, 0xff, 0 }, 0, 0 },
+	};
+	enum http2_error_code error_code;
+	const char *error;
+	unsigned int i;
+	int ret;
+
+	test_begin("http2 frame header check");
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		error_code = HTTP2_ERROR_NO_ERROR;
+		ret = http2_frame_header_check(&tests[i].hdr,
+					       HTTP2_DEFAULT_MAX_FRAME_SIZE,
+					       &error_code, &error);
+		test_assert_idx(ret == tests[i].ret, i);
+		test_assert_idx(error_code == tests[i].error_code, i);
+	}
+	test_end();
+}
+
+static void test_http2_frame_unpad(void)
+{
+	struct http2_frame_header hdr = {
+		.type = HTTP2_FRAME_HEADERS,
+		.flags = HTTP2_FRAME_FLAG_PADDED | HTTP2_FRAME_FLAG_PRIORITY,
+		.stream_id = 1,
+	};
+	const unsigned char payload[] = {
+		2, 0x80, 0, 0, 1, 16, 'a', 'b', 'c', 0, 0
+	};
+	const unsigned char *data = payload;
+	size_t size = sizeof(payload);
+	const char *error;
+
+	test_begin("http2 frame unpad");
+	test_assert(http2_frame_payload_unpad(&hdr, &data, &size, &error) == 0);
+	test_assert(size == 3 && memcmp(data, "abc", 3) == 0);
+
+	/* padding is longer than the payload */
+	hdr.type = HTTP2_FRAME_DATA;
+	hdr.flags = HTTP2_FRAME_FLAG_PADDED;
+	data = (const unsigned char *)"\x05" "abcd";
+	size = 5;
+	test_assert(http2_frame_payload_unpad(&hdr, &data, &size, &error) < 0);
+	/* missing pad length */
+	size = 0;
+	test_assert(http2_frame_payload_unpad(&hdr, &data, &size, &error) < 0);
+	test_end();
+}
+
+static void test_http2_settings(void)
+{
+	struct http2_settings set, parsed;
+	struct http2_frame_header hdr;
+	enum http2_error_code error_code;
+	const char *error;
+	buffer_t *output;
+
+	test_begin("http2 settings");
+	output = t_buffer_create(128);
+
+	/* defaults produce an empty SETTINGS frame */
+	http2_settings_init_default(&set);
+	http2_frame_write_settings(output, &set);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000000040000000000");
+
+	set.enable_push = FALSE;
+	set.initial_window_size = 1024*1024;
+	set.max_concurrent_streams = 100;
+	buffer_set_used_size(output, 0);
+	http2_frame_write_settings(output, &set);
+	test_assert(http2_frame_header_parse(output->data, output->used,
+					     &hdr) == 1);
+	test_assert(hdr.type == HTTP2_FRAME_SETTINGS && hdr.length == 18);
+	test_assert(http2_frame_header_check(&hdr,
+					     HTTP2_DEFAULT_MAX_FRAME_SIZE,
+					     &error_code, &error) == 0);
+	http2_settings_init_default(&parsed);
+	test_assert(http2_settings_parse(&parsed,
+		CONST_PTR_OFFSET(output->data, HTTP2_FRAME_HEADER_SIZE),
+		hdr.length, &error_code, &error) == 0);
+	test_assert(memcmp(&set, &parsed, sizeof(set)) == 0);
+
+	/* invalid values */
+	buffer_set_used_size(output, 0);
+	test_assert(hex_to_binary("000200000002", output) == 0);
+	test_assert(http2_settings_parse(&parsed, output->data, output->used,
+					 &error_code, &error) < 0);
+	test_assert(error_code == HTTP2_ERROR_PROTOCOL_ERROR);
+	buffer_set_used_size(output, 0);
+	test_assert(hex_to_binary("000480000000", output) == 0);
+	test_assert(http2_settings_parse(&parsed, output->data, output->used,
+					 &error_code, &error) < 0);
+	test_assert(error_code == HTTP2_ERROR_FLOW_CONTROL_ERROR);
+	buffer_set_used_size(output, 0);
+	test_assert(hex_to_binary("000500003fff", output) == 0);
+	test_assert(http2_settings_parse(&parsed, output->data, output->used,
+					 &error_code, &error) < 0);
+	test_assert(error_code == HTTP2_ERROR_PROTOCOL_ERROR);
+	/* unknown settings are ignored */
+	buffer_set_used_size(output, 0);
+	test_assert(hex_to_binary("00ff12345678", output) == 0);
+	test_assert(http2_settings_parse(&parsed, output->data, output->used,
+					 &error_code, &error) == 0);
+
+	buffer_set_used_size(output, 0);
+	http2_frame_write_settings_ack(output);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000000040100000000");
+	test_end();
+}
+
+static void test_http2_frame_write(void)
+{
+	struct http2_goaway goaway;
+	const char *error;
+	uint32_t increment;
+	buffer_t *output;
+
+	test_begin("http2 frame write");
+	output = t_buffer_create(128);
+
+	http2_frame_write_ping(output, TRUE,
+			       (const unsigned char *)"12345678");
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000008060100000000" "3132333435363738");
+
+	buffer_set_used_size(output, 0);
+	http2_frame_write_window_update(output, 3, 0x10000);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000004080000000003" "00010000");
+	test_assert(http2_frame_parse_window_update(
+		CONST_PTR_OFFSET(output->data, HTTP2_FRAME_HEADER_SIZE),
+		&increment, &error) == 0);
+	test_assert(increment == 0x10000);
+	test_assert(http2_frame_parse_window_update(
+		(const unsigned char *)"\x80\0\0\0", &increment, &error) < 0);
+
+	buffer_set_used_size(output, 0);
+	http2_frame_write_rst_stream(output, 5, HTTP2_ERROR_CANCEL);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000004030000000005" "00000008");
+	test_assert(http2_frame_parse_rst_stream(
+		CONST_PTR_OFFSET(output->data, HTTP2_FRAME_HEADER_SIZE)) ==
+		HTTP2_ERROR_CANCEL);
+
+	buffer_set_used_size(output, 0);
+	http2_frame_write_goaway(output, 7, HTTP2_ERROR_PROTOCOL_ERROR, "x");
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000009070000000000" "0000000700000001" "78");
+	http2_frame_parse_goaway(
+		CONST_PTR_OFFSET(output->data, HTTP2_FRAME_HEADER_SIZE),
+		output->used - HTTP2_FRAME_HEADER_SIZE, &goaway);
+	test_assert(goaway.last_stream_id == 7);
+	test_assert(goaway.error_code == HTTP2_ERROR_PROTOCOL_ERROR);
+	test_assert(goaway.debug_data_size == 1 &&
+		    goaway.debug_data[0] == 'x');
+	test_assert_strcmp(http2_error_code_to_str(goaway.error_code),
+			   "PROTOCOL_ERROR");
+	test_assert_strcmp(http2_error_code_to_str(0x100), "0x100");
+
+	/* DATA split into two frames */
+	buffer_set_used_size(output, 0);
+	http2_frame_write_data(output, 1, "abcde", 5, TRUE, 3);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000003000000000001" "616263"
+			   "000002000100000001" "6465");
+	/* empty DATA */
+	buffer_set_used_size(output, 0);
+	http2_frame_write_data(output, 1, "", 0, TRUE, 3);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000000000100000001");
+
+	/* HEADERS with CONTINUATION */
+	buffer_set_used_size(output, 0);
+	http2_frame_write_headers(output, 3, "abcde", 5, TRUE, 3);
+	test_assert_strcmp(binary_to_hex(output->data, output->used),
+			   "000003010100000003" "616263"
+			   "000002090400000003" "6465");
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_http2_frame_header,
+		test_http2_frame_header_check,
+		test_http2_frame_unpad,
+		test_http2_settings,
+		test_http2_frame_write,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,353 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "hex-binary.h"
+#include "http2-huffman.h"
+#include "http2-hpack.h"
+
+struct hpack_test_header_block {
+	const char *hex;
+	const struct hpack_header *headers;
+};
+
+/* RFC 7541, Appendix C.3 and C.4: requests */
+static const struct hpack_header request1_headers[] = {
+	{ ":method", "GET", FALSE },
+	{ ":scheme", "http", FALSE },
+	{ ":path", "/", FALSE },
+	{ ":authority", "www.example.com", FALSE },
+	{ NULL, NULL, FALSE }
+};
+static const struct hpack_header request2_headers[] = {
+	{ ":method", "GET", FALSE },
+	{ ":scheme", "http", FALSE },
+	{ ":path", "/", FALSE },
+	{ ":authority", "www.example.com", FALSE },
+	{ "cache-control", "no-cache", FALSE },
+	{ NULL, NULL, FALSE }
+};
+static const struct hpack_header request3_headers[] = {
+	{ ":method", "GET", FALSE },
+	{ ":scheme", "https", FALSE },
+	{ ":path", "/index.html", FALSE },
+	{ ":authority", "www.example.com", FALSE },
+	{ "custom-key", "custom-value", FALSE },
+	{ NULL, NULL, FALSE }
+};
+
+static const struct hpack_test_header_block requests_plain[] = {
+	{ "828684410f7777772e6578616d706c652e636f6d", request1_headers },
+	{ "828684be58086e6f2d6361636865", request2_headers },
+	{ "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+	  request3_headers },
+};
+
+static const struct hpack_test_header_block requests_huffman[] = {
+	{ "828684418cf1e3c2e5f23a6ba0ab90f4ff", request1_headers },
+	{ "828684be5886a8eb10649cbf", request2_headers },
+	{ "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+	  request3_headers },
+};
+
+/* RFC 7541, Appendix C.6: responses with a 256 byte table */
+static const struct hpack_header response1_headers[] = {
+	{ ":status", "302", FALSE },
+	{ "cache-control", "private", FALSE },
+	{ "date", "Mon, 21 Oct 2013 20:13:21 GMT", FALSE },
+	{ "location", "https://www.example.com", FALSE },
+	{ NULL, NULL, FALSE }
+};
+static const struct hpack_header response2_headers[] = {
+	{ ":status", "307", FALSE },
+	{ "cache-control", "private", FALSE },
+	{ "date", "Mon, 21 Oct 2013 20:13:21 GMT", FALSE },
+	{ "location", "https://www.example.com", FALSE },
+	{ NULL, NULL, FALSE }
+};
+static const struct hpack_header response3_headers[] = {
+	{ ":status", "200", FALSE },
+	{ "cache-control", "private", FALSE },
+	{ "date", "Mon, 21 Oct 2013 20:13:22 GMT", FALSE },
+	{ "location", "https://www.example.com", FALSE },
+	{ "content-encoding", "gzip", FALSE },
+	{ "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; "
+	  "max-age=3600; version=1", FALSE },
+	{ NULL, NULL, FALSE }
+};
+
+static const struct hpack_test_header_block responses_huffman[] = {
+	{ "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e0"
+	  "82a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+	  response1_headers },
+	{ "4883640effc1c0bf", response2_headers },
+	{ "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839b"
+	  "d9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab27"
+	  "0fb5291f9587316065c003ed4ee5b1063d5007",
+	  response3_headers },
+};
+
+static unsigned int hpack_test_headers_count(const struct hpack_header *headers)
+{
+	unsigned int count = 0;
+
+	while (headers[count].name != NULL)
+		count++;
+	return count;
+}
+
+static void
+test_hpack_decode_blocks(const char *name,
+			 const struct hpack_test_header_block *blocks,
+			 unsigned int blocks_count, size_t table_size)
+{
+	struct hpack_decoder *decoder;
+	ARRAY_TYPE(hpack_header) headers;
+	const struct hpack_header *header;
+	const char *error;
+	buffer_t *data;
+	unsigned int i, j, count;
+
+	test_begin(t_strdup_printf("hpack decode %s", name));
+	decoder = hpack_decoder_init(table_size, 0);
+	if (table_size != HPACK_DEFAULT_HEADER_TABLE_SIZE) {
+		/* the test vectors assume the table already has the size */
+		i_assert(table_size == 256);
+		data = t_buffer_create(8);
+		test_assert(hex_to_binary("3fe101", data) == 0);
+		t_array_init(&headers, 1);
+		test_assert(hpack_decode(decoder, data->data, data->used,
+					 pool_datastack_create(), &headers,
+					 &error) == 0);
+	}
+	for (i = 0; i < blocks_count; i++) {
+		data = t_buffer_create(128);
+		test_assert_idx(hex_to_binary(blocks[i].hex, data) == 0, i);
+		t_array_init(&headers, 8);
+		test_assert_idx(hpack_decode(decoder, data->data, data->used,
+					     pool_datastack_create(), &headers,
+					     &error) == 0, i);
+
+		count = hpack_test_headers_count(blocks[i].headers);
+		test_assert_idx(array_count(&headers) == count, i);
+		for (j = 0; j < count && j < array_count(&headers); j++) {
+			header = array_idx(&headers, j);
+			test_assert_idx(strcmp(header->name,
+				blocks[i].headers[j].name) == 0, i*100 + j);
+			test_assert_idx(strcmp(header->value,
+				blocks[i].headers[j].value) == 0, i*100 + j);
+		}
+	}
+	hpack_decoder_deinit(&decoder);
+	test_end();
+}
+
+static void test_hpack_decode(void)
+{
+	test_hpack_decode_blocks("requests", requests_plain,
+				 N_ELEMENTS(requests_plain),
+				 HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	test_hpack_decode_blocks("requests huffman", requests_huffman,
+				 N_ELEMENTS(requests_huffman),
+				 HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	test_hpack_decode_blocks("responses huffman", responses_huffman,
+				 N_ELEMENTS(responses_huffman), 256);
+}
+
+static void
+test_hpack_encode_blocks(const char *name,
+			 const struct hpack_test_header_block *blocks,
+			 unsigned int blocks_count, size_t table_size)
+{
+	struct hpack_encoder *encoder;
+	buffer_t *output;
+	unsigned int i;
+
+	test_begin(t_strdup_printf("hpack encode %s", name));
+	encoder = hpack_encoder_init(table_size);
+	output = t_buffer_create(128);
+	/* the first block signals the non-default table size */
+	if (table_size != HPACK_DEFAULT_HEADER_TABLE_SIZE) {
+		i_assert(table_size == 256);
+		hpack_encode(encoder, output, NULL, 0);
+		test_assert_strcmp(binary_to_hex(output->data, output->used),
+				   "3fe101");
+	}
+	for (i = 0; i < blocks_count; i++) {
+		buffer_set_used_size(output, 0);
+		hpack_encode(encoder, output, blocks[i].headers,
+			     hpack_test_headers_count(blocks[i].headers));
+		test_assert_strcmp_idx(binary_to_hex(output->data,
+						     output->used),
+				       blocks[i].hex, i);
+	}
+	hpack_encoder_deinit(&encoder);
+	test_end();
+}
+
+static void test_hpack_encode(void)
+{
+	/* The encoder uses Huffman encoding unless it's longer, like the
+	   test vectors do. */
+	test_hpack_encode_blocks("requests huffman", requests_huffman,
+				 N_ELEMENTS(requests_huffman),
+				 HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	test_hpack_encode_blocks("responses huffman", responses_huffman,
+				 N_ELEMENTS(responses_huffman), 256);
+}
+
+static void test_hpack_roundtrip(void)
+{
+	static const struct hpack_header headers[] = {
+		{ ":method", "POST", FALSE },
+		{ ":path", "/solr/dovecot/update", FALSE },
+		{ "Content-Type", "text/xml", FALSE },
+		{ "authorization", "Basic dXNlcjpwYXNz", TRUE },
+		{ "x-binary", "\x01\x7f\x80\xfe\xff", FALSE },
+		{ "x-empty", "", FALSE },
+	};
+	struct hpack_encoder *encoder;
+	struct hpack_decoder *decoder;
+	ARRAY_TYPE(hpack_header) decoded;
+	const struct hpack_header *header;
+	const char *error;
+	buffer_t *output;
+	unsigned int i, round;
+
+	test_begin("hpack roundtrip");
+	encoder = hpack_encoder_init(HPACK_DEFAULT_HEADER_TABLE_SIZE);
+	decoder = hpack_decoder_init(HPACK_DEFAULT_HEADER_TABLE_SIZE, 0);
+	output = t_buffer_create(256);
+	for (round = 0; round < 3; round++) {
+		if (round == 2) {
+			/* the peer shrinks the table */
+			hpack_encoder_set_max_table_size(encoder, 64);
+		}
+		buffer_set_used_size(output, 0);
+		hpack_encode(encoder, output, headers, N_ELEMENTS(headers));
+		t_array_init(&decoded, N_ELEMENTS(headers));
+		test_assert(hpack_decode(decoder, output->data, output->used,
+					 pool_datastack_create(), &decoded,
+					 &error) == 0);
+		test_assert(array_count(&decoded) == N_ELEMENTS(headers));
+		for (i = 0; i < array_count(&decoded); i++) {
+			header = array_idx(&decoded, i);
+			test_assert_idx(strcasecmp(header->name,
+						   headers[i].name) == 0, i);
+			test_assert_idx(strcmp(header->value,
+					       headers[i].value) == 0, i);
+			test_assert_idx(header->sensitive ==
+					headers[i].sensitive, i);
+		}
+		if (round == 1) {
+			/* everything except the sensitive header is now
+			   indexed */
+			test_assert(output->used < 40);
+		}
+	}
+	hpack_encoder_deinit(&encoder);
+	hpack_decoder_deinit(&decoder);
+	test_end();
+}
+
+static void test_hpack_decode_invalid(void)
+{
+	static const char *const invalid[] = {
+		/* index 0 */
+		"80",
+		/* index beyond the table */
+		"be",
+		/* truncated integer */
+		"ff",
+		/* integer overflow */
+		"ffffffffffffff01",
+		/* truncated string */
+		"400a6162",
+		/* table size update after a field */
+		"8220",
+		/* table size update above the limit */
+		"3fe21f",
+		/* empty name */
+		"40000161",
+		/* NUL in value */
+		"4001610162" "00",
+		/* Huffman: EOS symbol */
+		"4001618" "4ffffffff",
+		/* Huffman: too much padding */
+		"40016182" "1fff",
+		/* Huffman: padding isn't all ones */
+		"40016181" "1e",
+	};
+	struct hpack_decoder *decoder;
+	ARRAY_TYPE(hpack_header) headers;
+	const char *error;
+	buffer_t *data;
+	unsigned int i;
+
+	test_begin("hpack decode invalid");
+	for (i = 0; i < N_ELEMENTS(invalid); i++) {
+		decoder = hpack_decoder_init(HPACK_DEFAULT_HEADER_TABLE_SIZE,
+					     0);
+		data = t_buffer_create(32);
+		test_assert_idx(hex_to_binary(invalid[i], data) == 0, i);
+		t_array_init(&headers, 4);
+		test_assert_idx(hpack_decode(decoder, data->data, data->used,
+					     pool_datastack_create(), &headers,
+					     &error) < 0, i);
+		hpack_decoder_deinit(&decoder);
+	}
+
+	/* header list size limit */
+	decoder = hpack_decoder_init(HPACK_DEFAULT_HEADER_TABLE_SIZE, 64);
+	data = t_buffer_create(32);
+	test_assert(hex_to_binary("828282", data) == 0);
+	t_array_init(&headers, 4);
+	test_assert(hpack_decode(decoder, data->data, data->used,
+				 pool_datastack_create(), &headers,
+				 &error) < 0);
+	hpack_decoder_deinit(&decoder);
+	test_end();
+}
+
+static void test_http2_huffman(void)
+{
+	buffer_t *encoded, *decoded;
+	unsigned char data[256];
+	const char *error;
+	unsigned int i;
+
+	test_begin("http2 huffman");
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+	encoded = t_buffer_create(1024);
+	decoded = t_buffer_create(256);
+	for (i = 0; i <= sizeof(data); i++) {
+		buffer_set_used_size(encoded, 0);
+		buffer_set_used_size(decoded, 0);
+		http2_huffman_encode(encoded, data + sizeof(data) - i, i);
+		test_assert_idx(encoded->used ==
+			http2_huffman_encoded_length(data + sizeof(data) - i, i),
+			i);
+		test_assert_idx(http2_huffman_decode(decoded, encoded->data,
+						     encoded->used,
+						     &error) == 0, i);
+		test_assert_idx(decoded->used == i &&
+			memcmp(decoded->data, data + sizeof(data) - i, i) == 0,
+			i);
+	}
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_http2_huffman,
+		test_hpack_decode,
+		test_hpack_encode,
+		test_hpack_roundtrip,
+		test_hpack_decode_invalid,
+		NULL
+	};
+	return test_run(test_functions);
+}
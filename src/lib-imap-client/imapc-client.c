@@ -549,19 +549,13 @@ int imapc_client_create_temp_fd(struct imapc_client *client,
 
 	path = t_str_new(128);
 	str_append(path, client->set.temp_path_prefix);
-	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	/* we just want the fd, so create it unlinked */
+	fd = safe_mkstemp_hostpid_unlinked(path, 0600);
 	if (fd == -1) {
 		e_error(client->event,
 			"safe_mkstemp(%s) failed: %m", str_c(path));
 		return -1;
 	}
-
-	/* we just want the fd, unlink it */
-	if (i_unlink(str_c(path)) < 0) {
-		/* shouldn't happen.. */
-		i_close_fd(&fd);
-		return -1;
-	}
 	*path_r = str_c(path);
 	return fd;
 }
@@ -461,6 +461,21 @@ imap_msgpart_crlf_seek(struct mail *mail, struct istream *input,
 	return crlf_input;
 }
 
+static void imap_msgpart_lookup_nul_state(struct mail *mail)
+{
+	struct message_part *parts;
+
+	if (mail->has_nuls || mail->has_no_nuls)
+		return;
+
+	/* Looking up the message parts from cache updates the NUL state.
+	   Don't parse the mail just for this though. */
+	i_assert(mail->lookup_abort == MAIL_LOOKUP_ABORT_NEVER);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	(void)mail_get_parts(mail, &parts);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
+}
+
 static void
 imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 			 bool convert_nuls, bool use_partial_cache,
@@ -501,6 +516,12 @@ imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 		result->size = bytes_left;
 	}
 
+	if (convert_nuls && have_crlfs && i_stream_get_fd(result->input) != -1) {
+		/* The input can still be sent with sendfile(), unless it
+		   gets wrapped by the nonuls istream. Avoid that if the
+		   cached message parts show that there are no NULs. */
+		imap_msgpart_lookup_nul_state(mail);
+	}
 	if (!mail->has_no_nuls && convert_nuls) {
 		/* IMAP literals must not contain NULs. change them to
 		   0x80 characters. */
@@ -764,7 +785,7 @@ imap_msgpart_parse_bodystructure(struct mail *mail,
 	if (mail_get_special(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE,
 			     &bodystructure) < 0)
 		return -1;
-	if (all_parts->context != NULL) {
+	if (all_parts->data != NULL) {
 		/* we just parsed the bodystructure */
 		return 0;
 	}
@@ -828,7 +849,9 @@ int imap_msgpart_bodypartstructure(struct mail *mail,
 
 	if (mail_get_parts(mail, &all_parts) < 0)
 		return -1;
-	if (all_parts->context == NULL) {
+	if (all_parts->data == NULL) {
+		/* the parsed BODYSTRUCTURE is kept in the message_parts, so
+		   it's parsed only once per mail */
 		if (imap_msgpart_parse_bodystructure(mail, all_parts) < 0)
 			return -1;
 	}
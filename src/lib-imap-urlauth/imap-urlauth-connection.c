@@ -523,20 +523,14 @@ imap_urlauth_connection_create_temp_fd(struct imap_urlauth_connection *conn,
 
 	path = t_str_new(128);
 	mail_user_set_get_temp_prefix(path, conn->user->set);
-	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	/* we just want the fd, so create it unlinked */
+	fd = safe_mkstemp_hostpid_unlinked(path, 0600);
 	if (fd == -1) {
 		e_error(conn->event,
 			"safe_mkstemp(%s) failed: %m", str_c(path));
 		return -1;
 	}
 
-	/* we just want the fd, unlink it */
-	if (i_unlink(str_c(path)) < 0) {
-		/* shouldn't happen.. */
-		i_close_fd(&fd);
-		return -1;
-	}
-
 	*path_r = str_c(path);
 	return fd;
 }
@@ -927,6 +927,53 @@ int imap_parser_finish_line(struct imap_parser *parser, unsigned int count,
 	return finish_line(parser, count, args_r);
 }
 
+bool imap_parser_peek_simple_line(struct imap_parser *parser,
+				  const unsigned char **data_r, size_t *size_r)
+{
+	const unsigned char *data;
+	size_t i, data_size;
+
+	if (parser->cur_type != ARG_PARSE_NONE || parser->eol ||
+	    parser->args_added_extra_eol || parser->cur_pos != 0 ||
+	    array_count(&parser->root_list) > 0)
+		return FALSE;
+
+	data = i_stream_get_data(parser->input, &data_size);
+	for (i = 0; i < data_size; i++) {
+		switch (data[i]) {
+		case '\r':
+			if (i + 1 == data_size || data[i + 1] != '\n')
+				return FALSE;
+			/* fall through */
+		case '\n':
+			if (parser->line_size + i > parser->max_line_size)
+				return FALSE;
+			*data_r = data;
+			*size_r = i;
+			return TRUE;
+		case '"':
+		case '{':
+			/* quoted string or literal */
+			return FALSE;
+		default:
+			if (data[i] < ' ' || data[i] >= 0x7f)
+				return FALSE;
+			break;
+		}
+	}
+	/* line isn't fully buffered yet */
+	return FALSE;
+}
+
+void imap_parser_skip_simple_line(struct imap_parser *parser, size_t size)
+{
+	i_assert(parser->cur_type == ARG_PARSE_NONE);
+
+	parser->line_size += size;
+	i_stream_skip(parser->input, size);
+	parser->eol = TRUE;
+}
+
 const char *imap_parser_read_word(struct imap_parser *parser)
 {
 	const unsigned char *data;
@@ -98,6 +98,20 @@ int imap_parser_finish_line(struct imap_parser *parser, unsigned int count,
 			    enum imap_parser_flags flags,
 			    const struct imap_arg **args_r);
 
+/* Fast path for commands whose parameters are only atoms and lists of atoms:
+   If the rest of the command line is already fully buffered and contains no
+   quoted strings or literals, return it without the CRLF. Returns FALSE if
+   the line isn't fully buffered, isn't simple or if some arguments have
+   already been read. Nothing is consumed from the input, so the caller can
+   still fall back to imap_parser_read_args(). The returned data is valid only
+   until the input stream is read or skipped. */
+bool imap_parser_peek_simple_line(struct imap_parser *parser,
+				  const unsigned char **data_r, size_t *size_r);
+/* Consume the line returned by imap_parser_peek_simple_line(). Afterwards
+   the parser is at the end of the line, as if imap_parser_read_args() had
+   read all the arguments. */
+void imap_parser_skip_simple_line(struct imap_parser *parser, size_t size);
+
 /* Read one word - used for reading tag and command name.
    Returns NULL if more data is needed. */
 const char *imap_parser_read_word(struct imap_parser *parser);
@@ -1,6 +1,8 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "seq-set.h"
 #include "imap-seqset.h"
 
 static uint32_t get_next_number(const char **str)
@@ -68,21 +70,56 @@ get_next_seq_range(const char **str, uint32_t *seq1_r, uint32_t *seq2_r)
 	return 0;
 }
 
+static bool
+seq_range_array_can_append(const ARRAY_TYPE(seq_range) *array, uint32_t seq1)
+{
+	const struct seq_range *range;
+
+	if (array_is_empty(array))
+		return TRUE;
+	range = array_back(array);
+	return seq1 > range->seq2;
+}
+
 int imap_seq_set_parse(const char *str, ARRAY_TYPE(seq_range) *dest)
 {
+	struct seq_set *set = NULL;
 	uint32_t seq1, seq2;
+	int ret = 0;
 
 	while (*str != '\0') {
-		if (get_next_seq_range(&str, &seq1, &seq2) < 0)
-			return -1;
-		seq_range_array_add_range(dest, seq1, seq2);
+		if (get_next_seq_range(&str, &seq1, &seq2) < 0) {
+			ret = -1;
+			break;
+		}
+		if (set != NULL)
+			(void)seq_set_add_range(set, seq1, seq2);
+		else if (seq_range_array_can_append(dest, seq1))
+			seq_range_array_add_range(dest, seq1, seq2);
+		else {
+			/* Ranges aren't in ascending order. Inserting them
+			   into the middle of a large array would memmove()
+			   it each time, so continue with a seq_set. */
+			set = seq_set_init();
+			seq_set_add_array(set, dest);
+			(void)seq_set_add_range(set, seq1, seq2);
+		}
 
 		if (*str == ',')
 			str++;
-		else if (*str != '\0')
-			return -1;
+		else if (*str != '\0') {
+			ret = -1;
+			break;
+		}
 	}
-	return 0;
+	if (set != NULL) {
+		if (ret == 0) {
+			array_clear(dest);
+			seq_set_to_array(set, dest);
+		}
+		seq_set_deinit(&set);
+	}
+	return ret;
 }
 
 int imap_seq_set_nostar_parse(const char *str, ARRAY_TYPE(seq_range) *dest)
@@ -150,12 +150,72 @@ static void test_imap_parser_read_tag_cmd(void)
 	test_end();
 }
 
+static void test_imap_parser_simple_line(void)
+{
+	static const struct {
+		const char *input;
+		const char *line;
+	} tests[] = {
+		{ "1:* (FLAGS UID)\r\n", "1:* (FLAGS UID)" },
+		{ "1 +FLAGS (\\Seen)\n", "1 +FLAGS (\\Seen)" },
+		{ "\r\n", "" },
+		{ "1:* (FLAGS UID)", NULL },
+		{ "1:* (FLAGS UID)\r", NULL },
+		{ "1 BODY \"foo\"\r\n", NULL },
+		{ "1 APPEND {3}\r\n", NULL },
+		{ "1 \x01\r\n", NULL },
+		{ "1 \x80\r\n", NULL },
+	};
+	struct istream *input;
+	struct imap_parser *parser;
+	const struct imap_arg *args;
+	const unsigned char *data;
+	size_t size;
+	unsigned int i;
+
+	test_begin("imap parser simple line");
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		input = test_istream_create(tests[i].input);
+		test_assert_idx(i_stream_read(input) > 0, i);
+		parser = imap_parser_create(input, NULL, 1024);
+		if (tests[i].line == NULL) {
+			test_assert_idx(!imap_parser_peek_simple_line(parser,
+							&data, &size), i);
+		} else if (!imap_parser_peek_simple_line(parser, &data, &size)) {
+			test_assert_idx(FALSE, i);
+		} else {
+			test_assert_idx(size == strlen(tests[i].line) &&
+					memcmp(data, tests[i].line, size) == 0, i);
+			imap_parser_skip_simple_line(parser, size);
+			test_assert_idx(imap_parser_read_args(parser, 0, 0,
+							      &args) == 0, i);
+			test_assert_idx(IMAP_ARG_IS_EOL(&args[0]), i);
+		}
+		imap_parser_unref(&parser);
+		i_stream_destroy(&input);
+	}
+
+	/* not allowed after the generic parser has started */
+	input = test_istream_create("(FLAGS UID)\r\n");
+	parser = imap_parser_create(input, NULL, 1024);
+	test_istream_set_size(input, 3);
+	test_assert(i_stream_read(input) > 0);
+	test_assert(imap_parser_read_args(parser, 0, 0, &args) == -2);
+	test_istream_set_size(input, 13);
+	test_assert(i_stream_read(input) > 0);
+	test_assert(!imap_parser_peek_simple_line(parser, &data, &size));
+	imap_parser_unref(&parser);
+	i_stream_destroy(&input);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_imap_parser_crlf,
 		test_imap_parser_partial_list,
 		test_imap_parser_read_tag_cmd,
+		test_imap_parser_simple_line,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,320 @@
+/* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+#include "mail-cache.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define BENCH_DIR_NAME ".dovecot.bench"
+#define BENCH_INDEX_PREFIX "bench.dovecot.index"
+#define BENCH_APPEND_BATCH_SIZE 100
+#define BENCH_FLAG_UPDATE_COUNT 1000
+
+/**
+ * Generates a synthetic mailbox index with the given number of messages,
+ * keywords and cached fields, and measures how long the most common index
+ * operations take: appending to the transaction log, syncing the log into
+ * the map, writing the index file, opening the index and cache lookups.
+ */
+
+struct bench_ctx {
+	unsigned int message_count;
+	unsigned int keyword_count;
+	unsigned int field_count;
+
+	struct mail_index *index;
+	unsigned int *field_idxs;
+};
+
+static void bench_print(const char *name, uint64_t ts_0, uint64_t ts_1,
+			unsigned long count, const char *unit)
+{
+	double usecs = (double)(ts_1 - ts_0) / 1000.0;
+
+	printf("%s\n\tTotal: %0.02lf ms\n\t%0.03lf us/%s\n\n",
+	       name, usecs / 1000.0, usecs / (double)count, unit);
+}
+
+static struct mail_index *bench_index_open(struct bench_ctx *ctx)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(NULL, BENCH_DIR_NAME, BENCH_INDEX_PREFIX);
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) < 0) {
+		i_fatal("mail_index_open_or_create() failed: %s",
+			mail_index_get_error_message(index));
+	}
+	if (ctx->field_idxs == NULL)
+		ctx->field_idxs = i_new(unsigned int, ctx->field_count);
+	for (unsigned int i = 0; i < ctx->field_count; i++) {
+		struct mail_cache_field field = {
+			.name = t_strdup_printf("bench-field-%u", i),
+			.type = MAIL_CACHE_FIELD_STRING,
+			.decision = MAIL_CACHE_DECISION_YES,
+		};
+		mail_cache_register_fields(index->cache, &field, 1,
+					   default_pool);
+		ctx->field_idxs[i] = field.idx;
+	}
+	return index;
+}
+
+static void bench_index_close(struct mail_index **index)
+{
+	mail_index_close(*index);
+	mail_index_free(index);
+}
+
+static void bench_commit(struct mail_index_transaction **trans)
+{
+	if (mail_index_transaction_commit(trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+}
+
+static void bench_refresh(struct bench_ctx *ctx)
+{
+	if (mail_index_refresh(ctx->index) < 0)
+		i_fatal("mail_index_refresh() failed");
+}
+
+static void bench_log_append(struct bench_ctx *ctx)
+{
+	struct mail_index_view *view, *updated_view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	struct mail_keywords *keywords[ctx->keyword_count + 1];
+	const char *keyword_names[2] = { NULL, NULL };
+	uint32_t seq, uid_validity = 12345;
+	char data[64];
+	uint64_t ts_0, ts_1;
+
+	for (unsigned int i = 0; i < ctx->keyword_count; i++) {
+		keyword_names[0] = t_strdup_printf("$keyword%u", i);
+		keywords[i] = mail_index_keywords_create(ctx->index,
+							 keyword_names);
+	}
+
+	ts_0 = i_nanoseconds();
+	for (unsigned int n = 0; n < ctx->message_count; ) {
+		bench_refresh(ctx);
+		view = mail_index_view_open(ctx->index);
+		trans = mail_index_transaction_begin(view, 0);
+		updated_view = mail_index_transaction_open_updated_view(trans);
+		cache_view = mail_cache_view_open(ctx->index->cache,
+						  updated_view);
+		cache_trans = mail_cache_get_transaction(cache_view, trans);
+		if (n == 0) {
+			mail_index_update_header(trans,
+				offsetof(struct mail_index_header, uid_validity),
+				&uid_validity, sizeof(uid_validity), TRUE);
+		}
+		for (unsigned int i = 0; i < BENCH_APPEND_BATCH_SIZE &&
+		     n < ctx->message_count; i++, n++) {
+			mail_index_append(trans, n + 1, &seq);
+			if (i_rand_limit(2) == 0) {
+				mail_index_update_flags(trans, seq,
+					MODIFY_ADD, MAIL_SEEN);
+			}
+			if (ctx->keyword_count > 0 && i_rand_limit(4) == 0) {
+				mail_index_update_keywords(trans, seq,
+					MODIFY_ADD,
+					keywords[i_rand_limit(ctx->keyword_count)]);
+			}
+			for (unsigned int f = 0; f < ctx->field_count; f++) {
+				int len = i_snprintf(data, sizeof(data),
+						     "field %u of mail %u", f, n);
+				mail_cache_add(cache_trans, seq,
+					       ctx->field_idxs[f], data, len);
+			}
+		}
+		bench_commit(&trans);
+		mail_cache_view_close(&cache_view);
+		mail_index_view_close(&updated_view);
+		mail_index_view_close(&view);
+	}
+	ts_1 = i_nanoseconds();
+
+	for (unsigned int i = 0; i < ctx->keyword_count; i++)
+		mail_index_keywords_unref(&keywords[i]);
+
+	bench_print("mail_transaction_log_append (append mails)", ts_0, ts_1,
+		    ctx->message_count, "mail");
+}
+
+static void bench_flag_updates(struct bench_ctx *ctx)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint64_t ts_0, ts_1;
+
+	bench_refresh(ctx);
+	view = mail_index_view_open(ctx->index);
+	ts_0 = i_nanoseconds();
+	for (unsigned int i = 0; i < BENCH_FLAG_UPDATE_COUNT; i++) {
+		trans = mail_index_transaction_begin(view, 0);
+		mail_index_update_flags(trans,
+			i_rand_minmax(1, ctx->message_count),
+			i_rand_limit(2) == 0 ? MODIFY_ADD : MODIFY_REMOVE,
+			MAIL_FLAGGED);
+		bench_commit(&trans);
+	}
+	ts_1 = i_nanoseconds();
+	mail_index_view_close(&view);
+
+	bench_print("mail_transaction_log_append (flag update commits)",
+		    ts_0, ts_1, BENCH_FLAG_UPDATE_COUNT, "commit");
+}
+
+static void bench_sync_map(struct bench_ctx *ctx)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint64_t ts_0, ts_1;
+
+	ts_0 = i_nanoseconds();
+	if (mail_index_sync_begin(ctx->index, &sync_ctx, &view, &trans, 0) < 0)
+		i_fatal("mail_index_sync_begin() failed");
+	if (mail_index_sync_commit(&sync_ctx) < 0)
+		i_fatal("mail_index_sync_commit() failed");
+	ts_1 = i_nanoseconds();
+
+	bench_print("mail_index_sync_map (sync all changes)", ts_0, ts_1,
+		    ctx->message_count, "mail");
+}
+
+static void bench_index_write(struct bench_ctx *ctx)
+{
+	uint64_t ts_0, ts_1;
+
+	if (mail_index_lock_sync(ctx->index, "bench") < 0)
+		i_fatal("mail_index_lock_sync() failed");
+	ts_0 = i_nanoseconds();
+	mail_index_write(ctx->index, FALSE, "bench");
+	ts_1 = i_nanoseconds();
+	mail_index_unlock(ctx->index, "bench");
+
+	bench_print("mail_index_write", ts_0, ts_1,
+		    ctx->message_count, "mail");
+}
+
+static void bench_open(struct bench_ctx *ctx)
+{
+	struct mail_index *index;
+	uint64_t ts_0, ts_1;
+
+	ts_0 = i_nanoseconds();
+	index = bench_index_open(ctx);
+	ts_1 = i_nanoseconds();
+	bench_index_close(&index);
+
+	bench_print("mail_index_open (map index and log)", ts_0, ts_1,
+		    ctx->message_count, "mail");
+}
+
+static void bench_cache_lookup(struct bench_ctx *ctx)
+{
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	buffer_t *buf = buffer_create_dynamic(default_pool, 128);
+	unsigned long lookup_count = 0;
+	uint32_t seq, messages_count;
+	uint64_t ts_0, ts_1;
+
+	if (ctx->field_count == 0)
+		return;
+
+	bench_refresh(ctx);
+	view = mail_index_view_open(ctx->index);
+	cache_view = mail_cache_view_open(ctx->index->cache, view);
+	messages_count = mail_index_view_get_messages_count(view);
+
+	ts_0 = i_nanoseconds();
+	for (seq = 1; seq <= messages_count; seq++) {
+		for (unsigned int f = 0; f < ctx->field_count; f++) {
+			buffer_set_used_size(buf, 0);
+			if (mail_cache_lookup_field(cache_view, buf, seq,
+						    ctx->field_idxs[f]) < 0)
+				i_fatal("mail_cache_lookup_field() failed");
+			lookup_count++;
+		}
+	}
+	ts_1 = i_nanoseconds();
+
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+	buffer_free(&buf);
+
+	bench_print("mail_cache_lookup_field", ts_0, ts_1,
+		    lookup_count, "lookup");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s messages keywords cache_fields\n", prog);
+	fprintf(stderr, "Runs with 100000 messages, 10 keywords and 5 cache "
+		"fields if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct bench_ctx ctx = {
+		.message_count = 100000,
+		.keyword_count = 10,
+		.field_count = 5,
+	};
+	struct ioloop *ioloop;
+	const char *error;
+
+	lib_init();
+
+	if (argc == 4) {
+		if (str_to_uint(argv[1], &ctx.message_count) < 0 ||
+		    str_to_uint(argv[2], &ctx.keyword_count) < 0 ||
+		    str_to_uint(argv[3], &ctx.field_count) < 0 ||
+		    ctx.message_count == 0) {
+			fprintf(stderr, "Invalid parameters\n");
+			print_usage(argv[0]);
+		}
+	} else if (argc != 1) {
+		print_usage(argv[0]);
+	}
+
+	ioloop = io_loop_create();
+	(void)unlink_directory(BENCH_DIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR,
+			       &error);
+	if (mkdir(BENCH_DIR_NAME, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR_NAME);
+
+	printf("Index has %u messages, %u keywords and %u cache fields\n\n",
+	       ctx.message_count, ctx.keyword_count, ctx.field_count);
+
+	ctx.index = bench_index_open(&ctx);
+	T_BEGIN {
+		bench_log_append(&ctx);
+	} T_END;
+	bench_flag_updates(&ctx);
+	bench_sync_map(&ctx);
+	bench_index_write(&ctx);
+	bench_cache_lookup(&ctx);
+	bench_index_close(&ctx.index);
+	bench_open(&ctx);
+
+	i_free(ctx.field_idxs);
+	(void)unlink_directory(BENCH_DIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR,
+			       &error);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -324,6 +324,31 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	return 1;
 }
 
+static void
+mail_cache_seq_add_location(struct mail_cache_view *view,
+			    const struct mail_cache_lookup_iterate_ctx *iter,
+			    const struct mail_cache_iterate_field *field)
+{
+	struct mail_cache_field_location *loc;
+
+	loc = buffer_get_space_unsafe(view->cached_locations_buf,
+				      field->field_idx * sizeof(*loc),
+				      sizeof(*loc));
+	if (loc->exists_value == view->cached_exists_value) {
+		/* mail_cache_lookup_field() returns the first instance */
+		return;
+	}
+	loc->exists_value = view->cached_exists_value;
+	if (iter->offset == 0) {
+		/* uncommitted transaction - the data isn't in the file */
+		loc->offset = 0;
+		return;
+	}
+	loc->offset = field->offset;
+	loc->size = field->size;
+	loc->file_seq = view->cache->hdr->file_seq;
+}
+
 static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
@@ -332,8 +357,9 @@ static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 
 	view->cached_exists_value = (view->cached_exists_value + 1) & UINT8_MAX;
 	if (view->cached_exists_value == 0) {
-		/* wrapped, we'll have to clear the buffer */
+		/* wrapped, we'll have to clear the buffers */
 		buffer_set_used_size(view->cached_exists_buf, 0);
+		buffer_set_used_size(view->cached_locations_buf, 0);
 		view->cached_exists_value++;
 	}
 	view->cached_exists_seq = seq;
@@ -342,10 +368,38 @@ static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
 		buffer_write(view->cached_exists_buf, field.field_idx,
 			     &view->cached_exists_value, 1);
+		mail_cache_seq_add_location(view, &iter, &field);
 	}
 	return ret;
 }
 
+static int
+mail_cache_lookup_field_location(struct mail_cache_view *view,
+				 buffer_t *dest_buf, unsigned int field_idx)
+{
+	const struct mail_cache_field_location *loc;
+	const void *data;
+	size_t pos = field_idx * sizeof(*loc);
+
+	if (pos + sizeof(*loc) > view->cached_locations_buf->used)
+		return 0;
+	loc = CONST_PTR_OFFSET(view->cached_locations_buf->data, pos);
+	if (loc->exists_value != view->cached_exists_value ||
+	    loc->offset == 0)
+		return 0;
+	if (MAIL_CACHE_IS_UNUSABLE(view->cache) ||
+	    view->cache->hdr->file_seq != loc->file_seq) {
+		/* cache file was reopened since the lookup */
+		return 0;
+	}
+	if (loc->size == 0)
+		return 1;
+	if (mail_cache_map(view->cache, loc->offset, loc->size, &data) <= 0)
+		return 0;
+	buffer_append(dest_buf, data, loc->size);
+	return 1;
+}
+
 int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 			    unsigned int field)
 {
@@ -421,10 +475,20 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
-	if (ret <= 0)
+	if (ret <= 0) {
+		if (ret == 0)
+			view->cache->fields[field_idx].lookup_misses++;
 		return ret;
+	}
+	view->cache->fields[field_idx].lookup_hits++;
 
 	/* the field should exist */
+	if (view->cache->fields[field_idx].field.type != MAIL_CACHE_FIELD_BITMASK &&
+	    mail_cache_lookup_field_location(view, dest_buf, field_idx) > 0) {
+		/* found the field's location already while checking whether
+		   it exists */
+		return 1;
+	}
 	mail_cache_lookup_iter_init(view, seq, &iter);
 	if (view->cache->fields[field_idx].field.type == MAIL_CACHE_FIELD_BITMASK) {
 		ret = mail_cache_lookup_bitmask(&iter, field_idx,
@@ -445,6 +509,92 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	return ret;
 }
 
+static int
+mail_cache_lookup_fields_seq(struct mail_cache_view *view, uint32_t seq,
+			     const uint8_t *wanted, unsigned int wanted_count,
+			     uint8_t *found, pool_t pool,
+			     ARRAY_TYPE(mail_cache_range_field) *results)
+{
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_range_field *result;
+	int ret;
+
+	memset(found, 0, wanted_count);
+	mail_cache_lookup_iter_init(view, seq, &iter);
+	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
+		if (field.field_idx >= wanted_count ||
+		    wanted[field.field_idx] == 0 || found[field.field_idx] != 0)
+			continue;
+		/* return the first one that's found, same as
+		   mail_cache_lookup_field() */
+		found[field.field_idx] = 1;
+
+		result = array_append_space(results);
+		result->seq = seq;
+		result->field_idx = field.field_idx;
+		result->data = p_memdup(pool, field.data, field.size);
+		result->size = field.size;
+	}
+	return ret;
+}
+
+int mail_cache_lookup_fields_range(struct mail_cache_view *view,
+				   const ARRAY_TYPE(seq_range) *seqs,
+				   const unsigned int field_idxs[],
+				   unsigned int fields_count, pool_t pool,
+				   ARRAY_TYPE(mail_cache_range_field) *results)
+{
+	const struct seq_range *range;
+	unsigned int i, wanted_count = 0;
+	uint32_t seq;
+	int ret = 0;
+
+	for (i = 0; i < fields_count; i++) {
+		i_assert(field_idxs[i] < view->cache->fields_count);
+		i_assert(view->cache->fields[field_idxs[i]].field.type !=
+			 MAIL_CACHE_FIELD_BITMASK);
+		if (wanted_count <= field_idxs[i])
+			wanted_count = field_idxs[i] + 1;
+	}
+	if (wanted_count == 0)
+		return 0;
+
+	T_BEGIN {
+		uint8_t *wanted = t_malloc0(wanted_count);
+		uint8_t *found = t_malloc_no0(wanted_count);
+
+		for (i = 0; i < fields_count; i++)
+			wanted[field_idxs[i]] = 1;
+
+		array_foreach(seqs, range) {
+			for (seq = range->seq1; seq <= range->seq2; seq++) {
+				for (i = 0; i < fields_count; i++) {
+					mail_cache_decision_state_update(view,
+						seq, field_idxs[i]);
+				}
+				if (mail_cache_lookup_fields_seq(view, seq,
+						wanted, wanted_count, found,
+						pool, results) < 0) {
+					ret = -1;
+					break;
+				}
+				for (i = 0; i < fields_count; i++) {
+					struct mail_cache_field_private *priv =
+						&view->cache->fields[field_idxs[i]];
+					if (found[field_idxs[i]] != 0)
+						priv->lookup_hits++;
+					else
+						priv->lookup_misses++;
+				}
+			}
+			if (ret < 0)
+				break;
+		}
+	} T_END;
+	return ret;
+}
+
 struct header_lookup_data {
 	uint32_t data_size;
 	const unsigned char *data;
@@ -113,6 +113,10 @@ struct mail_cache_field_private {
 	   that doesn't have a local cache. That will result in the caching
 	   decision to change from TEMP to YES. */
 	uint32_t uid_highwater;
+	/* Number of lookups for this field within this session that found /
+	   didn't find the field in cache. Sent as mail_cache_field_lookups
+	   event when the cache is freed. */
+	unsigned int lookup_hits, lookup_misses;
 
 	/* Unused fields aren't written to cache file */
 	bool used:1;
@@ -238,6 +242,17 @@ struct mail_cache_missing_reason_cache {
 	uoff_t log_file_head_offset;
 };
 
+struct mail_cache_field_location {
+	/* Cache file offset to the field's data */
+	uint32_t offset;
+	uint32_t size;
+	/* mail_cache_header.file_seq of the file the offset points to */
+	uint32_t file_seq;
+	/* Location is valid only if this matches
+	   mail_cache_view.cached_exists_value */
+	uint8_t exists_value;
+};
+
 struct mail_cache_view {
 	struct mail_cache *cache;
 	struct mail_cache_view *prev, *next;
@@ -265,6 +280,10 @@ struct mail_cache_view {
 	buffer_t *cached_exists_buf;
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
+	/* Array of struct mail_cache_field_location indexed by field. These
+	   are filled while filling cached_exists_buf, so the fields' data can
+	   be looked up without walking through the record list again. */
+	buffer_t *cached_locations_buf;
 
 	/* mail_cache_view_update_cache_decisions() has been used to disable
 	   updating cache decisions. */
@@ -607,6 +607,27 @@ struct mail_cache *mail_cache_open_or_create(struct mail_index *index)
 	return mail_cache_open_or_create_path(index, path);
 }
 
+static void mail_cache_send_lookup_stats(struct mail_cache *cache)
+{
+	for (unsigned int i = 0; i < cache->fields_count; i++) {
+		const struct mail_cache_field_private *priv = &cache->fields[i];
+
+		if (priv->lookup_hits == 0 && priv->lookup_misses == 0)
+			continue;
+		struct event_passthrough *e =
+			event_create_passthrough(cache->event)->
+			set_name("mail_cache_field_lookups")->
+			add_str("field", priv->field.name)->
+			add_str("decision", mail_cache_decision_to_string(
+				priv->field.decision))->
+			add_int("hits", priv->lookup_hits)->
+			add_int("misses", priv->lookup_misses);
+		e_debug(e->event(), "Field %s cache lookups: %u hits, %u misses",
+			priv->field.name, priv->lookup_hits,
+			priv->lookup_misses);
+	}
+}
+
 void mail_cache_free(struct mail_cache **_cache)
 {
 	struct mail_cache *cache = *_cache;
@@ -615,6 +636,8 @@ void mail_cache_free(struct mail_cache **_cache)
 
 	i_assert(cache->views == NULL);
 
+	mail_cache_send_lookup_stats(cache);
+
 	if (cache->file_cache != NULL)
 		file_cache_free(&cache->file_cache);
 
@@ -960,6 +983,10 @@ mail_cache_view_open(struct mail_cache *cache, struct mail_index_view *iview)
 	view->cached_exists_buf =
 		buffer_create_dynamic(default_pool,
 				      cache->file_fields_count + 10);
+	view->cached_locations_buf =
+		buffer_create_dynamic(default_pool,
+			sizeof(struct mail_cache_field_location) *
+			(cache->file_fields_count + 10));
 	DLLIST_PREPEND(&cache->views, view);
 	return view;
 }
@@ -977,6 +1004,7 @@ void mail_cache_view_close(struct mail_cache_view **_view)
 
 	DLLIST_REMOVE(&view->cache->views, view);
 	buffer_free(&view->cached_exists_buf);
+	buffer_free(&view->cached_locations_buf);
 	i_free(view);
 }
 
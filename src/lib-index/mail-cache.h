@@ -64,6 +64,16 @@ struct mail_cache_field {
 	time_t last_used;
 };
 
+/* Field returned by mail_cache_lookup_fields_range() */
+struct mail_cache_range_field {
+	uint32_t seq;
+	unsigned int field_idx;
+
+	const void *data;
+	unsigned int size;
+};
+ARRAY_DEFINE_TYPE(mail_cache_range_field, struct mail_cache_range_field);
+
 struct mail_cache *mail_cache_open_or_create(struct mail_index *index);
 struct mail_cache *
 mail_cache_open_or_create_path(struct mail_index *index, const char *path);
@@ -178,6 +188,17 @@ void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx);
 
+/* Look up the given fields for all the mails in seqs. Each mail's cache
+   records are walked through only once, regardless of the number of fields.
+   The found fields are appended to results in ascending seq order, with their
+   data allocated from pool. Bitmask fields aren't supported.
+   Returns 0 if ok, -1 if error. */
+int mail_cache_lookup_fields_range(struct mail_cache_view *view,
+				   const ARRAY_TYPE(seq_range) *seqs,
+				   const unsigned int field_idxs[],
+				   unsigned int fields_count, pool_t pool,
+				   ARRAY_TYPE(mail_cache_range_field) *results);
+
 /* Return specified cached headers. Returns 1 if all fields were found,
    0 if not, -1 if error. dest is updated only if all fields were found. */
 int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
@@ -465,6 +465,7 @@ int mail_index_fsck(struct mail_index *index)
 	map = mail_index_map_clone(index->map);
 	mail_index_unmap(&index->map);
 	index->map = map;
+	mail_index_record_map_free_columns(map->rec_map);
 
 	T_BEGIN {
 		mail_index_fsck_map(index, map);
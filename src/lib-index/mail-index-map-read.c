@@ -11,6 +11,15 @@
 #include "mail-index-modseq.h"
 #include "ioloop.h"
 
+/* The index is mmaped only when it's large, and then most of its records
+   are typically accessed anyway. Populating the page tables at once is
+   cheaper than taking a separate page fault for each page. */
+#ifdef MAP_POPULATE
+#  define MAIL_INDEX_MMAP_FLAGS (MAP_PRIVATE | MAP_POPULATE)
+#else
+#  define MAIL_INDEX_MMAP_FLAGS MAP_PRIVATE
+#endif
+
 static void mail_index_map_copy_hdr(struct mail_index_map *map,
 				    const struct mail_index_header *hdr)
 {
@@ -46,7 +55,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	}
 
 	rec_map->mmap_base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
-				  MAP_PRIVATE, index->fd, 0);
+				  MAIL_INDEX_MMAP_FLAGS, index->fd, 0);
 	if (rec_map->mmap_base == MAP_FAILED) {
 		rec_map->mmap_base = NULL;
 		if (ioloop_time != index->last_mmap_error_time) {
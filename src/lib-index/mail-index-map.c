@@ -281,6 +281,7 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 	array_free(&rec_map->maps);
 	if (rec_map->modseq != NULL)
 		mail_index_map_modseq_free(&rec_map->modseq);
+	mail_index_record_map_free_columns(rec_map);
 	i_free(rec_map);
 }
 
@@ -593,3 +594,148 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 	}
 	i_assert(*last_seq_r >= *first_seq_r);
 }
+
+void mail_index_record_map_free_columns(struct mail_index_record_map *rec_map)
+{
+	struct mail_index_record_columns *columns = rec_map->columns;
+
+	if (columns == NULL)
+		return;
+
+	rec_map->columns = NULL;
+	i_free(columns->uids);
+	i_free(columns->flags);
+	i_free(columns->modseqs);
+	i_free(columns->keywords);
+	i_free(columns);
+}
+
+static struct mail_index_record_columns *
+mail_index_map_get_columns(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+
+	if (rec_map->columns != NULL &&
+	    rec_map->columns->count != rec_map->records_count) {
+		/* records were appended or truncated */
+		mail_index_record_map_free_columns(rec_map);
+	}
+	if (rec_map->columns == NULL) {
+		rec_map->columns = i_new(struct mail_index_record_columns, 1);
+		rec_map->columns->count = rec_map->records_count;
+	}
+	return rec_map->columns;
+}
+
+static const struct mail_index_ext *
+mail_index_map_get_ext(struct mail_index_map *map, uint32_t ext_id)
+{
+	uint32_t ext_map_idx;
+
+	if (!mail_index_map_get_ext_idx(map, ext_id, &ext_map_idx))
+		return NULL;
+	return array_idx(&map->extensions, ext_map_idx);
+}
+
+const uint32_t *mail_index_map_get_uid_column(struct mail_index_map *map)
+{
+	struct mail_index_record_columns *columns =
+		mail_index_map_get_columns(map);
+	const struct mail_index_record *rec;
+	unsigned int i;
+
+	if (columns->uids != NULL)
+		return columns->uids;
+
+	columns->uids = i_new(uint32_t, I_MAX(columns->count, 1));
+	for (i = 0; i < columns->count; i++) {
+		rec = MAIL_INDEX_MAP_IDX(map, i);
+		columns->uids[i] = rec->uid;
+	}
+	return columns->uids;
+}
+
+const uint8_t *mail_index_map_get_flags_column(struct mail_index_map *map)
+{
+	struct mail_index_record_columns *columns =
+		mail_index_map_get_columns(map);
+	const struct mail_index_record *rec;
+	unsigned int i;
+
+	if (columns->flags != NULL)
+		return columns->flags;
+
+	columns->flags = i_new(uint8_t, I_MAX(columns->count, 1));
+	for (i = 0; i < columns->count; i++) {
+		rec = MAIL_INDEX_MAP_IDX(map, i);
+		columns->flags[i] = rec->flags;
+	}
+	return columns->flags;
+}
+
+const uint64_t *mail_index_map_get_modseq_column(struct mail_index_map *map)
+{
+	struct mail_index_record_columns *columns;
+	const struct mail_index_ext *ext;
+	const uint64_t *modseqp;
+	unsigned int i;
+
+	ext = mail_index_map_get_ext(map, map->index->modseq_ext_id);
+	if (ext == NULL || ext->record_size != sizeof(*modseqp))
+		return NULL;
+
+	columns = mail_index_map_get_columns(map);
+	if (columns->modseqs != NULL) {
+		if (columns->modseq_offset == ext->record_offset)
+			return columns->modseqs;
+		/* another map with a different record layout built this */
+		i_free(columns->modseqs);
+	}
+
+	columns->modseq_offset = ext->record_offset;
+	columns->modseqs = i_new(uint64_t, I_MAX(columns->count, 1));
+	for (i = 0; i < columns->count; i++) {
+		modseqp = CONST_PTR_OFFSET(MAIL_INDEX_MAP_IDX(map, i),
+					   ext->record_offset);
+		columns->modseqs[i] = *modseqp;
+	}
+	return columns->modseqs;
+}
+
+const unsigned char *
+mail_index_map_get_keywords_column(struct mail_index_map *map,
+				   unsigned int *size_r)
+{
+	struct mail_index_record_columns *columns;
+	const struct mail_index_ext *ext;
+	unsigned char *dest;
+	unsigned int i;
+
+	ext = mail_index_map_get_ext(map, map->index->keywords_ext_id);
+	if (ext == NULL || ext->record_size == 0)
+		return NULL;
+
+	columns = mail_index_map_get_columns(map);
+	if (columns->keywords != NULL) {
+		if (columns->keywords_offset == ext->record_offset &&
+		    columns->keywords_size == ext->record_size) {
+			*size_r = columns->keywords_size;
+			return columns->keywords;
+		}
+		i_free(columns->keywords);
+	}
+
+	columns->keywords_offset = ext->record_offset;
+	columns->keywords_size = ext->record_size;
+	columns->keywords = i_new(unsigned char,
+				  I_MAX(columns->count, 1) * ext->record_size);
+	dest = columns->keywords;
+	for (i = 0; i < columns->count; i++) {
+		memcpy(dest, CONST_PTR_OFFSET(MAIL_INDEX_MAP_IDX(map, i),
+					      ext->record_offset),
+		       ext->record_size);
+		dest += ext->record_size;
+	}
+	*size_r = columns->keywords_size;
+	return columns->keywords;
+}
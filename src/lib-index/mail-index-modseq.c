@@ -218,6 +218,7 @@ int mail_index_modseq_set(struct mail_index_view *view,
 	if (*modseqp > min_modseq)
 		return 0;
 	else {
+		mail_index_record_map_free_columns(view->map->rec_map);
 		*modseqp = min_modseq;
 		return 1;
 	}
@@ -308,6 +309,7 @@ mail_index_modseq_update(struct mail_index_modseq_sync *ctx,
 		return;
 
 	ext = array_idx(&ctx->view->map->extensions, ext_map_idx);
+	mail_index_record_map_free_columns(ctx->view->map->rec_map);
 	for (; seq1 <= seq2; seq1++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(ctx->view->map, seq1);
 		modseqp = PTR_OFFSET(rec, ext->record_offset);
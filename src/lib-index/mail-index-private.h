@@ -121,6 +121,23 @@ struct mail_index_modseq_header {
 	uint32_t log_offset;
 };
 
+/* Structure-of-arrays copies of the most commonly scanned record fields.
+   Each column is built lazily on its first use and all of them are dropped
+   whenever the records change. */
+struct mail_index_record_columns {
+	/* rec_map->records_count when the columns were built */
+	unsigned int count;
+
+	uint32_t *uids;
+	uint8_t *flags;
+	uint64_t *modseqs;
+	unsigned char *keywords;
+
+	/* extension record offsets/sizes the columns were copied from */
+	uint32_t modseq_offset;
+	uint32_t keywords_offset, keywords_size;
+};
+
 struct mail_index_record_map {
 	ARRAY(struct mail_index_map *) maps;
 
@@ -133,6 +150,7 @@ struct mail_index_record_map {
 	unsigned int records_count;
 
 	struct mail_index_map_modseq *modseq;
+	struct mail_index_record_columns *columns;
 	uint32_t last_appended_uid;
 };
 
@@ -393,6 +411,23 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 				     uint32_t *first_seq_r,
 				     uint32_t *last_seq_r);
 
+/* Return the UIDs/flags of all the records in rec_map as a packed array
+   indexed by seq-1. The arrays are valid until the records are changed
+   (i.e. the map is synced), so the caller must not keep them over syncs. */
+const uint32_t *mail_index_map_get_uid_column(struct mail_index_map *map);
+const uint8_t *mail_index_map_get_flags_column(struct mail_index_map *map);
+/* Same as above for the modseq extension. Returns NULL if the map has no
+   modseqs. Note that the modseqs may be 0 for messages that haven't been
+   synced after modseqs were enabled. */
+const uint64_t *mail_index_map_get_modseq_column(struct mail_index_map *map);
+/* Same as above for the keywords extension bitmasks, each of them *size_r
+   bytes. Returns NULL if the map has no keywords. */
+const unsigned char *
+mail_index_map_get_keywords_column(struct mail_index_map *map,
+				   unsigned int *size_r);
+/* Drop the columns because the records are going to be changed. */
+void mail_index_record_map_free_columns(struct mail_index_record_map *rec_map);
+
 /* Returns 1 on success, 0 on non-critical errors we want to silently fix,
    -1 if map isn't usable. The caller is responsible for logging the errors
    if -1 is returned. */
@@ -816,6 +816,7 @@ int mail_index_sync_record(struct mail_index_sync_map_ctx *ctx,
 {
 	int ret;
 
+	mail_index_record_map_free_columns(ctx->view->map->rec_map);
 	T_BEGIN {
 		ret = mail_index_sync_record_real(ctx, hdr, data);
 	} T_END;
@@ -839,6 +840,8 @@ void mail_index_sync_map_deinit(struct mail_index_sync_map_ctx *sync_map_ctx)
 {
 	i_assert(sync_map_ctx->modseq_ctx == NULL);
 
+	/* modseq syncing may have updated the records */
+	mail_index_record_map_free_columns(sync_map_ctx->view->map->rec_map);
 	buffer_free(&sync_map_ctx->unknown_extensions);
 	if (sync_map_ctx->expunge_handlers_used)
 		mail_index_sync_deinit_expunge_handlers(sync_map_ctx);
@@ -496,6 +496,22 @@ static bool tview_ext_get_reset_id(struct mail_index_view *view,
 	return tview->super->ext_get_reset_id(view, map, ext_id, reset_id_r);
 }
 
+static bool tview_get_columns(struct mail_index_view *view,
+			      struct mail_index_view_columns *columns_r)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
+
+	if (t->reset || t->last_new_seq != 0 ||
+	    array_is_created(&t->updates) ||
+	    array_is_created(&t->keyword_updates)) {
+		/* the columns don't contain the uncommitted changes */
+		return FALSE;
+	}
+	return tview->super->get_columns(view, columns_r);
+}
+
 static struct mail_index_view_vfuncs trans_view_vfuncs = {
 	tview_close,
         tview_get_message_count,
@@ -507,7 +523,8 @@ static struct mail_index_view_vfuncs trans_view_vfuncs = {
 	tview_lookup_keywords,
 	tview_lookup_ext_full,
 	tview_get_header_ext,
-	tview_ext_get_reset_id
+	tview_ext_get_reset_id,
+	tview_get_columns
 };
 
 struct mail_index_view *
@@ -63,6 +63,11 @@ bool mail_index_transaction_is_expunged(struct mail_index_transaction *t,
 			     mail_transaction_expunge_guid_cmp) != NULL;
 }
 
+bool mail_index_transaction_has_changes(struct mail_index_transaction *t)
+{
+	return t->reset || MAIL_INDEX_TRANSACTION_HAS_CHANGES(t);
+}
+
 void mail_index_transaction_ref(struct mail_index_transaction *t)
 {
 	t->refcount++;
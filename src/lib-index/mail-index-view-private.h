@@ -37,6 +37,8 @@ struct mail_index_view_vfuncs {
 	bool (*ext_get_reset_id)(struct mail_index_view *view,
 				 struct mail_index_map *map,
 				 uint32_t ext_id, uint32_t *reset_id_r);
+	bool (*get_columns)(struct mail_index_view *view,
+			    struct mail_index_view_columns *columns_r);
 };
 
 union mail_index_view_module_context {
@@ -255,7 +255,7 @@ static void view_lookup_first(struct mail_index_view *view,
 #define LOW_UPDATE(x) \
 	STMT_START { if ((x) > low_uid) low_uid = x; } STMT_END
 	const struct mail_index_header *hdr = &view->map->hdr;
-	const struct mail_index_record *rec;
+	const uint8_t *rec_flags;
 	uint32_t seq, seq2, low_uid = 1;
 
 	*seq_r = 0;
@@ -274,9 +274,9 @@ static void view_lookup_first(struct mail_index_view *view,
 	}
 
 	i_assert(hdr->messages_count <= view->map->rec_map->records_count);
+	rec_flags = mail_index_map_get_flags_column(view->map);
 	for (; seq <= hdr->messages_count; seq++) {
-		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
-		if ((rec->flags & flags_mask) == (uint8_t)flags) {
+		if ((rec_flags[seq-1] & flags_mask) == (uint8_t)flags) {
 			*seq_r = seq;
 			break;
 		}
@@ -524,6 +524,33 @@ void mail_index_lookup_first(struct mail_index_view *view,
 	view->v.lookup_first(view, flags, flags_mask, seq_r);
 }
 
+bool mail_index_view_get_columns(struct mail_index_view *view,
+				 struct mail_index_view_columns *columns_r)
+{
+	return view->v.get_columns(view, columns_r);
+}
+
+bool mail_index_view_get_keyword_bit(struct mail_index_view *view,
+				     unsigned int keyword_idx,
+				     unsigned int *bit_r)
+{
+	const unsigned int *keyword_idx_map;
+	unsigned int i, count;
+
+	if (!array_is_created(&view->map->keyword_idx_map))
+		return FALSE;
+
+	/* keyword_idx_map[] contains file => index keyword mapping */
+	keyword_idx_map = array_get(&view->map->keyword_idx_map, &count);
+	for (i = 0; i < count; i++) {
+		if (keyword_idx_map[i] == keyword_idx) {
+			*bit_r = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 void mail_index_lookup_ext(struct mail_index_view *view, uint32_t seq,
 			   uint32_t ext_id, const void **data_r,
 			   bool *expunged_r)
@@ -583,6 +610,24 @@ void mail_index_ext_get_size(struct mail_index_map *map, uint32_t ext_id,
 	*record_align_r = ext->record_align;
 }
 
+static bool view_get_columns(struct mail_index_view *view,
+			     struct mail_index_view_columns *columns_r)
+{
+	if (view->map != view->index->map) {
+		/* lookups return the latest changes from the head map */
+		return FALSE;
+	}
+
+	i_zero(columns_r);
+	columns_r->messages_count = view->map->hdr.messages_count;
+	i_assert(columns_r->messages_count <= view->map->rec_map->records_count);
+	columns_r->flags = mail_index_map_get_flags_column(view->map);
+	columns_r->keywords =
+		mail_index_map_get_keywords_column(view->map,
+						   &columns_r->keywords_size);
+	return TRUE;
+}
+
 static struct mail_index_view_vfuncs view_vfuncs = {
 	view_close,
 	view_get_messages_count,
@@ -594,7 +639,8 @@ static struct mail_index_view_vfuncs view_vfuncs = {
 	view_lookup_keywords,
 	view_lookup_ext_full,
 	view_get_header_ext,
-	view_ext_get_reset_id
+	view_ext_get_reset_id,
+	view_get_columns
 };
 
 struct mail_index_view *
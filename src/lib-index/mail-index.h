@@ -185,6 +185,18 @@ struct mail_keywords {
 	unsigned int idx[FLEXIBLE_ARRAY_MEMBER];
 };
 
+/* Flags and keywords of all the messages in a view as packed arrays. */
+struct mail_index_view_columns {
+	uint32_t messages_count;
+	/* flags[seq-1] contains the message's flags */
+	const uint8_t *flags;
+	/* Keyword bitmasks, keywords_size bytes for each message. NULL if
+	   there are no keywords. The bit positions can be looked up with
+	   mail_index_view_get_keyword_bit(). */
+	const unsigned char *keywords;
+	unsigned int keywords_size;
+};
+
 enum mail_index_transaction_flags {
 	/* If transaction is marked as hidden, the changes are marked with
 	   hidden=TRUE when the view is synchronized. */
@@ -462,6 +474,8 @@ mail_index_transaction_get_view(struct mail_index_transaction *t);
 /* Returns TRUE if the given sequence is being expunged in this transaction. */
 bool mail_index_transaction_is_expunged(struct mail_index_transaction *t,
 					uint32_t seq);
+/* Returns TRUE if the transaction has any uncommitted changes. */
+bool mail_index_transaction_has_changes(struct mail_index_transaction *t);
 
 /* Returns a view containing the mailbox state after changes in transaction
    are applied. The view can still be used after transaction has been
@@ -623,6 +637,17 @@ bool mail_index_lookup_seq(struct mail_index_view *view,
 void mail_index_lookup_first(struct mail_index_view *view,
 			     enum mail_flags flags, uint8_t flags_mask,
 			     uint32_t *seq_r);
+/* Get the flags and keywords of all the messages in the view. This is
+   possible only when the view sees the latest index mapping and it has no
+   uncommitted changes. Returns FALSE if the caller needs to fall back to
+   per-message lookups. The columns are valid until the index is synced. */
+bool mail_index_view_get_columns(struct mail_index_view *view,
+				 struct mail_index_view_columns *columns_r);
+/* Get the bit position of the keyword in mail_index_view_columns.keywords.
+   Returns FALSE if the keyword isn't set for any messages. */
+bool mail_index_view_get_keyword_bit(struct mail_index_view *view,
+				     unsigned int keyword_idx,
+				     unsigned int *bit_r);
 
 /* Append a new record to index. */
 void mail_index_append(struct mail_index_transaction *t, uint32_t uid,
@@ -87,7 +87,10 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if (!file->log->index->log_sync_locked) {
+			/* the log is unlocked right after this write */
+			ctx->fsync_after_unlock = TRUE;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -240,13 +243,24 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 {
 	struct mail_transaction_log_append_ctx *ctx = *_ctx;
 	struct mail_index *index = ctx->log->index;
+	struct mail_transaction_log_file *file = index->log->head;
 	int ret = 0;
 
 	*_ctx = NULL;
 
 	ret = mail_transaction_log_append_locked(ctx);
 	if (!index->log_sync_locked)
-		mail_transaction_log_file_unlock(index->log->head, "appending");
+		mail_transaction_log_file_unlock(file, "appending");
+
+	if (ctx->fsync_after_unlock && ret == 0) {
+		/* The transaction is already visible to others, so it can't
+		   be moved to memory anymore like with write failures. */
+		if (fdatasync(file->fd) < 0) {
+			mail_index_file_set_syscall_error(index, file->filepath,
+							  "fdatasync()");
+			ret = -1;
+		}
+	}
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
@@ -13,6 +13,9 @@
 #include "mail-transaction-log-private.h"
 
 #define LOG_PREFETCH IO_BLOCK_SIZE
+/* When reading a lot of the log file, the pread() size is doubled after each
+   full read up to this size. */
+#define LOG_READ_MAX_SIZE (1024*1024)
 #define MEMORY_LOG_NAME "(in-memory transaction log file)"
 #define LOG_NEW_DOTLOCK_SUFFIX ".newlock"
 
@@ -1307,20 +1310,31 @@ mail_transaction_log_file_read_more(struct mail_transaction_log_file *file,
 				    const char **reason_r)
 {
 	void *data;
-	size_t size;
+	size_t size, read_size = LOG_PREFETCH;
 	uint32_t read_offset;
 	ssize_t ret;
 
 	read_offset = file->buffer_offset + file->buffer->used;
 
 	do {
-		data = buffer_append_space_unsafe(file->buffer, LOG_PREFETCH);
-		ret = pread(file->fd, data, LOG_PREFETCH, read_offset);
+		data = buffer_append_space_unsafe(file->buffer, read_size);
+		ret = pread(file->fd, data, read_size, read_offset);
 		if (ret > 0)
 			read_offset += ret;
 
 		size = read_offset - file->buffer_offset;
 		buffer_set_used_size(file->buffer, size);
+
+		if ((size_t)ret == read_size && read_size < LOG_READ_MAX_SIZE) {
+			/* there's more to read than usual */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+			if (read_size == LOG_PREFETCH) {
+				(void)posix_fadvise(file->fd, read_offset, 0,
+						    POSIX_FADV_WILLNEED);
+			}
+#endif
+			read_size *= 2;
+		}
 	} while (ret > 0 || (ret < 0 && errno == EINTR));
 
 	file->last_size = read_offset;
@@ -1462,7 +1476,7 @@ log_file_map_check_offsets(struct mail_transaction_log_file *file,
 
 static int
 mail_transaction_log_file_mmap(struct mail_transaction_log_file *file,
-			       const char **reason_r)
+			       uoff_t start_offset, const char **reason_r)
 {
 	/* we may have switched to mmaping */
 	buffer_free(&file->buffer);
@@ -1489,6 +1503,19 @@ mail_transaction_log_file_mmap(struct mail_transaction_log_file *file,
 		if (errno != 0)
 			log_file_set_syscall_error(file, "posix_madvise()");
 	}
+#ifdef POSIX_MADV_WILLNEED
+	/* Only the data after start_offset is going to be accessed. Start
+	   reading it ahead already, instead of page faulting one readahead
+	   window at a time. */
+	size_t advise_offset = start_offset & ~(size_t)(mmap_get_page_size()-1);
+	if (file->mmap_size - advise_offset > mmap_get_page_size()) {
+		errno = posix_madvise(PTR_OFFSET(file->mmap_base, advise_offset),
+				      file->mmap_size - advise_offset,
+				      POSIX_MADV_WILLNEED);
+		if (errno != 0)
+			log_file_set_syscall_error(file, "posix_madvise()");
+	}
+#endif
 
 	buffer_create_from_const_data(&file->mmap_buffer,
 				      file->mmap_base, file->mmap_size);
@@ -1558,7 +1585,8 @@ mail_transaction_log_file_map_mmap(struct mail_transaction_log_file *file,
 							      FALSE, reason_r);
 		}
 
-		if (mail_transaction_log_file_mmap(file, reason_r) < 0)
+		if (mail_transaction_log_file_mmap(file, start_offset,
+						   reason_r) < 0)
 			return -1;
 		ret = mail_transaction_log_file_sync(file, &retry, reason_r);
 	} while (retry);
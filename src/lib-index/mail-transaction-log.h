@@ -369,6 +369,11 @@ struct mail_transaction_log_append_ctx {
 	bool sync_includes_this:1;
 	/* fdatasync() after writing the transaction. */
 	bool want_fsync:1;
+	/* The written transaction still needs to be fdatasync()ed. This is
+	   done after the log is unlocked, so the other processes can append
+	   their transactions meanwhile and the filesystem can flush them all
+	   with a single journal commit. */
+	bool fsync_after_unlock:1;
 };
 
 #define LOG_IS_BEFORE(seq1, offset1, seq2, offset2) \
@@ -1,6 +1,7 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "write-full.h"
 #include "test-common.h"
@@ -227,6 +228,17 @@ static void test_mail_cache_fields(void)
 		cache_fields[TEST_FIELD_BITMASK].idx) == 1);
 	test_assert(str_len(str) == sizeof(bitmask_data) &&
 		    memcmp(str_data(str), bitmask_data, str_len(str)) == 0);
+	/* the other fields' locations changed in the purge */
+	str_truncate(str, 0);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+		cache_fields[TEST_FIELD_VARIABLE].idx) == 1);
+	test_assert(str_len(str) == sizeof(variable_data) &&
+		    memcmp(str_data(str), variable_data, str_len(str)) == 0);
+	str_truncate(str, 0);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+		cache_fields[TEST_FIELD_FIXED].idx) == 1);
+	test_assert(str_len(str) == sizeof(fixed_data) &&
+		    memcmp(str_data(str), fixed_data, str_len(str)) == 0);
 
 	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
 	mail_cache_view_close(&cache_view);
@@ -806,6 +818,73 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static bool
+test_range_field_equals(const ARRAY_TYPE(mail_cache_range_field) *results,
+			uint32_t seq, unsigned int field_idx, const char *data)
+{
+	const struct mail_cache_range_field *result;
+
+	array_foreach(results, result) {
+		if (result->seq == seq && result->field_idx == field_idx) {
+			return result->size == strlen(data) &&
+				memcmp(result->data, data, result->size) == 0;
+		}
+	}
+	return FALSE;
+}
+
+static void test_mail_cache_lookup_fields_range(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	ARRAY_TYPE(seq_range) seqs;
+	ARRAY_TYPE(mail_cache_range_field) results;
+	const struct mail_cache_range_field *result;
+	pool_t pool;
+
+	test_begin("mail cache lookup fields range");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field2.idx, "bar4");
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	test_mail_cache_add_field(&ctx, 3, ctx.cache_field3.idx, "baz3");
+	test_mail_cache_view_sync(&ctx);
+
+	const unsigned int field_idxs[] = {
+		ctx.cache_field.idx, ctx.cache_field2.idx,
+	};
+	pool = pool_alloconly_create("test cache range", 128);
+	t_array_init(&seqs, 2);
+	seq_range_array_add(&seqs, 1);
+	seq_range_array_add_range(&seqs, 3, 4);
+	t_array_init(&results, 8);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(mail_cache_lookup_fields_range(cache_view, &seqs,
+		field_idxs, N_ELEMENTS(field_idxs), pool, &results) == 0);
+	test_assert(array_count(&results) == 4);
+	test_assert(test_range_field_equals(&results, 1, ctx.cache_field.idx, "foo1"));
+	test_assert(test_range_field_equals(&results, 1, ctx.cache_field2.idx, "bar1"));
+	test_assert(test_range_field_equals(&results, 3, ctx.cache_field.idx, "foo3"));
+	test_assert(test_range_field_equals(&results, 4, ctx.cache_field2.idx, "bar4"));
+	/* results are in ascending seq order */
+	result = array_idx(&results, 2);
+	test_assert(result->seq == 3);
+	/* per-field lookup statistics */
+	test_assert(ctx.cache->fields[ctx.cache_field.idx].lookup_hits == 2);
+	test_assert(ctx.cache->fields[ctx.cache_field.idx].lookup_misses == 1);
+	test_assert(ctx.cache->fields[ctx.cache_field2.idx].lookup_hits == 2);
+	test_assert(ctx.cache->fields[ctx.cache_field2.idx].lookup_misses == 1);
+	mail_cache_view_close(&cache_view);
+	pool_unref(&pool);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +899,7 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_lookup_fields_range,
 		NULL
 	};
 	return test_run(test_functions);
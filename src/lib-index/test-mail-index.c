@@ -158,11 +158,133 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void test_mail_index_map_columns(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const uint32_t *uids;
+	const uint8_t *flags;
+	uint32_t seq, uid_validity = 123456;
+
+	test_begin("mail index map columns");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (unsigned int i = 1; i <= 5; i++) {
+		mail_index_append(trans, i*2, &seq);
+		if (i % 2 == 0)
+			mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_SEEN);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+
+	uids = mail_index_map_get_uid_column(view->map);
+	flags = mail_index_map_get_flags_column(view->map);
+	for (unsigned int i = 1; i <= 5; i++) {
+		test_assert_idx(uids[i-1] == i*2, i);
+		test_assert_idx(flags[i-1] == (i % 2 == 0 ? MAIL_SEEN : 0), i);
+	}
+	mail_index_lookup_first(view, 0, MAIL_SEEN, &seq);
+	test_assert(seq == 1);
+	mail_index_lookup_first(view, MAIL_SEEN, MAIL_SEEN, &seq);
+	test_assert(seq == 2);
+
+	/* the columns must be rebuilt after the records change */
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_flags(trans, 1, MODIFY_ADD, MAIL_SEEN);
+	mail_index_expunge(trans, 2);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+
+	test_assert(mail_index_view_get_messages_count(view) == 4);
+	uids = mail_index_map_get_uid_column(view->map);
+	flags = mail_index_map_get_flags_column(view->map);
+	test_assert(uids[0] == 2 && flags[0] == MAIL_SEEN);
+	test_assert(uids[1] == 6 && flags[1] == 0);
+	test_assert(uids[2] == 8 && flags[2] == MAIL_SEEN);
+	mail_index_lookup_first(view, 0, MAIL_SEEN, &seq);
+	test_assert(seq == 2);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_view_columns(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view, *updated_view;
+	struct mail_index_transaction *trans;
+	struct mail_index_view_columns columns;
+	struct mail_keywords *keywords;
+	const char *keyword_names[] = { "foo", NULL };
+	unsigned int bit;
+	uint32_t seq, uid_validity = 123456;
+
+	test_begin("mail index view columns");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	keywords = mail_index_keywords_create(index, keyword_names);
+	mail_index_append(trans, 1, &seq);
+	mail_index_append(trans, 2, &seq);
+	mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_FLAGGED);
+	mail_index_update_keywords(trans, seq, MODIFY_ADD, keywords);
+	mail_index_keywords_unref(&keywords);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	/* the view doesn't see the latest map */
+	test_assert(!mail_index_view_get_columns(view, &columns));
+	test_assert(mail_index_refresh(index) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+
+	test_assert(mail_index_view_get_columns(view, &columns));
+	test_assert(columns.messages_count == 2);
+	test_assert(columns.flags[0] == 0);
+	test_assert(columns.flags[1] == MAIL_FLAGGED);
+	test_assert(mail_index_view_get_keyword_bit(view, 0, &bit));
+	test_assert(columns.keywords != NULL && columns.keywords_size > 0);
+	test_assert((columns.keywords[0] & (1 << bit)) == 0);
+	test_assert((columns.keywords[columns.keywords_size] & (1 << bit)) != 0);
+
+	/* the updated view can't be used if it has uncommitted changes */
+	trans = mail_index_transaction_begin(view, 0);
+	updated_view = mail_index_transaction_open_updated_view(trans);
+	test_assert(mail_index_view_get_columns(updated_view, &columns));
+	mail_index_update_flags(trans, 1, MODIFY_ADD, MAIL_SEEN);
+	test_assert(!mail_index_view_get_columns(updated_view, &columns));
+	mail_index_view_close(&updated_view);
+	mail_index_transaction_rollback(&trans);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_map_columns,
+		test_mail_index_view_columns,
 		NULL
 	};
 	return test_run(test_functions);
@@ -1,6 +1,8 @@
 /* Copyright (c) 2017-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "buffer.h"
 #include "llist.h"
 #include "istream.h"
 #include "sha1.h"
@@ -12,6 +14,7 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 /* the registry entry with a pointer to struct dlua_script */
 #define LUA_SCRIPT_REGISTRY_KEY	"DLUA_SCRIPT"
@@ -23,7 +26,22 @@ struct event_category event_category_lua = {
 	.name = "lua",
 };
 
+/* Compiled script file. Script files are commonly loaded again for each
+   user (mail-lua, push-notification lua driver), so the compiled bytecode is
+   kept for the lifetime of the process. The file is parsed again only when
+   it changes. */
+struct dlua_script_bytecode {
+	char *filename;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	unsigned long mtime_nsec;
+	buffer_t *data;
+};
+
 static struct dlua_script *dlua_scripts = NULL;
+static ARRAY(struct dlua_script_bytecode) dlua_bytecode_cache;
 
 static int
 dlua_script_create_finish(struct dlua_script *script, const char **error_r);
@@ -291,6 +309,101 @@ int dlua_script_create_string(const char *str, struct dlua_script **script_r,
 	return -1;
 }
 
+static void dlua_bytecode_cache_free(void)
+{
+	struct dlua_script_bytecode *bc;
+
+	array_foreach_modifiable(&dlua_bytecode_cache, bc) {
+		i_free(bc->filename);
+		buffer_free(&bc->data);
+	}
+	array_free(&dlua_bytecode_cache);
+}
+
+static struct dlua_script_bytecode *
+dlua_bytecode_cache_lookup(const char *file)
+{
+	struct dlua_script_bytecode *bc;
+
+	if (!array_is_created(&dlua_bytecode_cache))
+		return NULL;
+	array_foreach_modifiable(&dlua_bytecode_cache, bc) {
+		if (strcmp(bc->filename, file) == 0)
+			return bc;
+	}
+	return NULL;
+}
+
+static int dlua_bytecode_writer(lua_State *L ATTR_UNUSED, const void *data,
+				size_t size, void *context)
+{
+	buffer_t *buf = context;
+
+	buffer_append(buf, data, size);
+	return 0;
+}
+
+static void
+dlua_bytecode_cache_update(lua_State *L, const char *file,
+			   const struct stat *st)
+{
+	struct dlua_script_bytecode *bc;
+	buffer_t *data;
+
+	/* the loaded chunk is at the top of the stack */
+	data = buffer_create_dynamic(default_pool, 1024);
+	if (lua_dump(L, dlua_bytecode_writer, data, 0) != 0) {
+		/* not fatal, the file is just parsed again next time */
+		buffer_free(&data);
+		return;
+	}
+
+	bc = dlua_bytecode_cache_lookup(file);
+	if (bc == NULL) {
+		if (!array_is_created(&dlua_bytecode_cache)) {
+			i_array_init(&dlua_bytecode_cache, 4);
+			lib_atexit(dlua_bytecode_cache_free);
+		}
+		bc = array_append_space(&dlua_bytecode_cache);
+		bc->filename = i_strdup(file);
+	} else {
+		buffer_free(&bc->data);
+	}
+	bc->dev = st->st_dev;
+	bc->ino = st->st_ino;
+	bc->size = st->st_size;
+	bc->mtime = st->st_mtime;
+	bc->mtime_nsec = ST_MTIME_NSEC(*st);
+	bc->data = data;
+}
+
+static int
+dlua_script_load_file(struct dlua_script *script, const char *file)
+{
+	const struct dlua_script_bytecode *bc;
+	struct stat st;
+	int ret;
+
+	if (stat(file, &st) < 0)
+		return luaL_loadfile(script->L, file);
+
+	bc = dlua_bytecode_cache_lookup(file);
+	if (bc != NULL && bc->dev == st.st_dev && bc->ino == st.st_ino &&
+	    bc->size == st.st_size && bc->mtime == st.st_mtime &&
+	    bc->mtime_nsec == ST_MTIME_NSEC(st)) {
+		/* use the same chunk name as luaL_loadfile() so error
+		   messages and tracebacks stay the same */
+		return luaL_loadbuffer(script->L, bc->data->data,
+				       bc->data->used,
+				       t_strconcat("@", file, NULL));
+	}
+
+	ret = luaL_loadfile(script->L, file);
+	if (ret == LUA_OK)
+		dlua_bytecode_cache_update(script->L, file, &st);
+	return ret;
+}
+
 int dlua_script_create_file(const char *file, struct dlua_script **script_r,
 			    struct event *event_parent, const char **error_r)
 {
@@ -307,7 +420,7 @@ int dlua_script_create_file(const char *file, struct dlua_script **script_r,
 	}
 
 	script = dlua_create_script(file, event_parent);
-	if (luaL_loadfile(script->L, file) != LUA_OK) {
+	if (dlua_script_load_file(script, file) != LUA_OK) {
 		*error_r = t_strdup_printf("lua_load(%s) failed: %s",
 					   file, lua_tostring(script->L, -1));
 		dlua_script_unref(&script);
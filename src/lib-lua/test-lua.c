@@ -4,6 +4,8 @@
 #include "dlua-script-private.h"
 
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 static int dlua_test_assert(lua_State *L)
 {
@@ -513,11 +515,67 @@ static void test_compat_tointegerx_and_isinteger(void)
 	test_end();
 }
 
+#define TEST_SCRIPT_FILE ".test-lua-script.lua"
+
+static void test_script_file_write(const char *data)
+{
+	int fd;
+
+	fd = open(TEST_SCRIPT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_SCRIPT_FILE);
+	if (write(fd, data, strlen(data)) != (ssize_t)strlen(data))
+		i_fatal("write(%s) failed: %m", TEST_SCRIPT_FILE);
+	i_close_fd(&fd);
+}
+
+static lua_Integer test_script_file_run(void)
+{
+	struct dlua_script *script = NULL;
+	const char *error;
+	lua_Integer value = -1;
+
+	if (dlua_script_create_file(TEST_SCRIPT_FILE, &script, NULL,
+				    &error) < 0 ||
+	    dlua_script_init(script, &error) < 0) {
+		i_error("%s", error);
+		dlua_script_unref(&script);
+		return -1;
+	}
+	if (dlua_pcall(script->L, "get_value", 0, 1, &error) < 0)
+		i_error("%s", error);
+	else {
+		value = lua_tointeger(script->L, -1);
+		lua_pop(script->L, 1);
+	}
+	dlua_script_unref(&script);
+	return value;
+}
+
+static void test_script_file_cache(void)
+{
+	test_begin("lua script file bytecode cache");
+
+	test_script_file_write("function get_value() return 1 end");
+	test_assert(test_script_file_run() == 1);
+	/* loaded from the cached bytecode */
+	test_assert(test_script_file_run() == 1);
+
+	/* changed file is parsed again */
+	test_script_file_write("function get_value() return 22 end");
+	test_assert(test_script_file_run() == 22);
+	test_assert(test_script_file_run() == 22);
+
+	i_unlink(TEST_SCRIPT_FILE);
+	test_end();
+}
+
 int main(void) {
 	void (*tests[])(void) = {
 		test_lua,
 		test_tls,
 		test_compat_tointegerx_and_isinteger,
+		test_script_file_cache,
 		NULL
 	};
 
@@ -145,6 +145,23 @@ static ssize_t i_stream_dot_read(struct istream_private *stream)
 
 	data = i_stream_get_data(stream->parent, &size);
 	for (i = 0; i < size && dest < stream->buffer_size; i++) {
+		if (dstream->state == 0) {
+			/* Copy everything up to the next line ending as-is.
+			   Only the CR/LF bytes need to go through the state
+			   machine below. */
+			size_t len = I_MIN(size - i, stream->buffer_size - dest);
+			const unsigned char *lf = memchr(data + i, '\n', len);
+
+			if (lf != NULL)
+				len = lf - (data + i);
+			if (len > 0 && data[i + len - 1] == '\r')
+				len--;
+			memcpy(stream->w_buffer + dest, data + i, len);
+			dest += len;
+			i += len;
+			if (i == size || dest == stream->buffer_size)
+				break;
+		}
 		switch (dstream->state) {
 		case 0:
 			break;
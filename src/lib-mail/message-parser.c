@@ -292,6 +292,27 @@ boundary_line_find(struct message_parser_ctx *ctx,
 	return 1;
 }
 
+static const unsigned char *
+boundary_line_lf_find(const unsigned char *data, const unsigned char *end)
+{
+	const unsigned char *dash;
+
+	if (data == end)
+		return NULL;
+
+	/* Boundary lines begin with "--", so only LFs followed by '-' matter.
+	   Look for the '-' instead of the LFs, since it's rare in e.g. base64
+	   encoded attachments. memchr() can then skip over most of the body
+	   at once instead of stopping at every line. */
+	while ((dash = memchr(data + 1, '-', end - (data + 1))) != NULL) {
+		if (dash[-1] == '\n')
+			return dash - 1;
+		data = dash;
+	}
+	/* LF at the end of data may still be followed by a boundary */
+	return end[-1] == '\n' ? end - 1 : NULL;
+}
+
 static int parse_next_mime_header_init(struct message_parser_ctx *ctx,
 				       struct message_block *block_r)
 {
@@ -418,10 +439,10 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	i_assert(block_r->size > 0);
 	boundary_start = 0;
 
-	/* skip to beginning of the next line. the first line was
-	   handled already. */
+	/* skip to beginning of the next line that can be a boundary.
+	   the first line was handled already. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	while ((next = boundary_line_lf_find(cur, end)) != NULL) {
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -447,19 +468,15 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 		/* found / need more data */
 		i_assert(ret >= 0);
 		i_assert(!(ret == 0 && full));
-	} else if (boundary_start == 0) {
-		/* no linefeeds in this block. we can just skip it. */
+	} else {
+		/* none of the lines in this block can begin a boundary.
+		   we can just skip it. */
 		ret = 0;
 		if (block_r->data[block_r->size-1] == '\r' && !ctx->eof) {
 			/* this may be the beginning of the \r\n--boundary */
 			block_r->size--;
 		}
 		boundary_start = block_r->size;
-	} else {
-		/* the boundary wasn't found from this data block,
-		   we'll need more data. */
-		ret = 0;
-		ctx->want_count = (block_r->size - boundary_start) + 1;
 	}
 
 	if (ret > 0 || (ret == 0 && !ctx->eof)) {
@@ -2,7 +2,6 @@
 
 #include "lib.h"
 #include "buffer.h"
-#include "hex-binary.h"
 #include "qp-decoder.h"
 
 /* quoted-printable lines can be max 76 characters. if we've seen more than
@@ -48,6 +47,18 @@ void qp_decoder_deinit(struct qp_decoder **_qp)
 	i_free(qp);
 }
 
+static inline int qp_hex_value(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	/* lowercase hex isn't strictly valid, but allow */
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
 static size_t
 qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		     size_t src_size)
@@ -61,6 +72,22 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		}
 		switch (src[i]) {
 		case '=':
+			if (i + 2 < src_size) {
+				int hi = qp_hex_value(src[i+1]);
+				int lo = qp_hex_value(src[i+2]);
+
+				if (hi >= 0 && lo >= 0) {
+					/* fast path: the whole =XX is
+					   available, decode it here */
+					buffer_append(qp->dest, src+start,
+						      i-start);
+					buffer_append_c(qp->dest,
+							(hi << 4) | lo);
+					i += 2;
+					start = i+1;
+					continue;
+				}
+			}
 			qp->state = STATE_EQUALS;
 			break;
 		case '\r':
@@ -175,10 +202,7 @@ int qp_decoder_more(struct qp_decoder *qp, const unsigned char *src,
 			}
 			break;
 		case STATE_EQUALS:
-			if ((src[i] >= '0' && src[i] <= '9') ||
-			    (src[i] >= 'A' && src[i] <= 'F') ||
-			    /* lowercase hex isn't strictly valid, but allow */
-			    (src[i] >= 'a' && src[i] <= 'f')) {
+			if (qp_hex_value(src[i]) >= 0) {
 				qp->hexchar = src[i];
 				qp->state = STATE_HEX2;
 			} else if (QP_IS_TRAILING_WHITESPACE(src[i])) {
@@ -200,16 +224,10 @@ int qp_decoder_more(struct qp_decoder *qp, const unsigned char *src,
 			}
 			break;
 		case STATE_HEX2:
-			if ((src[i] >= '0' && src[i] <= '9') ||
-			    (src[i] >= 'A' && src[i] <= 'F') ||
-			    (src[i] >= 'a' && src[i] <= 'f')) {
-				char data[3];
-
-				data[0] = qp->hexchar;
-				data[1] = src[i];
-				data[2] = '\0';
-				if (hex_to_binary(data, qp->dest) < 0)
-					i_unreached();
+			if (qp_hex_value(src[i]) >= 0) {
+				buffer_append_c(qp->dest,
+					(qp_hex_value(qp->hexchar) << 4) |
+					qp_hex_value(src[i]));
 				qp->state = STATE_TEXT;
 			} else {
 				/* invalid input */
@@ -177,7 +177,11 @@ static void test_istream_dot(void)
 		{ "\n.\r\n", "\n", "" },
 		{ "\n.\n", "\n", "" },
 		{ ".\r\n", "", "" },
-		{ ".\n", "", "" }
+		{ ".\n", "", "" },
+		{ "foo\rbar\r\nbaz\r\r\n..x\r\nx.\r\n.\r\nfoo",
+		  "foo\rbar\r\nbaz\r\r\n.x\r\nx.\r\n", "foo" },
+		{ "long line without dots\nfoo\r\r.\n.\n",
+		  "long line without dots\nfoo\r\r.\n", "" }
 	};
 	static const char *error_tests[] = {
 		"",
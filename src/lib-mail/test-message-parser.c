@@ -793,6 +793,66 @@ static const char input_msg[] =
 	test_end();
 }
 
+static void test_message_parser_dash_lines(void)
+{
+static const char input_msg[] =
+"Content-Type: multipart/mixed; boundary=\"a\"\n"
+"\n"
+"--a\n"
+"Content-Type: text/plain\n"
+"\n"
+"line-with-dashes--a\n"
+"-a\n"
+"--b\n"
+"---a\n"
+"-\n"
+"--a\r\n"
+"Content-Type: text/plain\r\n"
+"\r\n"
+"QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0\r\n"
+"NTY3ODk=\r\n"
+"--a--\n";
+	struct message_parser_ctx *parser;
+	struct istream *input;
+	struct message_part *parts, *parts2;
+	struct message_block block;
+	unsigned int i;
+	pool_t pool;
+	int ret;
+
+	test_begin("message parser lines beginning with dashes");
+	pool = pool_alloconly_create("message parser", 10240);
+	input = test_istream_create(input_msg);
+
+	test_assert(message_parse_stream(pool, input, &set_empty, FALSE, &parts) < 0);
+	test_assert(parts->children_count == 2);
+	test_assert(parts->children->body_size.physical_size ==
+		    strlen("line-with-dashes--a\n-a\n--b\n---a\n-"));
+	test_assert(parts->children->next->body_size.physical_size ==
+		    strlen("QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0\r\nNTY3ODk="));
+
+	/* parsing in small blocks */
+	i_stream_seek(input, 0);
+	test_istream_set_allow_eof(input, FALSE);
+
+	parser = message_parser_init(pool, input, &set_empty);
+	for (i = 1; i <= (sizeof(input_msg)-1)*2+1; i++) {
+		test_istream_set_size(input, i/2);
+		if (i > (sizeof(input_msg)-1)*2)
+			test_istream_set_allow_eof(input, TRUE);
+		while ((ret = message_parser_parse_next_block(parser,
+							      &block)) > 0) ;
+	}
+	test_assert(ret < 0);
+	message_parser_deinit(&parser, &parts2);
+	test_assert(input->stream_errno == 0);
+	test_assert(message_part_is_equal(parts, parts2));
+
+	i_stream_unref(&input);
+	pool_unref(&pool);
+	test_end();
+}
+
 static void test_message_parser_no_eoh(void)
 {
 	static const char input_msg[] = "a:b\n";
@@ -1384,6 +1444,7 @@ int main(void)
 		test_message_parser_continuing_mime_boundary,
 		test_message_parser_continuing_truncated_mime_boundary,
 		test_message_parser_continuing_mime_boundary_reverse,
+		test_message_parser_dash_lines,
 		test_message_parser_long_mime_boundary,
 		test_message_parser_no_eoh,
 		test_message_parser_mime_part_nested_limit,
@@ -178,10 +178,71 @@ static void test_qp_decoder(void)
 	test_end();
 }
 
+static void test_qp_decoder_random(void)
+{
+	string_t *input, *output, *str;
+	unsigned int i, j, len;
+
+	test_begin("qp-decoder random chunks");
+	input = t_str_new(1024);
+	output = t_str_new(1024);
+	str = t_str_new(1024);
+	for (i = 0; i < 1000; i++) {
+		struct qp_decoder *qp = qp_decoder_init(str);
+		size_t pos, size, error_pos;
+		const char *error;
+		int ret = 0;
+
+		str_truncate(input, 0);
+		str_truncate(output, 0);
+		len = i_rand_limit(200);
+		for (j = 0; j < len; j++) {
+			switch (i_rand_limit(4)) {
+			case 0: {
+				unsigned char c = i_rand_uchar();
+
+				/* lowercase hex is allowed as well */
+				str_printfa(input, i_rand_limit(2) == 0 ?
+					    "=%02X" : "=%02x", c);
+				str_append_c(output, c);
+				break;
+			}
+			case 1:
+				str_append(input, "=\r\n");
+				break;
+			default: {
+				char c = 'a' + i_rand_limit(26);
+
+				str_append_c(input, c);
+				str_append_c(output, c);
+				break;
+			}
+			}
+		}
+
+		for (pos = 0; pos < str_len(input); pos += size) {
+			size = i_rand_minmax(1, 8);
+			size = I_MIN(size, str_len(input) - pos);
+			if (qp_decoder_more(qp, str_data(input) + pos, size,
+					    &error_pos, &error) < 0)
+				ret = -1;
+		}
+		if (qp_decoder_finish(qp, &error) < 0)
+			ret = -1;
+		test_assert_idx(ret == 0, i);
+		test_assert_idx(str_equals(str, output), i);
+
+		qp_decoder_deinit(&qp);
+		str_truncate(str, 0);
+	}
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_qp_decoder,
+		test_qp_decoder_random,
 		NULL
 	};
 	return test_run(test_functions);
@@ -23,6 +23,22 @@ struct master_service_listener {
 	struct io *io;
 };
 
+struct master_service_config_blob {
+	/* Offsets to the key/value list of a matched config filter */
+	size_t start_offset, end_offset;
+};
+ARRAY_DEFINE_TYPE(master_service_config_blob,
+		  struct master_service_config_blob);
+
+struct master_service_config_filter {
+	/* NULL for the global settings and empty filters */
+	struct event_filter *filter;
+	/* Offsets to the filter's key/value list */
+	size_t start_offset, end_offset;
+};
+ARRAY_DEFINE_TYPE(master_service_config_filter,
+		  struct master_service_config_filter);
+
 struct master_service {
 	struct ioloop *ioloop;
 	struct event *event;
@@ -40,6 +56,19 @@ struct master_service {
 	ARRAY_TYPE(const_string) config_overrides;
 	void *config_mmap_base;
 	size_t config_mmap_size;
+	/* Filters parsed from config_mmap_base. They're parsed only once
+	   after the config is read, not on every settings lookup. */
+	pool_t config_filters_pool;
+	ARRAY_TYPE(master_service_config_filter) config_filters;
+	/* NULL-terminated list of protocols used by the config filters,
+	   or NULL if none */
+	const char *const *config_filter_protocols;
+	/* Config blobs, roots and disable_check_settings used by the previous
+	   master_service_settings_read(). If the next read matches the same,
+	   set_parser can be reused. */
+	ARRAY_TYPE(master_service_config_blob) config_prev_blobs;
+	ARRAY(const struct setting_parser_info *) config_prev_roots;
+	bool config_prev_disable_check_settings;
 	int syslog_facility;
 	data_stack_frame_t datastack_frame_id;
 
@@ -57,6 +86,10 @@ struct master_service {
 	unsigned int last_sent_status_avail_count;
 	time_t last_sent_status_time;
 	struct timeout *to_status;
+	struct timeout *to_mempool_stats;
+	/* CONNECT/DISCONNECT lines waiting to be written to anvil */
+	string_t *anvil_pending_cmds;
+	struct timeout *to_anvil_flush;
 
 	bool (*idle_die_callback)(void);
 	void (*die_callback)(void);
@@ -105,6 +138,8 @@ struct master_service {
 	bool io_status_waiting:1;
 };
 
+void master_service_config_filters_free(struct master_service *service);
+
 void master_service_io_listeners_add(struct master_service *service);
 void master_status_update(struct master_service *service);
 
@@ -51,8 +51,11 @@ static const struct setting_define master_service_setting_defines[] = {
 	DEF(STR, import_environment),
 	DEF(STR, stats_writer_socket_path),
 	DEF(SIZE, config_cache_size),
+	DEF(TIME, mempool_stats_interval),
+	DEF(TIME_MSECS, profiler_interval),
 	DEF(BOOL, version_ignore),
 	DEF(BOOL, shutdown_clients),
+	DEF(TIME, shutdown_clients_stagger_interval),
 	DEF(BOOL, verbose_proctitle),
 
 	DEF(STR, haproxy_trusted_networks),
@@ -89,8 +92,11 @@ static const struct master_service_settings master_service_default_settings = {
 	.import_environment = "TZ CORE_OUTOFMEM CORE_ERROR" ENV_SYSTEMD ENV_GDB,
 	.stats_writer_socket_path = "stats-writer",
 	.config_cache_size = 1024*1024,
+	.mempool_stats_interval = 0,
+	.profiler_interval = 0,
 	.version_ignore = FALSE,
 	.shutdown_clients = TRUE,
+	.shutdown_clients_stagger_interval = 0,
 	.verbose_proctitle = FALSE,
 
 	.haproxy_trusted_networks = "",
@@ -392,7 +398,7 @@ master_service_apply_config_overrides(struct master_service *service,
 }
 
 static void
-filter_string_parse_protocol(const char *filter_string,
+filter_string_parse_protocol(pool_t pool, const char *filter_string,
 			     ARRAY_TYPE(const_string) *protocols)
 {
 	const char *p = strstr(filter_string, "protocol=\"");
@@ -401,19 +407,27 @@ filter_string_parse_protocol(const char *filter_string,
 	const char *p2 = strchr(p + 10, '"');
 	if (p2 == NULL)
 		return;
-	const char *protocol = t_strdup_until(p + 10, p2);
+	const char *protocol = p_strdup_until(pool, p + 10, p2);
 	if (p - filter_string > 4 && strcmp(p - 4, "NOT ") == 0)
-		protocol = t_strconcat("!", protocol, NULL);
+		protocol = p_strconcat(pool, "!", protocol, NULL);
 	array_push_back(protocols, &protocol);
 }
 
+void master_service_config_filters_free(struct master_service *service)
+{
+	struct master_service_config_filter *filter;
+
+	if (service->config_filters_pool == NULL)
+		return;
+	array_foreach_modifiable(&service->config_filters, filter)
+		event_filter_unref(&filter->filter);
+	pool_unref(&service->config_filters_pool);
+	service->config_filter_protocols = NULL;
+}
+
 static int
-master_service_settings_read_mmap(struct setting_parser_context *parser,
-				  struct event *event,
-				  const unsigned char *mmap_base,
-				  size_t mmap_size,
-				  struct master_service_settings_output *output_r,
-				  const char **error_r)
+master_service_settings_parse_filters(struct master_service *service,
+				      const char **error_r)
 {
 	/*
 	   DOVECOT-CONFIG <TAB> 1.0 <LF>
@@ -432,12 +446,15 @@ master_service_settings_read_mmap(struct setting_parser_context *parser,
 	   (if we can't trust the config, what can we trust?), so for
 	   performance and simplicity we trust the mmaped data to be properly
 	   NUL-terminated. If it's not, it can cause a segfault. */
+	const unsigned char *mmap_base = service->config_mmap_base;
+	size_t mmap_size = service->config_mmap_size;
 	ARRAY_TYPE(const_string) protocols;
 
-	t_array_init(&protocols, 8);
-	const struct failure_context failure_ctx = {
-		.type = LOG_TYPE_DEBUG,
-	};
+	i_assert(service->config_filters_pool == NULL);
+	service->config_filters_pool =
+		pool_alloconly_create("master service config filters", 1024);
+	p_array_init(&service->config_filters, service->config_filters_pool, 16);
+	p_array_init(&protocols, service->config_filters_pool, 8);
 
 	const char *magic_prefix = "DOVECOT-CONFIG\t";
 	const unsigned int magic_prefix_len = strlen(magic_prefix);
@@ -479,6 +496,7 @@ master_service_settings_read_mmap(struct setting_parser_context *parser,
 		offset += sizeof(blob_size);
 
 		/* <filter> */
+		struct event_filter *filter = NULL;
 		if (offset > start_offset + sizeof(blob_size)) {
 			const char *filter_string =
 				(const char *)mmap_base + offset;
@@ -491,38 +509,92 @@ master_service_settings_read_mmap(struct setting_parser_context *parser,
 				return -1;
 			}
 
-			struct event_filter *filter = event_filter_create();
 			const char *error;
-			filter_string_parse_protocol(filter_string, &protocols);
-			if (event_filter_parse(filter_string, filter, &error) < 0) {
-				*error_r = t_strdup_printf(
-					"Received invalid filter '%s': %s",
-					filter_string, error);
-				event_filter_unref(&filter);
-				return -1;
-			}
-			bool match = filter_string[0] == '\0' ||
-				event_filter_match(filter, event,
-						   &failure_ctx);
-			event_filter_unref(&filter);
-			if (!match) {
-				/* Filter didn't match. Jump to the next one. */
-				offset = end_offset;
-				continue;
+			filter_string_parse_protocol(service->config_filters_pool,
+						     filter_string, &protocols);
+			if (filter_string[0] != '\0') {
+				filter = event_filter_create();
+				if (event_filter_parse(filter_string, filter,
+						       &error) < 0) {
+					*error_r = t_strdup_printf(
+						"Received invalid filter '%s': %s",
+						filter_string, error);
+					event_filter_unref(&filter);
+					return -1;
+				}
 			}
 		}
 
+		struct master_service_config_filter *config_filter =
+			array_append_space(&service->config_filters);
+		config_filter->filter = filter;
+		config_filter->start_offset = offset;
+		config_filter->end_offset = end_offset;
+		offset = end_offset;
+	} while (offset < mmap_size);
+
+	if (array_count(&protocols) > 0) {
+		array_append_zero(&protocols);
+		service->config_filter_protocols = array_front(&protocols);
+	}
+	return 0;
+}
+
+static int
+master_service_settings_find_blobs(struct master_service *service,
+				   struct event *event,
+				   ARRAY_TYPE(master_service_config_blob) *blobs,
+				   struct master_service_settings_output *output_r,
+				   const char **error_r)
+{
+	const struct master_service_config_filter *config_filter;
+	const struct failure_context failure_ctx = {
+		.type = LOG_TYPE_DEBUG,
+	};
+
+	if (service->config_filters_pool == NULL &&
+	    master_service_settings_parse_filters(service, error_r) < 0) {
+		master_service_config_filters_free(service);
+		return -1;
+	}
+
+	array_foreach(&service->config_filters, config_filter) {
+		if (config_filter->filter != NULL &&
+		    !event_filter_match(config_filter->filter, event,
+					&failure_ctx))
+			continue;
+
+		struct master_service_config_blob *blob =
+			array_append_space(blobs);
+		blob->start_offset = config_filter->start_offset;
+		blob->end_offset = config_filter->end_offset;
+	}
+	output_r->specific_services = service->config_filter_protocols;
+	return 0;
+}
+
+static int
+master_service_settings_parse_blobs(struct setting_parser_context *parser,
+				   const unsigned char *mmap_base,
+				   size_t mmap_size,
+				   const ARRAY_TYPE(master_service_config_blob) *blobs,
+				   const char **error_r)
+{
+	const struct master_service_config_blob *blob;
+
+	array_foreach(blobs, blob) {
 		/* list of settings: key, value, ... */
-		while (offset < end_offset) {
+		size_t offset = blob->start_offset;
+		while (offset < blob->end_offset) {
 			const char *key = (const char *)mmap_base + offset;
 			offset += strlen(key)+1;
 			const char *value = (const char *)mmap_base + offset;
 			offset += strlen(value)+1;
-			if (offset > end_offset) {
+			if (offset > blob->end_offset) {
 				*error_r = t_strdup_printf(
 					"Settings key/value points outside blob "
 					"(offset=%zu, end_offset=%zu, file_size=%zu)",
-					offset, end_offset, mmap_size);
+					offset, blob->end_offset, mmap_size);
 				return -1;
 			}
 			int ret;
@@ -534,15 +606,58 @@ master_service_settings_read_mmap(struct setting_parser_context *parser,
 			if (ret < 0)
 				return -1;
 		}
-	} while (offset < mmap_size);
-
-	if (array_count(&protocols) > 0) {
-		array_append_zero(&protocols);
-		output_r->specific_services = array_front(&protocols);
 	}
 	return 0;
 }
 
+static bool
+master_service_settings_can_reuse(struct master_service *service,
+				  const struct master_service_settings_input *input,
+				  const ARRAY_TYPE(master_service_config_blob) *blobs)
+{
+	const struct setting_parser_info *const *prev_roots;
+	unsigned int i, count;
+
+	if (service->set_parser == NULL ||
+	    !array_is_created(&service->config_prev_blobs) ||
+	    input->disable_check_settings !=
+	    service->config_prev_disable_check_settings)
+		return FALSE;
+
+	/* the same roots must be used */
+	prev_roots = array_get(&service->config_prev_roots, &count);
+	for (i = 0; i < count; i++) {
+		if (input->roots == NULL || input->roots[i] != prev_roots[i])
+			return FALSE;
+	}
+	if (input->roots != NULL && input->roots[i] != NULL)
+		return FALSE;
+
+	/* the same filters must have matched */
+	return array_cmp(&service->config_prev_blobs, blobs);
+}
+
+static void
+master_service_settings_set_reuse(struct master_service *service,
+				  const struct master_service_settings_input *input,
+				  const ARRAY_TYPE(master_service_config_blob) *blobs)
+{
+	unsigned int i;
+
+	if (!array_is_created(&service->config_prev_blobs)) {
+		i_array_init(&service->config_prev_blobs,
+			     array_count(blobs));
+		i_array_init(&service->config_prev_roots, 8);
+	}
+	array_clear(&service->config_prev_blobs);
+	array_append_array(&service->config_prev_blobs, blobs);
+	array_clear(&service->config_prev_roots);
+	for (i = 0; input->roots != NULL && input->roots[i] != NULL; i++)
+		array_push_back(&service->config_prev_roots, &input->roots[i]);
+	service->config_prev_disable_check_settings =
+		input->disable_check_settings;
+}
+
 int master_service_settings_read(struct master_service *service,
 				 const struct master_service_settings_input *input,
 				 struct master_service_settings_output *output_r,
@@ -577,6 +692,10 @@ int master_service_settings_read(struct master_service *service,
 		}
 	}
 	if (fd != -1) {
+		/* the config may have changed */
+		if (array_is_created(&service->config_prev_blobs))
+			array_clear(&service->config_prev_blobs);
+		master_service_config_filters_free(service);
 		if (service->config_mmap_base != NULL) {
 			i_assert(input->reload_config);
 			if (munmap(service->config_mmap_base,
@@ -598,6 +717,41 @@ int master_service_settings_read(struct master_service *service,
 		env_remove(DOVECOT_CONFIG_FD_ENV);
 	}
 
+	/* Create event for matching config filters */
+	struct event *event = event_create(NULL);
+	event_add_str(event, "protocol", input->service);
+	event_add_str(event, "user", input->username);
+	event_add_str(event, "local_name", input->local_name);
+	event_add_ip(event, "local_ip", &input->local_ip);
+	event_add_ip(event, "remote_ip", &input->remote_ip);
+
+	/* config_mmap_base is NULL only if
+	   MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS is used */
+	ARRAY_TYPE(master_service_config_blob) blobs;
+	t_array_init(&blobs, 16);
+	if (service->config_mmap_base != NULL) {
+		ret = master_service_settings_find_blobs(service, event,
+							 &blobs, output_r,
+							 error_r);
+		if (ret < 0) {
+			if (getenv(DOVECOT_CONFIG_FD_ENV) != NULL) {
+				i_fatal("Failed to parse config from fd %d: %s",
+					fd, *error_r);
+			}
+			event_unref(&event);
+			return -1;
+		}
+	}
+	event_unref(&event);
+
+	if (master_service_settings_can_reuse(service, input, &blobs)) {
+		/* The same config filters matched as in the previous lookup,
+		   so the settings would be exactly the same. This avoids
+		   parsing and checking all the settings again when e.g. a
+		   multi-client process creates a new user session. */
+		return 0;
+	}
+
 	if (service->set_pool != NULL) {
 		if (service->set_parser != NULL)
 			settings_parser_unref(&service->set_parser);
@@ -607,14 +761,6 @@ int master_service_settings_read(struct master_service *service,
 			pool_alloconly_create("master service settings", 16384);
 	}
 
-	/* Create event for matching config filters */
-	struct event *event = event_create(NULL);
-	event_add_str(event, "protocol", input->service);
-	event_add_str(event, "user", input->username);
-	event_add_str(event, "local_name", input->local_name);
-	event_add_ip(event, "local_ip", &input->local_ip);
-	event_add_ip(event, "remote_ip", &input->remote_ip);
-
 	p_array_init(&all_roots, service->set_pool, 8);
 	tmp_root = &master_service_setting_parser_info;
 	array_push_back(&all_roots, &tmp_root);
@@ -633,24 +779,16 @@ int master_service_settings_read(struct master_service *service,
 			array_front(&all_roots), array_count(&all_roots),
 			SETTINGS_PARSER_FLAG_IGNORE_UNKNOWN_KEYS);
 
-	/* config_mmap_base is NULL only if
-	   MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS is used */
-	if (service->config_mmap_base != NULL) {
-		ret = master_service_settings_read_mmap(parser, event,
+	if (master_service_settings_parse_blobs(parser,
 			service->config_mmap_base, service->config_mmap_size,
-			output_r, error_r);
-
-		if (ret < 0) {
-			if (getenv(DOVECOT_CONFIG_FD_ENV) != NULL) {
-				i_fatal("Failed to parse config from fd %d: %s",
-					fd, *error_r);
-			}
-			settings_parser_unref(&parser);
-			event_unref(&event);
-			return -1;
+			&blobs, error_r) < 0) {
+		if (getenv(DOVECOT_CONFIG_FD_ENV) != NULL) {
+			i_fatal("Failed to parse config from fd %d: %s",
+				fd, *error_r);
 		}
+		settings_parser_unref(&parser);
+		return -1;
 	}
-	event_unref(&event);
 
 	if (array_is_created(&service->config_overrides)) {
 		if (master_service_apply_config_overrides(service, parser,
@@ -671,6 +809,7 @@ int master_service_settings_read(struct master_service *service,
 	service->set = settings_parser_get_root_set(parser,
 				&master_service_setting_parser_info);
 	service->set_parser = parser;
+	master_service_settings_set_reuse(service, input, &blobs);
 
 	if (service->set->version_ignore &&
 	    (service->flags & MASTER_SERVICE_FLAG_STANDALONE) != 0) {
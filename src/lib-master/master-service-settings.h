@@ -24,6 +24,9 @@ struct master_service_settings {
 	const char *import_environment;
 	const char *stats_writer_socket_path;
 	uoff_t config_cache_size;
+	unsigned int mempool_stats_interval;
+	unsigned int profiler_interval;
+	unsigned int shutdown_clients_stagger_interval;
 	bool version_ignore;
 	bool shutdown_clients;
 	bool verbose_proctitle;
@@ -40,6 +40,7 @@ struct master_service_ssl_server_settings {
 	const char *ssl_alt_key;
 	const char *ssl_key_password;
 	const char *ssl_dh;
+	const char *ssl_session_ticket_key;
 };
 
 extern const struct setting_parser_info master_service_ssl_setting_parser_info;
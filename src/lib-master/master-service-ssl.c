@@ -75,6 +75,7 @@ void master_service_ssl_ctx_init(struct master_service *service)
 	ssl_set.cert.cert = server_set->ssl_cert;
 	ssl_set.cert.key = server_set->ssl_key;
 	ssl_set.dh = server_set->ssl_dh;
+	ssl_set.session_ticket_key = server_set->ssl_session_ticket_key;
 	ssl_set.cert.key_password = server_set->ssl_key_password;
 	ssl_set.cert_username_field = set->ssl_cert_username_field;
 	if (server_set->ssl_alt_cert != NULL &&
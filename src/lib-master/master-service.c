@@ -4,6 +4,7 @@
 #include "lib-signals.h"
 #include "lib-event-private.h"
 #include "event-filter.h"
+#include "event-profiler.h"
 #include "ioloop.h"
 #include "hostpid.h"
 #include "path-util.h"
@@ -766,6 +767,22 @@ void master_service_init_stats_client(struct master_service *service,
 	} T_END;
 }
 
+void master_service_init_forked_child(struct master_service *service)
+{
+	/* the log process tracks the log prefix separately for each PID */
+	hostpid_update_pid();
+	i_set_failure_prefix("%s", t_strdup(i_get_failure_prefix()));
+
+	if (service->stats_client != NULL)
+		stats_client_reinit_forked(service->stats_client);
+}
+
+void master_service_deinit_forked_child(struct master_service *service)
+{
+	if (service->stats_client != NULL)
+		stats_client_deinit(&service->stats_client);
+}
+
 void master_service_set_die_with_master(struct master_service *service,
 					bool set)
 {
@@ -844,23 +861,46 @@ bool master_service_parse_option(struct master_service *service,
 	return TRUE;
 }
 
+static void master_service_die(struct master_service *service)
+{
+	timeout_remove(&service->to_die);
+	if (service->die_callback == NULL)
+		master_service_stop(service);
+	else {
+		service->to_die =
+			timeout_add(MASTER_SERVICE_DIE_TIMEOUT_MSECS,
+				    master_service_stop,
+				    service);
+		service->die_callback();
+	}
+}
+
 static void master_service_error(struct master_service *service)
 {
+	unsigned int stagger_msecs;
+
 	/* Close all master-admin connections from anvil. This way they won't
 	   block stopping the process quickly. */
 	master_admin_clients_deinit();
 
 	master_service_stop_new_connections(service);
 	if (service->master_status.available_count ==
-	    service->total_available_count || service->die_with_master) {
-		if (service->die_callback == NULL)
-			master_service_stop(service);
+	    service->total_available_count)
+		master_service_die(service);
+	else if (service->die_with_master) {
+		stagger_msecs = service->set == NULL ? 0 :
+			service->set->shutdown_clients_stagger_interval * 1000;
+		if (stagger_msecs == 0)
+			master_service_die(service);
 		else {
+			/* Most likely a config reload. Disconnect the clients
+			   at a random time within the interval, so all the
+			   processes' clients won't be reconnecting at the same
+			   time. If master is shutting down, it sends SIGTERM
+			   to kill us immediately. */
 			service->to_die =
-				timeout_add(MASTER_SERVICE_DIE_TIMEOUT_MSECS,
-					    master_service_stop,
-					    service);
-			service->die_callback();
+				timeout_add(i_rand_limit(stagger_msecs),
+					    master_service_die, service);
 		}
 	}
 }
@@ -890,6 +930,27 @@ static void master_status_update_wait(struct master_service *service)
 	io_loop_destroy(&ioloop);
 }
 
+static void master_service_send_mempool_stats(struct master_service *service)
+{
+	const struct pool_alloconly_usage *const *usages;
+	unsigned int i, count;
+
+	usages = pool_alloconly_get_usage(&count);
+	for (i = 0; i < count; i++) {
+		struct event_passthrough *e =
+			event_create_passthrough(service->event)->
+			set_name("mempool_usage")->
+			add_str("pool_name", usages[i]->name)->
+			add_int("pool_count", usages[i]->pool_count)->
+			add_int("alloc_bytes", usages[i]->alloc_size)->
+			add_int("peak_alloc_bytes", usages[i]->peak_alloc_size);
+		e_debug(e->event(), "Memory pool %s: "
+			"%u pools, %zu bytes allocated (peak %zu bytes)",
+			usages[i]->name, usages[i]->pool_count,
+			usages[i]->alloc_size, usages[i]->peak_alloc_size);
+	}
+}
+
 void master_service_init_finish(struct master_service *service)
 {
 	struct stat st;
@@ -946,6 +1007,15 @@ void master_service_init_finish(struct master_service *service)
 	if (service->io_status_write != NULL)
 		master_status_update_wait(service);
 
+	if (service->set != NULL && service->set->mempool_stats_interval > 0) {
+		pool_alloconly_usage_tracking_enable();
+		service->to_mempool_stats =
+			timeout_add(service->set->mempool_stats_interval * 1000,
+				    master_service_send_mempool_stats, service);
+	}
+	if (service->set != NULL && service->set->profiler_interval > 0)
+		event_profiler_init(service->set->profiler_interval);
+
 	/* close data stack frame opened by master_service_init() */
 	if ((service->flags & MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME) == 0) {
 		if (!t_pop(&service->datastack_frame_id))
@@ -1227,14 +1297,12 @@ bool master_service_is_master_stopped(struct master_service *service)
 }
 
 static bool
-master_service_anvil_send(struct master_service *service, const char *cmd)
+master_service_anvil_write(struct master_service *service,
+			   const char *cmd, size_t cmd_len)
 {
 	ssize_t ret;
 
-	if ((service->flags & MASTER_SERVICE_FLAG_STANDALONE) != 0)
-		return FALSE;
-
-	ret = write(MASTER_ANVIL_FD, cmd, strlen(cmd));
+	ret = write(MASTER_ANVIL_FD, cmd, cmd_len);
 	if (ret < 0) {
 		if (errno == EPIPE) {
 			/* anvil process was probably recreated, don't bother
@@ -1247,11 +1315,57 @@ master_service_anvil_send(struct master_service *service, const char *cmd)
 		e_error(service->event, "write(anvil) failed: EOF");
 		return FALSE;
 	} else {
-		i_assert((size_t)ret == strlen(cmd));
+		i_assert((size_t)ret == cmd_len);
 		return TRUE;
 	}
 }
 
+static void master_service_anvil_flush(struct master_service *service)
+{
+	timeout_remove(&service->to_anvil_flush);
+	if (service->anvil_pending_cmds == NULL ||
+	    str_len(service->anvil_pending_cmds) == 0)
+		return;
+
+	(void)master_service_anvil_write(service,
+		str_c(service->anvil_pending_cmds),
+		str_len(service->anvil_pending_cmds));
+	str_truncate(service->anvil_pending_cmds, 0);
+}
+
+static bool
+master_service_anvil_send(struct master_service *service, const char *cmd)
+{
+	size_t cmd_len = strlen(cmd);
+
+	if ((service->flags & MASTER_SERVICE_FLAG_STANDALONE) != 0)
+		return FALSE;
+
+	/* The anvil pipe is shared by all processes. Writes up to PIPE_BUF
+	   are atomic, so the lines from different processes don't get mixed
+	   as long as each write has only full lines and fits into it. */
+	if (cmd_len > PIPE_BUF) {
+		master_service_anvil_flush(service);
+		return master_service_anvil_write(service, cmd, cmd_len);
+	}
+	if (service->anvil_pending_cmds == NULL)
+		service->anvil_pending_cmds = str_new(default_pool, PIPE_BUF);
+	else if (str_len(service->anvil_pending_cmds) + cmd_len > PIPE_BUF)
+		master_service_anvil_flush(service);
+
+	/* Send all the commands added during this ioloop run with a single
+	   write(). This way a process with many clients connecting and
+	   disconnecting doesn't need a syscall for each one of them, and
+	   anvil can read all of them at once. */
+	str_append_data(service->anvil_pending_cmds, cmd, cmd_len);
+	if (service->to_anvil_flush == NULL) {
+		service->to_anvil_flush =
+			timeout_add_short(0, master_service_anvil_flush,
+					  service);
+	}
+	return TRUE;
+}
+
 static void
 master_service_anvil_session_to_cmd(string_t *cmd,
 	const struct master_service_anvil_session *session)
@@ -1526,21 +1640,31 @@ static void master_service_deinit_real(struct master_service **_service)
 		io_remove(&service->listeners[i].io);
 	master_service_ssl_ctx_deinit(service);
 
+	/* flush the remaining samples while stats client still exists */
+	event_profiler_deinit();
 	if (service->stats_client != NULL)
 		stats_client_deinit(&service->stats_client);
 	timeout_remove(&service->to_overflow_call);
 	timeout_remove(&service->to_die);
 	timeout_remove(&service->to_overflow_state);
 	timeout_remove(&service->to_status);
+	timeout_remove(&service->to_mempool_stats);
+	master_service_anvil_flush(service);
+	str_free(&service->anvil_pending_cmds);
 	io_remove(&service->io_status_error);
 	io_remove(&service->io_status_write);
 	if (array_is_created(&service->config_overrides))
 		array_free(&service->config_overrides);
+	if (array_is_created(&service->config_prev_blobs)) {
+		array_free(&service->config_prev_blobs);
+		array_free(&service->config_prev_roots);
+	}
 
 	if (service->set_parser != NULL) {
 		settings_parser_unref(&service->set_parser);
 		pool_unref(&service->set_pool);
 	}
+	master_service_config_filters_free(service);
 	if (service->config_mmap_base != NULL) {
 		if (munmap(service->config_mmap_base,
 			   service->config_mmap_size) < 0)
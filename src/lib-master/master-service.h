@@ -156,6 +156,14 @@ void master_service_init_log_with_pid(struct master_service *service);
 void master_service_init_stats_client(struct master_service *service,
 				      bool silent_notfound_errors);
 
+/* Call in a child process that was fork()ed from the service process and
+   keeps running its code without exec()ing. Connections that can't be shared
+   with the parent process are replaced with new ones. The child should call
+   master_service_deinit_forked_child() and then _exit() when it's done,
+   instead of master_service_deinit(). */
+void master_service_init_forked_child(struct master_service *service);
+void master_service_deinit_forked_child(struct master_service *service);
+
 /* If set, die immediately when connection to master is lost.
    Normally all existing clients are handled first. */
 void master_service_set_die_with_master(struct master_service *service,
@@ -56,8 +56,10 @@ struct service_settings {
 	const char *chroot;
 
 	bool drop_priv_before_exec;
+	bool cpu_affinity;
 
 	unsigned int process_min_avail;
+	unsigned int process_min_avail_max;
 	unsigned int process_limit;
 	unsigned int client_limit;
 	unsigned int service_count;
@@ -1,8 +1,10 @@
 /* Copyright (c) 2017-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "strescape.h"
+#include "ioloop.h"
 #include "ostream.h"
 #include "time-util.h"
 #include "lib-event-private.h"
@@ -12,12 +14,37 @@
 
 #define STATS_CLIENT_TIMEOUT_MSECS (5*1000)
 #define STATS_CLIENT_RECONNECT_INTERVAL_MSECS (10*1000)
+/* How often locally aggregated metric values are sent */
+#define STATS_CLIENT_METRICS_FLUSH_INTERVAL_MSECS 1000
+/* Send the metric values earlier if this many bytes are buffered */
+#define STATS_CLIENT_METRICS_FLUSH_SIZE (IO_BLOCK_SIZE*4)
+
+/* Metric aggregated by the client. The stats server tells which metrics
+   don't need anything else than the event's duration and fields, so only
+   those values are sent for matching events. */
+struct stats_client_metric {
+	const char *name;
+	const char *const *fields;
+	unsigned int fields_count;
+
+	/* "METRIC <name> <values per event>" followed by the pending values */
+	string_t *pending;
+	size_t pending_header_len;
+};
 
 struct stats_client {
 	struct connection conn;
 	struct event_filter *filter;
 	struct ioloop *ioloop;
 	struct timeout *to_reconnect;
+
+	pool_t metrics_pool;
+	ARRAY(struct stats_client_metric *) metrics;
+	/* contexts are struct stats_client_metric */
+	struct event_filter *metrics_filter;
+	/* filter + metrics_filter */
+	struct event_filter *send_filter;
+	struct timeout *to_metrics_flush;
 	bool handshaked;
 	bool handshake_received_at_least_once;
 	bool silent_notfound_errors;
@@ -27,6 +54,72 @@ static struct connection_list *stats_clients;
 
 static void stats_client_connect(struct stats_client *client);
 
+static void stats_client_metrics_flush(struct stats_client *client);
+
+static void stats_client_metrics_free(struct stats_client *client)
+{
+	struct stats_client_metric *metric;
+
+	timeout_remove(&client->to_metrics_flush);
+	if (client->metrics_pool == NULL)
+		return;
+	array_foreach_elem(&client->metrics, metric)
+		str_free(&metric->pending);
+	event_filter_unref(&client->metrics_filter);
+	event_filter_unref(&client->send_filter);
+	pool_unref(&client->metrics_pool);
+}
+
+static int
+client_handshake_metrics(struct stats_client *client, const char *const *args,
+			 const char **error_r)
+{
+	struct stats_client_metric *metric;
+	struct event_filter *filter;
+
+	if (args[0] == NULL)
+		return 0;
+
+	client->metrics_pool =
+		pool_alloconly_create("stats client metrics", 1024);
+	p_array_init(&client->metrics, client->metrics_pool, 8);
+	client->metrics_filter = event_filter_create();
+
+	/* <name> <filter> <space-separated fields> */
+	for (; args[0] != NULL; args += 3) {
+		if (args[1] == NULL || args[2] == NULL) {
+			*error_r = "Invalid metric";
+			return -1;
+		}
+		metric = p_new(client->metrics_pool,
+			       struct stats_client_metric, 1);
+		metric->name = p_strdup(client->metrics_pool, args[0]);
+		metric->fields = (const char *const *)
+			p_strsplit_spaces(client->metrics_pool, args[2], " ");
+		metric->fields_count = str_array_length(metric->fields);
+		metric->pending = str_new(default_pool, 128);
+		str_append(metric->pending, "METRIC\t");
+		str_append_tabescaped(metric->pending, metric->name);
+		str_printfa(metric->pending, "\t%u", metric->fields_count + 1);
+		metric->pending_header_len = str_len(metric->pending);
+		array_push_back(&client->metrics, &metric);
+
+		filter = event_filter_create();
+		if (!event_filter_import(filter, args[1], error_r)) {
+			event_filter_unref(&filter);
+			return -1;
+		}
+		event_filter_merge_with_context(client->metrics_filter,
+						filter, metric);
+		event_filter_unref(&filter);
+	}
+
+	client->send_filter = event_filter_create();
+	event_filter_merge(client->send_filter, client->filter);
+	event_filter_merge(client->send_filter, client->metrics_filter);
+	return 0;
+}
+
 static int
 client_handshake_filter(const char *const *args, struct event_filter **filter_r,
 			const char **error_r)
@@ -68,9 +161,22 @@ stats_client_handshake(struct stats_client *client, const char *const *args)
 	if (filter == NULL)
 		filter = event_filter_create();
 
+	/* send the values aggregated using the old metrics list first */
+	stats_client_metrics_flush(client);
+	stats_client_metrics_free(client);
+
 	event_filter_unref(&client->filter);
 	client->filter = filter;
-	event_set_global_debug_send_filter(client->filter);
+	if (args[1] != NULL &&
+	    client_handshake_metrics(client, args + 2, &error) < 0) {
+		e_error(client->conn.event,
+			"stats: Received invalid metrics in handshake: %s",
+			error);
+		stats_client_metrics_free(client);
+	}
+	event_set_global_debug_send_filter(client->send_filter != NULL ?
+					   client->send_filter :
+					   client->filter);
 	return 1;
 }
 
@@ -100,6 +206,8 @@ static void stats_client_destroy(struct connection *conn)
 		event->sent_to_stats_id = 0;
 
 	client->handshaked = FALSE;
+	/* the metrics list is resent in the handshake */
+	stats_client_metrics_free(client);
 	connection_disconnect(conn);
 	if (client->ioloop != NULL) {
 		/* waiting for stats handshake to finish */
@@ -129,7 +237,7 @@ static const struct connection_settings stats_client_set = {
 	.service_name_in = "stats-server",
 	.service_name_out = "stats-client",
 	.major_version = 4,
-	.minor_version = 0,
+	.minor_version = 1,
 
 	.input_max_size = SIZE_MAX,
 	.output_max_size = SIZE_MAX,
@@ -188,6 +296,101 @@ stats_event_write(struct stats_client *client,
 	}
 }
 
+static void stats_client_metrics_flush(struct stats_client *client)
+{
+	struct stats_client_metric *metric;
+
+	timeout_remove(&client->to_metrics_flush);
+	if (client->metrics_pool == NULL)
+		return;
+
+	array_foreach_elem(&client->metrics, metric) {
+		if (str_len(metric->pending) == metric->pending_header_len)
+			continue;
+		str_append_c(metric->pending, '\n');
+		if (client->conn.output != NULL) {
+			o_stream_nsend(client->conn.output,
+				       str_data(metric->pending),
+				       str_len(metric->pending));
+		}
+		str_truncate(metric->pending, metric->pending_header_len);
+	}
+}
+
+static void
+stats_client_metric_add_field(string_t *dest, struct event *event,
+			      const char *key)
+{
+	const struct event_field *field;
+	intmax_t num = 0;
+
+	/* This must match how the stats process handles the fields */
+	field = event_find_field_recursive(event, key);
+	str_append_c(dest, '\t');
+	if (field == NULL)
+		return;
+
+	switch (field->value_type) {
+	case EVENT_FIELD_VALUE_TYPE_STR:
+	case EVENT_FIELD_VALUE_TYPE_STRLIST:
+	case EVENT_FIELD_VALUE_TYPE_IP:
+		break;
+	case EVENT_FIELD_VALUE_TYPE_INTMAX:
+		num = field->value.intmax;
+		break;
+	case EVENT_FIELD_VALUE_TYPE_TIMEVAL:
+		num = field->value.timeval.tv_sec * 1000000ULL +
+			field->value.timeval.tv_usec;
+		break;
+	}
+	str_printfa(dest, "%"PRIu64, (uint64_t)num);
+}
+
+static void
+stats_client_metric_add_event(struct stats_client *client,
+			      struct stats_client_metric *metric,
+			      struct event *event)
+{
+	uintmax_t duration;
+
+	/* the duration field is added by the stats process */
+	event_get_last_duration(event, &duration);
+	str_printfa(metric->pending, "\t%ju", duration);
+	for (unsigned int i = 0; i < metric->fields_count; i++) {
+		if (strcmp(metric->fields[i], "duration") == 0)
+			str_printfa(metric->pending, "\t%ju", duration);
+		else {
+			stats_client_metric_add_field(metric->pending, event,
+						      metric->fields[i]);
+		}
+	}
+
+	if (str_len(metric->pending) >= STATS_CLIENT_METRICS_FLUSH_SIZE)
+		stats_client_metrics_flush(client);
+	else if (client->to_metrics_flush == NULL) {
+		/* the stats client lives across ioloops, so use the root
+		   ioloop which isn't destroyed */
+		client->to_metrics_flush =
+			timeout_add_to(io_loop_get_root(),
+				       STATS_CLIENT_METRICS_FLUSH_INTERVAL_MSECS,
+				       stats_client_metrics_flush, client);
+	}
+}
+
+static void
+stats_client_aggregate_event(struct stats_client *client, struct event *event,
+			     const struct failure_context *ctx)
+{
+	struct event_filter_match_iter *iter;
+	struct stats_client_metric *metric;
+
+	iter = event_filter_match_iter_init(client->metrics_filter, event, ctx);
+	while ((metric = event_filter_match_iter_next(iter)) != NULL) T_BEGIN {
+		stats_client_metric_add_event(client, metric, event);
+	} T_END;
+	event_filter_match_iter_deinit(&iter);
+}
+
 static void
 stats_client_send_event(struct stats_client *client, struct event *event,
 			const struct failure_context *ctx)
@@ -197,6 +400,9 @@ stats_client_send_event(struct stats_client *client, struct event *event,
 	if (!client->handshaked)
 		return;
 
+	if (client->metrics_filter != NULL)
+		stats_client_aggregate_event(client, event, ctx);
+
 	if (!event_filter_match(client->filter, event, ctx))
 		return;
 
@@ -382,6 +588,7 @@ void stats_client_deinit(struct stats_client **_client)
 
 	*_client = NULL;
 
+	stats_client_metrics_flush(client);
 	if (client->conn.output != NULL && !client->conn.output->closed &&
 	    o_stream_get_buffer_used_size(client->conn.output) > 0) {
 		o_stream_set_flush_callback(client->conn.output,
@@ -391,6 +598,7 @@ void stats_client_deinit(struct stats_client **_client)
 		stats_client_wait(client);
 	}
 
+	stats_client_metrics_free(client);
 	event_filter_unref(&client->filter);
 	connection_deinit(&client->conn);
 	timeout_remove(&client->to_reconnect);
@@ -399,3 +607,27 @@ void stats_client_deinit(struct stats_client **_client)
 	if (stats_clients->connections == NULL)
 		stats_global_deinit();
 }
+
+void stats_client_reinit_forked(struct stats_client *client)
+{
+	struct stats_client_metric *metric;
+	struct event *event;
+
+	/* The parent process still uses the connection, so don't write
+	   anything more to it. Its buffered output and pending metric values
+	   belong to the parent as well. */
+	if (client->conn.output != NULL)
+		o_stream_abort(client->conn.output);
+	connection_disconnect(&client->conn);
+	if (client->metrics_pool != NULL) {
+		array_foreach_elem(&client->metrics, metric)
+			str_truncate(metric->pending, metric->pending_header_len);
+	}
+	timeout_remove(&client->to_metrics_flush);
+	timeout_remove(&client->to_reconnect);
+
+	/* the new connection needs the IDs to be re-sent */
+	for (event = events_get_head(); event != NULL; event = event->next)
+		event->sent_to_stats_id = 0;
+	stats_client_connect(client);
+}
@@ -4,5 +4,9 @@
 struct stats_client *
 stats_client_init(const char *path, bool silent_notfound_errors);
 void stats_client_deinit(struct stats_client **client);
+/* Call in a child process after fork() to replace the connection shared with
+   the parent process with a new one. The existing handshake is kept, so this
+   doesn't wait for the stats process. */
+void stats_client_reinit_forked(struct stats_client *client);
 
 #endif
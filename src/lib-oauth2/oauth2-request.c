@@ -41,6 +41,12 @@ oauth2_request_field_parse(const struct oauth2_field *field,
 		} else {
 			res->expires_at = ioloop_time + expires_in;
 		}
+	} else if (strcasecmp(field->name, "exp") == 0) {
+		/* RFC 7662 introspection response, seconds since epoch */
+		int64_t exp;
+		if (str_to_int64(field->value, &exp) == 0 && exp > 0 &&
+		    (res->expires_at == 0 || exp < res->expires_at))
+			res->expires_at = exp;
 	} else if (strcasecmp(field->name, "token_type") == 0) {
 		if (strcasecmp(field->value, "bearer") != 0) {
 			res->error = t_strdup_printf(
@@ -723,6 +723,10 @@ void smtp_server_reply_set_status(struct smtp_server_reply *reply,
 				  ATTR_NULL(3);
 unsigned int smtp_server_reply_get_status(struct smtp_server_reply *reply,
 					  const char **enh_code_r) ATTR_NULL(3);
+/* Returns the reply text without the status codes. Multi-line replies are
+   joined into a single line. */
+const char *
+smtp_server_reply_get_message(const struct smtp_server_reply *reply);
 
 void smtp_server_reply_add_text(struct smtp_server_reply *reply,
 				const char *line);
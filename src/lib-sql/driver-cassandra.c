@@ -87,13 +87,14 @@ struct cassandra_callback {
 struct cassandra_db {
 	struct sql_db api;
 
-	char *hosts, *keyspace, *table_prefix, *user, *password;
+	char *hosts, *keyspace, *table_prefix, *user, *password, *local_dc;
 	CassConsistency read_consistency, write_consistency, delete_consistency;
 	CassConsistency read_fallback_consistency, write_fallback_consistency;
 	CassConsistency delete_fallback_consistency;
 	CassLogLevel log_level;
 	bool debug_queries;
 	bool latency_aware_routing;
+	bool token_aware_routing_disabled;
 	bool init_ssl;
 	unsigned int protocol_version;
 	unsigned int num_threads;
@@ -101,7 +102,7 @@ struct cassandra_db {
 	unsigned int warn_timeout_msecs;
 	unsigned int heartbeat_interval_secs, idle_timeout_secs;
 	unsigned int execution_retry_interval_msecs, execution_retry_times;
-	unsigned int page_size;
+	unsigned int page_size, page_size_max;
 	in_port_t port;
 
 	CassCluster *cluster;
@@ -716,6 +717,20 @@ static int driver_cassandra_parse_connect_string(struct cassandra_db *db,
 			db->debug_queries = TRUE;
 		} else if (strcmp(key, "latency_aware_routing") == 0) {
 			db->latency_aware_routing = TRUE;
+		} else if (strcmp(key, "token_aware_routing") == 0) {
+			if (strcmp(value, "yes") == 0)
+				db->token_aware_routing_disabled = FALSE;
+			else if (strcmp(value, "no") == 0)
+				db->token_aware_routing_disabled = TRUE;
+			else {
+				*error_r = t_strdup_printf(
+					"Invalid token_aware_routing: %s",
+					value);
+				return -1;
+			}
+		} else if (strcmp(key, "local_dc") == 0) {
+			i_free(db->local_dc);
+			db->local_dc = i_strdup(value);
 		} else if (strcmp(key, "version") == 0) {
 			if (str_to_uint(value, &db->protocol_version) < 0) {
 				*error_r = t_strdup_printf(
@@ -807,6 +822,13 @@ static int driver_cassandra_parse_connect_string(struct cassandra_db *db,
 					value);
 				return -1;
 			}
+		} else if (strcmp(key, "page_size_max") == 0) {
+			if (str_to_uint(value, &db->page_size_max) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid page_size_max: %s",
+					value);
+				return -1;
+			}
 		} else if (strcmp(key, "ssl_ca") == 0) {
 			db->ssl_ca_file = i_strdup(value);
 		} else if (strcmp(key, "ssl_cert_file") == 0) {
@@ -961,6 +983,7 @@ static void driver_cassandra_free(struct cassandra_db **_db)
 	i_free(db->error);
 	i_free(db->table_prefix);
 	i_free(db->keyspace);
+	i_free(db->local_dc);
 	i_free(db->user);
 	i_free(db->password);
 	i_free(db->ssl_ca_file);
@@ -1088,6 +1111,19 @@ static int driver_cassandra_init_full_v(const struct sql_settings *set,
 		cass_cluster_set_num_threads_io(db->cluster, db->num_threads);
 	if (db->latency_aware_routing)
 		cass_cluster_set_latency_aware_routing(db->cluster, cass_true);
+	if (db->token_aware_routing_disabled)
+		cass_cluster_set_token_aware_routing(db->cluster, cass_false);
+	if (db->local_dc != NULL) {
+		CassError c_err;
+		if ((c_err = cass_cluster_set_load_balance_dc_aware(
+				db->cluster, db->local_dc, 0,
+				cass_false)) != CASS_OK) {
+			*error_r = t_strdup_printf("local_dc: %s",
+						   cass_error_desc(c_err));
+			driver_cassandra_free(&db);
+			return -1;
+		}
+	}
 	if (db->heartbeat_interval_secs != 0)
 		cass_cluster_set_connection_heartbeat_interval(db->cluster,
 			db->heartbeat_interval_secs);
@@ -1857,6 +1893,18 @@ driver_cassandra_result_more(struct sql_result **_result, bool async,
 	new_result->page_num = old_result->page_num + 1;
 	new_result->page0_start_time = old_result->page0_start_time;
 	new_result->total_row_count = old_result->total_row_count;
+	if (db->page_size_max > db->page_size) {
+		/* The caller is reading through a large result. Double the
+		   page size for each following page to reduce the number of
+		   round trips, while the first page is still returned
+		   quickly. */
+		unsigned int page_size = db->page_size;
+		for (unsigned int i = 0; i < new_result->page_num &&
+		     page_size < db->page_size_max; i++)
+			page_size *= 2;
+		cass_statement_set_paging_size(new_result->statement,
+			I_MIN(page_size, db->page_size_max));
+	}
 
 	sql_result_unref(*_result);
 	*_result = NULL;
@@ -28,6 +28,11 @@ struct pgsql_db {
 
 	struct pgsql_result *pending_results;
 	struct pgsql_result *cur_result;
+	/* Queries sent in pipeline mode, in the order of their replies */
+	ARRAY(struct pgsql_result *) pipeline;
+	/* Non-pipelined query waiting for the pipeline to finish */
+	struct pgsql_result *pipeline_wait_result;
+	unsigned int pipeline_max;
 	struct ioloop *ioloop, *orig_ioloop;
 	struct sql_result *sync_result;
 
@@ -38,6 +43,7 @@ struct pgsql_db {
 	const char *connect_state;
 
 	bool fatal_error:1;
+	bool pipeline_mode:1;
 };
 
 struct pgsql_binary_value {
@@ -58,6 +64,7 @@ struct pgsql_result {
 	const char **fields;
 	const char **values;
 	char *query;
+	char *error;
 
 	ARRAY(struct pgsql_binary_value) binary_values;
 
@@ -65,6 +72,9 @@ struct pgsql_result {
 	void *context;
 
 	bool timeout:1;
+	/* The result doesn't own the connection. It was sent in pipeline
+	   mode, or it was never sent at all. */
+	bool detached:1;
 };
 
 struct pgsql_transaction_context {
@@ -84,6 +94,7 @@ extern const struct sql_db driver_pgsql_db;
 extern const struct sql_result driver_pgsql_result;
 
 static void result_finish(struct pgsql_result *result);
+static const char *driver_pgsql_result_get_error(struct sql_result *_result);
 static void
 transaction_update_callback(struct sql_result *result,
 			    struct sql_transaction_query *query);
@@ -133,13 +144,56 @@ static void driver_pgsql_stop_io(struct pgsql_db *db)
 	}
 }
 
+static const char *last_error(struct pgsql_db *db)
+{
+	const char *msg;
+	size_t len;
+
+	msg = PQerrorMessage(db->pg);
+	if (msg == NULL)
+		return "(no error set)";
+
+	/* Error message should contain trailing \n, we don't want it */
+	len = strlen(msg);
+	return len == 0 || msg[len-1] != '\n' ? msg :
+		t_strndup(msg, len-1);
+}
+
 static void driver_pgsql_close(struct pgsql_db *db)
 {
+	ARRAY(struct pgsql_result *) aborted;
+	struct pgsql_result *result;
+
 	db->io_dir = 0;
 	db->fatal_error = FALSE;
+	db->pipeline_mode = FALSE;
 
 	driver_pgsql_stop_io(db);
 
+	/* Fail the pipelined queries after the connection is closed, so
+	   their callbacks can't send anything more to it. */
+	t_array_init(&aborted, 8);
+	if (array_is_created(&db->pipeline)) {
+		array_append_array(&aborted, &db->pipeline);
+		array_clear(&db->pipeline);
+	}
+	if (db->pipeline_wait_result != NULL) {
+		db->pipeline_wait_result->detached = TRUE;
+		array_push_back(&aborted, &db->pipeline_wait_result);
+		db->pipeline_wait_result = NULL;
+	}
+	if (array_count(&aborted) > 0) {
+		const char *error = last_error(db);
+
+		array_foreach_elem(&aborted, result) {
+			if (result->pgres != NULL) {
+				PQclear(result->pgres);
+				result->pgres = NULL;
+			}
+			result->error = i_strdup(error);
+		}
+	}
+
 	PQfinish(db->pg);
 	db->pg = NULL;
 
@@ -152,21 +206,9 @@ static void driver_pgsql_close(struct pgsql_db *db)
 		io_loop_stop(db->ioloop);
 	}
 	driver_pgsql_next_callback(db);
-}
-
-static const char *last_error(struct pgsql_db *db)
-{
-	const char *msg;
-	size_t len;
-
-	msg = PQerrorMessage(db->pg);
-	if (msg == NULL)
-		return "(no error set)";
 
-	/* Error message should contain trailing \n, we don't want it */
-	len = strlen(msg);
-	return len == 0 || msg[len-1] != '\n' ? msg :
-		t_strndup(msg, len-1);
+	array_foreach_elem(&aborted, result)
+		result_finish(result);
 }
 
 static void connect_callback(struct pgsql_db *db)
@@ -297,6 +339,8 @@ static void driver_pgsql_free(struct pgsql_db **_db)
 	i_free(db->connect_string);
 	i_free(db->host);
 	i_free(db->error);
+	if (array_is_created(&db->pipeline))
+		array_free(&db->pipeline);
 	array_free(&db->api.module_contexts);
 	i_free(db);
 }
@@ -321,28 +365,57 @@ static enum sql_db_flags driver_pgsql_get_flags(struct sql_db *db)
 }
 
 static int driver_pgsql_init_full_v(const struct sql_settings *set,
-				    struct sql_db **db_r, const char **error_r ATTR_UNUSED)
+				    struct sql_db **db_r, const char **error_r)
 {
 	struct pgsql_db *db;
-	const char *value;
+	const char *value, *error = NULL;
+	int ret = 0;
 
 	db = i_new(struct pgsql_db, 1);
-	db->connect_string = i_strdup(set->connect_string);
 	db->api = driver_pgsql_db;
 	db->api.event = event_create(set->event_parent);
 	event_add_category(db->api.event, &event_category_pgsql);
 
 	/* NOTE: Connection string will be parsed by pgsql itself
-		 We only pick the host part here */
+		 We only pick the host part and remove our own settings here */
 	T_BEGIN {
-		const char *const *arg = t_strsplit(db->connect_string, " ");
+		const char *const *arg = t_strsplit(set->connect_string, " ");
+		ARRAY_TYPE(const_string) connect_args;
 
+		t_array_init(&connect_args, 8);
 		for (; *arg != NULL; arg++) {
+			if (str_begins(*arg, "maxpipeline=", &value)) {
+				if (str_to_uint(value, &db->pipeline_max) < 0) {
+					error = t_strdup_printf(
+						"Invalid value for maxpipeline: %s",
+						value);
+					ret = -1;
+				}
+				continue;
+			}
 			if (str_begins(*arg, "host=", &value))
 				db->host = i_strdup(value);
-
+			array_push_back(&connect_args, arg);
 		}
-	} T_END;
+		array_append_zero(&connect_args);
+		db->connect_string = i_strdup(t_strarray_join(
+			array_front(&connect_args), " "));
+	} T_END_PASS_STR_IF(ret < 0, &error);
+
+	if (ret < 0) {
+		*error_r = error;
+		driver_pgsql_free(&db);
+		return -1;
+	}
+#ifndef HAVE_PQENTERPIPELINEMODE
+	if (db->pipeline_max > 0) {
+		e_warning(db->api.event,
+			  "maxpipeline requires libpq v14 or later - ignoring");
+		db->pipeline_max = 0;
+	}
+#endif
+	if (db->pipeline_max > 0)
+		i_array_init(&db->pipeline, db->pipeline_max);
 
 	event_set_append_log_prefix(db->api.event, t_strdup_printf("pgsql(%s): ", db->host));
 
@@ -401,25 +474,34 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 	bool success;
 
 	i_assert(!result->api.callback);
-	i_assert(db->cur_result == result);
 	i_assert(result->callback == NULL);
 
-	if (_result == db->sync_result)
-		db->sync_result = NULL;
-	db->cur_result = NULL;
+	if (result->detached) {
+		/* the connection has already moved on to the next query */
+		if (result->pgres != NULL) {
+			PQclear(result->pgres);
+			result->pgres = NULL;
+		}
+	} else {
+		i_assert(db->cur_result == result);
 
-	success = result->pgres != NULL && !db->fatal_error;
-	if (result->pgres != NULL) {
-		PQclear(result->pgres);
-		result->pgres = NULL;
-	}
+		if (_result == db->sync_result)
+			db->sync_result = NULL;
+		db->cur_result = NULL;
 
-	if (success) {
-		/* we'll have to read the rest of the results as well */
-		i_assert(db->io == NULL);
-		consume_results(db);
-	} else {
-		driver_pgsql_set_idle(db);
+		success = result->pgres != NULL && !db->fatal_error;
+		if (result->pgres != NULL) {
+			PQclear(result->pgres);
+			result->pgres = NULL;
+		}
+
+		if (success) {
+			/* we'll have to read the rest of the results as well */
+			i_assert(db->io == NULL);
+			consume_results(db);
+		} else {
+			driver_pgsql_set_idle(db);
+		}
 	}
 
 	if (array_is_created(&result->binary_values)) {
@@ -432,6 +514,7 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 
 	event_unref(&result->api.event);
 	i_free(result->query);
+	i_free(result->error);
 	i_free(result->fields);
 	i_free(result->values);
 	i_free(result);
@@ -443,25 +526,39 @@ static void result_finish(struct pgsql_result *result)
 	bool free_result = TRUE;
 	int duration;
 
-	i_assert(db->io == NULL);
+	i_assert(db->io == NULL || result->detached);
 	timeout_remove(&result->to);
 	DLLIST_REMOVE(&db->pending_results, result);
 
-	/* if connection to server was lost, we don't yet see that the
-	   connection is bad. we only see the fatal error, so assume it also
-	   means disconnection. */
-	if (PQstatus(db->pg) == CONNECTION_BAD || result->pgres == NULL ||
-	    PQresultStatus(result->pgres) == PGRES_FATAL_ERROR)
-		db->fatal_error = TRUE;
-
-	if (db->fatal_error) {
-		result->api.failed = TRUE;
-		result->api.failed_try_retry = TRUE;
+	if (result->detached) {
+		/* the connection is closed if it fails, so only the lost
+		   connection is worth retrying */
+		if (result->pgres == NULL) {
+			result->api.failed = TRUE;
+			result->api.failed_try_retry = TRUE;
+		} else if (PQresultStatus(result->pgres) == PGRES_FATAL_ERROR) {
+			result->api.failed = TRUE;
+		}
+	} else {
+		/* if connection to server was lost, we don't yet see that the
+		   connection is bad. we only see the fatal error, so assume it
+		   also means disconnection. */
+		if (PQstatus(db->pg) == CONNECTION_BAD ||
+		    result->pgres == NULL ||
+		    PQresultStatus(result->pgres) == PGRES_FATAL_ERROR)
+			db->fatal_error = TRUE;
+
+		if (db->fatal_error) {
+			result->api.failed = TRUE;
+			result->api.failed_try_retry = TRUE;
+		}
 	}
 
 	/* emit event */
 	if (result->api.failed) {
-		const char *error = result->timeout ? "Timed out" : last_error(db);
+		const char *error = result->detached ?
+			driver_pgsql_result_get_error(&result->api) :
+			(result->timeout ? "Timed out" : last_error(db));
 		struct event_passthrough *e =
 			sql_query_finished_event(&db->api, result->api.event,
 						 result->query, TRUE, &duration);
@@ -540,18 +637,23 @@ static void query_timeout(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
 
-	driver_pgsql_stop_io(db);
-
 	result->timeout = TRUE;
+	if (result->detached) {
+		/* the pipelined queries after this one can't be received
+		   before this one, so give up on the connection */
+		driver_pgsql_close(db);
+		return;
+	}
+
+	driver_pgsql_stop_io(db);
 	result_finish(result);
 }
 
-static void do_query(struct pgsql_result *result, const char *query)
+static void send_query(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
 	int ret;
 
-	i_assert(SQL_DB_IS_READY(&db->api));
 	i_assert(db->cur_result == NULL);
 	i_assert(db->io == NULL);
 
@@ -560,9 +662,8 @@ static void do_query(struct pgsql_result *result, const char *query)
 	DLLIST_PREPEND(&db->pending_results, result);
 	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
 				 query_timeout, result);
-	result->query = i_strdup(query);
 
-	if (PQsendQuery(db->pg, query) == 0 ||
+	if (PQsendQuery(db->pg, result->query) == 0 ||
 	    (ret = PQflush(db->pg)) < 0) {
 		/* failed to send query */
 		result_finish(result);
@@ -579,6 +680,189 @@ static void do_query(struct pgsql_result *result, const char *query)
 	}
 }
 
+#ifdef HAVE_PQENTERPIPELINEMODE
+static void pipeline_input(struct pgsql_db *db);
+
+static bool pipeline_can_send(struct pgsql_db *db, const char *query)
+{
+	/* Pipelined queries are sent with the extended query protocol,
+	   which allows only a single command per query. */
+	return db->pipeline_max > 0 && db->next_callback == NULL &&
+		db->ioloop == NULL && strchr(query, ';') == NULL;
+}
+
+static void pipeline_set_io(struct pgsql_db *db, bool want_write)
+{
+	enum io_condition io_dir = want_write ? IO_WRITE : IO_READ;
+
+	if (db->io != NULL && db->io_dir == io_dir)
+		return;
+	driver_pgsql_stop_io(db);
+	db->io = io_add(PQsocket(db->pg), io_dir, pipeline_input, db);
+	db->io_dir = io_dir;
+}
+
+static void pipeline_finished(struct pgsql_db *db)
+{
+	struct pgsql_result *result;
+
+	if (!db->pipeline_mode) {
+		/* already finished in a nested ioloop */
+		return;
+	}
+
+	driver_pgsql_stop_io(db);
+	db->pipeline_mode = FALSE;
+	if (PQexitPipelineMode(db->pg) == 0) {
+		e_error(db->api.event, "PQexitPipelineMode() failed: %s",
+			last_error(db));
+		driver_pgsql_close(db);
+		return;
+	}
+
+	if (db->pipeline_wait_result != NULL) {
+		result = db->pipeline_wait_result;
+		db->pipeline_wait_result = NULL;
+		DLLIST_REMOVE(&db->pending_results, result);
+		send_query(result);
+	} else {
+		driver_pgsql_set_state(db, SQL_DB_STATE_IDLE);
+	}
+}
+
+static void pipeline_input(struct pgsql_db *db)
+{
+	struct pgsql_result *result;
+	PGresult *pgres;
+	bool prev_null = FALSE;
+	int ret;
+
+	if (PQflush(db->pg) < 0 || PQconsumeInput(db->pg) == 0) {
+		driver_pgsql_close(db);
+		return;
+	}
+
+	while (array_count(&db->pipeline) > 0 && PQisBusy(db->pg) == 0) {
+		result = array_idx_elem(&db->pipeline, 0);
+		pgres = PQgetResult(db->pg);
+		if (pgres == NULL) {
+			/* end of the query's results */
+			if (prev_null)
+				break;
+			prev_null = TRUE;
+			continue;
+		}
+		prev_null = FALSE;
+
+		if (PQresultStatus(pgres) != PGRES_PIPELINE_SYNC) {
+			/* keep only the first result, like with non-pipelined
+			   queries */
+			if (result->pgres == NULL)
+				result->pgres = pgres;
+			else
+				PQclear(pgres);
+			continue;
+		}
+		/* each query is followed by its own sync point */
+		PQclear(pgres);
+		array_pop_front(&db->pipeline);
+		result_finish(result);
+
+		if (db->api.state < SQL_DB_STATE_IDLE) {
+			/* disconnected by the callback */
+			return;
+		}
+	}
+
+	if (array_count(&db->pipeline) == 0) {
+		pipeline_finished(db);
+		return;
+	}
+	if (db->api.state == SQL_DB_STATE_BUSY &&
+	    db->pipeline_wait_result == NULL &&
+	    array_count(&db->pipeline) < db->pipeline_max)
+		driver_pgsql_set_state(db, SQL_DB_STATE_IDLE);
+
+	if ((ret = PQflush(db->pg)) < 0) {
+		driver_pgsql_close(db);
+		return;
+	}
+	pipeline_set_io(db, ret > 0);
+}
+
+static void pipeline_send_query(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	int ret;
+
+	if (!db->pipeline_mode) {
+		if (PQenterPipelineMode(db->pg) == 0) {
+			e_error(db->api.event,
+				"PQenterPipelineMode() failed: %s",
+				last_error(db));
+			send_query(result);
+			return;
+		}
+		db->pipeline_mode = TRUE;
+	}
+
+	result->detached = TRUE;
+	DLLIST_PREPEND(&db->pending_results, result);
+	array_push_back(&db->pipeline, &result);
+	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
+				 query_timeout, result);
+	if (array_count(&db->pipeline) >= db->pipeline_max)
+		driver_pgsql_set_state(db, SQL_DB_STATE_BUSY);
+
+	if (PQsendQueryParams(db->pg, result->query, 0, NULL, NULL, NULL,
+			      NULL, 0) == 0 ||
+	    PQpipelineSync(db->pg) == 0 ||
+	    (ret = PQflush(db->pg)) < 0) {
+		/* failed to send query */
+		driver_pgsql_close(db);
+		return;
+	}
+	pipeline_set_io(db, ret > 0);
+}
+#else
+static bool
+pipeline_can_send(struct pgsql_db *db ATTR_UNUSED,
+		  const char *query ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+static void pipeline_send_query(struct pgsql_result *result ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+static void pipeline_finished(struct pgsql_db *db ATTR_UNUSED)
+{
+}
+#endif
+
+static void
+do_query(struct pgsql_result *result, const char *query, bool pipeline)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+
+	i_assert(SQL_DB_IS_READY(&db->api));
+
+	result->query = i_strdup(query);
+	if (pipeline && pipeline_can_send(db, query))
+		pipeline_send_query(result);
+	else if (db->pipeline_mode) {
+		/* send it after the pipelined queries have finished */
+		i_assert(db->pipeline_wait_result == NULL);
+		db->pipeline_wait_result = result;
+		DLLIST_PREPEND(&db->pending_results, result);
+		driver_pgsql_set_state(db, SQL_DB_STATE_BUSY);
+	} else {
+		send_query(result);
+	}
+}
+
 static const char *
 driver_pgsql_escape_string(struct sql_db *_db, const char *string)
 {
@@ -623,11 +907,12 @@ static void driver_pgsql_exec(struct sql_db *db, const char *query)
 	result->api.refcount = 1;
 	result->api.event = event_create(db->event);
 	result->callback = exec_callback;
-	do_query(result, query);
+	do_query(result, query, FALSE);
 }
 
-static void driver_pgsql_query(struct sql_db *db, const char *query,
-			       sql_query_callback_t *callback, void *context)
+static void
+driver_pgsql_query_full(struct sql_db *db, const char *query, bool pipeline,
+			sql_query_callback_t *callback, void *context)
 {
 	struct pgsql_result *result;
 
@@ -638,7 +923,19 @@ static void driver_pgsql_query(struct sql_db *db, const char *query,
 	result->api.event = event_create(db->event);
 	result->callback = callback;
 	result->context = context;
-	do_query(result, query);
+	do_query(result, query, pipeline);
+}
+
+#define driver_pgsql_query_full(db, query, pipeline, callback, context) \
+	driver_pgsql_query_full(db, query - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct sql_result *, typeof(context))), \
+		pipeline, (sql_query_callback_t *)callback, context)
+
+static void driver_pgsql_query(struct sql_db *db, const char *query,
+			       sql_query_callback_t *callback, void *context)
+{
+	(driver_pgsql_query_full)(db, query, TRUE, callback, context);
 }
 
 static void pgsql_query_s_callback(struct sql_result *result, void *context)
@@ -648,10 +945,18 @@ static void pgsql_query_s_callback(struct sql_result *result, void *context)
 	db->sync_result = result;
 }
 
+static void driver_pgsql_wait(struct sql_db *_db);
+
 static void driver_pgsql_sync_init(struct pgsql_db *db)
 {
 	bool add_to_connect;
 
+	if (db->pipeline_mode) {
+		/* the pipelined queries need to finish first */
+		driver_pgsql_wait(&db->api);
+		pipeline_finished(db);
+	}
+
 	db->orig_ioloop = current_ioloop;
 	if (db->io == NULL) {
 		db->ioloop = io_loop_create();
@@ -699,7 +1004,8 @@ driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
 		break;
 	}
 
-	driver_pgsql_query(&db->api, query, pgsql_query_s_callback, db);
+	(driver_pgsql_query_full)(&db->api, query, FALSE,
+				  pgsql_query_s_callback, db);
 	if (db->sync_result == NULL)
 		io_loop_run(db->ioloop);
 
@@ -741,6 +1047,11 @@ static int driver_pgsql_result_next_row(struct sql_result *_result)
 		if (++result->rownum < result->rows)
 			return 1;
 
+		if (result->detached) {
+			/* the pipelined query's other results were already
+			   discarded */
+			return 0;
+		}
 		/* end of this packet. see if there's more. FIXME: this may
 		   block, but the current API doesn't provide a non-blocking
 		   way to do this.. */
@@ -770,7 +1081,8 @@ static int driver_pgsql_result_next_row(struct sql_result *_result)
 	default:
 		/* treat as fatal error */
 		_result->failed = TRUE;
-		db->fatal_error = TRUE;
+		if (!result->detached)
+			db->fatal_error = TRUE;
 		return -1;
 	}
 }
@@ -908,7 +1220,8 @@ static const char *driver_pgsql_result_get_error(struct sql_result *_result)
 		db->error = i_strdup("Query timed out");
 	} else if (result->pgres == NULL) {
 		/* connection error */
-		db->error = i_strdup(last_error(db));
+		db->error = i_strdup(result->error != NULL ?
+				     result->error : last_error(db));
 	} else {
 		msg = PQresultErrorMessage(result->pgres);
 		if (msg == NULL)
@@ -980,11 +1293,11 @@ static bool transaction_send_next(void *context)
 		struct sql_transaction_query *query = ctx->ctx.head;
 
 		ctx->ctx.head = ctx->ctx.head->next;
-		sql_query(ctx->ctx.db, query->query,
-			  transaction_update_callback, query);
+		driver_pgsql_query_full(ctx->ctx.db, query->query, FALSE,
+					transaction_update_callback, query);
 	} else {
-		sql_query(ctx->ctx.db, "COMMIT",
-			  transaction_commit_callback, ctx);
+		driver_pgsql_query_full(ctx->ctx.db, "COMMIT", FALSE,
+					transaction_commit_callback, ctx);
 	}
 	return TRUE;
 }
@@ -1107,7 +1420,8 @@ driver_pgsql_transaction_commit(struct sql_transaction_context *_ctx,
 	} else {
 		/* multiple queries, use a transaction */
 		i_assert(_ctx->db->v.query == driver_pgsql_query);
-		sql_query(_ctx->db, "BEGIN", transaction_begin_callback, ctx);
+		driver_pgsql_query_full(_ctx->db, "BEGIN", FALSE,
+					transaction_begin_callback, ctx);
 	}
 }
 
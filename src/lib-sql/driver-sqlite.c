@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "eacces-error.h"
 #include "array.h"
+#include "hash.h"
 #include "ioloop.h"
 #include "str.h"
 #include "hex-binary.h"
@@ -29,9 +30,49 @@ struct sqlite_db {
 	int rc;
 };
 
+struct sqlite_prepared_statement {
+	struct sql_prepared_statement prep_stmt;
+
+	/* Compiled statement, or NULL if it hasn't been compiled yet for the
+	   current connection. */
+	sqlite3_stmt *stmt;
+	/* Result currently stepping through the stmt, or NULL if it's
+	   available for reuse. */
+	struct sqlite_result *result;
+};
+
+enum sqlite_sql_arg_type {
+	SQLITE_SQL_ARG_TYPE_STR,
+	SQLITE_SQL_ARG_TYPE_BINARY,
+	SQLITE_SQL_ARG_TYPE_INT64,
+	SQLITE_SQL_ARG_TYPE_DOUBLE,
+};
+
+struct sqlite_sql_arg {
+	unsigned int column_idx;
+
+	enum sqlite_sql_arg_type type;
+	const char *value_str;
+	const unsigned char *value_binary;
+	size_t value_binary_size;
+	int64_t value_int64;
+	double value_double;
+};
+
+struct sqlite_sql_statement {
+	struct sql_statement stmt;
+
+	/* NULL for statements created with sql_statement_init(), which are
+	   expanded into query text. */
+	struct sqlite_prepared_statement *prep;
+	ARRAY(struct sqlite_sql_arg) pending_args;
+};
+
 struct sqlite_result {
 	struct sql_result api;
 	sqlite3_stmt *stmt;
+	/* Set if stmt is the prepared statement's cached stmt */
+	struct sqlite_prepared_statement *prep;
 	unsigned int cols;
 	const char **row;
 };
@@ -99,12 +140,39 @@ static int driver_sqlite_connect(struct sql_db *_db)
 	return -1;
 }
 
+static void
+driver_sqlite_prepared_statement_close(struct sqlite_prepared_statement *prep_stmt)
+{
+	if (prep_stmt->result != NULL) {
+		/* the result still uses the stmt - it'll finalize it */
+		prep_stmt->result->prep = NULL;
+		prep_stmt->result = NULL;
+	} else if (prep_stmt->stmt != NULL) {
+		(void)sqlite3_finalize(prep_stmt->stmt);
+	}
+	prep_stmt->stmt = NULL;
+}
+
 static void driver_sqlite_disconnect(struct sql_db *_db)
 {
 	struct sqlite_db *db = container_of(_db, struct sqlite_db, api);
+	struct hash_iterate_context *iter;
+	struct sql_prepared_statement *prep_stmt;
+	char *query;
+
+	/* compiled statements belong to the connection */
+	iter = hash_table_iterate_init(_db->prepared_stmt_hash);
+	while (hash_table_iterate(iter, _db->prepared_stmt_hash,
+				  &query, &prep_stmt)) {
+		driver_sqlite_prepared_statement_close(
+			container_of(prep_stmt, struct sqlite_prepared_statement,
+				     prep_stmt));
+	}
+	hash_table_iterate_deinit(&iter);
 
 	sqlite3_close(db->sqlite);
 	db->sqlite = NULL;
+	db->connected = FALSE;
 }
 
 static int driver_sqlite_parse_connect_string(struct sqlite_db *db,
@@ -288,8 +356,112 @@ static void driver_sqlite_query(struct sql_db *db, const char *query,
 	sql_result_unref(result);
 }
 
-static struct sql_result *
-driver_sqlite_query_s(struct sql_db *_db, const char *query)
+static int
+driver_sqlite_statement_bind_args(struct sqlite_sql_statement *stmt,
+				  sqlite3_stmt *sqlite_stmt)
+{
+	const struct sqlite_sql_arg *arg;
+	int idx, rc = SQLITE_OK;
+
+	if (!array_is_created(&stmt->pending_args))
+		return SQLITE_OK;
+
+	array_foreach(&stmt->pending_args, arg) {
+		/* sqlite parameter indexes start from 1 */
+		idx = arg->column_idx + 1;
+		switch (arg->type) {
+		case SQLITE_SQL_ARG_TYPE_STR:
+			rc = sqlite3_bind_text(sqlite_stmt, idx, arg->value_str,
+					       -1, SQLITE_TRANSIENT);
+			break;
+		case SQLITE_SQL_ARG_TYPE_BINARY:
+			if (arg->value_binary_size == 0) {
+				rc = sqlite3_bind_zeroblob(sqlite_stmt, idx, 0);
+				break;
+			}
+			rc = sqlite3_bind_blob(sqlite_stmt, idx,
+					       arg->value_binary,
+					       arg->value_binary_size,
+					       SQLITE_TRANSIENT);
+			break;
+		case SQLITE_SQL_ARG_TYPE_INT64:
+			rc = sqlite3_bind_int64(sqlite_stmt, idx,
+						arg->value_int64);
+			break;
+		case SQLITE_SQL_ARG_TYPE_DOUBLE:
+			rc = sqlite3_bind_double(sqlite_stmt, idx,
+						 arg->value_double);
+			break;
+		}
+		if (rc != SQLITE_OK)
+			break;
+	}
+	return rc;
+}
+
+static int
+driver_sqlite_statement_prepare(struct sqlite_db *db,
+				struct sqlite_sql_statement *stmt,
+				struct sqlite_result *result)
+{
+	struct sqlite_prepared_statement *prep_stmt = stmt->prep;
+
+	if (prep_stmt->stmt != NULL && prep_stmt->result == NULL) {
+		/* reuse the already compiled statement */
+		result->stmt = prep_stmt->stmt;
+	} else {
+		/* first use, or the cached stmt is still being used by
+		   another result */
+		db->rc = sqlite3_prepare_v2(db->sqlite,
+					    prep_stmt->prep_stmt.query_template,
+					    -1, &result->stmt, NULL);
+		if (db->rc != SQLITE_OK) {
+			result->stmt = NULL;
+			return db->rc;
+		}
+		if (prep_stmt->stmt == NULL)
+			prep_stmt->stmt = result->stmt;
+	}
+	if (result->stmt == prep_stmt->stmt) {
+		prep_stmt->result = result;
+		result->prep = prep_stmt;
+	}
+	db->rc = driver_sqlite_statement_bind_args(stmt, result->stmt);
+	return db->rc;
+}
+
+static void driver_sqlite_result_free_stmt(struct sqlite_result *result)
+{
+	struct sqlite_db *db =
+		container_of(result->api.db, struct sqlite_db, api);
+	int rc;
+
+	if (result->prep != NULL) {
+		/* keep the compiled statement for the next query. The reset
+		   also releases the read lock held by an unfinished stmt. */
+		i_assert(result->prep->result == result);
+		(void)sqlite3_reset(result->stmt);
+		(void)sqlite3_clear_bindings(result->stmt);
+		result->prep->result = NULL;
+		result->prep = NULL;
+		result->stmt = NULL;
+		return;
+	}
+
+	rc = sqlite3_finalize(result->stmt);
+	if (rc == SQLITE_NOMEM) {
+		i_fatal_status(FATAL_OUTOFMEM, "finalize failed: %s (%d)",
+			       sqlite3_errmsg(db->sqlite), rc);
+	} else if (rc != SQLITE_OK) {
+		e_warning(result->api.event, "finalize failed: %s (%d)",
+			  sqlite3_errmsg(db->sqlite), rc);
+	}
+	result->stmt = NULL;
+}
+
+static struct sqlite_result *
+driver_sqlite_query_full(struct sql_db *_db, const char *query,
+			 struct sqlite_sql_statement *stmt)
 {
 	struct sqlite_db *db = container_of(_db, struct sqlite_db, api);
 	struct sqlite_result *result;
@@ -308,13 +480,20 @@ driver_sqlite_query_s(struct sql_db *_db, const char *query)
 		result->stmt = NULL;
 		result->cols = 0;
 	} else {
-		db->rc = sqlite3_prepare(db->sqlite, query, -1, &result->stmt, NULL);
+		if (stmt == NULL) {
+			db->rc = sqlite3_prepare(db->sqlite, query, -1,
+						 &result->stmt, NULL);
+		} else {
+			(void)driver_sqlite_statement_prepare(db, stmt, result);
+		}
 		driver_sqlite_result_log(&result->api, query);
 		if (db->rc == SQLITE_OK) {
 			result->api = driver_sqlite_result;
 			result->cols = sqlite3_column_count(result->stmt);
 			result->row = i_new(const char *, result->cols);
 		} else {
+			if (result->stmt != NULL)
+				driver_sqlite_result_free_stmt(result);
 			result->api = driver_sqlite_error_result;
 			result->stmt = NULL;
 			result->cols = 0;
@@ -324,29 +503,25 @@ driver_sqlite_query_s(struct sql_db *_db, const char *query)
 	result->api.db = _db;
 	result->api.refcount = 1;
 	result->api.event = event;
-	return &result->api;
+	return result;
+}
+
+static struct sql_result *
+driver_sqlite_query_s(struct sql_db *_db, const char *query)
+{
+	return &driver_sqlite_query_full(_db, query, NULL)->api;
 }
 
 static void driver_sqlite_result_free(struct sql_result *_result)
 {
 	struct sqlite_result *result =
 		container_of(_result, struct sqlite_result, api);
-	struct sqlite_db *db =
-		container_of(result->api.db, struct sqlite_db, api);
-	int rc;
 
 	if (_result->callback)
 		return;
 
 	if (result->stmt != NULL) {
-		rc = sqlite3_finalize(result->stmt);
-		if (rc == SQLITE_NOMEM) {
-			i_fatal_status(FATAL_OUTOFMEM, "finalize failed: %s (%d)",
-				       sqlite3_errmsg(db->sqlite), rc);
-		} else if (rc != SQLITE_OK) {
-			e_warning(_result->event, "finalize failed: %s (%d)",
-				  sqlite3_errmsg(db->sqlite), rc);
-		}
+		driver_sqlite_result_free_stmt(result);
 		i_free(result->row);
 	}
 	event_unref(&result->api.event);
@@ -602,6 +777,231 @@ driver_sqlite_update(struct sql_transaction_context *_ctx, const char *query,
 		*affected_rows = sqlite3_changes(db->sqlite);
 }
 
+static struct sql_prepared_statement *
+driver_sqlite_prepared_statement_init(struct sql_db *db,
+				      const char *query_template)
+{
+	struct sqlite_prepared_statement *prep_stmt =
+		i_new(struct sqlite_prepared_statement, 1);
+
+	prep_stmt->prep_stmt.db = db;
+	prep_stmt->prep_stmt.refcount = 1;
+	prep_stmt->prep_stmt.query_template = i_strdup(query_template);
+	return &prep_stmt->prep_stmt;
+}
+
+static void
+driver_sqlite_prepared_statement_deinit(struct sql_prepared_statement *_prep_stmt)
+{
+	struct sqlite_prepared_statement *prep_stmt =
+		container_of(_prep_stmt, struct sqlite_prepared_statement,
+			     prep_stmt);
+
+	driver_sqlite_prepared_statement_close(prep_stmt);
+	i_free(prep_stmt->prep_stmt.query_template);
+	i_free(prep_stmt);
+}
+
+static struct sql_statement *
+driver_sqlite_statement_init(struct sql_db *db ATTR_UNUSED,
+			     const char *query_template ATTR_UNUSED)
+{
+	pool_t pool = pool_alloconly_create("sqlite sql statement", 1024);
+	struct sqlite_sql_statement *stmt =
+		p_new(pool, struct sqlite_sql_statement, 1);
+	stmt->stmt.pool = pool;
+	return &stmt->stmt;
+}
+
+static struct sql_statement *
+driver_sqlite_statement_init_prepared(struct sql_prepared_statement *_prep_stmt)
+{
+	struct sqlite_prepared_statement *prep_stmt =
+		container_of(_prep_stmt, struct sqlite_prepared_statement,
+			     prep_stmt);
+	pool_t pool = pool_alloconly_create("sqlite prepared sql statement", 1024);
+	struct sqlite_sql_statement *stmt =
+		p_new(pool, struct sqlite_sql_statement, 1);
+
+	stmt->stmt.pool = pool;
+	stmt->stmt.query_template =
+		p_strdup(stmt->stmt.pool, prep_stmt->prep_stmt.query_template);
+	stmt->prep = prep_stmt;
+	return &stmt->stmt;
+}
+
+static struct sqlite_sql_arg *
+driver_sqlite_add_pending_arg(struct sqlite_sql_statement *stmt,
+			      unsigned int column_idx,
+			      enum sqlite_sql_arg_type type)
+{
+	struct sqlite_sql_arg *arg;
+
+	if (!array_is_created(&stmt->pending_args))
+		p_array_init(&stmt->pending_args, stmt->stmt.pool, 8);
+	arg = array_append_space(&stmt->pending_args);
+	arg->column_idx = column_idx;
+	arg->type = type;
+	return arg;
+}
+
+static void
+driver_sqlite_statement_bind_str(struct sql_statement *_stmt,
+				 unsigned int column_idx, const char *value)
+{
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+
+	if (stmt->prep != NULL) {
+		struct sqlite_sql_arg *arg =
+			driver_sqlite_add_pending_arg(stmt, column_idx,
+				SQLITE_SQL_ARG_TYPE_STR);
+		arg->value_str = p_strdup(_stmt->pool, value);
+	}
+}
+
+static void
+driver_sqlite_statement_bind_binary(struct sql_statement *_stmt,
+				    unsigned int column_idx,
+				    const void *value, size_t value_size)
+{
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+
+	if (stmt->prep != NULL) {
+		struct sqlite_sql_arg *arg =
+			driver_sqlite_add_pending_arg(stmt, column_idx,
+				SQLITE_SQL_ARG_TYPE_BINARY);
+		arg->value_binary = p_memdup(_stmt->pool, value, value_size);
+		arg->value_binary_size = value_size;
+	}
+}
+
+static void
+driver_sqlite_statement_bind_int64(struct sql_statement *_stmt,
+				   unsigned int column_idx, int64_t value)
+{
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+
+	if (stmt->prep != NULL) {
+		struct sqlite_sql_arg *arg =
+			driver_sqlite_add_pending_arg(stmt, column_idx,
+				SQLITE_SQL_ARG_TYPE_INT64);
+		arg->value_int64 = value;
+	}
+}
+
+static void
+driver_sqlite_statement_bind_double(struct sql_statement *_stmt,
+				    unsigned int column_idx, double value)
+{
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+
+	if (stmt->prep != NULL) {
+		struct sqlite_sql_arg *arg =
+			driver_sqlite_add_pending_arg(stmt, column_idx,
+				SQLITE_SQL_ARG_TYPE_DOUBLE);
+		arg->value_double = value;
+	}
+}
+
+static void
+driver_sqlite_statement_bind_uuid(struct sql_statement *_stmt,
+				  unsigned int column_idx,
+				  const guid_128_t uuid)
+{
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+
+	if (stmt->prep != NULL) {
+		/* sqlite has no uuid type - store it the same way as the
+		   expanded query text would */
+		struct sqlite_sql_arg *arg =
+			driver_sqlite_add_pending_arg(stmt, column_idx,
+				SQLITE_SQL_ARG_TYPE_STR);
+		arg->value_str = p_strdup(_stmt->pool,
+			guid_128_to_uuid_string(uuid, FORMAT_RECORD));
+	}
+}
+
+static struct sql_result *
+driver_sqlite_statement_query_s(struct sql_statement *_stmt)
+{
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+	struct sql_result *result;
+
+	if (stmt->prep == NULL) {
+		result = driver_sqlite_query_s(_stmt->db,
+					       sql_statement_get_query(_stmt));
+	} else {
+		result = &driver_sqlite_query_full(_stmt->db,
+				sql_statement_get_log_query(_stmt), stmt)->api;
+	}
+	pool_unref(&_stmt->pool);
+	return result;
+}
+
+static void
+driver_sqlite_statement_query(struct sql_statement *stmt,
+			      sql_query_callback_t *callback, void *context)
+{
+	struct sql_result *result;
+
+	result = driver_sqlite_statement_query_s(stmt);
+	result->callback = TRUE;
+	callback(result, context);
+	result->callback = FALSE;
+	sql_result_unref(result);
+}
+
+static void
+driver_sqlite_update_stmt(struct sql_transaction_context *_ctx,
+			  struct sql_statement *_stmt,
+			  unsigned int *affected_rows)
+{
+	struct sqlite_transaction_context *ctx =
+		container_of(_ctx, struct sqlite_transaction_context, ctx);
+	struct sqlite_db *db = container_of(_ctx->db, struct sqlite_db, api);
+	struct sqlite_sql_statement *stmt =
+		container_of(_stmt, struct sqlite_sql_statement, stmt);
+	struct sqlite_result result;
+
+	if (stmt->prep == NULL) {
+		driver_sqlite_update(_ctx, sql_statement_get_query(_stmt),
+				     affected_rows);
+		pool_unref(&_stmt->pool);
+		return;
+	}
+	if (ctx->failed) {
+		pool_unref(&_stmt->pool);
+		return;
+	}
+
+	i_zero(&result);
+	result.api.db = _ctx->db;
+	result.api.event = event_create(_ctx->db->event);
+	if (driver_sqlite_connect(_ctx->db) >= 0 &&
+	    driver_sqlite_statement_prepare(db, stmt, &result) == SQLITE_OK) {
+		db->rc = sqlite3_step(result.stmt);
+		if (db->rc == SQLITE_DONE || db->rc == SQLITE_ROW)
+			db->rc = SQLITE_OK;
+	}
+	driver_sqlite_result_log(&result.api,
+				 sql_statement_get_log_query(_stmt));
+
+	if (db->rc != SQLITE_OK)
+		ctx->failed = TRUE;
+	else if (affected_rows != NULL)
+		*affected_rows = sqlite3_changes(db->sqlite);
+	if (result.stmt != NULL)
+		driver_sqlite_result_free_stmt(&result);
+	event_unref(&result.api.event);
+	pool_unref(&_stmt->pool);
+}
+
 static const char *
 driver_sqlite_escape_blob(struct sql_db *_db ATTR_UNUSED,
 			  const unsigned char *data, size_t size)
@@ -620,7 +1020,7 @@ const struct sql_db driver_sqlite_db = {
 #if SQLITE_VERSION_NUMBER >= 3024000
 		SQL_DB_FLAG_ON_CONFLICT_DO |
 #endif
-		SQL_DB_FLAG_BLOCKING,
+		SQL_DB_FLAG_BLOCKING | SQL_DB_FLAG_PREP_STATEMENTS,
 
 	.v = {
 		.init_full = driver_sqlite_init_full_v,
@@ -640,6 +1040,19 @@ const struct sql_db driver_sqlite_db = {
 		.update = driver_sqlite_update,
 
 		.escape_blob = driver_sqlite_escape_blob,
+
+		.prepared_statement_init = driver_sqlite_prepared_statement_init,
+		.prepared_statement_deinit = driver_sqlite_prepared_statement_deinit,
+		.statement_init = driver_sqlite_statement_init,
+		.statement_init_prepared = driver_sqlite_statement_init_prepared,
+		.statement_bind_str = driver_sqlite_statement_bind_str,
+		.statement_bind_binary = driver_sqlite_statement_bind_binary,
+		.statement_bind_int64 = driver_sqlite_statement_bind_int64,
+		.statement_bind_double = driver_sqlite_statement_bind_double,
+		.statement_bind_uuid = driver_sqlite_statement_bind_uuid,
+		.statement_query = driver_sqlite_statement_query,
+		.statement_query_s = driver_sqlite_statement_query_s,
+		.update_stmt = driver_sqlite_update_stmt,
 	}
 };
 
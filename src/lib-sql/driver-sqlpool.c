@@ -260,7 +260,9 @@ sqlpool_state_changed(struct sql_db *conndb, enum sql_db_state prev_state,
 	if (conndb->state == SQL_DB_STATE_IDLE) {
 		conndb->connect_failure_count = 0;
 		conndb->connect_delay = SQL_CONNECT_MIN_DELAY;
-		sqlpool_request_send_next(db, conndb);
+		/* the connection may be able to pipeline more queries */
+		while (db->requests_head != NULL && SQL_DB_IS_READY(conndb))
+			sqlpool_request_send_next(db, conndb);
 	}
 
 	if (prev_state == SQL_DB_STATE_CONNECTING &&
@@ -66,9 +66,104 @@ static void test_sql_sqlite(void)
 	test_end();
 }
 
+static struct sql_result *
+test_sql_sqlite_prepared_query(struct sql_db *sql, const char *value)
+{
+	struct sql_prepared_statement *prep_stmt;
+	struct sql_statement *stmt;
+
+	prep_stmt = sql_prepared_statement_init(sql,
+		"SELECT foo FROM bar WHERE foo = ?");
+	stmt = sql_statement_init_prepared(prep_stmt);
+	sql_prepared_statement_unref(&prep_stmt);
+	sql_statement_bind_str(stmt, 0, value);
+	return sql_statement_query_s(&stmt);
+}
+
+static void test_sql_sqlite_prepared(void)
+{
+	test_begin("test sql api prepared statements");
+
+	const struct sql_settings set = {
+		.driver = "sqlite",
+		.connect_string = "test-database.db journal_mode=wal",
+	};
+	struct sql_prepared_statement *prep_stmt;
+	struct sql_statement *stmt;
+	struct sql_result *cursor, *cursor2;
+	struct sql_db *sql = NULL;
+	const char *error = NULL;
+	unsigned int affected_rows = 0;
+
+	sql_drivers_init();
+	driver_sqlite_init();
+
+	test_assert(sql_init_full(&set, &sql, &error) == 0 &&
+		    sql != NULL &&
+		    error == NULL);
+	test_assert((sql_get_flags(sql) & SQL_DB_FLAG_PREP_STATEMENTS) != 0);
+	setup_database(sql);
+
+	/* insert data with the same prepared statement twice */
+	struct sql_transaction_context *t = sql_transaction_begin(sql);
+	for (unsigned int i = 1; i <= 2; i++) {
+		prep_stmt = sql_prepared_statement_init(sql,
+			"INSERT INTO bar VALUES(?)");
+		stmt = sql_statement_init_prepared(prep_stmt);
+		sql_prepared_statement_unref(&prep_stmt);
+		sql_statement_bind_str(stmt, 0,
+				       t_strdup_printf("value'%u", i));
+		sql_update_stmt_get_rows(t, &stmt, &affected_rows);
+		test_assert_ucmp(affected_rows, ==, 1);
+	}
+	test_assert(sql_transaction_commit_s(&t, &error) == 0);
+
+	/* the cached statement is reused after the result is freed */
+	cursor = test_sql_sqlite_prepared_query(sql, "value'1");
+	test_assert(sql_result_next_row(cursor) == SQL_RESULT_NEXT_OK);
+	test_assert_strcmp(sql_result_get_field_value(cursor, 0), "value'1");
+	test_assert(sql_result_next_row(cursor) == SQL_RESULT_NEXT_LAST);
+
+	/* the cached statement is still in use - a new one is compiled */
+	cursor2 = test_sql_sqlite_prepared_query(sql, "value'2");
+	test_assert(sql_result_next_row(cursor2) == SQL_RESULT_NEXT_OK);
+	test_assert_strcmp(sql_result_get_field_value(cursor2, 0), "value'2");
+	test_assert(sql_result_next_row(cursor2) == SQL_RESULT_NEXT_LAST);
+	sql_result_unref(cursor);
+	sql_result_unref(cursor2);
+
+	cursor = test_sql_sqlite_prepared_query(sql, "value'2");
+	test_assert(sql_result_next_row(cursor) == SQL_RESULT_NEXT_OK);
+	test_assert_strcmp(sql_result_get_field_value(cursor, 0), "value'2");
+	sql_result_unref(cursor);
+
+	/* statements are compiled again after reconnecting */
+	sql_disconnect(sql);
+	cursor = test_sql_sqlite_prepared_query(sql, "value'1");
+	test_assert(sql_result_next_row(cursor) == SQL_RESULT_NEXT_OK);
+	test_assert_strcmp(sql_result_get_field_value(cursor, 0), "value'1");
+	sql_result_unref(cursor);
+
+	/* plain statements are still expanded into query text */
+	stmt = sql_statement_init(sql, "SELECT foo FROM bar WHERE foo = ?");
+	sql_statement_bind_str(stmt, 0, "value'2");
+	cursor = sql_statement_query_s(&stmt);
+	test_assert(sql_result_next_row(cursor) == SQL_RESULT_NEXT_OK);
+	test_assert_strcmp(sql_result_get_field_value(cursor, 0), "value'2");
+	sql_result_unref(cursor);
+
+	sql_unref(&sql);
+
+	driver_sqlite_deinit();
+	sql_drivers_deinit();
+
+	test_end();
+}
+
 int main(void) {
 	static void (*const test_functions[])(void) = {
 		test_sql_sqlite,
+		test_sql_sqlite_prepared,
 		NULL
 	};
 	return test_run(test_functions);
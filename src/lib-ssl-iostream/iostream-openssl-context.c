@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "hex-binary.h"
+#include "base64.h"
 #include "safe-memset.h"
 #include "iostream-openssl.h"
 #include "dovecot-openssl-common.h"
@@ -205,6 +206,38 @@ ssl_iostream_ctx_use_dh(struct ssl_iostream_context *ctx,
 	return ret;
 }
 
+static int
+ssl_iostream_ctx_use_session_ticket_key(struct ssl_iostream_context *ctx,
+					const char *key, const char **error_r)
+{
+	buffer_t *buf;
+	long key_size;
+	int ret;
+
+	/* The same key must be used by all the processes, so a session ticket
+	   created by one process can be resumed by another one. */
+	key_size = SSL_CTX_set_tlsext_ticket_keys(ctx->ssl_ctx, NULL, 0);
+	buf = t_buffer_create(key_size);
+	if (base64_decode(key, strlen(key), buf) < 0 ||
+	    buf->used != (size_t)key_size) {
+		*error_r = t_strdup_printf(
+			"ssl_session_ticket_key: Key must be %ld bytes of "
+			"base64-encoded data", key_size);
+		return -1;
+	}
+	ret = SSL_CTX_set_tlsext_ticket_keys(ctx->ssl_ctx,
+					     buffer_get_modifiable_data(buf, NULL),
+					     buf->used);
+	safe_memset(buffer_get_modifiable_data(buf, NULL), 0, buf->used);
+	if (ret != 1) {
+		*error_r = t_strdup_printf(
+			"SSL_CTX_set_tlsext_ticket_keys() failed: %s",
+			openssl_iostream_error());
+		return -1;
+	}
+	return 0;
+}
+
 static int ssl_ctx_use_certificate_chain(SSL_CTX *ctx, const char *cert)
 {
 	/* mostly just copy&pasted from SSL_CTX_use_certificate_chain_file() */
@@ -648,6 +681,12 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 		if (ssl_iostream_ctx_use_dh(ctx, set, error_r) < 0)
 			return -1;
 	}
+	if (!ctx->client_ctx && set->session_ticket_key != NULL &&
+	    *set->session_ticket_key != '\0') {
+		if (ssl_iostream_ctx_use_session_ticket_key(ctx,
+				set->session_ticket_key, error_r) < 0)
+			return -1;
+	}
 
 	/* set trusted CA certs */
 	if (set->verify_remote_cert) {
@@ -749,6 +788,50 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 	return ssl_iostream_context_set(ctx, set, error_r);
 }
 
+static int ssl_client_new_session_callback(SSL *ssl, SSL_SESSION *session)
+{
+	struct ssl_iostream *ssl_io;
+	SSL_SESSION *old_session;
+	char *old_host;
+
+	ssl_io = SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	if (ssl_io->connected_host == NULL)
+		return 0;
+
+	/* remember the latest session for each host */
+	if (hash_table_lookup_full(ssl_io->ctx->client_sessions,
+				   ssl_io->connected_host,
+				   &old_host, &old_session)) {
+		hash_table_update(ssl_io->ctx->client_sessions,
+				  old_host, session);
+		SSL_SESSION_free(old_session);
+	} else {
+		hash_table_insert(ssl_io->ctx->client_sessions,
+				  i_strdup(ssl_io->connected_host), session);
+	}
+	/* we took the reference */
+	return 1;
+}
+
+static void
+ssl_iostream_context_free_client_sessions(struct ssl_iostream_context *ctx)
+{
+	struct hash_iterate_context *iter;
+	SSL_SESSION *session;
+	char *host;
+
+	if (!hash_table_is_created(ctx->client_sessions))
+		return;
+
+	iter = hash_table_iterate_init(ctx->client_sessions);
+	while (hash_table_iterate(iter, ctx->client_sessions, &host, &session)) {
+		SSL_SESSION_free(session);
+		i_free(host);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&ctx->client_sessions);
+}
+
 int openssl_iostream_context_init_client(const struct ssl_iostream_settings *set,
 					 struct ssl_iostream_context **ctx_r,
 					 const char **error_r)
@@ -762,11 +845,19 @@ int openssl_iostream_context_init_client(const struct ssl_iostream_settings *set
 		return -1;
 	}
 	SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+	/* Keep the sessions in our own per-host cache, so the following
+	   connections to the same host can resume them and skip the full
+	   handshake. */
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT |
+				       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_ctx, ssl_client_new_session_callback);
 
 	ctx = i_new(struct ssl_iostream_context, 1);
 	ctx->refcount = 1;
 	ctx->ssl_ctx = ssl_ctx;
 	ctx->client_ctx = TRUE;
+	hash_table_create(&ctx->client_sessions, default_pool, 0,
+			  str_hash, strcmp);
 	if (ssl_iostream_context_init_common(ctx, set, error_r) < 0) {
 		ssl_iostream_context_unref(&ctx);
 		return -1;
@@ -811,6 +902,7 @@ void openssl_iostream_context_unref(struct ssl_iostream_context *ctx)
 	if (--ctx->refcount > 0)
 		return;
 
+	ssl_iostream_context_free_client_sessions(ctx);
 	SSL_CTX_free(ctx->ssl_ctx);
 	pool_unref(&ctx->pool);
 	i_free(ctx);
@@ -298,7 +298,9 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	   Each of the BIOs have one "write buffer". BIO_write() copies data
 	   to them, while BIO_read() reads from the other BIO's write buffer
 	   into the given buffer. The bio_int is used by OpenSSL and bio_ext
-	   is used by this library. */
+	   is used by this library. Note that this also means kernel TLS
+	   offloading can't be used, since OpenSSL enables it only for socket
+	   BIOs while the keys are being installed. */
 	if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
 		*error_r = t_strdup_printf("BIO_new_bio_pair() failed: %s",
 					   openssl_iostream_error());
@@ -328,6 +330,15 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
         SSL_set_ex_data(ssl_io->ssl, dovecot_ssl_extdata_index, ssl_io);
 	SSL_set_tlsext_host_name(ssl_io->ssl, host);
+	if (client && host != NULL &&
+	    hash_table_is_created(ctx->client_sessions)) {
+		SSL_SESSION *session =
+			hash_table_lookup(ctx->client_sessions, host);
+
+		/* try to resume the previous session to the same host */
+		if (session != NULL && SSL_set_session(ssl_io->ssl, session) != 1)
+			openssl_iostream_clear_errors();
+	}
 
 	if (openssl_iostream_set(ssl_io, set, error_r) < 0) {
 		openssl_iostream_free(ssl_io);
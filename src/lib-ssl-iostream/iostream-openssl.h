@@ -1,6 +1,7 @@
 #ifndef IOSTREAM_OPENSSL_H
 #define IOSTREAM_OPENSSL_H
 
+#include "hash.h"
 #include "iostream-ssl-private.h"
 
 #include <openssl/ssl.h>
@@ -25,6 +26,10 @@ struct ssl_iostream_context {
 
 	int username_nid;
 
+	/* SSL clients: host => SSL_SESSION of the latest connection to it,
+	   used for resuming the sessions */
+	HASH_TABLE(char *, SSL_SESSION *) client_sessions;
+
 	bool client_ctx:1;
 };
 
@@ -20,6 +20,7 @@ static const size_t ssl_iostream_settings_string_offsets[] = {
 	OFFSET(alt_cert.key),
 	OFFSET(alt_cert.key_password),
 	OFFSET(dh),
+	OFFSET(session_ticket_key),
 	OFFSET(cert_username_field),
 	OFFSET(crypto_device),
 };
@@ -24,6 +24,8 @@ struct ssl_iostream_settings {
 	struct ssl_iostream_cert cert; /* both */
 	struct ssl_iostream_cert alt_cert; /* both */
 	const char *dh; /* context-only */
+	/* base64-encoded TLS session ticket key, shared by all processes */
+	const char *session_ticket_key; /* context-only */
 	const char *cert_username_field; /* both */
 	const char *crypto_device; /* context-only */
 
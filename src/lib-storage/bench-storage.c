@@ -0,0 +1,379 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "str.h"
+#include "strnum.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "process-stat.h"
+#include "master-service.h"
+#include "mail-search-build.h"
+#include "test-mail-storage-common.h"
+
+#include <stdio.h>
+
+#define BENCH_SAVE_BATCH_SIZE 100
+#define BENCH_SEARCH_NEEDLE "benchneedle"
+#define BENCH_COPY_MAILBOX "Copy"
+
+/**
+ * Creates a user for each of the given mail storage formats and measures
+ * how long the common mail-storage.h operations take with a synthetic
+ * mailbox: saving, syncing, fetching, searching, sorting, copying and
+ * expunging. The read() and write() syscall counts are taken from
+ * /proc/self/io, so they are only available on Linux.
+ */
+
+struct bench_ctx {
+	unsigned int message_count;
+	struct test_mail_storage_ctx *storage_ctx;
+	struct event *event;
+	struct mailbox *box;
+
+	uint64_t ts_0;
+	struct process_stat stat;
+};
+
+static void bench_start(struct bench_ctx *ctx)
+{
+	process_stat_read_start(&ctx->stat, ctx->event);
+	ctx->ts_0 = i_nanoseconds();
+}
+
+static void bench_end(struct bench_ctx *ctx, const char *name,
+		      unsigned long count, const char *unit)
+{
+	double usecs = (double)(i_nanoseconds() - ctx->ts_0) / 1000.0;
+
+	process_stat_read_finish(&ctx->stat, ctx->event);
+	printf("%s\n\tTotal: %0.02lf ms\n\t%0.03lf us/%s\n"
+	       "\t%0.01lf %s/s\n"
+	       "\tsyscalls: %"PRIu64" reads, %"PRIu64" writes\n"
+	       "\tI/O: %"PRIu64" bytes read, %"PRIu64" bytes written\n\n",
+	       name, usecs / 1000.0, usecs / (double)count, unit,
+	       usecs == 0 ? 0 : (double)count * 1000000.0 / usecs, unit,
+	       ctx->stat.syscr, ctx->stat.syscw,
+	       ctx->stat.rchar, ctx->stat.wchar);
+}
+
+static void ATTR_NORETURN
+bench_box_fatal(struct mailbox *box, const char *func)
+{
+	i_fatal("%s(%s) failed: %s", func, mailbox_get_vname(box),
+		mailbox_get_last_internal_error(box, NULL));
+}
+
+static void bench_commit(struct mailbox_transaction_context **trans)
+{
+	struct mailbox *box = mailbox_transaction_get_mailbox(*trans);
+
+	if (mailbox_transaction_commit(trans) < 0)
+		bench_box_fatal(box, "mailbox_transaction_commit");
+}
+
+static void bench_sync(struct mailbox *box, enum mailbox_sync_flags flags)
+{
+	if (mailbox_sync(box, flags) < 0)
+		bench_box_fatal(box, "mailbox_sync");
+}
+
+static void bench_save_one(struct mailbox_transaction_context *trans,
+			   unsigned int n)
+{
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *str = t_str_new(1024);
+	ssize_t ret;
+
+	str_printfa(str, "From: user%u@example.com\n"
+		    "To: rcpt%u@example.com\n"
+		    "Subject: bench subject %u\n"
+		    "Date: %s\n"
+		    "Message-ID: <bench-%u@example.com>\n"
+		    "\n", i_rand_limit(100), i_rand_limit(100),
+		    i_rand_limit(1000),
+		    t_strdup_printf("Mon, %u Jan 2024 %02u:00:00 +0000",
+				    1 + i_rand_limit(28), i_rand_limit(24)),
+		    n);
+	for (unsigned int i = i_rand_limit(20); i > 0; i--)
+		str_append(str, "The quick brown fox jumps over the lazy dog\n");
+	if (n % 10 == 0)
+		str_append(str, BENCH_SEARCH_NEEDLE"\n");
+
+	input = i_stream_create_from_data(str_data(str), str_len(str));
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0)
+		bench_box_fatal(mailbox_transaction_get_mailbox(trans),
+				"mailbox_save_begin");
+	do {
+		if (mailbox_save_continue(save_ctx) < 0) {
+			mailbox_save_cancel(&save_ctx);
+			bench_box_fatal(mailbox_transaction_get_mailbox(trans),
+					"mailbox_save_continue");
+		}
+	} while ((ret = i_stream_read(input)) > 0);
+	i_assert(ret == -1);
+	if (mailbox_save_finish(&save_ctx) < 0)
+		bench_box_fatal(mailbox_transaction_get_mailbox(trans),
+				"mailbox_save_finish");
+	i_stream_unref(&input);
+}
+
+static void bench_save(struct bench_ctx *ctx)
+{
+	struct mailbox_transaction_context *trans;
+
+	bench_start(ctx);
+	for (unsigned int n = 0; n < ctx->message_count; ) {
+		trans = mailbox_transaction_begin(ctx->box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+		for (unsigned int i = 0; i < BENCH_SAVE_BATCH_SIZE &&
+		     n < ctx->message_count; i++, n++) T_BEGIN {
+			bench_save_one(trans, n);
+		} T_END;
+		bench_commit(&trans);
+	}
+	bench_sync(ctx->box, 0);
+	bench_end(ctx, "mailbox_save", ctx->message_count, "mail");
+}
+
+static void bench_resync(struct bench_ctx *ctx)
+{
+	/* reopen the mailbox so the sync has to look at the storage */
+	mailbox_close(ctx->box);
+	bench_start(ctx);
+	if (mailbox_open(ctx->box) < 0)
+		bench_box_fatal(ctx->box, "mailbox_open");
+	bench_sync(ctx->box, MAILBOX_SYNC_FLAG_FULL_READ);
+	bench_end(ctx, "mailbox_sync (reopen + full read)",
+		  ctx->message_count, "mail");
+}
+
+static unsigned int
+bench_search(struct bench_ctx *ctx, struct mail_search_args *args,
+	     const enum mail_sort_type *sort_program,
+	     enum mail_fetch_field wanted_fields, bool read_body)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	struct istream *input;
+	const char *value;
+	unsigned int count = 0;
+
+	trans = mailbox_transaction_begin(ctx->box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, sort_program,
+					 wanted_fields, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (read_body) {
+			if (mail_get_first_header(mail, "Subject", &value) < 0 ||
+			    mail_get_stream(mail, NULL, NULL, &input) < 0)
+				bench_box_fatal(ctx->box, "mail fetch");
+			i_stream_seek(input, 0);
+			while (i_stream_read(input) > 0)
+				i_stream_skip(input, i_stream_get_data_size(input));
+			if (input->stream_errno != 0)
+				bench_box_fatal(ctx->box, "mail read");
+		}
+		count++;
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		bench_box_fatal(ctx->box, "mailbox_search_deinit");
+	bench_commit(&trans);
+	return count;
+}
+
+static void bench_fetch(struct bench_ctx *ctx)
+{
+	struct mail_search_args *args;
+	unsigned int count;
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	bench_start(ctx);
+	count = bench_search(ctx, args, NULL, MAIL_FETCH_FLAGS |
+			     MAIL_FETCH_VIRTUAL_SIZE | MAIL_FETCH_STREAM_BODY,
+			     TRUE);
+	bench_end(ctx, "mail fetch (header + body)", count, "mail");
+	mail_search_args_unref(&args);
+}
+
+static void bench_search_body(struct bench_ctx *ctx)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	unsigned int count;
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_BODY);
+	arg->value.str = BENCH_SEARCH_NEEDLE;
+	bench_start(ctx);
+	count = bench_search(ctx, args, NULL, 0, FALSE);
+	bench_end(ctx, t_strdup_printf("mailbox_search (BODY, %u matches)",
+				       count), ctx->message_count, "mail");
+	mail_search_args_unref(&args);
+}
+
+static void bench_sort(struct bench_ctx *ctx)
+{
+	static const enum mail_sort_type sort_program[] = {
+		MAIL_SORT_SUBJECT, MAIL_SORT_DATE, MAIL_SORT_END
+	};
+	struct mail_search_args *args;
+	unsigned int count;
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	bench_start(ctx);
+	count = bench_search(ctx, args, sort_program, 0, FALSE);
+	bench_end(ctx, "mailbox_search (SORT SUBJECT DATE)", count, "mail");
+	mail_search_args_unref(&args);
+}
+
+static void bench_copy(struct bench_ctx *ctx)
+{
+	struct mailbox_transaction_context *src_trans, *dest_trans;
+	struct mail_search_args *args;
+	struct mail_search_context *search_ctx;
+	struct mail_save_context *save_ctx;
+	struct mailbox *dest_box;
+	struct mail *mail;
+	unsigned int count = 0;
+
+	dest_box = mailbox_alloc(mailbox_get_namespace(ctx->box)->list,
+				 BENCH_COPY_MAILBOX, 0);
+	if (mailbox_create(dest_box, NULL, FALSE) < 0)
+		bench_box_fatal(dest_box, "mailbox_create");
+	if (mailbox_open(dest_box) < 0)
+		bench_box_fatal(dest_box, "mailbox_open");
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	bench_start(ctx);
+	src_trans = mailbox_transaction_begin(ctx->box, 0, __func__);
+	dest_trans = mailbox_transaction_begin(dest_box,
+		MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	search_ctx = mailbox_search_init(src_trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		save_ctx = mailbox_save_alloc(dest_trans);
+		if (mailbox_copy(&save_ctx, mail) < 0)
+			bench_box_fatal(dest_box, "mailbox_copy");
+		count++;
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		bench_box_fatal(ctx->box, "mailbox_search_deinit");
+	bench_commit(&dest_trans);
+	bench_commit(&src_trans);
+	bench_sync(dest_box, 0);
+	bench_end(ctx, "mailbox_copy", count, "mail");
+	mail_search_args_unref(&args);
+
+	if (mailbox_delete(dest_box) < 0)
+		bench_box_fatal(dest_box, "mailbox_delete");
+	mailbox_free(&dest_box);
+}
+
+static void bench_expunge(struct bench_ctx *ctx)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	unsigned int count = 0;
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	bench_start(ctx);
+	trans = mailbox_transaction_begin(ctx->box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		/* expunge every other mail to fragment the mailbox */
+		if (mail->seq % 2 == 0) {
+			mail_expunge(mail);
+			count++;
+		}
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		bench_box_fatal(ctx->box, "mailbox_search_deinit");
+	bench_commit(&trans);
+	bench_sync(ctx->box, MAILBOX_SYNC_FLAG_EXPUNGE);
+	bench_end(ctx, "mail_expunge (every other mail)", count, "mail");
+	mail_search_args_unref(&args);
+}
+
+static void bench_format(struct bench_ctx *ctx, const char *driver)
+{
+	struct test_mail_storage_settings set = {
+		.username = t_strdup_printf("bench-%s", driver),
+		.driver = driver,
+	};
+
+	printf("==== %s ====\n\n", driver);
+	test_mail_storage_init_user(ctx->storage_ctx, &set);
+	ctx->box = mailbox_alloc(ctx->storage_ctx->user->namespaces->list,
+				 "INBOX", 0);
+	if (mailbox_open(ctx->box) < 0)
+		bench_box_fatal(ctx->box, "mailbox_open");
+
+	bench_save(ctx);
+	bench_resync(ctx);
+	T_BEGIN {
+		bench_fetch(ctx);
+		bench_search_body(ctx);
+		bench_sort(ctx);
+		bench_copy(ctx);
+		bench_expunge(ctx);
+	} T_END;
+
+	mailbox_free(&ctx->box);
+	test_mail_storage_deinit_user(ctx->storage_ctx);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [messages [format,...]]\n", prog);
+	fprintf(stderr, "Runs with 10000 messages on maildir, sdbox, mdbox "
+		"and mbox if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_ctx ctx = {
+		.message_count = 10000,
+	};
+	const char *const *formats = (const char *const[]) {
+		"maildir", "sdbox", "mdbox", "mbox", NULL
+	};
+	const char *prog = argv[0];
+
+	master_service = master_service_init("bench-storage",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT,
+					     &argc, &argv, "");
+	if (argc > 3)
+		print_usage(prog);
+	if (argc > 1 && (str_to_uint(argv[1], &ctx.message_count) < 0 ||
+			 ctx.message_count == 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(prog);
+	}
+	if (argc > 2)
+		formats = t_strsplit(argv[2], ",");
+
+	ctx.event = event_create(NULL);
+	ctx.storage_ctx = test_mail_storage_init();
+	printf("Mailboxes have %u messages\n\n", ctx.message_count);
+	for (; *formats != NULL; formats++) T_BEGIN {
+		bench_format(&ctx, *formats);
+	} T_END;
+	test_mail_storage_deinit(&ctx.storage_ctx);
+	event_unref(&ctx.event);
+
+	master_service_deinit(&master_service);
+	return 0;
+}
@@ -23,7 +23,7 @@ void dbox_attachment_save_write_metadata(struct mail_save_context *ctx,
 
 static int
 dbox_attachment_file_get_stream_from(struct dbox_file *file,
-				     const char *ext_refs,
+				     const char *ext_refs, bool prefetch,
 				     struct istream **stream,
 				     const char **error_r)
 {
@@ -42,12 +42,12 @@ dbox_attachment_file_get_stream_from(struct dbox_file *file,
 	if (index_attachment_stream_get(file->storage->attachment_fs,
 					file->storage->attachment_dir,
 					path_suffix, stream, msg_size,
-					ext_refs, error_r) < 0)
+					ext_refs, prefetch, error_r) < 0)
 		return 0;
 	return 1;
 }
 
-int dbox_attachment_file_get_stream(struct dbox_file *file,
+int dbox_attachment_file_get_stream(struct dbox_file *file, bool prefetch,
 				    struct istream **stream)
 {
 	const char *ext_refs, *error;
@@ -66,7 +66,8 @@ int dbox_attachment_file_get_stream(struct dbox_file *file,
 	/* we have external references. */
 	T_BEGIN {
 		ret = dbox_attachment_file_get_stream_from(file, ext_refs,
-							   stream, &error);
+							   prefetch, stream,
+							   &error);
 		if (ret == 0) {
 			dbox_file_set_corrupted(file,
 				"Corrupted ext-refs metadata %s: %s",
@@ -279,8 +279,38 @@ get_mail_stream(struct dbox_mail *mail, uoff_t offset,
 	}
 	if (file->storage->attachment_dir == NULL)
 		return 1;
-	else
-		return dbox_attachment_file_get_stream(file, stream_r);
+	else {
+		bool prefetch = (mail->imail.data.access_part &
+				 (READ_BODY | PARSE_BODY)) != 0;
+		return dbox_attachment_file_get_stream(file, prefetch,
+						       stream_r);
+	}
+}
+
+bool dbox_mail_prefetch(struct mail *_mail)
+{
+	struct dbox_storage *storage = DBOX_STORAGE(_mail->box->storage);
+	struct dbox_mail *mail = DBOX_MAIL(_mail);
+	struct index_mail_data *data = &mail->imail.data;
+	struct istream *input;
+
+	if (storage->attachment_fs == NULL ||
+	    (data->access_part & (READ_BODY | PARSE_BODY)) == 0)
+		return index_mail_prefetch(_mail);
+
+	/* Opening the stream already starts reading the external
+	   attachments via fs_prefetch(). Do it now, so the attachments of the
+	   next mails are read while the current mail is being handled. */
+	if (data->stream == NULL) {
+		if (mail_get_stream_because(_mail, NULL, NULL, "prefetch",
+					    &input) < 0)
+			return TRUE;
+	}
+	if (mail->open_file != NULL &&
+	    dbox_file_metadata_get(mail->open_file,
+				   DBOX_METADATA_EXT_REF) != NULL)
+		data->prefetch_sent = TRUE;
+	return index_mail_prefetch(_mail) && !data->prefetch_sent;
 }
 
 int dbox_mail_get_stream(struct mail *_mail, bool get_body ATTR_UNUSED,
@@ -41,6 +41,36 @@ void mdbox_map_set_corrupted(struct mdbox_map *map, const char *format, ...)
 	mdbox_storage_set_corrupted(map->storage);
 }
 
+static void mdbox_map_set_optimization_settings(struct mdbox_map *map)
+{
+	const struct mail_storage_settings *set = MAP_STORAGE(map)->set;
+	struct mail_index_optimization_settings optimization_set = {
+		.index = {
+			.rewrite_min_log_bytes = set->mail_index_rewrite_min_log_bytes,
+			.rewrite_max_log_bytes = set->mail_index_rewrite_max_log_bytes,
+		},
+		.log = {
+			.min_size = set->mail_index_log_rotate_min_size,
+			.max_size = set->mail_index_log_rotate_max_size,
+			.min_age_secs = set->mail_index_log_rotate_min_age,
+			.log2_max_age_secs = set->mail_index_log2_max_age,
+		},
+	};
+
+	/* The map index is rewritten while the map is locked, which blocks
+	   all saves and expunges of the user. With large maps it can be
+	   worth rewriting less often than the mailbox indexes. */
+	if (map->set->mdbox_map_rewrite_min_log_bytes != 0) {
+		optimization_set.index.rewrite_min_log_bytes =
+			map->set->mdbox_map_rewrite_min_log_bytes;
+	}
+	if (map->set->mdbox_map_rewrite_max_log_bytes != 0) {
+		optimization_set.index.rewrite_max_log_bytes =
+			map->set->mdbox_map_rewrite_max_log_bytes;
+	}
+	mail_index_set_optimization_settings(map->index, &optimization_set);
+}
+
 struct mdbox_map *
 mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list)
 {
@@ -64,6 +94,7 @@ mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list)
 	mail_index_set_lock_method(map->index,
 		MAP_STORAGE(map)->set->parsed_lock_method,
 		mail_storage_get_lock_timeout(MAP_STORAGE(map), UINT_MAX));
+	mdbox_map_set_optimization_settings(map);
 	map->root_list = root_list;
 	map->map_ext_id = mail_index_ext_register(map->index, "map",
 				sizeof(struct mdbox_map_mail_index_header),
@@ -6,6 +6,8 @@
 #include "ostream.h"
 #include "str.h"
 #include "hash.h"
+#include "sleep.h"
+#include "time-util.h"
 #include "dbox-attachment.h"
 #include "mdbox-storage.h"
 #include "mdbox-storage-rebuild.h"
@@ -48,6 +50,10 @@ struct mdbox_purge_context {
 
 	struct mdbox_map_atomic_context *atomic;
 	struct mdbox_map_append_context *append_ctx;
+
+	/* mdbox_purge_rate_limit accounting since throttle_start */
+	struct timeval throttle_start;
+	uoff_t throttle_bytes;
 };
 
 static int mdbox_map_file_msg_offset_cmp(const struct mdbox_map_file_msg *m1,
@@ -183,6 +189,26 @@ mdbox_purge_want_altpath(struct mdbox_purge_context *ctx,
 	return action == MDBOX_MSG_ACTION_MOVE_TO_ALT;
 }
 
+static void
+mdbox_purge_throttle(struct mdbox_purge_context *ctx, uoff_t bytes)
+{
+	uoff_t rate_limit = ctx->storage->set->mdbox_purge_rate_limit;
+	struct timeval now;
+	long long elapsed_usecs, wanted_usecs;
+
+	if (rate_limit == 0)
+		return;
+
+	/* The map isn't locked while messages are being copied, so sleeping
+	   here only delays this purge. */
+	ctx->throttle_bytes += bytes;
+	i_gettimeofday(&now);
+	elapsed_usecs = timeval_diff_usecs(&now, &ctx->throttle_start);
+	wanted_usecs = (long long)(ctx->throttle_bytes * 1000000 / rate_limit);
+	if (wanted_usecs > elapsed_usecs)
+		i_sleep_usecs(wanted_usecs - elapsed_usecs);
+}
+
 static int
 mdbox_purge_save_msg(struct mdbox_purge_context *ctx, struct dbox_file *file,
 		     const struct mdbox_map_file_msg *msg)
@@ -223,6 +249,7 @@ mdbox_purge_save_msg(struct mdbox_purge_context *ctx, struct dbox_file *file,
 	} else {
 		ret = 1;
 	}
+	mdbox_purge_throttle(ctx, input->v_offset);
 	i_stream_unref(&input);
 
 	if (ret > 0) {
@@ -276,14 +303,20 @@ mdbox_purge_attachments(struct mdbox_purge_context *ctx,
 {
 	struct dbox_storage *storage = &ctx->storage->storage;
 	const struct mail_attachment_extref *extref;
-	int ret = 0;
+	ARRAY_TYPE(const_string) paths;
+	const char *const *names;
+	unsigned int count;
+	int ret;
 
-	array_foreach(extrefs_arr, extref) {
-		if (index_attachment_delete(&storage->storage,
-					    storage->attachment_fs,
-					    extref->path) < 0)
-			ret = -1;
-	}
+	T_BEGIN {
+		t_array_init(&paths, array_count(extrefs_arr));
+		array_foreach(extrefs_arr, extref)
+			array_push_back(&paths, &extref->path);
+		names = array_get(&paths, &count);
+		ret = index_attachment_delete_multi(&storage->storage,
+						    storage->attachment_fs,
+						    names, count);
+	} T_END;
 	return ret;
 }
 
@@ -477,6 +510,7 @@ mdbox_purge_alloc(struct mdbox_storage *storage)
 	i_array_init(&ctx->primary_file_ids, 64);
 	i_array_init(&ctx->purge_file_ids, 64);
 	hash_table_create_direct(&ctx->altmoves, pool, 0);
+	i_gettimeofday(&ctx->throttle_start);
 	return ctx;
 }
 
@@ -15,6 +15,9 @@ static const struct setting_define mdbox_setting_defines[] = {
 	DEF(BOOL, mdbox_preallocate_space),
 	DEF(SIZE, mdbox_rotate_size),
 	DEF(TIME, mdbox_rotate_interval),
+	DEF(SIZE, mdbox_purge_rate_limit),
+	DEF(SIZE, mdbox_map_rewrite_min_log_bytes),
+	DEF(SIZE, mdbox_map_rewrite_max_log_bytes),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -22,7 +25,10 @@ static const struct setting_define mdbox_setting_defines[] = {
 static const struct mdbox_settings mdbox_default_settings = {
 	.mdbox_preallocate_space = FALSE,
 	.mdbox_rotate_size = 10*1024*1024,
-	.mdbox_rotate_interval = 0
+	.mdbox_rotate_interval = 0,
+	.mdbox_purge_rate_limit = 0,
+	.mdbox_map_rewrite_min_log_bytes = 0,
+	.mdbox_map_rewrite_max_log_bytes = 0
 };
 
 static const struct setting_parser_info mdbox_setting_parser_info = {
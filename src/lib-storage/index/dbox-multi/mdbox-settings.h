@@ -5,6 +5,9 @@ struct mdbox_settings {
 	bool mdbox_preallocate_space;
 	uoff_t mdbox_rotate_size;
 	unsigned int mdbox_rotate_interval;
+	uoff_t mdbox_purge_rate_limit;
+	uoff_t mdbox_map_rewrite_min_log_bytes;
+	uoff_t mdbox_map_rewrite_max_log_bytes;
 };
 
 const struct setting_parser_info *mdbox_get_setting_parser_info(void);
@@ -149,7 +149,7 @@ struct mail_vfuncs sdbox_mail_vfuncs = {
 	index_mail_set_seq,
 	index_mail_set_uid,
 	index_mail_set_uid_cache_updates,
-	index_mail_prefetch,
+	dbox_mail_prefetch,
 	index_mail_precache,
 	index_mail_add_temp_wanted_fields,
 
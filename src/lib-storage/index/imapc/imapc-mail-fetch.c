@@ -139,8 +139,38 @@ headers_merge(pool_t pool, const char *const *h1, const char *const *h2)
 	return array_front(&headers);
 }
 
+static void
+imapc_fetch_cmd_append_uid(string_t *cmd, size_t set_start, size_t set_end,
+			   uint32_t uid)
+{
+	const char *set = str_c(cmd);
+	size_t last_start = set_end, last_uid_start;
+	const char *colon;
+	uint32_t last_uid;
+
+	/* find the last element of the UID set */
+	while (last_start > set_start && set[last_start-1] != ',')
+		last_start--;
+	colon = memchr(set + last_start, ':', set_end - last_start);
+	last_uid_start = colon == NULL ? last_start : (size_t)(colon - set) + 1;
+
+	if (str_to_uint32(t_strndup(set + last_uid_start,
+				    set_end - last_uid_start), &last_uid) < 0 ||
+	    uid != last_uid + 1) {
+		str_insert(cmd, set_end, t_strdup_printf(",%u", uid));
+	} else if (colon == NULL) {
+		/* N -> N:uid */
+		str_insert(cmd, set_end, t_strdup_printf(":%u", uid));
+	} else {
+		/* N:M -> N:uid */
+		str_delete(cmd, last_uid_start, set_end - last_uid_start);
+		str_insert(cmd, last_uid_start, dec2str(uid));
+	}
+}
+
 static bool
-imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str)
+imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str,
+			   uint32_t uid)
 {
 	const char *s1 = str_c(str);
 	const char *s2 = str_c(mbox->pending_fetch_cmd);
@@ -157,10 +187,11 @@ imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str)
 
 	if (null_strcmp(p1, p2) != 0)
 		return FALSE;
-	/* append the new UID to the pending FETCH UID range */
-	str_truncate(str, p1-s1);
-	str_insert(mbox->pending_fetch_cmd, p2-s2, ",");
-	str_insert(mbox->pending_fetch_cmd, p2-s2+1, str_c(str) + 10);
+	/* append the new UID to the pending FETCH UID set. consecutive UIDs
+	   are merged into ranges, so the command stays short even with a
+	   large mail_prefetch_count. */
+	imapc_fetch_cmd_append_uid(mbox->pending_fetch_cmd, s2_args - s2,
+				   p2 - s2, uid);
 	return TRUE;
 }
 
@@ -170,7 +201,8 @@ imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, string_t *str)
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(mail->imail.mail.mail.box);
 
 	if (mbox->pending_fetch_request != NULL &&
-	    !imapc_mail_try_merge_fetch(mbox, str)) {
+	    !imapc_mail_try_merge_fetch(mbox, str,
+					mail->imail.mail.mail.uid)) {
 		/* send the previous FETCH and create a new one */
 		imapc_mail_fetch_flush(mbox);
 	}
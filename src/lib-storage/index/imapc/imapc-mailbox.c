@@ -177,6 +177,46 @@ imapc_mailbox_index_expunge(struct imapc_mailbox *mbox, uint32_t uid)
 	}
 }
 
+static bool
+imapc_mailbox_read_state_header(struct imapc_mailbox *mbox,
+				struct mail_index_view *view,
+				struct imapc_index_header *hdr_r)
+{
+	const void *data;
+	size_t data_size;
+
+	i_zero(hdr_r);
+	mail_index_get_header_ext(view, mbox->hdr_ext_id, &data, &data_size);
+	if (data_size < sizeof(*hdr_r))
+		return FALSE;
+	memcpy(hdr_r, data, sizeof(*hdr_r));
+	return TRUE;
+}
+
+static void imapc_mailbox_update_state_header(struct imapc_mailbox *mbox)
+{
+	struct imapc_index_header hdr, old_hdr;
+
+	if (!imapc_mailbox_has_modseqs(mbox) ||
+	    mail_index_is_in_memory(mbox->box.index) ||
+	    mbox->sync_highestmodseq == 0)
+		return;
+
+	i_zero(&hdr);
+	hdr.uid_validity = mbox->sync_uid_validity;
+	hdr.highest_modseq = mbox->sync_highestmodseq;
+
+	imapc_mailbox_init_delayed_trans(mbox);
+	if (!imapc_mailbox_read_state_header(mbox, mbox->delayed_sync_view,
+					     &old_hdr)) {
+		mail_index_ext_resize_hdr(mbox->delayed_sync_trans,
+					  mbox->hdr_ext_id, sizeof(hdr));
+	} else if (memcmp(&old_hdr, &hdr, sizeof(hdr)) == 0)
+		return;
+	mail_index_update_header_ext(mbox->delayed_sync_trans,
+				     mbox->hdr_ext_id, 0, &hdr, sizeof(hdr));
+}
+
 static void
 imapc_mailbox_fetch_state_finish(struct imapc_mailbox *mbox)
 {
@@ -212,14 +252,24 @@ imapc_mailbox_fetch_state_callback(const struct imapc_command_reply *reply,
 				   void *context)
 {
 	struct imapc_mailbox *mbox = context;
+	bool full_state = mbox->state_fetching_uid1 ||
+		mbox->state_fetching_changes;
 
+	if (mbox->state_fetching_changes &&
+	    reply->state != IMAPC_COMMAND_STATE_OK) {
+		/* the flags in local index may be stale */
+		mbox->state_fetched_success = FALSE;
+	}
 	mbox->state_fetching_uid1 = FALSE;
+	mbox->state_fetching_changes = FALSE;
 	mbox->delayed_untagged_exists = FALSE;
 	imapc_client_stop(mbox->storage->client->client);
 
 	switch (reply->state) {
 	case IMAPC_COMMAND_STATE_OK:
 		imapc_mailbox_fetch_state_finish(mbox);
+		if (full_state)
+			imapc_mailbox_update_state_header(mbox);
 		break;
 	case IMAPC_COMMAND_STATE_NO:
 		imapc_copy_error_from_reply(mbox->storage, MAIL_ERROR_PARAMS, reply);
@@ -235,6 +285,73 @@ imapc_mailbox_fetch_state_callback(const struct imapc_command_reply *reply,
 	}
 }
 
+static bool imapc_mailbox_fetch_changes(struct imapc_mailbox *mbox)
+{
+	struct imapc_msgmap *msgmap =
+		imapc_client_mailbox_get_msgmap(mbox->client_box);
+	struct imapc_index_header ihdr;
+	struct mail_index_view *view;
+	const struct mail_index_header *hdr;
+	struct imapc_command *cmd;
+	uint32_t lseq, uid, count;
+	uint64_t modseq;
+
+	if (!imapc_mailbox_has_modseqs(mbox) ||
+	    IMAPC_BOX_HAS_FEATURE(mbox, IMAPC_FEATURE_GMAIL_MIGRATION) ||
+	    mail_index_is_in_memory(mbox->box.index) ||
+	    mbox->sync_fetch_first_uid == 1 ||
+	    mbox->sync_highestmodseq == 0 ||
+	    array_count(&mbox->delayed_expunged_uids) > 0 ||
+	    imapc_msgmap_count(msgmap) != 0)
+		return FALSE;
+
+	imapc_mailbox_init_delayed_trans(mbox);
+	view = mbox->delayed_sync_view;
+	if (!imapc_mailbox_read_state_header(mbox, view, &ihdr) ||
+	    ihdr.uid_validity != mbox->sync_uid_validity ||
+	    ihdr.highest_modseq == 0 ||
+	    ihdr.highest_modseq > mbox->sync_highestmodseq)
+		return FALSE;
+
+	/* If the message count and UIDNEXT are unchanged, nothing has been
+	   expunged or appended since the index was last in sync. The
+	   sequence to UID mapping can then be built from the index. */
+	hdr = mail_index_get_header(view);
+	count = mail_index_view_get_messages_count(view);
+	if (hdr->next_uid != mbox->sync_uid_next ||
+	    count != mbox->exists_count)
+		return FALSE;
+	for (lseq = 1; lseq <= count; lseq++) {
+		if (mail_index_is_expunged(view, lseq)) {
+			imapc_msgmap_reset(msgmap);
+			return FALSE;
+		}
+		mail_index_lookup_uid(view, lseq, &uid);
+		imapc_msgmap_append(msgmap, lseq, uid);
+		if (array_is_created(&mbox->rseq_modseqs)) {
+			modseq = mail_index_modseq_lookup(view, lseq);
+			array_idx_set(&mbox->rseq_modseqs, lseq-1, &modseq);
+		}
+	}
+	mbox->sync_next_lseq = 0;
+	mbox->sync_next_rseq = 0;
+	mbox->state_fetched_success = TRUE;
+
+	if (ihdr.highest_modseq == mbox->sync_highestmodseq) {
+		/* no flag changes either */
+		return TRUE;
+	}
+
+	mail_index_modseq_enable(mbox->box.index);
+	cmd = imapc_client_mailbox_cmd(mbox->client_box,
+		imapc_mailbox_fetch_state_callback, mbox);
+	mbox->state_fetching_changes = TRUE;
+	imapc_command_send(cmd, t_strdup_printf(
+		"UID FETCH 1:* (FLAGS MODSEQ) (CHANGEDSINCE %"PRIu64")",
+		ihdr.highest_modseq));
+	return TRUE;
+}
+
 void imap_mailbox_select_finish(struct imapc_mailbox *mbox)
 {
 	if (mbox->exists_count == 0) {
@@ -242,6 +359,10 @@ void imap_mailbox_select_finish(struct imapc_mailbox *mbox)
 		mbox->sync_next_lseq = 1;
 		imapc_mailbox_init_delayed_trans(mbox);
 		imapc_mailbox_fetch_state_finish(mbox);
+		imapc_mailbox_update_state_header(mbox);
+	} else if (imapc_mailbox_fetch_changes(mbox)) {
+		/* The local index already has all the messages. Only the
+		   changed flags (if any) are being fetched. */
 	} else {
 		/* We don't know the latest flags, refresh them. */
 		(void)imapc_mailbox_fetch_state(mbox, 1);
@@ -160,7 +160,7 @@ void imapc_mailbox_run_nofetch(struct imapc_mailbox *mbox)
 	do {
 		imapc_client_run(mbox->storage->client->client);
 	} while (mbox->storage->reopen_count > 0 ||
-		 mbox->state_fetching_uid1);
+		 mbox->state_fetching_uid1 || mbox->state_fetching_changes);
 }
 
 void imapc_simple_callback(const struct imapc_command_reply *reply,
@@ -804,7 +804,8 @@ int imapc_mailbox_select(struct imapc_mailbox *mbox)
 			imapc_mailbox_get_remote_name(mbox));
 	}
 
-	while (ctx.ret == -2 || mbox->state_fetching_uid1)
+	while (ctx.ret == -2 || mbox->state_fetching_uid1 ||
+	       mbox->state_fetching_changes)
 		imapc_mailbox_run(mbox);
 	if (!mbox->state_fetched_success)
 		ctx.ret = -1;
@@ -817,6 +818,9 @@ static int imapc_mailbox_open(struct mailbox *box)
 
 	if (index_storage_mailbox_open(box, FALSE) < 0)
 		return -1;
+	mbox->hdr_ext_id =
+		mail_index_ext_register(box->index, "imapc",
+					sizeof(struct imapc_index_header), 0, 0);
 
 	if (box->deleting || (box->flags & MAILBOX_FLAG_SAVEONLY) != 0) {
 		/* We don't actually want to SELECT the mailbox. */
@@ -45,6 +45,15 @@ struct imapc_mailbox_event_callback {
 #define IMAPC_MAILBOX_IS_FULLY_SELECTED(mbox) \
 	((mbox)->sync_uid_validity != 0)
 
+/* "imapc" index header extension. Remembers the remote HIGHESTMODSEQ that
+   the local index was last fully in sync with, so reopening the mailbox can
+   fetch only the changes with CHANGEDSINCE instead of FETCH 1:* (FLAGS). */
+struct imapc_index_header {
+	uint32_t uid_validity;
+	uint32_t unused_padding;
+	uint64_t highest_modseq;
+};
+
 struct imapc_namespace {
 	const char *prefix;
 	char separator;
@@ -167,6 +176,7 @@ struct imapc_mailbox {
 	uint32_t sync_next_rseq;
 	uint32_t exists_count;
 	uint32_t min_append_uid;
+	uint32_t hdr_ext_id;
 	char *sync_gmail_pop3_search_tag;
 
 	/* keep the previous fetched message body cached,
@@ -185,6 +195,7 @@ struct imapc_mailbox {
 	bool selected:1;
 	bool exists_received:1;
 	bool state_fetching_uid1:1;
+	bool state_fetching_changes:1;
 	bool state_fetched_success:1;
 	bool rollback_pending:1;
 	bool delayed_untagged_exists:1;
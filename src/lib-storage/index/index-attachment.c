@@ -294,6 +294,53 @@ int index_attachment_delete(struct mail_storage *storage,
 	return ret;
 }
 
+/* Max number of attachments to delete with a single fs_delete_multi() */
+#define INDEX_ATTACHMENT_DELETE_BATCH_SIZE 1000
+
+static int
+index_attachment_delete_batch(struct mail_storage *storage, struct fs *fs,
+			      const char *const names[], unsigned int count)
+{
+	struct fs_file **files;
+	const char *attachment_dir = index_attachment_dir_get(storage);
+	unsigned int i;
+	int *errors, ret;
+
+	files = t_new(struct fs_file *, count);
+	errors = t_new(int, count);
+	for (i = 0; i < count; i++) {
+		files[i] = fs_file_init(fs,
+			t_strdup_printf("%s/%s", attachment_dir, names[i]),
+			FS_OPEN_MODE_READONLY | FS_OPEN_FLAG_ASYNC);
+	}
+	ret = fs_delete_multi(files, count, errors);
+	for (i = 0; i < count; i++) {
+		if (errors[i] != 0) {
+			mail_storage_set_critical(storage, "%s",
+				fs_file_last_error(files[i]));
+		}
+		fs_file_deinit(&files[i]);
+	}
+	return ret;
+}
+
+int index_attachment_delete_multi(struct mail_storage *storage, struct fs *fs,
+				  const char *const names[], unsigned int count)
+{
+	unsigned int i, n;
+	int ret = 0;
+
+	for (i = 0; i < count; i += n) {
+		n = I_MIN(count - i, INDEX_ATTACHMENT_DELETE_BATCH_SIZE);
+		T_BEGIN {
+			if (index_attachment_delete_batch(storage, fs,
+							  names + i, n) < 0)
+				ret = -1;
+		} T_END;
+	}
+	return ret;
+}
+
 void index_attachment_append_extrefs(string_t *str,
 	const ARRAY_TYPE(mail_attachment_extref) *extrefs)
 {
@@ -398,7 +445,8 @@ bool index_attachment_parse_extrefs(const char *line, pool_t pool,
 int index_attachment_stream_get(struct fs *fs, const char *attachment_dir,
 				const char *path_suffix,
 				struct istream **stream, uoff_t full_size,
-				const char *ext_refs, const char **error_r)
+				const char *ext_refs, bool prefetch,
+				const char **error_r)
 {
 	ARRAY_TYPE(mail_attachment_extref) extrefs_arr;
 	const struct mail_attachment_extref *extref;
@@ -433,6 +481,8 @@ int index_attachment_stream_get(struct fs *fs, const char *attachment_dir,
 			raw_size = extref->size;
 		}
 		fs_set_metadata(file, FS_METADATA_FILE_SIZE, t_strdup_printf("%"PRIuUOFF_T, raw_size));
+		if (prefetch)
+			(void)fs_prefetch(file, raw_size);
 		input = i_stream_create_fs_file(&file, IO_BLOCK_SIZE);
 
 		ret = istream_attachment_connector_add(conn, input,
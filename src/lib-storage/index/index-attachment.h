@@ -36,6 +36,10 @@ index_attachment_save_get_extrefs(struct mail_save_context *ctx);
    (name is same as mail_attachment_extref.name). */
 int index_attachment_delete(struct mail_storage *storage,
 			    struct fs *fs, const char *name);
+/* Delete multiple attachments as a batch. Returns 0 if all were deleted,
+   -1 if any of them failed. */
+int index_attachment_delete_multi(struct mail_storage *storage, struct fs *fs,
+				  const char *const names[], unsigned int count);
 
 void index_attachment_append_extrefs(string_t *str,
 	const ARRAY_TYPE(mail_attachment_extref) *extrefs);
@@ -44,9 +48,15 @@ void index_attachment_append_extrefs(string_t *str,
 bool index_attachment_parse_extrefs(const char *line, pool_t pool,
 				    ARRAY_TYPE(mail_attachment_extref) *extrefs);
 
+/* Replace the stream with one that includes all the external attachments.
+   If prefetch is TRUE, the attachments are prefetched via fs_prefetch()
+   immediately, so they can be read concurrently (and ahead of time if the
+   stream is opened while prefetching the mail) instead of one by one as
+   the stream reaches them. */
 int index_attachment_stream_get(struct fs *fs, const char *attachment_dir,
 				const char *path_suffix,
 				struct istream **stream, uoff_t full_size,
-				const char *ext_refs, const char **error_r);
+				const char *ext_refs, bool prefetch,
+				const char **error_r);
 
 #endif
@@ -7,9 +7,13 @@
 
 struct index_storage_attribute_iter {
 	struct mailbox_attribute_iter iter;
+	struct dict *dict;
 	struct dict_iterate_context *diter;
 	char *prefix;
 	size_t prefix_len;
+	/* The last iterated dict key and its value. These are valid until
+	   the next dict_iterate() call. */
+	const char *last_key, *last_value;
 	bool dict_disabled;
 };
 
@@ -212,6 +216,7 @@ int index_storage_attribute_set(struct mailbox_transaction_context *t,
 				const struct mail_attribute_value *value)
 {
 	enum mail_attribute_type type = type_flags & MAIL_ATTRIBUTE_TYPE_MASK;
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(t->box);
 	struct dict_transaction_context *dtrans;
 	const char *mailbox_prefix;
 	bool pvt = type == MAIL_ATTRIBUTE_TYPE_PRIVATE;
@@ -221,6 +226,8 @@ int index_storage_attribute_set(struct mailbox_transaction_context *t,
 	if (index_storage_attribute_get_dict_trans(t, type_flags, &dtrans,
 						   &mailbox_prefix) < 0)
 		return -1;
+	/* don't return the iterated value anymore after it's changed */
+	ibox->attr_iter = NULL;
 
 	T_BEGIN {
 		const char *prefixed_key =
@@ -247,19 +254,31 @@ int index_storage_attribute_get(struct mailbox *box,
 				const char *key,
 				struct mail_attribute_value *value_r)
 {
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	struct index_storage_attribute_iter *iter = ibox->attr_iter;
 	struct dict *dict;
-	const char *mailbox_prefix, *error;
+	const char *mailbox_prefix, *prefixed_key, *error;
 	int ret;
 
 	i_zero(value_r);
 
 	if (index_storage_get_dict(box, type_flags, &dict, &mailbox_prefix) < 0)
 		return -1;
+	prefixed_key = key_get_prefixed(type_flags, mailbox_prefix, key);
+
+	if (iter != NULL && iter->dict == dict && iter->last_key != NULL &&
+	    strcmp(iter->last_key, prefixed_key) == 0) {
+		/* The key was just returned by the attribute iteration,
+		   which already looked up its value. This avoids a dict
+		   lookup for each key when all the iterated attributes are
+		   read, e.g. with GETMETADATA DEPTH. */
+		value_r->value = t_strdup(iter->last_value);
+		return 1;
+	}
 
 	struct mail_user *user = mailbox_list_get_user(box->list);
 	const struct dict_op_settings *set = mail_user_get_dict_op_settings(user);
-	ret = dict_lookup(dict, set, pool_datastack_create(),
-			  key_get_prefixed(type_flags, mailbox_prefix, key),
+	ret = dict_lookup(dict, set, pool_datastack_create(), prefixed_key,
 			  &value_r->value, &error);
 	if (ret < 0) {
 		mailbox_set_critical(box,
@@ -289,9 +308,11 @@ index_storage_attribute_iter_init(struct mailbox *box,
 		iter->prefix_len = strlen(iter->prefix);
 		struct mail_user *user = mailbox_list_get_user(box->list);
 		const struct dict_op_settings *set = mail_user_get_dict_op_settings(user);
+		/* Get the values as well, since the callers typically want
+		   to look them up after each iterated key. */
+		iter->dict = dict;
 		iter->diter = dict_iterate_init(dict, set, iter->prefix,
-						DICT_ITERATE_FLAG_RECURSE |
-						DICT_ITERATE_FLAG_NO_VALUE);
+						DICT_ITERATE_FLAG_RECURSE);
 	}
 	return &iter->iter;
 }
@@ -301,23 +322,30 @@ index_storage_attribute_iter_next(struct mailbox_attribute_iter *_iter)
 {
 	struct index_storage_attribute_iter *iter =
 		(struct index_storage_attribute_iter *)_iter;
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(_iter->box);
 	const char *key, *value;
 
+	iter->last_key = NULL;
 	if (iter->diter == NULL || !dict_iterate(iter->diter, &key, &value))
 		return NULL;
 
 	i_assert(strncmp(key, iter->prefix, iter->prefix_len) == 0);
-	key += iter->prefix_len;
-	return key;
+	iter->last_key = key;
+	iter->last_value = value;
+	ibox->attr_iter = iter;
+	return key + iter->prefix_len;
 }
 
 int index_storage_attribute_iter_deinit(struct mailbox_attribute_iter *_iter)
 {
 	struct index_storage_attribute_iter *iter =
 		(struct index_storage_attribute_iter *)_iter;
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(_iter->box);
 	const char *error;
 	int ret;
 
+	if (ibox->attr_iter == iter)
+		ibox->attr_iter = NULL;
 	if (iter->diter == NULL) {
 		ret = iter->dict_disabled ? 0 : -1;
 	} else {
@@ -212,19 +212,13 @@ static int fd_callback(const char **path_r, void *context)
 
 	path = t_str_new(256);
 	mail_user_set_get_temp_prefix(path, _mail->box->storage->user->set);
-	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	/* we just want the fd, so create it unlinked */
+	fd = safe_mkstemp_hostpid_unlinked(path, 0600);
 	if (fd == -1) {
 		e_error(mail_event(_mail),
 			"Temp file creation to %s failed: %m", str_c(path));
 		return -1;
 	}
-
-	/* we just want the fd, unlink it */
-	if (i_unlink(str_c(path)) < 0) {
-		/* shouldn't happen.. */
-		i_close_fd(&fd);
-		return -1;
-	}
 	*path_r = str_c(path);
 	return fd;
 }
@@ -265,8 +259,11 @@ binary_parts_update(struct binary_ctx *ctx, const struct message_part *part,
 			size = blocks[i].input->v_offset;
 			if (blocks[i].converted_hdr)
 				bin_part.binary_hdr_size = size;
-			else
+			else {
 				bin_part.binary_body_size = size;
+				bin_part.binary_body_lines_count =
+					blocks[i].body_lines_count;
+			}
 			found = TRUE;
 		}
 		if (found) {
@@ -369,6 +366,7 @@ index_mail_read_binary_to_cache(struct mail *_mail,
 	struct index_mail *mail = INDEX_MAIL(_mail);
 	struct mail_binary_cache *cache = &_mail->box->storage->binary_cache;
 	struct binary_ctx ctx;
+	const struct binary_block *block;
 	struct istream *is;
 
 	i_zero(&ctx);
@@ -423,6 +421,9 @@ index_mail_read_binary_to_cache(struct mail *_mail,
 
 	i_assert(!i_stream_have_bytes_left(is));
 	cache->size = is->v_offset;
+	cache->lines = 0;
+	array_foreach(&ctx.blocks, block)
+		cache->lines += block->body_lines_count;
 	i_stream_seek(is, 0);
 
 	if (part->parent == NULL && include_hdr &&
@@ -484,12 +485,23 @@ index_mail_get_binary_size(struct mail *_mail,
 			   uoff_t *size_r, unsigned int *lines_r)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
+	struct mail_binary_cache *cache = &_mail->box->storage->binary_cache;
 	struct message_part *all_parts, *msg_part;
 	const struct message_binary_part *bin_part, *root_bin_part;
 	uoff_t size, end_offset;
 	unsigned int lines;
 	bool binary, converted;
 
+	if (cache->box == _mail->box && cache->uid == _mail->uid &&
+	    cache->orig_physical_pos == part->physical_pos &&
+	    cache->include_hdr == include_hdr) {
+		/* the part was just decoded for a BINARY fetch - don't
+		   decode the whole message only to get its size */
+		*size_r = cache->size;
+		*lines_r = cache->lines;
+		return 0;
+	}
+
 	if (mail_get_parts(_mail, &all_parts) < 0)
 		return -1;
 
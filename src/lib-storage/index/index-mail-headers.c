@@ -389,6 +389,8 @@ struct istream *
 index_mail_cache_parse_init(struct mail *_mail, struct istream *input)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
+	const unsigned int cache_field_envelope =
+		mail->ibox->cache_fields[MAIL_CACHE_IMAP_ENVELOPE].idx;
 	struct istream *input2;
 
 	i_assert(mail->data.tee_stream == NULL);
@@ -403,6 +405,11 @@ index_mail_cache_parse_init(struct mail *_mail, struct istream *input)
 	   not as cheap as the others to generate. */
 	if (index_mail_want_cache(mail, MAIL_CACHE_BODY_SNIPPET))
 		mail->data.save_body_snippet = TRUE;
+	/* Envelope is generated from the same header parsing, so do it now
+	   if the cache wants it instead of reading the header again later. */
+	if (mail_cache_field_want_add(_mail->transaction->cache_trans,
+				      _mail->seq, cache_field_envelope))
+		mail->data.save_envelope = TRUE;
 
 	mail->data.tee_stream = tee_i_stream_create(input);
 	input = tee_i_stream_create_child(mail->data.tee_stream);
@@ -654,6 +661,20 @@ index_mail_get_parsed_header(struct index_mail *mail, unsigned int field_idx)
 	return array_front(&header_values);
 }
 
+static int
+index_mail_cache_lookup_headers(struct mail *_mail, string_t *dest,
+				const unsigned int field_idxs[],
+				unsigned int fields_count)
+{
+	int ret;
+
+	mail_storage_timing_start(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+	ret = mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
+					_mail->seq, field_idxs, fields_count);
+	mail_storage_timing_end(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+	return ret;
+}
+
 static int
 index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 			   const char *const **value_r)
@@ -673,8 +694,7 @@ index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 	field_idx = get_header_field_idx(_mail->box, field);
 
 	dest = str_new(mail->mail.data_pool, 128);
-	if (mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
-				      _mail->seq, &field_idx, 1) <= 0) {
+	if (index_mail_cache_lookup_headers(_mail, dest, &field_idx, 1) <= 0) {
 		/* not in cache / error - first see if it's already parsed */
 		p_free(mail->mail.data_pool, dest);
 		if (mail->data.header_parser_initialized) {
@@ -948,9 +968,8 @@ int index_mail_get_header_stream(struct mail *_mail,
 	}
 
 	dest = str_new(mail->mail.data_pool, 256);
-	if (mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
-				      _mail->seq, headers->idx,
-				      headers->count) > 0) {
+	if (index_mail_cache_lookup_headers(_mail, dest, headers->idx,
+					    headers->count) > 0) {
 		str_append(dest, "\n");
 		_mail->transaction->stats.cache_hit_count++;
 		mail->data.filter_stream =
@@ -80,14 +80,100 @@ struct mail_cache_field *index_mail_global_cache_fields_dup(void)
 	return i_memdup(global_cache_fields, sizeof(global_cache_fields));
 }
 
+static const struct {
+	enum mail_fetch_field fetch_field;
+	enum index_cache_field cache_field;
+} index_mail_prefetch_cache_fields[] = {
+	{ MAIL_FETCH_DATE, MAIL_CACHE_SENT_DATE },
+	{ MAIL_FETCH_RECEIVED_DATE, MAIL_CACHE_RECEIVED_DATE },
+	{ MAIL_FETCH_SAVE_DATE, MAIL_CACHE_SAVE_DATE },
+	{ MAIL_FETCH_VIRTUAL_SIZE, MAIL_CACHE_VIRTUAL_FULL_SIZE },
+	{ MAIL_FETCH_PHYSICAL_SIZE, MAIL_CACHE_PHYSICAL_FULL_SIZE },
+};
+
+static void index_mail_cache_prefetch_free(struct index_mail *mail)
+{
+	if (array_is_created(&mail->cache_prefetch))
+		array_free(&mail->cache_prefetch);
+	pool_unref(&mail->cache_prefetch_pool);
+}
+
+void index_mail_prefetch_cache_range(struct mail *_mail,
+				     const ARRAY_TYPE(seq_range) *seqs)
+{
+	struct index_mail *mail = INDEX_MAIL(_mail);
+	unsigned int i, count = 0;
+	unsigned int field_idxs[N_ELEMENTS(index_mail_prefetch_cache_fields)];
+	int ret;
+
+	index_mail_cache_prefetch_free(mail);
+	for (i = 0; i < N_ELEMENTS(index_mail_prefetch_cache_fields); i++) {
+		if ((mail->mail.wanted_fields &
+		     index_mail_prefetch_cache_fields[i].fetch_field) != 0) {
+			field_idxs[count++] = mail->ibox->cache_fields[
+				index_mail_prefetch_cache_fields[i].cache_field].idx;
+		}
+	}
+	if (count == 0 || array_is_empty(seqs))
+		return;
+
+	mail->cache_prefetch_pool =
+		pool_alloconly_create("index mail cache prefetch", 1024);
+	i_array_init(&mail->cache_prefetch, 128);
+	mail_storage_timing_start(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+	ret = mail_cache_lookup_fields_range(_mail->transaction->cache_view,
+					     seqs, field_idxs, count,
+					     mail->cache_prefetch_pool,
+					     &mail->cache_prefetch);
+	mail_storage_timing_end(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+	if (ret < 0) {
+		/* the lookups will be done (and fail) one mail at a time */
+		index_mail_cache_prefetch_free(mail);
+	}
+}
+
+static bool
+index_mail_cache_prefetch_lookup(struct index_mail *mail, buffer_t *buf,
+				 unsigned int field_idx)
+{
+	const struct mail_cache_range_field *fields;
+	unsigned int idx, left_idx, right_idx, count;
+	uint32_t seq = mail->mail.mail.seq;
+
+	fields = array_get(&mail->cache_prefetch, &count);
+	left_idx = 0;
+	right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (fields[idx].seq < seq)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	for (idx = left_idx; idx < count && fields[idx].seq == seq; idx++) {
+		if (fields[idx].field_idx == field_idx) {
+			buffer_append(buf, fields[idx].data, fields[idx].size);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 				  unsigned int field_idx)
 {
 	struct mail *_mail = &mail->mail.mail;
 	int ret;
 
-	ret = mail_cache_lookup_field(mail->mail.mail.transaction->cache_view,
-				      buf, mail->mail.mail.seq, field_idx);
+	if (array_is_created(&mail->cache_prefetch) &&
+	    index_mail_cache_prefetch_lookup(mail, buf, field_idx))
+		ret = 1;
+	else {
+		mail_storage_timing_start(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+		ret = mail_cache_lookup_field(_mail->transaction->cache_view,
+					      buf, _mail->seq, field_idx);
+		mail_storage_timing_end(MAIL_STORAGE_TIMING_CACHE_LOOKUP);
+	}
 	if (ret > 0)
 		mail->mail.mail.transaction->stats.cache_hit_count++;
 
@@ -1134,7 +1220,9 @@ static int index_mail_write_body_snippet(struct index_mail *mail)
 	string_t *str;
 	int ret;
 
-	i_assert(mail->data.parsed_bodystructure);
+	/* the parts come either from parsing the message or from the cached
+	   BODYSTRUCTURE */
+	i_assert(mail->data.parts != NULL && mail->data.parts->data != NULL);
 
 	part = index_mail_find_first_text_mime_part(mail->data.parts);
 	if (part == NULL) {
@@ -1377,7 +1465,8 @@ int index_mail_init_stream(struct index_mail *mail,
 	i_assert(_mail->mail_stream_accessed);
 
 	if (!data->initialized_wrapper_stream &&
-	    _mail->transaction->stats_track) {
+	    (_mail->transaction->stats_track ||
+	     mail_storage_timing_is_enabled())) {
 		input = i_stream_create_mail(_mail, data->stream,
 					     !data->stream_has_only_header);
 		i_stream_unref(&data->stream);
@@ -1598,6 +1687,31 @@ index_mail_get_plain_bodystructure(struct index_mail *mail, string_t *str,
 		str_append(str, " NIL NIL NIL NIL");
 }
 
+static int index_mail_write_body_snippet_from_cache(struct index_mail *mail)
+{
+	const char *bodystructure, *error;
+
+	/* With both the MIME parts and BODYSTRUCTURE cached, the text part
+	   can be found without parsing the whole message. Only that part
+	   then needs to be read, instead of e.g. all the attachments. */
+	if (!get_cached_parts(mail) ||
+	    !index_mail_get_cached_bodystructure(mail, &bodystructure))
+		return 0;
+	if (mail->data.parts->data == NULL &&
+	    imap_bodystructure_parse(bodystructure, mail->mail.data_pool,
+				     mail->data.parts, &error) < 0) {
+		/* broken, fallback to parsing the message */
+		mail_set_cache_corrupted(&mail->mail.mail,
+			MAIL_FETCH_IMAP_BODYSTRUCTURE, t_strdup_printf(
+			"Invalid BODYSTRUCTURE %s: %s", bodystructure, error));
+		return 0;
+	}
+	if (index_mail_write_body_snippet(mail) < 0)
+		return -1;
+	i_assert(mail->data.body_snippet != NULL);
+	return 1;
+}
+
 static int
 index_mail_fetch_body_snippet(struct index_mail *mail, const char **value_r)
 {
@@ -1605,6 +1719,7 @@ index_mail_fetch_body_snippet(struct index_mail *mail, const char **value_r)
 	const unsigned int cache_field =
 		cache_fields[MAIL_CACHE_BODY_SNIPPET].idx;
 	string_t *str;
+	int ret;
 
 	mail->data.cache_fetch_fields |= MAIL_FETCH_BODY_SNIPPET;
 	if (mail->data.body_snippet == NULL) {
@@ -1618,6 +1733,16 @@ index_mail_fetch_body_snippet(struct index_mail *mail, const char **value_r)
 		return 0;
 	}
 
+	if ((ret = index_mail_write_body_snippet_from_cache(mail)) < 0)
+		return -1;
+	if (ret > 0) {
+		index_mail_cache_add_if_wanted(mail, MAIL_CACHE_BODY_SNIPPET,
+					       mail->data.body_snippet,
+					       strlen(mail->data.body_snippet));
+		*value_r = mail->data.body_snippet;
+		return 0;
+	}
+
 	/* reuse the IMAP bodystructure parsing code to get all the useful
 	   headers that we need. */
 	mail->data.save_body_snippet = TRUE;
@@ -1969,6 +2094,41 @@ static void check_envelope(struct index_mail *mail)
 	mail->data.save_envelope = TRUE;
 }
 
+static void index_mail_update_access_parts_piggyback(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mail_data *data = &mail->data;
+	const unsigned int cache_field_envelope =
+		mail->ibox->cache_fields[MAIL_CACHE_IMAP_ENVELOPE].idx;
+
+	/* The message is going to be parsed anyway. Generate also the other
+	   fields the cache wants from the same parsing pass, so fetching
+	   them later doesn't need to read the message again. */
+	if ((data->access_part & PARSE_HDR) == 0)
+		return;
+
+	if (!data->save_envelope && data->envelope == NULL &&
+	    mail_cache_field_want_add(_mail->transaction->cache_trans,
+				      _mail->seq, cache_field_envelope))
+		data->save_envelope = TRUE;
+	if (!data->save_sent_date && data->sent_date.time == (uint32_t)-1 &&
+	    index_mail_want_cache(mail, MAIL_CACHE_SENT_DATE))
+		data->save_sent_date = TRUE;
+
+	if ((data->access_part & PARSE_BODY) == 0)
+		return;
+
+	if (!data->save_bodystructure_body && data->bodystructure == NULL &&
+	    (index_mail_want_cache(mail, MAIL_CACHE_IMAP_BODYSTRUCTURE) ||
+	     index_mail_want_cache(mail, MAIL_CACHE_IMAP_BODY))) {
+		data->save_bodystructure_header = TRUE;
+		data->save_bodystructure_body = TRUE;
+	}
+	if (!data->save_body_snippet && data->body_snippet == NULL &&
+	    index_mail_want_cache(mail, MAIL_CACHE_BODY_SNIPPET))
+		data->save_body_snippet = TRUE;
+}
+
 void index_mail_update_access_parts_pre(struct mail *_mail)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
@@ -2097,6 +2257,8 @@ void index_mail_update_access_parts_pre(struct mail *_mail)
 			data->access_part |= READ_BODY;
 	}
 
+	index_mail_update_access_parts_piggyback(mail);
+
 	/* NOTE: Keep this attachment detection the last, so that the
 	   access_part check works correctly.
 
@@ -2303,6 +2465,7 @@ void index_mail_free(struct mail *_mail)
 	i_assert(_mail->transaction->mail_ref_count > 0);
 	_mail->transaction->mail_ref_count--;
 
+	index_mail_cache_prefetch_free(mail);
 	buffer_free(&mail->header_data);
 	if (array_is_created(&mail->header_lines))
 		array_free(&mail->header_lines);
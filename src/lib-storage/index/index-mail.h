@@ -155,6 +155,11 @@ struct index_mail {
 	ARRAY(unsigned int) header_match_lines;
 	uint8_t header_match_value;
 
+	/* Cache fields prefetched by index_mail_prefetch_cache_range(),
+	   sorted by seq. Allocated from cache_prefetch_pool. */
+	ARRAY_TYPE(mail_cache_range_field) cache_prefetch;
+	pool_t cache_prefetch_pool;
+
 	bool pop3_state_set:1;
 	/* close() is being called from mail_free() */
 	bool freeing:1;
@@ -179,6 +184,11 @@ void index_mail_set_seq(struct mail *mail, uint32_t seq, bool saving);
 bool index_mail_set_uid(struct mail *mail, uint32_t uid);
 void index_mail_set_uid_cache_updates(struct mail *mail, bool set);
 bool index_mail_prefetch(struct mail *mail);
+/* Look up the wanted fixed size cache fields (dates and sizes) for all the
+   given mails at once. The following lookups for them are then done from
+   memory instead of walking through each mail's cache records. */
+void index_mail_prefetch_cache_range(struct mail *mail,
+				     const ARRAY_TYPE(seq_range) *seqs);
 void index_mail_add_temp_wanted_fields(struct mail *mail,
 				       enum mail_fetch_field fields,
 				       struct mailbox_header_lookup_ctx *headers);
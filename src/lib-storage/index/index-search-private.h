@@ -19,6 +19,13 @@ struct index_search_context {
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
 	uint32_t seq1, seq2;
+	/* Messages that can match based on the index columns or a cached
+	   search result, or not created if neither could be used. */
+	ARRAY_TYPE(seq_range) candidate_seqs;
+	unsigned int candidate_seqs_idx;
+	/* Result that is added to the mailbox's search result cache if the
+	   search finishes successfully. */
+	struct mail_search_result *cache_result;
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
@@ -35,6 +42,10 @@ struct index_search_context {
 	bool have_index_args:1;
 	bool have_mailbox_args:1;
 	bool have_nonmatch_always:1;
+	/* candidate_seqs came from a cached search result, so they all
+	   match without evaluating the search args. */
+	bool cache_hit:1;
+	bool finished:1;
 };
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
@@ -179,16 +179,21 @@ int index_search_result_update_appends(struct mail_search_result *result,
 void index_search_results_update_expunges(struct mailbox *box,
 					  const ARRAY_TYPE(seq_range) *expunges)
 {
+	ARRAY_TYPE(seq_range) uids;
 	const struct seq_range *seqs;
 	uint32_t seq, uid;
 
 	if (array_count(&box->search_results) == 0)
 		return;
 
+	/* UIDs are in ascending order, so this only appends */
+	i_array_init(&uids, array_count(expunges));
 	array_foreach(expunges, seqs) {
 		for (seq = seqs->seq1; seq <= seqs->seq2; seq++) {
 			mail_index_lookup_uid(box->view, seq, &uid);
-			mailbox_search_results_remove(box, uid);
+			seq_range_array_add(&uids, uid);
 		}
 	}
+	mailbox_search_results_remove_uids(box, &uids);
+	array_free(&uids);
 }
@@ -42,6 +42,10 @@
    milliseconds, fail the search with MAIL_ERRSTR_INTERRUPTED. */
 #define SEARCH_INTERRUPT_DELAY_MSECS 2000
 
+/* Evaluate flag/keyword searches using the index columns only if there are
+   at least this many messages to search. */
+#define SEARCH_INDEX_COLUMNS_MIN_MESSAGES 256
+
 struct search_header_context {
         struct index_search_context *index_ctx;
         struct index_mail *imail;
@@ -1402,8 +1406,16 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	}
 	if (ctx->thread_ctx != NULL)
 		mail_thread_deinit(&ctx->thread_ctx);
+	if (ctx->cache_result != NULL) {
+		if (ctx->finished && ret == 0)
+			mailbox_search_result_cache_add(ctx->cache_result);
+		else
+			mailbox_search_result_free(&ctx->cache_result);
+	}
 	array_free(&ctx->mail_ctx.results);
 	array_free(&ctx->mail_ctx.module_contexts);
+	if (array_is_created(&ctx->candidate_seqs))
+		array_free(&ctx->candidate_seqs);
 
 	array_foreach_elem(&ctx->mail_ctx.mails, mail) {
 		struct index_mail *imail = INDEX_MAIL(mail);
@@ -1638,6 +1650,12 @@ int index_storage_search_next_match_mail(struct mail_search_context *_ctx,
 	struct index_mail *imail = INDEX_MAIL(mail);
 	int match;
 
+	if (ctx->cache_hit) {
+		/* all messages given by search_next_update_seq() match */
+		index_mail_update_access_parts_pre(mail);
+		return 1;
+	}
+
 	ctx->cur_mail = mail;
 	/* mail's access_type is SEARCH only while using it to process
 	   the search query. afterwards the mail can still be accessed
@@ -1897,8 +1915,10 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 			*tryagain_r = TRUE;
 			return FALSE;
 		}
-		if (ret < 0)
+		if (ret < 0) {
+			ctx->finished = !ctx->failed;
 			return FALSE;
+		}
 		*mail_r = mail;
 		return TRUE;
 	}
@@ -1914,6 +1934,7 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 		}
 		/* finished searching the messages. now sort them and start
 		   returning the messages. */
+		ctx->finished = !ctx->failed;
 		ctx->sorted = TRUE;
 		index_sort_list_finish(_ctx->sort_program);
 	}
@@ -1931,6 +1952,231 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 	return TRUE;
 }
 
+static bool
+search_arg_columns_supported(const struct mail_search_arg *arg,
+			     enum mail_flags unsupported_flags)
+{
+	const struct mail_search_arg *subarg;
+
+	if (arg->match_always || arg->nonmatch_always)
+		return TRUE;
+
+	switch (arg->type) {
+	case SEARCH_OR:
+	case SEARCH_SUB:
+		subarg = arg->value.subargs;
+		for (; subarg != NULL; subarg = subarg->next) {
+			if (!search_arg_columns_supported(subarg,
+							  unsupported_flags))
+				return FALSE;
+		}
+		return TRUE;
+	case SEARCH_FLAGS:
+		return (arg->value.flags & unsupported_flags) == 0;
+	case SEARCH_KEYWORDS:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void
+search_arg_columns_match_keyword(struct index_search_context *ctx,
+				 const struct mail_index_view_columns *columns,
+				 unsigned int keyword_idx,
+				 uint32_t seq1, unsigned int count,
+				 uint8_t *matches)
+{
+	const unsigned char *data;
+	unsigned int i, bit;
+	uint8_t mask;
+
+	if (columns->keywords == NULL ||
+	    !mail_index_view_get_keyword_bit(ctx->view, keyword_idx, &bit) ||
+	    bit / CHAR_BIT >= columns->keywords_size) {
+		/* no messages have the keyword */
+		memset(matches, 0, count);
+		return;
+	}
+
+	mask = 1 << (bit % CHAR_BIT);
+	data = columns->keywords + (seq1-1) * columns->keywords_size +
+		bit / CHAR_BIT;
+	for (i = 0; i < count; i++) {
+		matches[i] &= (data[0] & mask) != 0 ? 1 : 0;
+		data += columns->keywords_size;
+	}
+}
+
+static void
+search_arg_columns_match(struct index_search_context *ctx,
+			 const struct mail_index_view_columns *columns,
+			 const struct mail_search_arg *arg,
+			 uint32_t seq1, unsigned int count, uint8_t *matches)
+{
+	const struct mail_search_arg *subarg;
+	const struct mail_keywords *keywords;
+	const uint8_t *flags;
+	uint8_t *submatches;
+	unsigned int i;
+	uint8_t wanted;
+
+	if (arg->match_always || arg->nonmatch_always) {
+		memset(matches, arg->match_always ? 1 : 0, count);
+		return;
+	}
+
+	switch (arg->type) {
+	case SEARCH_OR:
+	case SEARCH_SUB:
+		memset(matches, arg->type == SEARCH_SUB ? 1 : 0, count);
+		submatches = t_malloc_no0(count);
+		subarg = arg->value.subargs;
+		for (; subarg != NULL; subarg = subarg->next) {
+			search_arg_columns_match(ctx, columns, subarg,
+						 seq1, count, submatches);
+			if (arg->type == SEARCH_SUB) {
+				for (i = 0; i < count; i++)
+					matches[i] &= submatches[i];
+			} else {
+				for (i = 0; i < count; i++)
+					matches[i] |= submatches[i];
+			}
+		}
+		break;
+	case SEARCH_FLAGS:
+		wanted = arg->value.flags;
+		flags = columns->flags + (seq1-1);
+		for (i = 0; i < count; i++)
+			matches[i] = (flags[i] & wanted) == wanted ? 1 : 0;
+		break;
+	case SEARCH_KEYWORDS:
+		keywords = arg->initialized.keywords;
+		/* invalid keyword never matches */
+		memset(matches, keywords->count == 0 ? 0 : 1, count);
+		for (i = 0; i < keywords->count; i++) {
+			search_arg_columns_match_keyword(ctx, columns,
+				keywords->idx[i], seq1, count, matches);
+		}
+		break;
+	default:
+		i_unreached();
+	}
+
+	if (arg->match_not) {
+		for (i = 0; i < count; i++)
+			matches[i] ^= 1;
+	}
+}
+
+static void search_init_index_columns(struct index_search_context *ctx)
+{
+	struct mail_index_view_columns columns;
+	const struct mail_search_arg *arg;
+	enum mail_flags unsupported_flags = MAIL_RECENT;
+	uint8_t *matches, *argmatches;
+	unsigned int i, first, count;
+	bool have_args = FALSE;
+
+	if (ctx->seq1 > ctx->seq2 ||
+	    ctx->seq2 - ctx->seq1 + 1 < SEARCH_INDEX_COLUMNS_MIN_MESSAGES)
+		return;
+	if (ctx->box->view_pvt != NULL)
+		unsupported_flags |= mailbox_get_private_flags_mask(ctx->box);
+
+	/* Only the root level args are ANDed together, so each of them that
+	   is supported can be used to filter out messages that can't match.
+	   The rest of the args are still checked for each message. */
+	arg = ctx->mail_ctx.args->args;
+	for (; arg != NULL; arg = arg->next) {
+		if (arg->type != SEARCH_ALL &&
+		    search_arg_columns_supported(arg, unsupported_flags)) {
+			have_args = TRUE;
+			break;
+		}
+	}
+	if (!have_args || !mail_index_view_get_columns(ctx->view, &columns))
+		return;
+	i_assert(ctx->seq2 <= columns.messages_count);
+
+	count = ctx->seq2 - ctx->seq1 + 1;
+	matches = t_malloc_no0(count);
+	argmatches = t_malloc_no0(count);
+	memset(matches, 1, count);
+	for (arg = ctx->mail_ctx.args->args; arg != NULL; arg = arg->next) {
+		if (!search_arg_columns_supported(arg, unsupported_flags))
+			continue;
+		search_arg_columns_match(ctx, &columns, arg, ctx->seq1, count,
+					 argmatches);
+		for (i = 0; i < count; i++)
+			matches[i] &= argmatches[i];
+	}
+
+	i_array_init(&ctx->candidate_seqs, 64);
+	for (i = 0; i < count; ) {
+		if (matches[i] == 0) {
+			i++;
+			continue;
+		}
+		first = i;
+		while (i < count && matches[i] != 0)
+			i++;
+		seq_range_array_add_range(&ctx->candidate_seqs,
+					  ctx->seq1 + first, ctx->seq1 + i - 1);
+	}
+}
+
+static void search_skip_candidate_nonmatches(struct index_search_context *ctx)
+{
+	const struct seq_range *range;
+	unsigned int count;
+
+	range = array_get(&ctx->candidate_seqs, &count);
+	while (ctx->candidate_seqs_idx < count &&
+	       range[ctx->candidate_seqs_idx].seq2 < ctx->mail_ctx.seq)
+		ctx->candidate_seqs_idx++;
+
+	if (ctx->candidate_seqs_idx == count) {
+		/* no more matches */
+		ctx->mail_ctx.seq = ctx->seq2 + 1;
+	} else if (ctx->mail_ctx.seq < range[ctx->candidate_seqs_idx].seq1)
+		ctx->mail_ctx.seq = range[ctx->candidate_seqs_idx].seq1;
+}
+
+static bool search_init_cached_result(struct index_search_context *ctx)
+{
+	struct mail_search_context *_ctx = &ctx->mail_ctx;
+	struct mail_search_result *result;
+	const struct seq_range *range;
+	uint32_t seq1, seq2;
+
+	if (_ctx->update_result != NULL ||
+	    !mailbox_search_result_cache_want(_ctx->args) ||
+	    mail_index_transaction_has_changes(_ctx->transaction->itrans))
+		return FALSE;
+
+	result = mailbox_search_result_cache_lookup(ctx->box, _ctx->args);
+	if (result == NULL) {
+		/* build the result while searching */
+		ctx->cache_result = mailbox_search_result_save(_ctx,
+			MAILBOX_SEARCH_RESULT_FLAG_UPDATE);
+		return FALSE;
+	}
+
+	/* syncing has kept the result up to date, so the messages in it are
+	   exactly the ones that match. */
+	i_array_init(&ctx->candidate_seqs, 64);
+	array_foreach(&result->uids, range) {
+		if (mail_index_lookup_seq_range(ctx->view, range->seq1,
+						range->seq2, &seq1, &seq2)) {
+			seq_range_array_add_range(&ctx->candidate_seqs,
+						  seq1, seq2);
+		}
+	}
+	ctx->cache_hit = TRUE;
+	return TRUE;
+}
+
 bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 {
         struct index_search_context *ctx = (struct index_search_context *)_ctx;
@@ -1940,10 +2186,20 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 	if (_ctx->seq == 0) {
 		/* first time */
 		_ctx->seq = ctx->seq1;
+		if (!search_init_cached_result(ctx) &&
+		    ctx->have_index_args) T_BEGIN {
+			search_init_index_columns(ctx);
+		} T_END;
 	} else {
 		_ctx->seq++;
 	}
 
+	if (ctx->cache_hit) {
+		search_skip_candidate_nonmatches(ctx);
+		_ctx->progress_cur = _ctx->seq;
+		return _ctx->seq <= ctx->seq2;
+	}
+
 	if (!ctx->have_seqsets && !ctx->have_index_args &&
 	    !ctx->have_nonmatch_always && _ctx->update_result == NULL) {
 		_ctx->progress_cur = _ctx->seq;
@@ -1952,6 +2208,11 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		if (array_is_created(&ctx->candidate_seqs)) {
+			search_skip_candidate_nonmatches(ctx);
+			if (_ctx->seq > ctx->seq2)
+				break;
+		}
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
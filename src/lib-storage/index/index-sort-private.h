@@ -13,6 +13,9 @@ struct mail_search_sort_program {
 			      struct mail *mail);
 	void (*sort_list_finish)(struct mail_search_sort_program *program);
 	void *context;
+	/* Index record extension that stores the primary sort key for
+	   ARRIVAL and DATE sorting. 0 in a record means it's not set yet. */
+	uint32_t date_ext_id;
 
 	ARRAY_TYPE(uint32_t) seqs;
 	unsigned int iter_idx;
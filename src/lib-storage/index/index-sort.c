@@ -8,6 +8,7 @@
 #include "message-header-decode.h"
 #include "imap-base-subject.h"
 #include "index-storage.h"
+#include "index-mail.h"
 #include "index-sort-private.h"
 
 
@@ -71,6 +72,35 @@ index_sort_program_set_date_failed(struct mail_search_sort_program *program,
 	}
 }
 
+static bool
+index_sort_lookup_date_ext(struct mail_search_sort_program *program,
+			   struct mail *mail, time_t *date_r)
+{
+	const void *data;
+	bool expunged;
+
+	mail_index_lookup_ext(program->t->view, mail->seq,
+			      program->date_ext_id, &data, &expunged);
+	if (data == NULL || *(const uint32_t *)data == 0)
+		return FALSE;
+	*date_r = *(const uint32_t *)data;
+	return TRUE;
+}
+
+static void
+index_sort_update_date_ext(struct mail_search_sort_program *program,
+			   struct mail *mail, time_t date)
+{
+	uint32_t date32 = date;
+
+	if (date <= 0 || (time_t)date32 != date) {
+		/* can't be stored. it's looked up again the next time. */
+		return;
+	}
+	mail_index_update_ext(program->t->itrans, mail->seq,
+			      program->date_ext_id, &date32, NULL);
+}
+
 static void
 index_sort_list_add_arrival(struct mail_search_sort_program *program,
 			    struct mail *mail)
@@ -80,8 +110,13 @@ index_sort_list_add_arrival(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
+	if (index_sort_lookup_date_ext(program, mail, &node->date))
+		return;
+
 	if (mail_get_received_date(mail, &node->date) < 0)
 		node->date = index_sort_program_set_date_failed(program, mail);
+	else
+		index_sort_update_date_ext(program, mail, node->date);
 }
 
 static void
@@ -94,12 +129,20 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_date(mail, &node->date, &tz) < 0)
+	if (index_sort_lookup_date_ext(program, mail, &node->date))
+		return;
+
+	if (mail_get_date(mail, &node->date, &tz) < 0) {
 		node->date = index_sort_program_set_date_failed(program, mail);
-	else if (node->date == 0) {
-		if (mail_get_received_date(mail, &node->date) < 0)
+		return;
+	}
+	if (node->date == 0) {
+		if (mail_get_received_date(mail, &node->date) < 0) {
 			node->date = index_sort_program_set_date_failed(program, mail);
+			return;
+		}
 	}
+	index_sort_update_date_ext(program, mail, node->date);
 }
 
 static void
@@ -196,6 +239,17 @@ void index_sort_list_add(struct mail_search_sort_program *program,
 	mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
 }
 
+static void
+index_sort_prefetch_secondary(struct mail_search_sort_program *program,
+			      const ARRAY_TYPE(seq_range) *seqs)
+{
+	/* Mails with identical primary sort keys get compared with the
+	   secondary keys via temp_mail. Look up its cached fields for all the
+	   mails at once instead of one mail at a time. */
+	if ((program->sort_program[1] & MAIL_SORT_MASK) != MAIL_SORT_END)
+		index_mail_prefetch_cache_range(program->temp_mail, seqs);
+}
+
 static int sort_node_date_cmp(const struct mail_sort_node_date *n1,
 			      const struct mail_sort_node_date *n2)
 {
@@ -215,6 +269,14 @@ static void
 index_sort_list_finish_date(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
+	const struct mail_sort_node_date *node;
+	ARRAY_TYPE(seq_range) seqs;
+
+	i_array_init(&seqs, 32);
+	array_foreach(nodes, node)
+		seq_range_array_add(&seqs, node->seq);
+	index_sort_prefetch_secondary(program, &seqs);
+	array_free(&seqs);
 
 	array_sort(nodes, sort_node_date_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
@@ -241,6 +303,14 @@ static void
 index_sort_list_finish_size(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_size) *nodes = program->context;
+	const struct mail_sort_node_size *node;
+	ARRAY_TYPE(seq_range) seqs;
+
+	i_array_init(&seqs, 32);
+	array_foreach(nodes, node)
+		seq_range_array_add(&seqs, node->seq);
+	index_sort_prefetch_secondary(program, &seqs);
+	array_free(&seqs);
 
 	array_sort(nodes, sort_node_size_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
@@ -375,6 +445,7 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 	struct mail_search_sort_program *program;
 	enum mail_fetch_field wanted_fields;
 	struct mailbox_header_lookup_ctx *wanted_headers;
+	const char *name;
 	unsigned int i;
 
 	if (sort_program == NULL || sort_program[0] == MAIL_SORT_END)
@@ -412,10 +483,19 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 		i_array_init(nodes, 128);
 
 		if ((program->sort_program[0] &
-		     MAIL_SORT_MASK) == MAIL_SORT_ARRIVAL)
+		     MAIL_SORT_MASK) == MAIL_SORT_ARRIVAL) {
 			program->sort_list_add = index_sort_list_add_arrival;
-		else
+			name = "sort-arrival";
+		} else {
 			program->sort_list_add = index_sort_list_add_date;
+			name = "sort-date";
+		}
+		/* the dates never change, so once looked up they can be
+		   read directly from the index records afterwards. */
+		program->date_ext_id =
+			mail_index_ext_register(t->box->index, name, 0,
+						sizeof(uint32_t),
+						sizeof(uint32_t));
 		program->sort_list_finish = index_sort_list_finish_date;
 		program->context = nodes;
 		break;
@@ -980,25 +980,44 @@ void index_save_context_free(struct mail_save_context *ctx)
 	ctx->unfinished = FALSE;
 }
 
+enum index_copy_cache_field_type {
+	INDEX_COPY_CACHE_FIELD_TYPE_NORMAL = 0,
+	INDEX_COPY_CACHE_FIELD_TYPE_SAVE_DATE,
+	INDEX_COPY_CACHE_FIELD_TYPE_PHYSICAL_SIZE,
+	INDEX_COPY_CACHE_FIELD_TYPE_VIRTUAL_SIZE,
+};
+
+struct index_copy_cache_field {
+	unsigned int src_field_idx, dest_field_idx;
+	enum index_copy_cache_field_type type;
+};
+
+struct index_copy_cache_map {
+	/* generation_sequence of the source mailbox */
+	unsigned int src_box_generation;
+	ARRAY(struct index_copy_cache_field) fields;
+	buffer_t *buf;
+};
+
 static void
-mail_copy_cache_field(struct mail_save_context *ctx, struct mail *src_mail,
-		      uint32_t dest_seq, const char *name, buffer_t *buf)
+index_copy_cache_map_add(struct index_copy_cache_map *map,
+			 struct mailbox *src_box, struct mailbox *dest_box,
+			 const char *name, bool no_normal_fields)
 {
-	struct mailbox_transaction_context *dest_trans = ctx->transaction;
+	struct index_copy_cache_field *field;
+	enum index_copy_cache_field_type type;
 	const struct mail_cache_field *dest_field;
 	unsigned int src_field_idx, dest_field_idx;
-	uint32_t t;
-	bool add = FALSE;
 
-	src_field_idx = mail_cache_register_lookup(src_mail->box->cache, name);
+	src_field_idx = mail_cache_register_lookup(src_box->cache, name);
 	i_assert(src_field_idx != UINT_MAX);
 
-	dest_field_idx = mail_cache_register_lookup(dest_trans->box->cache, name);
+	dest_field_idx = mail_cache_register_lookup(dest_box->cache, name);
 	if (dest_field_idx == UINT_MAX) {
 		/* unknown field */
 		return;
 	}
-	dest_field = mail_cache_register_get_field(dest_trans->box->cache,
+	dest_field = mail_cache_register_get_field(dest_box->cache,
 						   dest_field_idx);
 	if ((dest_field->decision &
 	     ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) == MAIL_CACHE_DECISION_NO) {
@@ -1006,41 +1025,113 @@ mail_copy_cache_field(struct mail_save_context *ctx, struct mail *src_mail,
 		return;
 	}
 
+	if (strcmp(name, "date.save") == 0)
+		type = INDEX_COPY_CACHE_FIELD_TYPE_SAVE_DATE;
+	else if (strcmp(name, "size.physical") == 0)
+		type = INDEX_COPY_CACHE_FIELD_TYPE_PHYSICAL_SIZE;
+	else if (strcmp(name, "size.virtual") == 0)
+		type = INDEX_COPY_CACHE_FIELD_TYPE_VIRTUAL_SIZE;
+	else if (no_normal_fields)
+		return;
+	else
+		type = INDEX_COPY_CACHE_FIELD_TYPE_NORMAL;
+
+	field = array_append_space(&map->fields);
+	field->src_field_idx = src_field_idx;
+	field->dest_field_idx = dest_field_idx;
+	field->type = type;
+}
+
+/* Looking up and comparing the cache fields of both mailboxes is expensive
+   compared to copying a single mail's cached data, so do it only once for
+   each source mailbox within the transaction. Fields registered later on
+   won't be copied, which is fine since cache is only an optimization. */
+static struct index_copy_cache_map *
+index_copy_cache_map_get(struct mailbox_transaction_context *t,
+			 struct mailbox *src_box)
+{
+	struct index_copy_cache_map *map = t->copy_cache_map;
+	struct mailbox_metadata src_metadata, dest_metadata;
+	const struct mailbox_cache_field *field;
+
+	if (map == NULL) {
+		map = t->copy_cache_map = i_new(struct index_copy_cache_map, 1);
+		i_array_init(&map->fields, 32);
+		map->buf = buffer_create_dynamic(default_pool, 1024);
+	} else if (map->src_box_generation == src_box->generation_sequence) {
+		return map;
+	}
+	map->src_box_generation = src_box->generation_sequence;
+	array_clear(&map->fields);
+
+	T_BEGIN {
+		if (mailbox_get_metadata(src_box, MAILBOX_METADATA_CACHE_FIELDS,
+					 &src_metadata) < 0)
+			i_unreached();
+		/* the only reason we're doing the destination lookup is to
+		   make sure that the cache file is opened and the cache
+		   decisions are up to date */
+		if (mailbox_get_metadata(t->box, MAILBOX_METADATA_CACHE_FIELDS,
+					 &dest_metadata) < 0)
+			i_unreached();
+
+		array_foreach(src_metadata.cache_fields, field) {
+			index_copy_cache_map_add(map, src_box, t->box,
+				field->name,
+				(t->flags & MAILBOX_TRANSACTION_FLAG_NO_CACHE_COPY) != 0);
+		}
+	} T_END;
+	return map;
+}
+
+void index_copy_cache_map_free(struct mailbox_transaction_context *t)
+{
+	struct index_copy_cache_map *map = t->copy_cache_map;
+
+	if (map == NULL)
+		return;
+	t->copy_cache_map = NULL;
+	array_free(&map->fields);
+	buffer_free(&map->buf);
+	i_free(map);
+}
+
+static void
+mail_copy_cache_field(struct mail_save_context *ctx, struct mail *src_mail,
+		      uint32_t dest_seq,
+		      const struct index_copy_cache_field *field, buffer_t *buf)
+{
+	struct mailbox_transaction_context *dest_trans = ctx->transaction;
+	uint32_t t;
+
 	buffer_set_used_size(buf, 0);
-	if (strcmp(name, "date.save") == 0) {
+	if (field->type == INDEX_COPY_CACHE_FIELD_TYPE_SAVE_DATE) {
 		/* save date must update when mail is copied */
 		t = ioloop_time32;
 		buffer_append(buf, &t, sizeof(t));
-		add = TRUE;
 	} else if (mail_cache_lookup_field(src_mail->transaction->cache_view, buf,
-					   src_mail->seq, src_field_idx) <= 0) {
+					   src_mail->seq,
+					   field->src_field_idx) <= 0) {
 		/* error / not found */
-		buffer_set_used_size(buf, 0);
-	} else {
-		if (strcmp(name, "size.physical") == 0 ||
-		    strcmp(name, "size.virtual") == 0) {
-			/* FIXME: until mail_cache_lookup() can read unwritten
-			   cached data from buffer, we'll do this optimization
-			   to make quota plugin's work faster */
-			struct index_mail *imail =
-				INDEX_MAIL(ctx->dest_mail);
-			uoff_t size;
-
-			i_assert(buf->used == sizeof(size));
-			memcpy(&size, buf->data, sizeof(size));
-			if (strcmp(name, "size.physical") == 0)
-				imail->data.physical_size = size;
-			else
-				imail->data.virtual_size = size;
-		}
-		/* NOTE: we'll want to add also nonexistent headers, which
-		   will keep the buf empty */
-		add = TRUE;
-	}
-	if (add) {
-		mail_cache_add(dest_trans->cache_trans, dest_seq,
-			       dest_field_idx, buf->data, buf->used);
+		return;
+	} else if (field->type != INDEX_COPY_CACHE_FIELD_TYPE_NORMAL) {
+		/* FIXME: until mail_cache_lookup() can read unwritten
+		   cached data from buffer, we'll do this optimization
+		   to make quota plugin's work faster */
+		struct index_mail *imail = INDEX_MAIL(ctx->dest_mail);
+		uoff_t size;
+
+		i_assert(buf->used == sizeof(size));
+		memcpy(&size, buf->data, sizeof(size));
+		if (field->type == INDEX_COPY_CACHE_FIELD_TYPE_PHYSICAL_SIZE)
+			imail->data.physical_size = size;
+		else
+			imail->data.virtual_size = size;
 	}
+	/* NOTE: we'll want to add also nonexistent headers, which
+	   will keep the buf empty */
+	mail_cache_add(dest_trans->cache_trans, dest_seq,
+		       field->dest_field_idx, buf->data, buf->used);
 }
 
 static void
@@ -1066,31 +1157,13 @@ index_copy_vsize_extension(struct mail_save_context *ctx,
 void index_copy_cache_fields(struct mail_save_context *ctx,
 			     struct mail *src_mail, uint32_t dest_seq)
 {
-	T_BEGIN {
-		struct mailbox_metadata src_metadata, dest_metadata;
-		const struct mailbox_cache_field *field;
-		buffer_t *buf;
+	struct index_copy_cache_map *map;
+	const struct index_copy_cache_field *field;
 
-		if (mailbox_get_metadata(src_mail->box,
-					 MAILBOX_METADATA_CACHE_FIELDS,
-					 &src_metadata) < 0)
-			i_unreached();
-		/* the only reason we're doing the destination lookup is to
-		   make sure that the cache file is opened and the cache
-		   decisions are up to date */
-		if (mailbox_get_metadata(ctx->transaction->box,
-					 MAILBOX_METADATA_CACHE_FIELDS,
-					 &dest_metadata) < 0)
-			i_unreached();
-
-		buf = buffer_create_dynamic(default_pool, 1024);
-		array_foreach(src_metadata.cache_fields, field) {
-			mail_copy_cache_field(ctx, src_mail, dest_seq,
-					      field->name, buf);
-		}
-		index_copy_vsize_extension(ctx, src_mail, dest_seq);
-		buffer_free(&buf);
-	} T_END;
+	map = index_copy_cache_map_get(ctx->transaction, src_mail->box);
+	array_foreach(&map->fields, field)
+		mail_copy_cache_field(ctx, src_mail, dest_seq, field, map->buf);
+	index_copy_vsize_extension(ctx, src_mail, dest_seq);
 }
 
 int index_storage_set_subscribed(struct mailbox *box, bool set)
@@ -44,6 +44,10 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	/* Attribute iterator whose last returned key's value can be used by
+	   index_storage_attribute_get() without a dict lookup. */
+	struct index_storage_attribute_iter *attr_iter;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -160,6 +164,7 @@ void index_transaction_rollback(struct mailbox_transaction_context *t);
 void index_save_context_free(struct mail_save_context *ctx);
 void index_copy_cache_fields(struct mail_save_context *ctx,
 			     struct mail *src_mail, uint32_t dest_seq);
+void index_copy_cache_map_free(struct mailbox_transaction_context *t);
 int index_storage_set_subscribed(struct mailbox *box, bool set);
 void index_storage_destroy(struct mail_storage *storage);
 
@@ -7,6 +7,7 @@
 #include "index-sync-private.h"
 #include "index-pop3-uidl.h"
 #include "index-mail.h"
+#include "mailbox-notify-client.h"
 
 static void index_transaction_free(struct mailbox_transaction_context *t)
 {
@@ -16,6 +17,7 @@ static void index_transaction_free(struct mailbox_transaction_context *t)
 	mail_index_view_close(&t->view);
 	if (array_is_created(&t->pvt_saves))
 		array_free(&t->pvt_saves);
+	index_copy_cache_map_free(t);
 	array_free(&t->module_contexts);
 	i_free(t->reason);
 	i_free(t);
@@ -215,6 +217,8 @@ int index_transaction_commit(struct mailbox_transaction_context *t,
 
 	if (ret < 0 && mail_index_is_deleted(box->index))
 		mailbox_set_deleted(box);
+	if (ret == 0)
+		mailbox_notify_client_changed(box, &result);
 
 	changes_r->ignored_modseq_changes = result.ignored_modseq_changes;
 	return ret;
@@ -119,7 +119,9 @@ i_stream_mail_read(struct istream_private *stream)
 	i_stream_seek(stream->parent, stream->parent_start_offset +
 		      stream->istream.v_offset);
 
+	mail_storage_timing_start(MAIL_STORAGE_TIMING_MAIL_READ);
 	ret = i_stream_read_copy_from_parent(&stream->istream);
+	mail_storage_timing_end(MAIL_STORAGE_TIMING_MAIL_READ);
 	size = i_stream_get_data_size(&stream->istream);
 	if (ret > 0) {
 		mstream->mail->transaction->stats.files_read_bytes += ret;
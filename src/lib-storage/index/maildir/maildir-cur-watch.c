@@ -0,0 +1,212 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "fd-util.h"
+#include "maildir-storage.h"
+#include "maildir-cur-watch.h"
+
+#ifdef HAVE_INOTIFY_INIT
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define MAILDIR_CUR_WATCH_BUFLEN (32*1024)
+
+#define MAILDIR_CUR_WATCH_ADDED POINTER_CAST(1)
+#define MAILDIR_CUR_WATCH_REMOVED POINTER_CAST(2)
+
+struct maildir_cur_watch {
+	int fd;
+	/* filename => MAILDIR_CUR_WATCH_ADDED/REMOVED while reading changes */
+	HASH_TABLE(const char *, void *) changes;
+	/* The changes seen in cur/ have all been applied to uidlist */
+	bool synced;
+};
+
+static struct maildir_cur_watch *
+maildir_cur_watch_init(struct maildir_mailbox *mbox)
+{
+	struct maildir_cur_watch *watch;
+	const char *cur_dir;
+	int fd;
+
+	watch = i_new(struct maildir_cur_watch, 1);
+	watch->fd = -1;
+
+	fd = inotify_init();
+	if (fd == -1) {
+		if (errno != EMFILE) {
+			mailbox_set_critical(&mbox->box,
+					     "inotify_init() failed: %m");
+		} else {
+			e_warning(mbox->box.event, "Inotify instance limit "
+				  "exceeded, scanning cur/ fully. Increase "
+				  "/proc/sys/fs/inotify/max_user_instances");
+		}
+		return watch;
+	}
+	fd_close_on_exec(fd, TRUE);
+	fd_set_nonblock(fd, TRUE);
+
+	cur_dir = t_strconcat(mailbox_get_path(&mbox->box), "/cur", NULL);
+	if (inotify_add_watch(fd, cur_dir, IN_CREATE | IN_DELETE | IN_MOVE |
+			      IN_DELETE_SELF | IN_MOVE_SELF |
+			      IN_ONLYDIR) == -1) {
+		if (errno == ENOSPC) {
+			e_warning(mbox->box.event, "Inotify watch limit "
+				  "exceeded, scanning cur/ fully. Increase "
+				  "/proc/sys/fs/inotify/max_user_watches");
+		} else if (errno != ENOENT) {
+			mailbox_set_critical(&mbox->box,
+				"inotify_add_watch(%s) failed: %m", cur_dir);
+		}
+		i_close_fd(&fd);
+		return watch;
+	}
+	watch->fd = fd;
+	return watch;
+}
+
+static int maildir_cur_watch_read_events(struct maildir_mailbox *mbox)
+{
+	struct maildir_cur_watch *watch = mbox->cur_watch;
+	const struct inotify_event *event;
+	unsigned char event_buf[MAILDIR_CUR_WATCH_BUFLEN];
+	const char *fname;
+	void *state;
+	ssize_t ret, pos;
+	int result = 1;
+
+	for (;;) {
+		ret = read(watch->fd, event_buf, sizeof(event_buf));
+		if (ret <= 0) {
+			if (ret == 0 || errno == EAGAIN)
+				break;
+			mailbox_set_critical(&mbox->box,
+					     "read(inotify) failed: %m");
+			return -1;
+		}
+
+		for (pos = 0; pos + (ssize_t)sizeof(*event) <= ret; ) {
+			event = (const struct inotify_event *)(event_buf + pos);
+			pos += sizeof(*event) + event->len;
+
+			if ((event->mask & (IN_IGNORED | IN_DELETE_SELF |
+					    IN_MOVE_SELF)) != 0) {
+				/* cur/ itself is gone, the watch needs to be
+				   added again */
+				return -1;
+			}
+			if ((event->mask & IN_Q_OVERFLOW) != 0) {
+				/* some changes were lost */
+				result = 0;
+				continue;
+			}
+			if (event->len == 0 ||
+			    !hash_table_is_created(watch->changes))
+				continue;
+
+			fname = event->name;
+			if (fname[0] == '.')
+				continue;
+			if (fname[0] == MAILDIR_INFO_SEP) {
+				/* needs to be renamed by the full scan */
+				result = 0;
+				continue;
+			}
+			state = (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0 ?
+				MAILDIR_CUR_WATCH_ADDED :
+				MAILDIR_CUR_WATCH_REMOVED;
+			if (hash_table_lookup(watch->changes, fname) == NULL)
+				fname = t_strdup(fname);
+			hash_table_update(watch->changes, fname, state);
+		}
+	}
+	return result;
+}
+
+void maildir_cur_watch_deinit(struct maildir_mailbox *mbox)
+{
+	if (mbox->cur_watch == NULL)
+		return;
+
+	i_close_fd(&mbox->cur_watch->fd);
+	i_free(mbox->cur_watch);
+}
+
+void maildir_cur_watch_reset(struct maildir_mailbox *mbox)
+{
+	if (mbox->cur_watch == NULL)
+		mbox->cur_watch = maildir_cur_watch_init(mbox);
+	mbox->cur_watch->synced = FALSE;
+	if (mbox->cur_watch->fd == -1)
+		return;
+
+	/* the full scan will see these changes */
+	if (maildir_cur_watch_read_events(mbox) < 0)
+		maildir_cur_watch_deinit(mbox);
+}
+
+void maildir_cur_watch_set_synced(struct maildir_mailbox *mbox)
+{
+	if (mbox->cur_watch != NULL && mbox->cur_watch->fd != -1)
+		mbox->cur_watch->synced = TRUE;
+}
+
+bool maildir_cur_watch_read(struct maildir_mailbox *mbox,
+			    ARRAY_TYPE(const_string) *added,
+			    ARRAY_TYPE(const_string) *removed)
+{
+	struct maildir_cur_watch *watch = mbox->cur_watch;
+	struct hash_iterate_context *iter;
+	const char *fname;
+	void *state;
+	int ret;
+
+	if (watch == NULL || !watch->synced)
+		return FALSE;
+	watch->synced = FALSE;
+
+	hash_table_create(&watch->changes, default_pool, 0, str_hash, strcmp);
+	ret = maildir_cur_watch_read_events(mbox);
+	if (ret > 0) {
+		iter = hash_table_iterate_init(watch->changes);
+		while (hash_table_iterate(iter, watch->changes,
+					  &fname, &state)) {
+			if (state == MAILDIR_CUR_WATCH_ADDED)
+				array_push_back(added, &fname);
+			else
+				array_push_back(removed, &fname);
+		}
+		hash_table_iterate_deinit(&iter);
+	}
+	hash_table_destroy(&watch->changes);
+	if (ret < 0)
+		maildir_cur_watch_deinit(mbox);
+	return ret > 0;
+}
+
+#else
+
+void maildir_cur_watch_deinit(struct maildir_mailbox *mbox ATTR_UNUSED)
+{
+}
+
+void maildir_cur_watch_reset(struct maildir_mailbox *mbox ATTR_UNUSED)
+{
+}
+
+void maildir_cur_watch_set_synced(struct maildir_mailbox *mbox ATTR_UNUSED)
+{
+}
+
+bool maildir_cur_watch_read(struct maildir_mailbox *mbox ATTR_UNUSED,
+			    ARRAY_TYPE(const_string) *added ATTR_UNUSED,
+			    ARRAY_TYPE(const_string) *removed ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MAILDIR_CUR_WATCH_H
+#define MAILDIR_CUR_WATCH_H
+
+struct maildir_mailbox;
+
+/* Start watching the maildir's cur/ directory for changes, or discard all the
+   changes seen so far if it's already being watched. This is called just
+   before cur/ is fully scanned. */
+void maildir_cur_watch_reset(struct maildir_mailbox *mbox);
+/* The full cur/ scan or the changes returned by maildir_cur_watch_read() were
+   successfully written to uidlist. The following syncs can use the changes
+   seen after this. */
+void maildir_cur_watch_set_synced(struct maildir_mailbox *mbox);
+/* Read the filenames added to and removed from cur/ since the previous call.
+   Only the latest state of each filename is returned. Returns FALSE if the
+   changes aren't reliably known and cur/ needs to be fully scanned. The watch
+   stays unsynced until maildir_cur_watch_set_synced() is called. */
+bool maildir_cur_watch_read(struct maildir_mailbox *mbox,
+			    ARRAY_TYPE(const_string) *added,
+			    ARRAY_TYPE(const_string) *removed);
+void maildir_cur_watch_deinit(struct maildir_mailbox *mbox);
+
+#endif
@@ -12,6 +12,7 @@
 #include "maildir-uidlist.h"
 #include "maildir-keywords.h"
 #include "maildir-sync.h"
+#include "maildir-cur-watch.h"
 #include "index-mail.h"
 
 #include <sys/stat.h>
@@ -626,6 +627,7 @@ static void maildir_mailbox_close(struct mailbox *box)
 		maildir_keywords_deinit(&mbox->keywords);
 	if (mbox->uidlist != NULL)
 		maildir_uidlist_deinit(&mbox->uidlist);
+	maildir_cur_watch_deinit(mbox);
 	index_storage_mailbox_close(box);
 }
 
@@ -78,6 +78,8 @@ struct maildir_mailbox {
 	/* maildir sync: */
 	struct maildir_uidlist *uidlist;
 	struct maildir_keywords *keywords;
+	/* maildir_incremental_sync: changes in cur/ */
+	struct maildir_cur_watch *cur_watch;
 
 	struct maildir_index_header maildir_hdr;
 	uint32_t maildir_ext_id;
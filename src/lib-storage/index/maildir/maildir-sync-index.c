@@ -450,6 +450,7 @@ int maildir_sync_index(struct maildir_index_sync_context *ctx,
 	const struct mail_index_header *hdr;
 	struct mail_index_header empty_hdr;
 	const struct mail_index_record *rec;
+	const ARRAY_TYPE(seq_range) *removed_uids;
 	uint32_t seq, seq2, uid, prev_uid;
         enum maildir_uidlist_rec_flag uflags;
 	const char *filename;
@@ -617,6 +618,14 @@ int maildir_sync_index(struct maildir_index_sync_context *ctx,
 		/* expunge the rest */
 		for (seq++; seq <= hdr->messages_count; seq++)
 			mail_index_expunge(ctx->trans, seq);
+	} else if ((removed_uids = maildir_sync_get_removed_uids(
+			ctx->maildir_sync_ctx)) != NULL) {
+		/* expunge the rest only if their files were seen removed */
+		for (seq++; seq <= hdr->messages_count; seq++) {
+			rec = mail_index_lookup(view, seq);
+			if (seq_range_exists(removed_uids, rec->uid))
+				mail_index_expunge(ctx->trans, seq);
+		}
 	}
 
 	/* add \Recent flags. use updated view so it contains newly
@@ -182,6 +182,7 @@
 #include "maildir-uidlist.h"
 #include "maildir-filename.h"
 #include "maildir-sync.h"
+#include "maildir-cur-watch.h"
 
 #include <stdio.h>
 #include <stddef.h>
@@ -224,9 +225,18 @@ struct maildir_sync_context {
 	struct maildir_uidlist_sync_ctx *uidlist_sync_ctx;
 	struct maildir_index_sync_context *index_sync_ctx;
 
+	/* maildir_incremental_sync: cur/ changes since the previous sync */
+	struct stat cur_st;
+	time_t cur_check_time;
+	ARRAY_TYPE(const_string) cur_added, cur_removed;
+	/* UIDs whose files were removed from cur/ */
+	ARRAY_TYPE(seq_range) cur_removed_uids;
+
 	bool partial:1;
 	bool locked:1;
 	bool racing:1;
+	bool incremental:1;
+	bool cur_watch_update:1;
 };
 
 void maildir_sync_set_racing(struct maildir_sync_context *ctx)
@@ -234,6 +244,14 @@ void maildir_sync_set_racing(struct maildir_sync_context *ctx)
 	ctx->racing = TRUE;
 }
 
+const ARRAY_TYPE(seq_range) *
+maildir_sync_get_removed_uids(struct maildir_sync_context *ctx)
+{
+	if (ctx == NULL || !ctx->incremental)
+		return NULL;
+	return &ctx->cur_removed_uids;
+}
+
 void maildir_sync_notify(struct maildir_sync_context *ctx)
 {
 	time_t now;
@@ -417,6 +435,11 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 	bool move_new, dir_changed = FALSE;
 
 	path = new_dir ? ctx->new_dir : ctx->cur_dir;
+	if (!new_dir && ctx->mbox->storage->set->maildir_incremental_sync) {
+		/* start tracking changes before reading the directory, so
+		   nothing done during the scan is missed */
+		maildir_cur_watch_reset(ctx->mbox);
+	}
 	for (i = 0;; i++) {
 		dirp = opendir(path);
 		if (dirp != NULL)
@@ -595,6 +618,60 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 		(move_count <= MAILDIR_RENAME_RESCAN_COUNT || final ? 0 : 1);
 }
 
+static bool maildir_sync_cur_read_changes(struct maildir_sync_context *ctx)
+{
+	/* stat() before reading the changes. anything changed after it will
+	   be seen in the next sync. */
+	ctx->cur_check_time = time(NULL);
+	if (stat(ctx->cur_dir, &ctx->cur_st) < 0)
+		return FALSE;
+
+	t_array_init(&ctx->cur_added, 32);
+	t_array_init(&ctx->cur_removed, 32);
+	return maildir_cur_watch_read(ctx->mbox, &ctx->cur_added,
+				      &ctx->cur_removed);
+}
+
+static int maildir_sync_cur_changes(struct maildir_sync_context *ctx)
+{
+	struct maildir_uidlist *uidlist = ctx->mbox->uidlist;
+	const char *fname, *uidlist_fname;
+	uint32_t uid;
+
+	i_assert(ctx->locked);
+
+	ctx->mbox->maildir_hdr.cur_check_time =
+		time_to_uint32(ctx->cur_check_time);
+	ctx->mbox->maildir_hdr.cur_mtime = ctx->cur_st.st_mtime;
+	ctx->mbox->maildir_hdr.cur_mtime_nsecs = ST_MTIME_NSEC(ctx->cur_st);
+
+	t_array_init(&ctx->cur_removed_uids, 16);
+	array_foreach_elem(&ctx->cur_added, fname) {
+		if (maildir_uidlist_sync_next(ctx->uidlist_sync_ctx,
+					      fname, 0) < 0)
+			return -1;
+	}
+	array_foreach_elem(&ctx->cur_removed, fname) {
+		/* the file may have been renamed to a name that was
+		   just added above */
+		uidlist_fname = maildir_uidlist_get_full_filename(uidlist,
+								  fname);
+		if (uidlist_fname == NULL || strcmp(uidlist_fname, fname) != 0)
+			continue;
+		if (!maildir_uidlist_get_uid(uidlist, fname, &uid) ||
+		    uid == (uint32_t)-1)
+			continue;
+		maildir_uidlist_sync_remove_expunged(ctx->uidlist_sync_ctx,
+						     fname);
+		seq_range_array_add(&ctx->cur_removed_uids, uid);
+	}
+	e_debug(ctx->mbox->box.event,
+		"Incremental cur/ sync: %u added, %u removed",
+		array_count(&ctx->cur_added),
+		seq_range_count(&ctx->cur_removed_uids));
+	return 0;
+}
+
 static void maildir_sync_get_header(struct maildir_mailbox *mbox)
 {
 	const void *data;
@@ -864,6 +941,12 @@ maildir_sync_context(struct maildir_sync_context *ctx, bool forced,
 	if (!cur_changed) {
 		ctx->partial = TRUE;
 		sync_flags = MAILDIR_UIDLIST_SYNC_PARTIAL;
+	} else if (!forced && maildir_sync_cur_read_changes(ctx)) {
+		/* we know exactly which files in cur/ have changed. update
+		   only them in uidlist, but still as a locked sync. */
+		ctx->incremental = TRUE;
+		ctx->partial = TRUE;
+		sync_flags = MAILDIR_UIDLIST_SYNC_PARTIAL;
 	} else {
 		ctx->partial = FALSE;
 		sync_flags = 0;
@@ -906,8 +989,12 @@ maildir_sync_context(struct maildir_sync_context *ctx, bool forced,
 		}
 	}
 	ctx->locked = maildir_uidlist_is_locked(ctx->mbox->uidlist);
-	if (!ctx->locked)
+	if (!ctx->locked) {
 		ctx->partial = TRUE;
+		/* the read changes can't be applied without the lock.
+		   scan cur/ instead. */
+		ctx->incremental = FALSE;
+	}
 
 	if (!ctx->mbox->syncing_commit && (ctx->locked || lock_failure)) {
 		if (maildir_sync_index_begin(ctx->mbox, ctx,
@@ -932,8 +1019,14 @@ maildir_sync_context(struct maildir_sync_context *ctx, bool forced,
 			return -1;
 
 		if (cur_changed) {
-			if (maildir_scan_dir(ctx, FALSE, TRUE, why) < 0)
+			if (ctx->incremental)
+				ret = maildir_sync_cur_changes(ctx);
+			else
+				ret = maildir_scan_dir(ctx, FALSE, TRUE, why);
+			if (ret < 0)
 				return -1;
+			/* cur/ is fully known in uidlist after it's written */
+			ctx->cur_watch_update = ctx->locked;
 		}
 
 		maildir_sync_update_next_uid(ctx->mbox);
@@ -982,7 +1075,10 @@ maildir_sync_context(struct maildir_sync_context *ctx, bool forced,
 		}
 	}
 
-	return maildir_uidlist_sync_deinit(&ctx->uidlist_sync_ctx, TRUE);
+	ret = maildir_uidlist_sync_deinit(&ctx->uidlist_sync_ctx, TRUE);
+	if (ret == 0 && ctx->cur_watch_update)
+		maildir_cur_watch_set_synced(ctx->mbox);
+	return ret;
 }
 
 int maildir_sync_lookup(struct maildir_mailbox *mbox, uint32_t uid,
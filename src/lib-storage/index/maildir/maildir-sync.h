@@ -39,6 +39,10 @@ void maildir_sync_index_rollback(struct maildir_index_sync_context **_ctx);
 struct maildir_keywords_sync_ctx *
 maildir_sync_get_keywords_sync_ctx(struct maildir_index_sync_context *ctx);
 void maildir_sync_set_racing(struct maildir_sync_context *ctx);
+/* Returns the UIDs whose files were seen removed by an incremental sync,
+   or NULL if the sync isn't incremental. */
+const ARRAY_TYPE(seq_range) *
+maildir_sync_get_removed_uids(struct maildir_sync_context *ctx);
 void maildir_sync_notify(struct maildir_sync_context *ctx);
 void maildir_sync_set_new_msgs_count(struct maildir_index_sync_context *ctx,
 				     unsigned int count);
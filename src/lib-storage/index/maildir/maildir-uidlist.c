@@ -1532,6 +1532,10 @@ static int maildir_uidlist_sync_update(struct maildir_uidlist_sync_ctx *ctx)
 
 	if (maildir_uidlist_want_recreate(ctx) || uidlist->recreate_on_change)
 		return maildir_uidlist_recreate(uidlist);
+	if (ctx->first_unwritten_pos == UINT_MAX) {
+		/* only expunged records were removed, nothing to append */
+		return 0;
+	}
 
 	if (!uidlist->locked_refresh || uidlist->fd == -1) {
 		/* make sure we have the latest file (e.g. NOREFRESH used) */
@@ -1835,8 +1839,9 @@ int maildir_uidlist_sync_next_uid(struct maildir_uidlist_sync_ctx *ctx,
 	return 1;
 }
 
-void maildir_uidlist_sync_remove(struct maildir_uidlist_sync_ctx *ctx,
-				 const char *filename)
+static void
+maildir_uidlist_sync_remove_rec(struct maildir_uidlist_sync_ctx *ctx,
+				const char *filename)
 {
 	struct maildir_uidlist_rec *rec;
 	unsigned int idx;
@@ -1861,9 +1866,25 @@ void maildir_uidlist_sync_remove(struct maildir_uidlist_sync_ctx *ctx,
 	}
 
 	ctx->changed = TRUE;
+}
+
+void maildir_uidlist_sync_remove(struct maildir_uidlist_sync_ctx *ctx,
+				 const char *filename)
+{
+	maildir_uidlist_sync_remove_rec(ctx, filename);
 	ctx->uidlist->recreate = TRUE;
 }
 
+void maildir_uidlist_sync_remove_expunged(struct maildir_uidlist_sync_ctx *ctx,
+					  const char *filename)
+{
+	/* Leave the line in the uidlist file. Other processes ignore it in
+	   partial syncs and drop it in full syncs, because the file no longer
+	   exists. The stale lines are removed once there are enough of them
+	   for maildir_uidlist_want_compress() to trigger a rewrite. */
+	maildir_uidlist_sync_remove_rec(ctx, filename);
+}
+
 void maildir_uidlist_sync_set_ext(struct maildir_uidlist_sync_ctx *ctx,
 				  struct maildir_uidlist_rec *rec,
 				  enum maildir_uidlist_rec_ext_key key,
@@ -125,6 +125,10 @@ int maildir_uidlist_sync_next_uid(struct maildir_uidlist_sync_ctx *ctx,
 				  struct maildir_uidlist_rec **rec_r);
 void maildir_uidlist_sync_remove(struct maildir_uidlist_sync_ctx *ctx,
 				 const char *filename);
+/* Like maildir_uidlist_sync_remove(), but for a file that was seen removed
+   from the maildir. The uidlist file isn't rewritten just for this. */
+void maildir_uidlist_sync_remove_expunged(struct maildir_uidlist_sync_ctx *ctx,
+					  const char *filename);
 void maildir_uidlist_sync_set_ext(struct maildir_uidlist_sync_ctx *ctx,
 				  struct maildir_uidlist_rec *rec,
 				  enum maildir_uidlist_rec_ext_key key,
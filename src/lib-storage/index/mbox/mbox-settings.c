@@ -19,6 +19,7 @@ static const struct setting_define mbox_setting_defines[] = {
 	DEF(SIZE, mbox_min_index_size),
 	DEF(BOOL, mbox_dirty_syncs),
 	DEF(BOOL, mbox_very_dirty_syncs),
+	DEF(BOOL, mbox_append_only_syncs),
 	DEF(BOOL, mbox_lazy_writes),
 	DEF(ENUM, mbox_md5),
 
@@ -33,6 +34,7 @@ static const struct mbox_settings mbox_default_settings = {
 	.mbox_min_index_size = 0,
 	.mbox_dirty_syncs = TRUE,
 	.mbox_very_dirty_syncs = FALSE,
+	.mbox_append_only_syncs = FALSE,
 	.mbox_lazy_writes = TRUE,
 	.mbox_md5 = "apop3d:all"
 };
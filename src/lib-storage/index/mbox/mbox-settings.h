@@ -9,6 +9,7 @@ struct mbox_settings {
 	uoff_t mbox_min_index_size;
 	bool mbox_dirty_syncs;
 	bool mbox_very_dirty_syncs;
+	bool mbox_append_only_syncs;
 	bool mbox_lazy_writes;
 	const char *mbox_md5;
 };
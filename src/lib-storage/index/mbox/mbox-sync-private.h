@@ -148,6 +148,8 @@ struct mbox_sync_context {
 	bool ext_modified:1;
 	bool index_reset:1;
 	bool errors:1;
+	/* mbox was fully synced and it has only grown since */
+	bool append_only:1;
 };
 
 int mbox_sync_header_refresh(struct mbox_mailbox *mbox);
@@ -1031,7 +1031,7 @@ static int mbox_sync_loop(struct mbox_sync_context *sync_ctx,
 	uint32_t uid, messages_count;
 	uoff_t offset;
 	int ret;
-	bool expunged, skipped_mails, uids_broken;
+	bool expunged, skipped_mails, uids_broken, append_verified = FALSE;
 
 	messages_count =
 		mail_index_view_get_messages_count(sync_ctx->sync_view);
@@ -1103,6 +1103,18 @@ static int mbox_sync_loop(struct mbox_sync_context *sync_ctx,
 				uid = mail_ctx->mail.uid = rec->uid;
 		}
 
+		if (sync_ctx->append_only && !mail_ctx->mail.pseudo &&
+		    sync_ctx->idx_seq == messages_count) {
+			/* this was the last mail in the previously synced
+			   file. if it's not what we expect, the file was
+			   modified before its old end. */
+			if (ret == 0 || rec == NULL) {
+				sync_ctx->mbox->mbox_hdr.dirty_flag = 1;
+				return 0;
+			}
+			append_verified = TRUE;
+		}
+
 		/* get all sync records related to this message. with pseudo
 		   message just get the first sync record so we can jump to
 		   it with partial seeking. */
@@ -1199,13 +1211,21 @@ static int mbox_sync_loop(struct mbox_sync_context *sync_ctx,
 	if (ret < 0)
 		return -1;
 
+	if (sync_ctx->append_only && !append_verified) {
+		/* the file ended before the last previously synced mail */
+		sync_ctx->mbox->mbox_hdr.dirty_flag = 1;
+		return 0;
+	}
+
 	if (istream_raw_mbox_is_eof(sync_ctx->input)) {
 		/* rest of the messages in index don't exist -> expunge them */
 		while (sync_ctx->idx_seq <= messages_count)
 			mail_index_expunge(sync_ctx->t, sync_ctx->idx_seq++);
 	}
 
-	if (!skipped_mails)
+	/* with append-only changes the skipped mails are known to be
+	   unchanged */
+	if (!skipped_mails || append_verified)
 		sync_ctx->mbox->mbox_hdr.dirty_flag = 0;
 	sync_ctx->mbox->mbox_broken_offsets = FALSE;
 
@@ -1626,6 +1646,17 @@ static int mbox_sync_do(struct mbox_sync_context *sync_ctx,
 			partial = FALSE;
 		else
 			partial = TRUE;
+	} else if (mbox_hdr->dirty_flag == 0 &&
+		   sync_ctx->mbox->storage->set->mbox_append_only_syncs &&
+		   (uint64_t)st->st_size > mbox_hdr->sync_size &&
+		   mail_index_view_get_messages_count(sync_ctx->sync_view) > 0) {
+		/* the file was fully synced and it has only grown since.
+		   most likely new mails were appended, so read only them.
+		   the last previously synced mail is verified to still be
+		   at its old offset, otherwise fallback to full syncing. */
+		partial = TRUE;
+		sync_ctx->append_only = TRUE;
+		sync_ctx->mbox->mbox_hdr.dirty_flag = 1;
 	} else if ((flags & MBOX_SYNC_UNDIRTY) != 0 ||
 		   (uint64_t)st->st_size == mbox_hdr->sync_size) {
 		/* we want to do full syncing. always do this if
@@ -1665,6 +1696,7 @@ static int mbox_sync_do(struct mbox_sync_context *sync_ctx,
 
 		mbox_sync_restart(sync_ctx);
 		partial = FALSE;
+		sync_ctx->append_only = FALSE;
 	}
 
 	if (mbox_sync_handle_eof_updates(sync_ctx, &mail_ctx) < 0)
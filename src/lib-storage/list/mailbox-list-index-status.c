@@ -375,6 +375,45 @@ index_list_get_metadata(struct mailbox *box,
 	return ibox->module_ctx.super.get_metadata(box, items, metadata_r);
 }
 
+static void
+index_list_update_fill_vsize_appends(struct mailbox *box,
+				     struct mail_index_view *view,
+				     struct mailbox_index_vsize *vsize)
+{
+	const struct mail_index_header *hdr = mail_index_get_header(view);
+	struct mailbox_index_vsize new_vsize = *vsize;
+	const uint32_t *vsizep;
+	const void *data;
+	uint32_t seq, seq1, seq2;
+	bool expunged;
+
+	if (vsize->highest_uid == 0 || vsize->highest_uid + 1 >= hdr->next_uid)
+		return;
+
+	/* The vsize header is updated only when the mailbox is synced, so
+	   it's usually behind after new mails were saved. Add the new mails'
+	   sizes from their vsize records, so STATUS (SIZE) can be answered
+	   from the list index. If there have been expunges or any of the
+	   sizes aren't in the index, leave it for the vsize header update. */
+	if (!mail_index_lookup_seq_range(view, 1, vsize->highest_uid,
+					 &seq1, &seq2))
+		seq2 = 0;
+	if (seq2 != vsize->message_count)
+		return;
+
+	for (seq = seq2 + 1; seq <= hdr->messages_count; seq++) {
+		mail_index_lookup_ext(view, seq, box->mail_vsize_ext_id,
+				      &data, &expunged);
+		vsizep = data;
+		if (vsizep == NULL || *vsizep == 0 || *vsizep == (uint32_t)-1)
+			return;
+		new_vsize.vsize += *vsizep - 1;
+		new_vsize.message_count++;
+	}
+	new_vsize.highest_uid = hdr->next_uid - 1;
+	*vsize = new_vsize;
+}
+
 static void
 index_list_update_fill_vsize(struct mailbox *box,
 			     struct mail_index_view *view,
@@ -385,8 +424,11 @@ index_list_update_fill_vsize(struct mailbox *box,
 
 	mail_index_get_header_ext(view, box->vsize_hdr_ext_id,
 				  &data, &size);
-	if (size == sizeof(changes_r->vsize))
+	if (size == sizeof(changes_r->vsize)) {
 		memcpy(&changes_r->vsize, data, sizeof(changes_r->vsize));
+		index_list_update_fill_vsize_appends(box, view,
+						     &changes_r->vsize);
+	}
 }
 
 static bool
@@ -758,6 +800,7 @@ void mailbox_list_index_status_sync_deinit(struct mailbox *box)
 	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(box->list);
 	const struct mail_index_header *hdr;
 
+	i_zero(&ibox->last_unchanged_check);
 	hdr = mail_index_get_header(box->view);
 	if (!ilist->opened &&
 	    ibox->pre_sync_log_file_head_offset == hdr->log_file_head_offset &&
@@ -784,6 +827,7 @@ index_list_transaction_commit(struct mailbox_transaction_context *t,
 	if (ibox->module_ctx.super.transaction_commit(t, changes_r) < 0)
 		return -1;
 	t = NULL;
+	i_zero(&ibox->last_unchanged_check);
 
 	/* check all changes here, because e.g. vsize update is _OTHERS */
 	if (changes_r->changes_mask == 0)
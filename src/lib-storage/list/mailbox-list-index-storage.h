@@ -11,6 +11,10 @@ struct index_list_mailbox {
 
 	uint32_t pre_sync_log_file_seq;
 	uoff_t pre_sync_log_file_head_offset;
+	/* ioloop_timeval when list index was last verified to be up-to-date
+	   for this mailbox. STATUS looks up both the status and the metadata
+	   items, which shouldn't check the mailbox for changes twice. */
+	struct timeval last_unchanged_check;
 
 	bool have_backend:1;
 };
@@ -519,3 +519,105 @@ int mailbox_list_index_sync_delete(struct mailbox_list_index_sync_context *sync_
 	mailbox_list_index_node_unlink(sync_ctx->ilist, node);
 	return 1;
 }
+
+static enum mailbox_list_index_flags
+mailbox_info_flags_to_index(enum mailbox_info_flags info_flags)
+{
+	enum mailbox_list_index_flags flags = 0;
+
+	if ((info_flags & MAILBOX_NONEXISTENT) != 0)
+		flags |= MAILBOX_LIST_INDEX_FLAG_NONEXISTENT;
+	if ((info_flags & MAILBOX_NOSELECT) != 0)
+		flags |= MAILBOX_LIST_INDEX_FLAG_NOSELECT;
+	if ((info_flags & MAILBOX_NOINFERIORS) != 0)
+		flags |= MAILBOX_LIST_INDEX_FLAG_NOINFERIORS;
+	return flags;
+}
+
+static bool
+mailbox_list_index_parent_exists(struct mailbox_list_index_sync_context *ctx,
+				 const char *name)
+{
+	const char *p = strrchr(name, ctx->sep[0]);
+
+	if (p == NULL)
+		return TRUE;
+	return mailbox_list_index_lookup(ctx->list,
+					 t_strdup_until(name, p)) != NULL;
+}
+
+static int
+mailbox_list_index_sync_mailbox_real(struct mailbox_list_index_sync_context *ctx,
+				     const char *name)
+{
+	struct mailbox_list_index_node *node;
+	enum mailbox_info_flags info_flags;
+	enum mailbox_list_index_flags flags;
+	uint32_t seq;
+	bool created;
+	int ret;
+
+	if (mailbox_list_index_need_refresh(ctx->ilist, ctx->view)) {
+		/* an earlier change is still waiting for a full refresh */
+		return 0;
+	}
+	if ((ret = mailbox_list_mailbox(ctx->list, name, &info_flags)) < 0)
+		return -1;
+	flags = mailbox_info_flags_to_index(info_flags);
+
+	node = mailbox_list_index_lookup(ctx->list, name);
+	if (ret == 0 || (flags & MAILBOX_LIST_INDEX_FLAG_NONEXISTENT) != 0) {
+		/* the mailbox is gone */
+		if (node == NULL)
+			return 1;
+		if (!mail_index_lookup_seq(ctx->view, node->uid, &seq))
+			i_panic("mailbox list index: lost uid=%u", node->uid);
+		if (node->children != NULL) {
+			node->flags = MAILBOX_LIST_INDEX_FLAG_NONEXISTENT;
+			mail_index_update_flags(ctx->trans, seq, MODIFY_REPLACE,
+						(enum mail_flags)node->flags);
+		} else {
+			mail_index_expunge(ctx->trans, seq);
+			mailbox_list_index_node_unlink(ctx->ilist, node);
+		}
+		return 1;
+	}
+
+	if (node == NULL && !mailbox_list_index_parent_exists(ctx, name)) {
+		/* the parents' flags depend on the layout - let the full
+		   refresh figure them out */
+		return 0;
+	}
+	/* look up the GUID for new mailboxes, so NOTIFY can detect renames */
+	ctx->syncing_list = TRUE;
+	seq = mailbox_list_index_sync_name(ctx, name, &node, &created);
+	ctx->syncing_list = FALSE;
+	node->flags = flags | MAILBOX_LIST_INDEX_FLAG_SYNC_EXISTS;
+	mail_index_update_flags(ctx->trans, seq, MODIFY_REPLACE,
+				(enum mail_flags)flags);
+	return 1;
+}
+
+int mailbox_list_index_sync_mailbox(struct mailbox_list *list,
+				    const char *name)
+{
+	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(list);
+	struct mailbox_list_index_sync_context *sync_ctx;
+	int ret;
+
+	if (!ilist->has_backing_store || ilist->syncing ||
+	    strcasecmp(name, "INBOX") == 0)
+		return 0;
+
+	if (mailbox_list_index_sync_begin(list, &sync_ctx) < 0)
+		return -1;
+	if (ilist->call_corruption_callback ||
+	    ilist->corrupted_names_or_parents)
+		ret = 0;
+	else T_BEGIN {
+		ret = mailbox_list_index_sync_mailbox_real(sync_ctx, name);
+	} T_END;
+	if (mailbox_list_index_sync_end(&sync_ctx, ret > 0) < 0)
+		return -1;
+	return ret;
+}
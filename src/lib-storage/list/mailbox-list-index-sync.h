@@ -32,4 +32,12 @@ uint32_t mailbox_list_index_sync_name(struct mailbox_list_index_sync_context *ct
 int mailbox_list_index_sync_delete(struct mailbox_list_index_sync_context *sync_ctx,
 				   const char *name, bool delete_selectable);
 
+/* Update a single mailbox in the index to match the backing store after this
+   process created or deleted it. The change gets to the other processes via
+   the index's transaction log, so they don't need to walk through the whole
+   backing store. Returns 1 if updated, 0 if a full refresh is needed instead,
+   -1 on error. */
+int mailbox_list_index_sync_mailbox(struct mailbox_list *list,
+				    const char *name);
+
 #endif
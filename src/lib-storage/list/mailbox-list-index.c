@@ -4,6 +4,7 @@
 #include "ioloop.h"
 #include "hash.h"
 #include "str.h"
+#include "time-util.h"
 #include "mail-index-view-private.h"
 #include "mail-storage-hooks.h"
 #include "mail-storage-private.h"
@@ -36,12 +37,15 @@ static void mailbox_list_index_init_pool(struct mailbox_list_index *ilist)
 	ilist->mailbox_pool = pool_alloconly_create("mailbox list index", 4096);
 	hash_table_create_direct(&ilist->mailbox_names, ilist->mailbox_pool, 0);
 	hash_table_create_direct(&ilist->mailbox_hash, ilist->mailbox_pool, 0);
+	hash_table_create(&ilist->mailbox_lookups, ilist->mailbox_pool, 0,
+			  str_hash, strcmp);
 }
 
 void mailbox_list_index_reset(struct mailbox_list_index *ilist)
 {
 	hash_table_destroy(&ilist->mailbox_names);
 	hash_table_destroy(&ilist->mailbox_hash);
+	hash_table_destroy(&ilist->mailbox_lookups);
 	pool_unref(&ilist->mailbox_pool);
 
 	ilist->mailbox_tree = NULL;
@@ -154,11 +158,22 @@ mailbox_list_index_lookup_real(struct mailbox_list *list, const char *name)
 struct mailbox_list_index_node *
 mailbox_list_index_lookup(struct mailbox_list *list, const char *name)
 {
+	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(list);
 	struct mailbox_list_index_node *node;
 
+	/* Iterating through all the mailboxes and looking up their status
+	   would otherwise scan through all the siblings for each mailbox. */
+	node = hash_table_lookup(ilist->mailbox_lookups, name);
+	if (node != NULL)
+		return node;
+
 	T_BEGIN {
 		node = mailbox_list_index_lookup_real(list, name);
 	} T_END;
+	if (node != NULL) {
+		hash_table_insert(ilist->mailbox_lookups,
+				  p_strdup(ilist->mailbox_pool, name), node);
+	}
 	return node;
 }
 
@@ -189,6 +204,8 @@ void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 	while (*prev != node)
 		prev = &(*prev)->next;
 	*prev = node->next;
+
+	hash_table_clear(ilist->mailbox_lookups, TRUE);
 }
 
 static int mailbox_list_index_parse_header(struct mailbox_list_index *ilist,
@@ -805,6 +822,7 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 				 uint32_t *seq_r)
 {
 	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT(box->list);
+	struct index_list_mailbox *ibox;
 	struct mailbox_list_index_node *node;
 	struct mail_index_view *view;
 	const char *reason = NULL;
@@ -815,6 +833,7 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 		/* mailbox list indexes aren't enabled */
 		return 0;
 	}
+	ibox = INDEX_LIST_STORAGE_CONTEXT(box);
 	if (MAILBOX_IS_NEVER_IN_INDEX(box) && require_refreshed) {
 		/* Optimization: Caller wants the list index to be up-to-date
 		   for this mailbox, but this mailbox isn't updated to the list
@@ -847,11 +866,17 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 	} else if (!require_refreshed) {
 		/* this operation doesn't need the index to be up-to-date */
 		ret = 0;
+	} else if (timeval_cmp(&ibox->last_unchanged_check,
+			       &ioloop_timeval) == 0) {
+		/* we haven't been to ioloop since the last check */
+		ret = 0;
 	} else {
 		ret = box->v.list_index_has_changed == NULL ? 0 :
 			box->v.list_index_has_changed(box, view, seq, FALSE,
 						      &reason);
 		i_assert(ret <= 0 || reason != NULL);
+		if (ret == 0)
+			ibox->last_unchanged_check = ioloop_timeval;
 	}
 
 	if (ret != 0) {
@@ -882,6 +907,7 @@ static void mailbox_list_index_deinit(struct mailbox_list *list)
 	if (ilist->index != NULL) {
 		hash_table_destroy(&ilist->mailbox_hash);
 		hash_table_destroy(&ilist->mailbox_names);
+		hash_table_destroy(&ilist->mailbox_lookups);
 		pool_unref(&ilist->mailbox_pool);
 		if (ilist->opened)
 			mail_index_close(ilist->index);
@@ -930,6 +956,19 @@ static void mailbox_list_index_refresh_if_not_found(struct mailbox_list *list,
 	mailbox_list_last_error_pop(list);
 }
 
+static void
+mailbox_list_index_update_or_refresh(struct mailbox_list *list,
+				     const char *name)
+{
+	int ret;
+
+	mailbox_list_last_error_push(list);
+	ret = mailbox_list_index_sync_mailbox(list, name);
+	mailbox_list_last_error_pop(list);
+	if (ret <= 0)
+		mailbox_list_index_refresh_later(list);
+}
+
 static int mailbox_list_index_open_mailbox(struct mailbox *box)
 {
 	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
@@ -954,7 +993,10 @@ mailbox_list_index_create_mailbox(struct mailbox *box,
 			mailbox_list_index_refresh_if_not_found(box->list, box->name);
 		return -1;
 	}
-	mailbox_list_index_refresh_later(box->list);
+	if (directory)
+		mailbox_list_index_refresh_later(box->list);
+	else
+		mailbox_list_index_update_or_refresh(box->list, box->name);
 	return 0;
 }
 
@@ -984,7 +1026,7 @@ mailbox_list_index_delete_mailbox(struct mailbox_list *list, const char *name)
 			mailbox_list_index_refresh_if_found(list, name, FALSE);
 		return -1;
 	}
-	mailbox_list_index_refresh_later(list);
+	mailbox_list_index_update_or_refresh(list, name);
 	return 0;
 }
 
@@ -1009,6 +1051,7 @@ mailbox_list_index_rename_mailbox(struct mailbox_list *oldlist,
 				  const char *newname)
 {
 	struct mailbox_list_index *oldilist = INDEX_LIST_CONTEXT_REQUIRE(oldlist);
+	struct mailbox_list_index_node *node;
 
 	if (oldilist->module_ctx.super.rename_mailbox(oldlist, oldname,
 						      newlist, newname) < 0) {
@@ -1018,9 +1061,17 @@ mailbox_list_index_rename_mailbox(struct mailbox_list *oldlist,
 			mailbox_list_index_refresh_if_not_found(newlist, newname);
 		return -1;
 	}
-	mailbox_list_index_refresh_later(oldlist);
-	if (oldlist != newlist)
-		mailbox_list_index_refresh_later(newlist);
+	node = mailbox_list_index_lookup(oldlist, oldname);
+	if (node != NULL && node->children == NULL) {
+		/* renaming a hierarchy moves all its children as well.
+		   only a single mailbox can be updated incrementally. */
+		mailbox_list_index_update_or_refresh(oldlist, oldname);
+		mailbox_list_index_update_or_refresh(newlist, newname);
+	} else {
+		mailbox_list_index_refresh_later(oldlist);
+		if (oldlist != newlist)
+			mailbox_list_index_refresh_later(newlist);
+	}
 	return 0;
 }
 
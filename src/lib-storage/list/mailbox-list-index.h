@@ -118,6 +118,9 @@ struct mailbox_list_index {
 
 	/* uint32_t uid => node */
 	HASH_TABLE(void *, struct mailbox_list_index_node *) mailbox_hash;
+	/* storage name => node for the names looked up so far. Cleared
+	   whenever nodes are removed from the tree. */
+	HASH_TABLE(char *, struct mailbox_list_index_node *) mailbox_lookups;
 	struct mailbox_list_index_node *mailbox_tree;
 
 	bool pending_init:1;
@@ -10,14 +10,23 @@
 
 #define AUTOEXPUNGE_LOCK_FNAME "dovecot.autoexpunge.lock"
 
-static bool
-mailbox_autoexpunge_lock(struct mail_user *user, struct file_lock **lock)
+struct mail_autoexpunge_context {
+	struct mail_user *user;
+	struct file_lock *lock;
+	unsigned int expunged_count;
+	/* another process is already autoexpunging */
+	bool lock_busy;
+};
+
+static bool mailbox_autoexpunge_lock(struct mail_autoexpunge_context *ctx)
 {
 	const char *error;
 	int ret;
 
-	if (*lock != NULL)
+	if (ctx->lock != NULL)
 		return TRUE;
+	if (ctx->lock_busy)
+		return FALSE;
 
 	/* Try to lock the autoexpunging. If the lock already exists, another
 	   process is already busy with expunging, so we don't have to do it.
@@ -26,16 +35,20 @@ mailbox_autoexpunge_lock(struct mail_user *user, struct file_lock **lock)
 	   it. The lock isn't really required; it 1) improves performance
 	   so that multiple processes won't do the same work unnecessarily,
 	   and 2) it helps to avoid duplicate mails being added with
-	   lazy_expunge. */
-	ret = mail_user_lock_file_create(user, AUTOEXPUNGE_LOCK_FNAME,
-					 0, lock, &error);
+	   lazy_expunge. The lock is created only once some mailbox is
+	   known to have mails to expunge, so the common case of nothing to
+	   do doesn't need to create and delete the lock file. */
+	ret = mail_user_lock_file_create(ctx->user, AUTOEXPUNGE_LOCK_FNAME,
+					 0, &ctx->lock, &error);
 	if (ret < 0) {
-		e_error(user->event, "autoexpunge: Couldn't create %s lock: %s",
+		e_error(ctx->user->event,
+			"autoexpunge: Couldn't create %s lock: %s",
 			AUTOEXPUNGE_LOCK_FNAME, error);
 		/* do autoexpunging anyway */
 		return TRUE;
 	} else if (ret == 0) {
 		/* another process is autoexpunging, so we don't need to. */
+		ctx->lock_busy = TRUE;
 		return FALSE;
 	} else {
 		return TRUE;
@@ -121,8 +134,8 @@ mailbox_autoexpunge_batch(struct mailbox *box,
 }
 
 static int
-mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
-		    unsigned int max_mails, unsigned int *expunged_count)
+mailbox_autoexpunge(struct mail_autoexpunge_context *ctx, struct mailbox *box,
+		    unsigned int interval_time, unsigned int max_mails)
 {
 	struct mailbox_metadata metadata;
 	struct mailbox_status status;
@@ -155,31 +168,37 @@ mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
 			return 0;
 	}
 
+	if (!mailbox_autoexpunge_lock(ctx))
+		return 0;
 	if (mailbox_sync(box, MAILBOX_SYNC_FLAG_FAST) < 0)
 		return -1;
 
 	do {
 		ret = mailbox_autoexpunge_batch(box, interval_time, max_mails,
-						expire_time, expunged_count);
+						expire_time,
+						&ctx->expunged_count);
 	} while (ret > 0);
 
 	return ret;
 }
 
 static void
-mailbox_autoexpunge_set(struct mail_namespace *ns, const char *vname,
+mailbox_autoexpunge_set(struct mail_autoexpunge_context *ctx,
+			struct mail_namespace *ns, const char *vname,
 			unsigned int autoexpunge,
-			unsigned int autoexpunge_max_mails,
-			unsigned int *expunged_count)
+			unsigned int autoexpunge_max_mails)
 {
 	struct mailbox *box;
 
+	if (ctx->lock_busy)
+		return;
+
 	/* autoexpunge is configured by admin, so we can safely ignore
 	   any ACLs the user might normally have against expunging in
 	   the mailbox. */
 	box = mailbox_alloc(ns->list, vname, MAILBOX_FLAG_IGNORE_ACLS);
-	if (mailbox_autoexpunge(box, autoexpunge, autoexpunge_max_mails,
-				expunged_count) < 0) {
+	if (mailbox_autoexpunge(ctx, box, autoexpunge,
+				autoexpunge_max_mails) < 0) {
 		e_error(box->event, "Failed to autoexpunge: %s",
 			mailbox_get_last_internal_error(box, NULL));
 	}
@@ -187,9 +206,9 @@ mailbox_autoexpunge_set(struct mail_namespace *ns, const char *vname,
 }
 
 static void
-mailbox_autoexpunge_wildcards(struct mail_namespace *ns,
-			      const struct mailbox_settings *set,
-			      unsigned int *expunged_count)
+mailbox_autoexpunge_wildcards(struct mail_autoexpunge_context *ctx,
+			      struct mail_namespace *ns,
+			      const struct mailbox_settings *set)
 {
 	struct mailbox_list_iterate_context *iter;
 	const struct mailbox_info *info;
@@ -200,10 +219,11 @@ mailbox_autoexpunge_wildcards(struct mail_namespace *ns,
 				      MAILBOX_LIST_ITER_NO_AUTO_BOXES |
 				      MAILBOX_LIST_ITER_SKIP_ALIASES |
 				      MAILBOX_LIST_ITER_RETURN_NO_FLAGS);
-	while ((info = mailbox_list_iter_next(iter)) != NULL) T_BEGIN {
-		mailbox_autoexpunge_set(ns, info->vname, set->autoexpunge,
-					set->autoexpunge_max_mails,
-					expunged_count);
+	while (!ctx->lock_busy &&
+	       (info = mailbox_list_iter_next(iter)) != NULL) T_BEGIN {
+		mailbox_autoexpunge_set(ctx, ns, info->vname,
+					set->autoexpunge,
+					set->autoexpunge_max_mails);
 	} T_END;
 	if (mailbox_list_iter_deinit(&iter) < 0) {
 		e_error(ns->user->event,
@@ -213,65 +233,63 @@ mailbox_autoexpunge_wildcards(struct mail_namespace *ns,
 }
 
 static void
-mailbox_autoexpunge_name(struct mail_namespace *ns,
-			 struct mailbox_settings *box_set,
-			 unsigned int *expunged_count)
+mailbox_autoexpunge_name(struct mail_autoexpunge_context *ctx,
+			 struct mail_namespace *ns,
+			 struct mailbox_settings *box_set)
 {
 	const char *vname;
 
 	if (strpbrk(box_set->name, "*?") != NULL)
-		mailbox_autoexpunge_wildcards(ns, box_set, expunged_count);
+		mailbox_autoexpunge_wildcards(ctx, ns, box_set);
 	else {
 		if (box_set->name[0] == '\0' && ns->prefix_len > 0 &&
 		    ns->prefix[ns->prefix_len-1] == mail_namespace_get_sep(ns))
 			vname = t_strndup(ns->prefix, ns->prefix_len - 1);
 		else
 			vname = t_strconcat(ns->prefix, box_set->name, NULL);
-		mailbox_autoexpunge_set(ns, vname, box_set->autoexpunge,
-					box_set->autoexpunge_max_mails,
-					expunged_count);
+		mailbox_autoexpunge_set(ctx, ns, vname, box_set->autoexpunge,
+					box_set->autoexpunge_max_mails);
 	}
 }
 
-static bool
-mail_namespace_autoexpunge(struct mail_namespace *ns, struct file_lock **lock,
-			   unsigned int *expunged_count)
+static void
+mail_namespace_autoexpunge(struct mail_autoexpunge_context *ctx,
+			   struct mail_namespace *ns)
 {
 	struct mailbox_settings *box_set;
 
 	if (!array_is_created(&ns->set->mailboxes))
-		return TRUE;
+		return;
 
 	array_foreach_elem(&ns->set->mailboxes, box_set) {
+		if (ctx->lock_busy)
+			break;
 		if (box_set->autoexpunge == 0 &&
 		    box_set->autoexpunge_max_mails == 0)
 			continue;
 
-		if (!mailbox_autoexpunge_lock(ns->user, lock))
-			return FALSE;
-
 		T_BEGIN {
-			mailbox_autoexpunge_name(ns, box_set, expunged_count);
+			mailbox_autoexpunge_name(ctx, ns, box_set);
 		} T_END;
 	}
-	return TRUE;
 }
 
 unsigned int mail_user_autoexpunge(struct mail_user *user)
 {
-	struct file_lock *lock = NULL;
+	struct mail_autoexpunge_context ctx = {
+		.user = user,
+	};
 	struct mail_namespace *ns;
-	unsigned int expunged_count = 0;
 	struct event_reason *reason =
 		event_reason_begin("storage:autoexpunge");
 
 	for (ns = user->namespaces; ns != NULL; ns = ns->next) {
-		if (ns->alias_for == NULL) {
-			if (!mail_namespace_autoexpunge(ns, &lock, &expunged_count))
-				break;
-		}
+		if (ctx.lock_busy)
+			break;
+		if (ns->alias_for == NULL)
+			mail_namespace_autoexpunge(&ctx, ns);
 	}
 	event_reason_end(&reason);
-	file_lock_free(&lock);
-	return expunged_count;
+	file_lock_free(&ctx.lock);
+	return ctx.expunged_count;
 }
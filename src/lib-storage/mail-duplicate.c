@@ -2,10 +2,15 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "array.h"
+#include "bits.h"
 #include "hex-binary.h"
 #include "mkdir-parents.h"
 #include "istream.h"
 #include "ostream.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "mmap-util.h"
 #include "time-util.h"
 #include "home-expand.h"
 #include "file-create-locked.h"
@@ -22,6 +27,15 @@
 #define COMPRESS_PERCENTAGE 10
 #define DUPLICATE_BUFSIZE 4096
 #define DUPLICATE_VERSION 2
+#define DUPLICATE_TABLE_VERSION 3
+
+/* Minimum number of slots in a table file */
+#define DUPLICATE_TABLE_MIN_SLOTS 64
+/* The table file is rewritten with more slots when more than this percentage
+   of the slots would be in use. */
+#define DUPLICATE_TABLE_MAX_LOAD_PERCENTAGE 75
+/* How often the table file is rewritten to drop the expired records */
+#define DUPLICATE_TABLE_COMPACT_INTERVAL_SECS (24*60*60)
 
 #define DUPLICATE_LOCK_FNAME_PREFIX "duplicate.lock."
 
@@ -66,6 +80,35 @@ struct mail_duplicate_record_header {
 	uint32_t user_size;
 };
 
+/* The table file format is a header followed by an open addressing hash
+   table of fixed size slots, which are looked up and updated in place. */
+struct mail_duplicate_table_header {
+	uint32_t version;
+	uint32_t hdr_size;
+	/* Always a power of 2 */
+	uint32_t slot_count;
+	/* Number of non-empty slots, including the expired ones */
+	uint32_t used_count;
+	/* The file is rewritten without the expired records after this */
+	uint32_t compact_stamp;
+};
+
+struct mail_duplicate_table_slot {
+	/* Expire timestamp, or 0 if the slot is empty */
+	uint32_t stamp;
+	/* MD5 of the ID and the lowercased user */
+	unsigned char key[MD5_RESULTLEN];
+};
+
+struct mail_duplicate_table {
+	int fd;
+	ino_t ino;
+	void *mmap_base;
+	size_t mmap_size;
+
+	struct mail_duplicate_table_header hdr;
+};
+
 struct mail_duplicate_transaction {
 	pool_t pool;
 	struct mail_duplicate_db *db;
@@ -74,6 +117,9 @@ struct mail_duplicate_transaction {
 
 	HASH_TABLE(struct mail_duplicate *, struct mail_duplicate *) hash;
 	const char *path;
+	/* The DB file, if it's in the table format. Otherwise the records
+	   are read into the hash. */
+	struct mail_duplicate_table *table;
 	unsigned int id_lock_count;
 
 	bool changed:1;
@@ -85,6 +131,7 @@ struct mail_duplicate_db {
 	char *path;
 	char *lock_dir;
 	struct dotlock_settings dotlock_set;
+	bool mmap_disable;
 
 	unsigned int transaction_count;
 };
@@ -247,6 +294,362 @@ mail_duplicate_unlock(struct mail_duplicate_transaction *trans,
 	errno = orig_errno;
 }
 
+static void
+mail_duplicate_get_key(const struct mail_duplicate *dup,
+		       unsigned char key_r[STATIC_ARRAY MD5_RESULTLEN])
+{
+	struct md5_context ctx;
+	uint32_t id_size = dup->id_size;
+
+	md5_init(&ctx);
+	md5_update(&ctx, &id_size, sizeof(id_size));
+	md5_update(&ctx, dup->id, dup->id_size);
+	T_BEGIN {
+		const char *user = t_str_lcase(dup->user);
+		md5_update(&ctx, user, strlen(user));
+	} T_END;
+	md5_final(&ctx, key_r);
+}
+
+static void
+mail_duplicate_table_close(struct mail_duplicate_transaction *trans,
+			   struct mail_duplicate_table **_table)
+{
+	struct mail_duplicate_table *table = *_table;
+
+	if (table == NULL)
+		return;
+	*_table = NULL;
+
+	if (table->mmap_base != NULL &&
+	    munmap(table->mmap_base, table->mmap_size) < 0)
+		e_error(trans->event, "munmap(%s) failed: %m", trans->path);
+	i_close_fd(&table->fd);
+	i_free(table);
+}
+
+/* Returns 1 if the file is in the table format, 0 if it's in the older
+   format, -1 if it's broken and was deleted or on I/O error. On success the
+   table takes over the fd. */
+static int
+mail_duplicate_table_open(struct mail_duplicate_transaction *trans, int fd,
+			  bool use_mmap, struct mail_duplicate_table **table_r)
+{
+	struct mail_duplicate_table *table;
+	struct mail_duplicate_table_header hdr;
+	struct stat st;
+	int ret;
+
+	if (fstat(fd, &st) < 0) {
+		e_error(trans->event, "fstat(%s) failed: %m", trans->path);
+		return -1;
+	}
+	ret = pread_full(fd, &hdr, sizeof(hdr), 0);
+	if (ret < 0) {
+		e_error(trans->event, "pread(%s) failed: %m", trans->path);
+		return -1;
+	}
+	if (ret == 0 || hdr.version != DUPLICATE_TABLE_VERSION)
+		return 0;
+
+	if (hdr.hdr_size < sizeof(hdr) || hdr.slot_count == 0 ||
+	    (hdr.slot_count & (hdr.slot_count - 1)) != 0 ||
+	    (uoff_t)st.st_size < hdr.hdr_size + (uoff_t)hdr.slot_count *
+	    sizeof(struct mail_duplicate_table_slot)) {
+		e_error(trans->event,
+			"broken mail_duplicate file %s", trans->path);
+		i_unlink_if_exists(trans->path);
+		return -1;
+	}
+
+	table = i_new(struct mail_duplicate_table, 1);
+	table->fd = fd;
+	table->ino = st.st_ino;
+	table->hdr = hdr;
+	if (use_mmap) {
+		table->mmap_base = mmap_ro_file(fd, &table->mmap_size);
+		if (table->mmap_base == MAP_FAILED) {
+			/* fall back to pread() */
+			e_error(trans->event, "mmap(%s) failed: %m",
+				trans->path);
+			table->mmap_base = NULL;
+		}
+	}
+	*table_r = table;
+	return 1;
+}
+
+static int
+mail_duplicate_table_read(struct mail_duplicate_transaction *trans,
+			  struct mail_duplicate_table *table,
+			  uoff_t offset, void *data, size_t size)
+{
+	int ret;
+
+	if (table->mmap_base != NULL) {
+		if (offset + size > table->mmap_size) {
+			e_error(trans->event,
+				"mail_duplicate file %s was truncated",
+				trans->path);
+			return -1;
+		}
+		memcpy(data, CONST_PTR_OFFSET(table->mmap_base, offset), size);
+		return 0;
+	}
+
+	ret = pread_full(table->fd, data, size, offset);
+	if (ret < 0) {
+		e_error(trans->event, "pread(%s) failed: %m", trans->path);
+		return -1;
+	}
+	if (ret == 0) {
+		e_error(trans->event,
+			"mail_duplicate file %s was truncated", trans->path);
+		return -1;
+	}
+	return 0;
+}
+
+static uoff_t
+mail_duplicate_table_slot_offset(struct mail_duplicate_table *table,
+				 unsigned int idx)
+{
+	return table->hdr.hdr_size +
+		(uoff_t)idx * sizeof(struct mail_duplicate_table_slot);
+}
+
+/* Returns 1 if the key was found, 0 if not, -1 on error. The found slot is
+   returned in slot_r. If the key wasn't found, idx_r is set to the slot where
+   it can be added, or UINT_MAX if there's no space. */
+static int
+mail_duplicate_table_lookup(struct mail_duplicate_transaction *trans,
+			    struct mail_duplicate_table *table,
+			    const unsigned char key[STATIC_ARRAY MD5_RESULTLEN],
+			    unsigned int *idx_r,
+			    struct mail_duplicate_table_slot *slot_r)
+{
+	unsigned int mask = table->hdr.slot_count - 1;
+	unsigned int i, idx, free_idx = UINT_MAX;
+	uint32_t hash;
+
+	memcpy(&hash, key, sizeof(hash));
+	idx = hash & mask;
+	for (i = 0; i < table->hdr.slot_count; i++) {
+		if (mail_duplicate_table_read(trans, table,
+				mail_duplicate_table_slot_offset(table, idx),
+				slot_r, sizeof(*slot_r)) < 0)
+			return -1;
+		if (slot_r->stamp == 0) {
+			*idx_r = free_idx != UINT_MAX ? free_idx : idx;
+			return 0;
+		}
+		if (memcmp(slot_r->key, key, MD5_RESULTLEN) == 0) {
+			*idx_r = idx;
+			return 1;
+		}
+		if (free_idx == UINT_MAX && (time_t)slot_r->stamp < ioloop_time) {
+			/* expired - can be reused */
+			free_idx = idx;
+		}
+		idx = (idx + 1) & mask;
+	}
+	*idx_r = free_idx;
+	return 0;
+}
+
+static void
+mail_duplicate_table_check(struct mail_duplicate_transaction *trans,
+			   struct mail_duplicate *dup)
+{
+	struct mail_duplicate_table_slot slot;
+	unsigned char key[MD5_RESULTLEN];
+	unsigned int idx;
+
+	mail_duplicate_get_key(dup, key);
+	if (mail_duplicate_table_lookup(trans, trans->table, key,
+					&idx, &slot) > 0 &&
+	    (time_t)slot.stamp >= ioloop_time) {
+		dup->marked = TRUE;
+		dup->time = slot.stamp;
+	} else {
+		dup->marked = FALSE;
+	}
+}
+
+/* Write the changed records into the existing table file. Returns 1 if done,
+   0 if the file needs to be rewritten instead, -1 on error. */
+static int
+mail_duplicate_table_update(struct mail_duplicate_transaction *trans,
+			    struct mail_duplicate_table *table)
+{
+	struct hash_iterate_context *iter;
+	struct mail_duplicate_table_slot slot;
+	struct mail_duplicate *d;
+	unsigned char key[MD5_RESULTLEN];
+	unsigned int idx, changed_count = 0;
+	uint32_t used_count = table->hdr.used_count;
+	int ret = 1;
+
+	if ((time_t)table->hdr.compact_stamp <= ioloop_time) {
+		e_debug(trans->event, "Compressing expired records");
+		return 0;
+	}
+
+	iter = hash_table_iterate_init(trans->hash);
+	while (hash_table_iterate(iter, trans->hash, &d, &d)) {
+		if (d->changed)
+			changed_count++;
+	}
+	hash_table_iterate_deinit(&iter);
+	if ((uint64_t)(used_count + changed_count) * 100 >
+	    (uint64_t)table->hdr.slot_count *
+	    DUPLICATE_TABLE_MAX_LOAD_PERCENTAGE) {
+		e_debug(trans->event, "Growing table");
+		return 0;
+	}
+
+	iter = hash_table_iterate_init(trans->hash);
+	while (ret > 0 && hash_table_iterate(iter, trans->hash, &d, &d)) {
+		if (!d->changed)
+			continue;
+
+		mail_duplicate_get_key(d, key);
+		ret = mail_duplicate_table_lookup(trans, table, key,
+						  &idx, &slot);
+		if (ret < 0)
+			break;
+		if (ret == 0) {
+			if (idx == UINT_MAX)
+				break;
+			if (mail_duplicate_table_read(trans, table,
+					mail_duplicate_table_slot_offset(table, idx),
+					&slot, sizeof(slot)) < 0) {
+				ret = -1;
+				break;
+			}
+			if (slot.stamp == 0)
+				used_count++;
+			memcpy(slot.key, key, sizeof(slot.key));
+		}
+		slot.stamp = time_to_uint32_trunc(d->time);
+		if (pwrite_full(table->fd, &slot, sizeof(slot),
+				mail_duplicate_table_slot_offset(table, idx)) < 0) {
+			e_error(trans->event, "pwrite(%s) failed: %m",
+				trans->path);
+			ret = -1;
+			break;
+		}
+		ret = 1;
+	}
+	hash_table_iterate_deinit(&iter);
+
+	if (used_count != table->hdr.used_count) {
+		table->hdr.used_count = used_count;
+		if (pwrite_full(table->fd, &table->hdr.used_count,
+				sizeof(table->hdr.used_count),
+				offsetof(struct mail_duplicate_table_header,
+					 used_count)) < 0) {
+			e_error(trans->event, "pwrite(%s) failed: %m",
+				trans->path);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static void
+mail_duplicate_table_insert(struct mail_duplicate_table_slot *slots,
+			    unsigned int slot_count,
+			    const struct mail_duplicate_table_slot *slot)
+{
+	unsigned int mask = slot_count - 1;
+	unsigned int idx;
+	uint32_t hash;
+
+	memcpy(&hash, slot->key, sizeof(hash));
+	idx = hash & mask;
+	while (slots[idx].stamp != 0 &&
+	       memcmp(slots[idx].key, slot->key, MD5_RESULTLEN) != 0)
+		idx = (idx + 1) & mask;
+	slots[idx] = *slot;
+}
+
+/* Write a new table file with all the non-expired records. */
+static int
+mail_duplicate_table_write(struct mail_duplicate_transaction *trans,
+			   struct mail_duplicate_table *old_table, int fd)
+{
+	ARRAY(struct mail_duplicate_table_slot) records;
+	struct mail_duplicate_table_header hdr;
+	struct mail_duplicate_table_slot *slots, slot;
+	const struct mail_duplicate_table_slot *record;
+	struct hash_iterate_context *iter;
+	struct mail_duplicate *d;
+	struct ostream *output;
+	unsigned int i, slot_count;
+	int ret = 0;
+
+	i_array_init(&records, 128);
+	if (old_table != NULL) {
+		size_t size = old_table->hdr.slot_count * sizeof(slot);
+
+		slots = i_malloc(size);
+		if (mail_duplicate_table_read(trans, old_table,
+				mail_duplicate_table_slot_offset(old_table, 0),
+				slots, size) == 0) {
+			for (i = 0; i < old_table->hdr.slot_count; i++) {
+				if (slots[i].stamp != 0 &&
+				    (time_t)slots[i].stamp >= ioloop_time)
+					array_push_back(&records, &slots[i]);
+			}
+		}
+		i_free(slots);
+	}
+	/* Without an old table file the hash has all the records read from
+	   the older format file. Otherwise it has only the changes. */
+	iter = hash_table_iterate_init(trans->hash);
+	while (hash_table_iterate(iter, trans->hash, &d, &d)) {
+		if (d->changed || (old_table == NULL && d->marked &&
+				   d->time >= ioloop_time)) {
+			mail_duplicate_get_key(d, slot.key);
+			slot.stamp = time_to_uint32_trunc(d->time);
+			array_push_back(&records, &slot);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+
+	slot_count = nearest_power(I_MAX(array_count(&records) * 2,
+					 DUPLICATE_TABLE_MIN_SLOTS));
+	slots = i_new(struct mail_duplicate_table_slot, slot_count);
+	array_foreach(&records, record)
+		mail_duplicate_table_insert(slots, slot_count, record);
+	array_free(&records);
+
+	i_zero(&hdr);
+	hdr.version = DUPLICATE_TABLE_VERSION;
+	hdr.hdr_size = sizeof(hdr);
+	hdr.slot_count = slot_count;
+	for (i = 0; i < slot_count; i++) {
+		if (slots[i].stamp != 0)
+			hdr.used_count++;
+	}
+	hdr.compact_stamp = time_to_uint32_trunc(ioloop_time +
+		DUPLICATE_TABLE_COMPACT_INTERVAL_SECS);
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(output);
+	o_stream_nsend(output, &hdr, sizeof(hdr));
+	o_stream_nsend(output, slots, slot_count * sizeof(*slots));
+	if (o_stream_finish(output) < 0) {
+		e_error(trans->event, "write(%s) failed: %s",
+			trans->path, o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_unref(&output);
+	i_free(slots);
+	return ret;
+}
+
 static int
 mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 			    struct istream *input,
@@ -396,7 +799,8 @@ static int mail_duplicate_read_db_file(struct mail_duplicate_transaction *trans)
 	return ret;
 }
 
-static void mail_duplicate_read(struct mail_duplicate_transaction *trans)
+static void
+mail_duplicate_read_legacy(struct mail_duplicate_transaction *trans)
 {
 	struct mail_duplicate_db *db = trans->db;
 	int new_fd;
@@ -420,6 +824,33 @@ static void mail_duplicate_read(struct mail_duplicate_transaction *trans)
 		file_dotlock_delete(&dotlock);
 }
 
+static void mail_duplicate_read(struct mail_duplicate_transaction *trans)
+{
+	int fd, ret;
+
+	i_assert(trans->table == NULL);
+
+	fd = open(trans->path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(trans->event,
+				"open(%s) failed: %m", trans->path);
+		}
+		return;
+	}
+	ret = mail_duplicate_table_open(trans, fd, !trans->db->mmap_disable,
+					&trans->table);
+	if (ret > 0) {
+		/* records are looked up from the table only when needed */
+		e_debug(trans->event, "Opened %s", trans->path);
+		trans->db_ino = trans->table->ino;
+		return;
+	}
+	i_close_fd(&fd);
+	if (ret == 0)
+		mail_duplicate_read_legacy(trans);
+}
+
 static void mail_duplicate_update(struct mail_duplicate_transaction *trans)
 {
 	struct stat st;
@@ -437,6 +868,7 @@ static void mail_duplicate_update(struct mail_duplicate_transaction *trans)
 		e_debug(trans->event, "DB file changed: "
 			"Updating duplicate records from DB file");
 
+		mail_duplicate_table_close(trans, &trans->table);
 		mail_duplicate_read(trans);
 	}
 }
@@ -499,6 +931,7 @@ mail_duplicate_transaction_free(struct mail_duplicate_transaction **_trans)
 		hash_table_destroy(&trans->hash);
 	}
 	i_assert(trans->id_lock_count == 0);
+	mail_duplicate_table_close(trans, &trans->table);
 
 	event_unref(&trans->event);
 	pool_unref(&trans->pool);
@@ -564,6 +997,8 @@ mail_duplicate_check(struct mail_duplicate_transaction *trans,
 	}
 
 	mail_duplicate_update(trans);
+	if (trans->table != NULL && !dup->changed)
+		mail_duplicate_table_check(trans, dup);
 	if (dup->marked) {
 		e_debug(trans->event, "Check ID: found");
 		return MAIL_DUPLICATE_CHECK_RESULT_EXISTS;
@@ -603,12 +1038,10 @@ void mail_duplicate_transaction_commit(
 	struct mail_duplicate_transaction **_trans)
 {
 	struct mail_duplicate_transaction *trans = *_trans;
-	struct mail_duplicate_file_header hdr;
-	struct mail_duplicate_record_header rec;
-	struct ostream *output;
-        struct hash_iterate_context *iter;
+	struct mail_duplicate_table *table = NULL;
+	struct hash_iterate_context *iter;
 	struct mail_duplicate *d;
-	int new_fd;
+	int fd, new_fd;
 	struct dotlock *dotlock;
 
 	if (trans == NULL)
@@ -629,7 +1062,7 @@ void mail_duplicate_transaction_commit(
 	struct mail_duplicate_db *db = trans->db;
 
 	i_assert(trans->path != NULL);
-	e_debug(trans->event, "Commit; overwrite %s", trans->path);
+	e_debug(trans->event, "Commit; update %s", trans->path);
 
 	new_fd = file_dotlock_open(&db->dotlock_set, trans->path, 0, &dotlock);
 	if (new_fd != -1)
@@ -648,41 +1081,27 @@ void mail_duplicate_transaction_commit(
 		return;
 	}
 
-	i_zero(&hdr);
-	hdr.version = DUPLICATE_VERSION;
-
-	output = o_stream_create_fd_file(new_fd, 0, FALSE);
-	o_stream_cork(output);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	i_zero(&rec);
-	iter = hash_table_iterate_init(trans->hash);
-	while (hash_table_iterate(iter, trans->hash, &d, &d)) {
-		if (d->marked) {
-			rec.stamp = time_to_uint32_trunc(d->time);
-			rec.id_size = d->id_size;
-			rec.user_size = strlen(d->user);
-
-			o_stream_nsend(output, &rec, sizeof(rec));
-			o_stream_nsend(output, d->id, rec.id_size);
-			o_stream_nsend(output, d->user, rec.user_size);
+	/* Update the table file in place if possible. Otherwise (e.g. the
+	   file is still in the older format) write a new one. */
+	fd = open(trans->path, O_RDWR);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(trans->event,
+				"open(%s) failed: %m", trans->path);
 		}
+	} else if (mail_duplicate_table_open(trans, fd, FALSE, &table) <= 0) {
+		i_close_fd(&fd);
 	}
-	hash_table_iterate_deinit(&iter);
 
-	if (o_stream_finish(output) < 0) {
-		e_error(trans->event, "write(%s) failed: %s",
-			trans->path, o_stream_get_error(output));
-		o_stream_unref(&output);
-		mail_duplicate_transaction_free(&trans);
-		return;
-	}
-	o_stream_unref(&output);
-
-	if (file_dotlock_replace(&dotlock, 0) < 0) {
+	if (table != NULL && mail_duplicate_table_update(trans, table) > 0)
+		file_dotlock_delete(&dotlock);
+	else if (mail_duplicate_table_write(trans, table, new_fd) < 0)
+		file_dotlock_delete(&dotlock);
+	else if (file_dotlock_replace(&dotlock, 0) < 0) {
 		e_error(trans->event,
 			"file_dotlock_replace(%s) failed: %m", trans->path);
 	}
+	mail_duplicate_table_close(trans, &table);
 
 	iter = hash_table_iterate_init(trans->hash);
 	while (hash_table_iterate(iter, trans->hash, &d, &d))
@@ -746,6 +1165,7 @@ mail_duplicate_db_init(struct mail_user *user, const char *name)
 	mail_set = mail_user_set_get_storage_set(user);
 	db->dotlock_set.use_excl_lock = mail_set->dotlock_use_excl;
 	db->dotlock_set.nfs_flush = mail_set->mail_nfs_storage;
+	db->mmap_disable = mail_set->mmap_disable;
 
 	return db;
 }
@@ -123,6 +123,7 @@ struct mail_binary_cache {
 	bool include_hdr;
 	struct istream *input;
 	uoff_t size;
+	unsigned int lines;
 };
 
 struct mail_storage_error {
@@ -460,6 +461,9 @@ struct mailbox {
 
 	/* Saved search results */
 	ARRAY(struct mail_search_result *) search_results;
+	/* Search results kept for answering repeated searches, oldest first.
+	   These are also in search_results, so syncing keeps them updated. */
+	ARRAY(struct mail_search_result *) search_result_cache;
 
 	/* Module-specific contexts. See mail_storage_module_id. */
 	ARRAY(union mailbox_module_context *) module_contexts;
@@ -665,6 +669,9 @@ struct mailbox_transaction_context {
 	uint32_t highest_pop3_uidl_uid;
 
 	struct mail_save_context *save_ctx;
+	/* Mapping of the copy source mailbox's cache fields to this
+	   mailbox's cache fields. Used by index_copy_cache_fields(). */
+	struct index_copy_cache_map *copy_cache_map;
 	/* number of mails saved/copied within this transaction. */
 	unsigned int save_count;
 	/* List of private flags added with save/copy. These are added to the
@@ -910,6 +917,11 @@ enum mail_index_open_flags
 mail_storage_settings_to_index_flags(const struct mail_storage_settings *set);
 void mailbox_save_context_deinit(struct mail_save_context *ctx);
 
+/* Track the time spent in a storage operation. Nested calls for the same
+   type are counted only once. */
+void mail_storage_timing_start(enum mail_storage_timing_type type);
+void mail_storage_timing_end(enum mail_storage_timing_type type);
+
 /* Notify that a sync should be done. */
 void mailbox_sync_notify(struct mailbox *box, uint32_t uid,
 			 enum mailbox_sync_type sync_type);
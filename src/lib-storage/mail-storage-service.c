@@ -4,12 +4,14 @@
 #include "ioloop.h"
 #include "array.h"
 #include "base64.h"
+#include "hash.h"
 #include "hostpid.h"
 #include "module-dir.h"
 #include "restrict-access.h"
 #include "eacces-error.h"
 #include "ipwd.h"
 #include "str.h"
+#include "strescape.h"
 #include "time-util.h"
 #include "sleep.h"
 #include "var-expand.h"
@@ -39,6 +41,13 @@
 #define MAX_TIME_BACKWARDS_SLEEP_MSECS  (5*1000)
 #define MAX_NOWARN_FORWARD_MSECS        (10*1000)
 
+/* Maximum number of users' settings to keep cached */
+#define MAIL_STORAGE_SERVICE_USER_CACHE_MAX_COUNT 16
+/* Settings are cached only after the same userdb fields have been seen
+   within this many latest lookups. This avoids the extra work of caching
+   when each lookup is for a different user, e.g. with doveadm -A. */
+#define MAIL_STORAGE_SERVICE_USER_CACHE_SEEN_COUNT 64
+
 struct mail_storage_service_privileges {
 	uid_t uid;
 	gid_t gid;
@@ -48,6 +57,24 @@ struct mail_storage_service_privileges {
 	const char *chroot;
 };
 
+struct mail_storage_service_user_cache_entry {
+	pool_t pool;
+	unsigned int key_hash;
+	const char *key;
+
+	/* The settings that the userdb fields were applied to. Referenced
+	   only so that the pointer can't be reused by another parser. */
+	struct setting_parser_context *unexpanded_set_parser;
+	/* The checked settings after applying the userdb fields */
+	struct setting_parser_context *set_parser;
+
+	const char *system_groups_user, *uid_source, *gid_source;
+	const char *chdir_path, *auth_mech, *auth_token, *auth_user;
+	bool anonymous:1;
+	bool admin:1;
+	bool home_from_userdb:1;
+};
+
 struct mail_storage_service_ctx {
 	pool_t pool;
 	struct master_service *service;
@@ -61,6 +88,11 @@ struct mail_storage_service_ctx {
 	pool_t userdb_next_pool;
 	const char *const **userdb_next_fieldsp;
 
+	/* Most recently used first */
+	ARRAY(struct mail_storage_service_user_cache_entry *) user_cache;
+	unsigned int user_cache_seen[MAIL_STORAGE_SERVICE_USER_CACHE_SEEN_COUNT];
+	unsigned int user_cache_seen_idx;
+
 	bool debug:1;
 	bool log_initialized:1;
 	bool config_permission_denied:1;
@@ -91,6 +123,8 @@ struct mail_storage_service_user {
 	bool admin:1;
 	bool master_service_user_set:1;
 	bool home_from_userdb:1;
+	/* set_parser is shared with a user cache entry */
+	bool set_parser_shared:1;
 };
 
 struct module *mail_storage_service_modules = NULL;
@@ -1221,6 +1255,195 @@ mail_storage_service_generate_session_id(pool_t pool, const char *prefix)
 
 }
 
+static const char *
+mail_storage_service_user_cache_key(struct mail_storage_service_ctx *ctx,
+				    enum mail_storage_service_flags flags,
+				    const char *const *userdb_fields)
+{
+	string_t *key = t_str_new(256);
+
+	str_printfa(key, "%x\t%x", ctx->flags, flags);
+	for (; userdb_fields != NULL && *userdb_fields != NULL; userdb_fields++) {
+		/* nice is applied to the process while handling the userdb
+		   reply, so it can't be skipped. */
+		if (str_begins_with(*userdb_fields, "nice="))
+			return NULL;
+		str_append_c(key, '\t');
+		str_append_tabescaped(key, *userdb_fields);
+	}
+	return str_c(key);
+}
+
+static void
+mail_storage_service_user_cache_entry_free(
+	struct mail_storage_service_user_cache_entry **_entry)
+{
+	struct mail_storage_service_user_cache_entry *entry = *_entry;
+	pool_t pool = entry->pool;
+
+	*_entry = NULL;
+	settings_parser_unref(&entry->set_parser);
+	settings_parser_unref(&entry->unexpanded_set_parser);
+	pool_unref(&pool);
+}
+
+static struct mail_storage_service_user_cache_entry *
+mail_storage_service_user_cache_lookup(struct mail_storage_service_ctx *ctx,
+				       struct setting_parser_context *set_parser,
+				       const char *key)
+{
+	struct mail_storage_service_user_cache_entry *entry;
+	unsigned int i, count, key_hash;
+
+	if (key == NULL || !array_is_created(&ctx->user_cache))
+		return NULL;
+
+	key_hash = str_hash(key);
+	count = array_count(&ctx->user_cache);
+	for (i = 0; i < count; i++) {
+		entry = array_idx_elem(&ctx->user_cache, i);
+		if (entry->key_hash == key_hash &&
+		    entry->unexpanded_set_parser == set_parser &&
+		    strcmp(entry->key, key) == 0)
+			break;
+	}
+	if (i == count)
+		return NULL;
+
+	/* move to the front */
+	array_delete(&ctx->user_cache, i, 1);
+	array_push_front(&ctx->user_cache, &entry);
+	return entry;
+}
+
+static void
+mail_storage_service_user_cache_apply(
+	const struct mail_storage_service_user_cache_entry *entry,
+	struct mail_storage_service_user *user)
+{
+	user->set_parser = entry->set_parser;
+	settings_parser_ref(user->set_parser);
+	user->set_parser_shared = TRUE;
+
+	user->system_groups_user = entry->system_groups_user;
+	user->uid_source = entry->uid_source;
+	user->gid_source = entry->gid_source;
+	user->chdir_path = entry->chdir_path;
+	user->auth_mech = entry->auth_mech;
+	user->auth_token = entry->auth_token;
+	user->auth_user = entry->auth_user;
+	user->anonymous = entry->anonymous;
+	user->admin = entry->admin;
+	user->home_from_userdb = entry->home_from_userdb;
+}
+
+static bool
+mail_storage_service_user_cache_seen(struct mail_storage_service_ctx *ctx,
+				     unsigned int key_hash)
+{
+	for (unsigned int i = 0; i < N_ELEMENTS(ctx->user_cache_seen); i++) {
+		if (ctx->user_cache_seen[i] == key_hash)
+			return TRUE;
+	}
+	ctx->user_cache_seen[ctx->user_cache_seen_idx] = key_hash;
+	ctx->user_cache_seen_idx = (ctx->user_cache_seen_idx + 1) %
+		N_ELEMENTS(ctx->user_cache_seen);
+	return FALSE;
+}
+
+static void
+mail_storage_service_user_cache_add(struct mail_storage_service_ctx *ctx,
+				    struct setting_parser_context *set_parser,
+				    const char *key,
+				    const struct mail_storage_service_user *user)
+{
+	struct mail_storage_service_user_cache_entry *entry;
+	const char *error;
+	unsigned int key_hash;
+	pool_t pool;
+
+	if (key == NULL)
+		return;
+	key_hash = str_hash(key);
+	if (!mail_storage_service_user_cache_seen(ctx, key_hash))
+		return;
+
+	pool = pool_alloconly_create(MEMPOOL_GROWING"mail storage service user cache",
+				     1024*6);
+	entry = p_new(pool, struct mail_storage_service_user_cache_entry, 1);
+	entry->pool = pool;
+	entry->key_hash = key_hash;
+	entry->key = p_strdup(pool, key);
+	/* settings_parser_dup() copies only the settings, so the parsed
+	   fields must be filled by checking the settings again. */
+	entry->set_parser = settings_parser_dup(user->set_parser, pool);
+	if (!settings_parser_check(entry->set_parser, pool, &error)) {
+		settings_parser_unref(&entry->set_parser);
+		pool_unref(&pool);
+		return;
+	}
+	entry->unexpanded_set_parser = set_parser;
+	settings_parser_ref(entry->unexpanded_set_parser);
+
+	entry->system_groups_user = p_strdup(pool, user->system_groups_user);
+	entry->uid_source = user->uid_source;
+	entry->gid_source = user->gid_source;
+	entry->chdir_path = p_strdup(pool, user->chdir_path);
+	entry->auth_mech = p_strdup(pool, user->auth_mech);
+	entry->auth_token = p_strdup(pool, user->auth_token);
+	entry->auth_user = p_strdup(pool, user->auth_user);
+	entry->anonymous = user->anonymous;
+	entry->admin = user->admin;
+	entry->home_from_userdb = user->home_from_userdb;
+
+	if (!array_is_created(&ctx->user_cache)) {
+		i_array_init(&ctx->user_cache,
+			     MAIL_STORAGE_SERVICE_USER_CACHE_MAX_COUNT);
+	} else if (array_count(&ctx->user_cache) >=
+		   MAIL_STORAGE_SERVICE_USER_CACHE_MAX_COUNT) {
+		struct mail_storage_service_user_cache_entry *old_entry =
+			array_idx_elem(&ctx->user_cache,
+				       array_count(&ctx->user_cache) - 1);
+		array_pop_back(&ctx->user_cache);
+		mail_storage_service_user_cache_entry_free(&old_entry);
+	}
+	array_push_front(&ctx->user_cache, &entry);
+}
+
+static void
+mail_storage_service_user_cache_deinit(struct mail_storage_service_ctx *ctx)
+{
+	struct mail_storage_service_user_cache_entry *entry;
+
+	if (!array_is_created(&ctx->user_cache))
+		return;
+	array_foreach_elem(&ctx->user_cache, entry)
+		mail_storage_service_user_cache_entry_free(&entry);
+	array_free(&ctx->user_cache);
+}
+
+static void
+mail_storage_service_user_unshare_set(struct mail_storage_service_user *user)
+{
+	struct setting_parser_context *set_parser;
+	const char *error;
+
+	if (!user->set_parser_shared)
+		return;
+
+	/* the settings are about to be modified - get a private copy */
+	set_parser = settings_parser_dup(user->set_parser, user->pool);
+	if (!settings_parser_check(set_parser, user->pool, &error))
+		i_panic("Cached user settings check unexpectedly failed: %s", error);
+	settings_parser_unref(&user->set_parser);
+	user->set_parser = set_parser;
+	user->user_set = settings_parser_get_root_set(user->set_parser,
+				&mail_user_setting_parser_info);
+	user->ssl_set = settings_parser_get_root_set(user->set_parser,
+				&master_service_ssl_setting_parser_info);
+	user->set_parser_shared = FALSE;
+}
+
 static int
 mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 				 const struct mail_storage_service_input *input,
@@ -1347,19 +1570,31 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 	user->input.session_create_time = input->session_create_time;
 	user->flags = flags;
 
-	user->set_parser = settings_parser_dup(set_parser, user_pool);
-
+	const char *cache_key =
+		mail_storage_service_user_cache_key(ctx, flags, userdb_fields);
+	const struct mail_storage_service_user_cache_entry *cache_entry =
+		mail_storage_service_user_cache_lookup(ctx, set_parser,
+						       cache_key);
+	if (cache_entry != NULL) {
+		/* the same userdb fields were already applied to the same
+		   settings - skip applying and checking them again */
+		mail_storage_service_user_cache_apply(cache_entry, user);
+		e_debug(event, "Using cached settings for userdb fields");
+	} else {
+		user->set_parser = settings_parser_dup(set_parser, user_pool);
+		user->gid_source = "mail_gid setting";
+		user->uid_source = "mail_uid setting";
+	}
 	user->user_set = settings_parser_get_root_set(user->set_parser,
 				&mail_user_setting_parser_info);
 	user->ssl_set = settings_parser_get_root_set(user->set_parser,
 				&master_service_ssl_setting_parser_info);
-	user->gid_source = "mail_gid setting";
-	user->uid_source = "mail_uid setting";
 
-	if ((flags & MAIL_STORAGE_SERVICE_FLAG_DEBUG) != 0)
+	if (cache_entry == NULL &&
+	    (flags & MAIL_STORAGE_SERVICE_FLAG_DEBUG) != 0)
 		(void)settings_parse_line(user->set_parser, "mail_debug=yes");
 
-	if (userdb_fields != NULL) {
+	if (cache_entry == NULL && userdb_fields != NULL) {
 		int ret2 = auth_user_fields_parse(userdb_fields, temp_pool,
 						  &reply, &error);
 		if (ret2 == 0) {
@@ -1373,7 +1608,8 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 			ret = -2;
 		}
 	}
-	if (ret > 0 && !settings_parser_check(user->set_parser, user_pool, &error)) {
+	if (ret > 0 && cache_entry == NULL &&
+	    !settings_parser_check(user->set_parser, user_pool, &error)) {
 		*error_r = t_strdup_printf(
 			"Invalid settings (probably caused by userdb): %s", error);
 		ret = -2;
@@ -1388,7 +1624,8 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 			ret = -2;
 		}
 	}
-	if ((ctx->flags & MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS) != 0 &&
+	if (cache_entry == NULL &&
+	    (ctx->flags & MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS) != 0 &&
 	    user_set->mail_plugins[0] != '\0') {
 		/* mail_storage_service_load_modules() already avoids loading
 		   plugins when the _NO_PLUGINS flag is set. However, it's
@@ -1401,6 +1638,10 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 		   to do this is just to clear out the mail_plugins setting: */
 		(void)settings_parse_line(user->set_parser, "mail_plugins=");
 	}
+	if (ret > 0 && cache_entry == NULL) {
+		mail_storage_service_user_cache_add(ctx, set_parser,
+						    cache_key, user);
+	}
 
 	if (ret < 0)
 		mail_storage_service_user_unref(&user);
@@ -1733,6 +1974,7 @@ void mail_storage_service_deinit(struct mail_storage_service_ctx **_ctx)
 
 	*_ctx = NULL;
 	(void)mail_storage_service_all_iter_deinit(ctx);
+	mail_storage_service_user_cache_deinit(ctx);
 	if (ctx->conn != NULL) {
 		if (mail_user_auth_master_conn == ctx->conn)
 			mail_user_auth_master_conn = NULL;
@@ -1768,6 +2010,8 @@ mail_storage_service_user_get_input(struct mail_storage_service_user *user)
 struct setting_parser_context *
 mail_storage_service_user_get_settings_parser(struct mail_storage_service_user *user)
 {
+	/* the caller may modify the settings */
+	mail_storage_service_user_unshare_set(user);
 	return user->set_parser;
 }
 
@@ -1793,6 +2037,7 @@ int mail_storage_service_user_set_setting(struct mail_storage_service_user *user
 					  const char *value,
 					  const char **error_r)
 {
+	mail_storage_service_user_unshare_set(user);
 	int ret = settings_parse_keyvalue(user->set_parser, key, value);
 	*error_r = settings_parser_get_error(user->set_parser);
 	return ret;
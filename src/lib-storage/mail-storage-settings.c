@@ -61,6 +61,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(TIME_HIDDEN, mail_index_log_rotate_min_age),
 	DEF(TIME_HIDDEN, mail_index_log2_max_age),
 	DEF(TIME, mailbox_idle_check_interval),
+	DEF(STR, mailbox_notify_socket_path),
 	DEF(UINT, mail_max_keyword_length),
 	DEF(TIME, mail_max_lock_timeout),
 	DEF(TIME, mail_temp_scan_interval),
@@ -119,6 +120,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_index_log_rotate_min_age = 5 * 60,
 	.mail_index_log2_max_age = 3600 * 24 * 2,
 	.mailbox_idle_check_interval = 30,
+	.mailbox_notify_socket_path = "",
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
 	.mail_temp_scan_interval = 7*24*60*60,
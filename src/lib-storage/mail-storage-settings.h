@@ -41,6 +41,7 @@ struct mail_storage_settings {
 	unsigned int mail_index_log_rotate_min_age;
 	unsigned int mail_index_log2_max_age;
 	unsigned int mailbox_idle_check_interval;
+	const char *mailbox_notify_socket_path;
 	unsigned int mail_max_keyword_length;
 	unsigned int mail_max_lock_timeout;
 	unsigned int mail_temp_scan_interval;
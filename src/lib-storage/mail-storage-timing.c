@@ -0,0 +1,60 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "time-util.h"
+#include "mail-storage-private.h"
+
+struct mail_storage_timing {
+	/* number of nested _start() calls */
+	unsigned int depth;
+	struct timeval start;
+	uint64_t total_usecs;
+};
+
+static bool mail_storage_timing_enabled = FALSE;
+static struct mail_storage_timing timings[MAIL_STORAGE_TIMING_COUNT];
+
+void mail_storage_timing_enable(void)
+{
+	mail_storage_timing_enabled = TRUE;
+}
+
+bool mail_storage_timing_is_enabled(void)
+{
+	return mail_storage_timing_enabled;
+}
+
+uint64_t mail_storage_timing_get_total_usecs(enum mail_storage_timing_type type)
+{
+	i_assert(type < MAIL_STORAGE_TIMING_COUNT);
+	return timings[type].total_usecs;
+}
+
+void mail_storage_timing_start(enum mail_storage_timing_type type)
+{
+	struct mail_storage_timing *timing = &timings[type];
+
+	if (!mail_storage_timing_enabled)
+		return;
+	if (timing->depth++ == 0)
+		i_gettimeofday(&timing->start);
+}
+
+void mail_storage_timing_end(enum mail_storage_timing_type type)
+{
+	struct mail_storage_timing *timing = &timings[type];
+	struct timeval now;
+	long long diff;
+
+	if (!mail_storage_timing_enabled || timing->depth == 0)
+		return;
+	if (--timing->depth > 0) {
+		/* only the outermost call is counted */
+		return;
+	}
+
+	i_gettimeofday(&now);
+	diff = timeval_diff_usecs(&now, &timing->start);
+	if (diff > 0)
+		timing->total_usecs += diff;
+}
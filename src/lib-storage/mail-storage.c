@@ -33,6 +33,7 @@
 #include "mail-search-mime-register.h"
 #include "mailbox-search-result-private.h"
 #include "mailbox-guid-cache.h"
+#include "mailbox-notify-client.h"
 #include "mail-cache.h"
 #include "utc-mktime.h"
 
@@ -91,6 +92,7 @@ void mail_storage_deinit(void)
 	if (array_is_created(&mail_storage_classes))
 		array_free(&mail_storage_classes);
 	mail_storage_hooks_deinit();
+	mailbox_notify_client_deinit();
 	mailbox_lists_deinit();
 	mailbox_attributes_deinit();
 	dsasl_clients_deinit();
@@ -1785,6 +1787,7 @@ void mailbox_close(struct mailbox *box)
 		i_panic("Trying to close mailbox %s with open transactions",
 			box->name);
 	}
+	mailbox_search_result_cache_free(box);
 	T_BEGIN {
 		box->v.close(box);
 	} T_END;
@@ -2392,8 +2395,10 @@ mailbox_sync_init(struct mailbox *box, enum mailbox_sync_flags flags)
 		i_panic("Trying to sync mailbox %s with open transactions",
 			box->name);
 	}
+	mail_storage_timing_start(MAIL_STORAGE_TIMING_SYNC);
 	if (!box->opened) {
 		if (mailbox_open(box) < 0) {
+			mail_storage_timing_end(MAIL_STORAGE_TIMING_SYNC);
 			ctx = i_new(struct mailbox_sync_context, 1);
 			ctx->box = box;
 			ctx->flags = flags;
@@ -2404,6 +2409,7 @@ mailbox_sync_init(struct mailbox *box, enum mailbox_sync_flags flags)
 	T_BEGIN {
 		ctx = box->v.sync_init(box, flags);
 	} T_END;
+	mail_storage_timing_end(MAIL_STORAGE_TIMING_SYNC);
 	return ctx;
 }
 
@@ -2414,9 +2420,11 @@ bool mailbox_sync_next(struct mailbox_sync_context *ctx,
 		return FALSE;
 
 	bool ret;
+	mail_storage_timing_start(MAIL_STORAGE_TIMING_SYNC);
 	T_BEGIN {
 		ret = ctx->box->v.sync_next(ctx, sync_rec_r);
 	} T_END;
+	mail_storage_timing_end(MAIL_STORAGE_TIMING_SYNC);
 	return ret;
 }
 
@@ -2434,9 +2442,11 @@ int mailbox_sync_deinit(struct mailbox_sync_context **_ctx,
 	i_zero(status_r);
 
 	if (!ctx->open_failed) {
+		mail_storage_timing_start(MAIL_STORAGE_TIMING_SYNC);
 		T_BEGIN {
 			ret = box->v.sync_deinit(ctx, status_r);
 		} T_END;
+		mail_storage_timing_end(MAIL_STORAGE_TIMING_SYNC);
 	} else {
 		i_free(ctx);
 		ret = -1;
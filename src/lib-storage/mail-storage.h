@@ -210,6 +210,11 @@ enum mailbox_transaction_flags {
 	   especially means the notify plugin. This would normally be used only
 	   with _FLAG_SYNC. */
 	MAILBOX_TRANSACTION_FLAG_NO_NOTIFY	= 0x40,
+	/* When copying mails within this transaction, copy only the cached
+	   fields that can't be cheaply regenerated (save date and sizes).
+	   Useful for destinations whose mails are rarely read, such as
+	   lazy-expunge mailboxes. */
+	MAILBOX_TRANSACTION_FLAG_NO_CACHE_COPY	= 0x80,
 };
 
 enum mailbox_sync_flags {
@@ -1031,4 +1036,24 @@ void mail_generate_guid_128_hash(const char *guid, guid_128_t guid_128_r);
 int mail_parse_human_timestamp(const char *str, time_t *timestamp_r,
 			       bool *utc_r);
 
+enum mail_storage_timing_type {
+	/* mailbox_sync_init(), _next() and _deinit() */
+	MAIL_STORAGE_TIMING_SYNC,
+	/* cache file lookups */
+	MAIL_STORAGE_TIMING_CACHE_LOOKUP,
+	/* reading mail streams */
+	MAIL_STORAGE_TIMING_MAIL_READ,
+
+	MAIL_STORAGE_TIMING_COUNT
+};
+
+/* Start tracking how much time the process spends in the storage operations.
+   This also makes mail streams track their reads, which adds a small
+   overhead. */
+void mail_storage_timing_enable(void);
+bool mail_storage_timing_is_enabled(void);
+/* Return how many microseconds the process has spent in the given operation
+   since the tracking was enabled. */
+uint64_t mail_storage_timing_get_total_usecs(enum mail_storage_timing_type type);
+
 #endif
@@ -0,0 +1,303 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "ostream.h"
+#include "str.h"
+#include "strnum.h"
+#include "connection.h"
+#include "mail-index-view-private.h"
+#include "mail-storage-private.h"
+#include "mailbox-watch.h"
+#include "mailbox-notify-client.h"
+
+#define MAILBOX_NOTIFY_PROTOCOL_MAJOR_VERSION 1
+#define MAILBOX_NOTIFY_PROTOCOL_MINOR_VERSION 0
+
+/* Don't try to reconnect more often than this after a failure */
+#define MAILBOX_NOTIFY_RECONNECT_SECS 10
+
+struct mailbox_notify_client_box {
+	struct mailbox *box;
+	char guid[GUID_128_SIZE*2 + 1];
+};
+
+struct mailbox_notify_client {
+	struct connection conn;
+	char *path;
+	bool connected;
+};
+
+static struct connection_list *notify_clients = NULL;
+static struct mailbox_notify_client *notify_client = NULL;
+static time_t notify_client_last_failure = 0;
+static ARRAY(struct mailbox_notify_client_box) notify_boxes = ARRAY_INIT;
+
+static const char *mailbox_notify_client_get_path(struct mailbox *box)
+{
+	const char *path = box->storage->set->mailbox_notify_socket_path;
+
+	if (path[0] == '\0' || path[0] == '/')
+		return path;
+	return t_strconcat(box->storage->user->set->base_dir, "/", path, NULL);
+}
+
+static bool
+mailbox_notify_client_box_is_synced(struct mailbox *box,
+				    const char *const *args)
+{
+	uint32_t indexid, log_file_seq;
+	uoff_t log_file_offset;
+
+	/* <indexid> <log file seq> <log file offset> */
+	if (str_array_length(args) != 3 ||
+	    str_to_uint32(args[0], &indexid) < 0 ||
+	    str_to_uint32(args[1], &log_file_seq) < 0 ||
+	    str_to_uoff(args[2], &log_file_offset) < 0)
+		return FALSE;
+
+	/* A shared mailbox may have a different (private) index, in which
+	   case the log position means nothing to us. */
+	if (box->index == NULL || box->view == NULL ||
+	    box->index->indexid != indexid)
+		return FALSE;
+	if (log_file_seq != box->view->log_file_head_seq)
+		return log_file_seq < box->view->log_file_head_seq;
+	return log_file_offset <= box->view->log_file_head_offset;
+}
+
+static void
+mailbox_notify_client_changed_input(const char *guid, const char *const *args)
+{
+	const struct mailbox_notify_client_box *nbox;
+	ARRAY(struct mailbox *) boxes;
+	struct mailbox *box;
+
+	/* Collect the mailboxes first, since the callbacks may
+	   unsubscribe. */
+	t_array_init(&boxes, 4);
+	array_foreach(&notify_boxes, nbox) {
+		if (strcmp(nbox->guid, guid) == 0 &&
+		    !mailbox_notify_client_box_is_synced(nbox->box, args))
+			array_push_back(&boxes, &nbox->box);
+	}
+	array_foreach_elem(&boxes, box)
+		mailbox_watch_notify(box);
+}
+
+static int
+mailbox_notify_client_input_args(struct connection *conn,
+				 const char *const *args)
+{
+	if (args[0] == NULL || strcmp(args[0], "CHANGED") != 0 ||
+	    args[1] == NULL) {
+		e_error(conn->event, "Invalid input: %s",
+			t_strarray_join(args, "\t"));
+		return -1;
+	}
+	mailbox_notify_client_changed_input(args[1], args + 2);
+	return 1;
+}
+
+static void mailbox_notify_client_destroy(struct connection *conn)
+{
+	struct mailbox_notify_client *client =
+		container_of(conn, struct mailbox_notify_client, conn);
+	const struct mailbox_notify_client_box *nbox;
+	ARRAY(struct mailbox *) boxes;
+	struct mailbox *box;
+
+	i_assert(client == notify_client);
+
+	if (client->connected) {
+		e_warning(conn->event, "Disconnected: %s",
+			  connection_disconnect_reason(conn));
+	}
+	notify_client_last_failure = ioloop_time;
+	notify_client = NULL;
+	connection_deinit(conn);
+	i_free(client->path);
+	i_free(client);
+
+	/* Changes may have been lost. Notify all the mailboxes so they'll
+	   check for changes themselves. They'll keep polling with
+	   mailbox_idle_check_interval from now on. */
+	if (!array_is_created(&notify_boxes))
+		return;
+	t_array_init(&boxes, array_count(&notify_boxes));
+	array_foreach(&notify_boxes, nbox)
+		array_push_back(&boxes, &nbox->box);
+	array_clear(&notify_boxes);
+	array_foreach_elem(&boxes, box)
+		mailbox_watch_notify(box);
+}
+
+static void mailbox_notify_client_connected(struct connection *conn,
+					    bool success)
+{
+	struct mailbox_notify_client *client =
+		container_of(conn, struct mailbox_notify_client, conn);
+
+	if (success)
+		client->connected = TRUE;
+}
+
+static const struct connection_vfuncs mailbox_notify_client_vfuncs = {
+	.destroy = mailbox_notify_client_destroy,
+	.input_args = mailbox_notify_client_input_args,
+	.client_connected = mailbox_notify_client_connected,
+};
+
+static const struct connection_settings mailbox_notify_client_set = {
+	.service_name_in = "mailbox-notify-server",
+	.service_name_out = "mailbox-notify-client",
+	.major_version = MAILBOX_NOTIFY_PROTOCOL_MAJOR_VERSION,
+	.minor_version = MAILBOX_NOTIFY_PROTOCOL_MINOR_VERSION,
+	.unix_client_connect_msecs = 1000,
+	.input_max_size = 1024,
+	.output_max_size = SIZE_MAX,
+	.client = TRUE,
+};
+
+static struct mailbox_notify_client *
+mailbox_notify_client_get(struct mailbox *box)
+{
+	struct mailbox_notify_client *client;
+	const char *path = mailbox_notify_client_get_path(box);
+
+	if (path[0] == '\0')
+		return NULL;
+	if (notify_client != NULL) {
+		/* only a single service is supported per process */
+		return strcmp(notify_client->path, path) == 0 ?
+			notify_client : NULL;
+	}
+	if (notify_client_last_failure + MAILBOX_NOTIFY_RECONNECT_SECS >
+	    ioloop_time)
+		return NULL;
+	/* The connection outlives any temporary ioloops */
+	if (current_ioloop != io_loop_get_root())
+		return NULL;
+
+	if (notify_clients == NULL) {
+		notify_clients =
+			connection_list_init(&mailbox_notify_client_set,
+					     &mailbox_notify_client_vfuncs);
+	}
+	client = i_new(struct mailbox_notify_client, 1);
+	client->path = i_strdup(path);
+	connection_init_client_unix(notify_clients, &client->conn, path);
+	event_set_append_log_prefix(client->conn.event, "mailbox-notify: ");
+	if (connection_client_connect(&client->conn) < 0) {
+		e_error(client->conn.event, "net_connect_unix(%s) failed: %m",
+			path);
+		notify_client_last_failure = ioloop_time;
+		connection_deinit(&client->conn);
+		i_free(client->path);
+		i_free(client);
+		return NULL;
+	}
+	notify_client = client;
+	return client;
+}
+
+static bool
+mailbox_notify_client_get_guid(struct mailbox *box, const char **guid_r)
+{
+	struct mailbox_metadata metadata;
+
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) < 0)
+		return FALSE;
+	*guid_r = guid_128_to_string(metadata.guid);
+	return TRUE;
+}
+
+bool mailbox_notify_client_subscribe(struct mailbox *box)
+{
+	struct mailbox_notify_client *client;
+	struct mailbox_notify_client_box *nbox;
+	const char *guid;
+
+	if (array_is_created(&notify_boxes)) {
+		array_foreach_modifiable(&notify_boxes, nbox) {
+			if (nbox->box == box)
+				return TRUE;
+		}
+	}
+
+	client = mailbox_notify_client_get(box);
+	if (client == NULL || !mailbox_notify_client_get_guid(box, &guid))
+		return FALSE;
+
+	if (!array_is_created(&notify_boxes))
+		i_array_init(&notify_boxes, 4);
+	nbox = array_append_space(&notify_boxes);
+	nbox->box = box;
+	i_assert(strlen(guid) < sizeof(nbox->guid));
+	i_strocpy(nbox->guid, guid, sizeof(nbox->guid));
+
+	o_stream_nsend_str(client->conn.output,
+			   t_strdup_printf("SUBSCRIBE\t%s\n", guid));
+	return TRUE;
+}
+
+void mailbox_notify_client_unsubscribe(struct mailbox *box)
+{
+	const struct mailbox_notify_client_box *nboxes;
+	unsigned int i, count;
+	char guid[sizeof(nboxes->guid)];
+
+	if (!array_is_created(&notify_boxes))
+		return;
+	nboxes = array_get(&notify_boxes, &count);
+	for (i = 0; i < count; i++) {
+		if (nboxes[i].box == box)
+			break;
+	}
+	if (i == count)
+		return;
+	memcpy(guid, nboxes[i].guid, sizeof(guid));
+	array_delete(&notify_boxes, i, 1);
+
+	/* the same mailbox may still be watched via another struct mailbox */
+	array_foreach(&notify_boxes, nboxes) {
+		if (strcmp(nboxes->guid, guid) == 0)
+			return;
+	}
+	if (notify_client != NULL) {
+		o_stream_nsend_str(notify_client->conn.output,
+				   t_strdup_printf("UNSUBSCRIBE\t%s\n", guid));
+	}
+}
+
+void mailbox_notify_client_changed(struct mailbox *box,
+	const struct mail_index_transaction_commit_result *result)
+{
+	struct mailbox_notify_client *client;
+	const char *guid;
+
+	if (box->storage->set->mailbox_notify_socket_path[0] == '\0' ||
+	    result->commit_size == 0)
+		return;
+
+	client = mailbox_notify_client_get(box);
+	if (client == NULL || !mailbox_notify_client_get_guid(box, &guid))
+		return;
+
+	o_stream_nsend_str(client->conn.output,
+		t_strdup_printf("CHANGED\t%s\t%u\t%u\t%"PRIuUOFF_T"\n", guid,
+				box->index->indexid, result->log_file_seq,
+				result->log_file_offset));
+}
+
+void mailbox_notify_client_deinit(void)
+{
+	if (array_is_created(&notify_boxes))
+		array_free(&notify_boxes);
+	if (notify_client != NULL)
+		notify_client->connected = FALSE;
+	if (notify_clients != NULL)
+		connection_list_deinit(&notify_clients);
+	i_assert(notify_client == NULL);
+}
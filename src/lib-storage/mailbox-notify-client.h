@@ -0,0 +1,20 @@
+#ifndef MAILBOX_NOTIFY_CLIENT_H
+#define MAILBOX_NOTIFY_CLIENT_H
+
+struct mail_index_transaction_commit_result;
+
+/* Subscribe to the mailbox's changes via the mailbox-notify service.
+   box->notify_callback is called when another process commits changes to the
+   mailbox. Returns TRUE if subscribed, FALSE if mailbox_notify_socket_path
+   isn't set or the service can't be reached. */
+bool mailbox_notify_client_subscribe(struct mailbox *box);
+void mailbox_notify_client_unsubscribe(struct mailbox *box);
+
+/* Broadcast that a transaction was committed to the mailbox. This is a no-op
+   if mailbox_notify_socket_path isn't set. */
+void mailbox_notify_client_changed(struct mailbox *box,
+	const struct mail_index_transaction_commit_result *result);
+
+void mailbox_notify_client_deinit(void);
+
+#endif
@@ -32,6 +32,23 @@ void mailbox_search_result_remove(struct mail_search_result *result,
 				  uint32_t uid);
 void mailbox_search_results_add(struct mail_search_context *ctx, uint32_t uid);
 void mailbox_search_results_remove(struct mailbox *box, uint32_t uid);
+/* Remove all the UIDs from all the mailbox's search results. This is faster
+   than calling mailbox_search_results_remove() for each UID. */
+void mailbox_search_results_remove_uids(struct mailbox *box,
+					const ARRAY_TYPE(seq_range) *uids);
+
+/* Returns TRUE if results for the search args can be cached. Only args whose
+   matches can be kept up to date by mailbox syncing are accepted. */
+bool mailbox_search_result_cache_want(const struct mail_search_args *args);
+/* Returns a cached result for equal search args, or NULL if there is none. */
+struct mail_search_result *
+mailbox_search_result_cache_lookup(struct mailbox *box,
+				   const struct mail_search_args *args);
+/* Add a finished search result to the cache. The cache takes ownership of
+   the result and may free older cached results. */
+void mailbox_search_result_cache_add(struct mail_search_result *result);
+/* Free all cached search results of the mailbox. */
+void mailbox_search_result_cache_free(struct mailbox *box);
 
 void mailbox_search_result_never(struct mail_search_result *result,
 				 uint32_t uid);
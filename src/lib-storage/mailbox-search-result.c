@@ -2,10 +2,14 @@
 
 #include "lib.h"
 #include "array.h"
+#include "seq-set.h"
 #include "mail-storage-private.h"
 #include "mail-search.h"
 #include "mailbox-search-result-private.h"
 
+/* Maximum number of search results cached per mailbox */
+#define MAILBOX_SEARCH_RESULT_CACHE_MAX_COUNT 4
+
 static void
 mailbox_search_result_analyze_args(struct mail_search_result *result,
 				   struct mail_search_arg *arg)
@@ -159,6 +163,53 @@ void mailbox_search_results_remove(struct mailbox *box, uint32_t uid)
 		mailbox_search_result_remove(results[i], uid);
 }
 
+static void
+mailbox_search_result_remove_uids(struct mail_search_result *result,
+				  const ARRAY_TYPE(seq_range) *uids)
+{
+	ARRAY_TYPE(seq_range) removed;
+	struct seq_set *set;
+	const struct seq_range *range;
+	uint32_t uid;
+
+	if (!seq_range_array_have_common(&result->uids, uids))
+		return;
+
+	/* Removing sparse UIDs one by one from a large result would
+	   memmove() the rest of the array for each UID. */
+	t_array_init(&removed, 32);
+	set = seq_set_init();
+	seq_set_add_array(set, &result->uids);
+	array_foreach(uids, range) {
+		for (uid = range->seq1;; uid++) {
+			if (seq_set_remove(set, uid))
+				seq_range_array_add(&removed, uid);
+			if (uid == range->seq2)
+				break;
+		}
+	}
+	array_clear(&result->uids);
+	seq_set_to_array(set, &result->uids);
+	seq_set_deinit(&set);
+
+	if (array_is_created(&result->removed_uids)) {
+		seq_range_array_merge(&result->removed_uids, &removed);
+		seq_range_array_remove_seq_range(&result->added_uids, &removed);
+	}
+}
+
+void mailbox_search_results_remove_uids(struct mailbox *box,
+					const ARRAY_TYPE(seq_range) *uids)
+{
+	struct mail_search_result *const *results;
+	unsigned int i, count;
+
+	results = array_get(&box->search_results, &count);
+	for (i = 0; i < count; i++) T_BEGIN {
+		mailbox_search_result_remove_uids(results[i], uids);
+	} T_END;
+}
+
 void mailbox_search_result_never(struct mail_search_result *result,
 				 uint32_t uid)
 {
@@ -179,6 +230,124 @@ void mailbox_search_results_never(struct mail_search_context *ctx,
 		mailbox_search_result_never(results[i], uid);
 }
 
+static bool
+mailbox_search_result_cache_want_args(const struct mail_search_arg *arg)
+{
+	const struct mail_search_arg *subargs;
+
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			subargs = arg->value.subargs;
+			if (!mailbox_search_result_cache_want_args(subargs))
+				return FALSE;
+			break;
+		case SEARCH_FLAGS:
+			/* recent flags aren't tracked by syncing */
+			if ((arg->value.flags & MAIL_RECENT) != 0)
+				return FALSE;
+			break;
+		case SEARCH_ALL:
+		case SEARCH_KEYWORDS:
+		case SEARCH_BEFORE:
+		case SEARCH_ON:
+		case SEARCH_SINCE:
+		case SEARCH_SMALLER:
+		case SEARCH_LARGER:
+			break;
+		default:
+			/* sequences and UID sets with '*' change meaning when
+			   the mailbox changes, and the rest are too expensive
+			   to re-check for each flag change. */
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+bool mailbox_search_result_cache_want(const struct mail_search_args *args)
+{
+	if (args->stop_on_nonmatch)
+		return FALSE;
+	return mailbox_search_result_cache_want_args(args->args);
+}
+
+struct mail_search_result *
+mailbox_search_result_cache_lookup(struct mailbox *box,
+				   const struct mail_search_args *args)
+{
+	struct mail_search_result *result;
+	unsigned int i, count;
+
+	if (!array_is_created(&box->search_result_cache))
+		return NULL;
+
+	count = array_count(&box->search_result_cache);
+	for (i = 0; i < count; i++) {
+		result = array_idx_elem(&box->search_result_cache, i);
+		/* args->box can't be compared, since the caller isn't
+		   required to have initialized the args */
+		if (mail_search_arg_equals(result->search_args->args,
+					   args->args)) {
+			/* move it to the end as the most recently used */
+			array_delete(&box->search_result_cache, i, 1);
+			array_push_back(&box->search_result_cache, &result);
+			return result;
+		}
+	}
+	return NULL;
+}
+
+static void
+mailbox_search_result_cache_free_result(struct mail_search_result *result)
+{
+	mail_search_args_deinit(result->search_args);
+	mailbox_search_result_free(&result);
+}
+
+void mailbox_search_result_cache_add(struct mail_search_result *result)
+{
+	struct mailbox *box = result->box;
+	struct mail_search_result *old_result;
+
+	i_assert((result->flags & MAILBOX_SEARCH_RESULT_FLAG_UPDATE) != 0);
+
+	old_result = mailbox_search_result_cache_lookup(box,
+							result->search_args);
+	if (old_result != NULL) {
+		/* an identical search finished first */
+		mailbox_search_result_free(&result);
+		return;
+	}
+	/* keep the args initialized, because updating the result while
+	   syncing searches with them. */
+	mail_search_args_init(result->search_args, box, FALSE, NULL);
+	if (!array_is_created(&box->search_result_cache)) {
+		i_array_init(&box->search_result_cache,
+			     MAILBOX_SEARCH_RESULT_CACHE_MAX_COUNT);
+	}
+	if (array_count(&box->search_result_cache) >=
+	    MAILBOX_SEARCH_RESULT_CACHE_MAX_COUNT) {
+		old_result = array_idx_elem(&box->search_result_cache, 0);
+		array_pop_front(&box->search_result_cache);
+		mailbox_search_result_cache_free_result(old_result);
+	}
+	array_push_back(&box->search_result_cache, &result);
+}
+
+void mailbox_search_result_cache_free(struct mailbox *box)
+{
+	struct mail_search_result *result;
+
+	if (!array_is_created(&box->search_result_cache))
+		return;
+
+	array_foreach_elem(&box->search_result_cache, result)
+		mailbox_search_result_cache_free_result(result);
+	array_free(&box->search_result_cache);
+}
+
 const ARRAY_TYPE(seq_range) *
 mailbox_search_result_get(struct mail_search_result *result)
 {
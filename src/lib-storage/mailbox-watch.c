@@ -4,6 +4,7 @@
 #include "ioloop.h"
 #include "mail-storage-private.h"
 #include "mailbox-watch.h"
+#include "mailbox-notify-client.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -43,7 +44,7 @@ static void notify_timeout(struct mailbox *box)
 		notify_delay_callback(box);
 }
 
-static void notify_callback(struct mailbox *box)
+void mailbox_watch_notify(struct mailbox *box)
 {
 	timeout_reset(box->to_notify);
 
@@ -63,7 +64,11 @@ void mailbox_watch_add(struct mailbox *box, const char *path)
 
 	i_assert(set->mailbox_idle_check_interval > 0);
 
-	(void)io_add_notify(path, notify_callback, box, &io);
+	/* With mailbox-notify service there's no need to watch the files.
+	   They're still stat()ed by the timeout in case the service gets
+	   disconnected, or the change came from a process not using it. */
+	if (!mailbox_notify_client_subscribe(box))
+		(void)io_add_notify(path, mailbox_watch_notify, box, &io);
 
 	file = i_new(struct mailbox_notify_file, 1);
 	file->path = i_strdup(path);
@@ -88,6 +93,7 @@ void mailbox_watch_remove_all(struct mailbox *box)
 {
 	struct mailbox_notify_file *file;
 
+	mailbox_notify_client_unsubscribe(box);
 	while (box->notify_files != NULL) {
 		file = box->notify_files;
 		box->notify_files = file->next;
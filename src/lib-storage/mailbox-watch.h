@@ -3,6 +3,9 @@
 
 void mailbox_watch_add(struct mailbox *box, const char *path);
 void mailbox_watch_remove_all(struct mailbox *box);
+/* Notify about changes to the mailbox after a short delay. Multiple calls
+   within the delay are merged. */
+void mailbox_watch_notify(struct mailbox *box);
 
 /* Create a new temporary ioloop, add all the watches back and call
    io_loop_extract_notify_fd() on it. Returns fd on success, -1 on error. */
@@ -155,6 +155,81 @@ backtrace_append_libc(string_t *str ATTR_UNUSED, const char **error_r)
 }
 #endif
 
+#if defined(HAVE_BACKTRACE_SYMBOLS) && defined(HAVE_EXECINFO_H)
+unsigned int backtrace_get_addresses(void **stack, unsigned int max_count)
+{
+	int ret;
+
+	ret = backtrace(stack, max_count);
+	return ret < 0 ? 0 : ret;
+}
+
+static void backtrace_append_function(string_t *str, const char *symbol)
+{
+	/* symbol is e.g. "/usr/lib/dovecot/imap(function+0x1a) [0x55..]" or
+	   "/usr/lib/dovecot/libdovecot.so.0(+0x1234) [0x7f..]" */
+	const char *start, *end, *p, *binary;
+
+	start = strchr(symbol, '(');
+	end = start == NULL ? NULL : strchr(start, ')');
+	if (end == NULL) {
+		str_append(str, symbol);
+		return;
+	}
+	for (p = start + 1; p < end && *p != '+'; p++) ;
+	if (p > start + 1) {
+		/* function name */
+		str_append_data(str, start + 1, p - (start + 1));
+		return;
+	}
+
+	/* no function name - use the binary name and the offset */
+	binary = t_strdup_until(symbol, start);
+	p = strrchr(binary, '/');
+	str_append(str, p == NULL ? binary : p + 1);
+	str_append_data(str, start + 1, end - (start + 1));
+}
+
+int backtrace_append_functions(string_t *str, void *const *stack,
+			       unsigned int count, const char **error_r)
+{
+	char **strings;
+	unsigned int i;
+
+	if (count == 0) {
+		*error_r = "Empty stack";
+		return -1;
+	}
+	strings = backtrace_symbols(stack, count);
+	if (strings == NULL) {
+		*error_r = "backtrace_symbols() failed";
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append(str, " -> ");
+		backtrace_append_function(str, strings[i]);
+	}
+	free(strings);
+	return 0;
+}
+#else
+unsigned int backtrace_get_addresses(void **stack ATTR_UNUSED,
+				     unsigned int max_count ATTR_UNUSED)
+{
+	return 0;
+}
+
+int backtrace_append_functions(string_t *str ATTR_UNUSED,
+			       void *const *stack ATTR_UNUSED,
+			       unsigned int count ATTR_UNUSED,
+			       const char **error_r)
+{
+	*error_r = "Missing implementation";
+	return -1;
+}
+#endif
+
 int backtrace_append(string_t *str, const char **error_r)
 {
 #if defined(HAVE_LIBUNWIND)
@@ -5,4 +5,16 @@
 int backtrace_append(string_t *str, const char **error_r);
 int backtrace_get(const char **backtrace_r, const char **error_r);
 
+/* Fill stack with up to max_count return addresses of the current call stack.
+   Returns the number of addresses, or 0 if not supported. After the first
+   call this can be used in signal handlers, although it's not strictly
+   async-signal-safe. */
+unsigned int backtrace_get_addresses(void **stack, unsigned int max_count);
+/* Append " -> " separated function names for the stack addresses returned by
+   backtrace_get_addresses(). The names don't contain offsets within the
+   functions, so different samples within the same functions produce the same
+   string. Returns 0 if ok, -1 if failure. */
+int backtrace_append_functions(string_t *str, void *const *stack,
+			       unsigned int count, const char **error_r);
+
 #endif
@@ -599,6 +599,43 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+/* Decode as many complete 4-character groups from the beginning of src as
+   possible directly into dest. Stops at the first group that contains
+   anything else than base64 characters, which the caller then handles one
+   character at a time. Returns the number of source bytes consumed. */
+static size_t
+base64_decode_quads(const struct base64_scheme *b64,
+		    const unsigned char *src, size_t src_size,
+		    size_t dst_avail, buffer_t *dest)
+{
+	size_t quad_count, i;
+	unsigned char *dst;
+
+	quad_count = I_MIN(src_size / 4, dst_avail / 3);
+	if (quad_count == 0)
+		return 0;
+
+	dst = buffer_append_space_unsafe(dest, quad_count * 3);
+	for (i = 0; i < quad_count; i++) {
+		unsigned char a = b64->decmap[src[0]];
+		unsigned char b = b64->decmap[src[1]];
+		unsigned char c = b64->decmap[src[2]];
+		unsigned char d = b64->decmap[src[3]];
+
+		/* valid values are 0..63, invalid ones are 0xff */
+		if (((a | b | c | d) & 0xc0) != 0)
+			break;
+		dst[0] = (a << 2) | (b >> 4);
+		dst[1] = (b << 4) | (c >> 2);
+		dst[2] = (c << 6) | d;
+		src += 4;
+		dst += 3;
+	}
+	if (i < quad_count)
+		buffer_set_used_size(dest, dest->used - (quad_count - i) * 3);
+	return i * 4;
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -661,8 +698,22 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+		if (dec->sub_pos == 0 && dst_avail >= 3) {
+			/* fast path: decode whole groups at once */
+			size_t n = base64_decode_quads(b64, src_c + src_pos,
+						       src_size - src_pos,
+						       dst_avail, dest);
+
+			src_pos += n;
+			dst_avail -= n / 4 * 3;
+			if (src_pos == src_size)
+				break;
+		}
+
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 
 		if (dm == 0xff) {
 			if (no_whitespace) {
@@ -0,0 +1,93 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "crc32.h"
+#include "hash-method.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "time-util.h"
+
+#include <stdio.h>
+
+#define BENCH_DEFAULT_TOTAL_MB 256
+
+/**
+ * Measures the throughput of crc32 and all the hash methods for a few
+ * different input sizes, from short strings (header hashes, GUIDs) to
+ * large attachments (SIS, FTS).
+ */
+
+static const size_t bench_sizes[] = { 16, 256, 4096, 1024*1024 };
+
+static void bench_print(const char *name, size_t size, uint64_t ts_0,
+			uint64_t ts_1, uoff_t total_bytes)
+{
+	double secs = (double)(ts_1 - ts_0) / 1000000000.0;
+
+	printf("%-12s %8zu bytes: %9.1f MB/s\n", name, size,
+	       secs <= 0 ? 0.0 : (double)total_bytes / secs / (1024*1024));
+}
+
+static void bench_crc32(const unsigned char *data, size_t size,
+			unsigned int count)
+{
+	uint64_t ts_0, ts_1;
+	uint32_t crc = 0;
+
+	ts_0 = i_nanoseconds();
+	for (unsigned int i = 0; i < count; i++)
+		crc = crc32_data_more(crc, data, size);
+	ts_1 = i_nanoseconds();
+	/* make sure the loop isn't optimized away */
+	if (crc == 0)
+		printf("(crc=0)\n");
+	bench_print("crc32", size, ts_0, ts_1, (uoff_t)size * count);
+}
+
+static void bench_hash_method(const struct hash_method *meth,
+			      const unsigned char *data, size_t size,
+			      unsigned int count)
+{
+	unsigned char ctx[meth->context_size];
+	unsigned char digest[meth->digest_size];
+	uint64_t ts_0, ts_1;
+
+	ts_0 = i_nanoseconds();
+	for (unsigned int i = 0; i < count; i++) {
+		meth->init(ctx);
+		meth->loop(ctx, data, size);
+		meth->result(ctx, digest);
+	}
+	ts_1 = i_nanoseconds();
+	bench_print(meth->name, size, ts_0, ts_1, (uoff_t)size * count);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int total_mb = BENCH_DEFAULT_TOTAL_MB;
+	unsigned char *data;
+	size_t max_size = bench_sizes[N_ELEMENTS(bench_sizes)-1];
+
+	lib_init();
+	if (argc > 2)
+		i_fatal("Usage: bench-hash [<total MB per test>]");
+	if (argc == 2 && (str_to_uint(argv[1], &total_mb) < 0 ||
+			  total_mb == 0))
+		i_fatal("Invalid total MB: %s", argv[1]);
+
+	data = i_malloc(max_size);
+	random_fill(data, max_size);
+
+	for (unsigned int i = 0; i < N_ELEMENTS(bench_sizes); i++) {
+		size_t size = bench_sizes[i];
+		unsigned int count = (uoff_t)total_mb * 1024 * 1024 / size;
+
+		bench_crc32(data, size, count);
+		for (unsigned int j = 0; hash_methods[j] != NULL; j++)
+			bench_hash_method(hash_methods[j], data, size, count);
+		printf("\n");
+	}
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
@@ -3,6 +3,10 @@
 #include "lib.h"
 #include "crc32.h"
 
+#ifdef __ARM_FEATURE_CRC32
+#  include <arm_acle.h>
+#endif
+
 static uint32_t crc32tab[256] = {
 	0x00000000,
 	0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
@@ -63,16 +67,75 @@ uint32_t crc32_data(const void *data, size_t size)
 	return crc32_data_more(0, data, size);
 }
 
+#ifdef __ARM_FEATURE_CRC32
+uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
+{
+	const uint8_t *p = data, *end = p + size;
+	uint64_t word;
+
+	/* ARMv8 CRC32 instructions use the same polynomial */
+	crc ^= 0xffffffff;
+	for (; (size_t)(end - p) >= sizeof(word); p += sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		crc = __crc32d(crc, word);
+	}
+	for (; p != end; p++)
+		crc = __crc32b(crc, *p);
+	crc ^= 0xffffffff;
+	return crc;
+}
+#else
+/* crc32tab_slices[n][i] is the CRC of byte i followed by n zero bytes. They
+   allow processing 8 bytes with independent table lookups. */
+static uint32_t crc32tab_slices[8][256];
+static bool crc32tab_slices_initialized = FALSE;
+
+static void crc32_init_slices(void)
+{
+	unsigned int i, n;
+	uint32_t crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32tab[i];
+		crc32tab_slices[0][i] = crc;
+		for (n = 1; n < 8; n++) {
+			crc = (crc >> 8) ^ crc32tab[crc & 0xff];
+			crc32tab_slices[n][i] = crc;
+		}
+	}
+	crc32tab_slices_initialized = TRUE;
+}
+
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
 {
 	const uint8_t *p = data, *end = p + size;
+	uint32_t word1, word2;
+
+	if (unlikely(!crc32tab_slices_initialized) && size >= 8)
+		crc32_init_slices();
 
 	crc ^= 0xffffffff;
+	/* slicing-by-8 */
+	for (; end - p >= 8; p += 8) {
+		word1 = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) |
+			       ((uint32_t)p[3] << 24));
+		word2 = p[4] | (p[5] << 8) | (p[6] << 16) |
+			((uint32_t)p[7] << 24);
+		crc = crc32tab_slices[7][word1 & 0xff] ^
+			crc32tab_slices[6][(word1 >> 8) & 0xff] ^
+			crc32tab_slices[5][(word1 >> 16) & 0xff] ^
+			crc32tab_slices[4][word1 >> 24] ^
+			crc32tab_slices[3][word2 & 0xff] ^
+			crc32tab_slices[2][(word2 >> 8) & 0xff] ^
+			crc32tab_slices[1][(word2 >> 16) & 0xff] ^
+			crc32tab_slices[0][word2 >> 24];
+	}
 	for (; p != end; p++)
 		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
 	crc ^= 0xffffffff;
 	return crc;
 }
+#endif
 
 uint32_t crc32_str(const char *str)
 {
@@ -86,6 +86,9 @@ static struct stack_block *current_block;
    freed. This can prevent rapid malloc()+free()ing when data stack is grown
    and shrunk constantly. */
 static struct stack_block *unused_block = NULL;
+/* unused_block has been in use since the previous
+   data_stack_free_unused_if_idle() call */
+static bool unused_block_recently_used = FALSE;
 
 static struct event *event_datastack = NULL;
 static bool event_datastack_deinitialized = FALSE;
@@ -231,6 +234,7 @@ static void free_blocks(struct stack_block *block)
 			 block->size > unused_block->size) {
 			free(unused_block);
 			unused_block = block;
+			unused_block_recently_used = TRUE;
 		} else {
 			free(block);
 		}
@@ -736,6 +740,15 @@ void data_stack_free_unused(void)
 {
 	free(unused_block);
 	unused_block = NULL;
+	unused_block_recently_used = FALSE;
+}
+
+void data_stack_free_unused_if_idle(void)
+{
+	if (unused_block_recently_used)
+		unused_block_recently_used = FALSE;
+	else
+		data_stack_free_unused();
 }
 
 void data_stack_init(void)
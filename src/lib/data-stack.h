@@ -157,6 +157,11 @@ size_t data_stack_get_used_size(void);
 /* Free all the memory that is currently unused (i.e. reserved for growing
    data stack quickly). */
 void data_stack_free_unused(void);
+/* Like data_stack_free_unused(), but free the memory only if it hasn't been
+   used since the previous call. This keeps the memory reserved while the data
+   stack keeps growing to the same size, so it's not repeatedly free()d and
+   malloc()ed. */
+void data_stack_free_unused_if_idle(void);
 
 void data_stack_init(void);
 void data_stack_deinit_event(void);
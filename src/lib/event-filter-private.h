@@ -24,6 +24,15 @@ struct event_filter {
 	int refcount;
 	ARRAY(struct event_filter_query_internal) queries;
 
+	/* Index of the queries by the event names they require, so events
+	   are matched only against the queries that can match them. Built
+	   lazily while matching and dropped whenever the queries change. */
+	pool_t index_pool;
+	/* exact event name => query indexes requiring that name */
+	HASH_TABLE(const char *, ARRAY_TYPE(uint) *) index_names;
+	/* queries that don't require any specific exact event name */
+	ARRAY_TYPE(uint) index_any_name;
+
 	bool fragment;
 	bool named_queries_only;
 };
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "hash.h"
 #include "llist.h"
 #include "str.h"
 #include "strescape.h"
@@ -42,6 +43,8 @@ struct event_filter_query_internal {
 
 static struct event_filter *event_filters = NULL;
 
+static void event_filter_index_free(struct event_filter *filter);
+
 static struct event_filter *event_filter_create_real(pool_t pool, bool fragment)
 {
 	struct event_filter *filter;
@@ -85,6 +88,7 @@ void event_filter_unref(struct event_filter **_filter)
 	if (--filter->refcount > 0)
 		return;
 
+	event_filter_index_free(filter);
 	if (!filter->fragment) {
 		DLLIST_REMOVE(&event_filters, filter);
 
@@ -104,6 +108,9 @@ event_filter_get_or_alloc_internal_query(struct event_filter *filter,
 {
 	struct event_filter_query_internal *query;
 
+	/* the caller is going to modify the query */
+	event_filter_index_free(filter);
+
 	array_foreach_modifiable(&filter->queries, query) {
 		if (query->context == context)
 			return query;
@@ -287,6 +294,7 @@ bool event_filter_remove_queries_with_context(struct event_filter *filter,
 
 	array_foreach(&filter->queries, int_query) {
 		if (int_query->context == context) {
+			event_filter_index_free(filter);
 			idx = array_foreach_idx(&filter->queries, int_query);
 			array_delete(&filter->queries, idx, 1);
 			return TRUE;
@@ -308,6 +316,42 @@ void event_filter_merge_with_context(struct event_filter *dest,
 	event_filter_merge_with_context_internal(dest, src, new_context, TRUE);
 }
 
+static bool
+event_filter_node_has_field(const struct event_filter_node *node,
+			    const char *key)
+{
+	if (node == NULL)
+		return FALSE;
+
+	switch (node->type) {
+	case EVENT_FILTER_NODE_TYPE_LOGIC:
+		return event_filter_node_has_field(node->children[0], key) ||
+			event_filter_node_has_field(node->children[1], key);
+	case EVENT_FILTER_NODE_TYPE_EVENT_FIELD_EXACT:
+	case EVENT_FILTER_NODE_TYPE_EVENT_FIELD_WILDCARD:
+	case EVENT_FILTER_NODE_TYPE_EVENT_FIELD_NUMERIC_WILDCARD:
+		return strcmp(node->field.key, key) == 0;
+	case EVENT_FILTER_NODE_TYPE_EVENT_NAME_EXACT:
+	case EVENT_FILTER_NODE_TYPE_EVENT_NAME_WILDCARD:
+	case EVENT_FILTER_NODE_TYPE_EVENT_SOURCE_LOCATION:
+	case EVENT_FILTER_NODE_TYPE_EVENT_CATEGORY:
+		return FALSE;
+	}
+	i_unreached();
+}
+
+bool event_filter_has_field(const struct event_filter *filter,
+			    const char *key)
+{
+	const struct event_filter_query_internal *query;
+
+	array_foreach(&filter->queries, query) {
+		if (event_filter_node_has_field(query->expr, key))
+			return TRUE;
+	}
+	return FALSE;
+}
+
 static const char *
 event_filter_export_query_expr_op(enum event_filter_node_op op)
 {
@@ -851,6 +895,123 @@ event_filter_query_match(const struct event_filter_query_internal *query,
 					     source_linenum, log_type);
 }
 
+static bool
+event_filter_node_get_required_names(struct event_filter_node *node,
+				     ARRAY_TYPE(const_string) *names)
+{
+	/* Returns TRUE if the node can match only events whose name is one of
+	   the names added to the array. */
+	switch (node->op) {
+	case EVENT_FILTER_OP_NOT:
+		return FALSE;
+	case EVENT_FILTER_OP_AND: {
+		unsigned int count = array_count(names);
+
+		if (event_filter_node_get_required_names(node->children[0],
+							 names))
+			return TRUE;
+		array_delete(names, count, array_count(names) - count);
+		return event_filter_node_get_required_names(node->children[1],
+							    names);
+	}
+	case EVENT_FILTER_OP_OR:
+		return event_filter_node_get_required_names(node->children[0],
+							    names) &&
+			event_filter_node_get_required_names(node->children[1],
+							     names);
+	default:
+		if (node->type != EVENT_FILTER_NODE_TYPE_EVENT_NAME_EXACT)
+			return FALSE;
+		array_push_back(names, &node->str);
+		return TRUE;
+	}
+}
+
+static void
+event_filter_index_add_name(struct event_filter *filter, const char *name,
+			    unsigned int query_idx)
+{
+	ARRAY_TYPE(uint) *queries;
+	const unsigned int *last;
+
+	queries = hash_table_lookup(filter->index_names, name);
+	if (queries == NULL) {
+		queries = p_new(filter->index_pool, ARRAY_TYPE(uint), 1);
+		p_array_init(queries, filter->index_pool, 2);
+		hash_table_insert(filter->index_names, name, queries);
+	} else {
+		/* the same name may be listed multiple times in the query */
+		last = array_back(queries);
+		if (*last == query_idx)
+			return;
+	}
+	array_push_back(queries, &query_idx);
+}
+
+static void event_filter_index_build(struct event_filter *filter)
+{
+	const struct event_filter_query_internal *query;
+	ARRAY_TYPE(const_string) names;
+	const char *name;
+	unsigned int idx;
+
+	i_assert(filter->index_pool == NULL);
+
+	filter->index_pool = pool_alloconly_create("event filter index", 1024);
+	hash_table_create(&filter->index_names, filter->index_pool, 0,
+			  str_hash, strcmp);
+	p_array_init(&filter->index_any_name, filter->index_pool, 4);
+
+	t_array_init(&names, 8);
+	array_foreach(&filter->queries, query) {
+		idx = array_foreach_idx(&filter->queries, query);
+		if (query->expr == NULL)
+			continue;
+
+		array_clear(&names);
+		if (event_filter_node_get_required_names(query->expr, &names)) {
+			array_foreach_elem(&names, name)
+				event_filter_index_add_name(filter, name, idx);
+		} else {
+			array_push_back(&filter->index_any_name, &idx);
+		}
+	}
+}
+
+static void event_filter_index_free(struct event_filter *filter)
+{
+	if (filter->index_pool == NULL)
+		return;
+	hash_table_destroy(&filter->index_names);
+	pool_unref(&filter->index_pool);
+}
+
+static void
+event_filter_get_candidates(struct event_filter *filter, struct event *event,
+			    const unsigned int **queries1_r,
+			    unsigned int *count1_r,
+			    const unsigned int **queries2_r,
+			    unsigned int *count2_r)
+{
+	ARRAY_TYPE(uint) *queries;
+	const char *name = event->sending_name;
+
+	if (filter->index_pool == NULL) T_BEGIN {
+		event_filter_index_build(filter);
+	} T_END;
+
+	*queries1_r = array_get(&filter->index_any_name, count1_r);
+	*queries2_r = NULL;
+	*count2_r = 0;
+	if (name == NULL) {
+		/* the indexed queries require an event name */
+		return;
+	}
+	queries = hash_table_lookup(filter->index_names, name);
+	if (queries != NULL)
+		*queries2_r = array_get(queries, count2_r);
+}
+
 static bool
 event_filter_match_fastpath(struct event_filter *filter, struct event *event)
 {
@@ -877,16 +1038,28 @@ bool event_filter_match_source(struct event_filter *filter, struct event *event,
 			       unsigned int source_linenum,
 			       const struct failure_context *ctx)
 {
-	const struct event_filter_query_internal *query;
+	const struct event_filter_query_internal *queries;
+	const unsigned int *idx1, *idx2;
+	unsigned int i, count1, count2;
 
 	i_assert(!filter->fragment);
 
 	if (!event_filter_match_fastpath(filter, event))
 		return FALSE;
 
-	array_foreach(&filter->queries, query) {
-		if (event_filter_query_match(query, event, source_filename,
-					     source_linenum, ctx))
+	queries = array_front(&filter->queries);
+	event_filter_get_candidates(filter, event, &idx1, &count1,
+				    &idx2, &count2);
+	for (i = 0; i < count2; i++) {
+		if (event_filter_query_match(&queries[idx2[i]], event,
+					     source_filename, source_linenum,
+					     ctx))
+			return TRUE;
+	}
+	for (i = 0; i < count1; i++) {
+		if (event_filter_query_match(&queries[idx1[i]], event,
+					     source_filename, source_linenum,
+					     ctx))
 			return TRUE;
 	}
 	return FALSE;
@@ -896,7 +1069,11 @@ struct event_filter_match_iter {
 	struct event_filter *filter;
 	struct event *event;
 	const struct failure_context *failure_ctx;
-	unsigned int idx;
+
+	/* two sorted lists of candidate query indexes */
+	const unsigned int *idx1, *idx2;
+	unsigned int count1, count2;
+	unsigned int pos1, pos2;
 };
 
 struct event_filter_match_iter *
@@ -911,22 +1088,32 @@ event_filter_match_iter_init(struct event_filter *filter, struct event *event,
 	iter->filter = filter;
 	iter->event = event;
 	iter->failure_ctx = ctx;
-	if (!event_filter_match_fastpath(filter, event))
-		iter->idx = UINT_MAX;
+	if (event_filter_match_fastpath(filter, event)) {
+		event_filter_get_candidates(filter, event,
+					    &iter->idx1, &iter->count1,
+					    &iter->idx2, &iter->count2);
+	}
 	return iter;
 }
 
 void *event_filter_match_iter_next(struct event_filter_match_iter *iter)
 {
-	const struct event_filter_query_internal *queries;
-	unsigned int count;
+	const struct event_filter_query_internal *queries, *query;
+	unsigned int idx;
 
-	queries = array_get(&iter->filter->queries, &count);
-	while (iter->idx < count) {
-		const struct event_filter_query_internal *query =
-			&queries[iter->idx];
+	/* The candidate lists are returned in the original query order, so
+	   they're merged here. The filter must not be modified while
+	   iterating, since that would invalidate the lists. */
+	queries = array_front(&iter->filter->queries);
+	while (iter->pos1 < iter->count1 || iter->pos2 < iter->count2) {
+		if (iter->pos2 == iter->count2 ||
+		    (iter->pos1 < iter->count1 &&
+		     iter->idx1[iter->pos1] < iter->idx2[iter->pos2]))
+			idx = iter->idx1[iter->pos1++];
+		else
+			idx = iter->idx2[iter->pos2++];
 
-		iter->idx++;
+		query = &queries[idx];
 		if (query->context != NULL &&
 		    event_filter_query_match(query, iter->event,
 					     iter->event->source_filename,
@@ -27,6 +27,10 @@ void event_filter_merge_with_context(struct event_filter *dest,
 bool event_filter_remove_queries_with_context(struct event_filter *filter,
 					      void *context);
 
+/* Returns TRUE if any of the filter's queries checks the given field. */
+bool event_filter_has_field(const struct event_filter *filter,
+			    const char *key);
+
 /* Export the filter into a string.  The context pointers aren't exported. */
 void event_filter_export(struct event_filter *filter, string_t *dest);
 /* Add queries to the filter from the given string. The string is expected to
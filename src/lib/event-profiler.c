@@ -0,0 +1,229 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "lib-signals.h"
+#include "lib-event.h"
+#include "backtrace-string.h"
+#include "event-profiler.h"
+
+#include <sys/time.h>
+
+#define EVENT_PROFILER_MAX_SAMPLES 256
+#define EVENT_PROFILER_MAX_DEPTH 16
+/* backtrace_get_addresses(), event_profiler_signal(), signal_handler() and
+   the signal trampoline */
+#define EVENT_PROFILER_SKIP_FRAMES 4
+
+struct event_profiler_sample {
+	struct event *event;
+	unsigned int depth;
+	void *stack[EVENT_PROFILER_MAX_DEPTH];
+};
+
+static bool profiler_enabled = FALSE;
+static unsigned int profiler_interval_msecs;
+static sigset_t profiler_sigset;
+
+/* Written by the signal handler. Accessed by others only while SIGPROF is
+   blocked. */
+static struct event_profiler_sample samples[EVENT_PROFILER_MAX_SAMPLES];
+static volatile unsigned int samples_count;
+static volatile unsigned int samples_dropped;
+
+static void
+event_profiler_signal(const siginfo_t *si ATTR_UNUSED,
+		      void *context ATTR_UNUSED)
+{
+	void *stack[EVENT_PROFILER_MAX_DEPTH + EVENT_PROFILER_SKIP_FRAMES];
+	struct event_profiler_sample *sample;
+	unsigned int depth;
+
+	if (samples_count >= EVENT_PROFILER_MAX_SAMPLES) {
+		samples_dropped++;
+		return;
+	}
+
+	depth = backtrace_get_addresses(stack, N_ELEMENTS(stack));
+	if (depth <= EVENT_PROFILER_SKIP_FRAMES)
+		return;
+	depth -= EVENT_PROFILER_SKIP_FRAMES;
+
+	sample = &samples[samples_count];
+	sample->event = event_get_global();
+	sample->depth = depth;
+	memcpy(sample->stack, stack + EVENT_PROFILER_SKIP_FRAMES,
+	       sizeof(sample->stack[0]) * depth);
+	samples_count++;
+}
+
+static unsigned int
+event_profiler_take_samples(struct event *event,
+			    struct event_profiler_sample **samples_r,
+			    unsigned int *dropped_r)
+{
+	struct event_profiler_sample *taken;
+	sigset_t oldset;
+	unsigned int i, count = 0, left = 0;
+
+	if (sigprocmask(SIG_BLOCK, &profiler_sigset, &oldset) < 0)
+		i_fatal("sigprocmask() failed: %m");
+	taken = t_new(struct event_profiler_sample, samples_count + 1);
+	for (i = 0; i < samples_count; i++) {
+		if (event == NULL || samples[i].event == event ||
+		    samples[i].event == NULL)
+			taken[count++] = samples[i];
+		else
+			samples[left++] = samples[i];
+	}
+	samples_count = left;
+	*dropped_r = samples_dropped;
+	samples_dropped = 0;
+	if (sigprocmask(SIG_SETMASK, &oldset, NULL) < 0)
+		i_fatal("sigprocmask() failed: %m");
+
+	*samples_r = taken;
+	return count;
+}
+
+static void
+event_profiler_send(struct event *parent, const char *stack,
+		    unsigned int count, unsigned int dropped)
+{
+	struct event *event = event_create(parent);
+
+	event_set_name(event, "profiler_samples");
+	event_add_str(event, "stack", stack);
+	event_add_int(event, "samples", count);
+	event_add_int(event, "sample_interval_msecs", profiler_interval_msecs);
+	event_add_int(event, "dropped_samples", dropped);
+	e_debug(event, "Profiler samples: %u x %s", count, stack);
+	event_unref(&event);
+}
+
+static void
+event_profiler_send_samples(struct event *parent, struct event *event,
+			    const struct event_profiler_sample *taken,
+			    unsigned int count, unsigned int *dropped)
+{
+	ARRAY_TYPE(const_string) stacks;
+	const char *const *stackp, *error;
+	unsigned int i, stacks_count, first;
+	string_t *str;
+
+	/* aggregate the samples by their function names */
+	t_array_init(&stacks, count);
+	str = t_str_new(256);
+	for (i = 0; i < count; i++) {
+		if (taken[i].event != event)
+			continue;
+		str_truncate(str, 0);
+		if (backtrace_append_functions(str, taken[i].stack,
+					       taken[i].depth, &error) < 0)
+			str_append(str, "unknown");
+		const char *stack = t_strdup(str_c(str));
+		array_push_back(&stacks, &stack);
+	}
+	array_sort(&stacks, i_strcmp_p);
+
+	stackp = array_get(&stacks, &stacks_count);
+	for (first = i = 0; i <= stacks_count; i++) {
+		if (i < stacks_count && strcmp(stackp[first], stackp[i]) == 0)
+			continue;
+		if (i > first) {
+			event_profiler_send(parent, stackp[first], i - first,
+					    *dropped);
+			*dropped = 0;
+		}
+		first = i;
+	}
+}
+
+static void event_profiler_flush(struct event *event)
+{
+	struct event_profiler_sample *taken;
+	unsigned int i, count, dropped;
+
+	count = event_profiler_take_samples(event, &taken, &dropped);
+	if (count == 0 && dropped == 0)
+		return;
+
+	if (event == NULL) {
+		/* deinit - the events may not exist anymore */
+		for (i = 0; i < count; i++)
+			taken[i].event = NULL;
+	} else {
+		/* the event's samples are sent as its children */
+		event_profiler_send_samples(event, event, taken, count,
+					    &dropped);
+	}
+	/* the samples without a global event are sent without a parent */
+	event_profiler_send_samples(NULL, NULL, taken, count, &dropped);
+	if (dropped > 0)
+		event_profiler_send(NULL, "", 0, dropped);
+}
+
+void event_profiler_event_popped(struct event *event)
+{
+	if (!profiler_enabled ||
+	    (samples_count == 0 && samples_dropped == 0))
+		return;
+
+	T_BEGIN {
+		event_profiler_flush(event);
+	} T_END;
+}
+
+void event_profiler_init(unsigned int interval_msecs)
+{
+	struct itimerval itv;
+	void *stack[1];
+
+	i_assert(interval_msecs > 0);
+
+	if (profiler_enabled)
+		return;
+
+	/* backtrace() may need to load libraries on the first call, which
+	   can't be done in a signal handler. */
+	if (backtrace_get_addresses(stack, N_ELEMENTS(stack)) == 0) {
+		i_error("Profiler not supported: backtrace() unavailable");
+		return;
+	}
+
+	sigemptyset(&profiler_sigset);
+	sigaddset(&profiler_sigset, SIGPROF);
+	lib_signals_set_handler(SIGPROF, LIBSIG_FLAG_RESTART,
+				event_profiler_signal, NULL);
+
+	profiler_interval_msecs = interval_msecs;
+	i_zero(&itv);
+	itv.it_interval.tv_sec = interval_msecs / 1000;
+	itv.it_interval.tv_usec = (interval_msecs % 1000) * 1000;
+	itv.it_value = itv.it_interval;
+	if (setitimer(ITIMER_PROF, &itv, NULL) < 0) {
+		i_error("setitimer(ITIMER_PROF) failed: %m");
+		lib_signals_unset_handler(SIGPROF, event_profiler_signal, NULL);
+		return;
+	}
+	profiler_enabled = TRUE;
+}
+
+void event_profiler_deinit(void)
+{
+	struct itimerval itv;
+
+	if (!profiler_enabled)
+		return;
+
+	i_zero(&itv);
+	if (setitimer(ITIMER_PROF, &itv, NULL) < 0)
+		i_error("setitimer(ITIMER_PROF) failed: %m");
+	lib_signals_unset_handler(SIGPROF, event_profiler_signal, NULL);
+
+	T_BEGIN {
+		event_profiler_flush(NULL);
+	} T_END;
+	profiler_enabled = FALSE;
+}
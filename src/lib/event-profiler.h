@@ -0,0 +1,25 @@
+#ifndef EVENT_PROFILER_H
+#define EVENT_PROFILER_H
+
+/* Sampling CPU profiler. Every interval_msecs of CPU time used by the process
+   the current call stack is recorded and attributed to the current global
+   event. When the global event is popped, its samples are sent as
+   "profiler_samples" events, which are children of the popped event. They
+   have fields:
+
+    - stack: " -> " separated function names, innermost first
+    - samples: number of samples with this stack
+    - sample_interval_msecs: the interval_msecs
+    - dropped_samples: number of samples dropped since the previous flush
+      because the sample buffer was full
+
+   Samples taken without a global event are sent without a parent event.
+   Stats metrics can then be used to aggregate the samples e.g. by user or
+   command. */
+void event_profiler_init(unsigned int interval_msecs);
+void event_profiler_deinit(void);
+
+/* Called by event_pop_global() after the event was popped. */
+void event_profiler_event_popped(struct event *event);
+
+#endif
@@ -60,6 +60,11 @@ static char *log_prefix = NULL;
 static char *log_stamp_format = NULL, *log_stamp_format_suffix = NULL;
 static bool failure_ignore_errors = FALSE, log_prefix_sent = FALSE;
 static bool coredump_on_error = FALSE;
+/* Lines written by default_write() are collected here while write buffering
+   is enabled. All the buffered lines go to log_write_buf_fd. */
+static buffer_t *log_write_buf = NULL;
+static int log_write_buf_fd = -1;
+static size_t log_write_buf_max_size = 0;
 static void log_timestamp_add(const struct failure_context *ctx, string_t *str);
 static void log_prefix_add(const struct failure_context *ctx, string_t *str);
 static int i_failure_send_option_forced(const char *key, const char *value);
@@ -79,6 +84,37 @@ static string_t * ATTR_FORMAT(3, 0) default_format(const struct failure_context
 	return str;
 }
 
+static int log_write_buf_flush(void)
+{
+	int ret;
+
+	if (log_write_buf == NULL || log_write_buf->used == 0)
+		return 0;
+
+	/* clear the buffer before writing, so a write failure doesn't
+	   cause the same data to be written again while logging the
+	   failure. */
+	ret = log_fd_write(log_write_buf_fd, log_write_buf->data,
+			   log_write_buf->used);
+	buffer_set_used_size(log_write_buf, 0);
+	return ret;
+}
+
+static int log_write_buf_append(int fd, string_t *data)
+{
+	if (log_write_buf == NULL)
+		log_write_buf = buffer_create_dynamic(default_pool, 8192);
+	else if (fd != log_write_buf_fd) {
+		if (log_write_buf_flush() < 0)
+			return -1;
+	}
+	log_write_buf_fd = fd;
+	buffer_append_buf(log_write_buf, data, 0, SIZE_MAX);
+	if (log_write_buf->used < log_write_buf_max_size)
+		return 0;
+	return log_write_buf_flush();
+}
+
 static int default_write(enum log_type type, string_t *data, size_t prefix_len ATTR_UNUSED)
 {
 	int fd;
@@ -95,6 +131,12 @@ static int default_write(enum log_type type, string_t *data, size_t prefix_len A
 		break;
 	}
 	str_append_c(data, '\n');
+	if (log_write_buf_max_size > 0 && type < LOG_TYPE_FATAL)
+		return log_write_buf_append(fd, data);
+	/* make sure fatals/panics don't get written before the earlier
+	   buffered lines */
+	if (log_write_buf_flush() < 0)
+		return -1;
 	return log_fd_write(fd, str_data(data), str_len(data));
 }
 
@@ -661,6 +703,7 @@ void i_syslog_error_handler(const struct failure_context *ctx,
 
 void i_set_failure_syslog(const char *ident, int options, int facility)
 {
+	i_failure_write_flush();
 	openlog(ident, options, facility);
 
 	i_set_fatal_handler(i_syslog_fatal_handler);
@@ -673,6 +716,7 @@ static void open_log_file(int *fd, const char *path)
 {
 	const char *str;
 
+	i_failure_write_flush();
 	if (*fd != STDERR_FILENO) {
 		if (close(*fd) < 0) {
 			str = t_strdup_printf("close(%d) failed: %m\n", *fd);
@@ -701,6 +745,7 @@ static void open_log_file(int *fd, const char *path)
 void i_set_failure_file(const char *path, const char *prefix)
 {
 	i_set_failure_prefix("%s", prefix);
+	i_failure_write_flush();
 
 	if (log_info_fd != STDERR_FILENO && log_info_fd != log_fd) {
 		if (close(log_info_fd) < 0)
@@ -962,8 +1007,30 @@ void i_set_failure_exit_callback(void (*callback)(int *status))
 	failure_exit_callback = callback;
 }
 
+void i_set_failure_write_buffer_size(size_t max_size)
+{
+	if (max_size == 0)
+		i_failure_write_flush();
+	log_write_buf_max_size = max_size;
+}
+
+void i_failure_write_flush(void)
+{
+	struct failure_context ctx;
+	int fd = log_write_buf_fd;
+
+	if (log_write_buf_flush() < 0 && !failure_ignore_errors) {
+		i_zero(&ctx);
+		ctx.type = fd == log_fd ? LOG_TYPE_ERROR : LOG_TYPE_INFO;
+		default_on_handler_failure(&ctx);
+	}
+}
+
 void failures_deinit(void)
 {
+	i_set_failure_write_buffer_size(0);
+	buffer_free(&log_write_buf);
+
 	if (log_debug_fd == log_info_fd || log_debug_fd == log_fd)
 		log_debug_fd = STDERR_FILENO;
 
@@ -144,6 +144,16 @@ void i_set_failure_timestamp_format(const char *fmt);
 void i_set_failure_send_ip(const struct ip_addr *ip);
 void i_set_failure_send_prefix(const char *prefix);
 
+/* Buffer the lines written to log files, and write them with a single
+   write() call once max_size bytes have been buffered or
+   i_failure_write_flush() is called. Fatal and panic messages flush the
+   buffer and are written immediately. Setting max_size to 0 flushes and
+   disables the buffering. This is mainly useful for the log process, which
+   writes a lot of lines at once. */
+void i_set_failure_write_buffer_size(size_t max_size);
+/* Write all the buffered log lines. */
+void i_failure_write_flush(void);
+
 /* Call the callback before exit()ing. The callback may update the status. */
 void i_set_failure_exit_callback(void (*callback)(int *status));
 /* Call the exit callback and exit() */
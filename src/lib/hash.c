@@ -9,8 +9,14 @@
 #include <ctype.h>
 
 #define HASH_TABLE_MIN_SIZE 67
+#define HASH_TABLE_OPEN_MIN_SIZE 16
+
+/* Key of a removed node in open addressing tables */
+static char hash_open_removed_key;
+#define HASH_OPEN_REMOVED_KEY ((void *)&hash_open_removed_key)
 
 #undef hash_table_create
+#undef hash_table_create_flags
 #undef hash_table_create_direct
 #undef hash_table_destroy
 #undef hash_table_clear
@@ -32,6 +38,13 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_open_node {
+	/* NULL = unused, HASH_OPEN_REMOVED_KEY = removed */
+	void *key;
+	void *value;
+	unsigned int hash;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
@@ -44,6 +57,12 @@ struct hash_table {
 
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
+
+	/* Used instead of nodes with HASH_TABLE_FLAG_OPEN_ADDRESSING. size is
+	   always a power of 2, and removed_count is the number of nodes with
+	   HASH_OPEN_REMOVED_KEY. There's always at least one unused node. */
+	struct hash_open_node *open_nodes;
+	unsigned int open_size_bits;
 };
 
 struct hash_iterate_context {
@@ -59,27 +78,49 @@ enum hash_table_operation{
 };
 
 static bool hash_table_resize(struct hash_table *table, bool grow);
+static void hash_open_resize(struct hash_table *table, unsigned int size);
 
-void hash_table_create(struct hash_table **table_r, pool_t node_pool,
-		       unsigned int initial_size, hash_callback_t *hash_cb,
-		       hash_cmp_callback_t *key_compare_cb)
+static unsigned int hash_open_size(unsigned int nodes_count)
+{
+	/* keep the table at most half full after resizing */
+	return I_MAX(nearest_power(nodes_count * 2 + 1),
+		     HASH_TABLE_OPEN_MIN_SIZE);
+}
+
+void hash_table_create_flags(struct hash_table **table_r, pool_t node_pool,
+			     unsigned int initial_size,
+			     enum hash_table_flags flags,
+			     hash_callback_t *hash_cb,
+			     hash_cmp_callback_t *key_compare_cb)
 {
 	struct hash_table *table;
 
 	pool_ref(node_pool);
 	table = i_new(struct hash_table, 1);
 	table->node_pool = node_pool;
-	table->initial_size =
-		I_MAX(primes_closest(initial_size), HASH_TABLE_MIN_SIZE);
-
 	table->hash_cb = hash_cb;
 	table->key_compare_cb = key_compare_cb;
 
-	table->size = table->initial_size;
-	table->nodes = i_new(struct hash_node, table->size);
+	if ((flags & HASH_TABLE_FLAG_OPEN_ADDRESSING) != 0) {
+		table->initial_size = hash_open_size(initial_size);
+		hash_open_resize(table, table->initial_size);
+	} else {
+		table->initial_size = I_MAX(primes_closest(initial_size),
+					    HASH_TABLE_MIN_SIZE);
+		table->size = table->initial_size;
+		table->nodes = i_new(struct hash_node, table->size);
+	}
 	*table_r = table;
 }
 
+void hash_table_create(struct hash_table **table_r, pool_t node_pool,
+		       unsigned int initial_size, hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb)
+{
+	hash_table_create_flags(table_r, node_pool, initial_size, 0,
+				hash_cb, key_compare_cb);
+}
+
 static unsigned int direct_hash(const void *p)
 {
 	/* NOTE: may truncate the value, but that doesn't matter. */
@@ -98,6 +139,139 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+static inline unsigned int
+hash_open_first_idx(const struct hash_table *table, unsigned int hash)
+{
+	/* Fibonacci hashing spreads also hashes that differ only in their
+	   high bits, such as pointers. */
+	return (uint32_t)(hash * 2654435769U) >> (32 - table->open_size_bits);
+}
+
+static struct hash_open_node *
+hash_open_lookup_node(const struct hash_table *table,
+		      const void *key, unsigned int hash)
+{
+	struct hash_open_node *node;
+	unsigned int idx, mask = table->size - 1;
+
+	for (idx = hash_open_first_idx(table, hash);; idx = (idx + 1) & mask) {
+		node = &table->open_nodes[idx];
+		if (node->key == NULL)
+			return NULL;
+		if (node->hash == hash && node->key != HASH_OPEN_REMOVED_KEY &&
+		    table->key_compare_cb(node->key, key) == 0)
+			return node;
+	}
+}
+
+static void
+hash_open_insert_new(struct hash_table *table, void *key, void *value,
+		     unsigned int hash)
+{
+	struct hash_open_node *node;
+	unsigned int idx, mask = table->size - 1;
+
+	for (idx = hash_open_first_idx(table, hash);; idx = (idx + 1) & mask) {
+		node = &table->open_nodes[idx];
+		if (node->key == NULL)
+			break;
+		if (node->key == HASH_OPEN_REMOVED_KEY) {
+			table->removed_count--;
+			break;
+		}
+	}
+	node->key = key;
+	node->value = value;
+	node->hash = hash;
+	table->nodes_count++;
+}
+
+static void hash_open_resize(struct hash_table *table, unsigned int size)
+{
+	struct hash_open_node *old_nodes = table->open_nodes;
+	unsigned int i, old_size = table->size;
+
+	i_assert(table->frozen == 0);
+	i_assert(size > table->nodes_count);
+
+	table->size = size;
+	table->open_size_bits = bits_required32(size) - 1;
+	table->open_nodes = i_new(struct hash_open_node, size);
+	table->nodes_count = 0;
+	table->removed_count = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_nodes[i].key != NULL &&
+		    old_nodes[i].key != HASH_OPEN_REMOVED_KEY) {
+			hash_open_insert_new(table, old_nodes[i].key,
+					     old_nodes[i].value,
+					     old_nodes[i].hash);
+		}
+	}
+	i_free(old_nodes);
+}
+
+static void hash_open_try_shrink(struct hash_table *table)
+{
+	unsigned int size;
+
+	if (table->frozen != 0)
+		return;
+
+	size = hash_open_size(table->nodes_count);
+	if (size < table->size / 4)
+		hash_open_resize(table, I_MAX(size, table->initial_size));
+	else if (table->removed_count > table->nodes_count)
+		hash_open_resize(table, table->size);
+}
+
+static void
+hash_open_insert(struct hash_table *table, void *key, void *value,
+		 enum hash_table_operation opcode)
+{
+	struct hash_open_node *node;
+	unsigned int hash;
+
+	i_assert(key != NULL && key != HASH_OPEN_REMOVED_KEY);
+
+	hash = table->hash_cb(key);
+	node = hash_open_lookup_node(table, key, hash);
+	if (node != NULL) {
+		i_assert(opcode == HASH_TABLE_OP_UPDATE);
+		node->value = value;
+		return;
+	}
+
+	/* keep the table at most 3/4 full, including the removed nodes */
+	if ((table->nodes_count + table->removed_count + 1) * 4 >
+	    table->size * 3) {
+		if (table->frozen == 0)
+			hash_open_resize(table, hash_open_size(table->nodes_count + 1));
+		else if (table->nodes_count + table->removed_count + 1 >=
+			 table->size) {
+			i_panic("hash table: Too many nodes added while frozen "
+				"(size=%u)", table->size);
+		}
+	}
+	hash_open_insert_new(table, key, value, hash);
+}
+
+static bool hash_open_try_remove(struct hash_table *table, const void *key)
+{
+	struct hash_open_node *node;
+
+	node = hash_open_lookup_node(table, key, table->hash_cb(key));
+	if (unlikely(node == NULL))
+		return FALSE;
+
+	node->key = HASH_OPEN_REMOVED_KEY;
+	node->value = NULL;
+	table->nodes_count--;
+	table->removed_count++;
+	hash_open_try_shrink(table);
+	return TRUE;
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,13 +313,14 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (table->open_nodes == NULL && !table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
 
 	pool_unref(&table->node_pool);
 	i_free(table->nodes);
+	i_free(table->open_nodes);
 	i_free(table);
 }
 
@@ -153,6 +328,14 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->open_nodes != NULL) {
+		memset(table->open_nodes, 0,
+		       sizeof(struct hash_open_node) * table->size);
+		table->nodes_count = 0;
+		table->removed_count = 0;
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +374,12 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->open_nodes != NULL) {
+		struct hash_open_node *onode =
+			hash_open_lookup_node(table, key, table->hash_cb(key));
+		return onode != NULL ? onode->value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +390,17 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->open_nodes != NULL) {
+		struct hash_open_node *onode =
+			hash_open_lookup_node(table, lookup_key,
+					      table->hash_cb(lookup_key));
+		if (onode == NULL)
+			return FALSE;
+		*orig_key = onode->key;
+		*value = onode->value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +497,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->open_nodes != NULL)
+		hash_open_insert(table, key, value, HASH_TABLE_OP_INSERT);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->open_nodes != NULL)
+		hash_open_insert(table, key, value, HASH_TABLE_OP_UPDATE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +553,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->open_nodes != NULL)
+		return hash_open_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -376,10 +585,31 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (table->open_nodes == NULL)
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
+static bool
+hash_open_iterate(struct hash_iterate_context *ctx,
+		  void **key_r, void **value_r)
+{
+	struct hash_table *table = ctx->table;
+	struct hash_open_node *node;
+
+	for (; ctx->pos < table->size; ctx->pos++) {
+		node = &table->open_nodes[ctx->pos];
+		if (node->key != NULL && node->key != HASH_OPEN_REMOVED_KEY) {
+			*key_r = node->key;
+			*value_r = node->value;
+			ctx->pos++;
+			return TRUE;
+		}
+	}
+	*key_r = *value_r = NULL;
+	return FALSE;
+}
+
 static struct hash_node *
 hash_table_iterate_next(struct hash_iterate_context *ctx,
 			struct hash_node *node)
@@ -403,6 +633,9 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 {
 	struct hash_node *node;
 
+	if (ctx->table->open_nodes != NULL)
+		return hash_open_iterate(ctx, key_r, value_r);
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -441,6 +674,10 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->open_nodes != NULL) {
+		hash_open_try_shrink(table);
+		return;
+	}
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
@@ -509,14 +746,17 @@ void hash_table_copy(struct hash_table *dest, struct hash_table *src)
 	struct hash_iterate_context *iter;
 	void *key, *value;
 
-	hash_table_freeze(dest);
+	/* open addressing tables must be able to grow while inserting */
+	if (dest->open_nodes == NULL)
+		hash_table_freeze(dest);
 
 	iter = hash_table_iterate_init(src);
 	while (hash_table_iterate(iter, &key, &value))
 		hash_table_insert(dest, key, value);
 	hash_table_iterate_deinit(&iter);
 
-	hash_table_thaw(dest);
+	if (dest->open_nodes == NULL)
+		hash_table_thaw(dest);
 }
 
 /* a char* hash function from ASU -- from glib */
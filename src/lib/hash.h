@@ -41,6 +41,40 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		(hash_callback_t *)hash_cb, \
 		(hash_cmp_callback_t *)key_cmp_cb))
 
+enum hash_table_flags {
+	/* Use open addressing (linear probing) instead of chaining. The nodes
+	   are stored directly in the table array, so no memory is allocated
+	   for them and lookups access fewer cache lines. The table isn't
+	   resized while it's frozen (or iterated), so while frozen only as
+	   many nodes can be added as there is free space in the table. */
+	HASH_TABLE_FLAG_OPEN_ADDRESSING	= 0x01,
+};
+
+/* Like hash_table_create(), but with flags. */
+void hash_table_create_flags(struct hash_table **table_r, pool_t node_pool,
+			     unsigned int initial_size,
+			     enum hash_table_flags flags,
+			     hash_callback_t *hash_cb,
+			     hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create_flags(table, pool, size, flags, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)) || \
+	COMPILE_ERROR_IF_TRUE( \
+               !__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+                       int (*)(typeof((*table)._key), typeof((*table)._key))) && \
+               !__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+                       int (*)(typeof((*table)._const_key), typeof((*table)._const_key)))) || \
+	COMPILE_ERROR_IF_TRUE( \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+			unsigned int (*)(typeof((*table)._key))) && \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+		unsigned int (*)(typeof((*table)._const_key)))), \
+	hash_table_create_flags(&(*table)._table, pool, size, flags, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb))
+
 /* Create hash table where comparisons are done directly with the pointers. */
 void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			      unsigned int initial_size);
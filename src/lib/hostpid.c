@@ -16,7 +16,6 @@ static char *my_domain = NULL;
 
 void hostpid_init(void)
 {
-	static char pid[MAX_INT_STRLEN];
 	char hostname[256];
 	const char *value;
 
@@ -38,6 +37,13 @@ void hostpid_init(void)
 	my_hostname_dup = i_strdup(value);
 	my_hostname = my_hostname_dup;
 
+	hostpid_update_pid();
+}
+
+void hostpid_update_pid(void)
+{
+	static char pid[MAX_INT_STRLEN];
+
 	i_snprintf(pid, sizeof(pid), "%lld", (long long)getpid());
 	my_pid = pid;
 }
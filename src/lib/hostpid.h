@@ -12,6 +12,9 @@ extern const char *my_pid;
 /* Initializes my_hostname and my_pid. */
 void hostpid_init(void);
 void hostpid_deinit(void);
+/* Update my_pid. This needs to be called after fork() in a child process that
+   keeps running the parent's code. */
+void hostpid_update_pid(void);
 
 /* Returns the current host+domain, or if it fails fallback to returning
    hostname. */
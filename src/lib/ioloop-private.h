@@ -74,6 +74,11 @@ struct timeout {
 
         unsigned int msecs;
 	struct timeval next_run;
+	/* timeout_reset() of a long timeout only sets this instead of
+	   repositioning the timeout in the priority queue. The queue keeps
+	   using next_run until the timeout reaches the head of the queue,
+	   where it's repositioned using this time. tv_sec=0 if unset. */
+	struct timeval deferred_run;
 
 	timeout_callback_t *callback;
         void *context;
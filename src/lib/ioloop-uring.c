@@ -0,0 +1,536 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Number of SQEs in the submission ring. Changes are queued into the ring
+   and only submitted once per ioloop iteration, so this only needs to be
+   large enough for the changes done within a single iteration. If it fills
+   up, the queued SQEs are submitted early. */
+#define IOLOOP_URING_SQ_ENTRIES 1024
+
+/* user_data for completions that we don't care about (poll removals and
+   wait timeouts) */
+#define IOLOOP_URING_USER_DATA_IGNORE ((uint64_t)-1)
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+struct ioloop_uring_fd {
+	struct io_list *list;
+
+	/* Incremented whenever the wanted poll mask changes. Completions
+	   from polls armed with an older generation are ignored. */
+	uint32_t generation;
+	/* generation of the currently armed poll */
+	uint32_t armed_generation;
+	bool armed:1;
+	bool dirty:1;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+	uint32_t features;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_array;
+	unsigned int sq_mask, sq_entries;
+	unsigned int *cq_head, *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* SQEs queued to the ring, but not yet submitted */
+	unsigned int sq_queued;
+	/* Poll changes done by I/O and timeout callbacks are queued and
+	   submitted with the next wait. */
+	bool batching;
+	struct __kernel_timespec wait_ts;
+
+	ARRAY(struct ioloop_uring_fd) fd_index;
+	/* fds whose poll needs to be (re-)armed or removed */
+	ARRAY(int) dirty_fds;
+	ARRAY(struct io_uring_cqe) events;
+};
+
+static int
+io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete,
+	       unsigned int flags, const void *arg, size_t arg_size)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			    min_complete, flags, arg, arg_size);
+}
+
+static void *
+io_uring_mmap(int ring_fd, size_t size, off_t offset, const char *name)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+	if (ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring %s) failed: %m", name);
+	return ptr;
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+	struct io_uring_params params;
+
+	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
+
+	i_array_init(&ctx->events, initial_fd_count);
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->dirty_fds, initial_fd_count);
+
+	i_zero(&params);
+	ctx->ring_fd = io_uring_setup(IOLOOP_URING_SQ_ENTRIES, &params);
+	if (ctx->ring_fd < 0) {
+		if (errno == ENOSYS || errno == EPERM) {
+			i_fatal("io_uring_setup() failed: %m (Dovecot was "
+				"built with --with-ioloop=uring, but the kernel "
+				"doesn't allow using io_uring - check "
+				"/proc/sys/kernel/io_uring_disabled)");
+		}
+		i_fatal("io_uring_setup() failed: %m");
+	}
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+	ctx->features = params.features;
+
+	ctx->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((ctx->features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_ring_size = I_MAX(ctx->sq_ring_size, ctx->cq_ring_size);
+		ctx->cq_ring_size = ctx->sq_ring_size;
+	}
+	ctx->sq_ring = io_uring_mmap(ctx->ring_fd, ctx->sq_ring_size,
+				     IORING_OFF_SQ_RING, "sq ring");
+	if ((ctx->features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ctx->cq_ring = ctx->sq_ring;
+	else {
+		ctx->cq_ring = io_uring_mmap(ctx->ring_fd, ctx->cq_ring_size,
+					     IORING_OFF_CQ_RING, "cq ring");
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = io_uring_mmap(ctx->ring_fd, ctx->sqes_size,
+				  IORING_OFF_SQES, "sqes");
+
+	ctx->sq_head = PTR_OFFSET(ctx->sq_ring, params.sq_off.head);
+	ctx->sq_tail = PTR_OFFSET(ctx->sq_ring, params.sq_off.tail);
+	ctx->sq_array = PTR_OFFSET(ctx->sq_ring, params.sq_off.array);
+	ctx->sq_mask = *(unsigned int *)PTR_OFFSET(ctx->sq_ring,
+						   params.sq_off.ring_mask);
+	ctx->sq_entries = params.sq_entries;
+	ctx->cq_head = PTR_OFFSET(ctx->cq_ring, params.cq_off.head);
+	ctx->cq_tail = PTR_OFFSET(ctx->cq_ring, params.cq_off.tail);
+	ctx->cq_mask = *(unsigned int *)PTR_OFFSET(ctx->cq_ring,
+						   params.cq_off.ring_mask);
+	ctx->cqes = PTR_OFFSET(ctx->cq_ring, params.cq_off.cqes);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct ioloop_uring_fd *fds;
+	unsigned int i, count;
+
+	fds = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++)
+		i_free(fds[i].list);
+
+	if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (ctx->cq_ring != ctx->sq_ring &&
+	    munmap(ctx->cq_ring, ctx->cq_ring_size) < 0)
+		i_error("munmap(io_uring cq ring) failed: %m");
+	if (munmap(ctx->sq_ring, ctx->sq_ring_size) < 0)
+		i_error("munmap(io_uring sq ring) failed: %m");
+	if (close(ctx->ring_fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	array_free(&ctx->fd_index);
+	array_free(&ctx->dirty_fds);
+	array_free(&ctx->events);
+	i_free(ioloop->handler_context);
+}
+
+static void
+io_uring_submit(struct ioloop_handler_context *ctx, unsigned int min_complete,
+		unsigned int flags, const void *arg, size_t arg_size)
+{
+	int ret;
+
+	ret = io_uring_enter(ctx->ring_fd, ctx->sq_queued, min_complete,
+			     flags, arg, arg_size);
+	if (ret < 0) {
+		if (errno == EINTR || errno == ETIME)
+			return;
+		if (errno == EAGAIN || errno == EBUSY) {
+			/* kernel is out of resources or the completion
+			   queue is overflowing. The completions are reaped
+			   afterwards, so the submission is retried on the next
+			   iteration. */
+			return;
+		}
+		i_fatal("io_uring_enter() failed: %m");
+	}
+	i_assert((unsigned int)ret <= ctx->sq_queued);
+	ctx->sq_queued -= ret;
+}
+
+static struct io_uring_sqe *
+io_uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+
+	tail = *ctx->sq_tail;
+	if (tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE) >=
+	    ctx->sq_entries) {
+		/* submission queue is full - submit the queued ones now */
+		io_uring_submit(ctx, 0, 0, NULL, 0);
+		if (tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE) >=
+		    ctx->sq_entries)
+			i_panic("io_uring submission queue is full");
+	}
+
+	idx = tail & ctx->sq_mask;
+	sqe = &ctx->sqes[idx];
+	i_zero(sqe);
+	ctx->sq_array[idx] = idx;
+	__atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ctx->sq_queued++;
+	return sqe;
+}
+
+static uint64_t io_uring_fd_user_data(int fd, uint32_t generation)
+{
+	return ((uint64_t)fd << 32) | generation;
+}
+
+static unsigned int io_uring_poll_mask(struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+
+	return events;
+}
+
+static void
+io_uring_fd_set_dirty(struct ioloop_handler_context *ctx, int fd,
+		      struct ioloop_uring_fd *ufd)
+{
+	if (!ufd->dirty) {
+		ufd->dirty = TRUE;
+		array_push_back(&ctx->dirty_fds, &fd);
+	}
+}
+
+static void
+io_uring_fd_flush(struct ioloop_handler_context *ctx, int fd,
+		  struct ioloop_uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int mask;
+
+	i_assert(ufd->dirty);
+	ufd->dirty = FALSE;
+
+	mask = ufd->list == NULL ? 0 : io_uring_poll_mask(ufd->list);
+	if (ufd->armed) {
+		sqe = io_uring_get_sqe(ctx);
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = io_uring_fd_user_data(fd, ufd->armed_generation);
+		sqe->user_data = IOLOOP_URING_USER_DATA_IGNORE;
+		ufd->armed = FALSE;
+	}
+	if (mask == 0)
+		return;
+
+	/* The polls are one-shot and re-armed after each completion. Arming
+	   checks the current readiness of the fd, so this gives the same
+	   level-triggered behavior as the other ioloop handlers. */
+	sqe = io_uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = mask;
+	sqe->user_data = io_uring_fd_user_data(fd, ufd->generation);
+	ufd->armed_generation = ufd->generation;
+	ufd->armed = TRUE;
+}
+
+static void io_uring_flush_dirty(struct ioloop_handler_context *ctx)
+{
+	struct ioloop_uring_fd *ufd;
+	int fd;
+
+	array_foreach_elem(&ctx->dirty_fds, fd) {
+		ufd = array_idx_modifiable(&ctx->fd_index, fd);
+		io_uring_fd_flush(ctx, fd, ufd);
+	}
+	array_clear(&ctx->dirty_fds);
+}
+
+static void
+io_uring_fd_changed(struct ioloop_handler_context *ctx, int fd,
+		    struct ioloop_uring_fd *ufd)
+{
+	ufd->generation++;
+	io_uring_fd_set_dirty(ctx, fd, ufd);
+	if (!ctx->batching) {
+		/* Not called from an I/O or timeout callback. Submit the
+		   change immediately, so the events are received in the same
+		   order as with the other ioloop handlers. */
+		io_uring_flush_dirty(ctx);
+		io_uring_submit(ctx, 0, 0, NULL, 0);
+	}
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct ioloop_uring_fd *ufd;
+
+	ufd = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (ufd->list == NULL)
+		ufd->list = i_new(struct io_list, 1);
+
+	(void)ioloop_iolist_add(ufd->list, io);
+	io_uring_fd_changed(ctx, io->fd, ufd);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed ATTR_UNUSED)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct ioloop_uring_fd *ufd;
+
+	/* Even if the fd is already closed, the armed poll keeps a reference
+	   to the file in kernel. It's removed via its user_data, which
+	   doesn't depend on the fd anymore. */
+	ufd = array_idx_modifiable(&ctx->fd_index, io->fd);
+	(void)ioloop_iolist_del(ufd->list, io);
+	io_uring_fd_changed(ctx, io->fd, ufd);
+	i_free(io);
+}
+
+static void
+io_uring_wait(struct ioloop_handler_context *ctx, int msecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct io_uring_sqe *sqe;
+
+	if (msecs == 0) {
+		io_uring_submit(ctx, 0, 0, NULL, 0);
+		return;
+	}
+	if (msecs < 0) {
+		io_uring_submit(ctx, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		return;
+	}
+
+	ctx->wait_ts.tv_sec = msecs / 1000;
+	ctx->wait_ts.tv_nsec = (msecs % 1000) * 1000000LL;
+	if ((ctx->features & IORING_FEAT_EXT_ARG) != 0) {
+		i_zero(&arg);
+		arg.ts = (uint64_t)(uintptr_t)&ctx->wait_ts;
+		io_uring_submit(ctx, 1, IORING_ENTER_GETEVENTS |
+				IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		return;
+	}
+
+	/* Old kernel: use a timeout SQE that completes either after the
+	   timeout or after one other completion, so it never outlives this
+	   wait. */
+	sqe = io_uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&ctx->wait_ts;
+	sqe->len = 1;
+	sqe->off = 1;
+	sqe->user_data = IOLOOP_URING_USER_DATA_IGNORE;
+	io_uring_submit(ctx, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static unsigned int io_uring_reap(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail, count = 0;
+
+	array_clear(&ctx->events);
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & ctx->cq_mask];
+		if (cqe->user_data == IOLOOP_URING_USER_DATA_IGNORE)
+			continue;
+		array_push_back(&ctx->events, cqe);
+		count++;
+	}
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+static void
+io_uring_events_rearm(struct ioloop_handler_context *ctx,
+		      unsigned int events_count)
+{
+	struct io_uring_cqe *event;
+	struct ioloop_uring_fd *ufd;
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < events_count; i++) {
+		event = array_idx_modifiable(&ctx->events, i);
+		fd = (int)(event->user_data >> 32);
+
+		if ((unsigned int)fd >= array_count(&ctx->fd_index))
+			ufd = NULL;
+		else
+			ufd = array_idx_modifiable(&ctx->fd_index, fd);
+		if (ufd == NULL || !ufd->armed ||
+		    ufd->armed_generation != (uint32_t)event->user_data) {
+			/* completion of an already removed poll */
+			event->user_data = IOLOOP_URING_USER_DATA_IGNORE;
+			continue;
+		}
+		if (event->res < 0) {
+			errno = -event->res;
+			i_panic("io_uring poll(%d) failed: %m", fd);
+		}
+		/* The poll was one-shot. Re-arm it already now, so it's not
+		   forgotten even if the ioloop is stopped before the event
+		   is handled. */
+		ufd->armed = FALSE;
+		io_uring_fd_set_dirty(ctx, fd, ufd);
+	}
+}
+
+static void
+io_uring_events_handle(struct ioloop *ioloop, unsigned int events_count)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	const struct io_uring_cqe *event;
+	struct ioloop_uring_fd *ufd;
+	struct io_list *list;
+	struct io_file *io;
+	unsigned int i, revents;
+	int fd, j;
+	bool call;
+
+	for (i = 0; i < events_count; i++) {
+		/* io_loop_handle_add() may cause fd_index array reallocation,
+		   so we have use array_idx() */
+		event = array_idx(&ctx->events, i);
+		if (event->user_data == IOLOOP_URING_USER_DATA_IGNORE)
+			continue;
+		fd = (int)(event->user_data >> 32);
+		ufd = array_idx_modifiable(&ctx->fd_index, fd);
+		if (ufd->generation != (uint32_t)event->user_data) {
+			/* the IOs have changed since the poll was armed */
+			continue;
+		}
+		revents = event->res;
+
+		list = ufd->list;
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = list->ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((revents & (POLLHUP | POLLERR)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (revents & (POLLIN | POLLPRI)) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (revents & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (revents & IO_URING_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running)
+					return;
+			}
+		}
+	}
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct timeval tv;
+	unsigned int events_count;
+	int msecs;
+
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	/* queue all the poll changes done since the last iteration, so they
+	   get submitted with the same io_uring_enter() that waits for the
+	   events */
+	io_uring_flush_dirty(ctx);
+	if (ioloop->io_files != NULL)
+		io_uring_wait(ctx, msecs);
+	else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		if (ctx->sq_queued > 0)
+			io_uring_submit(ctx, 0, 0, NULL, 0);
+		i_sleep_intr_msecs(msecs);
+	}
+	events_count = io_uring_reap(ctx);
+	io_uring_events_rearm(ctx, events_count);
+
+	ctx->batching = TRUE;
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (ioloop->running)
+		io_uring_events_handle(ioloop, events_count);
+	ctx->batching = FALSE;
+}
+
+#endif	/* IOLOOP_URING */
@@ -19,6 +19,10 @@
    logging many warnings about this, use a rather high value. */
 #define IOLOOP_TIME_MOVED_FORWARDS_MIN_USECS (100000)
 
+/* Resetting timeouts at least this long doesn't reposition them in the
+   timeout queue immediately. */
+#define IOLOOP_TIMEOUT_DEFER_RESET_MIN_MSECS 1000
+
 time_t ioloop_time = 0;
 struct timeval ioloop_timeval;
 struct ioloop *current_ioloop = NULL;
@@ -376,6 +380,7 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 	new_to->one_shot = old_to->one_shot;
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
+	new_to->deferred_run = old_to->deferred_run;
 
 	if (old_to->item.idx != UINT_MAX)
 		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
@@ -426,7 +431,24 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 	if (timeout->item.idx == UINT_MAX)
 		return;
 
-	timeout_update_next(timeout, tv_now);
+	if (tv_now == NULL &&
+	    timeout->msecs >= IOLOOP_TIMEOUT_DEFER_RESET_MIN_MSECS) {
+		/* Idle timeouts and such are reset much more often than
+		   they trigger. Avoid repositioning the timeout in the queue
+		   on every reset - it's done only once the timeout's
+		   original run time is reached. */
+		struct timeval old_run = timeout->next_run;
+
+		timeout_update_next(timeout, NULL);
+		if (timeval_cmp(&timeout->next_run, &old_run) > 0) {
+			timeout->deferred_run = timeout->next_run;
+			timeout->next_run = old_run;
+			return;
+		}
+	} else {
+		timeout_update_next(timeout, tv_now);
+	}
+	i_zero(&timeout->deferred_run);
 	/* If we came here from io_loop_handle_timeouts_real(), next_run must
 	   be larger than tv_now or it can go to infinite loop. This would
 	   mainly happen with 0 ms timeouts. Avoid this by making sure
@@ -491,15 +513,36 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	return ret;
 }
 
+static void timeout_apply_deferred_run(struct timeout *timeout)
+{
+	timeout->next_run = timeout->deferred_run;
+	i_zero(&timeout->deferred_run);
+	priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+}
+
+static struct timeout *io_loop_timeouts_peek(struct ioloop *ioloop)
+{
+	struct timeout *timeout;
+
+	/* Reposition the timeouts at the head of the queue that have been
+	   reset since they were added to the queue. The deferred run time
+	   is always later than the current one, so each timeout is moved
+	   at most once. */
+	while ((timeout = (struct timeout *)
+			priorityq_peek(ioloop->timeouts)) != NULL &&
+	       timeout->deferred_run.tv_sec != 0)
+		timeout_apply_deferred_run(timeout);
+	return timeout;
+}
+
 static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
 	struct timeval tv_now;
-	struct priorityq_item *item;
 	struct timeout *timeout;
 	int msecs;
 
-	item = priorityq_peek(ioloop->timeouts);
-	timeout = (struct timeout *)item;
+	timeout = io_loop_timeouts_peek(ioloop);
 
 	/* we need to see if there are pending IO waiting,
 	   if there is, we set msecs = 0 to ensure they are
@@ -606,6 +649,12 @@ static void io_loop_timeouts_update(struct ioloop *ioloop, long long diff_usecs)
 			timeval_add_usecs(&to->next_run, diff_usecs);
 		else
 			timeval_sub_usecs(&to->next_run, -diff_usecs);
+		if (to->deferred_run.tv_sec == 0)
+			continue;
+		if (diff_usecs > 0)
+			timeval_add_usecs(&to->deferred_run, diff_usecs);
+		else
+			timeval_sub_usecs(&to->deferred_run, -diff_usecs);
 	}
 }
 
@@ -637,7 +686,7 @@ static void ioloop_add_wait_time(struct ioloop *ioloop)
 
 static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 {
-	struct priorityq_item *item;
+	struct timeout *timeout;
 	struct timeval tv_old, tv, tv_call;
 	long long diff_usecs;
 	data_stack_frame_t t_id;
@@ -670,9 +719,7 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 	tv_call = ioloop_timeval;
 
 	while (ioloop->running &&
-	       (item = priorityq_peek(ioloop->timeouts)) != NULL) {
-		struct timeout *timeout = (struct timeout *)item;
-
+	       (timeout = io_loop_timeouts_peek(ioloop)) != NULL) {
 		/* use tv_call to make sure we don't get to infinite loop in
 		   case callbacks update ioloop_timeval. */
 		if (timeout_get_wait_time(timeout, &tv, &tv_call, TRUE) > 0)
@@ -707,14 +754,14 @@ void io_loop_handle_timeouts(struct ioloop *ioloop)
 		io_loop_handle_timeouts_real(ioloop);
 	} T_END;
 
-	/* Free the unused memory in data stack once per second. This way if
-	   the data stack has grown excessively large temporarily, it won't
-	   permanently waste memory. And if the data stack grows back to the
-	   same large size, re-allocating it once per second doesn't cause
-	   performance problems. */
+	/* Free the unused memory in data stack if it hasn't been used during
+	   the last second. This way if the data stack has grown excessively
+	   large temporarily, it won't permanently waste memory. And if the
+	   data stack keeps growing back to the same large size, it's not
+	   re-allocated once per second. */
 	if (data_stack_last_free_unused != ioloop_time) {
 		if (data_stack_last_free_unused != 0)
-			data_stack_free_unused();
+			data_stack_free_unused_if_idle();
 		data_stack_last_free_unused = ioloop_time;
 	}
 }
@@ -56,15 +56,11 @@ static int o_stream_temp_move_to_fd(struct temp_ostream *tstream)
 
 	path = t_str_new(128);
 	str_append(path, tstream->temp_path_prefix);
-	tstream->fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	tstream->fd = safe_mkstemp_hostpid_unlinked(path, 0600);
 	if (tstream->fd == -1) {
 		i_error("safe_mkstemp(%s) failed: %m", str_c(path));
 		return -1;
 	}
-	if (i_unlink(str_c(path)) < 0) {
-		i_close_fd(&tstream->fd);
-		return -1;
-	}
 	if (write_full(tstream->fd, tstream->buf->data, tstream->buf->used) < 0) {
 		i_error("write(%s) failed: %m", str_c(path));
 		i_close_fd(&tstream->fd);
@@ -165,7 +165,13 @@ static ssize_t i_stream_tee_read(struct istream_private *stream)
 	} else {
 		/* there's still some data available from parent */
 		i_assert(last_high_offset < input->v_offset + size);
-		tee_streams_update_buffer(tstream->tee);
+		if (stream->buffer != data) {
+			/* All the children reference the parent's buffer
+			   directly, and they're updated whenever the parent
+			   is read or skipped. So this is needed only if the
+			   buffer was changed by someone else. */
+			tee_streams_update_buffer(tstream->tee);
+		}
 		i_assert(stream->pos < size);
 	}
 
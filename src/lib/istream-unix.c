@@ -77,6 +77,8 @@ struct istream *i_stream_create_unix(int fd, size_t max_buffer_size)
 	ustream->read_fd = -1;
 	input = i_stream_create_file_common(&ustream->fstream, fd, NULL,
 					    max_buffer_size, FALSE);
+	/* the fd must be read with recvmsg() to receive the passed fds */
+	input->readable_fd = FALSE;
 	input->real_stream->iostream.close = i_stream_unix_close;
 	input->real_stream->read = i_stream_unix_read;
 	return input;
@@ -176,6 +176,13 @@ static bool json_parse_whitespace(struct json_parser *parser)
 static int json_skip_string(struct json_parser *parser)
 {
 	for (; parser->data != parser->end; parser->data++) {
+		/* skip quickly over the unescaped part of the string */
+		while (*parser->data != '"' && *parser->data != '\\') {
+			if (++parser->data == parser->end) {
+				json_parser_update_input_pos(parser);
+				return 0;
+			}
+		}
 		if (*parser->data == '"') {
 			parser->data++;
 			json_parser_update_input_pos(parser);
@@ -302,6 +309,19 @@ static int json_parse_string(struct json_parser *parser, bool allow_skip,
 
 	str_truncate(parser->value, 0);
 	for (; parser->data != parser->end; parser->data++) {
+		/* copy the unescaped part of the string in one go */
+		const unsigned char *p = parser->data;
+		while (*p != '"' && *p != '\\' && *p != '\0') {
+			if (++p == parser->end)
+				break;
+		}
+		if (p != parser->data) {
+			str_append_data(parser->value, parser->data,
+					p - parser->data);
+			parser->data = p;
+			if (p == parser->end)
+				return 0;
+		}
 		if (*parser->data == '"') {
 			parser->data++;
 			*value_r = str_c(parser->value);
@@ -829,13 +849,28 @@ void json_append_escaped(string_t *dest, const char *src)
 	json_append_escaped_data(dest, (const unsigned char*)src, strlen(src));
 }
 
+static inline bool json_char_needs_escaping(unsigned char c)
+{
+	return c < 0x20 || c >= 0x80 || c == '"' || c == '\\';
+}
+
 void json_append_escaped_data(string_t *dest, const unsigned char *src, size_t size)
 {
-	size_t i;
+	size_t i, start;
 	int bytes = 0;
 	unichar_t chr;
 
 	for (i = 0; i < size;) {
+		/* append the characters that don't need escaping in one go */
+		for (start = i; i < size; i++) {
+			if (json_char_needs_escaping(src[i]))
+				break;
+		}
+		if (i > start)
+			str_append_data(dest, src + start, i - start);
+		if (i == size)
+			break;
+
 		bytes = uni_utf8_get_char_n(src+i, size-i, &chr);
 		if (bytes > 0 && uni_is_valid_ucs4(chr)) {
 			json_append_escaped_ucs4(dest, chr);
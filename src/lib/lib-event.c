@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "lib-event-private.h"
 #include "event-filter.h"
+#include "event-profiler.h"
 #include "array.h"
 #include "llist.h"
 #include "time-util.h"
@@ -162,6 +163,35 @@ void event_copy_categories(struct event *to, struct event *from)
 		event_add_category(to, categories[cat_count-i]);
 }
 
+static void
+event_field_materialize(const struct event *event, struct event_field *field)
+{
+	event_field_str_callback_t *callback = field->lazy_callback;
+
+	if (callback == NULL)
+		return;
+
+	/* clear the callback first in case it looks up the field itself */
+	field->lazy_callback = NULL;
+	T_BEGIN {
+		const char *value = callback(field->lazy_context);
+
+		field->value.str = p_strdup(event->pool,
+					    value == NULL ? "" : value);
+	} T_END;
+	field->lazy_context = NULL;
+}
+
+static void event_fields_materialize(const struct event *event)
+{
+	struct event_field *field;
+
+	if (!array_is_created(&event->fields))
+		return;
+	array_foreach_modifiable(&event->fields, field)
+		event_field_materialize(event, field);
+}
+
 void event_copy_fields(struct event *to, struct event *from)
 {
 	const struct event_field *fld;
@@ -170,6 +200,7 @@ void event_copy_fields(struct event *to, struct event *from)
 
 	if (!array_is_created(&from->fields))
 		return;
+	event_fields_materialize(from);
 	array_foreach(&from->fields, fld) {
 		switch (fld->value_type) {
 		case EVENT_FIELD_VALUE_TYPE_STR:
@@ -529,6 +560,7 @@ struct event *event_pop_global(struct event *event)
 		current_global_event = events[event_count-1];
 		array_delete(&global_event_stack, event_count-1, 1);
 	}
+	event_profiler_event_popped(event);
 	return current_global_event;
 }
 
@@ -937,8 +969,8 @@ event_add_category(struct event *event, struct event_category *category)
 	return event_add_categories(event, categories);
 }
 
-struct event_field *
-event_find_field_nonrecursive(const struct event *event, const char *key)
+static struct event_field *
+event_find_field_nonrecursive_lazy(const struct event *event, const char *key)
 {
 	struct event_field *field;
 
@@ -952,6 +984,17 @@ event_find_field_nonrecursive(const struct event *event, const char *key)
 	return NULL;
 }
 
+struct event_field *
+event_find_field_nonrecursive(const struct event *event, const char *key)
+{
+	struct event_field *field;
+
+	field = event_find_field_nonrecursive_lazy(event, key);
+	if (field != NULL)
+		event_field_materialize(event, field);
+	return field;
+}
+
 const struct event_field *
 event_find_field_recursive(const struct event *event, const char *key)
 {
@@ -1040,7 +1083,8 @@ event_get_field(struct event *event, const char *key, bool clear)
 {
 	struct event_field *field;
 
-	field = event_find_field_nonrecursive(event, key);
+	/* don't generate a lazy value that is just going to be replaced */
+	field = event_find_field_nonrecursive_lazy(event, key);
 	if (field == NULL) {
 		if (!array_is_created(&event->fields))
 			p_array_init(&event->fields, event->pool, 8);
@@ -1048,6 +1092,10 @@ event_get_field(struct event *event, const char *key, bool clear)
 		field->key = p_strdup(event->pool, key);
 	} else if (clear) {
 		i_zero(&field->value);
+		field->lazy_callback = NULL;
+		field->lazy_context = NULL;
+	} else {
+		event_field_materialize(event, field);
 	}
 	event_set_changed(event);
 	return field;
@@ -1073,6 +1121,21 @@ event_add_str(struct event *event, const char *key, const char *value)
 	return event;
 }
 
+#undef event_add_str_lazy
+struct event *
+event_add_str_lazy(struct event *event, const char *key,
+		   event_field_str_callback_t *callback, void *context)
+{
+	struct event_field *field;
+
+	field = event_get_field(event, key, TRUE);
+	field->value_type = EVENT_FIELD_VALUE_TYPE_STR;
+	field->value.str = "";
+	field->lazy_callback = callback;
+	field->lazy_context = context;
+	return event;
+}
+
 struct event *
 event_strlist_append(struct event *event, const char *key, const char *value)
 {
@@ -1244,6 +1307,7 @@ event_get_fields(const struct event *event, unsigned int *count_r)
 		*count_r = 0;
 		return NULL;
 	}
+	event_fields_materialize(event);
 	return array_get(&event->fields, count_r);
 }
 
@@ -1381,6 +1445,7 @@ void event_export(const struct event *event, string_t *dest)
 
 	if (array_is_created(&event->fields)) {
 		const struct event_field *field;
+		event_fields_materialize(event);
 		array_foreach(&event->fields, field) {
 			str_append_c(dest, '\t');
 			event_export_field_value(dest, field);
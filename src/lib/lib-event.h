@@ -11,6 +11,10 @@
 struct event;
 struct event_log_params;
 
+/* Returns the value for a lazy string field. The returned string is copied,
+   so it may be allocated from data stack. */
+typedef const char *event_field_str_callback_t(void *context);
+
 /* Hierarchical category of events. Each event can belong to multiple
    categories. For example [ lib-storage/maildir, syscall/io ]. The categories
    are expected to live as long as they're used in events. */
@@ -48,6 +52,11 @@ struct event_field {
 		unsigned int ip_bits; /* set for event filters */
 		ARRAY_TYPE(const_string) strlist;
 	} value;
+
+	/* Non-NULL if the STR value hasn't been generated yet. Only the
+	   event code in src/lib should look at these. */
+	event_field_str_callback_t *lazy_callback;
+	void *lazy_context;
 };
 
 struct event_add_field {
@@ -349,6 +358,18 @@ event_add_category(struct event *event, struct event_category *category);
    Returns the event parameter. */
 struct event *
 event_add_str(struct event *event, const char *key, const char *value);
+/* Same as event_add_str(), but the value is generated by calling the
+   callback only when something actually reads the field, e.g. a matching
+   event filter, stats metric or exporter. This makes it cheap to add fields
+   that are expensive to build but usually unwanted. The context must stay
+   valid as long as the event exists, or until the field is replaced. */
+struct event *
+event_add_str_lazy(struct event *event, const char *key,
+		   event_field_str_callback_t *callback, void *context);
+#define event_add_str_lazy(event, key, callback, context) \
+	event_add_str_lazy(event, key, \
+		(event_field_str_callback_t *)callback, TRUE ? context : \
+		CALLBACK_TYPECHECK(callback, const char *(*)(typeof(context))))
 struct event *
 event_add_int(struct event *event, const char *key, intmax_t num);
 /* Adds int value to event if it is non-zero */
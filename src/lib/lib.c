@@ -201,6 +201,8 @@ void lib_deinit(void)
 	failures_deinit();
 	process_title_deinit();
 	random_deinit();
+	pool_alloconly_free_cached_blocks();
+	pool_alloconly_usage_tracking_deinit();
 
 	lib_clean_exit = TRUE;
 }
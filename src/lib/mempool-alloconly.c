@@ -2,6 +2,8 @@
 
 /* @UNSAFE: whole file */
 #include "lib.h"
+#include "array.h"
+#include "hash.h"
 #include "safe-memset.h"
 #include "mempool.h"
 
@@ -111,6 +113,18 @@
  * Since the pool structure itself is allocated from the first block, this
  * final call to free() will release the memory allocated for struct
  * alloconly_pool and struct pool.
+ *
+ * Block cache
+ * -----------
+ *
+ * Pools are often created and destroyed for each short-lived object (e.g.
+ * a request), so the same small block sizes are constantly malloc()ed and
+ * free()d. To avoid this, freed blocks with a power-of-two size between
+ * POOL_BLOCK_CACHE_MIN_SIZE and POOL_BLOCK_CACHE_MAX_SIZE are kept in
+ * per-size freelists and reused by block_alloc(). The used part of the
+ * block is zeroed before it's added to the freelist, so the cached blocks
+ * look the same as freshly calloc()ed ones. The cache isn't used with
+ * DEBUG, so the freed memory can still be checked for use-after-free.
  */
 
 #ifndef DEBUG
@@ -125,6 +139,8 @@ struct alloconly_pool {
 	int refcount;
 
 	struct pool_block *block;
+	/* Non-NULL if usage tracking was enabled when the pool was created */
+	struct pool_alloconly_usage *usage;
 #ifdef DEBUG
 	const char *name;
 	size_t base_size;
@@ -157,6 +173,26 @@ struct pool_block {
 #  define CLEAR_CHR 0
 #endif
 
+#ifndef DEBUG
+#  define POOL_BLOCK_CACHE_MIN_SIZE 1024
+#  define POOL_BLOCK_CACHE_MAX_SIZE (1024*16)
+/* Maximum number of bytes in cached blocks for each block size */
+#  define POOL_BLOCK_CACHE_MAX_BYTES_PER_SIZE (1024*64)
+#  define POOL_BLOCK_CACHE_SIZE_COUNT 5
+
+struct pool_block_cache {
+	/* linked through pool_block.prev */
+	struct pool_block *blocks;
+	unsigned int count;
+};
+
+static struct pool_block_cache block_cache[POOL_BLOCK_CACHE_SIZE_COUNT];
+#endif
+
+/* pool name => usage, when usage tracking is enabled */
+static HASH_TABLE(const char *, struct pool_alloconly_usage *) usage_hash;
+static ARRAY(struct pool_alloconly_usage *) usage_arr;
+
 static const char *pool_alloconly_get_name(pool_t pool);
 static void pool_alloconly_ref(pool_t pool);
 static void pool_alloconly_unref(pool_t *pool);
@@ -225,7 +261,76 @@ static void check_sentries(struct pool_block *block)
 }
 #endif
 
-pool_t pool_alloconly_create(const char *name ATTR_UNUSED, size_t size)
+void pool_alloconly_usage_tracking_enable(void)
+{
+	if (hash_table_is_created(usage_hash))
+		return;
+	hash_table_create(&usage_hash, default_pool, 0, str_hash, strcmp);
+	i_array_init(&usage_arr, 32);
+}
+
+void pool_alloconly_usage_tracking_deinit(void)
+{
+	struct pool_alloconly_usage *usage;
+
+	if (!hash_table_is_created(usage_hash))
+		return;
+	/* Pools that still exist keep pointing to their usage, so it can't
+	   be freed if any of them is still alive. */
+	array_foreach_elem(&usage_arr, usage) {
+		if (usage->pool_count > 0)
+			return;
+	}
+	array_foreach_elem(&usage_arr, usage)
+		i_free(usage);
+	array_free(&usage_arr);
+	hash_table_destroy(&usage_hash);
+}
+
+const struct pool_alloconly_usage *const *
+pool_alloconly_get_usage(unsigned int *count_r)
+{
+	if (!hash_table_is_created(usage_hash)) {
+		*count_r = 0;
+		return NULL;
+	}
+	return (const void *)array_get(&usage_arr, count_r);
+}
+
+static struct pool_alloconly_usage *pool_alloconly_usage_get(const char *name)
+{
+	struct pool_alloconly_usage *usage;
+
+	(void)str_begins(name, MEMPOOL_GROWING, &name);
+	usage = hash_table_lookup(usage_hash, name);
+	if (usage == NULL) {
+		/* Pool names are practically always static strings, but
+		   copy it just in case. */
+		usage = i_malloc(MALLOC_ADD(sizeof(*usage), strlen(name) + 1));
+		usage->name = memcpy(usage + 1, name, strlen(name) + 1);
+		hash_table_insert(usage_hash, usage->name, usage);
+		array_push_back(&usage_arr, &usage);
+	}
+	return usage;
+}
+
+static void
+pool_alloconly_usage_update(struct alloconly_pool *apool,
+			    size_t alloc_size, bool add)
+{
+	struct pool_alloconly_usage *usage = apool->usage;
+
+	if (!add) {
+		i_assert(usage->alloc_size >= alloc_size);
+		usage->alloc_size -= alloc_size;
+	} else {
+		usage->alloc_size += alloc_size;
+		if (usage->peak_alloc_size < usage->alloc_size)
+			usage->peak_alloc_size = usage->alloc_size;
+	}
+}
+
+pool_t pool_alloconly_create(const char *name, size_t size)
 {
 	struct alloconly_pool apool, *new_apool;
 	size_t min_alloc = SIZEOF_POOLBLOCK +
@@ -243,6 +348,10 @@ pool_t pool_alloconly_create(const char *name ATTR_UNUSED, size_t size)
 	i_zero(&apool);
 	apool.pool = static_alloconly_pool;
 	apool.refcount = 1;
+	if (unlikely(hash_table_is_created(usage_hash))) {
+		apool.usage = pool_alloconly_usage_get(name);
+		apool.usage->pool_count++;
+	}
 
 	if (size < min_alloc)
 		size = nearest_power(size + min_alloc);
@@ -278,16 +387,84 @@ pool_t pool_alloconly_create_clean(const char *name, size_t size)
 	return pool;
 }
 
-static void pool_alloconly_free_block(struct alloconly_pool *apool ATTR_UNUSED,
+#ifndef DEBUG
+static struct pool_block_cache *block_cache_get(size_t alloc_size)
+{
+	if (alloc_size < POOL_BLOCK_CACHE_MIN_SIZE ||
+	    alloc_size > POOL_BLOCK_CACHE_MAX_SIZE ||
+	    (alloc_size & (alloc_size - 1)) != 0)
+		return NULL;
+	return &block_cache[bits_required64(alloc_size) -
+			    bits_required64(POOL_BLOCK_CACHE_MIN_SIZE)];
+}
+
+static bool block_cache_add(struct pool_block *block)
+{
+	size_t alloc_size = SIZEOF_POOLBLOCK + block->size;
+	struct pool_block_cache *cache = block_cache_get(alloc_size);
+
+	if (cache == NULL ||
+	    (cache->count + 1) * alloc_size > POOL_BLOCK_CACHE_MAX_BYTES_PER_SIZE)
+		return FALSE;
+
+	/* unused data is always zero, so clear only the used part */
+	memset(POOL_BLOCK_DATA(block), 0, block->size - block->left);
+	block->prev = cache->blocks;
+	cache->blocks = block;
+	cache->count++;
+	return TRUE;
+}
+
+static struct pool_block *block_cache_take(size_t alloc_size)
+{
+	struct pool_block_cache *cache = block_cache_get(alloc_size);
+	struct pool_block *block;
+
+	if (cache == NULL || cache->blocks == NULL)
+		return NULL;
+	block = cache->blocks;
+	cache->blocks = block->prev;
+	cache->count--;
+	return block;
+}
+#endif
+
+void pool_alloconly_free_cached_blocks(void)
+{
+#ifndef DEBUG
+	struct pool_block *block;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(block_cache); i++) {
+		while (block_cache[i].blocks != NULL) {
+			block = block_cache[i].blocks;
+			block_cache[i].blocks = block->prev;
+			free(block);
+		}
+		block_cache[i].count = 0;
+	}
+#endif
+}
+
+static void pool_alloconly_free_block(struct alloconly_pool *apool,
 				      struct pool_block *block)
 {
+	if (apool->usage != NULL) {
+		pool_alloconly_usage_update(apool,
+					    SIZEOF_POOLBLOCK + block->size,
+					    FALSE);
+	}
 #ifdef DEBUG
 	safe_memset(block, CLEAR_CHR, SIZEOF_POOLBLOCK + block->size);
 #else
 	if (apool->clean_frees) {
-		safe_memset(block, CLEAR_CHR,
-			    SIZEOF_POOLBLOCK + block->size);
+		size_t size = block->size;
+
+		safe_memset(block, CLEAR_CHR, SIZEOF_POOLBLOCK + size);
+		block->size = block->left = size;
 	}
+	if (block_cache_add(block))
+		return;
 #endif
 	free(block);
 }
@@ -309,6 +486,11 @@ pool_alloconly_free_blocks_until_last(struct alloconly_pool *apool)
 
 static void pool_alloconly_destroy(struct alloconly_pool *apool)
 {
+	if (apool->usage != NULL) {
+		i_assert(apool->usage->pool_count > 0);
+		apool->usage->pool_count--;
+	}
+
 	/* destroy all but the last block */
 	pool_alloconly_free_blocks_until_last(apool);
 
@@ -380,7 +562,13 @@ static void block_alloc(struct alloconly_pool *apool, size_t size)
 #endif
 	}
 
+#ifndef DEBUG
+	block = block_cache_take(size);
+	if (block == NULL)
+		block = calloc(size, 1);
+#else
 	block = calloc(size, 1);
+#endif
 	if (unlikely(block == NULL)) {
 		i_fatal_status(FATAL_OUTOFMEM, "block_alloc(%zu"
 			       "): Out of memory", size);
@@ -390,6 +578,9 @@ static void block_alloc(struct alloconly_pool *apool, size_t size)
 
 	block->size = size - SIZEOF_POOLBLOCK;
 	block->left = block->size;
+
+	if (apool->usage != NULL)
+		pool_alloconly_usage_update(apool, size, TRUE);
 }
 
 static void *pool_alloconly_malloc(pool_t pool, size_t size)
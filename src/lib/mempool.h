@@ -167,6 +167,27 @@ static inline void pool_unref(pool_t *pool)
 size_t pool_alloconly_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_alloconly_get_total_alloc_size(pool_t pool);
+/* Free the memory blocks that alloconly pools have cached for reuse. */
+void pool_alloconly_free_cached_blocks(void);
+
+struct pool_alloconly_usage {
+	/* Pool name given to pool_alloconly_create() without the
+	   MEMPOOL_GROWING prefix */
+	const char *name;
+	/* Number of existing pools with this name */
+	unsigned int pool_count;
+	/* Current and highest system memory allocated for these pools */
+	size_t alloc_size, peak_alloc_size;
+};
+
+/* Start tracking the memory usage of alloconly pools, summed up by the pool
+   name. Only the pools created after this call are tracked. */
+void pool_alloconly_usage_tracking_enable(void);
+void pool_alloconly_usage_tracking_deinit(void);
+/* Returns the tracked memory usage for each pool name, or NULL if tracking
+   isn't enabled. */
+const struct pool_alloconly_usage *const *
+pool_alloconly_get_usage(unsigned int *count_r);
 
 /* Returns how much memory has been allocated from this pool. */
 size_t pool_allocfree_get_total_used_size(pool_t pool);
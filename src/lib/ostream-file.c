@@ -2,8 +2,10 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "ioloop.h"
+#include "fd-util.h"
 #include "write-full.h"
 #include "net.h"
 #include "sendfile-util.h"
@@ -26,9 +28,24 @@
 #define IS_STREAM_EMPTY(fstream) \
 	((fstream)->head == (fstream)->tail && !(fstream)->full)
 
+/* Maximum number of iovecs to combine into a writev() without allocating
+   memory for the iovec array. */
+#define OSTREAM_FILE_WRITEV_MAX_IOV 16
+
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
+#ifdef HAVE_SPLICE
+/* Maximum number of bytes to move with a single splice(). This is the
+   default pipe capacity in Linux. */
+#define OSTREAM_FILE_SPLICE_MAX_SIZE (64*1024)
+
+/* The pipe is always emptied before returning from io_stream_splice(), so
+   a single pipe can be shared by all the streams in the process. */
+static int splice_pipe_fd[2] = { -1, -1 };
+static pid_t splice_pipe_pid;
+#endif
+
 static void stream_send_io(struct file_ostream *fstream);
 static struct ostream * o_stream_create_fd_common(int fd,
 		size_t max_buffer_size, bool autoclose_fd);
@@ -562,6 +579,40 @@ static void stream_send_io(struct file_ostream *fstream)
 	o_stream_unref(&ostream);
 }
 
+/* Write the buffered data followed by iov using a single writev().
+   Returns how many bytes of iov were written, or -1 on error. */
+static ssize_t
+o_stream_file_writev_with_buffer(struct file_ostream *fstream,
+				 const struct const_iovec *iov,
+				 unsigned int iov_count)
+{
+	struct const_iovec iov_buf[OSTREAM_FILE_WRITEV_MAX_IOV];
+	struct const_iovec *full_iov = iov_buf;
+	unsigned int buf_iov_count;
+	size_t used;
+	ssize_t ret;
+
+	used = file_buffer_get_used_size(fstream);
+	T_BEGIN {
+		if (iov_count + 2 > N_ELEMENTS(iov_buf))
+			full_iov = t_new(struct const_iovec, iov_count + 2);
+		buf_iov_count = o_stream_fill_iovec(fstream, full_iov);
+		memcpy(full_iov + buf_iov_count, iov,
+		       sizeof(*iov) * iov_count);
+		ret = o_stream_file_writev_full(fstream, full_iov,
+						buf_iov_count + iov_count);
+	} T_END;
+	if (ret < 0)
+		return -1;
+	if ((size_t)ret < used) {
+		update_buffer(fstream, ret);
+		return 0;
+	}
+	update_buffer(fstream, used);
+	i_assert(IS_STREAM_EMPTY(fstream));
+	return ret - used;
+}
+
 static size_t o_stream_add(struct file_ostream *fstream,
 			   const void *data, size_t size)
 {
@@ -618,20 +669,24 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 		size += iov[i].iov_len;
 	total_size = size;
 
-	if (size > get_unused_space(fstream) && !IS_STREAM_EMPTY(fstream)) {
-		if (o_stream_file_flush(stream) < 0)
-			return -1;
-	}
-
 	optimal_size = I_MIN(fstream->optimal_block_size,
 			     fstream->ostream.max_buffer_size);
-	if (IS_STREAM_EMPTY(fstream) &&
-	    (!stream->corked || size >= optimal_size)) {
+	if (size > get_unused_space(fstream) && !IS_STREAM_EMPTY(fstream)) {
+		/* doesn't fit to buffer - send the buffer and the new data
+		   with a single writev() */
+		ret = o_stream_file_writev_with_buffer(fstream, iov, iov_count);
+		if (ret < 0)
+			return -1;
+	} else if (IS_STREAM_EMPTY(fstream) &&
+		   (!stream->corked || size >= optimal_size)) {
 		/* send immediately */
 		ret = o_stream_file_writev_full(fstream, iov, iov_count);
 		if (ret < 0)
 			return -1;
+	}
 
+	if (ret > 0) {
+		/* some of the new data was already sent */
 		size = ret;
 		while (size > 0 && iov_count > 0 && size >= iov[0].iov_len) {
 			size -= iov[0].iov_len;
@@ -856,6 +911,142 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_SPLICE
+static bool splice_pipe_init(void)
+{
+	pid_t pid = getpid();
+
+	if (splice_pipe_fd[0] != -1) {
+		if (splice_pipe_pid == pid)
+			return TRUE;
+		/* forked - don't share the pipe with the parent process */
+		i_close_fd(&splice_pipe_fd[0]);
+		i_close_fd(&splice_pipe_fd[1]);
+	}
+	if (pipe(splice_pipe_fd) < 0) {
+		i_error("pipe() failed: %m");
+		splice_pipe_fd[0] = splice_pipe_fd[1] = -1;
+		return FALSE;
+	}
+	fd_close_on_exec(splice_pipe_fd[0], TRUE);
+	fd_close_on_exec(splice_pipe_fd[1], TRUE);
+	fd_set_nonblock(splice_pipe_fd[0], TRUE);
+	fd_set_nonblock(splice_pipe_fd[1], TRUE);
+	splice_pipe_pid = pid;
+	return TRUE;
+}
+
+static void
+splice_pipe_drain(struct file_ostream *foutstream, size_t size)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	ssize_t ret;
+
+	/* Move the data that couldn't be written to the output fd into the
+	   ostream buffer, or drop it if the output has already failed. */
+	while (size > 0) {
+		ret = read(splice_pipe_fd[0], buf, I_MIN(size, sizeof(buf)));
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			i_panic("read(splice pipe) failed: %s",
+				ret == 0 ? "EOF" : strerror(errno));
+		}
+		if (foutstream->fd != -1) {
+			if (o_stream_add(foutstream, buf, ret) != (size_t)ret)
+				i_unreached();
+			foutstream->ostream.ostream.offset += ret;
+		}
+		size -= ret;
+	}
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	size_t max_size, sent;
+	ssize_t ret;
+
+	/* The leftover data in the pipe is moved to ostream buffer, so
+	   max_size must fit into it. */
+	max_size = I_MIN(outstream->max_buffer_size,
+			 OSTREAM_FILE_SPLICE_MAX_SIZE);
+	i_assert(max_size > 0);
+	if (!splice_pipe_init())
+		return FALSE;
+
+	/* flush out any data in buffer */
+	if ((ret = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+
+	for (;;) {
+		ret = splice(in_fd, NULL, splice_pipe_fd[1], NULL, max_size,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == 0) {
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			if (errno == EINVAL) {
+				/* splice() not supported with these fds */
+				return FALSE;
+			}
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			instream->stream_errno = errno;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+		instream->v_offset += ret;
+
+		for (sent = 0; sent < (size_t)ret; ) {
+			ssize_t ret2 = splice(splice_pipe_fd[0], NULL,
+					      foutstream->fd, NULL, ret - sent,
+					      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret2 < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN)
+					break;
+				io_stream_set_error(&outstream->iostream,
+						    "splice() failed: %m");
+				outstream->ostream.stream_errno = errno;
+				stream_closed(foutstream);
+				break;
+			}
+			sent += ret2;
+		}
+		foutstream->real_offset += sent;
+		foutstream->buffer_offset += sent;
+		outstream->ostream.offset += sent;
+
+		if (sent < (size_t)ret) {
+			splice_pipe_drain(foutstream, ret - sent);
+			*res_r = foutstream->fd == -1 ?
+				OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT :
+				OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -997,6 +1188,21 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_SPLICE
+	/* Use splice() to move data from a socket to another socket without
+	   copying it via userspace. Only the plain fd istream can be used,
+	   since other istreams would want to see the data. The data already
+	   buffered in the istream must be sent first. */
+	if (!foutstream->no_splice && !foutstream->file && in_fd != -1 &&
+	    in_fd != foutstream->fd && !instream->seekable &&
+	    instream->real_stream->parent == NULL &&
+	    outstream->max_buffer_size > 0 &&
+	    i_stream_get_data_size(instream) == 0) {
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+		foutstream->no_splice = TRUE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -104,3 +104,37 @@ int safe_mkstemp_hostpid_group(string_t *prefix, mode_t mode,
 		str_truncate(prefix, orig_prefix_len);
 	return fd;
 }
+
+int safe_mkstemp_hostpid_unlinked(string_t *prefix, mode_t mode)
+{
+	int fd;
+
+#ifdef O_TMPFILE
+	const char *path = str_c(prefix);
+	const char *p = strrchr(path, '/');
+	const char *dir;
+	mode_t old_umask;
+
+	if (p == NULL)
+		dir = ".";
+	else if (p == path)
+		dir = "/";
+	else
+		dir = t_strdup_until(path, p);
+	old_umask = umask(0666 ^ mode);
+	fd = open(dir, O_TMPFILE | O_RDWR, 0666);
+	umask(old_umask);
+	if (fd != -1)
+		return fd;
+	/* O_TMPFILE isn't supported by the kernel or the filesystem, or the
+	   directory is inaccessible. Let the fallback report any errors. */
+#endif
+	fd = safe_mkstemp_hostpid(prefix, mode, (uid_t)-1, (gid_t)-1);
+	if (fd == -1)
+		return -1;
+	if (i_unlink(str_c(prefix)) < 0) {
+		i_close_fd(&fd);
+		return -1;
+	}
+	return fd;
+}
@@ -11,5 +11,10 @@ int safe_mkstemp_group(string_t *prefix, mode_t mode,
 int safe_mkstemp_hostpid(string_t *prefix, mode_t mode, uid_t uid, gid_t gid);
 int safe_mkstemp_hostpid_group(string_t *prefix, mode_t mode,
 			       gid_t gid, const char *gid_origin);
+/* Create a new temporary file that is already unlinked, into the directory
+   of the given prefix. If the OS and the filesystem support O_TMPFILE, the
+   file never gets a name and the prefix isn't modified. Otherwise the file
+   is created with safe_mkstemp_hostpid() and unlinked immediately. */
+int safe_mkstemp_hostpid_unlinked(string_t *prefix, mode_t mode);
 
 #endif
@@ -0,0 +1,287 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "seq-set.h"
+
+#define SEQ_SET_CHUNK_BITS 16
+#define SEQ_SET_CHUNK_SIZE (1U << SEQ_SET_CHUNK_BITS)
+#define SEQ_SET_CHUNK_MASK (SEQ_SET_CHUNK_SIZE - 1)
+#define SEQ_SET_BITMAP_SIZE (SEQ_SET_CHUNK_SIZE / 8)
+/* Convert ranges to bitmap when they would take more memory */
+#define SEQ_SET_MAX_CHUNK_RANGES \
+	(SEQ_SET_BITMAP_SIZE / sizeof(struct seq_range))
+
+#define SEQ_SET_BIT_IS_SET(bitmap, n) \
+	(((bitmap)[(n) / 8] & (1 << ((n) % 8))) != 0)
+
+struct seq_set_chunk {
+	/* seq >> SEQ_SET_CHUNK_BITS */
+	uint32_t key;
+	/* number of sequences in this chunk */
+	uint32_t count;
+	/* Either ranges or bitmap is used. The ranges contain the full
+	   sequence numbers. */
+	ARRAY_TYPE(seq_range) ranges;
+	uint8_t *bitmap;
+};
+
+struct seq_set {
+	/* sorted by key */
+	ARRAY(struct seq_set_chunk) chunks;
+};
+
+struct seq_set *seq_set_init(void)
+{
+	struct seq_set *set;
+
+	set = i_new(struct seq_set, 1);
+	i_array_init(&set->chunks, 4);
+	return set;
+}
+
+static void seq_set_chunk_free(struct seq_set_chunk *chunk)
+{
+	if (chunk->bitmap != NULL)
+		i_free(chunk->bitmap);
+	else
+		array_free(&chunk->ranges);
+}
+
+void seq_set_clear(struct seq_set *set)
+{
+	struct seq_set_chunk *chunk;
+
+	array_foreach_modifiable(&set->chunks, chunk)
+		seq_set_chunk_free(chunk);
+	array_clear(&set->chunks);
+}
+
+void seq_set_deinit(struct seq_set **_set)
+{
+	struct seq_set *set = *_set;
+
+	if (set == NULL)
+		return;
+	*_set = NULL;
+
+	seq_set_clear(set);
+	array_free(&set->chunks);
+	i_free(set);
+}
+
+static bool
+seq_set_chunk_lookup(const struct seq_set *set, uint32_t key,
+		     unsigned int *idx_r)
+{
+	const struct seq_set_chunk *chunks;
+	unsigned int idx, left_idx, right_idx, count;
+
+	chunks = array_get(&set->chunks, &count);
+	if (count > 0 && chunks[count-1].key < key) {
+		/* quick check for appends */
+		*idx_r = count;
+		return FALSE;
+	}
+
+	left_idx = 0; right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (chunks[idx].key < key)
+			left_idx = idx + 1;
+		else if (chunks[idx].key > key)
+			right_idx = idx;
+		else {
+			*idx_r = idx;
+			return TRUE;
+		}
+	}
+	*idx_r = left_idx;
+	return FALSE;
+}
+
+static struct seq_set_chunk *
+seq_set_chunk_get(struct seq_set *set, uint32_t key)
+{
+	struct seq_set_chunk *chunk;
+	unsigned int idx;
+
+	if (seq_set_chunk_lookup(set, key, &idx))
+		return array_idx_modifiable(&set->chunks, idx);
+
+	chunk = array_insert_space(&set->chunks, idx);
+	chunk->key = key;
+	i_array_init(&chunk->ranges, 4);
+	return chunk;
+}
+
+static void seq_set_chunk_to_bitmap(struct seq_set_chunk *chunk)
+{
+	const struct seq_range *range;
+	uint32_t seq;
+
+	chunk->bitmap = i_malloc(SEQ_SET_BITMAP_SIZE);
+	array_foreach(&chunk->ranges, range) {
+		for (seq = range->seq1;; seq++) {
+			uint32_t n = seq & SEQ_SET_CHUNK_MASK;
+
+			chunk->bitmap[n / 8] |= 1 << (n % 8);
+			if (seq == range->seq2)
+				break;
+		}
+	}
+	array_free(&chunk->ranges);
+}
+
+static unsigned int
+seq_set_chunk_add_range(struct seq_set_chunk *chunk,
+			uint32_t seq1, uint32_t seq2)
+{
+	unsigned int n, n2, added = 0;
+
+	if (chunk->bitmap == NULL) {
+		added = seq_range_array_add_range_count(&chunk->ranges,
+							seq1, seq2);
+		if (array_count(&chunk->ranges) > SEQ_SET_MAX_CHUNK_RANGES)
+			seq_set_chunk_to_bitmap(chunk);
+	} else {
+		n2 = seq2 & SEQ_SET_CHUNK_MASK;
+		for (n = seq1 & SEQ_SET_CHUNK_MASK; n <= n2; n++) {
+			if (!SEQ_SET_BIT_IS_SET(chunk->bitmap, n)) {
+				chunk->bitmap[n / 8] |= 1 << (n % 8);
+				added++;
+			}
+		}
+	}
+	chunk->count += added;
+	return added;
+}
+
+bool seq_set_add(struct seq_set *set, uint32_t seq)
+{
+	return seq_set_add_range(set, seq, seq) == 0;
+}
+
+unsigned int seq_set_add_range(struct seq_set *set, uint32_t seq1,
+			       uint32_t seq2)
+{
+	struct seq_set_chunk *chunk;
+	unsigned int added = 0;
+	uint32_t key, chunk_last;
+
+	i_assert(seq1 <= seq2);
+
+	for (;;) {
+		key = seq1 >> SEQ_SET_CHUNK_BITS;
+		chunk_last = seq1 | SEQ_SET_CHUNK_MASK;
+		chunk = seq_set_chunk_get(set, key);
+		if (seq2 <= chunk_last) {
+			added += seq_set_chunk_add_range(chunk, seq1, seq2);
+			break;
+		}
+		added += seq_set_chunk_add_range(chunk, seq1, chunk_last);
+		seq1 = chunk_last + 1;
+	}
+	return added;
+}
+
+void seq_set_add_array(struct seq_set *set, const ARRAY_TYPE(seq_range) *array)
+{
+	const struct seq_range *range;
+
+	array_foreach(array, range)
+		(void)seq_set_add_range(set, range->seq1, range->seq2);
+}
+
+bool seq_set_remove(struct seq_set *set, uint32_t seq)
+{
+	struct seq_set_chunk *chunk;
+	unsigned int idx, n;
+
+	if (!seq_set_chunk_lookup(set, seq >> SEQ_SET_CHUNK_BITS, &idx))
+		return FALSE;
+	chunk = array_idx_modifiable(&set->chunks, idx);
+
+	if (chunk->bitmap == NULL) {
+		if (!seq_range_array_remove(&chunk->ranges, seq))
+			return FALSE;
+		/* removing may have split a range */
+		if (array_count(&chunk->ranges) > SEQ_SET_MAX_CHUNK_RANGES)
+			seq_set_chunk_to_bitmap(chunk);
+	} else {
+		n = seq & SEQ_SET_CHUNK_MASK;
+		if (!SEQ_SET_BIT_IS_SET(chunk->bitmap, n))
+			return FALSE;
+		chunk->bitmap[n / 8] &= ~(1 << (n % 8));
+	}
+	if (--chunk->count == 0) {
+		seq_set_chunk_free(chunk);
+		array_delete(&set->chunks, idx, 1);
+	}
+	return TRUE;
+}
+
+bool seq_set_exists(const struct seq_set *set, uint32_t seq)
+{
+	const struct seq_set_chunk *chunk;
+	unsigned int idx;
+
+	if (!seq_set_chunk_lookup(set, seq >> SEQ_SET_CHUNK_BITS, &idx))
+		return FALSE;
+	chunk = array_idx(&set->chunks, idx);
+	if (chunk->bitmap == NULL)
+		return seq_range_exists(&chunk->ranges, seq);
+	return SEQ_SET_BIT_IS_SET(chunk->bitmap, seq & SEQ_SET_CHUNK_MASK);
+}
+
+unsigned int seq_set_count(const struct seq_set *set)
+{
+	const struct seq_set_chunk *chunk;
+	unsigned int count = 0;
+
+	array_foreach(&set->chunks, chunk)
+		count += chunk->count;
+	return count;
+}
+
+static void
+seq_set_chunk_bitmap_to_array(const struct seq_set_chunk *chunk,
+			      ARRAY_TYPE(seq_range) *dest)
+{
+	uint32_t base = chunk->key << SEQ_SET_CHUNK_BITS;
+	unsigned int n = 0, start;
+
+	while (n < SEQ_SET_CHUNK_SIZE) {
+		if (n % 8 == 0 && chunk->bitmap[n / 8] == 0) {
+			/* skip over empty bytes quickly */
+			n += 8;
+			continue;
+		}
+		if (!SEQ_SET_BIT_IS_SET(chunk->bitmap, n)) {
+			n++;
+			continue;
+		}
+		start = n;
+		while (n < SEQ_SET_CHUNK_SIZE &&
+		       SEQ_SET_BIT_IS_SET(chunk->bitmap, n))
+			n++;
+		seq_range_array_add_range(dest, base + start, base + n - 1);
+	}
+}
+
+void seq_set_to_array(const struct seq_set *set, ARRAY_TYPE(seq_range) *dest)
+{
+	const struct seq_set_chunk *chunk;
+	const struct seq_range *range;
+
+	array_foreach(&set->chunks, chunk) {
+		if (chunk->bitmap != NULL) {
+			seq_set_chunk_bitmap_to_array(chunk, dest);
+			continue;
+		}
+		array_foreach(&chunk->ranges, range) {
+			seq_range_array_add_range(dest, range->seq1,
+						  range->seq2);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef SEQ_SET_H
+#define SEQ_SET_H
+
+#include "seq-range-array.h"
+
+/* Set of sequences/UIDs for sets that are sparse and large, where
+   ARRAY_TYPE(seq_range) would have to memmove() large parts of the array on
+   each add and remove done in the middle. The sequences are split into chunks
+   of 65536 sequences. Each chunk is stored as a sorted seq_range array as
+   long as it's small, and converted to a bitmap once the ranges would take
+   more memory than the bitmap. Adding or removing a sequence is then bounded
+   by the chunk size, instead of the size of the whole set.
+
+   Use seq_set_add_array() and seq_set_to_array() to convert from/to the
+   seq_range arrays used by the rest of the code. */
+struct seq_set;
+
+struct seq_set *seq_set_init(void);
+void seq_set_deinit(struct seq_set **set);
+
+/* Add sequence to the set. Returns TRUE if it already existed. */
+bool ATTR_NOWARN_UNUSED_RESULT
+seq_set_add(struct seq_set *set, uint32_t seq);
+/* Add seq1..seq2 to the set. Returns the number of sequences that didn't
+   already exist. */
+unsigned int ATTR_NOWARN_UNUSED_RESULT
+seq_set_add_range(struct seq_set *set, uint32_t seq1, uint32_t seq2);
+/* Add all the ranges in the array to the set. */
+void seq_set_add_array(struct seq_set *set, const ARRAY_TYPE(seq_range) *array);
+/* Remove sequence from the set. Returns TRUE if it existed. */
+bool ATTR_NOWARN_UNUSED_RESULT
+seq_set_remove(struct seq_set *set, uint32_t seq);
+/* Returns TRUE if sequence exists in the set. */
+bool seq_set_exists(const struct seq_set *set, uint32_t seq) ATTR_PURE;
+/* Returns the number of sequences in the set. */
+unsigned int seq_set_count(const struct seq_set *set) ATTR_PURE;
+/* Remove all sequences from the set. */
+void seq_set_clear(struct seq_set *set);
+
+/* Add all the sequences in the set to the seq_range array. */
+void seq_set_to_array(const struct seq_set *set, ARRAY_TYPE(seq_range) *dest);
+
+#endif
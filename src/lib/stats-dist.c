@@ -1,6 +1,7 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "str.h"
 #include "stats-dist.h"
 #include "sort.h"
 
@@ -8,6 +9,17 @@
    more than 20 in your subsample. */
 #define TIMING_DEFAULT_SUBSAMPLING_BUFFER (20*24) /* 20*24 fits in a page */
 
+/* Once there are more events than samples, percentiles are calculated from
+   a log-linear histogram: values below 2^STATS_DIST_SUB_BITS have their own
+   buckets, and each larger power of two range is split into
+   2^STATS_DIST_SUB_BITS equally wide buckets. This keeps the relative error
+   below 1/2^STATS_DIST_SUB_BITS regardless of the number of events. */
+#define STATS_DIST_SUB_BITS 5
+#define STATS_DIST_SUB_COUNT (1U << STATS_DIST_SUB_BITS)
+/* Number of buckets needed to cover all uint64_t values */
+#define STATS_DIST_MAX_BUCKETS \
+	((64 - STATS_DIST_SUB_BITS + 1) * STATS_DIST_SUB_COUNT)
+
 struct stats_dist {
 	unsigned int sample_count;
 	unsigned int count;
@@ -15,6 +27,12 @@ struct stats_dist {
 	uint64_t min;
 	uint64_t max;
 	uint64_t sum;
+
+	/* Histogram bucket counts for bucket indexes
+	   [bucket_first, bucket_first + bucket_count) */
+	unsigned int bucket_first, bucket_count;
+	unsigned int *buckets;
+
 	uint64_t samples[];
 };
 
@@ -36,16 +54,81 @@ struct stats_dist *stats_dist_init_with_size(unsigned int sample_count)
 
 void stats_dist_deinit(struct stats_dist **_stats)
 {
+	if (*_stats != NULL)
+		i_free((*_stats)->buckets);
 	i_free_and_null(*_stats);
 }
 
 void stats_dist_reset(struct stats_dist *stats)
 {
 	unsigned int sample_count = stats->sample_count;
+	i_free(stats->buckets);
 	i_zero(stats);
 	stats->sample_count = sample_count;
 }
 
+/* Buckets are (lower, upper] ranges, so that all the powers of two are
+   bucket upper bounds. Bucket 0 also contains the value 0. */
+static unsigned int stats_dist_bucket_idx(uint64_t value)
+{
+	unsigned int bits;
+
+	if (value <= STATS_DIST_SUB_COUNT)
+		return value == 0 ? 0 : value - 1;
+	value--;
+	bits = bits_required64(value) - 1;
+	return (bits - STATS_DIST_SUB_BITS + 1) * STATS_DIST_SUB_COUNT +
+		((value >> (bits - STATS_DIST_SUB_BITS)) &
+		 (STATS_DIST_SUB_COUNT - 1));
+}
+
+static uint64_t stats_dist_bucket_upper(unsigned int idx)
+{
+	unsigned int shift = idx / STATS_DIST_SUB_COUNT;
+	uint64_t upper;
+
+	if (shift == 0)
+		return idx + 1;
+	upper = (uint64_t)(STATS_DIST_SUB_COUNT + 1 +
+			   idx % STATS_DIST_SUB_COUNT) << (shift - 1);
+	/* the last bucket's upper bound would be 2^64 */
+	return upper == 0 ? UINT64_MAX : upper;
+}
+
+static uint64_t stats_dist_bucket_lower(unsigned int idx)
+{
+	return idx == 0 ? 0 : stats_dist_bucket_upper(idx - 1) + 1;
+}
+
+static void
+stats_dist_add_bucket(struct stats_dist *stats, unsigned int idx,
+		      unsigned int count)
+{
+	unsigned int first, last;
+
+	if (stats->bucket_count == 0) {
+		first = last = idx;
+	} else {
+		first = I_MIN(stats->bucket_first, idx);
+		last = I_MAX(stats->bucket_first + stats->bucket_count - 1,
+			     idx);
+	}
+	if (stats->bucket_count == 0 || first != stats->bucket_first ||
+	    last - first + 1 != stats->bucket_count) {
+		unsigned int *buckets = i_new(unsigned int, last - first + 1);
+		if (stats->bucket_count > 0) {
+			memcpy(buckets + (stats->bucket_first - first),
+			       stats->buckets,
+			       sizeof(*buckets) * stats->bucket_count);
+		}
+		i_free(stats->buckets);
+		stats->buckets = buckets;
+		stats->bucket_first = first;
+		stats->bucket_count = last - first + 1;
+	}
+	stats->buckets[idx - stats->bucket_first] += count;
+}
+
 void stats_dist_add(struct stats_dist *stats, uint64_t value)
 {
 	if (stats->count < stats->sample_count) {
@@ -65,6 +148,50 @@ void stats_dist_add(struct stats_dist *stats, uint64_t value)
 	if (stats->min > value)
 		stats->min = value;
 	stats->sorted = FALSE;
+	stats_dist_add_bucket(stats, stats_dist_bucket_idx(value), 1);
+}
+
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src)
+{
+	unsigned int i, src_samples_count, step, filled, seen;
+
+	i_assert(dest->sample_count == src->sample_count);
+
+	if (src->count == 0)
+		return;
+
+	/* Each of the src samples represents step number of events */
+	src_samples_count = I_MIN(src->count, src->sample_count);
+	step = src->count / src_samples_count;
+	filled = I_MIN(dest->count, dest->sample_count);
+	seen = dest->count;
+	for (i = 0; i < src_samples_count; i++) {
+		seen += step;
+		if (filled < dest->sample_count)
+			dest->samples[filled++] = src->samples[i];
+		else {
+			unsigned int idx = i_rand_limit(seen);
+			if (idx < dest->sample_count)
+				dest->samples[idx] = src->samples[i];
+		}
+	}
+	for (i = 0; i < src->bucket_count; i++) {
+		if (src->buckets[i] > 0) {
+			stats_dist_add_bucket(dest, src->bucket_first + i,
+					      src->buckets[i]);
+		}
+	}
+
+	if (dest->count == 0) {
+		dest->min = src->min;
+		dest->max = src->max;
+	} else {
+		dest->min = I_MIN(dest->min, src->min);
+		dest->max = I_MAX(dest->max, src->max);
+	}
+	dest->count += src->count;
+	dest->sum += src->sum;
+	dest->sorted = FALSE;
 }
 
 unsigned int stats_dist_get_count(const struct stats_dist *stats)
@@ -112,6 +239,8 @@ uint64_t stats_dist_get_median(struct stats_dist *stats)
 {
 	if (stats->count == 0)
 		return 0;
+	if (stats->count > stats->sample_count)
+		return stats_dist_get_percentile(stats, 0.5);
 	/* cast-away const - reading requires sorting */
 	stats_dist_ensure_sorted(stats);
 	unsigned int count = (stats->count < stats->sample_count)
@@ -161,10 +290,46 @@ static unsigned int stats_dist_get_index(unsigned int range, double fraction)
 	return idx;
 }
 
+static uint64_t
+stats_dist_get_histogram_percentile(const struct stats_dist *stats,
+				    double fraction)
+{
+	unsigned int i, idx, seen = 0;
+	uint64_t lower, upper, value;
+
+	idx = stats_dist_get_index(stats->count, fraction);
+	if (idx == 0)
+		return stats->min;
+	if (idx == stats->count - 1)
+		return stats->max;
+	for (i = 0; i < stats->bucket_count; i++) {
+		seen += stats->buckets[i];
+		if (seen > idx)
+			break;
+	}
+	i_assert(i < stats->bucket_count);
+
+	/* Use the middle of the bucket, but never go outside the seen
+	   values. */
+	lower = stats_dist_bucket_lower(stats->bucket_first + i);
+	upper = stats_dist_bucket_upper(stats->bucket_first + i);
+	value = lower + (upper - lower) / 2;
+	if (value < stats->min)
+		return stats->min;
+	if (value > stats->max)
+		return stats->max;
+	return value;
+}
+
 uint64_t stats_dist_get_percentile(struct stats_dist *stats, double fraction)
 {
 	if (stats->count == 0)
 		return 0;
+	if (stats->count > stats->sample_count) {
+		/* The samples are only a random subset of the events. The
+		   histogram is more accurate. */
+		return stats_dist_get_histogram_percentile(stats, fraction);
+	}
 	stats_dist_ensure_sorted(stats);
 	unsigned int count = (stats->count < stats->sample_count)
 		? stats->count
@@ -181,3 +346,100 @@ const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
 		: stats->sample_count;
 	return stats->samples;
 }
+
+uint64_t stats_dist_get_count_le(const struct stats_dist *stats,
+				 uint64_t value)
+{
+	uint64_t count = 0;
+	unsigned int i;
+
+	for (i = 0; i < stats->bucket_count; i++) {
+		if (stats_dist_bucket_upper(stats->bucket_first + i) > value)
+			break;
+		count += stats->buckets[i];
+	}
+	return count;
+}
+
+void stats_dist_export(const struct stats_dist *stats, string_t *dest)
+{
+	unsigned int i, samples_count;
+
+	samples_count = I_MIN(stats->count, stats->sample_count);
+	str_printfa(dest, "%u %"PRIu64" %"PRIu64" %"PRIu64" %u",
+		    stats->count, stats->sum, stats->min, stats->max,
+		    samples_count);
+	for (i = 0; i < samples_count; i++)
+		str_printfa(dest, " %"PRIu64, stats->samples[i]);
+	str_printfa(dest, " %u %u", stats->bucket_first, stats->bucket_count);
+	for (i = 0; i < stats->bucket_count; i++)
+		str_printfa(dest, " %u", stats->buckets[i]);
+}
+
+static int
+stats_dist_import_args(struct stats_dist *stats, const char *const *args,
+		       const char **error_r)
+{
+	unsigned int i, samples_count, bucket_count, buckets_sum = 0;
+	unsigned int count = str_array_length(args);
+
+	if (count < 7 ||
+	    str_to_uint(args[0], &stats->count) < 0 ||
+	    str_to_uint64(args[1], &stats->sum) < 0 ||
+	    str_to_uint64(args[2], &stats->min) < 0 ||
+	    str_to_uint64(args[3], &stats->max) < 0 ||
+	    str_to_uint(args[4], &samples_count) < 0) {
+		*error_r = "Invalid header";
+		return -1;
+	}
+	args += 5; count -= 5;
+	if (samples_count != I_MIN(stats->count, stats->sample_count) ||
+	    samples_count + 2 > count) {
+		*error_r = "Invalid number of samples";
+		return -1;
+	}
+	for (i = 0; i < samples_count; i++) {
+		if (str_to_uint64(args[i], &stats->samples[i]) < 0) {
+			*error_r = "Invalid sample";
+			return -1;
+		}
+	}
+	args += samples_count; count -= samples_count;
+
+	if (str_to_uint(args[0], &stats->bucket_first) < 0 ||
+	    str_to_uint(args[1], &bucket_count) < 0 ||
+	    bucket_count != count - 2 ||
+	    stats->bucket_first > STATS_DIST_MAX_BUCKETS ||
+	    bucket_count > STATS_DIST_MAX_BUCKETS - stats->bucket_first) {
+		*error_r = "Invalid buckets";
+		return -1;
+	}
+	if (bucket_count > 0) {
+		stats->buckets = i_new(unsigned int, bucket_count);
+		stats->bucket_count = bucket_count;
+	}
+	for (i = 0; i < bucket_count; i++) {
+		if (str_to_uint(args[2 + i], &stats->buckets[i]) < 0) {
+			*error_r = "Invalid bucket";
+			return -1;
+		}
+		buckets_sum += stats->buckets[i];
+	}
+	if (buckets_sum != stats->count) {
+		*error_r = "Bucket counts don't match the event count";
+		return -1;
+	}
+	return 0;
+}
+
+int stats_dist_import(struct stats_dist *stats, const char *data,
+		      const char **error_r)
+{
+	stats_dist_reset(stats);
+	if (stats_dist_import_args(stats, t_strsplit(data, " "),
+				   error_r) < 0) {
+		stats_dist_reset(stats);
+		return -1;
+	}
+	return 0;
+}
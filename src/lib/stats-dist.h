@@ -10,6 +10,9 @@ void stats_dist_reset(struct stats_dist *stats);
 
 /* Add a new event. */
 void stats_dist_add(struct stats_dist *stats, uint64_t value);
+/* Add all events from src to dest. Both must have the same sample count.
+   The samples are randomly merged, but the histogram stays exact. */
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src);
 
 /* Returns number of events added. */
 unsigned int stats_dist_get_count(const struct stats_dist *stats);
@@ -22,14 +25,16 @@ uint64_t stats_dist_get_min(const struct stats_dist *stats);
 uint64_t stats_dist_get_max(const struct stats_dist *stats);
 /* Returns events' average. */
 double stats_dist_get_avg(const struct stats_dist *stats);
-/* Returns events' approximate (through random subsampling) median. */
+/* Returns events' median. This is exact as long as the number of events
+   doesn't exceed the sample count. After that it's calculated from a
+   log-linear histogram with less than 1/32 relative error. */
 uint64_t stats_dist_get_median(struct stats_dist *stats);
 /* Returns events' variance */
 double stats_dist_get_variance(const struct stats_dist *stats);
-/* Returns events' approximate (through random subsampling) percentile.
+/* Returns events' percentile with the same accuracy as the median.
    fraction parameter is in the range (0., 1.], so 95th %-ile is 0.95. */
 uint64_t stats_dist_get_percentile(struct stats_dist *stats, double fraction);
-/* Returns events' approximate (through random subsampling) 95th percentile. */
+/* Returns events' 95th percentile. */
 static inline uint64_t stats_dist_get_95th(struct stats_dist *stats)
 {
 	return stats_dist_get_percentile(stats, 0.95);
@@ -37,4 +42,18 @@ static inline uint64_t stats_dist_get_95th(struct stats_dist *stats)
 /* Returns the sample array */
 const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
 				       unsigned int *count_r);
+/* Returns the number of events that are <= value. This is exact when value
+   is a power of two or 1..32. Otherwise the events in the histogram bucket
+   containing value aren't counted. */
+uint64_t stats_dist_get_count_le(const struct stats_dist *stats,
+				 uint64_t value);
+
+/* Append the full state of stats to dest as a space-separated string. */
+void stats_dist_export(const struct stats_dist *stats, string_t *dest);
+/* Replace the state of stats with the one exported by stats_dist_export().
+   The sample counts must be the same. Returns 0 on success, -1 if the data
+   is invalid. */
+int stats_dist_import(struct stats_dist *stats, const char *data,
+		      const char **error_r);
+
 #endif
@@ -5,6 +5,11 @@
 #include "lib.h"
 #include "str-find.h"
 
+/* Keys up to this length are searched by scanning for the first byte with
+   memchr(), which libc implements with SIMD instructions. Boyer-Moore's
+   skips are better than that only for longer keys. */
+#define STR_FIND_MEMCHR_MAX_KEY_LEN 32
+
 struct str_find_context {
 	pool_t pool;
 	unsigned char *key;
@@ -106,6 +111,36 @@ void str_find_deinit(struct str_find_context **_ctx)
 	p_free(ctx->pool, ctx);
 }
 
+static bool str_find_memchr(struct str_find_context *ctx,
+			    const unsigned char *data, size_t size,
+			    unsigned int *pos_r)
+{
+	const unsigned char *p, *end;
+	unsigned int key_len = ctx->key_len;
+	unsigned char first = ctx->key[0], last = ctx->key[key_len-1];
+
+	if (size < key_len) {
+		*pos_r = 0;
+		return FALSE;
+	}
+
+	/* find the first byte, then check the last byte before comparing
+	   the rest of the key */
+	p = data;
+	end = data + size - key_len + 1;
+	while ((p = memchr(p, first, end - p)) != NULL) {
+		if (p[key_len-1] == last &&
+		    memcmp(p + 1, ctx->key + 1, key_len - 1) == 0) {
+			ctx->match_end_pos = (p - data) + key_len;
+			return TRUE;
+		}
+		p++;
+	}
+	/* the rest of the data is checked for partial matches */
+	*pos_r = end - data;
+	return FALSE;
+}
+
 bool str_find_more(struct str_find_context *ctx,
 		    const unsigned char *data, size_t size)
 {
@@ -140,6 +175,10 @@ bool str_find_more(struct str_find_context *ctx,
 		i_assert(j + size < key_len);
 		ctx->match_count = j;
 		j = 0;
+	} else if (key_len <= STR_FIND_MEMCHR_MAX_KEY_LEN) {
+		if (str_find_memchr(ctx, data, size, &j))
+			return TRUE;
+		ctx->match_count = 0;
 	} else {
 		/* Boyer-Moore searching */
 		j = 0;
@@ -1302,6 +1302,54 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static void test_base64_decode_small_dest(void)
+{
+	string_t *enc, *dec;
+	buffer_t out;
+	unsigned char data[1024], outbuf[16];
+	unsigned int i, j, len;
+
+	enc = t_str_new(2048);
+	dec = t_str_new(1024);
+
+	test_begin("base64 decode into small output buffers");
+	for (i = 0; i < 200; i++) {
+		struct base64_encoder b64enc;
+		struct base64_decoder b64dec;
+		size_t pos = 0, src_pos, out_size;
+		int ret = 1;
+
+		len = i_rand_limit(sizeof(data));
+		for (j = 0; j < len; j++)
+			data[j] = i_rand_uchar();
+		str_truncate(enc, 0);
+		base64_encode_init(&b64enc, &base64_scheme,
+				   i % 2 == 0 ? BASE64_ENCODE_FLAG_CRLF : 0,
+				   i_rand_limit(80));
+		base64_encode_more(&b64enc, data, len, NULL, enc);
+		base64_encode_finish(&b64enc, enc);
+
+		out_size = i_rand_minmax(1, sizeof(outbuf));
+		str_truncate(dec, 0);
+		base64_decode_init(&b64dec, &base64_scheme, 0);
+		while (ret > 0 && pos < str_len(enc)) {
+			buffer_create_from_data(&out, outbuf, out_size);
+			ret = base64_decode_more(&b64dec,
+						 str_data(enc) + pos,
+						 str_len(enc) - pos,
+						 &src_pos, &out);
+			pos += src_pos;
+			buffer_append(dec, out.data, out.used);
+		}
+		test_assert_idx(ret > 0, i);
+		test_assert_idx(base64_decode_finish(&b64dec) == 0, i);
+		test_assert_idx(pos == str_len(enc), i);
+		test_assert_idx(str_len(dec) == len &&
+				memcmp(str_data(dec), data, len) == 0, i);
+	}
+	test_end();
+}
+
 void test_base64(void)
 {
 	test_base64_encode();
@@ -1314,4 +1362,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_decode_small_dest();
 }
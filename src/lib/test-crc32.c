@@ -10,5 +10,16 @@ void test_crc32(void)
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	/* long enough to use the word-at-a-time code paths */
+	const char *fox = "The quick brown fox jumps over the lazy dog";
+	test_assert(crc32_str(fox) == 0x414fa339);
+	test_assert(crc32_data(fox, strlen(fox)) == 0x414fa339);
+	for (unsigned int i = 0; i <= 16; i++) {
+		const char *data = "0123456789abcdef0123456789abcdef";
+
+		test_assert_idx(crc32_data_more(crc32_data(data, i), data + i,
+						32 - i) ==
+				crc32_data(data, 32), i);
+	}
 	test_end();
 }
@@ -68,6 +68,47 @@ static void test_ds_grow_event(void)
 	test_end();
 }
 
+static void test_ds_free_unused_if_idle(void)
+{
+	const char *error;
+
+	test_begin("data-stack free unused if idle");
+	event_register_callback(test_ds_grow_event_callback);
+
+	struct event_filter *filter = event_filter_create();
+	test_assert(event_filter_parse("event=data_stack_grow", filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+
+	T_BEGIN {
+		(void)t_malloc0(1024*5);
+		(void)t_malloc0(1024*100);
+	} T_END;
+	test_assert(ds_grow_event_count == 1);
+
+	/* the block was just used - it's not freed */
+	data_stack_free_unused_if_idle();
+	T_BEGIN {
+		(void)t_malloc0(1024*5);
+		(void)t_malloc0(1024*100);
+	} T_END;
+	test_assert(ds_grow_event_count == 1);
+
+	/* it was used again, so it's still not freed */
+	data_stack_free_unused_if_idle();
+	/* not used since the previous call - freed */
+	data_stack_free_unused_if_idle();
+	T_BEGIN {
+		(void)t_malloc0(1024*5);
+		(void)t_malloc0(1024*100);
+	} T_END;
+	test_assert(ds_grow_event_count == 2);
+
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_ds_grow_event_callback);
+	test_end();
+}
+
 static void test_ds_get_used_size(void)
 {
 	test_begin("data-stack data_stack_get_used_size()");
@@ -347,6 +388,7 @@ void test_data_stack(void)
 {
 	void (*tests[])(void) = {
 		test_ds_grow_event,
+		test_ds_free_unused_if_idle,
 		test_ds_get_used_size,
 		test_ds_get_bytes_available,
 		test_ds_grow_in_event,
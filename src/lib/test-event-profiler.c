@@ -0,0 +1,91 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "lib-event-private.h"
+#include "event-filter.h"
+#include "lib-signals.h"
+#include "event-profiler.h"
+#include "backtrace-string.h"
+
+#include <time.h>
+
+static struct event *test_parent_event;
+static unsigned int test_samples_count;
+static unsigned int test_parent_samples_count;
+
+static bool
+test_event_profiler_callback(struct event *event,
+			     enum event_callback_type type,
+			     struct failure_context *ctx ATTR_UNUSED,
+			     const char *fmt ATTR_UNUSED,
+			     va_list args ATTR_UNUSED)
+{
+	const struct event_field *field;
+
+	if (type != EVENT_CALLBACK_TYPE_SEND ||
+	    null_strcmp(event->sending_name, "profiler_samples") != 0)
+		return TRUE;
+
+	field = event_find_field_nonrecursive(event, "samples");
+	test_assert(field != NULL &&
+		    field->value_type == EVENT_FIELD_VALUE_TYPE_INTMAX);
+	if (field == NULL)
+		return TRUE;
+	test_samples_count += field->value.intmax;
+	if (event_get_parent(event) == test_parent_event)
+		test_parent_samples_count += field->value.intmax;
+
+	field = event_find_field_nonrecursive(event, "stack");
+	test_assert(field != NULL &&
+		    field->value_type == EVENT_FIELD_VALUE_TYPE_STR);
+	return TRUE;
+}
+
+static void test_event_profiler_busy_loop(clock_t msecs)
+{
+	clock_t end = clock() + msecs * CLOCKS_PER_SEC / 1000;
+	volatile unsigned int i = 0;
+
+	while (clock() < end)
+		i++;
+}
+
+void test_event_profiler(void)
+{
+	const char *error;
+	void *stack[1];
+
+	test_begin("event profiler");
+	if (backtrace_get_addresses(stack, N_ELEMENTS(stack)) == 0) {
+		/* not supported */
+		test_end();
+		return;
+	}
+
+	event_register_callback(test_event_profiler_callback);
+	struct event_filter *filter = event_filter_create();
+	test_assert(event_filter_parse("event=profiler_samples", filter,
+				       &error) == 0);
+	event_set_global_debug_send_filter(filter);
+	event_filter_unref(&filter);
+
+	lib_signals_init();
+	event_profiler_init(1);
+	test_parent_event = event_create(NULL);
+	event_push_global(test_parent_event);
+	test_event_profiler_busy_loop(100);
+	event_pop_global(test_parent_event);
+	test_assert(test_parent_samples_count > 0);
+	test_assert(test_samples_count == test_parent_samples_count);
+
+	/* samples without a global event are sent at deinit */
+	test_event_profiler_busy_loop(100);
+	event_profiler_deinit();
+	lib_signals_deinit();
+	test_assert(test_samples_count > test_parent_samples_count);
+
+	event_unref(&test_parent_event);
+	event_unset_global_debug_send_filter();
+	event_unregister_callback(test_event_profiler_callback);
+	test_end();
+}
@@ -8,6 +8,8 @@
 #include "failures.h"
 
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 static int handlers_set_me;
 
@@ -165,10 +167,72 @@ static void test_internal_split(void)
 	test_end();
 }
 
+static off_t test_write_buffer_file_size(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		i_fatal("stat(%s) failed: %m", path);
+	return st.st_size;
+}
+
+static int test_write_buffer_child(const char *path)
+{
+	i_set_failure_file(path, "");
+	i_set_failure_write_buffer_size(64);
+
+	i_info("first");
+	i_warning("second");
+	if (test_write_buffer_file_size(path) != 0)
+		return 1;
+	i_failure_write_flush();
+	if (test_write_buffer_file_size(path) != 28)
+		return 2;
+
+	/* reaching the maximum size writes the buffer */
+	i_info("%s", "0123456789012345678901234567890123456789"
+		     "0123456789012345678901234567890123456789");
+	if (test_write_buffer_file_size(path) != 28 + 87)
+		return 3;
+
+	i_info("third");
+	i_set_failure_write_buffer_size(0);
+	if (test_write_buffer_file_size(path) != 28 + 87 + 12)
+		return 4;
+	i_info("fourth");
+	if (test_write_buffer_file_size(path) != 28 + 87 + 12 + 13)
+		return 5;
+	return 0;
+}
+
+static void test_write_buffer(void)
+{
+	const char *path = ".test-failures-write-buffer";
+	int status;
+	pid_t pid;
+
+	test_begin("buffered log writes");
+	i_unlink_if_exists(path);
+	switch (pid = fork()) {
+	case (pid_t)-1:
+		i_fatal("fork() failed: %m");
+	case 0:
+		test_exit(test_write_buffer_child(path));
+	default:
+		break;
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		i_fatal("waitpid() failed: %m");
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	i_unlink(path);
+	test_end();
+}
+
 void test_failures(void)
 {
 	test_get_set_handlers();
 	test_expected();
 	test_expected_str();
 	test_internal_split();
+	test_write_buffer();
 }
@@ -4,15 +4,28 @@
 #include "hash.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static unsigned int test_hash_direct_hash(void *p)
+{
+	return POINTER_CAST_TO(p, unsigned int);
+}
+
+static int test_hash_direct_cmp(void *p1, void *p2)
+{
+	return p1 == p2 ? 0 : 1;
+}
+
+static void
+test_hash_random_pool(pool_t pool, enum hash_table_flags flags)
 {
 #define KEYMAX 100000
 	HASH_TABLE(void *, void *) hash;
 	unsigned int *keys;
 	unsigned int i, key, keyidx, delidx;
 
+	test_begin(t_strdup_printf("hash random (flags=%d)", flags));
 	keys = i_new(unsigned int, KEYMAX); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	hash_table_create_flags(&hash, pool, 0, flags,
+				test_hash_direct_hash, test_hash_direct_cmp);
 	for (i = 0; i < KEYMAX; i++) {
 		key = (i_rand_limit(KEYMAX)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -29,19 +42,73 @@ static void test_hash_random_pool(pool_t pool)
 			keyidx--;
 		}
 	}
+	test_assert(hash_table_count(hash) == keyidx);
 	for (i = 0; i < keyidx; i++)
 		hash_table_remove(hash, POINTER_CAST(keys[i]));
+	test_assert(hash_table_count(hash) == 0);
 	hash_table_destroy(&hash);
 	i_free(keys);
+	test_end();
+}
+
+static void test_hash_open_addressing(void)
+{
+	HASH_TABLE(const char *, const char *) hash;
+	struct hash_iterate_context *iter;
+	const char *keys[1000], *key, *value;
+	unsigned int i, count;
+
+	test_begin("hash open addressing");
+	hash_table_create_flags(&hash, default_pool, 0,
+				HASH_TABLE_FLAG_OPEN_ADDRESSING,
+				str_hash, strcmp);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		keys[i] = t_strdup_printf("key%u", i);
+		hash_table_insert(hash, keys[i], keys[i]);
+	}
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys));
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		test_assert(hash_table_lookup(hash, t_strdup_printf("key%u", i)) == keys[i]);
+		hash_table_update(hash, keys[i], keys[(i + 1) % N_ELEMENTS(keys)]);
+	}
+	test_assert(hash_table_lookup(hash, t_strdup("key1000")) == NULL);
+	test_assert(hash_table_lookup(hash, t_strdup("key0")) == keys[1]);
+
+	/* remove every other key while iterating */
+	count = 0;
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		if (count++ % 2 == 0)
+			hash_table_remove(hash, key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == N_ELEMENTS(keys));
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys) / 2);
+
+	count = 0;
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		if (hash_table_lookup(hash, keys[i]) != NULL)
+			count++;
+	}
+	test_assert(count == N_ELEMENTS(keys) / 2);
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, keys[0]) == NULL);
+	hash_table_destroy(&hash);
+	test_end();
 }
 
 void test_hash(void)
 {
 	pool_t pool;
 
-	test_hash_random_pool(default_pool);
+	test_hash_random_pool(default_pool, 0);
+	test_hash_random_pool(default_pool, HASH_TABLE_FLAG_OPEN_ADDRESSING);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, 0);
 	pool_unref(&pool);
+
+	test_hash_open_addressing();
 }
@@ -132,6 +132,45 @@ static void test_ioloop_timeout(void)
 	test_end();
 }
 
+struct test_timeout_reset_ctx {
+	struct timeout *to, *to_reset;
+};
+
+static void timeout_reset_callback(struct test_timeout_reset_ctx *ctx)
+{
+	timeout_reset(ctx->to);
+	timeout_remove(&ctx->to_reset);
+}
+
+static void test_ioloop_timeout_reset(void)
+{
+	struct test_timeout_reset_ctx ctx;
+	struct ioloop *ioloop;
+	struct timeval tv_start, tv_callback;
+
+	test_begin("ioloop timeout reset");
+	ioloop = io_loop_create();
+
+	/* reset the timeout once before it triggers - it must trigger only
+	   after the full timeout from the reset */
+	ctx.to = timeout_add(1000, timeout_callback, &tv_callback);
+	ctx.to_reset = timeout_add_short(300, timeout_reset_callback, &ctx);
+	i_gettimeofday(&tv_start);
+	io_loop_run(ioloop);
+	test_assert(timeval_diff_msecs(&tv_callback, &tv_start) >= 1200);
+	test_assert(ctx.to_reset == NULL);
+
+	/* the timeout keeps running after the deferred reset is applied */
+	i_gettimeofday(&tv_start);
+	io_loop_run(ioloop);
+	test_assert(timeval_diff_msecs(&tv_callback, &tv_start) >= 900);
+	timeout_remove(&ctx.to);
+	test_assert(io_loop_is_empty(ioloop));
+	io_loop_destroy(&ioloop);
+
+	test_end();
+}
+
 static void zero_timeout_callback(unsigned int *counter)
 {
 	*counter += 1;
@@ -394,6 +433,7 @@ static void test_ioloop_context_events(void)
 void test_ioloop(void)
 {
 	test_ioloop_timeout();
+	test_ioloop_timeout_reset();
 	test_ioloop_zero_timeout();
 	test_ioloop_zero_timeout_recreate();
 	test_ioloop_find_fd_conditions();
@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "array.h"
+#include "str.h"
 
 static void test_event_fields(void)
 {
@@ -86,6 +87,48 @@ static void test_event_strlist(void)
 	test_end();
 }
 
+static const char *test_event_lazy_callback(unsigned int *counter)
+{
+	return t_strdup_printf("lazy%u", ++*counter);
+}
+
+static void test_event_str_lazy(void)
+{
+	unsigned int counter = 0;
+	unsigned int count;
+
+	test_begin("event lazy str");
+	struct event *e1 = event_create(NULL);
+	event_add_str_lazy(e1, "key", test_event_lazy_callback, &counter);
+	event_add_str_lazy(e1, "key2", test_event_lazy_callback, &counter);
+	test_assert(counter == 0);
+
+	/* the value is generated only once */
+	struct event *e2 = event_create(e1);
+	test_assert_strcmp(event_find_field_recursive_str(e2, "key"), "lazy1");
+	test_assert_strcmp(event_find_field_recursive_str(e1, "key"), "lazy1");
+	test_assert(counter == 1);
+
+	/* replacing the field drops the callback */
+	event_add_str_lazy(e1, "key", test_event_lazy_callback, &counter);
+	event_add_str(e1, "key", "value");
+	test_assert_strcmp(event_find_field_recursive_str(e1, "key"), "value");
+	test_assert(counter == 1);
+
+	/* exporting generates the remaining values */
+	string_t *str = t_str_new(128);
+	event_export(e1, str);
+	test_assert(counter == 2);
+	test_assert(strstr(str_c(str), "lazy2") != NULL);
+	(void)event_get_fields(e1, &count);
+	test_assert(count == 2);
+	test_assert(counter == 2);
+
+	event_unref(&e2);
+	event_unref(&e1);
+	test_end();
+}
+
 static void test_lib_event_reason_code(void)
 {
 	test_begin("event reason codes");
@@ -100,6 +143,7 @@ void test_lib_event(void)
 {
 	test_event_fields();
 	test_event_strlist();
+	test_event_str_lazy();
 	test_lib_event_reason_code();
 }
 
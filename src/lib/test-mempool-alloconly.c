@@ -14,7 +14,7 @@ static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
 	return TRUE;
 }
 
-void test_mempool_alloconly(void)
+static void test_mempool_alloconly_alloc(void)
 {
 #define SENTRY_SIZE 32
 #define SENTRY_CHAR 0xDE
@@ -50,9 +50,67 @@ void test_mempool_alloconly(void)
 			pool_unref(&pool);
 		}
 	}
+
+	/* the freed blocks may be reused, so they must be cleared */
+	for (i = 0; i < 2; i++) {
+		pool = pool_alloconly_create("test", 1024);
+		mem[0] = p_malloc(pool, 512);
+		test_assert(mem_has_bytes(mem[0], 512, 0));
+		memset(mem[0], 0xff, 512);
+		mem[1] = p_malloc(pool, 2048);
+		test_assert(mem_has_bytes(mem[1], 2048, 0));
+		memset(mem[1], 0xff, 2048);
+		pool_unref(&pool);
+	}
 	test_end();
 }
 
+static void test_mempool_alloconly_usage(void)
+{
+	const struct pool_alloconly_usage *const *usages;
+	unsigned int i, count;
+	pool_t pool1, pool2;
+
+	test_begin("mempool_alloconly usage tracking");
+	test_assert(pool_alloconly_get_usage(&count) == NULL && count == 0);
+	pool_alloconly_usage_tracking_enable();
+
+	pool1 = pool_alloconly_create("test usage", 1024);
+	pool2 = pool_alloconly_create(MEMPOOL_GROWING"test usage", 1024);
+	(void)p_malloc(pool2, 4096);
+
+	usages = pool_alloconly_get_usage(&count);
+	for (i = 0; i < count; i++) {
+		if (strcmp(usages[i]->name, "test usage") == 0)
+			break;
+	}
+	test_assert(i < count);
+	if (i < count) {
+		test_assert(usages[i]->pool_count == 2);
+		test_assert(usages[i]->alloc_size ==
+			    pool_alloconly_get_total_alloc_size(pool1) +
+			    pool_alloconly_get_total_alloc_size(pool2));
+		size_t peak_alloc_size = usages[i]->alloc_size;
+		test_assert(usages[i]->peak_alloc_size == peak_alloc_size);
+
+		pool_unref(&pool1);
+		pool_unref(&pool2);
+		test_assert(usages[i]->pool_count == 0);
+		test_assert(usages[i]->alloc_size == 0);
+		test_assert(usages[i]->peak_alloc_size == peak_alloc_size);
+	}
+	pool_unref(&pool1);
+	pool_unref(&pool2);
+	pool_alloconly_usage_tracking_deinit();
+	test_end();
+}
+
+void test_mempool_alloconly(void)
+{
+	test_mempool_alloconly_alloc();
+	test_mempool_alloconly_usage();
+}
+
 enum fatal_test_state fatal_mempool_alloconly(unsigned int stage)
 {
 	static pool_t pool;
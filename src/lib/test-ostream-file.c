@@ -2,11 +2,13 @@
 
 #include "test-lib.h"
 #include "net.h"
+#include "fd-util.h"
 #include "str.h"
 #include "safe-mkstemp.h"
 #include "randgen.h"
 #include "istream.h"
 #include "ostream.h"
+#include "ostream-file-private.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -181,9 +183,109 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static void test_ostream_file_send_istream_socket(void)
+{
+	struct istream *input;
+	struct ostream *output;
+	char buf[10];
+	int in_fd[2], out_fd[2];
+
+	test_begin("ostream file send istream socket");
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	fd_set_nonblock(in_fd[1], TRUE);
+	fd_set_nonblock(out_fd[0], TRUE);
+	input = i_stream_create_fd_autoclose(&in_fd[1], 1024);
+	output = o_stream_create_fd_autoclose(&out_fd[0], 1024);
+
+	/* data is moved until the input has no more */
+	test_assert(write(in_fd[0], "abcdefghij", 10) == 10);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(input->v_offset == 10);
+	test_assert(output->offset == 10);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 10 &&
+		    memcmp(buf, "abcdefghij", 10) == 0);
+
+	/* data already buffered in the istream is sent first */
+	test_assert(write(in_fd[0], "0123", 4) == 4);
+	test_assert(i_stream_read(input) == 4);
+	test_assert(write(in_fd[0], "45", 2) == 2);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(input->v_offset == 16);
+	test_assert(output->offset == 16);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 6 &&
+		    memcmp(buf, "012345", 6) == 0);
+
+	/* EOF */
+	i_close_fd(&in_fd[0]);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	test_assert(input->eof);
+
+	i_stream_unref(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&out_fd[1]);
+	test_end();
+}
+
+static unsigned int test_writev_count;
+
+static ssize_t
+test_ostream_file_writev_counter(struct file_ostream *fstream,
+				 const struct const_iovec *iov,
+				 unsigned int iov_count, const char **error_r)
+{
+	test_writev_count++;
+	return o_stream_file_writev(fstream, iov, iov_count, error_r);
+}
+
+static void test_ostream_file_writev_with_buffer(void)
+{
+	struct file_ostream *fstream;
+	struct ostream *output;
+	unsigned char data[100], buf[256];
+	unsigned int i;
+	int sock_fd[2];
+
+	test_begin("ostream file writev with buffer");
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fd) == 0);
+	output = o_stream_create_fd(sock_fd[0], 64);
+	fstream = container_of(output->real_stream, struct file_ostream,
+			       ostream);
+	fstream->writev = test_ostream_file_writev_counter;
+	test_writev_count = 0;
+
+	/* the buffered data and the data that doesn't fit into the buffer
+	   are sent with a single writev() */
+	o_stream_cork(output);
+	test_assert(o_stream_send(output, "0123456789", 10) == 10);
+	test_assert(test_writev_count == 0);
+	test_assert(o_stream_send(output, data, sizeof(data)) == sizeof(data));
+	test_assert(test_writev_count == 1);
+	test_assert(o_stream_get_buffer_used_size(output) == 0);
+	o_stream_uncork(output);
+	test_assert(test_writev_count == 1);
+	test_assert(output->offset == 10 + sizeof(data));
+
+	test_assert(read(sock_fd[1], buf, sizeof(buf)) == 10 + sizeof(data));
+	test_assert(memcmp(buf, "0123456789", 10) == 0);
+	test_assert(memcmp(buf + 10, data, sizeof(data)) == 0);
+
+	o_stream_destroy(&output);
+	i_close_fd(&sock_fd[0]);
+	i_close_fd(&sock_fd[1]);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_send_istream_socket();
+	test_ostream_file_writev_with_buffer();
 }
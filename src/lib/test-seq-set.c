@@ -0,0 +1,152 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "array.h"
+#include "seq-set.h"
+
+static void
+test_seq_set_assert_equals(const struct seq_set *set,
+			   const ARRAY_TYPE(seq_range) *expected)
+{
+	ARRAY_TYPE(seq_range) ranges;
+	const struct seq_range *r1, *r2;
+	unsigned int i, count1, count2;
+
+	t_array_init(&ranges, 16);
+	seq_set_to_array(set, &ranges);
+	r1 = array_get(&ranges, &count1);
+	r2 = array_get(expected, &count2);
+	test_assert(count1 == count2);
+	for (i = 0; i < count1 && i < count2; i++) {
+		test_assert_idx(r1[i].seq1 == r2[i].seq1 &&
+				r1[i].seq2 == r2[i].seq2, i);
+	}
+	test_assert(seq_set_count(set) == seq_range_count(expected));
+}
+
+static void test_seq_set_boundaries(void)
+{
+	struct seq_set *set;
+	ARRAY_TYPE(seq_range) expected;
+
+	test_begin("seq_set boundaries");
+	set = seq_set_init();
+	t_array_init(&expected, 4);
+
+	test_assert(!seq_set_add(set, 0));
+	test_assert(!seq_set_add(set, (uint32_t)-1));
+	test_assert(seq_set_add(set, (uint32_t)-1));
+	/* spans multiple chunks */
+	test_assert(seq_set_add_range(set, 65530, 200000) == 200000-65530+1);
+	test_assert(seq_set_add_range(set, 65535, 65536) == 0);
+	seq_range_array_add(&expected, 0);
+	seq_range_array_add_range(&expected, 65530, 200000);
+	seq_range_array_add(&expected, (uint32_t)-1);
+	test_seq_set_assert_equals(set, &expected);
+
+	test_assert(seq_set_exists(set, 65535));
+	test_assert(seq_set_exists(set, 65536));
+	test_assert(!seq_set_exists(set, 200001));
+	test_assert(seq_set_remove(set, 65536));
+	test_assert(!seq_set_remove(set, 65536));
+	test_assert(seq_set_remove(set, 0));
+	test_assert(!seq_set_exists(set, 0));
+	seq_range_array_remove(&expected, 65536);
+	seq_range_array_remove(&expected, 0);
+	test_seq_set_assert_equals(set, &expected);
+
+	seq_set_clear(set);
+	test_assert(seq_set_count(set) == 0);
+	seq_set_deinit(&set);
+	test_assert(set == NULL);
+	test_end();
+}
+
+static void test_seq_set_sparse(void)
+{
+	struct seq_set *set;
+	ARRAY_TYPE(seq_range) expected;
+	uint32_t seq;
+
+	test_begin("seq_set sparse");
+	set = seq_set_init();
+	t_array_init(&expected, 1024);
+
+	/* every other sequence in descending order converts the chunks to
+	   bitmaps */
+	for (seq = 300000; seq > 0; seq -= 2)
+		test_assert(!seq_set_add(set, seq));
+	for (seq = 2; seq <= 300000; seq += 2)
+		seq_range_array_add(&expected, seq);
+	test_seq_set_assert_equals(set, &expected);
+
+	/* fill the holes in the middle */
+	for (seq = 100001; seq < 200000; seq += 2)
+		test_assert(!seq_set_add(set, seq));
+	seq_range_array_add_range(&expected, 100001, 199999);
+	test_seq_set_assert_equals(set, &expected);
+
+	/* remove most of it - seq_range_array_remove() would be too slow
+	   for this, so just check the return values */
+	for (seq = 1; seq <= 300000; seq++) {
+		if (seq % 1000 != 0) {
+			test_assert(seq_set_remove(set, seq) ==
+				    seq_range_exists(&expected, seq));
+		}
+	}
+	array_clear(&expected);
+	for (seq = 1000; seq <= 300000; seq += 1000)
+		seq_range_array_add(&expected, seq);
+	test_seq_set_assert_equals(set, &expected);
+	test_assert(seq_set_count(set) == 300);
+	seq_set_deinit(&set);
+	test_end();
+}
+
+static void test_seq_set_random(void)
+{
+	struct seq_set *set;
+	ARRAY_TYPE(seq_range) expected;
+	uint32_t seq1, seq2;
+	unsigned int i;
+
+	test_begin("seq_set random");
+	set = seq_set_init();
+	t_array_init(&expected, 1024);
+	for (i = 0; i < 20000; i++) {
+		seq1 = i_rand_limit(300000);
+		switch (i_rand_limit(3)) {
+		case 0:
+			test_assert_idx(seq_set_add(set, seq1) ==
+					seq_range_array_add(&expected, seq1), i);
+			break;
+		case 1:
+			seq2 = seq1 + i_rand_limit(100);
+			test_assert_idx(seq_set_add_range(set, seq1, seq2) ==
+					seq_range_array_add_range_count(&expected,
+									seq1, seq2), i);
+			break;
+		case 2:
+			test_assert_idx(seq_set_remove(set, seq1) ==
+					seq_range_array_remove(&expected, seq1), i);
+			break;
+		}
+		test_assert_idx(seq_set_exists(set, seq1) ==
+				seq_range_exists(&expected, seq1), i);
+	}
+	test_seq_set_assert_equals(set, &expected);
+
+	/* converting back and forth gives the same result */
+	seq_set_clear(set);
+	seq_set_add_array(set, &expected);
+	test_seq_set_assert_equals(set, &expected);
+	seq_set_deinit(&set);
+	test_end();
+}
+
+void test_seq_set(void)
+{
+	test_seq_set_boundaries();
+	test_seq_set_sparse();
+	test_seq_set_random();
+}
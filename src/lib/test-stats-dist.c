@@ -1,6 +1,7 @@
 /* Copyright (c) 2007-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "str.h"
 #include "stats-dist.h"
 #include "sort.h"
 #include "math.h"
@@ -79,6 +80,136 @@ static void test_stats_dist_get_variance(void)
 	test_end();
 }
 
+static bool
+test_stats_dist_is_near(uint64_t value, uint64_t expected)
+{
+	/* the histogram's relative error is below 1/32 */
+	return value >= expected - expected/32 &&
+		value <= expected + expected/32;
+}
+
+static void test_stats_dist_histogram(void)
+{
+	struct stats_dist *t, *t2;
+	unsigned int i;
+
+	test_begin("stats_dists histogram");
+	t = stats_dist_init();
+	for (i = 1; i <= 100000; i++)
+		stats_dist_add(t, i);
+	test_assert(test_stats_dist_is_near(stats_dist_get_median(t), 50000));
+	test_assert(test_stats_dist_is_near(stats_dist_get_95th(t), 95000));
+	test_assert(test_stats_dist_is_near(
+		stats_dist_get_percentile(t, 0.99), 99000));
+	test_assert(test_stats_dist_is_near(
+		stats_dist_get_percentile(t, 0.999), 99900));
+	test_assert(stats_dist_get_percentile(t, 1) == 100000);
+	test_assert(stats_dist_get_percentile(t, 0) == 1);
+	test_assert(stats_dist_get_count_le(t, 0) == 0);
+	test_assert(stats_dist_get_count_le(t, 1) == 1);
+	test_assert(stats_dist_get_count_le(t, 20) == 20);
+	test_assert(stats_dist_get_count_le(t, 1024) == 1024);
+	test_assert(stats_dist_get_count_le(t, 65536) == 65536);
+	test_assert(stats_dist_get_count_le(t, 1ULL << 40) == 100000);
+
+	stats_dist_reset(t);
+	test_assert(stats_dist_get_count_le(t, 1ULL << 40) == 0);
+	stats_dist_add(t, 0);
+	stats_dist_add(t, UINT64_MAX);
+	test_assert(stats_dist_get_count_le(t, 1) == 1);
+	test_assert(stats_dist_get_count_le(t, 1ULL << 63) == 1);
+	test_assert(stats_dist_get_count_le(t, UINT64_MAX) == 2);
+	stats_dist_deinit(&t);
+	test_end();
+
+	test_begin("stats_dists merge");
+	t = stats_dist_init();
+	t2 = stats_dist_init();
+	stats_dist_merge(t, t2);
+	test_assert(stats_dist_get_count(t) == 0);
+	for (i = 1; i <= 100; i++)
+		stats_dist_add(t, i * 1000);
+	for (i = 1; i <= 50000; i++)
+		stats_dist_add(t2, i);
+	stats_dist_merge(t, t2);
+	test_assert(stats_dist_get_count(t) == 50100);
+	test_assert(stats_dist_get_sum(t) == 5050*1000 + 50000ULL*50001/2);
+	test_assert(stats_dist_get_min(t) == 1);
+	test_assert(stats_dist_get_max(t) == 100000);
+	test_assert(stats_dist_get_count_le(t, 32768) == 32768 + 32);
+	test_assert(stats_dist_get_percentile(t, 1) == 100000);
+	test_assert(test_stats_dist_is_near(
+		stats_dist_get_percentile(t, 0.999), 100000 - 50*1000));
+
+	/* merging into an empty dist gives the same result */
+	stats_dist_reset(t);
+	stats_dist_merge(t, t2);
+	test_assert(stats_dist_get_count(t) == 50000);
+	test_assert(stats_dist_get_min(t) == 1);
+	test_assert(stats_dist_get_max(t) == 50000);
+	test_assert(stats_dist_get_count_le(t, 16384) == 16384);
+	stats_dist_deinit(&t);
+	stats_dist_deinit(&t2);
+	test_end();
+}
+
+static void test_stats_dist_export_import(void)
+{
+	static const char *const invalid_data[] = {
+		"",
+		"1 2 3 4",
+		"1 5 5 5 0 4 1 1",
+		"1 5 5 5 1 5 4 2 1 1",
+		"2 5 5 5 1 5 4 1 1",
+		"1 5 5 5 1 5 1919 2 1 0",
+		"1 5 5 5 1 x 4 1 1",
+	};
+	struct stats_dist *t, *t2;
+	const char *error;
+	string_t *str = t_str_new(128), *str2 = t_str_new(128);
+	unsigned int i, n;
+
+	test_begin("stats_dists export/import");
+	t = stats_dist_init();
+	t2 = stats_dist_init();
+	for (n = 0; n < 2; n++) {
+		/* both with all events in samples, and with more events */
+		for (i = 0; i < 1000; i++)
+			stats_dist_add(t, i * 7 + n);
+		str_truncate(str, 0);
+		stats_dist_export(t, str);
+		test_assert(stats_dist_import(t2, str_c(str), &error) == 0);
+		test_assert(stats_dist_get_count(t2) == stats_dist_get_count(t));
+		test_assert(stats_dist_get_sum(t2) == stats_dist_get_sum(t));
+		test_assert(stats_dist_get_min(t2) == stats_dist_get_min(t));
+		test_assert(stats_dist_get_max(t2) == stats_dist_get_max(t));
+		test_assert(stats_dist_get_95th(t2) == stats_dist_get_95th(t));
+		str_truncate(str2, 0);
+		stats_dist_export(t2, str2);
+		test_assert_strcmp(str_c(str), str_c(str2));
+	}
+
+	stats_dist_reset(t);
+	str_truncate(str, 0);
+	stats_dist_export(t, str);
+	test_assert(stats_dist_import(t2, str_c(str), &error) == 0);
+	test_assert(stats_dist_get_count(t2) == 0);
+
+	stats_dist_add(t, 5);
+	str_truncate(str, 0);
+	stats_dist_export(t, str);
+	test_assert_strcmp(str_c(str), "1 5 5 5 1 5 4 1 1");
+
+	for (i = 0; i < N_ELEMENTS(invalid_data); i++) {
+		test_assert_idx(stats_dist_import(t2, invalid_data[i],
+						  &error) < 0, i);
+		test_assert_idx(stats_dist_get_count(t2) == 0, i);
+	}
+	stats_dist_deinit(&t);
+	stats_dist_deinit(&t2);
+	test_end();
+}
+
 void test_stats_dist(void)
 {
 	static int64_t test_input1[] = {
@@ -129,4 +260,6 @@ void test_stats_dist(void)
 	test_end();
 
 	test_stats_dist_get_variance();
+	test_stats_dist_histogram();
+	test_stats_dist_export_import();
 }
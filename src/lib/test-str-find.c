@@ -56,6 +56,56 @@ struct str_find_input {
 	int pos;
 };
 
+static void test_str_find_random_blocks(void)
+{
+	struct str_find_context *ctx;
+	unsigned char text[1024], key[48];
+	unsigned int i, key_len, key_pos, pos, n, text_len = sizeof(text);
+	const unsigned char *p;
+	int expected_pos, found_pos;
+	bool matched;
+
+	test_begin("str_find() random blocks");
+	for (i = 0; i < 2000; i++) {
+		/* use a small alphabet so there are many partial matches */
+		for (pos = 0; pos < text_len; pos++)
+			text[pos] = 'a' + i_rand_limit(3);
+		key_len = i_rand_minmax(1, sizeof(key));
+		if (i_rand_limit(2) == 0) {
+			key_pos = i_rand_limit(text_len - key_len + 1);
+			memcpy(key, text + key_pos, key_len);
+		} else {
+			for (pos = 0; pos < key_len; pos++)
+				key[pos] = 'a' + i_rand_limit(3);
+		}
+
+		expected_pos = -1;
+		for (p = text; p + key_len <= text + text_len; p++) {
+			if (memcmp(p, key, key_len) == 0) {
+				expected_pos = p - text;
+				break;
+			}
+		}
+
+		T_BEGIN {
+			ctx = str_find_init(pool_datastack_create(),
+					    t_strndup(key, key_len));
+			matched = FALSE; found_pos = -1;
+			for (pos = 0; pos < text_len && !matched; pos += n) {
+				n = I_MIN(i_rand_minmax(1, 128), text_len - pos);
+				if (str_find_more(ctx, text + pos, n)) {
+					matched = TRUE;
+					found_pos = pos - key_len +
+						str_find_get_match_end_pos(ctx);
+				}
+			}
+			str_find_deinit(&ctx);
+		} T_END;
+		test_assert_idx(found_pos == expected_pos, i);
+	}
+	test_end();
+}
+
 void test_str_find(void)
 {
 	static const char *fail_input[] = {
@@ -83,4 +133,5 @@ void test_str_find(void)
 	for (i = 0; i < N_ELEMENTS(fail_input) && success; i++)
 		success = test_str_find_substring(fail_input[i], -1);
 	test_out("str_find()", success);
+	test_str_find_random_blocks();
 }
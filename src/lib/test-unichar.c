@@ -36,6 +36,40 @@ static void test_unichar_uni_utf8_partial_strlen_n(void)
 	test_end();
 }
 
+static void test_unichar_ascii_runs(void)
+{
+	/* invalid and multibyte sequences at each position relative to the
+	   word-sized ASCII checks */
+	unsigned char input[40];
+	buffer_t *buf = t_buffer_create(64);
+	size_t i, pos;
+
+	test_begin("unichar ASCII runs");
+	for (i = 0; i + 2 <= sizeof(input); i++) {
+		memset(input, 'a', sizeof(input));
+		input[i] = 0xc3;
+		input[i + 1] = 0xa4;
+		test_assert_idx(uni_utf8_data_is_valid(input, sizeof(input)), i);
+		test_assert_idx(uni_utf8_partial_strlen_n(input, sizeof(input),
+							  &pos) ==
+				sizeof(input) - 1 && pos == sizeof(input), i);
+		test_assert_idx(uni_utf8_partial_strlen_n(input, i + 1, &pos) ==
+				i && pos == i, i);
+
+		input[i + 1] = 'a';
+		test_assert_idx(!uni_utf8_data_is_valid(input, sizeof(input)), i);
+		buffer_set_used_size(buf, 0);
+		test_assert_idx(!uni_utf8_get_valid_data(input, sizeof(input),
+							 buf), i);
+		test_assert_idx(buf->used == sizeof(input) - 1 +
+				UTF8_REPLACEMENT_CHAR_LEN, i);
+		test_assert_idx(memcmp(CONST_PTR_OFFSET(buf->data, i),
+				       utf8_replacement_char,
+				       UTF8_REPLACEMENT_CHAR_LEN) == 0, i);
+	}
+	test_end();
+}
+
 static void test_unichar_valid_unicode(void)
 {
 	struct {
@@ -180,6 +214,7 @@ void test_unichar(void)
 
 	test_unichar_uni_utf8_strlen();
 	test_unichar_uni_utf8_partial_strlen_n();
+	test_unichar_ascii_runs();
 	test_unichar_valid_unicode();
 	test_unichar_surrogates();
 }
@@ -475,6 +475,66 @@ static void test_var_expand_merge_tables(void)
 	test_end();
 }
 
+static void test_var_expand_program(void)
+{
+	static const struct var_expand_test tests[] = {
+		{ "", "", 1 },
+		{ "plain text", "plain text", 1 },
+		{ "a%vb%%c", "avalue1234b%c", 1 },
+		{ "%3.2v/%Uv", "ue/VALUE1234", 1 },
+		{ "%05{num}-%{alpha}", "00042-beta", 1 },
+		{ "%{alpha", "UNSUPPORTED_VARIABLE_{alpha", 0 },
+		{ "x%", "x", 1 },
+		{ "x%L", "x", 1 },
+		{ "%y%{unknown}", "UNSUPPORTED_VARIABLE_yUNSUPPORTED_VARIABLE_unknown", 0 },
+		{ "%{if;%v;eq;value1234;yes;no}", "yes", 1 },
+	};
+	static const struct var_expand_table table[] = {
+		{ 'v', "value1234", NULL },
+		{ '\0', "42", "num" },
+		{ '\0', "beta", "alpha" },
+		{ '\0', NULL, NULL }
+	};
+	struct var_expand_program *program;
+	string_t *str = t_str_new(128), *str2 = t_str_new(128);
+	const char *error, *error2;
+	unsigned int i;
+	int ret;
+
+	test_begin("var_expand_program");
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		program = var_expand_program_create(tests[i].in);
+		test_assert_strcmp_idx(var_expand_program_get_str(program),
+				       tests[i].in, i);
+		str_truncate(str, 0);
+		ret = var_expand_program_execute(str, program, table, NULL,
+						 NULL, &error);
+		test_assert_idx(ret == tests[i].ret, i);
+		test_assert_strcmp_idx(str_c(str), tests[i].out, i);
+
+		/* executing again gives the same result */
+		str_truncate(str, 0);
+		test_assert_idx(var_expand_program_execute(str, program, table,
+			NULL, NULL, &error) == tests[i].ret, i);
+		test_assert_strcmp_idx(str_c(str), tests[i].out, i);
+		var_expand_program_free(&program);
+		test_assert_idx(program == NULL, i);
+
+		/* the cached path in var_expand() gives the same result,
+		   both on the first and the second call */
+		str_truncate(str2, 0);
+		test_assert_idx(var_expand(str2, tests[i].in, table,
+					   &error2) == tests[i].ret, i);
+		test_assert_strcmp_idx(str_c(str2), tests[i].out, i);
+		str_truncate(str2, 0);
+		test_assert_idx(var_expand(str2, tests[i].in, table,
+					   &error2) == tests[i].ret, i);
+		test_assert_strcmp_idx(str_c(str2), tests[i].out, i);
+		test_assert_idx((error == NULL) == (error2 == NULL), i);
+	}
+	test_end();
+}
+
 void test_var_expand(void)
 {
 	test_var_expand_ranges();
@@ -486,4 +546,5 @@ void test_var_expand(void)
 	test_var_expand_extensions();
 	test_var_expand_if();
 	test_var_expand_merge_tables();
+	test_var_expand_program();
 }
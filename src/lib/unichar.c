@@ -202,14 +202,36 @@ unsigned int uni_utf8_strlen_n(const void *input, size_t size)
 	return uni_utf8_partial_strlen_n(input, size, &partial_pos);
 }
 
+/* Returns the number of 7bit ASCII bytes at the beginning of input. Most of
+   the text is usually ASCII, so this checks a whole word at a time. */
+static size_t uni_ascii_prefix_len(const unsigned char *input, size_t size)
+{
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= size; i += sizeof(word)) {
+		memcpy(&word, input + i, sizeof(word));
+		if ((word & 0x8080808080808080ULL) != 0)
+			break;
+	}
+	for (; i < size && input[i] < 0x80; i++) ;
+	return i;
+}
+
 unsigned int uni_utf8_partial_strlen_n(const void *_input, size_t size,
 				       size_t *partial_pos_r)
 {
 	const unsigned char *input = _input;
 	unsigned int count, len = 0;
-	size_t i;
+	size_t i, ascii_len;
 
 	for (i = 0; i < size; ) {
+		if (input[i] < 0x80) {
+			ascii_len = uni_ascii_prefix_len(input + i, size - i);
+			i += ascii_len;
+			len += ascii_len;
+			continue;
+		}
 		count = uni_utf8_char_bytes(input[i]);
 		if (i + count > size)
 			break;
@@ -372,7 +394,7 @@ static int uni_utf8_find_invalid_pos(const unsigned char *input, size_t size,
 	/* find the first invalid utf8 sequence */
 	for (i = 0; i < size;) {
 		if (input[i] < 0x80)
-			i++;
+			i += uni_ascii_prefix_len(input + i, size - i);
 		else {
 			len = is_valid_utf8_seq(input + i, size-i);
 			if (unlikely(len == 0)) {
@@ -399,7 +421,9 @@ bool uni_utf8_get_valid_data(const unsigned char *input, size_t size,
 	output_add_replacement_char(buf);
 	while (i < size) {
 		if (input[i] < 0x80) {
-			buffer_append_c(buf, input[i++]);
+			len = uni_ascii_prefix_len(input + i, size - i);
+			buffer_append(buf, input + i, len);
+			i += len;
 			continue;
 		}
 
@@ -21,6 +21,11 @@
 #define TABLE_LAST(t) \
 	((t)->key == '\0' && (t)->long_key == NULL)
 
+/* Maximum number of compiled templates kept in the cache. Templates normally
+   come from settings, so this is only a safety limit against callers
+   expanding dynamically generated strings. */
+#define VAR_EXPAND_PROGRAM_CACHE_MAX_COUNT 256
+
 struct var_expand_modifier {
 	char key;
 	const char *(*func)(const char *, struct var_expand_context *);
@@ -167,6 +172,49 @@ static const struct var_expand_modifier modifiers[] = {
 	{ '\0', NULL }
 };
 
+enum var_expand_program_elem_type {
+	VAR_EXPAND_PROGRAM_ELEM_LITERAL,
+	VAR_EXPAND_PROGRAM_ELEM_SHORT_KEY,
+	VAR_EXPAND_PROGRAM_ELEM_LONG_KEY,
+};
+
+struct var_expand_program_elem {
+	enum var_expand_program_elem_type type;
+	/* literal text or the contents of %{long_key} */
+	const char *str;
+	size_t len;
+	char key;
+
+	int offset, width;
+	bool zero_padding;
+	unsigned int modifier_count;
+	const char *(*modifiers[MAX_MODIFIER_COUNT])
+		(const char *, struct var_expand_context *);
+};
+
+struct var_expand_program {
+	pool_t pool;
+	const char *str;
+	ARRAY(struct var_expand_program_elem) elems;
+};
+
+static HASH_TABLE(const char *, struct var_expand_program *)
+	var_expand_program_cache;
+
+static void
+var_expand_program_add_literal(struct var_expand_program *program,
+			       const char *str, size_t len)
+{
+	struct var_expand_program_elem *elem;
+
+	if (len == 0)
+		return;
+	elem = array_append_space(&program->elems);
+	elem->type = VAR_EXPAND_PROGRAM_ELEM_LITERAL;
+	elem->str = str;
+	elem->len = len;
+}
+
 static int
 var_expand_short(const struct var_expand_context *ctx, char key,
 		 const char **var_r, const char **error_r)
@@ -487,178 +535,286 @@ var_expand_long(struct var_expand_context *ctx,
 	return ret;
 }
 
-int var_expand_with_funcs(string_t *dest, const char *str,
-			  const struct var_expand_table *table,
-			  const struct var_expand_func_table *func_table,
-			  void *context, const char **error_r)
+static struct var_expand_program *
+var_expand_program_compile(pool_t pool, const char *str)
 {
+	struct var_expand_program *program;
+	struct var_expand_program_elem elem;
 	const struct var_expand_modifier *m;
-	const char *var;
-	struct var_expand_context ctx;
-	const char *(*modifier[MAX_MODIFIER_COUNT])
-		(const char *, struct var_expand_context *);
-	const char *end;
-	unsigned int i, modifier_count;
-	size_t len;
-	int ret, final_ret = 1;
+	const char *literal_start, *end;
 
-	*error_r = NULL;
-
-	i_zero(&ctx);
-	ctx.table = table;
-	ctx.func_table = func_table;
-	ctx.context = context;
+	program = p_new(pool, struct var_expand_program, 1);
+	program->pool = pool;
+	program->str = p_strdup(pool, str);
+	p_array_init(&program->elems, pool, 8);
 
+	str = literal_start = program->str;
 	for (; *str != '\0'; str++) {
 		if (*str != '%')
-			str_append_c(dest, *str);
-		else {
-			int sign = 1;
+			continue;
+		var_expand_program_add_literal(program, literal_start,
+					       str - literal_start);
+
+		int sign = 1;
+
+		i_zero(&elem);
+		str++;
 
+		/* [<offset>.]<width>[<modifiers>]<variable> */
+		if (*str == '-') {
+			sign = -1;
 			str++;
+		}
+		if (*str == '0') {
+			elem.zero_padding = TRUE;
+			str++;
+		}
+		while (*str >= '0' && *str <= '9') {
+			elem.width = elem.width*10 + (*str - '0');
+			str++;
+		}
 
-			/* reset per-field modifiers */
-			ctx.offset = 0;
-			ctx.width = 0;
-			ctx.zero_padding = FALSE;
+		if (*str == '.') {
+			elem.offset = sign * elem.width;
+			sign = 1;
+			elem.width = 0;
+			str++;
 
-			/* [<offset>.]<width>[<modifiers>]<variable> */
-			if (*str == '-') {
-				sign = -1;
-				str++;
-			}
+			/* if offset was prefixed with zero (or it was
+			   plain zero), just ignore that. zero padding
+			   is done with the width. */
+			elem.zero_padding = FALSE;
 			if (*str == '0') {
-				ctx.zero_padding = TRUE;
+				elem.zero_padding = TRUE;
 				str++;
 			}
-			while (*str >= '0' && *str <= '9') {
-				ctx.width = ctx.width*10 + (*str - '0');
+			if (*str == '-') {
+				sign = -1;
 				str++;
 			}
 
-			if (*str == '.') {
-				ctx.offset = sign * ctx.width;
-				sign = 1;
-				ctx.width = 0;
+			while (*str >= '0' && *str <= '9') {
+				elem.width = elem.width*10 + (*str - '0');
 				str++;
-
-				/* if offset was prefixed with zero (or it was
-				   plain zero), just ignore that. zero padding
-				   is done with the width. */
-				ctx.zero_padding = FALSE;
-				if (*str == '0') {
-					ctx.zero_padding = TRUE;
-					str++;
-				}
-				if (*str == '-') {
-					sign = -1;
-					str++;
-				}
-
-				while (*str >= '0' && *str <= '9') {
-					ctx.width = ctx.width*10 + (*str - '0');
-					str++;
-				}
-				ctx.width = sign * ctx.width;
 			}
+			elem.width = sign * elem.width;
+		}
 
-			modifier_count = 0;
-			while (modifier_count < MAX_MODIFIER_COUNT) {
-				modifier[modifier_count] = NULL;
-				for (m = modifiers; m->key != '\0'; m++) {
-					if (m->key == *str) {
-						/* @UNSAFE */
-						modifier[modifier_count] =
-							m->func;
-						str++;
-						break;
-					}
-				}
-				if (modifier[modifier_count] == NULL)
+		while (elem.modifier_count < MAX_MODIFIER_COUNT) {
+			for (m = modifiers; m->key != '\0'; m++) {
+				if (m->key == *str)
 					break;
-				modifier_count++;
 			}
-
-			if (*str == '\0')
+			if (m->key == '\0')
 				break;
+			elem.modifiers[elem.modifier_count++] = m->func;
+			str++;
+		}
 
-			var = NULL;
-			if (*str == '{' && strchr(str, '}') != NULL) {
-				/* %{long_key} */
-				unsigned int ctr = 1;
-				bool escape = FALSE;
-				end = str;
-				while(*++end != '\0' && ctr > 0) {
-					if (!escape && *end == '\\') {
-						escape = TRUE;
-						continue;
-					}
-					if (escape) {
-						escape = FALSE;
-						continue;
-					}
-					if (*end == '{') ctr++;
-					if (*end == '}') ctr--;
-				}
-				if (ctr == 0)
-					/* it needs to come back a bit */
-					end--;
-				/* if there is no } it will consume rest of the
-				   string */
-				len = end - (str + 1);
-				ret = var_expand_long(&ctx, str+1, len,
-						      &var, error_r);
-				str = end;
-			} else {
-				ret = var_expand_short(&ctx, *str,
-						       &var, error_r);
-			}
-			i_assert(var != NULL);
-
-			if (final_ret > ret)
-				final_ret = ret;
-
-			if (ret <= 0)
-				str_append(dest, var);
-			else {
-				for (i = 0; i < modifier_count; i++)
-					var = modifier[i](var, &ctx);
-
-				if (ctx.offset < 0) {
-					/* if offset is < 0 then we want to
-					   start at the end */
-					size_t len = strlen(var);
-					size_t offset_from_end = -ctx.offset;
-
-					if (len > offset_from_end)
-						var += len - offset_from_end;
-				} else {
-					while (*var != '\0' && ctx.offset > 0) {
-						ctx.offset--;
-						var++;
-					}
+		if (*str == '\0') {
+			literal_start = str;
+			break;
+		}
+
+		if (*str == '{' && strchr(str, '}') != NULL) {
+			/* %{long_key} */
+			unsigned int ctr = 1;
+			bool escape = FALSE;
+			end = str;
+			while(*++end != '\0' && ctr > 0) {
+				if (!escape && *end == '\\') {
+					escape = TRUE;
+					continue;
 				}
-				if (ctx.width == 0)
-					str_append(dest, var);
-				else if (!ctx.zero_padding) {
-					if (ctx.width < 0)
-						ctx.width = strlen(var) - (-ctx.width);
-					str_append_max(dest, var, ctx.width);
-				} else {
-					/* %05d -like padding. no truncation. */
-					ssize_t len = strlen(var);
-					while (len < ctx.width) {
-						str_append_c(dest, '0');
-						ctx.width--;
-					}
-					str_append(dest, var);
+				if (escape) {
+					escape = FALSE;
+					continue;
 				}
+				if (*end == '{') ctr++;
+				if (*end == '}') ctr--;
+			}
+			if (ctr == 0)
+				/* it needs to come back a bit */
+				end--;
+			/* if there is no } it will consume rest of the
+			   string */
+			elem.type = VAR_EXPAND_PROGRAM_ELEM_LONG_KEY;
+			elem.str = str + 1;
+			elem.len = end - (str + 1);
+			array_push_back(&program->elems, &elem);
+			if (*end == '\0') {
+				literal_start = str = end;
+				break;
 			}
+			str = end;
+		} else {
+			elem.type = VAR_EXPAND_PROGRAM_ELEM_SHORT_KEY;
+			elem.key = *str;
+			array_push_back(&program->elems, &elem);
 		}
+		literal_start = str + 1;
+	}
+	var_expand_program_add_literal(program, literal_start,
+				       str - literal_start);
+	return program;
+}
+
+struct var_expand_program *var_expand_program_create(const char *str)
+{
+	pool_t pool = pool_alloconly_create("var_expand program", 256);
+
+	return var_expand_program_compile(pool, str);
+}
+
+void var_expand_program_free(struct var_expand_program **_program)
+{
+	struct var_expand_program *program = *_program;
+
+	if (program == NULL)
+		return;
+	*_program = NULL;
+	pool_unref(&program->pool);
+}
+
+const char *var_expand_program_get_str(const struct var_expand_program *program)
+{
+	return program->str;
+}
+
+static void
+var_expand_program_elem_append(string_t *dest,
+			       const struct var_expand_program_elem *elem,
+			       struct var_expand_context *ctx,
+			       const char *var)
+{
+	unsigned int i;
+
+	for (i = 0; i < elem->modifier_count; i++)
+		var = elem->modifiers[i](var, ctx);
+
+	if (ctx->offset < 0) {
+		/* if offset is < 0 then we want to start at the end */
+		size_t len = strlen(var);
+		size_t offset_from_end = -ctx->offset;
+
+		if (len > offset_from_end)
+			var += len - offset_from_end;
+	} else {
+		while (*var != '\0' && ctx->offset > 0) {
+			ctx->offset--;
+			var++;
+		}
+	}
+	if (ctx->width == 0)
+		str_append(dest, var);
+	else if (!ctx->zero_padding) {
+		if (ctx->width < 0)
+			ctx->width = strlen(var) - (-ctx->width);
+		str_append_max(dest, var, ctx->width);
+	} else {
+		/* %05d -like padding. no truncation. */
+		ssize_t len = strlen(var);
+		while (len < ctx->width) {
+			str_append_c(dest, '0');
+			ctx->width--;
+		}
+		str_append(dest, var);
+	}
+}
+
+int var_expand_program_execute(string_t *dest,
+			       const struct var_expand_program *program,
+			       const struct var_expand_table *table,
+			       const struct var_expand_func_table *func_table,
+			       void *context, const char **error_r)
+{
+	const struct var_expand_program_elem *elem;
+	struct var_expand_context ctx;
+	const char *var;
+	int ret, final_ret = 1;
+
+	*error_r = NULL;
+
+	i_zero(&ctx);
+	ctx.table = table;
+	ctx.func_table = func_table;
+	ctx.context = context;
+
+	array_foreach(&program->elems, elem) {
+		if (elem->type == VAR_EXPAND_PROGRAM_ELEM_LITERAL) {
+			str_append_data(dest, elem->str, elem->len);
+			continue;
+		}
+
+		/* reset per-field modifiers */
+		ctx.offset = elem->offset;
+		ctx.width = elem->width;
+		ctx.zero_padding = elem->zero_padding;
+
+		var = NULL;
+		if (elem->type == VAR_EXPAND_PROGRAM_ELEM_LONG_KEY) {
+			ret = var_expand_long(&ctx, elem->str, elem->len,
+					      &var, error_r);
+		} else {
+			ret = var_expand_short(&ctx, elem->key,
+					       &var, error_r);
+		}
+		i_assert(var != NULL);
+
+		if (final_ret > ret)
+			final_ret = ret;
+
+		if (ret <= 0)
+			str_append(dest, var);
+		else
+			var_expand_program_elem_append(dest, elem, &ctx, var);
 	}
 	return final_ret;
 }
 
+static const struct var_expand_program *
+var_expand_program_cache_get(const char *str)
+{
+	struct var_expand_program *program;
+
+	if (!hash_table_is_created(var_expand_program_cache)) {
+		hash_table_create(&var_expand_program_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	program = hash_table_lookup(var_expand_program_cache, str);
+	if (program != NULL)
+		return program;
+
+	if (hash_table_count(var_expand_program_cache) >=
+	    VAR_EXPAND_PROGRAM_CACHE_MAX_COUNT) {
+		/* Cache is full. Nothing is evicted from it, because the
+		   cached programs may still be executing in a caller's
+		   var_expand() (e.g. %{if} and hash salts recurse). */
+		return var_expand_program_compile(pool_datastack_create(), str);
+	}
+	program = var_expand_program_create(str);
+	hash_table_insert(var_expand_program_cache, program->str, program);
+	return program;
+}
+
+int var_expand_with_funcs(string_t *dest, const char *str,
+			  const struct var_expand_table *table,
+			  const struct var_expand_func_table *func_table,
+			  void *context, const char **error_r)
+{
+	const struct var_expand_program *program;
+
+	if (strchr(str, '%') == NULL) {
+		/* nothing to expand - don't waste a cache slot on it */
+		*error_r = NULL;
+		str_append(dest, str);
+		return 1;
+	}
+	program = var_expand_program_cache_get(str);
+	return var_expand_program_execute(dest, program, table, func_table,
+					  context, error_r);
+}
+
 int var_expand(string_t *dest, const char *str,
 	       const struct var_expand_table *table, const char **error_r)
 {
@@ -778,7 +934,20 @@ bool var_has_key(const char *str, char key, const char *long_key)
 
 void var_expand_extensions_deinit(void)
 {
+	struct hash_iterate_context *iter;
+	const char *key;
+	struct var_expand_program *program;
+
 	array_free(&var_expand_extensions);
+
+	if (!hash_table_is_created(var_expand_program_cache))
+		return;
+	iter = hash_table_iterate_init(var_expand_program_cache);
+	while (hash_table_iterate(iter, var_expand_program_cache,
+				  &key, &program))
+		var_expand_program_free(&program);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&var_expand_program_cache);
 }
 
 void var_expand_extensions_init(void)
@@ -30,6 +30,22 @@ int var_expand_with_funcs(string_t *dest, const char *str,
 			  const struct var_expand_func_table *func_table,
 			  void *func_context, const char **error_r) ATTR_NULL(3, 4, 5);
 
+/* Parse the format string once, so it can be expanded multiple times without
+   re-parsing it. var_expand_with_funcs() uses an internal cache of these, so
+   this is mainly useful for callers that want to manage the lifetime
+   themselves. */
+struct var_expand_program *var_expand_program_create(const char *str);
+void var_expand_program_free(struct var_expand_program **program);
+/* Returns the format string that the program was created from. */
+const char *var_expand_program_get_str(const struct var_expand_program *program);
+/* Same as var_expand_with_funcs(), but using a pre-parsed program. */
+int var_expand_program_execute(string_t *dest,
+			       const struct var_expand_program *program,
+			       const struct var_expand_table *table,
+			       const struct var_expand_func_table *func_table,
+			       void *func_context, const char **error_r)
+	ATTR_NULL(3, 4, 5);
+
 /* Returns the actual key character for given string, ie. skip any modifiers
    that are before it. The string should be the data after the '%' character.
    For %{long_variable}, '{' is returned. */
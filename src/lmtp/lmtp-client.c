@@ -266,6 +266,7 @@ client_default_destroy(struct client *client)
 		mail_user_deinit(&client->raw_mail_user);
 
 	client_state_reset(client);
+	lmtp_proxy_pool_deinit(&client->proxy_pool);
 	event_unref(&client->event);
 	pool_unref(&client->state_pool);
 	pool_unref(&client->pool);
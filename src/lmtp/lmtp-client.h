@@ -90,6 +90,7 @@ struct client {
 	struct istream *dot_input;
 	struct lmtp_local *local;
 	struct lmtp_proxy *proxy;
+	struct lmtp_proxy_pool *proxy_pool;
 
 	/* Module-specific contexts. */
 	ARRAY(union lmtp_module_context *) module_contexts;
@@ -1,11 +1,13 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for syncfs() */
 #include "lmtp-common.h"
 #include "smtp-server.h"
 #include "str.h"
 #include "istream.h"
 #include "strescape.h"
 #include "time-util.h"
+#include "write-full.h"
 #include "hostpid.h"
 #include "var-expand.h"
 #include "restrict-access.h"
@@ -26,6 +28,11 @@
 #include "lmtp-recipient.h"
 #include "lmtp-local.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
 struct lmtp_local_recipient {
 	struct lmtp_recipient *rcpt;
 
@@ -38,6 +45,22 @@ struct lmtp_local_recipient {
 	bool anvil_connect_sent:1;
 };
 
+struct lmtp_local_fsync_fs {
+	dev_t dev;
+	int fd;
+};
+
+/* A group of recipients delivered to by a separate process with
+   lmtp_parallel_delivery_limit */
+struct lmtp_local_worker {
+	struct lmtp_local_recipient *const *llrcpts;
+	unsigned int count;
+
+	pid_t pid;
+	/* the process writes its recipients' replies to this pipe */
+	int fd;
+};
+
 struct lmtp_local {
 	struct client *client;
 
@@ -46,6 +69,11 @@ struct lmtp_local {
 	struct mail *raw_mail, *first_saved_mail;
 	struct mail_user *rcpt_user;
 
+	/* lmtp_fsync_batch: file systems that need to be synced before
+	   replying to DATA */
+	ARRAY(struct lmtp_local_fsync_fs) fsync_fs;
+	bool fsync_batch_failed:1;
+
 	struct smtp_server_stats stats;
 };
 
@@ -75,6 +103,13 @@ void lmtp_local_deinit(struct lmtp_local **_local)
 
 	if (array_is_created(&local->rcpt_to))
 		array_free(&local->rcpt_to);
+	if (array_is_created(&local->fsync_fs)) {
+		struct lmtp_local_fsync_fs *fs;
+
+		array_foreach_modifiable(&local->fsync_fs, fs)
+			i_close_fd(&fs->fd);
+		array_free(&local->fsync_fs);
+	}
 
 	if (local->raw_mail != NULL) {
 		struct mailbox_transaction_context *raw_trans =
@@ -370,6 +405,91 @@ int lmtp_local_rcpt(struct client *client,
 	return 1;
 }
 
+/*
+ * Batched fsyncing
+ */
+
+static bool
+lmtp_local_fsync_batch_want(struct lmtp_local *local,
+			    const struct mail_storage_settings *mail_set)
+{
+#ifndef HAVE_SYNCFS
+	return FALSE;
+#endif
+	return local->client->lmtp_set->lmtp_fsync_batch &&
+		array_count(&local->rcpt_to) > 1 &&
+		mail_set->parsed_fsync_mode != FSYNC_MODE_NEVER;
+}
+
+static void
+lmtp_local_fsync_batch_add(struct lmtp_local *local, struct mail_user *user)
+{
+	struct lmtp_local_fsync_fs *fs;
+	struct mail_namespace *ns;
+	struct stat st;
+	const char *path;
+	int fd;
+
+	/* Open the INBOX namespace root while still running as the user.
+	   The fd is used only for syncfs()ing its file system. */
+	ns = mail_namespace_find_inbox(user->namespaces);
+	path = mailbox_list_get_root_forced(ns->list,
+					    MAILBOX_LIST_PATH_TYPE_MAILBOX);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		e_error(user->event, "open(%s) failed: %m", path);
+		local->fsync_batch_failed = TRUE;
+		return;
+	}
+	if (fstat(fd, &st) < 0) {
+		e_error(user->event, "fstat(%s) failed: %m", path);
+		local->fsync_batch_failed = TRUE;
+		i_close_fd(&fd);
+		return;
+	}
+
+	if (!array_is_created(&local->fsync_fs))
+		i_array_init(&local->fsync_fs, 4);
+	array_foreach_modifiable(&local->fsync_fs, fs) {
+		if (fs->dev == st.st_dev) {
+			i_close_fd(&fd);
+			return;
+		}
+	}
+	fs = array_append_space(&local->fsync_fs);
+	fs->dev = st.st_dev;
+	fs->fd = fd;
+}
+
+static void lmtp_local_fsync_batch_finish(struct lmtp_local *local)
+{
+#ifdef HAVE_SYNCFS
+	struct lmtp_local_fsync_fs *fs;
+#endif
+
+	if (local->fsync_batch_failed) {
+		/* we don't know which file system to sync */
+		sync();
+		local->fsync_batch_failed = FALSE;
+	}
+	if (!array_is_created(&local->fsync_fs))
+		return;
+
+#ifdef HAVE_SYNCFS
+	array_foreach_modifiable(&local->fsync_fs, fs) {
+		if (syncfs(fs->fd) < 0) {
+			e_error(local->client->event,
+				"syncfs() failed: %m - "
+				"delivered mails may not be durable");
+		}
+		i_close_fd(&fs->fd);
+	}
+#else
+	i_unreached();
+#endif
+	array_clear(&local->fsync_fs);
+}
+
 /*
  * DATA command
  */
@@ -428,6 +548,7 @@ lmtp_local_deliver(struct lmtp_local *local,
 	struct mail_namespace *ns;
 	struct setting_parser_context *set_parser;
 	const char *line, *error, *username;
+	bool fsync_batch;
 	int ret;
 
 	input = mail_storage_service_user_get_input(service_user);
@@ -451,6 +572,13 @@ lmtp_local_deliver(struct lmtp_local *local,
 		if (settings_parse_line(set_parser, line) < 0)
 			i_unreached();
 	}
+	fsync_batch = lmtp_local_fsync_batch_want(local, mail_set);
+	if (fsync_batch) {
+		/* the file systems are synced after all the recipients have
+		   been delivered to */
+		if (settings_parse_line(set_parser, "mail_fsync=never") < 0)
+			i_unreached();
+	}
 
 	i_zero(&lldctx);
 	lldctx.session_id = lrcpt->session_id;
@@ -492,6 +620,8 @@ lmtp_local_deliver(struct lmtp_local *local,
 	}
 
 	ret = client->v.local_deliver(client, lrcpt, cmd, trans, &lldctx);
+	if (ret == 0 && fsync_batch)
+		lmtp_local_fsync_batch_add(local, rcpt_user);
 
 	lmtp_local_rcpt_anvil_disconnect(llrcpt);
 	return ret;
@@ -617,17 +747,17 @@ static uid_t
 lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 			    struct smtp_server_cmd_ctx *cmd,
 			    struct smtp_server_transaction *trans,
-			    struct mail_deliver_session *session)
+			    struct mail_deliver_session *session,
+			    struct lmtp_local_recipient *const *llrcpts,
+			    unsigned int count)
 {
 	struct client *client = local->client;
 	uid_t first_uid = (uid_t)-1;
 	struct mail *src_mail;
-	struct lmtp_local_recipient *const *llrcpts;
-	unsigned int count, i;
+	unsigned int i;
 	int ret;
 
 	src_mail = local->raw_mail;
-	llrcpts = array_get(&local->rcpt_to, &count);
 	for (i = 0; i < count; i++) {
 		struct lmtp_local_recipient *llrcpt = llrcpts[i];
 		struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
@@ -709,22 +839,23 @@ lmtp_local_open_raw_mail(struct lmtp_local *local,
 	return 0;
 }
 
-void lmtp_local_data(struct client *client,
-		     struct smtp_server_cmd_ctx *cmd,
-		     struct smtp_server_transaction *trans,
-		     struct istream *input)
+static void
+lmtp_local_deliver_group(struct lmtp_local *local,
+			 struct smtp_server_cmd_ctx *cmd,
+			 struct smtp_server_transaction *trans,
+			 struct lmtp_local_recipient *const *llrcpts,
+			 unsigned int count)
 {
-	struct lmtp_local *local = client->local;
 	struct mail_deliver_session *session;
 	uid_t old_uid, first_uid;
 
-	if (lmtp_local_open_raw_mail(local, trans, input) < 0)
-		return;
-
 	session = mail_deliver_session_init();
 	old_uid = geteuid();
-	first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans, session);
+	first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans, session,
+						llrcpts, count);
 	mail_deliver_session_deinit(&session);
+	/* the replies are sent only after returning to ioloop */
+	lmtp_local_fsync_batch_finish(local);
 
 	if (local->first_saved_mail != NULL) {
 		struct mail *mail = local->first_saved_mail;
@@ -741,6 +872,7 @@ void lmtp_local_data(struct client *client,
 				i_fatal("seteuid() failed: %m");
 		}
 
+		local->first_saved_mail = NULL;
 		mail_storage_service_io_activate_user(user->service_user);
 		mail_free(&mail);
 		mailbox_transaction_rollback(&trans);
@@ -749,6 +881,273 @@ void lmtp_local_data(struct client *client,
 		mail_storage_service_io_deactivate_user(user->service_user);
 		mail_user_deinit(&user);
 	}
+}
+
+/*
+ * Parallel delivery
+ */
+
+static struct smtp_server_recipient *
+lmtp_local_worker_find_rcpt(const struct lmtp_local_worker *worker,
+			    unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < worker->count; i++) {
+		struct smtp_server_recipient *rcpt =
+			worker->llrcpts[i]->rcpt->rcpt;
+
+		if (rcpt->index == index)
+			return rcpt;
+	}
+	return NULL;
+}
+
+static void ATTR_NORETURN
+lmtp_local_worker_run(struct lmtp_local *local,
+		      struct smtp_server_cmd_ctx *cmd,
+		      struct smtp_server_transaction *trans,
+		      const struct lmtp_local_worker *worker, int fd)
+{
+	struct lmtp_local_recipient *llrcpt;
+	struct smtp_server_recipient *rcpt;
+	struct smtp_server_reply *reply;
+	const char *enh_code;
+	unsigned int i, status;
+	int exit_status = 0;
+
+	master_service_init_forked_child(master_service);
+	/* the parent process disconnects all the recipients from anvil */
+	array_foreach_elem(&local->rcpt_to, llrcpt)
+		llrcpt->anvil_connect_sent = FALSE;
+
+	lmtp_local_deliver_group(local, cmd, trans,
+				 worker->llrcpts, worker->count);
+
+	/* Send the replies to the parent process:
+	   <rcpt index> <status> <enhanced code> <message> */
+	string_t *str = t_str_new(256);
+	for (i = 0; i < worker->count; i++) {
+		rcpt = worker->llrcpts[i]->rcpt->rcpt;
+		reply = smtp_server_recipient_get_reply(rcpt);
+		if (reply == NULL)
+			continue;
+		status = smtp_server_reply_get_status(reply, &enh_code);
+		str_printfa(str, "%u\t%u\t", rcpt->index, status);
+		if (enh_code != NULL)
+			str_append_tabescaped(str, enh_code);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, smtp_server_reply_get_message(reply));
+		str_append_c(str, '\n');
+	}
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		e_error(local->client->event,
+			"write(lmtp delivery process pipe) failed: %m");
+		exit_status = FATAL_DEFAULT;
+	}
+	master_service_deinit_forked_child(master_service);
+	_exit(exit_status);
+}
+
+static void
+lmtp_local_worker_start(struct lmtp_local *local,
+			struct smtp_server_cmd_ctx *cmd,
+			struct smtp_server_transaction *trans,
+			struct lmtp_local_worker *workers, unsigned int idx)
+{
+	struct lmtp_local_worker *worker = &workers[idx];
+	unsigned int i;
+	int fd[2];
+	pid_t pid;
+
+	if (pipe(fd) < 0) {
+		e_error(local->client->event, "pipe() failed: %m");
+		return;
+	}
+	/* don't leak the pipe to e.g. sendmail processes */
+	fd_close_on_exec(fd[0], TRUE);
+	fd_close_on_exec(fd[1], TRUE);
+
+	pid = fork();
+	if (pid < 0) {
+		e_error(local->client->event, "fork() failed: %m");
+		i_close_fd(&fd[0]);
+		i_close_fd(&fd[1]);
+		return;
+	}
+	if (pid == 0) {
+		/* child */
+		for (i = 0; i < idx; i++) {
+			if (workers[i].fd != -1)
+				i_close_fd(&workers[i].fd);
+		}
+		i_close_fd(&fd[0]);
+		lmtp_local_worker_run(local, cmd, trans, worker, fd[1]);
+	}
+	i_close_fd(&fd[1]);
+	worker->pid = pid;
+	worker->fd = fd[0];
+}
+
+static void
+lmtp_local_worker_read_replies(struct lmtp_local *local,
+			       struct smtp_server_cmd_ctx *cmd,
+			       struct lmtp_local_worker *worker)
+{
+	struct smtp_server_recipient *rcpt;
+	struct istream *input;
+	const char *line, *const *args;
+	unsigned int index, status;
+
+	/* the fd is blocking, so this reads until the process exits */
+	input = i_stream_create_fd_autoclose(&worker->fd, SIZE_MAX);
+	i_stream_set_name(input, "lmtp delivery process");
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		args = t_strsplit_tabescaped(line);
+		if (str_array_length(args) != 4 ||
+		    str_to_uint(args[0], &index) < 0 ||
+		    str_to_uint(args[1], &status) < 0 ||
+		    status < 200 || status >= 560 ||
+		    (rcpt = lmtp_local_worker_find_rcpt(worker, index)) == NULL ||
+		    smtp_server_recipient_get_reply(rcpt) != NULL) {
+			e_error(local->client->event,
+				"lmtp delivery process %ld sent invalid reply: %s",
+				(long)worker->pid, line);
+			continue;
+		}
+		smtp_server_reply_index(cmd, index, status,
+					args[2][0] == '\0' ? NULL : args[2],
+					"%s", args[3]);
+	}
+	if (input->stream_errno != 0) {
+		e_error(local->client->event, "read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+	}
+	i_stream_destroy(&input);
+}
+
+static void
+lmtp_local_worker_finish(struct lmtp_local *local,
+			 struct smtp_server_cmd_ctx *cmd,
+			 struct lmtp_local_worker *worker)
+{
+	struct smtp_server_recipient *rcpt;
+	unsigned int i;
+	int status;
+
+	lmtp_local_worker_read_replies(local, cmd, worker);
+
+	while (waitpid(worker->pid, &status, 0) < 0) {
+		if (errno == ECHILD) {
+			/* already reaped by someone else */
+			status = 0;
+			break;
+		}
+		if (errno != EINTR) {
+			e_error(local->client->event,
+				"waitpid(%ld) failed: %m", (long)worker->pid);
+			status = 0;
+			break;
+		}
+	}
+	if (WIFSIGNALED(status)) {
+		e_error(local->client->event,
+			"lmtp delivery process %ld killed by signal %d",
+			(long)worker->pid, WTERMSIG(status));
+	} else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		e_error(local->client->event,
+			"lmtp delivery process %ld exited with status %d",
+			(long)worker->pid, WEXITSTATUS(status));
+	}
+
+	/* The mail may or may not have been delivered to the recipients that
+	   didn't get a reply. A temporary failure could cause a duplicate
+	   delivery, but that's better than losing the mail. */
+	for (i = 0; i < worker->count; i++) {
+		rcpt = worker->llrcpts[i]->rcpt->rcpt;
+		if (smtp_server_recipient_get_reply(rcpt) == NULL) {
+			smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+				"Temporary internal error");
+		}
+	}
+}
+
+static void
+lmtp_local_deliver_parallel(struct lmtp_local *local,
+			    struct smtp_server_cmd_ctx *cmd,
+			    struct smtp_server_transaction *trans,
+			    unsigned int limit)
+{
+	ARRAY(struct lmtp_local_recipient *) rcpts;
+	struct lmtp_local_recipient *llrcpt, *const *llrcpts;
+	struct lmtp_local_worker *workers;
+	unsigned int i, count, first, worker_count;
+
+	t_array_init(&rcpts, array_count(&local->rcpt_to));
+	array_foreach_elem(&local->rcpt_to, llrcpt) {
+		if (llrcpt->duplicate == NULL)
+			array_push_back(&rcpts, &llrcpt);
+	}
+	llrcpts = array_get(&rcpts, &count);
+
+	/* Split the recipients into groups in their original order, so
+	   recipients in the same group can still share the first saved mail
+	   (e.g. hard links). */
+	worker_count = I_MIN(limit, count);
+	workers = t_new(struct lmtp_local_worker, worker_count);
+	for (i = 0; i < worker_count; i++) {
+		first = i * count / worker_count;
+		workers[i].llrcpts = llrcpts + first;
+		workers[i].count = (i + 1) * count / worker_count - first;
+		workers[i].pid = (pid_t)-1;
+		workers[i].fd = -1;
+	}
+
+	/* this process delivers the first group itself */
+	for (i = 1; i < worker_count; i++)
+		lmtp_local_worker_start(local, cmd, trans, workers, i);
+	for (i = 0; i < worker_count; i++) {
+		if (workers[i].pid == (pid_t)-1) {
+			lmtp_local_deliver_group(local, cmd, trans,
+						 workers[i].llrcpts,
+						 workers[i].count);
+		}
+	}
+	for (i = 1; i < worker_count; i++) {
+		if (workers[i].pid != (pid_t)-1)
+			lmtp_local_worker_finish(local, cmd, &workers[i]);
+	}
+
+	/* don't deliver more than once to the same recipient */
+	array_foreach_elem(&local->rcpt_to, llrcpt) {
+		if (llrcpt->duplicate == NULL)
+			continue;
+		smtp_server_reply_submit_duplicate(cmd,
+			llrcpt->rcpt->rcpt->index,
+			llrcpt->duplicate->rcpt->rcpt->index);
+	}
+}
+
+void lmtp_local_data(struct client *client,
+		     struct smtp_server_cmd_ctx *cmd,
+		     struct smtp_server_transaction *trans,
+		     struct istream *input)
+{
+	struct lmtp_local *local = client->local;
+	unsigned int limit = client->lmtp_set->lmtp_parallel_delivery_limit;
+	struct lmtp_local_recipient *const *llrcpts;
+	unsigned int count;
+	uid_t old_uid;
+
+	if (lmtp_local_open_raw_mail(local, trans, input) < 0)
+		return;
+
+	old_uid = geteuid();
+	llrcpts = array_get(&local->rcpt_to, &count);
+	if (limit > 1 && count > 1)
+		lmtp_local_deliver_parallel(local, cmd, trans, limit);
+	else
+		lmtp_local_deliver_group(local, cmd, trans, llrcpts, count);
 
 	if (old_uid == 0) {
 		/* switch back to running as root, since that's what we're
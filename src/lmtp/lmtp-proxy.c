@@ -66,16 +66,37 @@ struct lmtp_proxy_connection {
 	struct smtp_client_transaction *lmtp_trans;
 	struct istream *data_input;
 	struct timeout *to;
+	/* Number of transactions started in lmtp_conn so far */
+	unsigned int transactions_count;
 
 	bool finished:1;
 	bool failed:1;
 };
 
+/* Backend connections kept open between the transactions of the same
+   incoming LMTP session. They can't be shared between sessions, because
+   XCLIENT is sent only once per connection. */
+struct lmtp_proxy_idle_connection {
+	struct lmtp_proxy_pool *pool;
+	struct lmtp_proxy_rcpt_settings set;
+	char *host;
+
+	struct smtp_client_connection *lmtp_conn;
+	unsigned int transactions_count;
+	struct timeout *to_idle;
+};
+
+struct lmtp_proxy_pool {
+	struct smtp_client *lmtp_client;
+	ARRAY(struct lmtp_proxy_idle_connection *) idle_conns;
+};
+
 struct lmtp_proxy {
 	struct client *client;
 
 	struct smtp_server_transaction *trans;
 
+	/* owned by client->proxy_pool */
 	struct smtp_client *lmtp_client;
 
 	ARRAY(struct lmtp_proxy_connection *) connections;
@@ -146,15 +167,141 @@ lmtp_proxy_init(struct client *client,
 	else
 		proxy->initial_ttl = lmtp_set.proxy_data.ttl_plus_1 - 1;
 
-	proxy->lmtp_client = smtp_client_init(&lmtp_set);
+	/* The smtp_client is shared by all the transactions of this session,
+	   so that the backend connections can be reused. */
+	if (client->proxy_pool == NULL) {
+		client->proxy_pool = i_new(struct lmtp_proxy_pool, 1);
+		i_array_init(&client->proxy_pool->idle_conns, 4);
+		client->proxy_pool->lmtp_client = smtp_client_init(&lmtp_set);
+	}
+	proxy->lmtp_client = client->proxy_pool->lmtp_client;
 
 	return proxy;
 }
 
+static bool
+lmtp_proxy_settings_equal(const struct lmtp_proxy_rcpt_settings *set1,
+			  const struct lmtp_proxy_rcpt_settings *set2)
+{
+	return set1->protocol == set2->protocol &&
+		set1->set.port == set2->set.port &&
+		strcmp(set1->set.host, set2->set.host) == 0 &&
+		(set2->set.host_ip.family == 0 ||
+		 net_ip_compare(&set1->set.host_ip, &set2->set.host_ip)) &&
+		net_ip_compare(&set1->set.source_ip, &set2->set.source_ip) &&
+		set1->set.ssl_flags == set2->set.ssl_flags;
+}
+
+static void
+lmtp_proxy_idle_connection_free(struct lmtp_proxy_idle_connection *iconn)
+{
+	timeout_remove(&iconn->to_idle);
+	if (iconn->lmtp_conn != NULL)
+		smtp_client_connection_close(&iconn->lmtp_conn);
+	i_free(iconn->host);
+	i_free(iconn);
+}
+
+static void
+lmtp_proxy_idle_connection_remove(struct lmtp_proxy_idle_connection *iconn)
+{
+	struct lmtp_proxy_idle_connection *const *iconns;
+	unsigned int i, count;
+
+	iconns = array_get(&iconn->pool->idle_conns, &count);
+	for (i = 0; i < count; i++) {
+		if (iconns[i] == iconn) {
+			array_delete(&iconn->pool->idle_conns, i, 1);
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static void
+lmtp_proxy_idle_connection_timeout(struct lmtp_proxy_idle_connection *iconn)
+{
+	lmtp_proxy_idle_connection_remove(iconn);
+	lmtp_proxy_idle_connection_free(iconn);
+}
+
+static bool
+lmtp_proxy_connection_can_reuse(struct lmtp_proxy_connection *conn)
+{
+	const struct lmtp_settings *lmtp_set = conn->proxy->client->lmtp_set;
+
+	if (lmtp_set->lmtp_proxy_connection_idle_timeout == 0)
+		return FALSE;
+	if (conn->lmtp_conn == NULL || conn->lmtp_trans != NULL ||
+	    conn->failed)
+		return FALSE;
+	if (lmtp_set->lmtp_proxy_connection_max_transactions > 0 &&
+	    conn->transactions_count >=
+	    lmtp_set->lmtp_proxy_connection_max_transactions)
+		return FALSE;
+	return smtp_client_connection_get_state(conn->lmtp_conn) ==
+		SMTP_CLIENT_CONNECTION_STATE_READY;
+}
+
+static void
+lmtp_proxy_connection_set_idle(struct lmtp_proxy_connection *conn)
+{
+	struct client *client = conn->proxy->client;
+	struct lmtp_proxy_pool *pool = client->proxy_pool;
+	struct lmtp_proxy_idle_connection *iconn;
+
+	iconn = i_new(struct lmtp_proxy_idle_connection, 1);
+	iconn->pool = pool;
+	iconn->set = conn->set;
+	iconn->host = conn->host;
+	iconn->set.set.host = iconn->host;
+	conn->host = NULL;
+	iconn->lmtp_conn = conn->lmtp_conn;
+	conn->lmtp_conn = NULL;
+	iconn->transactions_count = conn->transactions_count;
+	iconn->to_idle = timeout_add(
+		client->lmtp_set->lmtp_proxy_connection_idle_timeout * 1000,
+		lmtp_proxy_idle_connection_timeout, iconn);
+	array_push_back(&pool->idle_conns, &iconn);
+}
+
+static bool
+lmtp_proxy_connection_reuse_idle(struct lmtp_proxy_connection *conn)
+{
+	struct lmtp_proxy_pool *pool = conn->proxy->client->proxy_pool;
+	struct lmtp_proxy_idle_connection *const *iconns, *iconn;
+	unsigned int i, count;
+
+	iconns = array_get(&pool->idle_conns, &count);
+	for (i = 0; i < count; i++) {
+		if (lmtp_proxy_settings_equal(&iconns[i]->set, &conn->set))
+			break;
+	}
+	if (i == count)
+		return FALSE;
+
+	iconn = iconns[i];
+	array_delete(&pool->idle_conns, i, 1);
+	if (smtp_client_connection_get_state(iconn->lmtp_conn) !=
+	    SMTP_CLIENT_CONNECTION_STATE_READY) {
+		/* disconnected while idling */
+		lmtp_proxy_idle_connection_free(iconn);
+		return FALSE;
+	}
+
+	conn->lmtp_conn = iconn->lmtp_conn;
+	iconn->lmtp_conn = NULL;
+	conn->transactions_count = iconn->transactions_count;
+	lmtp_proxy_idle_connection_free(iconn);
+	return TRUE;
+}
+
 static void lmtp_proxy_connection_deinit(struct lmtp_proxy_connection *conn)
 {
 	if (conn->lmtp_trans != NULL)
 		smtp_client_transaction_destroy(&conn->lmtp_trans);
+	if (lmtp_proxy_connection_can_reuse(conn))
+		lmtp_proxy_connection_set_idle(conn);
 	if (conn->lmtp_conn != NULL)
 		smtp_client_connection_close(&conn->lmtp_conn);
 	timeout_remove(&conn->to);
@@ -173,13 +320,28 @@ void lmtp_proxy_deinit(struct lmtp_proxy **_proxy)
 	array_foreach_elem(&proxy->connections, conn)
 		lmtp_proxy_connection_deinit(conn);
 
-	smtp_client_deinit(&proxy->lmtp_client);
 	i_stream_unref(&proxy->data_input);
 	array_free(&proxy->rcpt_to);
 	array_free(&proxy->connections);
 	i_free(proxy);
 }
 
+void lmtp_proxy_pool_deinit(struct lmtp_proxy_pool **_pool)
+{
+	struct lmtp_proxy_pool *pool = *_pool;
+	struct lmtp_proxy_idle_connection *iconn;
+
+	if (pool == NULL)
+		return;
+	*_pool = NULL;
+
+	array_foreach_elem(&pool->idle_conns, iconn)
+		lmtp_proxy_idle_connection_free(iconn);
+	array_free(&pool->idle_conns);
+	smtp_client_deinit(&pool->lmtp_client);
+	i_free(pool);
+}
+
 static void
 lmtp_proxy_mail_cb(const struct smtp_reply *proxy_reply ATTR_UNUSED,
 		   struct lmtp_proxy_connection *conn ATTR_UNUSED)
@@ -230,9 +392,7 @@ lmtp_proxy_connection_has_rcpt_forward(struct lmtp_proxy_connection *conn)
 	return (cap_extra != NULL);
 }
 
-static struct lmtp_proxy_connection *
-lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
-			  const struct lmtp_proxy_rcpt_settings *set)
+static void lmtp_proxy_connection_create(struct lmtp_proxy_connection *conn)
 {
 	static const char *rcpt_param_extensions[] =
 		{ LMTP_RCPT_FORWARD_PARAMETER, NULL };
@@ -240,38 +400,12 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 		.name = LMTP_RCPT_FORWARD_CAPABILITY,
 		.rcpt_param_extensions = rcpt_param_extensions,
 	};
-	struct smtp_client_settings lmtp_set;
-	struct smtp_server_transaction *trans = proxy->trans;
+	struct lmtp_proxy *proxy = conn->proxy;
 	struct client *client = proxy->client;
-	struct lmtp_proxy_connection *conn;
+	struct smtp_client_settings lmtp_set;
 	enum smtp_client_connection_ssl_mode ssl_mode;
 	struct ssl_iostream_settings ssl_set;
 
-	i_assert(set->set.timeout_msecs > 0);
-
-	array_foreach_elem(&proxy->connections, conn) {
-		if (conn->set.protocol == set->protocol &&
-		    conn->set.set.port == set->set.port &&
-		    strcmp(conn->set.set.host, set->set.host) == 0 &&
-		    (set->set.host_ip.family == 0 ||
-		     net_ip_compare(&conn->set.set.host_ip, &set->set.host_ip)) &&
-		    net_ip_compare(&conn->set.set.source_ip, &set->set.source_ip) &&
-		    conn->set.set.ssl_flags == set->set.ssl_flags)
-			return conn;
-	}
-
-	conn = i_new(struct lmtp_proxy_connection, 1);
-	conn->proxy = proxy;
-	conn->set.protocol = set->protocol;
-	conn->set.set.host_ip = set->set.host_ip;
-	conn->host = i_strdup(set->set.host);
-	conn->set.set.host = conn->host;
-	conn->set.set.source_ip = set->set.source_ip;
-	conn->set.set.port = set->set.port;
-	conn->set.set.ssl_flags = set->set.ssl_flags;
-	conn->set.set.timeout_msecs = set->set.timeout_msecs;
-	array_push_back(&proxy->connections, &conn);
-
 	lmtp_proxy_connection_init_ssl(conn, &ssl_set, &ssl_mode);
 
 	i_zero(&lmtp_set);
@@ -284,12 +418,12 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 
 	if (conn->set.set.host_ip.family != 0) {
 		conn->lmtp_conn = smtp_client_connection_create_ip(
-			proxy->lmtp_client, set->protocol,
+			proxy->lmtp_client, conn->set.protocol,
 			&conn->set.set.host_ip, conn->set.set.port,
 			conn->set.set.host, ssl_mode, &lmtp_set);
 	} else {
 		conn->lmtp_conn = smtp_client_connection_create(
-			proxy->lmtp_client, set->protocol,
+			proxy->lmtp_client, conn->set.protocol,
 			conn->set.set.host, conn->set.set.port,
 			ssl_mode, &lmtp_set);
 	}
@@ -301,7 +435,38 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	smtp_client_connection_accept_extra_capability(conn->lmtp_conn,
 						       &cap_rcpt_forward);
 	smtp_client_connection_connect(conn->lmtp_conn, NULL, NULL);
+}
+
+static struct lmtp_proxy_connection *
+lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
+			  const struct lmtp_proxy_rcpt_settings *set)
+{
+	struct smtp_server_transaction *trans = proxy->trans;
+	struct lmtp_proxy_connection *conn;
+
+	i_assert(set->set.timeout_msecs > 0);
+
+	array_foreach_elem(&proxy->connections, conn) {
+		if (lmtp_proxy_settings_equal(&conn->set, set))
+			return conn;
+	}
+
+	conn = i_new(struct lmtp_proxy_connection, 1);
+	conn->proxy = proxy;
+	conn->set.protocol = set->protocol;
+	conn->set.set.host_ip = set->set.host_ip;
+	conn->host = i_strdup(set->set.host);
+	conn->set.set.host = conn->host;
+	conn->set.set.source_ip = set->set.source_ip;
+	conn->set.set.port = set->set.port;
+	conn->set.set.ssl_flags = set->set.ssl_flags;
+	conn->set.set.timeout_msecs = set->set.timeout_msecs;
+	array_push_back(&proxy->connections, &conn);
+
+	if (!lmtp_proxy_connection_reuse_idle(conn))
+		lmtp_proxy_connection_create(conn);
 
+	conn->transactions_count++;
 	conn->lmtp_trans = smtp_client_transaction_create(
 		conn->lmtp_conn, trans->mail_from, &trans->params, 0,
 		lmtp_proxy_connection_finish, conn);
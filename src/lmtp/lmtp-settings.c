@@ -69,7 +69,11 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(BOOL, lmtp_rcpt_check_quota),
 	DEF(BOOL, lmtp_add_received_header),
 	DEF(BOOL, lmtp_verbose_replies),
+	DEF(BOOL, lmtp_fsync_batch),
 	DEF(UINT, lmtp_user_concurrency_limit),
+	DEF(UINT, lmtp_parallel_delivery_limit),
+	DEF(TIME, lmtp_proxy_connection_idle_timeout),
+	DEF(UINT, lmtp_proxy_connection_max_transactions),
 	DEF(ENUM, lmtp_hdr_delivery_address),
 	DEF(STR_VARS, lmtp_rawlog_dir),
 	DEF(STR_VARS, lmtp_proxy_rawlog_dir),
@@ -91,7 +95,11 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_rcpt_check_quota = FALSE,
 	.lmtp_add_received_header = TRUE,
 	.lmtp_verbose_replies = FALSE,
+	.lmtp_fsync_batch = FALSE,
 	.lmtp_user_concurrency_limit = 0,
+	.lmtp_parallel_delivery_limit = 0,
+	.lmtp_proxy_connection_idle_timeout = 0,
+	.lmtp_proxy_connection_max_transactions = 100,
 	.lmtp_hdr_delivery_address = "final:none:original",
 	.lmtp_rawlog_dir = "",
 	.lmtp_proxy_rawlog_dir = "",
@@ -24,7 +24,11 @@ struct lmtp_settings {
 	bool lmtp_rcpt_check_quota;
 	bool lmtp_add_received_header;
 	bool lmtp_verbose_replies;
+	bool lmtp_fsync_batch;
 	unsigned int lmtp_user_concurrency_limit;
+	unsigned int lmtp_parallel_delivery_limit;
+	unsigned int lmtp_proxy_connection_idle_timeout;
+	unsigned int lmtp_proxy_connection_max_transactions;
 	const char *lmtp_hdr_delivery_address;
 	const char *lmtp_rawlog_dir;
 	const char *lmtp_proxy_rawlog_dir;
@@ -23,6 +23,13 @@
 #define LOG_WARN_PENDING_COUNT (1000 / MAX_MSECS_PER_CONNECTION)
 /* If we keep being busy, log a warning every 60 seconds. */
 #define LOG_WARN_PENDING_INTERVAL (60 * LOG_WARN_PENDING_COUNT)
+/* After we've been busy with the log connection for this long, start
+   dropping its debug lines so the process isn't blocked on writing to
+   the log FIFO only because of its debug logging. */
+#define LOG_DROP_DEBUG_PENDING_COUNT LOG_WARN_PENDING_COUNT
+/* Buffer the written log lines up to this many bytes before writing
+   them in a single write() call. */
+#define LOG_WRITE_BUFFER_SIZE (64*1024)
 
 struct log_client {
 	struct ip_addr ip;
@@ -53,6 +60,7 @@ struct log_connection {
 	HASH_TABLE(void *, struct log_client *) clients;
 
 	unsigned int pending_count;
+	unsigned int dropped_debug_count;
 
 	bool master:1;
 	bool handshaked:1;
@@ -337,6 +345,11 @@ log_it(struct log_connection *log, const char *line,
 		prefix = client != NULL && client->prefix != NULL ?
 			client->prefix : log->default_prefix;
 	}
+	if (failure.log_type == LOG_TYPE_DEBUG &&
+	    log->pending_count >= LOG_DROP_DEBUG_PENDING_COUNT) {
+		log->dropped_debug_count++;
+		return;
+	}
 	client_log_ctx(log, &failure_ctx, log_time, prefix, failure.text);
 }
 
@@ -394,7 +407,20 @@ static int log_connection_handshake(struct log_connection *log)
 	return 0;
 }
 
-static void log_connection_input(struct log_connection *log)
+static void log_connection_dropped_report(struct log_connection *log)
+{
+	if (log->dropped_debug_count == 0)
+		return;
+	e_warning(log->event,
+		  "Log connection fd %d listen_fd %d prefix '%s' "
+		  "was sending input faster than we can write - "
+		  "dropped %u debug lines",
+		  log->fd, log->listen_fd, log->default_prefix,
+		  log->dropped_debug_count);
+	log->dropped_debug_count = 0;
+}
+
+static void log_connection_input_real(struct log_connection *log)
 {
 	const char *line;
 	ssize_t ret;
@@ -456,6 +482,7 @@ static void log_connection_input(struct log_connection *log)
 					last_pending_log = NULL;
 				log_refresh_proctitle();
 			}
+			log_connection_dropped_report(log);
 			return;
 		}
 		last_pending_log = log;
@@ -469,10 +496,20 @@ static void log_connection_input(struct log_connection *log)
 				  "Log connection fd %d listen_fd %d prefix '%s' "
 				  "is sending input faster than we can write",
 				  log->fd, log->listen_fd, log->default_prefix);
+			log_connection_dropped_report(log);
 		}
 	}
 }
 
+static void log_connection_input(struct log_connection *log)
+{
+	/* Write the lines read from the connection in larger batches
+	   instead of doing a write() for each line. */
+	i_set_failure_write_buffer_size(LOG_WRITE_BUFFER_SIZE);
+	log_connection_input_real(log);
+	i_set_failure_write_buffer_size(0);
+}
+
 void log_connection_create(struct log_error_buffer *errorbuf,
 			   int fd, int listen_fd)
 {
@@ -512,6 +549,7 @@ log_connection_destroy(struct log_connection *log, bool shutting_down)
 	}
 	hash_table_iterate_deinit(&iter);
 	hash_table_destroy(&log->clients);
+	log_connection_dropped_report(log);
 
 	if (client_count > 0 && shutting_down) {
 		e_warning(log->event,
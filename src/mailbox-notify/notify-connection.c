@@ -0,0 +1,231 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "connection.h"
+#include "ioloop.h"
+#include "ostream.h"
+#include "str.h"
+#include "strnum.h"
+#include "master-service.h"
+#include "notify-subscriptions.h"
+#include "notify-connection.h"
+
+#define MAILBOX_NOTIFY_PROTOCOL_MAJOR_VERSION 1
+#define MAILBOX_NOTIFY_PROTOCOL_MINOR_VERSION 0
+
+/* Disconnect clients that don't read their notifications */
+#define MAILBOX_NOTIFY_MAX_OUTBUF_SIZE (1024*1024)
+
+struct notify_connection {
+	struct connection conn;
+
+	struct notify_subscriptions *subs;
+	/* GUIDs this connection has subscribed to */
+	ARRAY(char *) guids;
+	struct timeout *to_destroy;
+};
+
+static struct connection_list *notify_connections = NULL;
+
+static void notify_connection_destroy_timeout(struct notify_connection *conn);
+
+static bool notify_guid_is_valid(const char *guid)
+{
+	guid_128_t guid_128;
+
+	return guid_128_from_string(guid, guid_128) == 0;
+}
+
+static int
+notify_connection_subscribe(struct notify_connection *conn,
+			    const char *const *args, const char **error_r)
+{
+	char *guid;
+
+	/* <guid> */
+	if (str_array_length(args) != 1 || !notify_guid_is_valid(args[0])) {
+		*error_r = "SUBSCRIBE: Invalid parameters";
+		return -1;
+	}
+	array_foreach_elem(&conn->guids, guid) {
+		if (strcmp(guid, args[0]) == 0)
+			return 0;
+	}
+	guid = i_strdup(args[0]);
+	array_push_back(&conn->guids, &guid);
+	notify_subscriptions_add(conn->subs, guid, conn);
+	return 0;
+}
+
+static int
+notify_connection_unsubscribe(struct notify_connection *conn,
+			      const char *const *args, const char **error_r)
+{
+	char **guids;
+	unsigned int i, count;
+
+	/* <guid> */
+	if (str_array_length(args) != 1) {
+		*error_r = "UNSUBSCRIBE: Invalid parameters";
+		return -1;
+	}
+	guids = array_get_modifiable(&conn->guids, &count);
+	for (i = 0; i < count; i++) {
+		if (strcmp(guids[i], args[0]) == 0) {
+			notify_subscriptions_remove(conn->subs, guids[i], conn);
+			i_free(guids[i]);
+			array_delete(&conn->guids, i, 1);
+			break;
+		}
+	}
+	return 0;
+}
+
+static int
+notify_connection_changed(struct notify_connection *conn,
+			  const char *const *args, const char **error_r)
+{
+	struct notify_change change;
+
+	/* <guid> <indexid> <log file seq> <log file offset> */
+	if (str_array_length(args) != 4 || !notify_guid_is_valid(args[0]) ||
+	    str_to_uint32(args[1], &change.indexid) < 0 ||
+	    str_to_uint32(args[2], &change.log_file_seq) < 0 ||
+	    str_to_uoff(args[3], &change.log_file_offset) < 0) {
+		*error_r = "CHANGED: Invalid parameters";
+		return -1;
+	}
+	notify_subscriptions_changed(conn->subs, args[0], &change);
+	return 0;
+}
+
+static int
+notify_connection_input_args(struct connection *_conn, const char *const *args)
+{
+	struct notify_connection *conn =
+		container_of(_conn, struct notify_connection, conn);
+	const char *cmd = args[0], *error;
+	int ret;
+
+	if (cmd == NULL) {
+		e_error(_conn->event, "Empty command");
+		return -1;
+	}
+	args++;
+
+	if (strcmp(cmd, "SUBSCRIBE") == 0)
+		ret = notify_connection_subscribe(conn, args, &error);
+	else if (strcmp(cmd, "UNSUBSCRIBE") == 0)
+		ret = notify_connection_unsubscribe(conn, args, &error);
+	else if (strcmp(cmd, "CHANGED") == 0)
+		ret = notify_connection_changed(conn, args, &error);
+	else {
+		error = t_strconcat("Unknown command: ", cmd, NULL);
+		ret = -1;
+	}
+	if (ret < 0) {
+		e_error(_conn->event, "Client input error: %s", error);
+		return -1;
+	}
+	return 1;
+}
+
+void notify_connection_send_change(void *subscriber, const char *guid,
+				   const struct notify_change *change)
+{
+	struct notify_connection *conn = subscriber;
+	string_t *str;
+
+	if (conn->to_destroy != NULL)
+		return;
+	if (o_stream_get_buffer_used_size(conn->conn.output) >=
+	    MAILBOX_NOTIFY_MAX_OUTBUF_SIZE) {
+		/* The client isn't reading the notifications. It'll notice
+		   the disconnection and fall back to checking the mailboxes
+		   by itself. Don't destroy the connection here, because
+		   the subscriptions are being iterated. */
+		e_error(conn->conn.event,
+			"Client isn't reading notifications - disconnecting");
+		conn->to_destroy = timeout_add_short(0,
+			notify_connection_destroy_timeout, conn);
+		return;
+	}
+
+	str = t_str_new(128);
+	str_append(str, "CHANGED\t");
+	str_append(str, guid);
+	if (change != NULL) {
+		str_printfa(str, "\t%u\t%u\t%"PRIuUOFF_T, change->indexid,
+			    change->log_file_seq, change->log_file_offset);
+	}
+	str_append_c(str, '\n');
+	o_stream_nsend(conn->conn.output, str_data(str), str_len(str));
+}
+
+static void notify_connection_destroy(struct connection *_conn)
+{
+	struct notify_connection *conn =
+		container_of(_conn, struct notify_connection, conn);
+	char *guid;
+
+	array_foreach_elem(&conn->guids, guid) {
+		notify_subscriptions_remove(conn->subs, guid, conn);
+		i_free(guid);
+	}
+	array_free(&conn->guids);
+	timeout_remove(&conn->to_destroy);
+	connection_deinit(&conn->conn);
+	i_free(conn);
+
+	master_service_client_connection_destroyed(master_service);
+}
+
+static void notify_connection_destroy_timeout(struct notify_connection *conn)
+{
+	notify_connection_destroy(&conn->conn);
+}
+
+static const struct connection_vfuncs notify_connection_vfuncs = {
+	.destroy = notify_connection_destroy,
+	.input_args = notify_connection_input_args,
+};
+
+static const struct connection_settings notify_connection_set = {
+	.service_name_in = "mailbox-notify-client",
+	.service_name_out = "mailbox-notify-server",
+	.major_version = MAILBOX_NOTIFY_PROTOCOL_MAJOR_VERSION,
+	.minor_version = MAILBOX_NOTIFY_PROTOCOL_MINOR_VERSION,
+	.input_max_size = 1024,
+	.output_max_size = SIZE_MAX,
+};
+
+void notify_connection_create(struct master_service_connection *master_conn,
+			      struct notify_subscriptions *subs)
+{
+	struct notify_connection *conn;
+
+	if (notify_connections == NULL) {
+		notify_connections =
+			connection_list_init(&notify_connection_set,
+					     &notify_connection_vfuncs);
+	}
+
+	conn = i_new(struct notify_connection, 1);
+	conn->subs = subs;
+	i_array_init(&conn->guids, 8);
+	connection_init_server(notify_connections, &conn->conn,
+			       master_conn->name, master_conn->fd,
+			       master_conn->fd);
+}
+
+unsigned int notify_connections_get_count(void)
+{
+	return notify_connections == NULL ? 0 : notify_connections->connections_count;
+}
+
+void notify_connections_destroy_all(void)
+{
+	if (notify_connections != NULL)
+		connection_list_deinit(&notify_connections);
+}
@@ -0,0 +1,15 @@
+#ifndef NOTIFY_CONNECTION_H
+#define NOTIFY_CONNECTION_H
+
+struct master_service_connection;
+struct notify_subscriptions;
+
+void notify_connection_create(struct master_service_connection *conn,
+			      struct notify_subscriptions *subs);
+void notify_connection_send_change(void *subscriber, const char *guid,
+				   const struct notify_change *change);
+
+unsigned int notify_connections_get_count(void);
+void notify_connections_destroy_all(void);
+
+#endif
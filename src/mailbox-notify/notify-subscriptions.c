@@ -0,0 +1,188 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "ioloop.h"
+#include "notify-subscriptions.h"
+
+struct notify_mailbox {
+	char *guid;
+	ARRAY(void *) subscribers;
+
+	/* The latest change published during the current batch */
+	struct notify_change pending_change;
+	bool pending:1;
+	/* Changes with different indexids were published */
+	bool pending_unknown:1;
+};
+
+struct notify_subscriptions {
+	unsigned int batch_msecs;
+	notify_subscription_callback_t *callback;
+
+	HASH_TABLE(char *, struct notify_mailbox *) mailboxes;
+	/* Mailboxes with pending changes */
+	ARRAY(struct notify_mailbox *) pending;
+	struct timeout *to_batch;
+};
+
+struct notify_subscriptions *
+notify_subscriptions_init(unsigned int batch_msecs,
+			  notify_subscription_callback_t *callback)
+{
+	struct notify_subscriptions *subs;
+
+	subs = i_new(struct notify_subscriptions, 1);
+	subs->batch_msecs = batch_msecs;
+	subs->callback = callback;
+	hash_table_create(&subs->mailboxes, default_pool, 0, str_hash, strcmp);
+	i_array_init(&subs->pending, 16);
+	return subs;
+}
+
+static void notify_mailbox_free(struct notify_mailbox *mbox)
+{
+	array_free(&mbox->subscribers);
+	i_free(mbox->guid);
+	i_free(mbox);
+}
+
+void notify_subscriptions_deinit(struct notify_subscriptions **_subs)
+{
+	struct notify_subscriptions *subs = *_subs;
+	struct hash_iterate_context *iter;
+	struct notify_mailbox *mbox;
+	char *guid;
+
+	*_subs = NULL;
+
+	notify_subscriptions_flush(subs);
+
+	iter = hash_table_iterate_init(subs->mailboxes);
+	while (hash_table_iterate(iter, subs->mailboxes, &guid, &mbox))
+		notify_mailbox_free(mbox);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&subs->mailboxes);
+	array_free(&subs->pending);
+	i_free(subs);
+}
+
+static void
+notify_mailbox_free_if_unused(struct notify_subscriptions *subs,
+			      struct notify_mailbox *mbox)
+{
+	if (array_count(&mbox->subscribers) > 0 || mbox->pending)
+		return;
+
+	hash_table_remove(subs->mailboxes, mbox->guid);
+	notify_mailbox_free(mbox);
+}
+
+void notify_subscriptions_add(struct notify_subscriptions *subs,
+			      const char *guid, void *subscriber)
+{
+	struct notify_mailbox *mbox;
+	void *const *subscriberp;
+
+	mbox = hash_table_lookup(subs->mailboxes, guid);
+	if (mbox == NULL) {
+		mbox = i_new(struct notify_mailbox, 1);
+		mbox->guid = i_strdup(guid);
+		i_array_init(&mbox->subscribers, 4);
+		hash_table_insert(subs->mailboxes, mbox->guid, mbox);
+	}
+	array_foreach(&mbox->subscribers, subscriberp) {
+		if (*subscriberp == subscriber)
+			return;
+	}
+	array_push_back(&mbox->subscribers, &subscriber);
+}
+
+void notify_subscriptions_remove(struct notify_subscriptions *subs,
+				 const char *guid, void *subscriber)
+{
+	struct notify_mailbox *mbox;
+	void *const *subscribers;
+	unsigned int i, count;
+
+	mbox = hash_table_lookup(subs->mailboxes, guid);
+	if (mbox == NULL)
+		return;
+
+	subscribers = array_get(&mbox->subscribers, &count);
+	for (i = 0; i < count; i++) {
+		if (subscribers[i] == subscriber) {
+			array_delete(&mbox->subscribers, i, 1);
+			break;
+		}
+	}
+	notify_mailbox_free_if_unused(subs, mbox);
+}
+
+static void
+notify_mailbox_send(struct notify_subscriptions *subs,
+		    struct notify_mailbox *mbox)
+{
+	const struct notify_change *change =
+		mbox->pending_unknown ? NULL : &mbox->pending_change;
+	void *subscriber;
+
+	array_foreach_elem(&mbox->subscribers, subscriber)
+		subs->callback(subscriber, mbox->guid, change);
+	mbox->pending = FALSE;
+	mbox->pending_unknown = FALSE;
+}
+
+void notify_subscriptions_flush(struct notify_subscriptions *subs)
+{
+	struct notify_mailbox *mbox;
+
+	timeout_remove(&subs->to_batch);
+	while (array_count(&subs->pending) > 0) {
+		mbox = array_idx_elem(&subs->pending, 0);
+		array_pop_front(&subs->pending);
+		notify_mailbox_send(subs, mbox);
+		notify_mailbox_free_if_unused(subs, mbox);
+	}
+}
+
+void notify_subscriptions_changed(struct notify_subscriptions *subs,
+				  const char *guid,
+				  const struct notify_change *change)
+{
+	struct notify_mailbox *mbox;
+	struct notify_change *pending;
+
+	mbox = hash_table_lookup(subs->mailboxes, guid);
+	if (mbox == NULL || array_count(&mbox->subscribers) == 0) {
+		/* nobody is interested */
+		return;
+	}
+
+	pending = &mbox->pending_change;
+	if (!mbox->pending) {
+		*pending = *change;
+		mbox->pending = TRUE;
+		array_push_back(&subs->pending, &mbox);
+	} else if (pending->indexid != change->indexid) {
+		/* e.g. shared mailbox with private indexes */
+		mbox->pending_unknown = TRUE;
+	} else if (change->log_file_seq > pending->log_file_seq ||
+		   (change->log_file_seq == pending->log_file_seq &&
+		    change->log_file_offset > pending->log_file_offset)) {
+		*pending = *change;
+	}
+
+	if (subs->batch_msecs == 0)
+		notify_subscriptions_flush(subs);
+	else if (subs->to_batch == NULL) {
+		subs->to_batch = timeout_add_short(subs->batch_msecs,
+			notify_subscriptions_flush, subs);
+	}
+}
+
+unsigned int notify_subscriptions_count(struct notify_subscriptions *subs)
+{
+	return hash_table_count(subs->mailboxes);
+}
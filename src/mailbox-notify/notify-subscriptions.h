@@ -0,0 +1,42 @@
+#ifndef NOTIFY_SUBSCRIPTIONS_H
+#define NOTIFY_SUBSCRIPTIONS_H
+
+/* Position of a change in the mailbox's index. The position can be compared
+   only between processes using the same index files (same indexid). */
+struct notify_change {
+	uint32_t indexid;
+	uint32_t log_file_seq;
+	uoff_t log_file_offset;
+};
+
+/* Send the change to the subscriber. If change is NULL, changes were
+   published with different indexids and the subscriber can't know whether
+   it has already seen them. */
+typedef void
+notify_subscription_callback_t(void *subscriber, const char *guid,
+			       const struct notify_change *change);
+
+struct notify_subscriptions *
+notify_subscriptions_init(unsigned int batch_msecs,
+			  notify_subscription_callback_t *callback);
+/* Flushes all pending changes before freeing. */
+void notify_subscriptions_deinit(struct notify_subscriptions **subs);
+
+/* Subscribe to changes in the mailbox GUID. Subscribing multiple times is
+   the same as subscribing once. */
+void notify_subscriptions_add(struct notify_subscriptions *subs,
+			      const char *guid, void *subscriber);
+void notify_subscriptions_remove(struct notify_subscriptions *subs,
+				 const char *guid, void *subscriber);
+
+/* Notify the mailbox's subscribers about the change. Changes published
+   within the batch_msecs are merged and sent together. */
+void notify_subscriptions_changed(struct notify_subscriptions *subs,
+				  const char *guid,
+				  const struct notify_change *change);
+/* Send all pending changes immediately. */
+void notify_subscriptions_flush(struct notify_subscriptions *subs);
+
+unsigned int notify_subscriptions_count(struct notify_subscriptions *subs);
+
+#endif
@@ -0,0 +1,195 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "test-common.h"
+#include "notify-subscriptions.h"
+
+#define GUID1 "00112233445566778899aabbccddeeff"
+#define GUID2 "ffeeddccbbaa99887766554433221100"
+
+struct test_sent_change {
+	const char *subscriber;
+	const char *guid;
+	bool unknown;
+	struct notify_change change;
+};
+
+static ARRAY(struct test_sent_change) sent_changes;
+static char sub1[] = "sub1", sub2[] = "sub2";
+
+static void
+test_send_callback(void *subscriber, const char *guid,
+		   const struct notify_change *change)
+{
+	struct test_sent_change *sent;
+
+	sent = array_append_space(&sent_changes);
+	sent->subscriber = subscriber;
+	sent->guid = t_strdup(guid);
+	if (change == NULL)
+		sent->unknown = TRUE;
+	else
+		sent->change = *change;
+}
+
+static void test_notify_subscriptions_batch(void)
+{
+	struct ioloop *ioloop;
+	struct notify_subscriptions *subs;
+	const struct test_sent_change *sent;
+	struct notify_change change = {
+		.indexid = 1234,
+		.log_file_seq = 2,
+		.log_file_offset = 100,
+	};
+
+	test_begin("notify subscriptions batch");
+	ioloop = io_loop_create();
+	t_array_init(&sent_changes, 8);
+	subs = notify_subscriptions_init(100, test_send_callback);
+
+	/* nobody subscribed - nothing is sent */
+	notify_subscriptions_changed(subs, GUID1, &change);
+	notify_subscriptions_flush(subs);
+	test_assert(array_count(&sent_changes) == 0);
+	test_assert(notify_subscriptions_count(subs) == 0);
+
+	notify_subscriptions_add(subs, GUID1, sub1);
+	notify_subscriptions_add(subs, GUID1, sub1);
+	notify_subscriptions_add(subs, GUID1, sub2);
+	notify_subscriptions_add(subs, GUID2, sub2);
+	test_assert(notify_subscriptions_count(subs) == 2);
+
+	/* multiple changes are merged into the latest one */
+	notify_subscriptions_changed(subs, GUID1, &change);
+	change.log_file_offset = 300;
+	notify_subscriptions_changed(subs, GUID1, &change);
+	change.log_file_offset = 200;
+	notify_subscriptions_changed(subs, GUID1, &change);
+	test_assert(array_count(&sent_changes) == 0);
+	notify_subscriptions_flush(subs);
+
+	test_assert(array_count(&sent_changes) == 2);
+	array_foreach(&sent_changes, sent) {
+		test_assert_strcmp(sent->guid, GUID1);
+		test_assert(!sent->unknown);
+		test_assert(sent->change.indexid == 1234);
+		test_assert(sent->change.log_file_seq == 2);
+		test_assert(sent->change.log_file_offset == 300);
+	}
+	sent = array_idx(&sent_changes, 0);
+	test_assert_strcmp(sent->subscriber, sub1);
+	sent = array_idx(&sent_changes, 1);
+	test_assert_strcmp(sent->subscriber, sub2);
+	array_clear(&sent_changes);
+
+	/* a newer log file wins over a larger offset */
+	change.log_file_seq = 3;
+	change.log_file_offset = 50;
+	notify_subscriptions_changed(subs, GUID2, &change);
+	notify_subscriptions_flush(subs);
+	test_assert(array_count(&sent_changes) == 1);
+	sent = array_idx(&sent_changes, 0);
+	test_assert_strcmp(sent->subscriber, sub2);
+	test_assert_strcmp(sent->guid, GUID2);
+	test_assert(sent->change.log_file_seq == 3 &&
+		    sent->change.log_file_offset == 50);
+	array_clear(&sent_changes);
+
+	notify_subscriptions_deinit(&subs);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_notify_subscriptions_indexids(void)
+{
+	struct ioloop *ioloop;
+	struct notify_subscriptions *subs;
+	const struct test_sent_change *sent;
+	struct notify_change change = {
+		.indexid = 1,
+		.log_file_seq = 1,
+		.log_file_offset = 100,
+	};
+
+	test_begin("notify subscriptions different indexids");
+	ioloop = io_loop_create();
+	t_array_init(&sent_changes, 8);
+	subs = notify_subscriptions_init(100, test_send_callback);
+	notify_subscriptions_add(subs, GUID1, sub1);
+
+	notify_subscriptions_changed(subs, GUID1, &change);
+	change.indexid = 2;
+	notify_subscriptions_changed(subs, GUID1, &change);
+	notify_subscriptions_flush(subs);
+	test_assert(array_count(&sent_changes) == 1);
+	sent = array_idx(&sent_changes, 0);
+	test_assert(sent->unknown);
+	array_clear(&sent_changes);
+
+	/* the next batch is known again */
+	notify_subscriptions_changed(subs, GUID1, &change);
+	notify_subscriptions_flush(subs);
+	test_assert(array_count(&sent_changes) == 1);
+	sent = array_idx(&sent_changes, 0);
+	test_assert(!sent->unknown && sent->change.indexid == 2);
+
+	notify_subscriptions_deinit(&subs);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_notify_subscriptions_remove(void)
+{
+	struct ioloop *ioloop;
+	struct notify_subscriptions *subs;
+	const struct test_sent_change *sent;
+	struct notify_change change = {
+		.indexid = 1,
+		.log_file_seq = 1,
+		.log_file_offset = 100,
+	};
+
+	test_begin("notify subscriptions remove");
+	ioloop = io_loop_create();
+	t_array_init(&sent_changes, 8);
+	subs = notify_subscriptions_init(100, test_send_callback);
+	notify_subscriptions_add(subs, GUID1, sub1);
+	notify_subscriptions_add(subs, GUID1, sub2);
+
+	/* pending changes are still sent to the remaining subscribers */
+	notify_subscriptions_changed(subs, GUID1, &change);
+	notify_subscriptions_remove(subs, GUID1, sub1);
+	notify_subscriptions_remove(subs, GUID2, sub1);
+	notify_subscriptions_flush(subs);
+	test_assert(array_count(&sent_changes) == 1);
+	sent = array_idx(&sent_changes, 0);
+	test_assert_strcmp(sent->subscriber, sub2);
+	array_clear(&sent_changes);
+
+	/* the mailbox is freed after the last subscriber is gone and the
+	   pending changes are sent */
+	notify_subscriptions_changed(subs, GUID1, &change);
+	notify_subscriptions_remove(subs, GUID1, sub2);
+	test_assert(notify_subscriptions_count(subs) == 1);
+	notify_subscriptions_flush(subs);
+	test_assert(array_count(&sent_changes) == 0);
+	test_assert(notify_subscriptions_count(subs) == 0);
+
+	notify_subscriptions_deinit(&subs);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_notify_subscriptions_batch,
+		test_notify_subscriptions_indexids,
+		test_notify_subscriptions_remove,
+		NULL
+	};
+	return test_run(test_functions);
+}
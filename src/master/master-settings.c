@@ -113,8 +113,10 @@ static const struct setting_define service_setting_defines[] = {
 	DEF(STR, chroot),
 
 	DEF(BOOL, drop_priv_before_exec),
+	DEF(BOOL, cpu_affinity),
 
 	DEF(UINT, process_min_avail),
+	DEF(UINT, process_min_avail_max),
 	DEF(UINT, process_limit),
 	DEF(UINT, client_limit),
 	DEF(UINT, service_count),
@@ -143,8 +145,10 @@ static const struct service_settings service_default_settings = {
 	.chroot = "",
 
 	.drop_priv_before_exec = FALSE,
+	.cpu_affinity = FALSE,
 
 	.process_min_avail = 0,
+	.process_min_avail_max = 0,
 	.process_limit = 0,
 	.client_limit = 0,
 	.service_count = 0,
@@ -555,6 +559,12 @@ master_settings_verify(void *_set, pool_t pool, const char **error_r)
 				service->name);
 			return FALSE;
 		}
+		if (service->process_min_avail_max > process_limit) {
+			*error_r = t_strdup_printf("service(%s): "
+				"process_min_avail_max is higher than process_limit",
+				service->name);
+			return FALSE;
+		}
 		if (service->vsz_limit < 1024*1024 && service->vsz_limit != 0) {
 			*error_r = t_strdup_printf("service(%s): "
 				"vsz_limit is too low", service->name);
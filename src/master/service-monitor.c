@@ -29,12 +29,43 @@
 #define SERVICE_MAX_EXIT_FAILURES_IN_SEC 10
 #define SERVICE_MIN_SUCCESSFUL_AGE_SECS 10
 #define SERVICE_PREFORK_MAX_AT_ONCE 10
+#define SERVICE_DEMAND_INTERVAL_SECS 10
 
 static void service_monitor_start_extra_avail(struct service *service);
 static void service_status_more(struct service_process *process,
 				const struct master_status *status);
 static void service_monitor_listen_start_force(struct service *service);
 
+static void service_demand_update(struct service *service)
+{
+	time_t secs = ioloop_time - service->process_demand_interval_start;
+
+	if (secs < SERVICE_DEMAND_INTERVAL_SECS)
+		return;
+	service->process_demand_prev =
+		secs < SERVICE_DEMAND_INTERVAL_SECS*2 ?
+		service->process_demand : 0;
+	service->process_demand = 0;
+	service->process_demand_interval_start = ioloop_time;
+}
+
+static unsigned int service_get_min_avail(struct service *service)
+{
+	unsigned int min_avail = service->set->process_min_avail;
+	unsigned int demand;
+
+	if (service->set->process_min_avail_max <= min_avail)
+		return min_avail;
+
+	/* Keep enough processes available to handle the recent demand
+	   without having to wait for new processes to be created. When the
+	   demand drops, the extra processes get killed via idle_kill. */
+	service_demand_update(service);
+	demand = I_MAX(service->process_demand, service->process_demand_prev);
+	demand = I_MIN(demand, service->set->process_min_avail_max);
+	return I_MAX(min_avail, demand);
+}
+
 static void service_process_idle_kill_timeout(struct service_process *process)
 {
 	struct master_status status;
@@ -55,16 +86,17 @@ static void service_kill_idle(struct service *service)
 	   processes there won't be any extra idling processes left. */
 	unsigned int processes_to_kill =
 		service->process_idling_lowwater_since_kills;
+	unsigned int min_avail = service_get_min_avail(service);
 	service->process_idling_lowwater_since_kills = service->process_idling;
 
-	/* Always try to leave process_min_avail processes */
+	/* Always try to leave service_get_min_avail() processes */
 	i_assert(processes_to_kill <= service->process_avail);
-	if (processes_to_kill <= service->set->process_min_avail) {
+	if (processes_to_kill <= min_avail) {
 		if (service->process_idling == 0)
 			timeout_remove(&service->to_idle);
 		return;
 	}
-	processes_to_kill -= service->set->process_min_avail;
+	processes_to_kill -= min_avail;
 
 	/* Now, kill the processes with the oldest idle_start time.
 
@@ -128,6 +160,10 @@ static void service_status_more(struct service_process *process,
 	/* process used up all of its clients */
 	i_assert(service->process_avail > 0);
 	service->process_avail--;
+	if (service->set->process_min_avail_max > 0) {
+		service_demand_update(service);
+		service->process_demand++;
+	}
 
 	if (service->type == SERVICE_TYPE_LOGIN &&
 	    service->process_avail == 0 &&
@@ -160,7 +196,7 @@ static void service_check_idle(struct service_process *process)
 		       &service->idle_processes_tail, process);
 	process->idle_start = ioloop_time;
 
-	if (service->process_avail > service->set->process_min_avail &&
+	if (service->process_avail > service_get_min_avail(service) &&
 	    service->to_idle == NULL &&
 	    service->idle_kill != UINT_MAX) {
 		/* We have more processes than we really need. Start a timer
@@ -398,11 +434,10 @@ static void service_accept(struct service_listener *l)
 static bool
 service_monitor_start_count(struct service *service, unsigned int limit)
 {
-	unsigned int i, count;
-
-	i_assert(service->set->process_min_avail >= service->process_avail);
+	unsigned int i, count, min_avail = service_get_min_avail(service);
 
-	count = service->set->process_min_avail - service->process_avail;
+	count = min_avail > service->process_avail ?
+		min_avail - service->process_avail : 0;
 	if (service->process_count + count > service->process_limit)
 		count = service->process_limit - service->process_count;
 	if (count > limit)
@@ -430,9 +465,9 @@ static void service_monitor_prefork_timeout(struct service *service)
 		service->prefork_counter = service->list->fork_counter;
 		return;
 	}
-	if (service->process_avail < service->set->process_min_avail) {
+	if (service->process_avail < service_get_min_avail(service)) {
 		if (service_monitor_start_count(service, SERVICE_PREFORK_MAX_AT_ONCE) &&
-		    service->process_avail < service->set->process_min_avail) {
+		    service->process_avail < service_get_min_avail(service)) {
 			/* All SERVICE_PREFORK_MAX_AT_ONCE were created, but
 			   it still wasn't enough. Launch more in the next
 			   timeout. */
@@ -444,7 +479,7 @@ static void service_monitor_prefork_timeout(struct service *service)
 
 static void service_monitor_start_extra_avail(struct service *service)
 {
-	if (service->process_avail >= service->set->process_min_avail ||
+	if (service->process_avail >= service_get_min_avail(service) ||
 	    service->process_count >= service->process_limit ||
 	    service->list->destroying)
 		return;
@@ -453,7 +488,7 @@ static void service_monitor_start_extra_avail(struct service *service)
 		/* quickly start one process now */
 		if (!service_monitor_start_count(service, 1))
 			return;
-		if (service->process_avail >= service->set->process_min_avail)
+		if (service->process_avail >= service_get_min_avail(service))
 			return;
 	}
 	if (service->to_prefork == NULL) {
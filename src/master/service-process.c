@@ -1,5 +1,6 @@
 /* Copyright (c) 2005-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for sched_setaffinity() */
 #include "common.h"
 #include "array.h"
 #include "aqueue.h"
@@ -33,6 +34,9 @@
 #include <syslog.h>
 #include <signal.h>
 #include <sys/wait.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+#  include <sched.h>
+#endif
 
 static void service_reopen_inet_listeners(struct service *service)
 {
@@ -218,10 +222,17 @@ service_dup_fds(struct service *service)
 		i_set_failure_internal();
 	}
 
-	if (service->type == SERVICE_TYPE_LOG) {
-		/* Pass our config fd to the log process, so it won't depend
-		   on config process. Note that we don't want to do this for
-		   other processes, since it prevents config reload. */
+	if (service->type == SERVICE_TYPE_LOG ||
+	    (service->type != SERVICE_TYPE_CONFIG &&
+	     !service->set->drop_priv_before_exec)) {
+		/* Pass our config fd to the process, so it doesn't need to
+		   ask it from the config process. This makes the process
+		   startup faster and the log process won't depend on the
+		   config process. The fd is replaced on config reload, so
+		   it's the same config the config process would return.
+		   Processes that drop privileges before exec wouldn't have
+		   had access to the config socket, so don't give them the
+		   full config either. */
 		i_assert(global_config_fd != -1);
 		if (lseek(global_config_fd, 0, SEEK_SET) < 0)
 			i_fatal("lseek(config fd, 0) failed: %m");
@@ -344,6 +355,41 @@ service_process_setup_environment(struct service *service, unsigned int uid,
 	env_put(DOVECOT_LOG_DEBUG_ENV, service_set->log_debug);
 }
 
+static void
+service_process_set_cpu_affinity(struct service *service, pid_t pid)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t cpus;
+	unsigned int cpu, n;
+
+	/* Pin the processes to the CPUs usable by master in round-robin
+	   order. With reuse_port listeners each process also has its own
+	   listener socket, so the connections are spread evenly across the
+	   CPUs. */
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0) {
+		e_error(service->event, "sched_getaffinity() failed: %m");
+		return;
+	}
+	n = service->process_count_total % CPU_COUNT(&cpus);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &cpus) && n-- == 0)
+			break;
+	}
+	i_assert(cpu < CPU_SETSIZE);
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(pid, sizeof(cpus), &cpus) < 0) {
+		e_error(service->event,
+			"sched_setaffinity(%s, cpu=%u) failed: %m",
+			dec2str(pid), cpu);
+	}
+#else
+	e_error(service->event,
+		"cpu_affinity=yes isn't supported on this system");
+#endif
+}
+
 static void service_process_status_timeout(struct service_process *process)
 {
 	e_error(process->service->event,
@@ -415,6 +461,8 @@ struct service_process *service_process_create(struct service *service)
 		process_exec(service->executable);
 	}
 	i_assert(hash_table_lookup(service_pids, POINTER_CAST(pid)) == NULL);
+	if (process_forked && service->set->cpu_affinity)
+		service_process_set_cpu_affinity(service, pid);
 
 	process = i_new(struct service_process, 1);
 	process->service = service;
@@ -658,17 +658,36 @@ static void services_kill_timeout(struct service_list *service_list)
 
 void services_destroy(struct service_list *service_list, bool wait)
 {
+	const struct master_service_settings *service_set =
+		service_list->service_set;
+	struct service *service;
+	unsigned int uninitialized_count, kill_msecs;
+
 	/* make sure we log if child processes died unexpectedly */
 	service_list->destroying = TRUE;
 	services_monitor_reap_children();
 
 	services_monitor_stop(service_list, wait);
 
-	if (service_list->refcount > 1 &&
-	    service_list->service_set->shutdown_clients) {
+	if (wait && service_set->shutdown_clients &&
+	    service_set->shutdown_clients_stagger_interval > 0) {
+		/* The processes delay disconnecting their clients when they
+		   notice that master is gone. Make them die now, since this
+		   isn't a reload. */
+		array_foreach_elem(&service_list->services, service) {
+			if (service->type != SERVICE_TYPE_LOG) {
+				(void)service_signal(service, SIGTERM,
+						     &uninitialized_count);
+			}
+		}
+	}
+
+	if (service_list->refcount > 1 && service_set->shutdown_clients) {
+		kill_msecs = SERVICE_DIE_TIMEOUT_MSECS +
+			service_set->shutdown_clients_stagger_interval * 1000;
 		service_list->to_kill =
-			timeout_add(SERVICE_DIE_TIMEOUT_MSECS,
-				    services_kill_timeout, service_list);
+			timeout_add(kill_msecs, services_kill_timeout,
+				    service_list);
 	}
 
 	service_list->destroyed = TRUE;
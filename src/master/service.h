@@ -79,6 +79,11 @@ struct service {
 	unsigned int process_idling_lowwater_since_kills;
 	/* max number of processes allowed */
 	unsigned int process_limit;
+	/* Number of processes that used up all their client slots during the
+	   current and the previous SERVICE_DEMAND_INTERVAL_SECS. Used for
+	   growing process_min_avail up to process_min_avail_max. */
+	unsigned int process_demand, process_demand_prev;
+	time_t process_demand_interval_start;
 	/* Total number of processes ever created */
 	uint64_t process_count_total;
 
@@ -122,7 +127,7 @@ struct service {
 	/* next time to try to kill idling processes */
 	struct timeout *to_idle;
 
-	/* prefork processes up to process_min_avail if there's time */
+	/* prefork processes up to service_get_min_avail() if there's time */
 	struct timeout *to_prefork;
 	unsigned int prefork_counter;
 
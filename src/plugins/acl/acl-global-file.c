@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "llist.h"
 #include "ioloop.h"
 #include "istream.h"
 #include "strescape.h"
@@ -21,18 +22,68 @@ struct acl_global_parse_rights {
 	struct acl_rights rights;
 };
 
-struct acl_global_file {
+/* The parsed global ACL file is shared by all the ACL backends in the process
+   using the same file. With shared namespaces there's a backend for each
+   user whose mailboxes are accessed, so this avoids parsing and stat()ing the
+   same file over and over again. */
+struct acl_global_file_data {
+	struct acl_global_file_data *prev, *next;
+	int refcount;
+
 	char *path;
 	struct stat prev_st;
-	struct event *event;
 	time_t last_refresh_time;
 
 	pool_t rights_pool;
 	ARRAY(struct acl_global_rights) rights;
+};
+
+struct acl_global_file {
+	struct acl_global_file_data *data;
+	struct event *event;
 
 	unsigned int refresh_interval_secs;
 };
 
+static struct acl_global_file_data *acl_global_files = NULL;
+
+static struct acl_global_file_data *
+acl_global_file_data_get(const char *path)
+{
+	struct acl_global_file_data *data;
+
+	for (data = acl_global_files; data != NULL; data = data->next) {
+		if (strcmp(data->path, path) == 0) {
+			data->refcount++;
+			return data;
+		}
+	}
+
+	data = i_new(struct acl_global_file_data, 1);
+	data->refcount = 1;
+	data->path = i_strdup(path);
+	i_array_init(&data->rights, 32);
+	data->rights_pool = pool_alloconly_create("acl global file rights", 1024);
+	DLLIST_PREPEND(&acl_global_files, data);
+	return data;
+}
+
+static void acl_global_file_data_unref(struct acl_global_file_data **_data)
+{
+	struct acl_global_file_data *data = *_data;
+
+	*_data = NULL;
+	i_assert(data->refcount > 0);
+	if (--data->refcount > 0)
+		return;
+
+	DLLIST_REMOVE(&acl_global_files, data);
+	array_free(&data->rights);
+	pool_unref(&data->rights_pool);
+	i_free(data->path);
+	i_free(data);
+}
+
 struct acl_global_file *
 acl_global_file_init(const char *path, unsigned int refresh_interval_secs,
 		     struct event *event)
@@ -40,11 +91,9 @@ acl_global_file_init(const char *path, unsigned int refresh_interval_secs,
 	struct acl_global_file *file;
 
 	file = i_new(struct acl_global_file, 1);
-	file->path = i_strdup(path);
+	file->data = acl_global_file_data_get(path);
 	file->refresh_interval_secs = refresh_interval_secs;
 	file->event = event_create(event);
-	i_array_init(&file->rights, 32);
-	file->rights_pool = pool_alloconly_create("acl global file rights", 1024);
 	return file;
 }
 
@@ -54,10 +103,8 @@ void acl_global_file_deinit(struct acl_global_file **_file)
 
 	*_file = NULL;
 
-	array_free(&file->rights);
+	acl_global_file_data_unref(&file->data);
 	event_unref(&file->event);
-	pool_unref(&file->rights_pool);
-	i_free(file->path);
 	i_free(file);
 }
 
@@ -105,8 +152,8 @@ acl_global_file_parse_line(struct acl_global_file_parse_ctx *ctx,
 	}
 
 	pright = array_append_space(&ctx->parse_rights);
-	pright->vpattern = p_strdup(ctx->file->rights_pool, vpattern);
-	if (acl_rights_parse_line(line, ctx->file->rights_pool,
+	pright->vpattern = p_strdup(ctx->file->data->rights_pool, vpattern);
+	if (acl_rights_parse_line(line, ctx->file->data->rights_pool,
 				  &pright->rights, error_r) < 0)
 		return -1;
 	pright->rights.global = TRUE;
@@ -121,16 +168,17 @@ static int acl_global_file_read(struct acl_global_file *file)
 	struct istream *input;
 	const char *line, *error, *prev_vpattern;
 	unsigned int linenum = 0;
+	struct acl_global_file_data *data = file->data;
 	int ret = 0;
 
-	array_clear(&file->rights);
-	p_clear(file->rights_pool);
+	array_clear(&data->rights);
+	p_clear(data->rights_pool);
 
 	i_zero(&ctx);
 	ctx.file = file;
 	i_array_init(&ctx.parse_rights, 32);
 
-	input = i_stream_create_file(file->path, SIZE_MAX);
+	input = i_stream_create_file(data->path, SIZE_MAX);
 	i_stream_set_return_partial_line(input, TRUE);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		linenum++;
@@ -141,7 +189,7 @@ static int acl_global_file_read(struct acl_global_file *file)
 			if (ret < 0) {
 				e_error(file->event,
 					"Global ACL file %s line %u: %s",
-					file->path, linenum, error);
+					data->path, linenum, error);
 			}
 		} T_END;
 		if (ret < 0)
@@ -150,7 +198,7 @@ static int acl_global_file_read(struct acl_global_file *file)
 	if (ret == 0 && input->stream_errno != 0) {
 		e_error(file->event,
 			"Couldn't read global ACL file %s: %s",
-			file->path, i_stream_get_error(input));
+			data->path, i_stream_get_error(input));
 		ret = -1;
 	}
 	if (ret == 0) {
@@ -159,10 +207,10 @@ static int acl_global_file_read(struct acl_global_file *file)
 		if (i_stream_stat(input, TRUE, &st) < 0) {
 			e_error(file->event,
 				"Couldn't stat global ACL file %s: %s",
-				file->path, i_stream_get_error(input));
+				data->path, i_stream_get_error(input));
 			ret = -1;
 		} else {
-			file->prev_st = *st;
+			data->prev_st = *st;
 		}
 	}
 	i_stream_destroy(&input);
@@ -174,9 +222,9 @@ static int acl_global_file_read(struct acl_global_file *file)
 	array_foreach_modifiable(&ctx.parse_rights, pright) {
 		if (right == NULL ||
 		    strcmp(prev_vpattern, pright->vpattern) != 0) {
-			right = array_append_space(&file->rights);
+			right = array_append_space(&data->rights);
 			right->vpattern = pright->vpattern;
-			p_array_init(&right->rights, file->rights_pool, 4);
+			p_array_init(&right->rights, data->rights_pool, 4);
 		}
 		array_push_back(&right->rights, &pright->rights);
 	}
@@ -187,32 +235,33 @@ static int acl_global_file_read(struct acl_global_file *file)
 
 int acl_global_file_refresh(struct acl_global_file *file)
 {
+	struct acl_global_file_data *data = file->data;
 	struct stat st;
 
-	if (file->last_refresh_time + (time_t)file->refresh_interval_secs > ioloop_time)
+	if (data->last_refresh_time + (time_t)file->refresh_interval_secs > ioloop_time)
 		return 0;
-	if (file->last_refresh_time != 0) {
-		if (stat(file->path, &st) < 0) {
-			e_error(file->event, "stat(%s) failed: %m", file->path);
+	if (data->last_refresh_time != 0) {
+		if (stat(data->path, &st) < 0) {
+			e_error(file->event, "stat(%s) failed: %m", data->path);
 			return -1;
 		}
-		if (st.st_ino == file->prev_st.st_ino &&
-		    st.st_size == file->prev_st.st_size &&
-		    CMP_ST_MTIME(&st, &file->prev_st)) {
+		if (st.st_ino == data->prev_st.st_ino &&
+		    st.st_size == data->prev_st.st_size &&
+		    CMP_ST_MTIME(&st, &data->prev_st)) {
 			/* no change to the file */
-			file->last_refresh_time = ioloop_time;
+			data->last_refresh_time = ioloop_time;
 			return 0;
 		}
 	}
 	if (acl_global_file_read(file) < 0)
 		return -1;
-	file->last_refresh_time = ioloop_time;
+	data->last_refresh_time = ioloop_time;
 	return 0;
 }
 
 void acl_global_file_last_stat(struct acl_global_file *file, struct stat *st_r)
 {
-	*st_r = file->prev_st;
+	*st_r = file->data->prev_st;
 }
 
 void acl_global_file_get(struct acl_global_file *file, const char *vname,
@@ -222,7 +271,7 @@ void acl_global_file_get(struct acl_global_file *file, const char *vname,
 	const struct acl_rights *rights;
 	struct acl_rights *new_rights;
 
-	array_foreach_modifiable(&file->rights, global_rights) {
+	array_foreach_modifiable(&file->data->rights, global_rights) {
 		if (!wildcard_match(vname, global_rights->vpattern))
 			continue;
 		e_debug(file->event, "Mailbox '%s' matches global ACL pattern '%s'",
@@ -238,9 +287,9 @@ bool acl_global_file_have_any(struct acl_global_file *file, const char *vname)
 {
 	struct acl_global_rights *rights;
 
-	i_assert(file->last_refresh_time != 0);
+	i_assert(file->data->last_refresh_time != 0);
 
-	array_foreach_modifiable(&file->rights, rights) {
+	array_foreach_modifiable(&file->data->rights, rights) {
 		if (wildcard_match(vname, rights->vpattern))
 			return TRUE;
 	}
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "dict.h"
 #include "mail-user.h"
@@ -26,10 +27,11 @@ struct acl_lookup_dict_iter {
 	pool_t pool;
 	struct acl_lookup_dict *dict;
 
-	pool_t iter_value_pool;
 	ARRAY_TYPE(const_string) iter_ids;
 	ARRAY_TYPE(const_string) iter_values;
 	unsigned int iter_idx, iter_value_idx;
+	/* usernames already returned via another identifier */
+	HASH_TABLE(const char *, void *) seen_values;
 
 	bool failed:1;
 };
@@ -290,15 +292,22 @@ static void acl_lookup_dict_iterate_read(struct acl_lookup_dict_iter *iter)
 	/* read all of it to memory. at least currently dict-proxy can support
 	   only one iteration at a time, but the acl code can end up rebuilding
 	   the dict, which opens another iteration. */
-	p_clear(iter->iter_value_pool);
 	array_clear(&iter->iter_values);
 	const struct dict_op_settings *set = mail_user_get_dict_op_settings(iter->dict->user);
 	dict_iter = dict_iterate_init(iter->dict->dict, set, prefix,
-				      DICT_ITERATE_FLAG_RECURSE);
+				      DICT_ITERATE_FLAG_RECURSE |
+				      DICT_ITERATE_FLAG_NO_VALUE);
 	while (dict_iterate(dict_iter, &key, &value)) {
 		i_assert(prefix_len < strlen(key));
 
-		key = p_strdup(iter->iter_value_pool, key + prefix_len);
+		/* The same user is commonly found via multiple identifiers
+		   (e.g. anyone and a group). Return it only once, since the
+		   caller sets up a namespace for each one. */
+		key += prefix_len;
+		if (hash_table_lookup(iter->seen_values, key) != NULL)
+			continue;
+		key = p_strdup(iter->pool, key);
+		hash_table_insert(iter->seen_values, key, POINTER_CAST(1));
 		array_push_back(&iter->iter_values, &key);
 	}
 	if (dict_iterate_deinit(&dict_iter, &error) < 0) {
@@ -330,8 +339,7 @@ acl_lookup_dict_iterate_visible_init(struct acl_lookup_dict *dict)
 	array_push_back(&iter->iter_ids, &id);
 
 	i_array_init(&iter->iter_values, 64);
-	iter->iter_value_pool =
-		pool_alloconly_create("acl lookup dict iter values", 1024);
+	hash_table_create(&iter->seen_values, pool, 0, str_hash, strcmp);
 
 	/* get all groups we belong to */
 	if (auser->groups != NULL) {
@@ -375,8 +383,8 @@ int acl_lookup_dict_iterate_visible_deinit(struct acl_lookup_dict_iter **_iter)
 	int ret = iter->failed ? -1 : 0;
 
 	*_iter = NULL;
+	hash_table_destroy(&iter->seen_values);
 	array_free(&iter->iter_values);
-	pool_unref(&iter->iter_value_pool);
 	pool_unref(&iter->pool);
 	return ret;
 }
@@ -278,6 +278,7 @@ const struct fs fs_class_compress = {
 		.iter_next = fs_wrapper_iter_next,
 		.iter_deinit = fs_wrapper_iter_deinit,
 		.switch_ioloop = NULL,
-		.get_nlinks = fs_wrapper_get_nlinks
+		.get_nlinks = fs_wrapper_get_nlinks,
+		.delete_multi = fs_wrapper_delete_multi,
 	}
 };
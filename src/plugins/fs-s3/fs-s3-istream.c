@@ -0,0 +1,319 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "strnum.h"
+#include "istream-private.h"
+#include "http-response.h"
+#include "fs-s3-private.h"
+
+/* The object is read with ranged GET requests of part_size bytes. Up to
+   max_parallel of them are in progress at the same time, and the parts are
+   returned by the stream in order as they finish. The first request is sent
+   already when the stream is created, so fs_prefetch() can start the read
+   early. */
+
+struct s3_istream_part {
+	struct s3_istream *sstream;
+	struct s3_fs_request *sreq;
+
+	uoff_t offset;
+	/* response payload, NULL if it was empty */
+	buffer_t *data;
+	/* number of bytes already returned from data */
+	size_t data_pos;
+	bool finished:1;
+};
+
+struct s3_istream {
+	struct istream_private istream;
+	struct s3_fs_file *file;
+	char *path;
+
+	/* parts in progress or not fully read yet, in offset order */
+	ARRAY(struct s3_istream_part *) parts;
+	/* offset of the next part to request */
+	uoff_t next_offset;
+	/* object size, UOFF_T_MAX until the first response is received */
+	uoff_t object_size;
+
+	int error_errno;
+	char *error;
+};
+
+static void s3_istream_schedule_parts(struct s3_istream *sstream);
+
+static void s3_istream_part_free(struct s3_istream_part **_part)
+{
+	struct s3_istream_part *part = *_part;
+
+	*_part = NULL;
+	fs_s3_request_abort(&part->sreq);
+	buffer_free(&part->data);
+	i_free(part);
+}
+
+static void s3_istream_abort_parts(struct s3_istream *sstream)
+{
+	struct s3_istream_part *part;
+
+	array_foreach_elem(&sstream->parts, part)
+		s3_istream_part_free(&part);
+	array_clear(&sstream->parts);
+}
+
+static void
+s3_istream_set_error(struct s3_istream *sstream, int error_errno,
+		     const char *error)
+{
+	if (sstream->error != NULL)
+		return;
+	sstream->error_errno = error_errno;
+	sstream->error = i_strdup(error);
+}
+
+static void s3_istream_set_size(struct s3_istream *sstream, uoff_t size)
+{
+	sstream->object_size = size;
+	sstream->istream.cached_stream_size = size;
+	sstream->file->size = size;
+}
+
+static void
+s3_istream_part_response(struct s3_fs_request *sreq,
+			 const struct http_response *response)
+{
+	struct s3_istream_part *part = sreq->context;
+	struct s3_istream *sstream = part->sstream;
+	const char *value, *p;
+	uoff_t size;
+
+	if (sstream->object_size != UOFF_T_MAX)
+		return;
+	i_assert(part->offset == 0);
+
+	switch (response->status) {
+	case 200:
+		/* the whole object was returned */
+		sstream->next_offset = UOFF_T_MAX;
+		if (http_response_get_payload_size(response, &size) > 0)
+			s3_istream_set_size(sstream, size);
+		return;
+	case 206:
+		/* bytes <first>-<last>/<size> */
+		value = http_response_header_get(response, "Content-Range");
+		if (value == NULL || (p = strchr(value, '/')) == NULL ||
+		    str_to_uoff(p + 1, &size) < 0) {
+			s3_istream_set_error(sstream, EIO, t_strdup_printf(
+				"Invalid Content-Range header in response: %s",
+				value == NULL ? "(missing)" : value));
+			return;
+		}
+		break;
+	case 416:
+		/* the object is empty */
+		size = 0;
+		break;
+	default:
+		return;
+	}
+	s3_istream_set_size(sstream, size);
+	s3_istream_schedule_parts(sstream);
+}
+
+static void s3_istream_part_finished(struct s3_fs_request *sreq)
+{
+	struct s3_istream_part *part = sreq->context;
+	struct s3_istream *sstream = part->sstream;
+	uoff_t expected_size;
+
+	part->sreq = NULL;
+	part->finished = TRUE;
+
+	if (sreq->status == 416 && part->offset == 0) {
+		/* empty object */
+	} else if (!fs_s3_request_is_success(sreq)) {
+		s3_istream_set_error(sstream, sreq->error_errno,
+			t_strdup_printf("GET %s failed: %s",
+					sstream->path, sreq->error));
+	} else if (sreq->status == 200 && part->offset != 0) {
+		s3_istream_set_error(sstream, EIO, t_strdup_printf(
+			"GET %s failed: Range request returned the full object",
+			sstream->path));
+	} else {
+		part->data = sreq->payload;
+		sreq->payload = NULL;
+
+		if (sstream->object_size == UOFF_T_MAX) {
+			/* full object without Content-Length */
+			s3_istream_set_size(sstream, part->data == NULL ? 0 :
+					    part->data->used);
+		}
+		expected_size = sreq->status == 200 ? sstream->object_size :
+			I_MIN(sstream->file->fs->part_size,
+			      sstream->object_size - part->offset);
+		if ((part->data == NULL ? 0 : part->data->used) !=
+		    expected_size) {
+			s3_istream_set_error(sstream, EIO, t_strdup_printf(
+				"GET %s failed: Expected %"PRIuUOFF_T" bytes "
+				"at offset %"PRIuUOFF_T", received %zu",
+				sstream->path, expected_size, part->offset,
+				part->data == NULL ? 0 : part->data->used));
+		}
+	}
+	if (sstream->error != NULL) {
+		/* part is freed by the abort, but sreq stays valid until
+		   this callback returns */
+		s3_istream_abort_parts(sstream);
+	}
+	i_stream_set_input_pending(&sstream->istream.istream, TRUE);
+	fs_s3_file_async_callback(sstream->file);
+}
+
+static void s3_istream_add_part(struct s3_istream *sstream)
+{
+	struct s3_fs *fs = sstream->file->fs;
+	struct s3_istream_part *part;
+	struct s3_sigv4_header *hdr;
+	ARRAY_TYPE(s3_sigv4_header) headers;
+
+	part = i_new(struct s3_istream_part, 1);
+	part->sstream = sstream;
+	part->offset = sstream->next_offset;
+	sstream->next_offset += fs->part_size;
+
+	t_array_init(&headers, 1);
+	hdr = array_append_space(&headers);
+	hdr->name = "range";
+	hdr->value = t_strdup_printf("bytes=%"PRIuUOFF_T"-%"PRIuUOFF_T,
+				     part->offset,
+				     part->offset + fs->part_size - 1);
+
+	part->sreq = fs_s3_request_init(fs, sstream->file->file.event, "GET",
+					sstream->path, "", &headers, NULL);
+	part->sreq->response_callback = s3_istream_part_response;
+	part->sreq->callback = s3_istream_part_finished;
+	part->sreq->context = part;
+	array_push_back(&sstream->parts, &part);
+	fs_s3_request_submit(part->sreq);
+}
+
+static void s3_istream_schedule_parts(struct s3_istream *sstream)
+{
+	if (sstream->object_size == UOFF_T_MAX) {
+		/* the size isn't known until the first part's response */
+		if (sstream->next_offset == 0)
+			s3_istream_add_part(sstream);
+		return;
+	}
+	while (sstream->error == NULL &&
+	       sstream->next_offset < sstream->object_size &&
+	       array_count(&sstream->parts) < sstream->file->fs->max_parallel)
+		s3_istream_add_part(sstream);
+}
+
+static ssize_t i_stream_s3_read(struct istream_private *stream)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream);
+	struct s3_istream_part *part;
+	size_t avail, size;
+
+	for (;;) {
+		if (sstream->error != NULL) {
+			stream->istream.stream_errno = sstream->error_errno;
+			io_stream_set_error(&stream->iostream, "%s",
+					    sstream->error);
+			return -1;
+		}
+		if (array_count(&sstream->parts) == 0) {
+			i_assert(sstream->object_size != UOFF_T_MAX);
+			stream->istream.eof = TRUE;
+			return -1;
+		}
+
+		part = array_idx_elem(&sstream->parts, 0);
+		if (!part->finished)
+			return 0;
+
+		avail = part->data == NULL ? 0 :
+			part->data->used - part->data_pos;
+		if (avail > 0)
+			break;
+		/* part fully read - request more */
+		array_pop_front(&sstream->parts);
+		s3_istream_part_free(&part);
+		s3_istream_schedule_parts(sstream);
+	}
+
+	if (!i_stream_try_alloc(stream, avail, &size))
+		return -2;
+	size = I_MIN(size, avail);
+	memcpy(stream->w_buffer + stream->pos,
+	       CONST_PTR_OFFSET(part->data->data, part->data_pos), size);
+	stream->pos += size;
+	part->data_pos += size;
+	return size;
+}
+
+static int i_stream_s3_stat(struct istream_private *stream,
+			    bool exact ATTR_UNUSED)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream);
+
+	stream->statbuf.st_size = sstream->object_size == UOFF_T_MAX ? -1 :
+		(off_t)sstream->object_size;
+	stream->statbuf.st_mtime = sstream->file->mtime;
+	return 0;
+}
+
+static void i_stream_s3_close(struct iostream_private *stream,
+			      bool close_parent ATTR_UNUSED)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream.iostream);
+
+	s3_istream_abort_parts(sstream);
+}
+
+static void i_stream_s3_destroy(struct iostream_private *stream)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream.iostream);
+
+	s3_istream_abort_parts(sstream);
+	array_free(&sstream->parts);
+	i_free(sstream->path);
+	i_free(sstream->error);
+	i_stream_free_buffer(&sstream->istream);
+}
+
+struct istream *
+i_stream_create_s3(struct s3_fs_file *file, size_t max_buffer_size)
+{
+	struct s3_istream *sstream;
+	struct istream *input;
+
+	sstream = i_new(struct s3_istream, 1);
+	sstream->file = file;
+	sstream->path = i_strdup(fs_s3_get_object_path(file->fs,
+							   file->file.path));
+	sstream->object_size = UOFF_T_MAX;
+	i_array_init(&sstream->parts, file->fs->max_parallel);
+
+	sstream->istream.max_buffer_size = max_buffer_size;
+	sstream->istream.read = i_stream_s3_read;
+	sstream->istream.stat = i_stream_s3_stat;
+	sstream->istream.iostream.close = i_stream_s3_close;
+	sstream->istream.iostream.destroy = i_stream_s3_destroy;
+	sstream->istream.istream.readable_fd = FALSE;
+	sstream->istream.istream.blocking = FALSE;
+	sstream->istream.istream.seekable = FALSE;
+
+	input = i_stream_create(&sstream->istream, NULL, -1, 0);
+	i_stream_set_name(input, sstream->path);
+	s3_istream_schedule_parts(sstream);
+	return input;
+}
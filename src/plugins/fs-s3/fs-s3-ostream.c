@@ -0,0 +1,488 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "ostream-private.h"
+#include "http-response.h"
+#include "fs-s3-private.h"
+
+/* Objects that fit into a single part are written with a single PUT.
+   Larger objects are written with a multipart upload, where each part is
+   uploaded as soon as part_size bytes have been written. Up to max_parallel
+   parts are uploaded at the same time. Writing to the stream blocks when
+   the limit is reached until one of the uploads finishes. */
+
+struct s3_fs_upload_part {
+	struct s3_fs_upload *upload;
+	unsigned int number;
+	struct s3_fs_request *sreq;
+	/* part data waiting for the multipart upload to be created */
+	buffer_t *pending_data;
+	char *etag;
+};
+
+struct s3_fs_upload {
+	struct s3_fs_file *file;
+	char *path;
+
+	/* data for the part currently being written */
+	buffer_t *buf;
+
+	/* request creating the multipart upload */
+	struct s3_fs_request *create_req;
+	char *upload_id;
+	ARRAY(struct s3_fs_upload_part *) parts;
+	/* number of parts not finished yet */
+	unsigned int parts_pending;
+
+	/* the single PUT or the multipart upload completion */
+	struct s3_fs_request *finish_req;
+
+	int error_errno;
+	char *error;
+
+	bool finishing:1;
+	bool finish_sent:1;
+	bool finished:1;
+};
+
+struct s3_ostream {
+	struct ostream_private ostream;
+	struct s3_fs_upload *upload;
+};
+
+static int fs_s3_upload_try_finish(struct s3_fs_upload *upload);
+
+static void
+fs_s3_upload_set_error(struct s3_fs_upload *upload, int error_errno,
+		       const char *error)
+{
+	if (upload->error != NULL)
+		return;
+	upload->error_errno = error_errno;
+	upload->error = i_strdup(error);
+}
+
+static void
+fs_s3_upload_set_request_error(struct s3_fs_upload *upload,
+			       struct s3_fs_request *sreq, const char *method)
+{
+	fs_s3_upload_set_error(upload, sreq->error_errno,
+		t_strdup_printf("%s %s failed: %s", method, upload->path,
+				sreq->error));
+}
+
+static void fs_s3_upload_request_finished(struct s3_fs_upload *upload)
+{
+	if (upload->finishing) {
+		(void)fs_s3_upload_try_finish(upload);
+		fs_s3_file_async_callback(upload->file);
+	}
+}
+
+static void
+fs_s3_upload_get_headers(struct s3_fs_upload *upload,
+			 ARRAY_TYPE(s3_sigv4_header) *headers)
+{
+	struct s3_fs_file *file = upload->file;
+	const struct fs_metadata *md;
+	struct s3_sigv4_header *hdr;
+
+	t_array_init(headers, 8);
+	if (file->open_mode == FS_OPEN_MODE_CREATE) {
+		/* fail with 412 if the object already exists */
+		hdr = array_append_space(headers);
+		hdr->name = "if-none-match";
+		hdr->value = "*";
+	}
+	if (!array_is_created(&file->file.metadata))
+		return;
+	array_foreach(&file->file.metadata, md) {
+		if (str_begins_with(md->key, FS_METADATA_INTERNAL_PREFIX))
+			continue;
+		hdr = array_append_space(headers);
+		hdr->name = t_str_lcase(t_strconcat("x-amz-meta-",
+						    md->key, NULL));
+		hdr->value = md->value;
+	}
+}
+
+static void fs_s3_upload_apply_write_fname(struct s3_fs_upload *upload)
+{
+	struct fs_file *file = &upload->file->file;
+	const char *new_fname;
+
+	new_fname = fs_metadata_find(&file->metadata, FS_METADATA_WRITE_FNAME);
+	if (new_fname == NULL)
+		return;
+
+	i_free(file->path);
+	file->path = i_strdup(new_fname);
+	i_free(upload->path);
+	upload->path = i_strdup(fs_s3_get_object_path(upload->file->fs,
+						       file->path));
+}
+
+static void
+fs_s3_upload_part_response(struct s3_fs_request *sreq,
+			   const struct http_response *response)
+{
+	struct s3_fs_upload_part *part = sreq->context;
+	const char *etag;
+
+	etag = http_response_header_get(response, "ETag");
+	if (etag != NULL && response->status / 100 == 2)
+		part->etag = i_strdup(etag);
+}
+
+static void fs_s3_upload_part_finished(struct s3_fs_request *sreq)
+{
+	struct s3_fs_upload_part *part = sreq->context;
+	struct s3_fs_upload *upload = part->upload;
+
+	part->sreq = NULL;
+	i_assert(upload->parts_pending > 0);
+	upload->parts_pending--;
+
+	if (!fs_s3_request_is_success(sreq))
+		fs_s3_upload_set_request_error(upload, sreq, "PUT");
+	else if (part->etag == NULL) {
+		fs_s3_upload_set_error(upload, EIO, t_strdup_printf(
+			"PUT %s part %u failed: ETag missing from response",
+			upload->path, part->number));
+	}
+	fs_s3_upload_request_finished(upload);
+}
+
+static void
+fs_s3_upload_send_part(struct s3_fs_upload *upload,
+		       struct s3_fs_upload_part *part)
+{
+	struct s3_fs *fs = upload->file->fs;
+	string_t *query = t_str_new(128);
+
+	i_assert(upload->upload_id != NULL);
+
+	str_printfa(query, "partNumber=%u&uploadId=", part->number);
+	s3_sigv4_uri_encode(query, upload->upload_id, TRUE);
+
+	part->sreq = fs_s3_request_init(fs, upload->file->file.event, "PUT",
+					upload->path, str_c(query), NULL,
+					part->pending_data);
+	part->pending_data = NULL;
+	part->sreq->response_callback = fs_s3_upload_part_response;
+	part->sreq->callback = fs_s3_upload_part_finished;
+	part->sreq->context = part;
+	fs_s3_request_submit(part->sreq);
+}
+
+static void fs_s3_upload_create_finished(struct s3_fs_request *sreq)
+{
+	struct s3_fs_upload *upload = sreq->context;
+	struct s3_fs_upload_part *part;
+	const char *upload_id;
+	size_t pos = 0;
+
+	upload->create_req = NULL;
+	if (!fs_s3_request_is_success(sreq)) {
+		fs_s3_upload_set_request_error(upload, sreq, "POST");
+	} else if ((upload_id = fs_s3_xml_next_value(sreq->payload, &pos,
+						     "UploadId")) == NULL) {
+		fs_s3_upload_set_error(upload, EIO, t_strdup_printf(
+			"POST %s failed: UploadId missing from response",
+			upload->path));
+	} else {
+		upload->upload_id = i_strdup(upload_id);
+	}
+
+	array_foreach_elem(&upload->parts, part) {
+		if (part->pending_data == NULL)
+			continue;
+		if (upload->error == NULL)
+			fs_s3_upload_send_part(upload, part);
+		else {
+			buffer_free(&part->pending_data);
+			upload->parts_pending--;
+		}
+	}
+	fs_s3_upload_request_finished(upload);
+}
+
+static void fs_s3_upload_create(struct s3_fs_upload *upload)
+{
+	ARRAY_TYPE(s3_sigv4_header) headers;
+
+	fs_s3_upload_apply_write_fname(upload);
+	fs_s3_upload_get_headers(upload, &headers);
+	upload->create_req = fs_s3_request_init(upload->file->fs,
+		upload->file->file.event, "POST", upload->path, "uploads=",
+		&headers, NULL);
+	upload->create_req->callback = fs_s3_upload_create_finished;
+	upload->create_req->context = upload;
+	fs_s3_request_submit(upload->create_req);
+}
+
+static void fs_s3_upload_add_part(struct s3_fs_upload *upload, size_t size)
+{
+	struct s3_fs_upload_part *part;
+
+	i_assert(size <= upload->buf->used);
+
+	if (array_count(&upload->parts) == FS_S3_MAX_PARTS) {
+		fs_s3_upload_set_error(upload, EFBIG, t_strdup_printf(
+			"PUT %s failed: Too many parts (max %u)",
+			upload->path, FS_S3_MAX_PARTS));
+		return;
+	}
+	if (upload->upload_id == NULL && upload->create_req == NULL)
+		fs_s3_upload_create(upload);
+
+	part = i_new(struct s3_fs_upload_part, 1);
+	part->upload = upload;
+	part->number = array_count(&upload->parts) + 1;
+	part->pending_data = buffer_create_dynamic(default_pool, size);
+	buffer_append(part->pending_data, upload->buf->data, size);
+	buffer_delete(upload->buf, 0, size);
+	array_push_back(&upload->parts, &part);
+	upload->parts_pending++;
+
+	if (upload->upload_id != NULL)
+		fs_s3_upload_send_part(upload, part);
+}
+
+static void fs_s3_upload_complete_finished(struct s3_fs_request *sreq)
+{
+	struct s3_fs_upload *upload = sreq->context;
+	const char *code;
+	size_t pos = 0;
+
+	upload->finish_req = NULL;
+	if (!fs_s3_request_is_success(sreq)) {
+		fs_s3_upload_set_request_error(upload, sreq,
+			upload->upload_id == NULL ? "PUT" : "POST");
+	} else if (upload->upload_id != NULL &&
+		   (code = fs_s3_xml_next_value(sreq->payload, &pos,
+						"Code")) != NULL) {
+		/* completion can fail after a 200 response has already
+		   been sent */
+		fs_s3_upload_set_error(upload, EIO, t_strdup_printf(
+			"POST %s failed: %s", upload->path, code));
+	} else {
+		upload->finished = TRUE;
+		i_free(upload->upload_id);
+	}
+	fs_s3_upload_request_finished(upload);
+}
+
+static void fs_s3_upload_send_complete(struct s3_fs_upload *upload)
+{
+	struct s3_fs_upload_part *part;
+	ARRAY_TYPE(s3_sigv4_header) headers;
+	string_t *query = t_str_new(128);
+	string_t *payload;
+
+	payload = str_new(default_pool, 64 + array_count(&upload->parts) * 96);
+	str_append(payload, "<CompleteMultipartUpload>");
+	array_foreach_elem(&upload->parts, part) {
+		str_printfa(payload, "<Part><PartNumber>%u</PartNumber>"
+			    "<ETag>%s</ETag></Part>", part->number, part->etag);
+	}
+	str_append(payload, "</CompleteMultipartUpload>");
+
+	str_append(query, "uploadId=");
+	s3_sigv4_uri_encode(query, upload->upload_id, TRUE);
+
+	t_array_init(&headers, 1);
+	if (upload->file->open_mode == FS_OPEN_MODE_CREATE) {
+		struct s3_sigv4_header *hdr = array_append_space(&headers);
+		hdr->name = "if-none-match";
+		hdr->value = "*";
+	}
+	upload->finish_req = fs_s3_request_init(upload->file->fs,
+		upload->file->file.event, "POST", upload->path, str_c(query),
+		&headers, payload);
+	upload->finish_req->callback = fs_s3_upload_complete_finished;
+	upload->finish_req->context = upload;
+	fs_s3_request_submit(upload->finish_req);
+}
+
+static void fs_s3_upload_send_single(struct s3_fs_upload *upload)
+{
+	ARRAY_TYPE(s3_sigv4_header) headers;
+	buffer_t *payload = upload->buf;
+
+	upload->buf = NULL;
+	fs_s3_upload_apply_write_fname(upload);
+	fs_s3_upload_get_headers(upload, &headers);
+	upload->finish_req = fs_s3_request_init(upload->file->fs,
+		upload->file->file.event, "PUT", upload->path, "",
+		&headers, payload);
+	upload->finish_req->callback = fs_s3_upload_complete_finished;
+	upload->finish_req->context = upload;
+	fs_s3_request_submit(upload->finish_req);
+}
+
+/* Returns 1 if the upload is finished, 0 if it's still in progress and
+   -1 on failure. */
+static int fs_s3_upload_try_finish(struct s3_fs_upload *upload)
+{
+	if (upload->error != NULL)
+		return -1;
+	if (upload->finished)
+		return 1;
+	if (upload->finish_sent)
+		return 0;
+
+	if (array_count(&upload->parts) == 0) {
+		/* everything fits into a single PUT */
+		upload->finish_sent = TRUE;
+		fs_s3_upload_send_single(upload);
+		return 0;
+	}
+	if (upload->buf->used > 0) {
+		fs_s3_upload_add_part(upload, upload->buf->used);
+		if (upload->error != NULL)
+			return -1;
+	}
+	if (upload->create_req != NULL || upload->parts_pending > 0)
+		return 0;
+	upload->finish_sent = TRUE;
+	fs_s3_upload_send_complete(upload);
+	return 0;
+}
+
+static ssize_t
+o_stream_s3_sendv(struct ostream_private *stream,
+		  const struct const_iovec *iov, unsigned int iov_count)
+{
+	struct s3_ostream *sstream =
+		container_of(stream, struct s3_ostream, ostream);
+	struct s3_fs_upload *upload = sstream->upload;
+	struct s3_fs *fs = upload->file->fs;
+	size_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < iov_count; i++) {
+		buffer_append(upload->buf, iov[i].iov_base, iov[i].iov_len);
+		total += iov[i].iov_len;
+	}
+	while (upload->buf->used >= fs->part_size && upload->error == NULL) {
+		fs_s3_upload_add_part(upload, fs->part_size);
+		/* don't buffer more than max_parallel parts in memory */
+		while (upload->parts_pending >= fs->max_parallel &&
+		       upload->error == NULL)
+			fs_s3_wait_async(&fs->fs);
+	}
+	if (upload->error != NULL) {
+		io_stream_set_error(&stream->iostream, "%s", upload->error);
+		stream->ostream.stream_errno = upload->error_errno;
+		return -1;
+	}
+	stream->ostream.offset += total;
+	return total;
+}
+
+void fs_s3_write_stream(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct s3_fs_upload *upload;
+	struct s3_ostream *sstream;
+
+	i_assert(_file->output == NULL);
+	i_assert(file->upload == NULL);
+
+	upload = i_new(struct s3_fs_upload, 1);
+	upload->file = file;
+	upload->path = i_strdup(fs_s3_get_object_path(file->fs,
+						       _file->path));
+	upload->buf = buffer_create_dynamic(default_pool,
+		I_MIN(file->fs->part_size, IO_BLOCK_SIZE * 16));
+	i_array_init(&upload->parts, 8);
+	file->upload = upload;
+
+	sstream = i_new(struct s3_ostream, 1);
+	sstream->upload = upload;
+	sstream->ostream.sendv = o_stream_s3_sendv;
+	sstream->ostream.max_buffer_size = SIZE_MAX;
+	_file->output = o_stream_create(&sstream->ostream, NULL, -1);
+	o_stream_set_name(_file->output, upload->path);
+}
+
+int fs_s3_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct s3_fs_upload *upload = file->upload;
+	int ret;
+
+	if (_file->output != NULL)
+		o_stream_destroy(&_file->output);
+	if (!success) {
+		fs_s3_upload_free(&file->upload);
+		return -1;
+	}
+
+	upload->finishing = TRUE;
+	while ((ret = fs_s3_upload_try_finish(upload)) == 0) {
+		if ((_file->flags & FS_OPEN_FLAG_ASYNC) != 0) {
+			fs_file_set_error_async(_file);
+			return 0;
+		}
+		fs_s3_wait_async(&file->fs->fs);
+	}
+	if (ret < 0) {
+		fs_set_error(_file->event, upload->error_errno, "%s",
+			     upload->error);
+	}
+	fs_s3_upload_free(&file->upload);
+	return ret;
+}
+
+static void fs_s3_upload_abort_finished(struct s3_fs_request *sreq)
+{
+	if (!fs_s3_request_is_success(sreq) && sreq->status != 404) {
+		e_error(sreq->event, "Failed to abort multipart upload: %s",
+			sreq->error);
+	}
+}
+
+void fs_s3_upload_free(struct s3_fs_upload **_upload)
+{
+	struct s3_fs_upload *upload = *_upload;
+	struct s3_fs_upload_part *part;
+	struct s3_fs_request *sreq;
+	string_t *query;
+
+	if (upload == NULL)
+		return;
+	*_upload = NULL;
+
+	fs_s3_request_abort(&upload->create_req);
+	fs_s3_request_abort(&upload->finish_req);
+	array_foreach_elem(&upload->parts, part) {
+		fs_s3_request_abort(&part->sreq);
+		buffer_free(&part->pending_data);
+		i_free(part->etag);
+		i_free(part);
+	}
+	if (upload->upload_id != NULL) {
+		/* remove the uploaded parts. The request isn't tied to the
+		   file, so it's finished in the background. */
+		query = t_str_new(128);
+		str_append(query, "uploadId=");
+		s3_sigv4_uri_encode(query, upload->upload_id, TRUE);
+		sreq = fs_s3_request_init(upload->file->fs,
+					  upload->file->fs->fs.event, "DELETE",
+					  upload->path, str_c(query),
+					  NULL, NULL);
+		sreq->callback = fs_s3_upload_abort_finished;
+		fs_s3_request_submit(sreq);
+	}
+	array_free(&upload->parts);
+	buffer_free(&upload->buf);
+	i_free(upload->upload_id);
+	i_free(upload->error);
+	i_free(upload->path);
+	i_free(upload);
+}
@@ -0,0 +1,165 @@
+#ifndef FS_S3_PRIVATE_H
+#define FS_S3_PRIVATE_H
+
+#include "fs-api-private.h"
+#include "s3-sigv4.h"
+
+struct http_response;
+struct s3_fs_request;
+struct s3_fs_upload;
+
+/* S3 requires all multipart upload parts except the last one to be at
+   least 5 MB. */
+#define FS_S3_MIN_PART_SIZE (5*1024*1024)
+#define FS_S3_MAX_PART_SIZE (1024*1024*1024)
+#define FS_S3_MAX_PARTS 10000
+
+#define S3_FS(ptr)	container_of((ptr), struct s3_fs, fs)
+#define S3_FILE(ptr)	container_of((ptr), struct s3_fs_file, file)
+
+ARRAY_DEFINE_TYPE(s3_sigv4_header, struct s3_sigv4_header);
+
+typedef void fs_s3_request_callback_t(struct s3_fs_request *sreq);
+typedef void
+fs_s3_response_callback_t(struct s3_fs_request *sreq,
+			  const struct http_response *response);
+
+struct s3_fs {
+	struct fs fs;
+	pool_t pool;
+	struct http_client *client;
+	struct s3_sigv4_credentials creds;
+
+	const char *host_name;
+	in_port_t port;
+	bool ssl;
+	/* value for the Host header, i.e. host[:port] */
+	const char *host;
+	/* encoded path to the bucket root, without trailing '/'. Empty with
+	   virtual-hosted style URLs. */
+	const char *bucket_path;
+	/* bucket name, NULL if not known. Needed for server side copying. */
+	const char *bucket;
+	/* object key prefix */
+	const char *key_prefix;
+
+	/* size of multipart upload parts and ranged GET requests */
+	size_t part_size;
+	/* max number of parts uploaded or downloaded in parallel per file */
+	unsigned int max_parallel;
+
+	/* all requests in progress */
+	struct s3_fs_request *requests;
+	bool waiting:1;
+};
+
+struct s3_fs_file {
+	struct fs_file file;
+	struct s3_fs *fs;
+	enum fs_open_mode open_mode;
+
+	fs_file_async_callback_t *async_callback;
+	void *async_context;
+
+	/* stream started by fs_prefetch() */
+	struct istream *prefetch_input;
+	struct s3_fs_upload *upload;
+
+	uoff_t size;
+	time_t mtime;
+	/* HEAD request was done successfully */
+	bool head_done:1;
+};
+
+struct s3_fs_request {
+	struct s3_fs_request *prev, *next;
+	struct s3_fs *fs;
+	struct event *event;
+	struct http_client_request *http_req;
+
+	/* HTTP response status, 0 if the request hasn't finished */
+	unsigned int status;
+	/* error message if the request failed */
+	char *error;
+	/* errno for the failure */
+	int error_errno;
+
+	/* request payload, owned by the request */
+	buffer_t *request_payload;
+	/* response payload, owned by the request unless taken over by
+	   the callback (set to NULL) */
+	buffer_t *payload;
+	struct istream *payload_input;
+	struct io *io;
+
+	/* called with the response headers before the payload is read */
+	fs_s3_response_callback_t *response_callback;
+	/* called once when the request is finished, successfully or not */
+	fs_s3_request_callback_t *callback;
+	void *context;
+};
+
+struct s3_fs_request_result {
+	unsigned int status;
+	/* error message if the request failed or returned non-2xx */
+	const char *error;
+	int error_errno;
+	/* response headers with lowercased names */
+	ARRAY_TYPE(s3_sigv4_header) headers;
+	/* response payload, must be freed by the caller */
+	buffer_t *payload;
+};
+
+/* Create a new request. The path and query must be encoded, and the query
+   parameters must be sorted by name. The headers may be NULL. If payload is
+   non-NULL, the request takes over its ownership. The callback must be set
+   before calling fs_s3_request_submit(). */
+struct s3_fs_request *
+fs_s3_request_init(struct s3_fs *fs, struct event *event,
+		   const char *method, const char *path, const char *query,
+		   const ARRAY_TYPE(s3_sigv4_header) *headers,
+		   buffer_t *payload);
+void fs_s3_request_submit(struct s3_fs_request *sreq);
+/* Abort the request without calling its callback. */
+void fs_s3_request_abort(struct s3_fs_request **sreq);
+/* Returns TRUE if the request finished with a 2xx status. */
+bool fs_s3_request_is_success(const struct s3_fs_request *sreq);
+/* Submit the request and wait until it's finished. The result is allocated
+   from data stack. Returns 0 if the request finished with a 2xx status,
+   -1 if not. */
+int fs_s3_request_run(struct s3_fs_request *sreq,
+		      struct s3_fs_request_result *result_r);
+const char *
+fs_s3_request_result_header(const struct s3_fs_request_result *result,
+			    const char *name);
+
+/* Move *pos after the next <name> tag in the XML payload. Returns FALSE if
+   it's not found. */
+bool fs_s3_xml_skip_to(const buffer_t *payload, size_t *pos,
+		       const char *name);
+/* Returns the unescaped text of the next <name> element in the XML payload
+   and moves *pos after it, or NULL if it's not found. */
+const char *fs_s3_xml_next_value(const buffer_t *payload, size_t *pos,
+				 const char *name);
+
+/* Append the value to dest with XML special characters escaped. */
+void fs_s3_xml_append_escaped(string_t *dest, const char *value);
+
+/* Returns the encoded request path for the object key. */
+const char *fs_s3_get_object_path(struct s3_fs *fs, const char *key);
+
+/* Run ioloop until some request finishes. */
+void fs_s3_wait_async(struct fs *fs);
+bool fs_s3_switch_ioloop(struct fs *fs);
+
+/* Call the file's async callback, if any. */
+void fs_s3_file_async_callback(struct s3_fs_file *file);
+
+struct istream *
+i_stream_create_s3(struct s3_fs_file *file, size_t max_buffer_size);
+
+void fs_s3_write_stream(struct fs_file *file);
+int fs_s3_write_stream_finish(struct fs_file *file, bool success);
+void fs_s3_upload_free(struct s3_fs_upload **upload);
+
+#endif
@@ -0,0 +1,451 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "llist.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "http-client.h"
+#include "http-response.h"
+#include "dns-lookup.h"
+#include "fs-s3-private.h"
+
+/* Max size of a response payload that isn't read into a part buffer
+   (error replies, list and multipart upload replies). */
+#define FS_S3_MAX_REPLY_SIZE (16*1024*1024)
+
+struct s3_fs_request_sync_context {
+	pool_t pool;
+	ARRAY_TYPE(s3_sigv4_header) headers;
+
+	unsigned int status;
+	int error_errno;
+	char *error;
+	buffer_t *payload;
+	bool finished;
+};
+
+static void fs_s3_request_free(struct s3_fs_request *sreq)
+{
+	io_remove(&sreq->io);
+	i_stream_unref(&sreq->payload_input);
+	buffer_free(&sreq->request_payload);
+	buffer_free(&sreq->payload);
+	event_unref(&sreq->event);
+	i_free(sreq->error);
+	i_free(sreq);
+}
+
+const char *fs_s3_get_object_path(struct s3_fs *fs, const char *key)
+{
+	string_t *path = t_str_new(128);
+
+	str_append(path, fs->bucket_path);
+	str_append_c(path, '/');
+	s3_sigv4_uri_encode(path, fs->key_prefix, FALSE);
+	s3_sigv4_uri_encode(path, key, FALSE);
+	return str_c(path);
+}
+
+static const unsigned char *
+fs_s3_mem_find(const unsigned char *data, size_t size, const char *needle)
+{
+	size_t needle_len = strlen(needle);
+
+	for (; size >= needle_len; data++, size--) {
+		if (memcmp(data, needle, needle_len) == 0)
+			return data;
+	}
+	return NULL;
+}
+
+bool fs_s3_xml_skip_to(const buffer_t *payload, size_t *pos,
+		       const char *name)
+{
+	const char *tag = t_strdup_printf("<%s>", name);
+	const unsigned char *p;
+
+	if (payload == NULL || *pos >= payload->used)
+		return FALSE;
+	p = fs_s3_mem_find(CONST_PTR_OFFSET(payload->data, *pos),
+			   payload->used - *pos, tag);
+	if (p == NULL)
+		return FALSE;
+	*pos = (p - (const unsigned char *)payload->data) + strlen(tag);
+	return TRUE;
+}
+
+const char *fs_s3_xml_next_value(const buffer_t *payload, size_t *pos,
+				 const char *name)
+{
+	const unsigned char *data, *end;
+	string_t *value;
+	size_t i, size;
+
+	if (!fs_s3_xml_skip_to(payload, pos, name))
+		return NULL;
+	data = CONST_PTR_OFFSET(payload->data, *pos);
+	end = memchr(data, '<', payload->used - *pos);
+	if (end == NULL)
+		return NULL;
+	size = end - data;
+	*pos += size;
+
+	value = t_str_new(size + 1);
+	for (i = 0; i < size; i++) {
+		if (data[i] != '&') {
+			str_append_c(value, data[i]);
+			continue;
+		}
+		if (size - i >= 5 && memcmp(data + i, "&amp;", 5) == 0) {
+			str_append_c(value, '&');
+			i += 4;
+		} else if (size - i >= 4 && memcmp(data + i, "&lt;", 4) == 0) {
+			str_append_c(value, '<');
+			i += 3;
+		} else if (size - i >= 4 && memcmp(data + i, "&gt;", 4) == 0) {
+			str_append_c(value, '>');
+			i += 3;
+		} else if (size - i >= 6 && memcmp(data + i, "&quot;", 6) == 0) {
+			str_append_c(value, '"');
+			i += 5;
+		} else if (size - i >= 6 && memcmp(data + i, "&apos;", 6) == 0) {
+			str_append_c(value, '\'');
+			i += 5;
+		} else {
+			str_append_c(value, data[i]);
+		}
+	}
+	return str_c(value);
+}
+
+void fs_s3_xml_append_escaped(string_t *dest, const char *value)
+{
+	for (; *value != '\0'; value++) {
+		switch (*value) {
+		case '&':
+			str_append(dest, "&amp;");
+			break;
+		case '<':
+			str_append(dest, "&lt;");
+			break;
+		case '>':
+			str_append(dest, "&gt;");
+			break;
+		case '"':
+			str_append(dest, "&quot;");
+			break;
+		case '\'':
+			str_append(dest, "&apos;");
+			break;
+		default:
+			str_append_c(dest, *value);
+			break;
+		}
+	}
+}
+
+static void fs_s3_request_finish(struct s3_fs_request *sreq)
+{
+	struct s3_fs *fs = sreq->fs;
+	const char *code;
+	size_t pos = 0;
+
+	if (sreq->error == NULL && !fs_s3_request_is_success(sreq)) {
+		code = fs_s3_xml_next_value(sreq->payload, &pos, "Code");
+		sreq->error = code == NULL ?
+			i_strdup_printf("HTTP %u", sreq->status) :
+			i_strdup_printf("HTTP %u (%s)", sreq->status, code);
+	}
+	if (sreq->error != NULL && sreq->error_errno == 0) {
+		switch (sreq->status) {
+		case 403:
+			sreq->error_errno = EACCES;
+			break;
+		case 404:
+			sreq->error_errno = ENOENT;
+			break;
+		case 412:
+			sreq->error_errno = EEXIST;
+			break;
+		default:
+			sreq->error_errno = EIO;
+			break;
+		}
+	}
+
+	DLLIST_REMOVE(&fs->requests, sreq);
+	if (fs->waiting)
+		io_loop_stop(current_ioloop);
+	sreq->callback(sreq);
+	fs_s3_request_free(sreq);
+}
+
+static void fs_s3_request_payload_input(struct s3_fs_request *sreq)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(sreq->payload_input,
+					 &data, &size)) > 0) {
+		buffer_append(sreq->payload, data, size);
+		i_stream_skip(sreq->payload_input, size);
+	}
+	if (ret == 0)
+		return;
+
+	if (sreq->payload_input->stream_errno != 0) {
+		i_free(sreq->error);
+		sreq->error = i_strdup_printf("read(%s) failed: %s",
+			i_stream_get_name(sreq->payload_input),
+			i_stream_get_error(sreq->payload_input));
+		sreq->error_errno = sreq->payload_input->stream_errno;
+	}
+	io_remove(&sreq->io);
+	i_stream_unref(&sreq->payload_input);
+	fs_s3_request_finish(sreq);
+}
+
+static void
+fs_s3_request_response(const struct http_response *response,
+		       struct s3_fs_request *sreq)
+{
+	uoff_t size;
+
+	sreq->http_req = NULL;
+	sreq->status = response->status;
+	if (http_response_is_internal_error(response)) {
+		sreq->error = i_strdup(response->reason);
+		sreq->error_errno = EIO;
+	} else if (sreq->response_callback != NULL) {
+		sreq->response_callback(sreq, response);
+	}
+
+	if (response->payload == NULL) {
+		fs_s3_request_finish(sreq);
+		return;
+	}
+	if (http_response_get_payload_size(response, &size) <= 0)
+		size = 1024;
+	else if (size > FS_S3_MAX_REPLY_SIZE &&
+		 size > sreq->fs->part_size) {
+		/* the server didn't honor our Range header */
+		sreq->error = i_strdup_printf(
+			"Response payload is too large (%"PRIuUOFF_T" bytes)",
+			size);
+		sreq->error_errno = EIO;
+		fs_s3_request_finish(sreq);
+		return;
+	}
+	sreq->payload = buffer_create_dynamic(default_pool, size);
+	sreq->payload_input = response->payload;
+	i_stream_ref(sreq->payload_input);
+	sreq->io = io_add_istream(sreq->payload_input,
+				  fs_s3_request_payload_input, sreq);
+	fs_s3_request_payload_input(sreq);
+}
+
+struct s3_fs_request *
+fs_s3_request_init(struct s3_fs *fs, struct event *event,
+		   const char *method, const char *path, const char *query,
+		   const ARRAY_TYPE(s3_sigv4_header) *headers,
+		   buffer_t *payload)
+{
+	struct s3_fs_request *sreq;
+	ARRAY_TYPE(s3_sigv4_header) all_headers;
+	struct s3_sigv4_header *hdr;
+	const char *target, *amz_date, *payload_hash;
+
+	sreq = i_new(struct s3_fs_request, 1);
+	sreq->fs = fs;
+	sreq->event = event_create(event);
+	sreq->request_payload = payload;
+
+	amz_date = s3_sigv4_date(ioloop_time);
+	payload_hash = payload == NULL ?
+		s3_sigv4_payload_hash("", 0) :
+		s3_sigv4_payload_hash(payload->data, payload->used);
+
+	t_array_init(&all_headers, 8);
+	if (headers != NULL)
+		array_append_array(&all_headers, headers);
+	hdr = array_append_space(&all_headers);
+	hdr->name = "host";
+	hdr->value = fs->host;
+	hdr = array_append_space(&all_headers);
+	hdr->name = "x-amz-date";
+	hdr->value = amz_date;
+	hdr = array_append_space(&all_headers);
+	hdr->name = "x-amz-content-sha256";
+	hdr->value = payload_hash;
+
+	target = query[0] == '\0' ? path :
+		t_strdup_printf("%s?%s", path, query);
+	sreq->http_req = http_client_request(fs->client, method,
+		fs->host_name, target, fs_s3_request_response, sreq);
+	http_client_request_set_port(sreq->http_req, fs->port);
+	http_client_request_set_ssl(sreq->http_req, fs->ssl);
+	http_client_request_set_event(sreq->http_req, sreq->event);
+	array_foreach_modifiable(&all_headers, hdr) {
+		http_client_request_add_header(sreq->http_req, hdr->name,
+					       hdr->value);
+	}
+	http_client_request_add_header(sreq->http_req, "Authorization",
+		s3_sigv4_get_authorization(&fs->creds, method, path, query,
+					   array_front(&all_headers),
+					   array_count(&all_headers),
+					   amz_date, payload_hash));
+	if (payload != NULL) {
+		struct istream *input =
+			i_stream_create_from_buffer(payload);
+		http_client_request_set_payload(sreq->http_req, input, FALSE);
+		i_stream_unref(&input);
+	}
+	DLLIST_PREPEND(&fs->requests, sreq);
+	return sreq;
+}
+
+void fs_s3_request_submit(struct s3_fs_request *sreq)
+{
+	i_assert(sreq->callback != NULL);
+	http_client_request_submit(sreq->http_req);
+}
+
+void fs_s3_request_abort(struct s3_fs_request **_sreq)
+{
+	struct s3_fs_request *sreq = *_sreq;
+
+	if (sreq == NULL)
+		return;
+	*_sreq = NULL;
+
+	DLLIST_REMOVE(&sreq->fs->requests, sreq);
+	if (sreq->http_req != NULL)
+		http_client_request_abort(&sreq->http_req);
+	fs_s3_request_free(sreq);
+}
+
+bool fs_s3_request_is_success(const struct s3_fs_request *sreq)
+{
+	return sreq->error == NULL && sreq->status / 100 == 2;
+}
+
+static void
+fs_s3_request_sync_response(struct s3_fs_request *sreq,
+			    const struct http_response *response)
+{
+	struct s3_fs_request_sync_context *ctx = sreq->context;
+	const struct http_header_field *field;
+	struct s3_sigv4_header *hdr;
+	const ARRAY_TYPE(http_header_field) *fields;
+
+	fields = http_response_header_get_fields(response);
+	if (fields == NULL)
+		return;
+	array_foreach(fields, field) {
+		hdr = array_append_space(&ctx->headers);
+		hdr->name = p_strdup(ctx->pool, t_str_lcase(field->name));
+		hdr->value = p_strdup(ctx->pool, field->value);
+	}
+}
+
+static void fs_s3_request_sync_finished(struct s3_fs_request *sreq)
+{
+	struct s3_fs_request_sync_context *ctx = sreq->context;
+
+	ctx->finished = TRUE;
+	ctx->status = sreq->status;
+	ctx->error_errno = sreq->error_errno;
+	ctx->error = p_strdup(ctx->pool, sreq->error);
+	ctx->payload = sreq->payload;
+	sreq->payload = NULL;
+}
+
+int fs_s3_request_run(struct s3_fs_request *sreq,
+		      struct s3_fs_request_result *result_r)
+{
+	struct s3_fs *fs = sreq->fs;
+	struct s3_fs_request_sync_context ctx;
+	const struct s3_sigv4_header *hdr;
+	struct s3_sigv4_header *new_hdr;
+
+	i_zero(&ctx);
+	ctx.pool = pool_alloconly_create("s3 request result", 1024);
+	p_array_init(&ctx.headers, ctx.pool, 16);
+
+	i_assert(sreq->response_callback == NULL);
+	sreq->response_callback = fs_s3_request_sync_response;
+	sreq->callback = fs_s3_request_sync_finished;
+	sreq->context = &ctx;
+	fs_s3_request_submit(sreq);
+
+	while (!ctx.finished)
+		fs_s3_wait_async(&fs->fs);
+
+	i_zero(result_r);
+	result_r->status = ctx.status;
+	result_r->error_errno = ctx.error_errno;
+	result_r->error = t_strdup(ctx.error);
+	result_r->payload = ctx.payload;
+	t_array_init(&result_r->headers, array_count(&ctx.headers) + 1);
+	array_foreach(&ctx.headers, hdr) {
+		new_hdr = array_append_space(&result_r->headers);
+		new_hdr->name = t_strdup(hdr->name);
+		new_hdr->value = t_strdup(hdr->value);
+	}
+	pool_unref(&ctx.pool);
+	return result_r->error == NULL &&
+		result_r->status / 100 == 2 ? 0 : -1;
+}
+
+const char *
+fs_s3_request_result_header(const struct s3_fs_request_result *result,
+			    const char *name)
+{
+	const struct s3_sigv4_header *hdr;
+
+	array_foreach(&result->headers, hdr) {
+		if (strcasecmp(hdr->name, name) == 0)
+			return hdr->value;
+	}
+	return NULL;
+}
+
+bool fs_s3_switch_ioloop(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+	struct s3_fs_request *sreq;
+
+	(void)http_client_switch_ioloop(fs->client);
+	if (fs->fs.set.dns_client != NULL)
+		dns_client_switch_ioloop(fs->fs.set.dns_client);
+	for (sreq = fs->requests; sreq != NULL; sreq = sreq->next) {
+		if (sreq->io != NULL)
+			sreq->io = io_loop_move_io(&sreq->io);
+	}
+	return fs->requests != NULL;
+}
+
+void fs_s3_wait_async(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+	struct ioloop *prev_ioloop = current_ioloop, *ioloop;
+	bool prev_waiting = fs->waiting;
+
+	if (fs->requests == NULL)
+		return;
+
+	ioloop = io_loop_create();
+	(void)fs_s3_switch_ioloop(_fs);
+	fs->waiting = TRUE;
+	io_loop_run(ioloop);
+	fs->waiting = prev_waiting;
+
+	io_loop_set_current(prev_ioloop);
+	(void)fs_s3_switch_ioloop(_fs);
+	io_loop_set_current(ioloop);
+	io_loop_destroy(&ioloop);
+}
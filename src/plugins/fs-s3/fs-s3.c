@@ -0,0 +1,854 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "md5.h"
+#include "base64.h"
+#include "str-parse.h"
+#include "guid.h"
+#include "llist.h"
+#include "istream.h"
+#include "http-url.h"
+#include "http-date.h"
+#include "http-client.h"
+#include "fs-s3-private.h"
+
+/* Driver for Amazon S3 compatible object storages:
+
+   s3:[key=value:...]<url>
+
+   The url is either a path-style URL with the bucket as the first path
+   component (https://s3.example.com/bucket) or a virtual-hosted style URL
+   (https://bucket.s3.example.com/). Supported keys:
+
+   access_key, secret_key: credentials used for signing the requests
+   region: region used for signing the requests (default: us-east-1)
+   bucket: bucket name, needed for server side copying with virtual-hosted
+     style URLs (default: the first path component of the URL)
+   prefix: prefix added to all object keys
+   part_size: size of multipart upload parts and ranged reads (default: 8M)
+   max_parallel: max number of parts transferred in parallel for a single
+     file (default: 4)
+   timeout_msecs: HTTP request timeout (default: 30000)
+*/
+
+#define FS_S3_DEFAULT_REGION "us-east-1"
+#define FS_S3_DEFAULT_PART_SIZE (8*1024*1024)
+#define FS_S3_DEFAULT_MAX_PARALLEL 4
+#define FS_S3_DEFAULT_TIMEOUT_MSECS (30*1000)
+#define FS_S3_HTTP_MAX_PARALLEL_CONNECTIONS_PER_PART 2
+/* max number of keys in a single DeleteObjects request */
+#define FS_S3_DELETE_MAX_KEYS 1000
+
+struct s3_fs_iter {
+	struct fs_iter iter;
+	char *prefix;
+	char *continuation_token;
+
+	/* ListObjectsV2 request in progress */
+	struct s3_fs_request *list_req;
+
+	/* names of the page being returned */
+	ARRAY_TYPE(const_string) names;
+	pool_t names_pool;
+	unsigned int names_idx;
+	/* names of the next page, filled by list_req */
+	ARRAY_TYPE(const_string) next_names;
+	pool_t next_names_pool;
+
+	bool next_names_ready;
+	bool truncated;
+	bool failed;
+};
+
+extern const struct fs fs_class_s3;
+
+static struct fs *fs_s3_alloc(void)
+{
+	struct s3_fs *fs;
+
+	fs = i_new(struct s3_fs, 1);
+	fs->fs = fs_class_s3;
+	fs->pool = pool_alloconly_create("s3 fs", 1024);
+	return &fs->fs;
+}
+
+static int
+fs_s3_parse_arg(struct s3_fs *fs, const char *key, const char *value,
+		unsigned int *timeout_msecs_r, const char **error_r)
+{
+	uoff_t size;
+	const char *error;
+
+	if (strcmp(key, "access_key") == 0)
+		fs->creds.access_key = p_strdup(fs->pool, value);
+	else if (strcmp(key, "secret_key") == 0)
+		fs->creds.secret_key = p_strdup(fs->pool, value);
+	else if (strcmp(key, "region") == 0)
+		fs->creds.region = p_strdup(fs->pool, value);
+	else if (strcmp(key, "bucket") == 0)
+		fs->bucket = p_strdup(fs->pool, value);
+	else if (strcmp(key, "prefix") == 0)
+		fs->key_prefix = p_strdup(fs->pool, value);
+	else if (strcmp(key, "part_size") == 0) {
+		if (str_parse_get_size(value, &size, &error) < 0) {
+			*error_r = t_strdup_printf("Invalid part_size: %s",
+						   error);
+			return -1;
+		}
+		if (size < FS_S3_MIN_PART_SIZE || size > FS_S3_MAX_PART_SIZE) {
+			*error_r = t_strdup_printf(
+				"part_size must be between %u and %u bytes",
+				FS_S3_MIN_PART_SIZE, FS_S3_MAX_PART_SIZE);
+			return -1;
+		}
+		fs->part_size = size;
+	} else if (strcmp(key, "max_parallel") == 0) {
+		if (str_to_uint(value, &fs->max_parallel) < 0 ||
+		    fs->max_parallel == 0) {
+			*error_r = t_strdup_printf(
+				"Invalid max_parallel: %s", value);
+			return -1;
+		}
+	} else if (strcmp(key, "timeout_msecs") == 0) {
+		if (str_to_uint(value, timeout_msecs_r) < 0) {
+			*error_r = t_strdup_printf(
+				"Invalid timeout_msecs: %s", value);
+			return -1;
+		}
+	} else {
+		*error_r = t_strdup_printf("Unknown parameter: %s", key);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fs_s3_init(struct fs *_fs, const char *args, const struct fs_settings *set,
+	   const char **error_r)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+	struct http_client_settings http_set;
+	struct http_url *url;
+	const char *p, *arg, *value, *error;
+	unsigned int timeout_msecs = FS_S3_DEFAULT_TIMEOUT_MSECS;
+
+	fs->part_size = FS_S3_DEFAULT_PART_SIZE;
+	fs->max_parallel = FS_S3_DEFAULT_MAX_PARALLEL;
+
+	while (!str_begins_with(args, "http://") &&
+	       !str_begins_with(args, "https://")) {
+		p = strchr(args, ':');
+		if (p == NULL) {
+			*error_r = "URL missing from args";
+			return -1;
+		}
+		arg = t_strdup_until(args, p);
+		args = p + 1;
+
+		value = strchr(arg, '=');
+		if (value == NULL) {
+			*error_r = t_strdup_printf(
+				"Invalid parameter (missing '='): %s", arg);
+			return -1;
+		}
+		if (fs_s3_parse_arg(fs, t_strdup_until(arg, value), value + 1,
+				    &timeout_msecs, error_r) < 0)
+			return -1;
+	}
+	if (fs->creds.access_key == NULL || fs->creds.secret_key == NULL) {
+		*error_r = "access_key and secret_key parameters are required";
+		return -1;
+	}
+	if (fs->creds.region == NULL)
+		fs->creds.region = FS_S3_DEFAULT_REGION;
+	fs->creds.service = "s3";
+	if (fs->key_prefix == NULL)
+		fs->key_prefix = "";
+
+	if (http_url_parse(args, NULL, 0, pool_datastack_create(),
+			   &url, &error) < 0) {
+		*error_r = t_strdup_printf("Invalid URL %s: %s", args, error);
+		return -1;
+	}
+	fs->host_name = p_strdup(fs->pool, url->host.name);
+	fs->port = http_url_get_port(url);
+	fs->ssl = url->have_ssl;
+	fs->host = url->port == 0 ? p_strdup(fs->pool, url->host.name) :
+		p_strdup_printf(fs->pool, "%s:%u", url->host.name, url->port);
+	/* the path is already encoded */
+	value = t_str_trim(url->path == NULL ? "" : url->path, "/");
+	fs->bucket_path = value[0] == '\0' ? "" :
+		p_strconcat(fs->pool, "/", value, NULL);
+	if (fs->bucket == NULL && value[0] != '\0' &&
+	    strchr(value, '/') == NULL)
+		fs->bucket = p_strdup(fs->pool, value);
+
+	i_zero(&http_set);
+	http_set.dns_client = set->dns_client;
+	http_set.ssl = set->ssl_client_set;
+	http_set.max_idle_time_msecs = 5*1000;
+	/* keep the connections open for the parallel part transfers */
+	http_set.max_parallel_connections = fs->max_parallel *
+		FS_S3_HTTP_MAX_PARALLEL_CONNECTIONS_PER_PART;
+	http_set.max_pipelined_requests = 1;
+	http_set.max_attempts = 3;
+	http_set.request_timeout_msecs = timeout_msecs;
+	http_set.event_parent = _fs->event;
+	http_set.debug = set->debug;
+	fs->client = http_client_init(&http_set);
+	return 0;
+}
+
+static void fs_s3_free(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+
+	while (fs->requests != NULL) {
+		struct s3_fs_request *sreq = fs->requests;
+
+		fs_s3_request_abort(&sreq);
+	}
+	if (fs->client != NULL)
+		http_client_deinit(&fs->client);
+	pool_unref(&fs->pool);
+	i_free(fs);
+}
+
+static enum fs_properties fs_s3_get_properties(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+	enum fs_properties props =
+		FS_PROPERTY_METADATA | FS_PROPERTY_STAT | FS_PROPERTY_ITER |
+		FS_PROPERTY_ASYNC;
+
+	if (fs->bucket != NULL)
+		props |= FS_PROPERTY_FASTCOPY | FS_PROPERTY_COPY_METADATA;
+	return props;
+}
+
+static struct fs_file *fs_s3_file_alloc(void)
+{
+	struct s3_fs_file *file = i_new(struct s3_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_s3_file_init(struct fs_file *_file, const char *path,
+		enum fs_open_mode mode, enum fs_open_flags flags ATTR_UNUSED)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	guid_128_t guid;
+
+	i_assert(mode != FS_OPEN_MODE_APPEND); /* not supported */
+
+	file->fs = S3_FS(_file->fs);
+	file->open_mode = mode;
+	file->mtime = (time_t)-1;
+	if (mode != FS_OPEN_MODE_CREATE_UNIQUE_128)
+		file->file.path = i_strdup(path);
+	else {
+		guid_128_generate(guid);
+		file->file.path = i_strdup_printf("%s/%s", path,
+						  guid_128_to_string(guid));
+	}
+}
+
+static void fs_s3_file_close(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	i_stream_unref(&file->prefetch_input);
+	fs_s3_upload_free(&file->upload);
+}
+
+static void fs_s3_file_deinit(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	i_assert(_file->output == NULL);
+
+	fs_s3_file_close(_file);
+	fs_file_free(_file);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static void
+fs_s3_set_async_callback(struct fs_file *_file,
+			 fs_file_async_callback_t *callback, void *context)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	file->async_callback = callback;
+	file->async_context = context;
+}
+
+void fs_s3_file_async_callback(struct s3_fs_file *file)
+{
+	if (file->async_callback != NULL)
+		file->async_callback(file->async_context);
+}
+
+static void
+fs_s3_file_set_request_error(struct s3_fs_file *file, const char *method,
+			     const struct s3_fs_request_result *result)
+{
+	fs_set_error(file->file.event, result->error_errno, "%s %s failed: %s",
+		     method, fs_s3_get_object_path(file->fs, file->file.path),
+		     result->error);
+}
+
+static int fs_s3_file_head(struct s3_fs_file *file)
+{
+	struct s3_fs_request *sreq;
+	struct s3_fs_request_result result;
+	const struct s3_sigv4_header *hdr;
+	const char *value;
+	int ret;
+
+	if (file->head_done)
+		return 0;
+
+	sreq = fs_s3_request_init(file->fs, file->file.event, "HEAD",
+		fs_s3_get_object_path(file->fs, file->file.path), "",
+		NULL, NULL);
+	ret = fs_s3_request_run(sreq, &result);
+	buffer_free(&result.payload);
+	if (ret < 0) {
+		fs_s3_file_set_request_error(file, "HEAD", &result);
+		return -1;
+	}
+
+	value = fs_s3_request_result_header(&result, "content-length");
+	if (value == NULL || str_to_uoff(value, &file->size) < 0) {
+		fs_set_error(file->file.event, EIO,
+			     "HEAD %s failed: Invalid Content-Length: %s",
+			     fs_s3_get_object_path(file->fs, file->file.path),
+			     value == NULL ? "(missing)" : value);
+		return -1;
+	}
+	value = fs_s3_request_result_header(&result, "last-modified");
+	if (value == NULL ||
+	    !http_date_parse((const unsigned char *)value, strlen(value),
+			     &file->mtime))
+		file->mtime = (time_t)-1;
+
+	fs_metadata_init_or_clear(&file->file);
+	array_foreach(&result.headers, hdr) {
+		if (str_begins(hdr->name, "x-amz-meta-", &value))
+			fs_default_set_metadata(&file->file, value, hdr->value);
+	}
+	file->head_done = TRUE;
+	return 0;
+}
+
+static int
+fs_s3_get_metadata(struct fs_file *_file, enum fs_get_metadata_flags flags,
+		   const ARRAY_TYPE(fs_metadata) **metadata_r)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	if ((flags & FS_GET_METADATA_FLAG_LOADED_ONLY) == 0 &&
+	    fs_s3_file_head(file) < 0)
+		return -1;
+	fs_metadata_init(_file);
+	*metadata_r = &_file->metadata;
+	return 0;
+}
+
+static bool fs_s3_prefetch(struct fs_file *_file, uoff_t length ATTR_UNUSED)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	if (file->prefetch_input == NULL) {
+		/* start reading the first parts in the background */
+		file->prefetch_input = i_stream_create_s3(file, IO_BLOCK_SIZE);
+	}
+	return FALSE;
+}
+
+static struct istream *
+fs_s3_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct istream *input;
+
+	if (file->prefetch_input != NULL) {
+		input = file->prefetch_input;
+		file->prefetch_input = NULL;
+		i_stream_set_max_buffer_size(input, max_buffer_size);
+		return input;
+	}
+	return i_stream_create_s3(file, max_buffer_size);
+}
+
+static int fs_s3_exists(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	if (fs_s3_file_head(file) == 0)
+		return 1;
+	return errno == ENOENT ? 0 : -1;
+}
+
+static int fs_s3_stat(struct fs_file *_file, struct stat *st_r)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	if (fs_s3_file_head(file) < 0)
+		return -1;
+	i_zero(st_r);
+	st_r->st_size = file->size;
+	st_r->st_mtime = file->mtime;
+	return 0;
+}
+
+static int fs_s3_copy(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct s3_fs_file *src = S3_FILE(_src);
+	struct s3_fs_file *dest = S3_FILE(_dest);
+	struct s3_fs *fs = dest->fs;
+	struct s3_fs_request *sreq;
+	struct s3_fs_request_result result;
+	struct s3_sigv4_header *hdr;
+	ARRAY_TYPE(s3_sigv4_header) headers;
+	const struct fs_metadata *md;
+	string_t *source;
+	int ret;
+
+	if (fs->bucket == NULL || _src == NULL)
+		return fs_default_copy(_src, _dest);
+
+	source = t_str_new(128);
+	str_append_c(source, '/');
+	s3_sigv4_uri_encode(source, fs->bucket, TRUE);
+	str_append_c(source, '/');
+	s3_sigv4_uri_encode(source, fs->key_prefix, FALSE);
+	s3_sigv4_uri_encode(source, src->file.path, FALSE);
+
+	t_array_init(&headers, 8);
+	hdr = array_append_space(&headers);
+	hdr->name = "x-amz-copy-source";
+	hdr->value = str_c(source);
+	if (_dest->metadata_changed) {
+		hdr = array_append_space(&headers);
+		hdr->name = "x-amz-metadata-directive";
+		hdr->value = "REPLACE";
+		array_foreach(&_dest->metadata, md) {
+			if (str_begins_with(md->key,
+					    FS_METADATA_INTERNAL_PREFIX))
+				continue;
+			hdr = array_append_space(&headers);
+			hdr->name = t_str_lcase(t_strconcat("x-amz-meta-",
+							    md->key, NULL));
+			hdr->value = md->value;
+		}
+	}
+	sreq = fs_s3_request_init(fs, _dest->event, "PUT",
+		fs_s3_get_object_path(fs, _dest->path), "", &headers, NULL);
+	ret = fs_s3_request_run(sreq, &result);
+	if (ret == 0) {
+		/* copying can fail after a 200 response has already been
+		   sent */
+		size_t pos = 0;
+		const char *code =
+			fs_s3_xml_next_value(result.payload, &pos, "Code");
+		if (code != NULL) {
+			result.error = code;
+			result.error_errno = EIO;
+			ret = -1;
+		}
+	}
+	buffer_free(&result.payload);
+	if (ret < 0) {
+		fs_s3_file_set_request_error(dest, "PUT", &result);
+		return -1;
+	}
+	return 0;
+}
+
+static int fs_s3_delete(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct s3_fs_request *sreq;
+	struct s3_fs_request_result result;
+	int ret;
+
+	sreq = fs_s3_request_init(file->fs, _file->event, "DELETE",
+		fs_s3_get_object_path(file->fs, _file->path), "", NULL, NULL);
+	ret = fs_s3_request_run(sreq, &result);
+	buffer_free(&result.payload);
+	if (ret < 0) {
+		fs_s3_file_set_request_error(file, "DELETE", &result);
+		return -1;
+	}
+	file->head_done = FALSE;
+	return 0;
+}
+
+struct s3_fs_delete_context {
+	struct s3_fs *fs;
+	struct fs_file *const *files;
+	int *errors;
+	unsigned int pending;
+};
+
+struct s3_fs_delete_batch {
+	struct s3_fs_delete_context *ctx;
+	unsigned int first, count;
+};
+
+static void
+fs_s3_delete_batch_set_error(struct s3_fs_delete_batch *batch,
+			     unsigned int idx, int error, const char *errstr)
+{
+	struct fs_file *file = batch->ctx->files[idx];
+
+	batch->ctx->errors[idx] = error;
+	fs_set_error(file->event, error, "DELETE %s failed: %s",
+		     file->path, errstr);
+}
+
+static void fs_s3_delete_batch_finished(struct s3_fs_request *sreq)
+{
+	struct s3_fs_delete_batch *batch = sreq->context;
+	struct s3_fs_delete_context *ctx = batch->ctx;
+	const char *key, *code, *path;
+	unsigned int i;
+	size_t pos = 0;
+
+	i_assert(ctx->pending > 0);
+	ctx->pending--;
+
+	if (!fs_s3_request_is_success(sreq)) {
+		for (i = batch->first; i < batch->first + batch->count; i++) {
+			fs_s3_delete_batch_set_error(batch, i,
+				sreq->error_errno, sreq->error);
+		}
+		i_free(batch);
+		return;
+	}
+	for (i = batch->first; i < batch->first + batch->count; i++) {
+		struct s3_fs_file *file = S3_FILE(ctx->files[i]);
+		file->head_done = FALSE;
+	}
+
+	/* with quiet mode only the failed keys are listed */
+	while (fs_s3_xml_skip_to(sreq->payload, &pos, "Error") &&
+	       (key = fs_s3_xml_next_value(sreq->payload, &pos,
+					   "Key")) != NULL) {
+		code = fs_s3_xml_next_value(sreq->payload, &pos, "Code");
+		if (code == NULL)
+			code = "Unknown error";
+		if (!str_begins(key, ctx->fs->key_prefix, &path))
+			continue;
+		for (i = batch->first; i < batch->first + batch->count; i++) {
+			if (strcmp(ctx->files[i]->path, path) == 0) {
+				fs_s3_delete_batch_set_error(batch, i,
+					strcmp(code, "AccessDenied") == 0 ?
+					EACCES : EIO, code);
+				break;
+			}
+		}
+	}
+	i_free(batch);
+}
+
+static void
+fs_s3_delete_batch_submit(struct s3_fs_delete_context *ctx,
+			  unsigned int first, unsigned int count)
+{
+	struct s3_fs *fs = ctx->fs;
+	struct s3_fs_delete_batch *batch;
+	struct s3_fs_request *sreq;
+	struct s3_sigv4_header *hdr;
+	ARRAY_TYPE(s3_sigv4_header) headers;
+	unsigned char md5[MD5_RESULTLEN];
+	string_t *payload, *md5_base64;
+	unsigned int i;
+
+	payload = str_new(default_pool, 64 + count * 128);
+	str_append(payload, "<Delete><Quiet>true</Quiet>");
+	for (i = first; i < first + count; i++) {
+		str_append(payload, "<Object><Key>");
+		fs_s3_xml_append_escaped(payload, t_strconcat(fs->key_prefix,
+			ctx->files[i]->path, NULL));
+		str_append(payload, "</Key></Object>");
+	}
+	str_append(payload, "</Delete>");
+
+	/* DeleteObjects requires Content-MD5 */
+	md5_get_digest(payload->data, payload->used, md5);
+	md5_base64 = t_str_new(MAX_BASE64_ENCODED_SIZE(sizeof(md5)));
+	base64_encode(md5, sizeof(md5), md5_base64);
+	t_array_init(&headers, 1);
+	hdr = array_append_space(&headers);
+	hdr->name = "content-md5";
+	hdr->value = str_c(md5_base64);
+
+	batch = i_new(struct s3_fs_delete_batch, 1);
+	batch->ctx = ctx;
+	batch->first = first;
+	batch->count = count;
+
+	sreq = fs_s3_request_init(fs, ctx->files[first]->event, "POST",
+		fs->bucket_path[0] == '\0' ? "/" : fs->bucket_path,
+		"delete=", &headers, payload);
+	sreq->callback = fs_s3_delete_batch_finished;
+	sreq->context = batch;
+	ctx->pending++;
+	fs_s3_request_submit(sreq);
+}
+
+static int
+fs_s3_delete_multi(struct fs_file *const files[], unsigned int count,
+		   int errors_r[])
+{
+	struct s3_fs_file *file = S3_FILE(files[0]);
+	struct s3_fs_delete_context ctx;
+	unsigned int i, batch_count;
+
+	i_zero(&ctx);
+	ctx.fs = file->fs;
+	ctx.files = files;
+	ctx.errors = errors_r;
+	for (i = 0; i < count; i++)
+		errors_r[i] = 0;
+
+	for (i = 0; i < count; i += batch_count) {
+		batch_count = I_MIN(count - i, FS_S3_DELETE_MAX_KEYS);
+		while (ctx.pending >= ctx.fs->max_parallel)
+			fs_s3_wait_async(&ctx.fs->fs);
+		fs_s3_delete_batch_submit(&ctx, i, batch_count);
+	}
+	while (ctx.pending > 0)
+		fs_s3_wait_async(&ctx.fs->fs);
+
+	for (i = 0; i < count; i++) {
+		if (errors_r[i] != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static struct fs_iter *fs_s3_iter_alloc(void)
+{
+	struct s3_fs_iter *iter = i_new(struct s3_fs_iter, 1);
+	return &iter->iter;
+}
+
+static void fs_s3_iter_list_finished(struct s3_fs_request *sreq);
+
+static void fs_s3_iter_list_submit(struct s3_fs_iter *iter)
+{
+	struct s3_fs *fs = S3_FS(iter->iter.fs);
+	string_t *query = t_str_new(256);
+
+	i_assert(iter->list_req == NULL);
+
+	/* parameters must be sorted for signing */
+	if (iter->continuation_token != NULL) {
+		str_append(query, "continuation-token=");
+		s3_sigv4_uri_encode(query, iter->continuation_token, TRUE);
+		str_append_c(query, '&');
+	}
+	str_append(query, "delimiter=%2F&list-type=2&prefix=");
+	s3_sigv4_uri_encode(query, iter->prefix, TRUE);
+
+	iter->list_req = fs_s3_request_init(fs, iter->iter.event, "GET",
+		fs->bucket_path[0] == '\0' ? "/" : fs->bucket_path,
+		str_c(query), NULL, NULL);
+	iter->list_req->callback = fs_s3_iter_list_finished;
+	iter->list_req->context = iter;
+	fs_s3_request_submit(iter->list_req);
+}
+
+static void
+fs_s3_iter_init(struct fs_iter *_iter, const char *path,
+		enum fs_iter_flags flags ATTR_UNUSED)
+{
+	struct s3_fs_iter *iter = container_of(_iter, struct s3_fs_iter, iter);
+	struct s3_fs *fs = S3_FS(_iter->fs);
+
+	if (path[0] != '\0' && path[strlen(path)-1] != '/')
+		path = t_strconcat(path, "/", NULL);
+	iter->prefix = i_strconcat(fs->key_prefix, path, NULL);
+	iter->names_pool = pool_alloconly_create("fs s3 iter", 1024);
+	p_array_init(&iter->names, iter->names_pool, 64);
+	iter->next_names_pool = pool_alloconly_create("fs s3 iter next", 1024);
+	p_array_init(&iter->next_names, iter->next_names_pool, 64);
+	/* start listing the first page already */
+	fs_s3_iter_list_submit(iter);
+}
+
+static void
+fs_s3_iter_add_name(struct s3_fs_iter *iter, const char *name)
+{
+	const char *suffix;
+
+	if (!str_begins(name, iter->prefix, &suffix))
+		return;
+	if ((iter->iter.flags & FS_ITER_FLAG_DIRS) != 0)
+		suffix = t_strcut(suffix, '/');
+	if (suffix[0] == '\0')
+		return;
+	suffix = p_strdup(iter->next_names_pool, suffix);
+	array_push_back(&iter->next_names, &suffix);
+}
+
+static int
+fs_s3_iter_parse_list(struct s3_fs_iter *iter, const buffer_t *payload)
+{
+	struct s3_fs *fs = S3_FS(iter->iter.fs);
+	const char *value;
+	size_t pos = 0;
+
+	if ((iter->iter.flags & FS_ITER_FLAG_DIRS) == 0) {
+		while (fs_s3_xml_skip_to(payload, &pos, "Contents") &&
+		       (value = fs_s3_xml_next_value(payload, &pos,
+						     "Key")) != NULL)
+			fs_s3_iter_add_name(iter, value);
+	} else {
+		while (fs_s3_xml_skip_to(payload, &pos, "CommonPrefixes") &&
+		       (value = fs_s3_xml_next_value(payload, &pos,
+						     "Prefix")) != NULL)
+			fs_s3_iter_add_name(iter, value);
+	}
+
+	pos = 0;
+	value = fs_s3_xml_next_value(payload, &pos, "IsTruncated");
+	iter->truncated = value != NULL && strcmp(value, "true") == 0;
+	i_free(iter->continuation_token);
+	if (iter->truncated) {
+		pos = 0;
+		value = fs_s3_xml_next_value(payload, &pos,
+					     "NextContinuationToken");
+		if (value == NULL) {
+			fs_set_error(iter->iter.event, EIO,
+				     "GET %s failed: NextContinuationToken "
+				     "missing from truncated response",
+				     fs->bucket_path);
+			return -1;
+		}
+		iter->continuation_token = i_strdup(value);
+	}
+	return 0;
+}
+
+static void fs_s3_iter_list_finished(struct s3_fs_request *sreq)
+{
+	struct s3_fs_iter *iter = sreq->context;
+	struct s3_fs *fs = S3_FS(iter->iter.fs);
+
+	iter->list_req = NULL;
+	if (!fs_s3_request_is_success(sreq)) {
+		fs_set_error(iter->iter.event, sreq->error_errno,
+			     "GET %s failed: %s", fs->bucket_path,
+			     sreq->error);
+		iter->failed = TRUE;
+	} else if (fs_s3_iter_parse_list(iter, sreq->payload) < 0) {
+		iter->failed = TRUE;
+	} else {
+		iter->next_names_ready = TRUE;
+	}
+	if ((iter->iter.flags & FS_ITER_FLAG_ASYNC) != 0 &&
+	    iter->iter.async_callback != NULL)
+		iter->iter.async_callback(iter->iter.async_context);
+}
+
+static void fs_s3_iter_switch_page(struct s3_fs_iter *iter)
+{
+	pool_t pool = iter->names_pool;
+
+	iter->names = iter->next_names;
+	iter->names_pool = iter->next_names_pool;
+	iter->names_idx = 0;
+
+	p_clear(pool);
+	p_array_init(&iter->next_names, pool, 64);
+	iter->next_names_pool = pool;
+	iter->next_names_ready = FALSE;
+
+	/* prefetch the next page while the caller processes this one */
+	if (iter->truncated)
+		fs_s3_iter_list_submit(iter);
+}
+
+static const char *fs_s3_iter_next(struct fs_iter *_iter)
+{
+	struct s3_fs_iter *iter = container_of(_iter, struct s3_fs_iter, iter);
+
+	_iter->async_have_more = FALSE;
+	while (iter->names_idx == array_count(&iter->names)) {
+		if (iter->failed)
+			return NULL;
+		if (iter->next_names_ready)
+			fs_s3_iter_switch_page(iter);
+		else if (iter->list_req == NULL)
+			return NULL;
+		else if ((_iter->flags & FS_ITER_FLAG_ASYNC) != 0) {
+			_iter->async_have_more = TRUE;
+			return NULL;
+		} else {
+			fs_s3_wait_async(_iter->fs);
+		}
+	}
+	return array_idx_elem(&iter->names, iter->names_idx++);
+}
+
+static int fs_s3_iter_deinit(struct fs_iter *_iter)
+{
+	struct s3_fs_iter *iter = container_of(_iter, struct s3_fs_iter, iter);
+	int ret = iter->failed ? -1 : 0;
+
+	fs_s3_request_abort(&iter->list_req);
+	pool_unref(&iter->names_pool);
+	pool_unref(&iter->next_names_pool);
+	i_free(iter->continuation_token);
+	i_free(iter->prefix);
+	return ret;
+}
+
+const struct fs fs_class_s3 = {
+	.name = "s3",
+	.v = {
+		.alloc = fs_s3_alloc,
+		.init = fs_s3_init,
+		.deinit = NULL,
+		.free = fs_s3_free,
+		.get_properties = fs_s3_get_properties,
+		.file_alloc = fs_s3_file_alloc,
+		.file_init = fs_s3_file_init,
+		.file_deinit = fs_s3_file_deinit,
+		.file_close = fs_s3_file_close,
+		.get_path = NULL,
+		.set_async_callback = fs_s3_set_async_callback,
+		.wait_async = fs_s3_wait_async,
+		.set_metadata = fs_default_set_metadata,
+		.get_metadata = fs_s3_get_metadata,
+		.prefetch = fs_s3_prefetch,
+		.read = NULL,
+		.read_stream = fs_s3_read_stream,
+		.write = NULL,
+		.write_stream = fs_s3_write_stream,
+		.write_stream_finish = fs_s3_write_stream_finish,
+		.lock = NULL,
+		.unlock = NULL,
+		.exists = fs_s3_exists,
+		.stat = fs_s3_stat,
+		.copy = fs_s3_copy,
+		.rename = NULL,
+		.delete_file = fs_s3_delete,
+		.iter_alloc = fs_s3_iter_alloc,
+		.iter_init = fs_s3_iter_init,
+		.iter_next = fs_s3_iter_next,
+		.iter_deinit = fs_s3_iter_deinit,
+		.switch_ioloop = fs_s3_switch_ioloop,
+		.get_nlinks = NULL,
+		.delete_multi = fs_s3_delete_multi,
+	}
+};
@@ -0,0 +1,122 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "hmac.h"
+#include "sha2.h"
+#include "s3-sigv4.h"
+
+#include <ctype.h>
+#include <time.h>
+
+#define S3_SIGV4_ALGORITHM "AWS4-HMAC-SHA256"
+
+void s3_sigv4_uri_encode(string_t *dest, const char *data, bool encode_slash)
+{
+	for (; *data != '\0'; data++) {
+		unsigned char c = *data;
+
+		if (i_isalnum(c) || c == '-' || c == '_' || c == '.' ||
+		    c == '~' || (c == '/' && !encode_slash))
+			str_append_c(dest, c);
+		else
+			str_printfa(dest, "%%%02X", c);
+	}
+}
+
+const char *s3_sigv4_payload_hash(const void *data, size_t size)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+
+	sha256_get_digest(data, size, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+const char *s3_sigv4_date(time_t timestamp)
+{
+	struct tm *tm = gmtime(&timestamp);
+	char buf[17];
+
+	if (strftime(buf, sizeof(buf), "%Y%m%dT%H%M%SZ", tm) == 0)
+		i_unreached();
+	return t_strdup(buf);
+}
+
+static int s3_sigv4_header_cmp(const struct s3_sigv4_header *h1,
+			       const struct s3_sigv4_header *h2)
+{
+	return strcmp(h1->name, h2->name);
+}
+
+static void
+s3_sigv4_hmac(const unsigned char *key, size_t key_size, const char *data,
+	      unsigned char digest[STATIC_ARRAY SHA256_RESULTLEN])
+{
+	struct hmac_context ctx;
+
+	hmac_init(&ctx, key, key_size, &hash_method_sha256);
+	hmac_update(&ctx, data, strlen(data));
+	hmac_final(&ctx, digest);
+}
+
+const char *
+s3_sigv4_get_authorization(const struct s3_sigv4_credentials *creds,
+			   const char *method, const char *path,
+			   const char *query,
+			   const struct s3_sigv4_header *headers,
+			   unsigned int headers_count,
+			   const char *amz_date, const char *payload_hash)
+{
+	struct s3_sigv4_header *sorted_headers;
+	string_t *canonical, *signed_headers, *str;
+	const char *date, *scope;
+	unsigned char key[SHA256_RESULTLEN], digest[SHA256_RESULTLEN];
+	unsigned int i;
+
+	i_assert(strlen(amz_date) == 16);
+	date = t_strndup(amz_date, 8);
+	scope = t_strdup_printf("%s/%s/%s/aws4_request", date,
+				creds->region, creds->service);
+
+	sorted_headers = t_new(struct s3_sigv4_header, headers_count);
+	memcpy(sorted_headers, headers,
+	       sizeof(*sorted_headers) * headers_count);
+	qsort(sorted_headers, headers_count, sizeof(*sorted_headers),
+	      (int (*)(const void *, const void *))s3_sigv4_header_cmp);
+
+	/* canonical request */
+	canonical = t_str_new(512);
+	signed_headers = t_str_new(128);
+	str_printfa(canonical, "%s\n%s\n%s\n", method, path, query);
+	for (i = 0; i < headers_count; i++) {
+		str_printfa(canonical, "%s:%s\n", sorted_headers[i].name,
+			    t_str_trim(sorted_headers[i].value, " \t"));
+		if (i > 0)
+			str_append_c(signed_headers, ';');
+		str_append(signed_headers, sorted_headers[i].name);
+	}
+	str_printfa(canonical, "\n%s\n%s", str_c(signed_headers),
+		    payload_hash);
+
+	/* string to sign */
+	str = t_str_new(256);
+	str_printfa(str, S3_SIGV4_ALGORITHM"\n%s\n%s\n%s", amz_date, scope,
+		    s3_sigv4_payload_hash(str_data(canonical),
+					  str_len(canonical)));
+
+	/* signing key */
+	s3_sigv4_hmac((const unsigned char *)
+		      t_strconcat("AWS4", creds->secret_key, NULL),
+		      strlen(creds->secret_key) + 4, date, key);
+	s3_sigv4_hmac(key, sizeof(key), creds->region, key);
+	s3_sigv4_hmac(key, sizeof(key), creds->service, key);
+	s3_sigv4_hmac(key, sizeof(key), "aws4_request", key);
+	s3_sigv4_hmac(key, sizeof(key), str_c(str), digest);
+
+	return t_strdup_printf(S3_SIGV4_ALGORITHM" Credential=%s/%s, "
+			       "SignedHeaders=%s, Signature=%s",
+			       creds->access_key, scope,
+			       str_c(signed_headers),
+			       binary_to_hex(digest, sizeof(digest)));
+}
@@ -0,0 +1,39 @@
+#ifndef S3_SIGV4_H
+#define S3_SIGV4_H
+
+struct s3_sigv4_credentials {
+	const char *access_key;
+	const char *secret_key;
+	const char *region;
+	const char *service;
+};
+
+struct s3_sigv4_header {
+	/* lowercase header name */
+	const char *name;
+	const char *value;
+};
+
+/* Append data to dest URI-encoded as required by AWS signature version 4.
+   Only the RFC 3986 unreserved characters are left unencoded. If
+   encode_slash is FALSE, '/' is also left as-is (for object paths). */
+void s3_sigv4_uri_encode(string_t *dest, const char *data, bool encode_slash);
+
+/* Returns hex-encoded SHA256 of the payload. */
+const char *s3_sigv4_payload_hash(const void *data, size_t size);
+/* Returns the timestamp in the x-amz-date header format. */
+const char *s3_sigv4_date(time_t timestamp);
+
+/* Returns the value for the Authorization header. The path and query must
+   already be encoded, and the query parameters must be sorted by name.
+   The headers must contain at least host, x-amz-date and
+   x-amz-content-sha256, but they don't need to be sorted. */
+const char *
+s3_sigv4_get_authorization(const struct s3_sigv4_credentials *creds,
+			   const char *method, const char *path,
+			   const char *query,
+			   const struct s3_sigv4_header *headers,
+			   unsigned int headers_count,
+			   const char *amz_date, const char *payload_hash);
+
+#endif
@@ -232,14 +232,24 @@ void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend)
 	if (hash_table_is_created(x->optimize)) {
 		struct hash_iterate_context *iter =
 			hash_table_iterate_init(x->optimize);
+		bool queue = fts_backend_flatcurve_optimize_is_queued(backend);
 
 		void *key, *val;
 		while (hash_table_iterate(iter, x->optimize, &key, &val)) {
+			if (queue) {
+				if (fts_backend_flatcurve_queue_optimize(
+					backend, (const char *)key, &error) < 0)
+					e_error(backend->event, "%s", error);
+				continue;
+			}
+
+			str_truncate(backend->boxname, 0);
+			str_truncate(backend->db_path, 0);
 			str_append(backend->boxname, (const char *)key);
 			str_append(backend->db_path, (const char *)val);
 
 			if (fts_flatcurve_xapian_optimize_box(
-				backend, &error) < 0)
+				backend, FALSE, &error) < 0)
 				e_error(backend->event, "%s", error);
 		}
 
@@ -1384,8 +1394,14 @@ fts_flatcurve_xapian_close_db(struct flatcurve_fts_backend *backend,
 		unsigned int elapsed =
 			(unsigned int) timeval_diff_msecs(&now, &start);
 		if (xdb->changes > 0)
-			e_debug(backend->event, "Committed %u changes to DB "
-				"(RW, %s) in %u.%03u secs", xdb->changes,
+			e_debug(event_create_passthrough(backend->event)->
+				set_name("fts_flatcurve_commit")->
+				add_str("mailbox", str_c(backend->boxname))->
+				add_str("db", xdb->dbpath->fname)->
+				add_int("changes", xdb->changes)->
+				add_int("commit_msecs", elapsed)->event(),
+				"Committed %u changes to DB (RW, %s) in "
+				"%u.%03u secs", xdb->changes,
 				xdb->dbpath->fname, elapsed / 1000, elapsed % 1000);
 
 		xdb->changes = 0;
@@ -1464,6 +1480,31 @@ fts_flatcurve_xapian_close_dbs(struct flatcurve_fts_backend *backend,
 	return 0;
 }
 
+/* Returns: 1 if there are uncommitted changes, 0 if not, -1 on error */
+int fts_flatcurve_xapian_write_behind(struct flatcurve_fts_backend *backend,
+				      const char **error_r)
+{
+	struct hash_iterate_context *iter;
+	void *key, *val;
+	struct flatcurve_xapian *x = backend->xapian;
+	int ret = 0;
+
+	if (fts_flatcurve_xapian_clear_document(backend, error_r) < 0)
+		return -1;
+
+	iter = hash_table_iterate_init(x->dbs);
+	while (hash_table_iterate(iter, x->dbs, &key, &val)) {
+		struct flatcurve_xapian_db *xdb =
+			(struct flatcurve_xapian_db *)val;
+		if (xdb->dbw != NULL && xdb->changes > 0) {
+			ret = 1;
+			break;
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	return ret;
+}
+
 /* Returns: 0 on success, -1 on error */
 int fts_flatcurve_xapian_refresh(struct flatcurve_fts_backend *backend,
 				 const char **error_r)
@@ -1511,6 +1552,23 @@ fts_flatcurve_xapian_get_last_uid_query(struct flatcurve_fts_backend *backend AT
 		? 0 : m.begin().get_document().get_docid();
 }
 
+static uint32_t
+fts_flatcurve_xapian_get_last_uid_db(struct flatcurve_fts_backend *backend,
+				     Xapian::Database *db)
+{
+	try {
+		/* Optimization: if last used ID still exists in  mailbox,
+		 * this is a cheap call. */
+		return db->get_document(db->get_lastdocid()).get_docid();
+	} catch (Xapian::DocNotFoundError &e) {
+		/* Last used Xapian ID is no longer in the DB. Need
+			* to do a manual search for the last existing ID. */
+		return fts_flatcurve_xapian_get_last_uid_query(backend, db);
+	} catch (Xapian::InvalidArgumentError &e) {
+		return 0;
+	}
+}
+
 /* Returns: 0 on success, -1 on error */
 int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 				      uint32_t *last_uid_r, const char **error_r)
@@ -1520,6 +1578,7 @@ int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 			(FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT |
 			 FLATCURVE_XAPIAN_DB_IGNORE_EMPTY);
 
+	struct flatcurve_xapian *x = backend->xapian;
 	Xapian::Database *db;
 	int ret = fts_flatcurve_xapian_read_db(backend, opts, &db, error_r);
 	if (ret < 0)
@@ -1530,20 +1589,17 @@ int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 		return 0;
 	}
 
-	try {
-		/* Optimization: if last used ID still exists in  mailbox,
-		 * this is a cheap call. */
-		*last_uid_r = db->get_document(db->get_lastdocid()).get_docid();
-		return 0;
-	} catch (Xapian::DocNotFoundError &e) {
-		/* Last used Xapian ID is no longer in the DB. Need
-			* to do a manual search for the last existing ID. */
-		*last_uid_r = fts_flatcurve_xapian_get_last_uid_query(backend, db);
-		return 0;
-	} catch (Xapian::InvalidArgumentError &e) {
-		*last_uid_r = 0;
-		return 0;
+	*last_uid_r = fts_flatcurve_xapian_get_last_uid_db(backend, db);
+
+	/* The read DB doesn't see the changes left uncommitted by
+	 * write-behind yet. */
+	if (x->dbw_current != NULL && x->dbw_current->dbw != NULL &&
+	    x->dbw_current->changes > 0) {
+		uint32_t uid = fts_flatcurve_xapian_get_last_uid_db(
+			backend, x->dbw_current->dbw);
+		*last_uid_r = I_MAX(*last_uid_r, uid);
 	}
+	return 0;
 }
 
 /* Returns: 0 not found, 1 if found, -1 on error */
@@ -1905,7 +1961,7 @@ fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
 
 /* Returns: 0 on success, -1 on error */
 int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
-				      const char **error_r)
+				      bool force, const char **error_r)
 {
 	static const enum flatcurve_xapian_db_opts opts =
 		(enum flatcurve_xapian_db_opts)
@@ -1918,8 +1974,7 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 		backend, opts, &db, error_r)) <= 0)
 		return ret;
 
-	if (backend->xapian->deinit &&
-	    !fts_flatcurve_xapian_need_optimize(backend)) {
+	if (!force && !fts_flatcurve_xapian_need_optimize(backend)) {
 		return fts_flatcurve_xapian_close(backend, error_r);
 	}
 
@@ -2131,8 +2186,12 @@ bool
 fts_flatcurve_xapian_query_iter_next(struct fts_flatcurve_xapian_query_iter *iter,
 				     struct fts_flatcurve_xapian_query_result **result_r)
 {
+	/* Searching doesn't need to create DBs for mailboxes that haven't
+	 * been indexed. */
 	static const enum flatcurve_xapian_db_opts opts =
-		ENUM_EMPTY(flatcurve_xapian_db_opts);
+		(enum flatcurve_xapian_db_opts)
+			(FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT |
+			 FLATCURVE_XAPIAN_DB_IGNORE_EMPTY);
 
 	if (iter->error != NULL)
 		return FALSE;
@@ -2177,11 +2236,14 @@ fts_flatcurve_xapian_query_iter_next(struct fts_flatcurve_xapian_query_iter *ite
 		return FALSE;
 
 	iter->result->score = iter->mset_iter.get_weight();
-	/* MSet docid can be an "interleaved" docid generated by
-	 * Xapian::Database when handling multiple DBs at once. Instead, we
-	 * want the "unique docid", which is obtained by looking at the
-	 * doc id from the Document object itself. */
-	iter->result->uid = iter->mset_iter.get_document().get_docid();
+	/* MSet docid is an "interleaved" docid generated by
+	 * Xapian::Database when handling multiple DBs at once:
+	 * (shard docid - 1) * shards + shard index + 1. We want the
+	 * "unique docid" of the shard, which can be calculated from it
+	 * without loading the Document object. */
+	Xapian::docid docid = *iter->mset_iter;
+	unsigned int shards = iter->query->backend->xapian->shards;
+	iter->result->uid = shards <= 1 ? docid : (docid - 1) / shards + 1;
 	++iter->mset_iter;
 
 	*result_r = iter->result;
@@ -30,6 +30,11 @@ int fts_flatcurve_xapian_refresh(struct flatcurve_fts_backend *backend,
 int fts_flatcurve_xapian_close(struct flatcurve_fts_backend *backend,
 			       const char **error_r);
 void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend);
+/* Write the current document to the DB, but leave the DB open with its
+   changes uncommitted. Returns 1 if there are uncommitted changes, 0 if not,
+   -1 on error. */
+int fts_flatcurve_xapian_write_behind(struct flatcurve_fts_backend *backend,
+				      const char **error_r);
 
 int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 				      uint32_t *last_uid_r, const char **error_r);
@@ -49,7 +54,10 @@ int
 fts_flatcurve_xapian_index_body(struct flatcurve_fts_backend_update_context *ctx,
 				const unsigned char *data, size_t size,
 				const char **error_r);
+/* If force is FALSE, the mailbox is optimized only if it has reached
+   fts_flatcurve_optimize_limit shards. */
 int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
+				      bool force,
 				      const char **error_r);
 void
 fts_flatcurve_xapian_build_query_match_all(struct flatcurve_fts_query *query);
@@ -3,16 +3,24 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
+#include "net.h"
+#include "write-full.h"
 #include "imap-util.h"
 #include "mail-storage-private.h"
 #include "mail-search-build.h"
 #include "mailbox-list-iter.h"
 #include "str.h"
+#include "strescape.h"
 #include "time-util.h"
 #include "unlink-directory.h"
 #include "fts-backend-flatcurve.h"
 #include "fts-backend-flatcurve-xapian.h"
 
+#define INDEXER_SOCKET_NAME "indexer"
+#define INDEXER_HANDSHAKE "VERSION\tindexer-client\t1\t0\n"
+#define INDEXER_WORKER_SERVICE_NAME "indexer-worker"
+
 enum fts_backend_flatcurve_action {
 	FTS_BACKEND_FLATCURVE_ACTION_OPTIMIZE,
 	FTS_BACKEND_FLATCURVE_ACTION_RESCAN
@@ -69,6 +77,8 @@ fts_backend_flatcurve_close_mailbox(struct flatcurve_fts_backend *backend,
 				    const char **error_r)
 {
 	int ret = 0;
+
+	timeout_remove(&backend->to_write_behind);
 	if (str_len(backend->boxname) > 0) {
 		ret = fts_flatcurve_xapian_close(backend, error_r);
 
@@ -80,6 +90,49 @@ fts_backend_flatcurve_close_mailbox(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+static void
+fts_backend_flatcurve_write_behind_timeout(struct flatcurve_fts_backend *backend)
+{
+	const char *error;
+
+	timeout_remove(&backend->to_write_behind);
+	if (fts_backend_is_updating(&backend->backend)) {
+		/* the changes are committed later when the update ends */
+		return;
+	}
+	if (fts_backend_flatcurve_close_mailbox(backend, &error) < 0)
+		e_error(backend->event, "%s", error);
+}
+
+/* Leave the mailbox's changes uncommitted after the update ends, so that
+   the following updates can be committed together with them. */
+static int
+fts_backend_flatcurve_write_behind(struct flatcurve_fts_backend *backend,
+				   const char **error_r)
+{
+	const char *error;
+	int ret;
+
+	if (str_len(backend->boxname) == 0)
+		return 0;
+
+	ret = fts_flatcurve_xapian_write_behind(backend, error_r);
+	if (ret < 0) {
+		(void)fts_backend_flatcurve_close_mailbox(backend, &error);
+		return -1;
+	}
+	if (ret == 0)
+		return fts_backend_flatcurve_close_mailbox(backend, error_r);
+
+	if (backend->to_write_behind == NULL) {
+		backend->to_write_behind =
+			timeout_add(backend->fuser->set.write_behind_time,
+				    fts_backend_flatcurve_write_behind_timeout,
+				    backend);
+	}
+	return 0;
+}
+
 static int fts_backend_flatcurve_refresh(struct fts_backend * _backend)
 {
 	const char *error;
@@ -206,9 +259,14 @@ fts_backend_flatcurve_update_set_mailbox(struct fts_backend_update_context *_ctx
 	struct flatcurve_fts_backend_update_context *ctx =
 		(struct flatcurve_fts_backend_update_context *)_ctx;
 
-	int ret = box == NULL ?
-		fts_backend_flatcurve_close_mailbox(ctx->backend, &error) :
-		fts_backend_flatcurve_set_mailbox(ctx->backend, box, &error);
+	int ret;
+
+	if (box != NULL)
+		ret = fts_backend_flatcurve_set_mailbox(ctx->backend, box, &error);
+	else if (ctx->backend->fuser->set.write_behind_time > 0)
+		ret = fts_backend_flatcurve_write_behind(ctx->backend, &error);
+	else
+		ret = fts_backend_flatcurve_close_mailbox(ctx->backend, &error);
 	if (ret < 0)
 		e_error(ctx->backend->event, "%s", error);
 }
@@ -491,6 +549,11 @@ fts_backend_flatcurve_iterate_ns(struct fts_backend *_backend,
 		MAILBOX_LIST_ITER_RETURN_NO_FLAGS;
 	enum mailbox_flags mbox_flags = 0;
 	pool_t pool = NULL;
+	/* Optimize requests queued to indexer only optimize the mailboxes
+	   that need it. Otherwise optimizing is forced. */
+	bool force = !backend->fuser->set.optimize_queue ||
+		strcmp(_backend->ns->user->service,
+		       INDEXER_WORKER_SERVICE_NAME) != 0;
 
 	bool failed = FALSE;
 	iter = mailbox_list_iter_init(_backend->ns->list, "*", iter_flags);
@@ -508,7 +571,7 @@ fts_backend_flatcurve_iterate_ns(struct fts_backend *_backend,
 		switch (act) {
 		case FTS_BACKEND_FLATCURVE_ACTION_OPTIMIZE:
 			if (fts_flatcurve_xapian_optimize_box(
-				backend, &error) < 0) {
+				backend, force, &error) < 0) {
 				e_error(backend->event, "%s", error);
 				failed = TRUE;
 			}
@@ -539,6 +602,49 @@ fts_backend_flatcurve_iterate_ns(struct fts_backend *_backend,
 	return failed ? -1 : 0;
 }
 
+bool fts_backend_flatcurve_optimize_is_queued(struct flatcurve_fts_backend *backend)
+{
+	return backend->fuser->set.optimize_queue &&
+		strcmp(backend->backend.ns->user->service,
+		       INDEXER_WORKER_SERVICE_NAME) != 0;
+}
+
+int fts_backend_flatcurve_queue_optimize(struct flatcurve_fts_backend *backend,
+					 const char *boxname,
+					 const char **error_r)
+{
+	struct mail_user *user = backend->backend.ns->user;
+	string_t *str = t_str_new(256);
+	const char *path;
+	int fd, ret = 0;
+
+	path = t_strconcat(user->set->base_dir, "/"INDEXER_SOCKET_NAME, NULL);
+	fd = net_connect_unix(path);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("net_connect_unix(%s) failed: %m",
+					   path);
+		return -1;
+	}
+
+	str_append(str, INDEXER_HANDSHAKE);
+	str_append(str, "OPTIMIZE\t0\t");
+	str_append_tabescaped(str, user->username);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, boxname);
+	str_append_c(str, '\n');
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m", path);
+		ret = -1;
+	} else {
+		e_debug(event_create_passthrough(backend->event)->
+			set_name("fts_flatcurve_optimize_queued")->
+			add_str("mailbox", boxname)->event(),
+			"Queued optimizing to indexer");
+	}
+	i_close_fd(&fd);
+	return ret;
+}
+
 static int fts_backend_flatcurve_optimize(struct fts_backend *backend)
 {
 	return fts_backend_flatcurve_iterate_ns(backend,
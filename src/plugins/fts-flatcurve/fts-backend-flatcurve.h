@@ -21,6 +21,9 @@ struct flatcurve_fts_backend {
 
 	enum file_lock_method parsed_lock_method;
 
+	/* Commits the changes left uncommitted by write-behind */
+	struct timeout *to_write_behind;
+
 	pool_t pool;
 };
 
@@ -63,6 +66,15 @@ int
 fts_backend_flatcurve_close_mailbox(struct flatcurve_fts_backend *backend,
 				    const char **error_r);
 
+/* Returns TRUE if the automatic optimizations should be queued to indexer
+   instead of running them in this process. */
+bool fts_backend_flatcurve_optimize_is_queued(struct flatcurve_fts_backend *backend);
+/* Add a background request to indexer for optimizing the mailbox.
+   Returns: 0 on success, -1 on error */
+int fts_backend_flatcurve_queue_optimize(struct flatcurve_fts_backend *backend,
+					 const char *boxname,
+					 const char **error_r);
+
 /* Returns: 0 if FTS directory doesn't exist, 1 on deletion, -1 on error */
 int fts_backend_flatcurve_delete_dir(const char *path, const char **error_r);
 
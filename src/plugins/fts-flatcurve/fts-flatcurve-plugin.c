@@ -22,12 +22,17 @@
 #define FTS_FLATCURVE_PLUGIN_OPTIMIZE_LIMIT "fts_flatcurve_optimize_limit"
 #define FTS_FLATCURVE_OPTIMIZE_LIMIT_DEFAULT 10
 
+#define FTS_FLATCURVE_PLUGIN_OPTIMIZE_QUEUE "fts_flatcurve_optimize_queue"
+
 #define FTS_FLATCURVE_PLUGIN_ROTATE_COUNT "fts_flatcurve_rotate_count"
 #define FTS_FLATCURVE_ROTATE_SIZE_DEFAULT 5000
 
 #define FTS_FLATCURVE_PLUGIN_ROTATE_TIME "fts_flatcurve_rotate_time"
 #define FTS_FLATCURVE_ROTATE_TIME_DEFAULT 5000
 
+#define FTS_FLATCURVE_PLUGIN_WRITE_BEHIND_TIME "fts_flatcurve_write_behind_time"
+#define FTS_FLATCURVE_WRITE_BEHIND_TIME_DEFAULT 0
+
 #define FTS_FLATCURVE_PLUGIN_SUBSTRING_SEARCH "fts_flatcurve_substring_search"
 
 const char *fts_flatcurve_plugin_version = DOVECOT_ABI_VERSION;
@@ -119,6 +124,20 @@ fts_flatcurve_plugin_init_settings(struct mail_user *user,
 		set->rotate_time = val;
 	}
 
+	set->write_behind_time = FTS_FLATCURVE_WRITE_BEHIND_TIME_DEFAULT;
+	pset = mail_user_plugin_getenv(user, FTS_FLATCURVE_PLUGIN_WRITE_BEHIND_TIME);
+	if (pset != NULL) {
+		const char *error;
+		if (str_parse_get_interval_msecs(pset, &val, &error) < 0) {
+			*error_r = t_strdup_printf("Invalid %s: %s",
+				FTS_FLATCURVE_PLUGIN_WRITE_BEHIND_TIME, error);
+			return -1;
+		}
+		set->write_behind_time = val;
+	}
+
+	set->optimize_queue = mail_user_plugin_getenv_bool(
+		user, FTS_FLATCURVE_PLUGIN_OPTIMIZE_QUEUE);
 	set->substring_search = mail_user_plugin_getenv_bool(
 		user, FTS_FLATCURVE_PLUGIN_SUBSTRING_SEARCH);
 
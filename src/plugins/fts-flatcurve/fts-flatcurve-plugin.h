@@ -21,6 +21,8 @@ struct fts_flatcurve_settings {
 	unsigned int optimize_limit;
 	unsigned int rotate_count;
 	unsigned int rotate_time;
+	unsigned int write_behind_time;
+	bool optimize_queue;
 	bool substring_search;
 };
 
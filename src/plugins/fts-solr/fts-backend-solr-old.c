@@ -476,6 +476,8 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 			      ctx->documents_added ? "true" : "false");
 	if (solr_connection_post(backend->solr_conn, str) < 0)
 		ret = -1;
+	if (solr_connection_post_wait(backend->solr_conn) < 0)
+		ret = -1;
 
 	str_free(&ctx->cmd);
 	str_free(&ctx->hdr);
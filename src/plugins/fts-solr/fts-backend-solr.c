@@ -382,19 +382,21 @@ fts_backend_solr_expunge_flush(struct solr_fts_backend_update_context *ctx)
 	str_append(ctx->cmd_expunge, "<delete>");
 }
 
-static int fts_backend_solr_commit(struct solr_fts_backend_update_context *ctx)
+static void fts_backend_solr_commit(struct solr_fts_backend_update_context *ctx)
 {
 	struct solr_fts_backend *backend =
 		(struct solr_fts_backend *) ctx->ctx.backend;
 	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(ctx->ctx.backend->ns->user);
 
 	if (!fuser->set.soft_commit)
-		return 0;
+		return;
 
+	/* Don't wait for the commit to finish. The following lookups wait
+	   for it before they're sent. */
 	const char *str = t_strdup_printf(
 		"<commit softCommit=\"true\" waitSearcher=\"%s\"/>",
 		ctx->documents_added ? "true" : "false");
-	return solr_connection_post(backend->solr_conn, str);
+	solr_connection_commit_async(backend->solr_conn, str);
 }
 
 static int
@@ -410,8 +412,7 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 
 	if (ctx->expunges) {
 		fts_backend_solr_expunge_flush(ctx);
-		if (fts_backend_solr_commit(ctx) < 0)
-			ret = -1;
+		fts_backend_solr_commit(ctx);
 	}
 
 	str_free(&ctx->cmd);
@@ -431,6 +432,8 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 {
 	struct solr_fts_backend_update_context *ctx =
 		(struct solr_fts_backend_update_context *)_ctx;
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)_ctx->backend;
 	const char *box_guid;
 
 	if (ctx->prev_uid != 0) {
@@ -438,13 +441,12 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 
 		/* flush solr between mailboxes, so we don't wrongly update
 		   last_uid before we know it has succeeded */
-		if (fts_backed_solr_build_flush(ctx) < 0)
+		if (fts_backed_solr_build_flush(ctx) < 0 ||
+		    solr_connection_post_wait(backend->solr_conn) < 0)
 			_ctx->failed = TRUE;
 		else if (!_ctx->failed) {
-			if (fts_backend_solr_commit(ctx) < 0)
-				_ctx->failed = TRUE;
-			else
-				fts_index_set_last_uid(ctx->cur_box, ctx->prev_uid);
+			fts_backend_solr_commit(ctx);
+			fts_index_set_last_uid(ctx->cur_box, ctx->prev_uid);
 		}
 		ctx->prev_uid = 0;
 	}
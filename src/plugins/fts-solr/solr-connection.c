@@ -31,6 +31,9 @@ struct solr_connection_post {
 
 	struct http_client_request *http_req;
 	int request_status;
+	/* The update is buffered here when it's sent in parallel with the
+	   other updates */
+	buffer_t *payload;
 
 	bool failed:1;
 };
@@ -44,7 +47,12 @@ struct solr_connection {
 	char *http_user;
 	char *http_password;
 
+	/* Number of updates sent without waiting for the response */
+	unsigned int max_parallel_updates;
+	unsigned int pending_updates;
+
 	bool debug:1;
+	bool pending_updates_failed:1;
 	bool posting:1;
 	bool http_ssl:1;
 };
@@ -94,11 +102,13 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 	}
 
 	conn->debug = solr_set->debug;
+	conn->max_parallel_updates = solr_set->max_parallel_updates;
 
 	if (solr_http_client == NULL) {
 		i_zero(&http_set);
 		http_set.max_idle_time_msecs = 5*1000;
-		http_set.max_parallel_connections = 1;
+		http_set.max_parallel_connections =
+			I_MAX(solr_set->max_parallel_updates, 1);
 		http_set.max_pipelined_requests = 1;
 		http_set.max_redirects = 1;
 		http_set.max_attempts = 3;
@@ -127,6 +137,8 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	struct solr_connection *conn = *_conn;
 
 	*_conn = NULL;
+	if (conn->pending_updates > 0)
+		(void)solr_connection_post_wait(conn);
 	event_unref(&conn->event);
 	i_free(conn->http_host);
 	i_free(conn->http_base_url);
@@ -194,6 +206,11 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 	lctx.result_pool = pool;
 	lctx.event = conn->event;
 
+	/* Make sure the lookup sees the updates and commits that are still
+	   being sent. */
+	if (conn->pending_updates > 0)
+		(void)solr_connection_post_wait(conn);
+
 	i_free_and_null(conn->http_failure);
 	url = t_strconcat(conn->http_base_url, "select?", query, NULL);
 
@@ -231,18 +248,46 @@ solr_connection_update_response(const struct http_response *response,
 	}
 }
 
+static void
+solr_connection_update_async_response(const struct http_response *response,
+				      struct solr_connection *conn)
+{
+	i_assert(conn->pending_updates > 0);
+	conn->pending_updates--;
+
+	if (response->status / 100 != 2) {
+		e_error(conn->event, "fts-solr: Indexing failed: %s",
+			http_response_get_message(response));
+		conn->pending_updates_failed = TRUE;
+	}
+}
+
+static void
+solr_connection_commit_async_response(const struct http_response *response,
+				      struct solr_connection *conn)
+{
+	i_assert(conn->pending_updates > 0);
+	conn->pending_updates--;
+
+	if (response->status / 100 != 2) {
+		e_error(conn->event, "fts-solr: Commit failed: %s",
+			http_response_get_message(response));
+	}
+}
+
 static struct http_client_request *
-solr_connection_post_request(struct solr_connection_post *post)
+solr_connection_http_request(struct solr_connection *conn,
+			     http_client_request_callback_t *callback,
+			     void *context)
 {
-	struct solr_connection *conn = post->conn;
 	struct http_client_request *http_req;
 	const char *url;
 
 	url = t_strconcat(conn->http_base_url, "update", NULL);
 
-	http_req = http_client_request(solr_http_client, "POST",
-				       conn->http_host, url,
-				       solr_connection_update_response, post);
+	http_req = (http_client_request)(solr_http_client, "POST",
+					 conn->http_host, url,
+					 callback, context);
 	if (conn->http_user != NULL) {
 		http_client_request_set_auth_simple(
 			http_req, conn->http_user, conn->http_password);
@@ -253,6 +298,31 @@ solr_connection_post_request(struct solr_connection_post *post)
 	return http_req;
 }
 
+static struct http_client_request *
+solr_connection_post_request(struct solr_connection_post *post)
+{
+	return solr_connection_http_request(post->conn,
+		(http_client_request_callback_t *)solr_connection_update_response,
+		post);
+}
+
+static void
+solr_connection_post_submit_async(struct solr_connection *conn,
+				  const unsigned char *data, size_t size,
+				  http_client_request_callback_t *callback)
+{
+	struct http_client_request *http_req;
+
+	/* Limit the number of updates waiting for a response. */
+	if (conn->pending_updates >= conn->max_parallel_updates)
+		http_client_wait(solr_http_client);
+
+	http_req = solr_connection_http_request(conn, callback, conn);
+	http_client_request_set_payload_data(http_req, data, size);
+	http_client_request_submit(http_req);
+	conn->pending_updates++;
+}
+
 struct solr_connection_post *
 solr_connection_post_begin(struct solr_connection *conn)
 {
@@ -263,7 +333,15 @@ solr_connection_post_begin(struct solr_connection *conn)
 
 	post = i_new(struct solr_connection_post, 1);
 	post->conn = conn;
-	post->http_req = solr_connection_post_request(post);
+	if (conn->max_parallel_updates > 1)
+		post->payload = buffer_create_dynamic(default_pool, 1024*64);
+	else {
+		/* The blocking payload API doesn't mix well with other
+		   requests still running in the client. */
+		if (conn->pending_updates > 0)
+			http_client_wait(solr_http_client);
+		post->http_req = solr_connection_post_request(post);
+	}
 	return post;
 }
 
@@ -275,6 +353,11 @@ void solr_connection_post_more(struct solr_connection_post *post,
 	if (post->failed)
 		return;
 
+	if (post->payload != NULL) {
+		buffer_append(post->payload, data, size);
+		return;
+	}
+
 	if (post->request_status == 0) {
 		(void)http_client_request_send_payload(
 			&post->http_req, data, size);
@@ -293,7 +376,13 @@ int solr_connection_post_end(struct solr_connection_post **_post)
 
 	*_post = NULL;
 
-	if (!post->failed) {
+	if (post->payload != NULL) {
+		solr_connection_post_submit_async(conn,
+			post->payload->data, post->payload->used,
+			(http_client_request_callback_t *)
+				solr_connection_update_async_response);
+		buffer_free(&post->payload);
+	} else if (!post->failed) {
 		if (http_client_request_finish_payload(&post->http_req) < 0 ||
 		    post->request_status < 0) {
 			ret = -1;
@@ -328,3 +417,27 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 
 	return post.request_status;
 }
+
+void solr_connection_commit_async(struct solr_connection *conn,
+				  const char *cmd)
+{
+	i_assert(!conn->posting);
+
+	solr_connection_post_submit_async(conn,
+		(const unsigned char *)cmd, strlen(cmd),
+		(http_client_request_callback_t *)
+			solr_connection_commit_async_response);
+}
+
+int solr_connection_post_wait(struct solr_connection *conn)
+{
+	int ret;
+
+	if (conn->pending_updates > 0)
+		http_client_wait(solr_http_client);
+	i_assert(conn->pending_updates == 0);
+
+	ret = conn->pending_updates_failed ? -1 : 0;
+	conn->pending_updates_failed = FALSE;
+	return ret;
+}
@@ -16,6 +16,13 @@ void solr_connection_deinit(struct solr_connection **conn);
 int solr_connection_select(struct solr_connection *conn, const char *query,
 			   pool_t pool, struct solr_result ***box_results_r);
 int solr_connection_post(struct solr_connection *conn, const char *cmd);
+/* Send a commit without waiting for its response. Failures are only
+   logged, since the updates themselves have already succeeded. */
+void solr_connection_commit_async(struct solr_connection *conn,
+				  const char *cmd);
+/* Wait for the updates sent in parallel (max_parallel_updates > 1) and the
+   asynchronous commits to finish. Returns -1 if any of the updates failed. */
+int solr_connection_post_wait(struct solr_connection *conn);
 
 struct solr_connection_post *
 solr_connection_post_begin(struct solr_connection *conn);
@@ -269,24 +269,47 @@ fts_build_add_tokens_with_filter(struct fts_mail_build_context *ctx,
 {
 	struct fts_tokenizer *tokenizer = ctx->cur_user_lang->index_tokenizer;
 	struct fts_filter *filter = ctx->cur_user_lang->filter;
+	ARRAY_TYPE(const_string) tokens;
 	const char *token, *error;
-	int ret = 1, ret2;
-
-	while (ret > 0) T_BEGIN {
-		ret = ret2 = fts_tokenizer_next(tokenizer, data, size, &token, &error);
-		if (ret2 > 0 && filter != NULL)
-			ret2 = fts_filter_filter(filter, &token, &error);
-		if (ret2 < 0) {
+	unsigned int i, count;
+	int ret, ret2;
+
+	/* Tokenize the whole block first and only then run the filters and
+	   give the tokens to the backend. The tokens are allocated from data
+	   stack, so this way there's only a single data stack frame for the
+	   whole block instead of one for each token. The filtered tokens may
+	   point to the filter's internal buffer, so they must be given to the
+	   backend immediately. */
+	T_BEGIN {
+		t_array_init(&tokens, 64);
+		while ((ret = fts_tokenizer_next(tokenizer, data, size,
+						 &token, &error)) > 0)
+			array_push_back(&tokens, &token);
+		if (ret < 0) {
 			mail_set_critical(ctx->mail,
 				"fts: Couldn't create indexable tokens: %s",
 				error);
 		}
-		if (ret2 > 0) {
+
+		const char *const *token_p = array_get(&tokens, &count);
+		for (i = 0; i < count; i++) {
+			token = token_p[i];
+			if (filter != NULL) {
+				ret2 = fts_filter_filter(filter, &token, &error);
+				if (ret2 < 0) {
+					mail_set_critical(ctx->mail,
+						"fts: Couldn't create indexable tokens: %s",
+						error);
+				}
+				if (ret2 <= 0)
+					continue;
+			}
 			if (fts_backend_update_build_more(ctx->update_ctx,
 							  (const void *)token,
 							  strlen(token)) < 0) {
 				mail_storage_set_internal_error(ctx->mail->box->storage);
 				ret = -1;
+				break;
 			}
 		}
 	} T_END;
@@ -0,0 +1,226 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "hex-binary.h"
+#include "istream.h"
+#include "sha2.h"
+#include "fs-api.h"
+#include "message-parser.h"
+#include "mail-user.h"
+#include "fts-user.h"
+#include "fts-parser.h"
+
+/* Attachments larger than this are passed directly to the parser without
+   caching, so they don't need to be kept in memory. */
+#define FTS_PARSER_CACHE_MAX_INPUT_SIZE (8*1024*1024)
+/* Don't cache extracted texts larger than this. */
+#define FTS_PARSER_CACHE_MAX_OUTPUT_SIZE (1024*1024)
+
+struct cache_fts_parser {
+	struct fts_parser parser;
+	struct fts_parser *real_parser;
+	struct fs *fs;
+	struct event *event;
+
+	struct sha256_ctx hash_ctx;
+	/* Input buffered until the cache has been looked up */
+	buffer_t *input;
+	/* Extracted text read from the cache or returned by the parser */
+	buffer_t *output;
+	size_t output_offset;
+	char *path;
+
+	bool passthrough:1;
+	bool looked_up:1;
+	bool hit:1;
+	bool output_finished:1;
+	bool output_too_large:1;
+};
+
+static void fts_parser_cache_send_input(struct cache_fts_parser *parser,
+					const struct message_block *block)
+{
+	struct message_block input_block = *block;
+
+	if (parser->input->used > 0) {
+		input_block.data = parser->input->data;
+		input_block.size = parser->input->used;
+		parser->real_parser->v.more(parser->real_parser, &input_block);
+	}
+	buffer_free(&parser->input);
+}
+
+static const char *fts_parser_cache_get_path(struct cache_fts_parser *parser)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+	const char *hash;
+
+	sha256_result(&parser->hash_ctx, digest);
+	hash = binary_to_hex(digest, sizeof(digest));
+	return t_strdup_printf("%c%c/%s", hash[0], hash[1], hash);
+}
+
+static int fts_parser_cache_lookup(struct cache_fts_parser *parser)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	file = fs_file_init(parser->fs, parser->path, FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	parser->output = buffer_create_dynamic(default_pool, IO_BLOCK_SIZE);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		buffer_append(parser->output, data, size);
+		i_stream_skip(input, size);
+	}
+
+	if (ret == 0) {
+		/* async fs backend - don't wait for it */
+		buffer_set_used_size(parser->output, 0);
+	} else if (input->stream_errno == 0)
+		ret = 1;
+	else {
+		if (input->stream_errno != ENOENT) {
+			e_error(parser->event, "read(%s) failed: %s",
+				i_stream_get_name(input),
+				i_stream_get_error(input));
+		}
+		buffer_set_used_size(parser->output, 0);
+		ret = 0;
+	}
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	return ret;
+}
+
+static void fts_parser_cache_write(struct cache_fts_parser *parser)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(parser->fs, parser->path, FS_OPEN_MODE_REPLACE);
+	if (fs_write(file, parser->output->data, parser->output->used) < 0) {
+		e_error(parser->event, "fs_write(%s) failed: %s",
+			fs_file_path(file), fs_file_last_error(file));
+	}
+	fs_file_deinit(&file);
+}
+
+static void fts_parser_cache_more(struct fts_parser *_parser,
+				  struct message_block *block)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+
+	if (parser->passthrough) {
+		parser->real_parser->v.more(parser->real_parser, block);
+		return;
+	}
+
+	if (block->size > 0) {
+		sha256_loop(&parser->hash_ctx, block->data, block->size);
+		if (parser->input->used + block->size >
+		    FTS_PARSER_CACHE_MAX_INPUT_SIZE) {
+			/* too large to cache */
+			fts_parser_cache_send_input(parser, block);
+			parser->passthrough = TRUE;
+			parser->real_parser->v.more(parser->real_parser, block);
+		} else {
+			buffer_append(parser->input, block->data, block->size);
+		}
+		block->size = 0;
+		return;
+	}
+
+	if (!parser->looked_up) {
+		parser->looked_up = TRUE;
+		parser->path = i_strdup(fts_parser_cache_get_path(parser));
+		if (fts_parser_cache_lookup(parser) > 0) {
+			e_debug(parser->event, "Cache hit for %s", parser->path);
+			parser->hit = TRUE;
+			buffer_free(&parser->input);
+		} else {
+			fts_parser_cache_send_input(parser, block);
+		}
+	}
+
+	if (parser->hit) {
+		block->data = CONST_PTR_OFFSET(parser->output->data,
+					       parser->output_offset);
+		block->size = parser->output->used - parser->output_offset;
+		parser->output_offset = parser->output->used;
+		return;
+	}
+
+	parser->real_parser->v.more(parser->real_parser, block);
+	if (block->size == 0)
+		parser->output_finished = TRUE;
+	else if (parser->output_too_large)
+		;
+	else if (parser->output->used + block->size >
+		 FTS_PARSER_CACHE_MAX_OUTPUT_SIZE) {
+		parser->output_too_large = TRUE;
+		buffer_free(&parser->output);
+	} else {
+		buffer_append(parser->output, block->data, block->size);
+	}
+}
+
+static int fts_parser_cache_deinit(struct fts_parser *_parser,
+				   const char **retriable_err_msg_r)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+	int ret;
+
+	ret = fts_parser_deinit(&parser->real_parser, retriable_err_msg_r);
+	if (parser->hit) {
+		/* the parser was never used */
+		ret = 1;
+	} else if (ret > 0 && parser->output_finished &&
+		   !parser->output_too_large && !parser->passthrough) {
+		fts_parser_cache_write(parser);
+	}
+
+	buffer_free(&parser->input);
+	buffer_free(&parser->output);
+	event_unref(&parser->event);
+	i_free(parser->path);
+	i_free(parser);
+	return ret;
+}
+
+static struct fts_parser_vfuncs fts_parser_cache = {
+	NULL,
+	fts_parser_cache_more,
+	fts_parser_cache_deinit,
+	NULL
+};
+
+struct fts_parser *
+fts_parser_cache_init(struct fts_parser_context *parser_context,
+		      const char *parser_name, struct fts_parser *real_parser)
+{
+	struct cache_fts_parser *parser;
+	struct fs *fs;
+
+	fs = fts_user_get_parser_cache_fs(parser_context->user);
+	if (fs == NULL)
+		return real_parser;
+
+	parser = i_new(struct cache_fts_parser, 1);
+	parser->parser.v = fts_parser_cache;
+	parser->real_parser = real_parser;
+	parser->fs = fs;
+	parser->event = event_create(parser_context->event);
+	event_set_append_log_prefix(parser->event, "fts-parser-cache: ");
+	parser->input = buffer_create_dynamic(default_pool, IO_BLOCK_SIZE);
+
+	/* The parser and content type can affect the extracted text, so
+	   they're part of the key along with the decoded body part. */
+	sha256_init(&parser->hash_ctx);
+	sha256_loop(&parser->hash_ctx, parser_name, strlen(parser_name) + 1);
+	sha256_loop(&parser->hash_ctx, parser_context->content_type,
+		    strlen(parser_context->content_type) + 1);
+	return &parser->parser;
+}
@@ -37,8 +37,18 @@ bool fts_parser_init(struct fts_parser_context *parser_context,
 		T_BEGIN {
 			*parser_r = parsers[i]->try_init(parser_context);
 		} T_END;
-		if (*parser_r != NULL)
-			return TRUE;
+		if (*parser_r == NULL)
+			continue;
+
+		/* external parsers are expensive - cache their output */
+		if (parsers[i] == &fts_parser_tika) {
+			*parser_r = fts_parser_cache_init(parser_context,
+							  "tika", *parser_r);
+		} else if (parsers[i] == &fts_parser_script) {
+			*parser_r = fts_parser_cache_init(parser_context,
+							  "script", *parser_r);
+		}
+		return TRUE;
 	}
 	return FALSE;
 }
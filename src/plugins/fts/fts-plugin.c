@@ -27,6 +27,7 @@ void fts_plugin_init(struct module *module)
 
 void fts_plugin_deinit(void)
 {
+	fts_user_cache_deinit();
 	fts_library_deinit();
 	fts_parsers_unload();
 	mail_storage_hooks_remove(&fts_mail_storage_hooks);
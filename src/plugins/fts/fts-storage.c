@@ -32,6 +32,9 @@
 
 #define INDEXER_SOCKET_NAME "indexer"
 #define INDEXER_HANDSHAKE "VERSION\tindexer-client\t1\t0\n"
+/* With fts_autoindex_inline, leave indexing to the indexer process if there
+   are more unindexed mails than this. */
+#define FTS_AUTOINDEX_INLINE_MAX_MSGS 20
 
 struct fts_mailbox_list {
 	union mailbox_list_module_context module_ctx;
@@ -705,6 +708,55 @@ static void fts_queue_index(struct mailbox *box)
 	i_close_fd(&fd);
 }
 
+static int fts_index_inline(struct mailbox *box)
+{
+	struct mailbox *ibox;
+	struct mailbox_transaction_context *t;
+	struct mailbox_status status;
+	struct mail *mail;
+	int ret = 1;
+
+	/* Use a separate mailbox, so the caller's view of the mailbox isn't
+	   synced behind its back. This is similar to what indexer-worker
+	   does, but without the indexer round trip and re-initializing the
+	   user in another process. */
+	ibox = mailbox_alloc(box->list, box->vname, 0);
+	if (mailbox_sync(ibox, 0) < 0 ||
+	    mailbox_get_status(ibox, STATUS_MESSAGES | STATUS_LAST_CACHED_SEQ,
+			       &status) < 0) {
+		e_error(box->event, "Failed to index mails inline: %s",
+			mailbox_get_last_internal_error(ibox, NULL));
+		mailbox_free(&ibox);
+		return -1;
+	}
+	if (status.last_cached_seq >= status.messages) {
+		/* everything is already indexed */
+	} else if (status.messages - status.last_cached_seq >
+		   FTS_AUTOINDEX_INLINE_MAX_MSGS) {
+		ret = 0;
+	} else {
+		/* Precaching the last mail indexes all the mails missing
+		   from the FTS index. */
+		t = mailbox_transaction_begin(ibox, 0, "FTS inline index");
+		mail = mail_alloc(t, MAIL_FETCH_STREAM_HEADER |
+				  MAIL_FETCH_STREAM_BODY, NULL);
+		mail_set_seq(mail, status.messages);
+		if (mail_precache(mail) < 0)
+			ret = -1;
+		mail_free(&mail);
+		if (ret < 0)
+			mailbox_transaction_rollback(&t);
+		else if (mailbox_transaction_commit(&t) < 0)
+			ret = -1;
+		if (ret < 0) {
+			e_error(box->event, "Failed to index mails inline: %s",
+				mailbox_get_last_internal_error(ibox, NULL));
+		}
+	}
+	mailbox_free(&ibox);
+	return ret;
+}
+
 static int
 fts_transaction_commit(struct mailbox_transaction_context *t,
 		       struct mail_transaction_commit_changes *changes_r)
@@ -731,8 +783,14 @@ fts_transaction_commit(struct mailbox_transaction_context *t,
 	if (ret < 0)
 		return -1;
 
-	if (autoindex)
-		fts_queue_index(box);
+	if (autoindex) {
+		/* If the inline indexing fails or there are too many mails to
+		   index, fall back to the indexer. */
+		if (!mail_user_plugin_getenv_bool(box->storage->user,
+						  "fts_autoindex_inline") ||
+		    fts_index_inline(box) <= 0)
+			fts_queue_index(box);
+	}
 	return 0;
 }
 
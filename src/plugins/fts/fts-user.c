@@ -1,7 +1,12 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "str.h"
 #include "module-context.h"
+#include "fs-api.h"
+#include "iostream-ssl.h"
 #include "mail-user.h"
 #include "mail-storage-private.h"
 #include "mailbox-match-plugin.h"
@@ -22,11 +27,19 @@ struct fts_user {
 	ARRAY_TYPE(fts_user_language) languages, data_languages;
 
 	struct mailbox_match_plugin *autoindex_exclude;
+	/* fts_parser_cache: extracted attachment text cache */
+	struct fs *parser_cache_fs;
 };
 
 static MODULE_CONTEXT_DEFINE_INIT(fts_user_module,
 				  &mail_user_module_register);
 
+/* Maximum number of different filter chain configurations to cache. */
+#define FTS_USER_FILTERS_CACHE_MAX_COUNT 32
+
+/* language + filters with their settings => filter chain */
+static HASH_TABLE(char *, struct fts_filter *) fts_user_filters_cache;
+
 static const char *const *str_keyvalues_to_array(const char *str)
 {
 	const char *key, *value, *const *keyvalues;
@@ -92,6 +105,8 @@ fts_user_create_filters(struct mail_user *user, const struct fts_language *lang,
 	struct fts_filter *filter = NULL, *parent = NULL;
 	const char *filters_key, *const *filters, *filter_set_name;
 	const char *str, *error, *set_key;
+	ARRAY_TYPE(const_string) set_keys, set_values;
+	string_t *cache_key;
 	unsigned int i;
 	int ret = 0;
 
@@ -110,13 +125,15 @@ fts_user_create_filters(struct mail_user *user, const struct fts_language *lang,
 	}
 
 	filters = t_strsplit_spaces(str, " ");
+	t_array_init(&set_keys, 8);
+	t_array_init(&set_values, 8);
+	cache_key = t_str_new(128);
+	str_append(cache_key, lang->name);
 	for (i = 0; filters[i] != NULL; i++) {
-		filter_class = fts_filter_find(filters[i]);
-		if (filter_class == NULL) {
+		if (fts_filter_find(filters[i]) == NULL) {
 			*error_r = t_strdup_printf("%s: Unknown filter '%s'",
 						   filters_key, filters[i]);
-			ret = -1;
-			break;
+			return -1;
 		}
 
 		/* try the language-specific setting first */
@@ -128,7 +145,29 @@ fts_user_create_filters(struct mail_user *user, const struct fts_language *lang,
 			set_key = t_strdup_printf("fts_filter_%s", filter_set_name);
 			str = mail_user_plugin_getenv(user, set_key);
 		}
+		array_push_back(&set_keys, &set_key);
+		array_push_back(&set_values, &str);
 
+		str_printfa(cache_key, "\n%s\t%c%s", filters[i],
+			    str == NULL ? '-' : '+', str == NULL ? "" : str);
+	}
+
+	/* Filters don't keep any per-user state, so the same filter chain can
+	   be shared by all users with the same configuration. */
+	if (hash_table_is_created(fts_user_filters_cache)) {
+		filter = hash_table_lookup(fts_user_filters_cache,
+					   str_c(cache_key));
+		if (filter != NULL) {
+			fts_filter_ref(filter);
+			*filter_r = filter;
+			return 0;
+		}
+	}
+
+	for (i = 0; filters[i] != NULL; i++) {
+		filter_class = fts_filter_find(filters[i]);
+		set_key = array_idx_elem(&set_keys, i);
+		str = array_idx_elem(&set_values, i);
 		if (fts_filter_create(filter_class, parent, lang,
 				      str_keyvalues_to_array(str),
 				      &filter, &error) < 0) {
@@ -145,6 +184,17 @@ fts_user_create_filters(struct mail_user *user, const struct fts_language *lang,
 			fts_filter_unref(&parent);
 		return -1;
 	}
+
+	if (!hash_table_is_created(fts_user_filters_cache)) {
+		hash_table_create(&fts_user_filters_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	if (hash_table_count(fts_user_filters_cache) <
+	    FTS_USER_FILTERS_CACHE_MAX_COUNT) {
+		fts_filter_ref(filter);
+		hash_table_insert(fts_user_filters_cache,
+				  i_strdup(str_c(cache_key)), filter);
+	}
 	*filter_r = filter;
 	return 0;
 }
@@ -374,6 +424,7 @@ static void fts_user_free(struct fts_user *fuser)
 			fts_user_language_free(user_lang);
 	}
 	mailbox_match_plugin_deinit(&fuser->autoindex_exclude);
+	fs_deinit(&fuser->parser_cache_fs);
 }
 
 static int
@@ -390,6 +441,29 @@ fts_mail_user_init_libfts(struct mail_user *user, struct fts_user *fuser,
 	return 0;
 }
 
+static int
+fts_mail_user_init_parser_cache(struct mail_user *user, struct fts_user *fuser,
+				const char **error_r)
+{
+	struct fs_settings fs_set;
+	struct ssl_iostream_settings ssl_set;
+	const char *str, *error;
+
+	str = mail_user_plugin_getenv(user, "fts_parser_cache");
+	if (str == NULL || str[0] == '\0')
+		return 0;
+
+	i_zero(&fs_set);
+	mail_user_init_fs_settings(user, &fs_set, &ssl_set);
+	if (fs_init_from_string(str, &fs_set, &fuser->parser_cache_fs,
+				&error) < 0) {
+		*error_r = t_strdup_printf(
+			"fts_parser_cache: fs_init(%s) failed: %s", str, error);
+		return -1;
+	}
+	return 0;
+}
+
 int fts_mail_user_init(struct mail_user *user, bool initialize_libfts,
 		       const char **error_r)
 {
@@ -409,6 +483,10 @@ int fts_mail_user_init(struct mail_user *user, bool initialize_libfts,
 			return -1;
 		}
 	}
+	if (fts_mail_user_init_parser_cache(user, fuser, error_r) < 0) {
+		fts_user_free(fuser);
+		return -1;
+	}
 	fuser->autoindex_exclude =
 		mailbox_match_plugin_init(user, "fts_autoindex_exclude");
 
@@ -426,3 +504,28 @@ void fts_mail_user_deinit(struct mail_user *user)
 			fts_user_free(fuser);
 	}
 }
+
+struct fs *fts_user_get_parser_cache_fs(struct mail_user *user)
+{
+	struct fts_user *fuser = FTS_USER_CONTEXT(user);
+
+	return fuser == NULL ? NULL : fuser->parser_cache_fs;
+}
+
+void fts_user_cache_deinit(void)
+{
+	struct hash_iterate_context *iter;
+	struct fts_filter *filter;
+	char *key;
+
+	if (!hash_table_is_created(fts_user_filters_cache))
+		return;
+
+	iter = hash_table_iterate_init(fts_user_filters_cache);
+	while (hash_table_iterate(iter, fts_user_filters_cache, &key, &filter)) {
+		fts_filter_unref(&filter);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&fts_user_filters_cache);
+}
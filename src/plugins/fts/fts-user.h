@@ -24,4 +24,11 @@ int fts_mail_user_init(struct mail_user *user, bool initialize_libfts,
 		       const char **error_r);
 void fts_mail_user_deinit(struct mail_user *user);
 
+/* Returns the fs configured with fts_parser_cache, or NULL if extracted
+   attachment text isn't cached. */
+struct fs *fts_user_get_parser_cache_fs(struct mail_user *user);
+
+/* Free the filter chains shared between users. */
+void fts_user_cache_deinit(void);
+
 #endif
@@ -2,6 +2,8 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "hash.h"
+#include "str-parse.h"
 #include "dict.h"
 #include "mail-user.h"
 #include "mail-namespace.h"
@@ -13,6 +15,9 @@
 	MODULE_CONTEXT_REQUIRE(obj, last_login_user_module)
 
 #define LAST_LOGIN_DEFAULT_KEY_PREFIX "last-login/"
+/* Maximum number of users whose last update time is remembered for
+   last_login_min_interval. The whole cache is dropped when it's reached. */
+#define LAST_LOGIN_MAX_RECENT_UPDATES 1000
 
 struct last_login_user {
 	union mail_user_module_context module_ctx;
@@ -25,6 +30,55 @@ const char *last_login_plugin_version = DOVECOT_ABI_VERSION;
 static MODULE_CONTEXT_DEFINE_INIT(last_login_user_module,
 				  &mail_user_module_register);
 
+/* dict + key -> time of the last update done by this process */
+static pool_t last_login_recent_pool;
+static HASH_TABLE(char *, void *) last_login_recent_updates;
+
+static void last_login_recent_updates_deinit(void)
+{
+	if (!hash_table_is_created(last_login_recent_updates))
+		return;
+	hash_table_destroy(&last_login_recent_updates);
+	pool_unref(&last_login_recent_pool);
+}
+
+static bool
+last_login_recently_updated(const char *dict_value, const char *key_name,
+			    unsigned int min_interval_secs)
+{
+	const char *key = t_strconcat(dict_value, "\n", key_name, NULL);
+	char *orig_key;
+	void *value;
+
+	if (!hash_table_is_created(last_login_recent_updates)) {
+		last_login_recent_pool =
+			pool_alloconly_create("last-login recent updates", 4096);
+		hash_table_create(&last_login_recent_updates, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	if (hash_table_lookup_full(last_login_recent_updates, key,
+				   &orig_key, &value)) {
+		time_t last_update = POINTER_CAST_TO(value, time_t);
+
+		if (last_update <= ioloop_time &&
+		    ioloop_time - last_update < (time_t)min_interval_secs)
+			return TRUE;
+		hash_table_update(last_login_recent_updates, orig_key,
+				  POINTER_CAST(ioloop_time));
+		return FALSE;
+	}
+
+	if (hash_table_count(last_login_recent_updates) >=
+	    LAST_LOGIN_MAX_RECENT_UPDATES) {
+		hash_table_clear(last_login_recent_updates, TRUE);
+		p_clear(last_login_recent_pool);
+	}
+	hash_table_insert(last_login_recent_updates,
+			  p_strdup(last_login_recent_pool, key),
+			  POINTER_CAST(ioloop_time));
+	return FALSE;
+}
+
 static void last_login_dict_deinit(struct mail_user *user)
 {
 	struct last_login_user *luser = LAST_LOGIN_USER_CONTEXT(user);
@@ -79,7 +133,8 @@ static void last_login_mail_user_created(struct mail_user *user)
 	struct dict *dict;
 	struct dict_settings set;
 	struct dict_transaction_context *trans;
-	const char *dict_value, *key_name, *precision, *error;
+	const char *dict_value, *key_name, *precision, *min_interval, *error;
+	unsigned int min_interval_secs = 0;
 
 	if (user->autocreated) {
 		/* we want to handle only logged in users,
@@ -95,6 +150,34 @@ static void last_login_mail_user_created(struct mail_user *user)
 	if (dict_value == NULL || dict_value[0] == '\0')
 		return;
 
+	key_name = mail_user_plugin_getenv(user, "last_login_key");
+	if (key_name == NULL) {
+		key_name = t_strdup_printf(LAST_LOGIN_DEFAULT_KEY_PREFIX"%s",
+					   user->username);
+	}
+	key_name = t_strconcat(DICT_PATH_SHARED, key_name, NULL);
+
+	/* With many short sessions the same user's last login would be
+	   written over and over again. Skip the update if this process
+	   already did it recently. */
+	min_interval = mail_user_plugin_getenv(user, "last_login_min_interval");
+	if (min_interval != NULL && min_interval[0] != '\0' &&
+	    str_parse_get_interval(min_interval, &min_interval_secs,
+				   &error) < 0) {
+		e_error(user->event,
+			"last_login_dict: Invalid last_login_min_interval '%s': %s",
+			min_interval, error);
+		min_interval_secs = 0;
+	}
+	if (min_interval_secs > 0 &&
+	    last_login_recently_updated(dict_value, key_name,
+					min_interval_secs)) {
+		e_debug(user->event, "last_login_dict: "
+			"Skipping update, it was done less than %u seconds ago",
+			min_interval_secs);
+		return;
+	}
+
 	i_zero(&set);
 	set.base_dir = user->set->base_dir;
 	set.event_parent = user->event;
@@ -113,13 +196,6 @@ static void last_login_mail_user_created(struct mail_user *user)
 	luser->dict = dict;
 	MODULE_CONTEXT_SET(user, last_login_user_module, luser);
 
-	key_name = mail_user_plugin_getenv(user, "last_login_key");
-	if (key_name == NULL) {
-		key_name = t_strdup_printf(LAST_LOGIN_DEFAULT_KEY_PREFIX"%s",
-					   user->username);
-	}
-	key_name = t_strconcat(DICT_PATH_SHARED, key_name, NULL);
-
 	precision = mail_user_plugin_getenv(user, "last_login_precision");
 
 	struct dict_op_settings dset = *mail_user_get_dict_op_settings(user);
@@ -159,4 +235,5 @@ void last_login_plugin_init(struct module *module)
 void last_login_plugin_deinit(void)
 {
 	mail_storage_hooks_remove(&last_login_mail_storage_hooks);
+	last_login_recent_updates_deinit();
 }
@@ -325,8 +325,13 @@ static void lazy_expunge_mail_expunge_move(struct mail *_mail)
 			return;
 		}
 
+		/* The expunged mails are rarely read, so don't spend time
+		   copying their cached data. The backends already move the
+		   message bodies without copying them where possible (mdbox
+		   refcounting, sdbox/maildir hardlinks). */
 		lt->dest_trans = mailbox_transaction_begin(lt->dest_box,
-					  MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  MAILBOX_TRANSACTION_FLAG_EXTERNAL |
+					  MAILBOX_TRANSACTION_FLAG_NO_CACHE_COPY,
 					  __func__);
 	}
 
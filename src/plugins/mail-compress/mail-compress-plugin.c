@@ -10,6 +10,7 @@
 #include "index-storage.h"
 #include "index-mail.h"
 #include "compression.h"
+#include "zstd-dictionary.h"
 #include "mail-compress-plugin.h"
 
 #include <fcntl.h>
@@ -44,6 +45,10 @@ struct mail_compress_user {
 
 	const struct compression_handler *save_handler;
 	int save_level;
+	unsigned int save_workers;
+	/* Also used for reading, so mails saved with it stay readable after
+	   mail_compress_save is changed. */
+	struct zstd_dictionary *zstd_dict;
 };
 
 const char *mail_compress_plugin_version = DOVECOT_ABI_VERSION;
@@ -233,8 +238,20 @@ mail_compress_mail_save_compress_begin(struct mail_save_context *ctx,
 	if (zbox->super.save_begin(ctx, input) < 0)
 		return -1;
 
-	output = zuser->save_handler->create_ostream(ctx->data.output,
-						     zuser->save_level);
+	if (zuser->zstd_dict != NULL &&
+	    strcmp(zuser->save_handler->name, "zstd") == 0) {
+		output = o_stream_create_zstd_dict(ctx->data.output,
+						   zuser->save_level,
+						   zuser->save_workers,
+						   zuser->zstd_dict);
+	} else if (zuser->save_workers > 0) {
+		output = zuser->save_handler->create_ostream_workers(
+			ctx->data.output, zuser->save_level,
+			zuser->save_workers);
+	} else {
+		output = zuser->save_handler->create_ostream(ctx->data.output,
+							     zuser->save_level);
+	}
 	o_stream_unref(&ctx->data.output);
 	ctx->data.output = output;
 	o_stream_cork(ctx->data.output);
@@ -330,6 +347,7 @@ static void mail_compress_mail_user_deinit(struct mail_user *user)
 	struct mail_compress_user *zuser = MAIL_COMPRESS_USER_CONTEXT(user);
 
 	mail_compress_mail_cache_close(zuser);
+	zstd_dictionary_unref(&zuser->zstd_dict);
 	zuser->module_ctx.super.deinit(user);
 }
 
@@ -337,7 +355,7 @@ static void mail_compress_mail_user_created(struct mail_user *user)
 {
 	struct mail_user_vfuncs *v = user->vlast;
 	struct mail_compress_user *zuser;
-	const char *name;
+	const char *name, *error;
 	int ret;
 
 	zuser = p_new(user->pool, struct mail_compress_user, 1);
@@ -372,6 +390,28 @@ static void mail_compress_mail_user_created(struct mail_user *user)
 	} else if (zuser->save_handler != NULL) {
 		zuser->save_level = zuser->save_handler->get_default_level();
 	}
+	name = zuser->save_handler == NULL ? NULL :
+		mail_user_plugin_getenv(user, "mail_compress_save_workers");
+	if (name != NULL && name[0] != '\0') {
+		if (str_to_uint(name, &zuser->save_workers) < 0) {
+			e_error(user->event,
+				"mail_compress_save_workers: Invalid number: %s",
+				name);
+			zuser->save_workers = 0;
+		} else if (zuser->save_workers > 0 &&
+			   zuser->save_handler->create_ostream_workers == NULL) {
+			e_error(user->event,
+				"mail_compress_save_workers: Not supported by handler %s",
+				zuser->save_handler->name);
+			zuser->save_workers = 0;
+		}
+	}
+	name = mail_user_plugin_getenv(user, "mail_compress_zstd_dictionary");
+	if (name != NULL && name[0] != '\0' &&
+	    zstd_dictionary_load(name, &zuser->zstd_dict, &error) < 0) {
+		e_error(user->event, "mail_compress_zstd_dictionary: %s",
+			error);
+	}
 	MODULE_CONTEXT_SET(user, mail_compress_user_module, zuser);
 }
 
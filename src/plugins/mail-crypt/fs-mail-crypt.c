@@ -71,5 +71,6 @@ const struct fs fs_class_mail_crypt = {
 		.iter_deinit = fs_wrapper_iter_deinit,
 		.switch_ioloop = NULL,
 		.get_nlinks = fs_wrapper_get_nlinks,
+		.delete_multi = fs_wrapper_delete_multi,
 	}
 };
@@ -1,6 +1,7 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "str.h"
 #include "dict.h"
 #include "array.h"
@@ -22,31 +23,56 @@ struct mail_crypt_key_cache_entry {
 	char *pubid;
 	/* this is lazily initialized */
 	struct dcrypt_keypair pair;
+	time_t created;
 };
 
+static void
+mail_crypt_key_cache_entry_free(struct mail_crypt_key_cache_entry **_ent)
+{
+	struct mail_crypt_key_cache_entry *ent = *_ent;
+
+	*_ent = NULL;
+	i_free(ent->pubid);
+	if (ent->pair.priv != NULL)
+		dcrypt_key_unref_private(&ent->pair.priv);
+	if (ent->pair.pub != NULL)
+		dcrypt_key_unref_public(&ent->pair.pub);
+	i_free(ent);
+}
+
 static
-int mail_crypt_get_key_cache(struct mail_crypt_key_cache_entry *cache,
+int mail_crypt_get_key_cache(struct mail_crypt_user *muser,
 			     const char *pubid,
 			     struct dcrypt_private_key **privkey_r,
 			     struct dcrypt_public_key **pubkey_r)
 {
-	for(struct mail_crypt_key_cache_entry *ent = cache;
-	    ent != NULL; ent = ent->next)
-	{
-		if (strcmp(pubid, ent->pubid) == 0) {
-			if (privkey_r != NULL && ent->pair.priv != NULL) {
-				dcrypt_key_ref_private(ent->pair.priv);
-				*privkey_r = ent->pair.priv;
-				return 1;
-			} else if (pubkey_r != NULL && ent->pair.pub != NULL) {
-				dcrypt_key_ref_public(ent->pair.pub);
-				*pubkey_r = ent->pair.pub;
-				return 1;
-			} else if ((privkey_r == NULL && pubkey_r == NULL) ||
-				   (ent->pair.priv == NULL &&
-				   ent->pair.pub == NULL)) {
-				i_unreached();
-			}
+	struct mail_crypt_key_cache_entry **entp, *ent;
+
+	for (entp = &muser->key_cache; *entp != NULL; entp = &(*entp)->next) {
+		ent = *entp;
+		if (strcmp(pubid, ent->pubid) != 0)
+			continue;
+
+		if (muser->key_cache_ttl_secs > 0 &&
+		    ent->created + (time_t)muser->key_cache_ttl_secs <=
+		    ioloop_time) {
+			/* expired - drop the unwrapped keys */
+			*entp = ent->next;
+			mail_crypt_key_cache_entry_free(&ent);
+			return 0;
+		}
+		if (privkey_r != NULL && ent->pair.priv != NULL) {
+			dcrypt_key_ref_private(ent->pair.priv);
+			*privkey_r = ent->pair.priv;
+			return 1;
+		} else if (pubkey_r != NULL && ent->pair.pub != NULL) {
+			dcrypt_key_ref_public(ent->pair.pub);
+			*pubkey_r = ent->pair.pub;
+			return 1;
+		} else if ((privkey_r == NULL && pubkey_r == NULL) ||
+			   (ent->pair.priv == NULL &&
+			   ent->pair.pub == NULL)) {
+			i_unreached();
 		}
 	}
 	return 0;
@@ -82,6 +108,7 @@ void mail_crypt_put_key_cache(struct mail_crypt_key_cache_entry **cache,
 	struct mail_crypt_key_cache_entry *ent =
 		i_new(struct mail_crypt_key_cache_entry, 1);
 	ent->pubid = i_strdup(pubid);
+	ent->created = ioloop_time;
 	ent->pair.priv = privkey;
 	ent->pair.pub = pubkey;
 	if (ent->pair.priv != NULL)
@@ -105,12 +132,7 @@ void mail_crypt_key_cache_destroy(struct mail_crypt_key_cache_entry **cache)
 
 	while(cur != NULL) {
 		next = cur->next;
-		i_free(cur->pubid);
-		if (cur->pair.priv != NULL)
-			dcrypt_key_unref_private(&cur->pair.priv);
-		if (cur->pair.pub != NULL)
-			dcrypt_key_unref_public(&cur->pair.pub);
-		i_free(cur);
+		mail_crypt_key_cache_entry_free(&cur);
 		cur = next;
 	}
 }
@@ -301,7 +323,7 @@ int mail_crypt_get_private_key(struct mailbox *box, const char *pubid,
 	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
 
 	/* check cache */
-	if (mail_crypt_get_key_cache(muser->key_cache, pubid, key_r, NULL) > 0) {
+	if (mail_crypt_get_key_cache(muser, pubid, key_r, NULL) > 0) {
 		return 1;
 	}
 
@@ -342,12 +364,21 @@ int mail_crypt_user_get_private_key(struct mail_user *user, const char *pubid,
 				    struct dcrypt_private_key **key_r,
 				    const char **error_r)
 {
-	struct mail_namespace *ns = mail_namespace_find_inbox(user->namespaces);
-	struct mailbox *box = mailbox_alloc(ns->list, "INBOX",
-					    MAILBOX_FLAG_READONLY);
+	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
+	struct mail_namespace *ns;
+	struct mailbox *box;
 	struct mail_attribute_value value;
 	int ret;
 
+	/* Unwrapping folder keys looks up the user key for each folder.
+	   Avoid opening INBOX when the key is already cached. */
+	if (pubid != NULL &&
+	    mail_crypt_get_key_cache(muser, pubid, key_r, NULL) > 0)
+		return 1;
+
+	ns = mail_namespace_find_inbox(user->namespaces);
+	box = mailbox_alloc(ns->list, "INBOX", MAILBOX_FLAG_READONLY);
+
 	/* try retrieve currently active user key */
 	if (mailbox_open(box) < 0) {
 		*error_r = t_strdup_printf("mailbox_open(%s) failed: %s",
@@ -547,7 +578,7 @@ int mail_crypt_get_public_key(struct mailbox *box, const char *pubid,
 	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
 
 	/* check cache */
-	if (mail_crypt_get_key_cache(muser->key_cache, pubid, NULL, key_r) > 0) {
+	if (mail_crypt_get_key_cache(muser, pubid, NULL, key_r) > 0) {
 		return 1;
 	}
 
@@ -832,7 +863,7 @@ int mail_crypt_box_get_shared_key(struct mailbox *box,
 	int ret;
 
 	/* check cache */
-	if (mail_crypt_get_key_cache(muser->key_cache, pubid, key_r, NULL) > 0) {
+	if (mail_crypt_get_key_cache(muser, pubid, key_r, NULL) > 0) {
 		return 1;
 	}
 
@@ -9,6 +9,7 @@
 #include "randgen.h"
 #include "module-dir.h"
 #include "str.h"
+#include "str-parse.h"
 #include "safe-mkstemp.h"
 #include "istream.h"
 #include "istream-decrypt.h"
@@ -440,6 +441,17 @@ static void mail_crypt_mail_user_created(struct mail_user *user)
 				version);
 	}
 
+	const char *ttl = mail_user_plugin_getenv(user,
+			"mail_crypt_key_cache_ttl");
+	if (ttl != NULL && *ttl != '\0' &&
+	    str_parse_get_interval(ttl, &muser->key_cache_ttl_secs,
+				   &error) < 0) {
+		user->error = p_strdup_printf(user->pool,
+				"mail_crypt_plugin: "
+				"Invalid mail_crypt_key_cache_ttl %s: %s",
+				ttl, error);
+	}
+
 	if (mail_crypt_global_keys_load(user, "mail_crypt_global",
 					&muser->global_keys, FALSE, &error) < 0) {
 		user->error = p_strdup_printf(user->pool,
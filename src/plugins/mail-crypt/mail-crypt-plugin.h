@@ -18,6 +18,8 @@ struct mail_crypt_user {
 	struct mail_crypt_global_keys global_keys;
 	struct mail_crypt_cache cache;
 	struct mail_crypt_key_cache_entry *key_cache;
+	/* How long unwrapped keys are kept in key_cache (0 = forever) */
+	unsigned int key_cache_ttl_secs;
 	const char *curve;
 	int save_version;
 };
@@ -54,6 +54,9 @@ struct pop3_migration_mail_storage {
 
 	const char *pop3_box_vname;
 	ARRAY(struct pop3_uidl_map) pop3_uidl_map;
+	/* number of mails to prefetch while hashing headers,
+	   0 = use mail_prefetch_count */
+	unsigned int hdr_prefetch_count;
 
 	bool all_mailboxes:1;
 	bool pop3_all_hdr_sha1_set:1;
@@ -493,7 +496,8 @@ static void map_remove_found_seqs(struct mail_search_arg *search_arg,
 }
 
 static int
-map_read_hdr_hashes(struct mailbox *box, struct array *msg_map, uint32_t seq1)
+map_read_hdr_hashes(struct mailbox *box, struct array *msg_map, uint32_t seq1,
+		    unsigned int prefetch_count)
 {
         struct mailbox_transaction_context *t;
 	struct mail_search_args *search_args;
@@ -515,6 +519,12 @@ map_read_hdr_hashes(struct mailbox *box, struct array *msg_map, uint32_t seq1)
 	ctx = mailbox_search_init(t, search_args, NULL,
 				  MAIL_FETCH_STREAM_HEADER, NULL);
 	mail_search_args_unref(&search_args);
+	if (prefetch_count > 0 && prefetch_count < UINT_MAX) {
+		/* Prefetching pipelines the header reads (e.g. POP3 TOP or
+		   IMAP FETCH BODY.PEEK[HEADER]) so that the remote server's
+		   latency isn't paid separately for each mail. */
+		ctx->max_mails = prefetch_count + 1;
+	}
 
 	while (mailbox_search_next(ctx, &mail)) {
 		map = array_idx_modifiable_i(msg_map, mail->seq-1);
@@ -553,7 +563,7 @@ pop3_map_read_hdr_hashes(struct mail_storage *storage, struct mailbox *pop3_box,
 	}
 
 	if (map_read_hdr_hashes(pop3_box, &mstorage->pop3_uidl_map.arr,
-				first_seq) < 0)
+				first_seq, mstorage->hdr_prefetch_count) < 0)
 		return -1;
 
 	if (first_seq == 1)
@@ -628,9 +638,12 @@ static int imap_map_read(struct mailbox *box)
 static int imap_map_read_hdr_hashes(struct mailbox *box)
 {
 	struct pop3_migration_mailbox *mbox = POP3_MIGRATION_CONTEXT_REQUIRE(box);
+	struct pop3_migration_mail_storage *mstorage =
+		POP3_MIGRATION_CONTEXT_REQUIRE(box->storage);
 
 	return map_read_hdr_hashes(box, &mbox->imap_msg_map.arr,
-				   mbox->first_unfound_idx+1);
+				   mbox->first_unfound_idx+1,
+				   mstorage->hdr_prefetch_count);
 }
 
 static void pop3_uidl_assign_cached(struct mailbox *box)
@@ -1029,7 +1042,7 @@ static void pop3_migration_mail_storage_created(struct mail_storage *storage)
 {
 	struct pop3_migration_mail_storage *mstorage;
 	struct mail_storage_vfuncs *v = storage->vlast;
-	const char *pop3_box_vname;
+	const char *pop3_box_vname, *value;
 
 	pop3_box_vname = mail_user_plugin_getenv(storage->user,
 						 "pop3_migration_mailbox");
@@ -1059,6 +1072,14 @@ static void pop3_migration_mail_storage_created(struct mail_storage *storage)
 	mstorage->skip_uidl_cache =
 		mail_user_plugin_getenv_bool(storage->user,
 			"pop3_migration_skip_uidl_cache");
+	value = mail_user_plugin_getenv(storage->user,
+					"pop3_migration_prefetch_count");
+	if (value != NULL &&
+	    str_to_uint(value, &mstorage->hdr_prefetch_count) < 0) {
+		e_error(storage->user->event,
+			"pop3_migration: Invalid pop3_migration_prefetch_count "
+			"value: %s", value);
+	}
 
 	MODULE_CONTEXT_SET(storage, pop3_migration_storage_module, mstorage);
 }
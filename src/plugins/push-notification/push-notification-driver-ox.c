@@ -5,7 +5,6 @@
 #include "http-client.h"
 #include "http-url.h"
 #include "ioloop.h"
-#include "istream.h"
 #include "json-parser.h"
 #include "mailbox-attribute.h"
 #include "mail-storage-private.h"
@@ -30,10 +29,13 @@ static const char *const default_mboxes[] = { "INBOX", NULL };
 #define DEFAULT_CACHE_LIFETIME_SECS 60
 #define DEFAULT_TIMEOUT_MSECS 2000
 #define DEFAULT_RETRY_COUNT 1
+#define DEFAULT_MAX_PENDING 10
+#define DEFAULT_MAX_QUEUED 1000
 
 /* This is data that is shared by all plugin users. */
 struct push_notification_driver_ox_global {
 	struct http_client *http_client;
+	struct push_notification_driver_queue *queue;
 	int refcount;
 };
 static struct push_notification_driver_ox_global *ox_global = NULL;
@@ -46,6 +48,7 @@ struct push_notification_driver_ox_config {
 	bool use_unsafe_username;
 	unsigned int http_max_retries;
 	unsigned int http_timeout_msecs;
+	struct push_notification_driver_queue_settings queue_set;
 
 	char *cached_ox_metadata;
 	time_t cached_ox_metadata_timestamp;
@@ -54,8 +57,17 @@ struct push_notification_driver_ox_config {
 /* This is data specific to an OX driver transaction. */
 struct push_notification_driver_ox_txn {
 	const char *unsafe_user;
+
+	/* mailbox status is looked up only once per transaction */
+	struct mailbox_status box_status;
+	bool box_status_looked_up;
+	bool box_status_success;
 };
 
+static void
+push_notification_driver_ox_send(
+	struct push_notification_driver_queue_item *item, void *context);
+
 static void
 push_notification_driver_ox_init_global(
 	struct mail_user *user,
@@ -78,6 +90,11 @@ push_notification_driver_ox_init_global(
 
 		ox_global->http_client = http_client_init(&http_set);
 	}
+	if (ox_global->queue == NULL) {
+		ox_global->queue = push_notification_driver_queue_init(
+			&config->queue_set, config->event,
+			push_notification_driver_ox_send, NULL);
+	}
 }
 
 static int
@@ -136,6 +153,22 @@ push_notification_driver_ox_init(struct push_notification_driver_config *config,
 		dconfig->http_timeout_msecs = DEFAULT_TIMEOUT_MSECS;
 	}
 
+	tmp = hash_table_lookup(config->config, (const char *)"max_pending");
+	if ((tmp == NULL) ||
+	    (str_to_uint(tmp, &dconfig->queue_set.max_pending) < 0) ||
+	    dconfig->queue_set.max_pending == 0)
+		dconfig->queue_set.max_pending = DEFAULT_MAX_PENDING;
+	tmp = hash_table_lookup(config->config, (const char *)"max_queued");
+	if ((tmp == NULL) ||
+	    (str_to_uint(tmp, &dconfig->queue_set.max_queued) < 0))
+		dconfig->queue_set.max_queued = DEFAULT_MAX_QUEUED;
+	tmp = hash_table_lookup(config->config, (const char *)"coalesce_msecs");
+	if ((tmp == NULL) ||
+	    (str_to_uint(tmp, &dconfig->queue_set.coalesce_msecs) < 0))
+		dconfig->queue_set.coalesce_msecs = 0;
+	tmp = hash_table_lookup(config->config, (const char *)"spool_dir");
+	dconfig->queue_set.spool_dir = p_strdup_empty(pool, tmp);
+
 	e_debug(dconfig->event, "Using cache lifetime: %u",
 		dconfig->cached_ox_metadata_lifetime_secs);
 
@@ -294,28 +327,40 @@ push_notification_driver_ox_begin_txn(struct push_notification_driver_txn *dtxn)
 static void
 push_notification_driver_ox_http_callback(
 	const struct http_response *response,
-	struct push_notification_driver_ox_config *dconfig)
+	struct push_notification_driver_queue_item *item)
 {
 	switch (response->status / 100) {
 	case 2:
 		// Success.
-		e_debug(dconfig->event, "Notification sent successfully: %s",
+		e_debug(item->event, "Notification sent successfully: %s",
 			http_response_get_message(response));
 		break;
 
 	default:
 		// Error.
-		e_error(dconfig->event, "Error when sending notification: %s",
+		e_error(item->event, "Error when sending notification: %s",
 			http_response_get_message(response));
 		break;
 	}
+	push_notification_driver_queue_item_sent(&item);
 }
 
-/* Callback needed for i_stream_add_destroy_callback() in
-   push_notification_driver_ox_process_msg. */
-static void str_free_i(string_t *str)
+static void
+push_notification_driver_ox_send(
+	struct push_notification_driver_queue_item *item,
+	void *context ATTR_UNUSED)
 {
-	str_free(&str);
+	struct http_client_request *http_req;
+
+	http_req = http_client_request_url_str(
+		ox_global->http_client, "PUT", item->destination,
+		push_notification_driver_ox_http_callback, item);
+	http_client_request_set_event(http_req, item->event);
+	http_client_request_add_header(http_req, "Content-Type",
+				       "application/json; charset=utf-8");
+	http_client_request_set_payload_data(http_req,
+		str_data(item->payload), str_len(item->payload));
+	http_client_request_submit(http_req);
 }
 
 static int
@@ -362,38 +407,31 @@ push_notification_driver_ox_process_msg(
 	struct push_notification_driver_ox_config *dconfig =
 		(struct push_notification_driver_ox_config *)
 			dtxn->duser->context;
-	struct http_client_request *http_req;
 	struct push_notification_event_messagenew_data *messagenew;
-	struct istream *payload;
 	string_t *str;
 	struct push_notification_driver_ox_txn *txn =
 		(struct push_notification_driver_ox_txn *)dtxn->context;
 	struct mail_user *user = dtxn->ptxn->muser;
-	struct mailbox_status box_status;
-	bool status_success = TRUE;
-
-	if (push_notification_driver_ox_get_mailbox_status(
-		dtxn, &box_status) < 0) {
-		status_success = FALSE;
-	}
+	const char *username;
 
 	messagenew = push_notification_txn_msg_get_eventdata(msg, "MessageNew");
 	if (messagenew == NULL)
 		return;
 
-	push_notification_driver_ox_init_global(user, dconfig);
+	if (!txn->box_status_looked_up) {
+		txn->box_status_looked_up = TRUE;
+		txn->box_status_success =
+			push_notification_driver_ox_get_mailbox_status(
+				dtxn, &txn->box_status) == 0;
+	}
 
-	http_req = http_client_request_url(
-		ox_global->http_client, "PUT", dconfig->http_url,
-		push_notification_driver_ox_http_callback, dconfig);
-	http_client_request_set_event(http_req, dtxn->ptxn->event);
-	http_client_request_add_header(http_req, "Content-Type",
-				       "application/json; charset=utf-8");
+	push_notification_driver_ox_init_global(user, dconfig);
 
-	str = str_new(default_pool, 256);
+	username = dconfig->use_unsafe_username ?
+		txn->unsafe_user : user->username;
+	str = t_str_new(256);
 	str_append(str, "{\"user\":\"");
-	json_append_escaped(str, dconfig->use_unsafe_username ?
-			    txn->unsafe_user : user->username);
+	json_append_escaped(str, username);
 	str_append(str, "\",\"event\":\"messageNew\",\"folder\":\"");
 	json_append_escaped(str, msg->mailbox);
 	str_printfa(str, "\",\"imap-uidvalidity\":%u,\"imap-uid\":%u",
@@ -413,19 +451,18 @@ push_notification_driver_ox_process_msg(
 		json_append_escaped(str, messagenew->snippet);
 		str_append(str, "\"");
 	}
-	if (status_success) {
-		str_printfa(str, ",\"unseen\":%u", box_status.unseen);
+	if (txn->box_status_success) {
+		str_printfa(str, ",\"unseen\":%u", txn->box_status.unseen);
 	}
 	str_append(str, "}");
 
 	e_debug(dconfig->event, "Sending notification: %s", str_c(str));
 
-	payload = i_stream_create_from_data(str_data(str), str_len(str));
-	i_stream_add_destroy_callback(payload, str_free_i, str);
-	http_client_request_set_payload(http_req, payload, FALSE);
-
-	http_client_request_submit(http_req);
-	i_stream_unref(&payload);
+	/* the latest notification for the same user and folder contains the
+	   most recent unseen count, so it can replace the older ones */
+	push_notification_driver_queue_add(ox_global->queue, dtxn->ptxn->event,
+		http_url_create(dconfig->http_url),
+		t_strconcat(username, "\t", msg->mailbox, NULL), str);
 }
 
 static void
@@ -436,8 +473,6 @@ push_notification_driver_ox_deinit(
 
 	i_free(dconfig->cached_ox_metadata);
 	if (ox_global != NULL) {
-		if (ox_global->http_client != NULL)
-			http_client_wait(ox_global->http_client);
 		i_assert(ox_global->refcount > 0);
 		--ox_global->refcount;
 	}
@@ -447,6 +482,14 @@ push_notification_driver_ox_deinit(
 static void push_notification_driver_ox_cleanup(void)
 {
 	if ((ox_global != NULL) && (ox_global->refcount <= 0)) {
+		if (ox_global->queue != NULL) {
+			/* queued notifications are spooled if possible, so
+			   only the ones already being sent are waited for */
+			push_notification_driver_queue_flush(ox_global->queue);
+			if (ox_global->http_client != NULL)
+				http_client_wait(ox_global->http_client);
+			push_notification_driver_queue_deinit(&ox_global->queue);
+		}
 		if (ox_global->http_client != NULL) {
 			http_client_deinit(&ox_global->http_client);
 		}
@@ -3,11 +3,49 @@
 #include "lib.h"
 #include "array.h"
 #include "hash.h"
+#include "llist.h"
+#include "str.h"
+#include "ioloop.h"
+#include "hostpid.h"
+#include "time-util.h"
+#include "write-full.h"
 #include "mail-user.h"
 
 #include "push-notification-drivers.h"
 #include "push-notification-events.h"
 
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Don't look for spooled notifications more often than this. */
+#define PUSH_NOTIFICATION_QUEUE_SPOOL_CHECK_INTERVAL_SECS 10
+/* Max size of a spooled notification file */
+#define PUSH_NOTIFICATION_QUEUE_SPOOL_MAX_SIZE (1024*1024)
+
+struct push_notification_driver_queue {
+	struct push_notification_driver_queue_settings set;
+	char *spool_dir;
+	struct event *event;
+
+	push_notification_driver_queue_send_t *send_callback;
+	void *context;
+
+	/* notifications waiting to be sent, oldest first */
+	struct push_notification_driver_queue_item *queued, *queued_tail;
+	unsigned int queued_count;
+	/* notifications being sent */
+	unsigned int pending_count;
+
+	struct timeout *to_send;
+	time_t last_spool_check;
+	unsigned int spool_counter;
+	bool running:1;
+	bool flushed:1;
+};
+
 static ARRAY(const struct push_notification_driver *) push_notification_drivers;
 
 static bool
@@ -181,3 +219,323 @@ void push_notification_driver_unregister(
 			array_free(&push_notification_drivers);
 	}
 }
+
+static void
+push_notification_driver_queue_item_free(
+	struct push_notification_driver_queue_item *item)
+{
+	event_unref(&item->event);
+	str_free(&item->payload);
+	i_free(item->destination);
+	i_free(item->coalesce_key);
+	i_free(item);
+}
+
+static void
+push_notification_driver_queue_spool(
+	struct push_notification_driver_queue *queue, const char *destination,
+	const char *coalesce_key, const string_t *payload)
+{
+	const char *fname, *temp_path, *path;
+	string_t *data;
+	int fd;
+
+	fname = t_strdup_printf("%ld.%s.%u", (long)ioloop_time, my_pid,
+				++queue->spool_counter);
+	temp_path = t_strdup_printf("%s/.%s", queue->set.spool_dir, fname);
+	path = t_strdup_printf("%s/%s", queue->set.spool_dir, fname);
+
+	data = t_str_new(128 + str_len(payload));
+	str_append(data, destination);
+	str_append_c(data, '\n');
+	if (coalesce_key != NULL)
+		str_append(data, coalesce_key);
+	str_append_c(data, '\n');
+	str_append_str(data, payload);
+
+	/* write to a temp file first, so other processes never see partially
+	   written notifications */
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd == -1) {
+		e_error(queue->event, "open(%s) failed: %m", temp_path);
+		return;
+	}
+	if (write_full(fd, str_data(data), str_len(data)) < 0) {
+		e_error(queue->event, "write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return;
+	}
+	i_close_fd(&fd);
+	if (rename(temp_path, path) < 0) {
+		e_error(queue->event, "rename(%s, %s) failed: %m",
+			temp_path, path);
+		i_unlink(temp_path);
+	}
+}
+
+static int
+push_notification_driver_queue_read_spool_file(
+	struct push_notification_driver_queue *queue, const char *path,
+	string_t *data)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			/* another process already took it */
+			return 0;
+		}
+		e_error(queue->event, "open(%s) failed: %m", path);
+		return -1;
+	}
+	do {
+		ret = read(fd, buffer_append_space_unsafe(data, 1024), 1024);
+		buffer_set_used_size(data, str_len(data) - 1024 +
+				     (ret < 0 ? 0 : ret));
+	} while (ret > 0 && str_len(data) < PUSH_NOTIFICATION_QUEUE_SPOOL_MAX_SIZE);
+	if (ret < 0)
+		e_error(queue->event, "read(%s) failed: %m", path);
+	i_close_fd(&fd);
+
+	/* whoever manages to unlink the file sends the notification */
+	if (unlink(path) < 0) {
+		if (errno != ENOENT)
+			e_error(queue->event, "unlink(%s) failed: %m", path);
+		return 0;
+	}
+	return ret < 0 ? -1 : 1;
+}
+
+static void
+push_notification_driver_queue_add_item(
+	struct push_notification_driver_queue *queue, struct event *event,
+	const char *destination, const char *coalesce_key,
+	const unsigned char *payload, size_t payload_size)
+{
+	struct push_notification_driver_queue_item *item;
+
+	item = i_new(struct push_notification_driver_queue_item, 1);
+	item->queue = queue;
+	item->event = event;
+	event_ref(item->event);
+	item->destination = i_strdup(destination);
+	item->coalesce_key = i_strdup(coalesce_key);
+	item->payload = str_new(default_pool, payload_size + 1);
+	str_append_data(item->payload, payload, payload_size);
+	item->queued_time = ioloop_timeval;
+	DLLIST2_APPEND(&queue->queued, &queue->queued_tail, item);
+	queue->queued_count++;
+}
+
+static void
+push_notification_driver_queue_load_spool(
+	struct push_notification_driver_queue *queue)
+{
+	DIR *dir;
+	struct dirent *d;
+	const char *path, *p, *p2;
+	string_t *data;
+
+	queue->last_spool_check = ioloop_time;
+	dir = opendir(queue->set.spool_dir);
+	if (dir == NULL) {
+		if (errno != ENOENT) {
+			e_error(queue->event, "opendir(%s) failed: %m",
+				queue->set.spool_dir);
+		}
+		return;
+	}
+	data = str_new(default_pool, 1024);
+	while (queue->queued_count < queue->set.max_queued &&
+	       (d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		path = t_strdup_printf("%s/%s", queue->set.spool_dir,
+				       d->d_name);
+		str_truncate(data, 0);
+		if (push_notification_driver_queue_read_spool_file(
+			queue, path, data) <= 0)
+			continue;
+
+		p = memchr(str_data(data), '\n', str_len(data));
+		p2 = p == NULL ? NULL :
+			memchr(p + 1, '\n', str_len(data) -
+			       (p + 1 - str_c(data)));
+		if (p2 == NULL) {
+			e_error(queue->event,
+				"Invalid spooled notification file %s", path);
+			continue;
+		}
+		e_debug(queue->event, "Sending spooled notification %s", path);
+		push_notification_driver_queue_add_item(queue, queue->event,
+			t_strdup_until(str_c(data), p),
+			p + 1 == p2 ? NULL : t_strdup_until(p + 1, p2),
+			(const unsigned char *)p2 + 1,
+			str_len(data) - (p2 + 1 - str_c(data)));
+	}
+	if (closedir(dir) < 0) {
+		e_error(queue->event, "closedir(%s) failed: %m",
+			queue->set.spool_dir);
+	}
+	str_free(&data);
+}
+
+static void
+push_notification_driver_queue_run(
+	struct push_notification_driver_queue *queue)
+{
+	struct push_notification_driver_queue_item *item;
+	struct timeval send_time;
+	int wait_msecs;
+
+	if (queue->running)
+		return;
+	queue->running = TRUE;
+	timeout_remove(&queue->to_send);
+
+	if (queue->queued == NULL && queue->pending_count == 0 &&
+	    queue->set.spool_dir != NULL && !queue->flushed &&
+	    queue->last_spool_check +
+	    PUSH_NOTIFICATION_QUEUE_SPOOL_CHECK_INTERVAL_SECS <= ioloop_time)
+		push_notification_driver_queue_load_spool(queue);
+
+	while (queue->queued != NULL &&
+	       queue->pending_count < queue->set.max_pending) {
+		item = queue->queued;
+		send_time = item->queued_time;
+		timeval_add_msecs(&send_time, queue->set.coalesce_msecs);
+		wait_msecs = timeval_diff_msecs(&send_time, &ioloop_timeval);
+		if (wait_msecs > 0) {
+			queue->to_send = timeout_add_short(wait_msecs,
+				push_notification_driver_queue_run, queue);
+			break;
+		}
+		DLLIST2_REMOVE(&queue->queued, &queue->queued_tail, item);
+		queue->queued_count--;
+		queue->pending_count++;
+		queue->send_callback(item, queue->context);
+	}
+	queue->running = FALSE;
+}
+
+struct push_notification_driver_queue *
+push_notification_driver_queue_init(
+	const struct push_notification_driver_queue_settings *set,
+	struct event *event_parent,
+	push_notification_driver_queue_send_t *send_callback, void *context)
+{
+	struct push_notification_driver_queue *queue;
+
+	i_assert(set->max_pending > 0);
+
+	queue = i_new(struct push_notification_driver_queue, 1);
+	queue->set = *set;
+	queue->spool_dir = i_strdup_empty(set->spool_dir);
+	queue->set.spool_dir = queue->spool_dir;
+	queue->event = event_create(event_parent);
+	queue->send_callback = send_callback;
+	queue->context = context;
+	return queue;
+}
+
+void push_notification_driver_queue_deinit(
+	struct push_notification_driver_queue **_queue)
+{
+	struct push_notification_driver_queue *queue = *_queue;
+
+	*_queue = NULL;
+	i_assert(queue->queued == NULL);
+	i_assert(queue->pending_count == 0);
+
+	timeout_remove(&queue->to_send);
+	event_unref(&queue->event);
+	i_free(queue->spool_dir);
+	i_free(queue);
+}
+
+void push_notification_driver_queue_flush(
+	struct push_notification_driver_queue *queue)
+{
+	struct push_notification_driver_queue_item *item;
+
+	/* don't start sending spooled notifications anymore */
+	queue->flushed = TRUE;
+	timeout_remove(&queue->to_send);
+	while ((item = queue->queued) != NULL) {
+		DLLIST2_REMOVE(&queue->queued, &queue->queued_tail, item);
+		queue->queued_count--;
+		if (queue->set.spool_dir != NULL) T_BEGIN {
+			push_notification_driver_queue_spool(queue,
+				item->destination, item->coalesce_key,
+				item->payload);
+			push_notification_driver_queue_item_free(item);
+		} T_END; else {
+			queue->pending_count++;
+			queue->send_callback(item, queue->context);
+		}
+	}
+}
+
+void push_notification_driver_queue_add(
+	struct push_notification_driver_queue *queue, struct event *event,
+	const char *destination, const char *coalesce_key,
+	const string_t *payload)
+{
+	struct push_notification_driver_queue_item *item;
+
+	if (queue->set.coalesce_msecs > 0 && coalesce_key != NULL) {
+		for (item = queue->queued; item != NULL; item = item->next) {
+			if (null_strcmp(item->coalesce_key, coalesce_key) != 0)
+				continue;
+			/* replace the older notification, but keep its place
+			   in the queue */
+			e_debug(event, "Coalescing notification with a queued "
+				"one (key=%s)", coalesce_key);
+			str_truncate(item->payload, 0);
+			str_append_str(item->payload, payload);
+			i_free(item->destination);
+			item->destination = i_strdup(destination);
+			event_unref(&item->event);
+			item->event = event;
+			event_ref(item->event);
+			return;
+		}
+	}
+
+	if (queue->queued_count >= queue->set.max_queued) {
+		if (queue->set.spool_dir != NULL) T_BEGIN {
+			push_notification_driver_queue_spool(queue,
+				destination, coalesce_key, payload);
+		} T_END; else {
+			e_error(event, "Notification queue is full "
+				"(max_queued=%u) - dropping notification",
+				queue->set.max_queued);
+		}
+		return;
+	}
+	push_notification_driver_queue_add_item(queue, event, destination,
+		coalesce_key, str_data(payload), str_len(payload));
+	push_notification_driver_queue_run(queue);
+}
+
+void push_notification_driver_queue_item_sent(
+	struct push_notification_driver_queue_item **_item)
+{
+	struct push_notification_driver_queue_item *item = *_item;
+	struct push_notification_driver_queue *queue = item->queue;
+
+	*_item = NULL;
+	i_assert(queue->pending_count > 0);
+	queue->pending_count--;
+	push_notification_driver_queue_item_free(item);
+	push_notification_driver_queue_run(queue);
+}
+
+unsigned int push_notification_driver_queue_count(
+	struct push_notification_driver_queue *queue)
+{
+	return queue->queued_count + queue->pending_count;
+}
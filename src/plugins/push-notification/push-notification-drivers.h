@@ -8,6 +8,7 @@
 
 struct mail_user;
 struct push_notification_driver_config;
+struct push_notification_driver_queue;
 struct push_notification_driver_txn;
 struct push_notification_driver_user;
 struct push_notification_txn_mbox;
@@ -106,11 +107,72 @@ struct push_notification_txn {
 };
 
 
+struct push_notification_driver_queue_settings {
+	/* Max number of notifications being sent at the same time. */
+	unsigned int max_pending;
+	/* Max number of notifications waiting to be sent. If the queue is
+	   full, new notifications are written to spool_dir, or dropped if
+	   spool_dir isn't set. */
+	unsigned int max_queued;
+	/* Queued notifications are sent only after they have been waiting
+	   this long. A new notification with the same coalesce key replaces
+	   the queued one, so only the latest one is sent. 0 disables. */
+	unsigned int coalesce_msecs;
+	/* Directory where notifications are spooled when the queue is full
+	   or when it's deinitialized. The spooled notifications are sent
+	   later by any process using the same spool_dir. NULL disables. */
+	const char *spool_dir;
+};
+
+struct push_notification_driver_queue_item {
+	struct push_notification_driver_queue_item *prev, *next;
+	struct push_notification_driver_queue *queue;
+	struct event *event;
+
+	/* Where the notification is sent (e.g. URL) */
+	char *destination;
+	char *coalesce_key;
+	string_t *payload;
+
+	struct timeval queued_time;
+};
+
+/* Send the notification. The driver must call
+   push_notification_driver_queue_item_sent() once it's finished. */
+typedef void
+push_notification_driver_queue_send_t(
+	struct push_notification_driver_queue_item *item, void *context);
+
 int push_notification_driver_init(
 	struct mail_user *user, const char *config_in, pool_t pool,
 	struct push_notification_driver_user **duser_r);
 void push_notification_driver_cleanup_all(void);
 
+struct push_notification_driver_queue *
+push_notification_driver_queue_init(
+	const struct push_notification_driver_queue_settings *set,
+	struct event *event_parent,
+	push_notification_driver_queue_send_t *send_callback, void *context);
+/* The queue must be empty. */
+void push_notification_driver_queue_deinit(
+	struct push_notification_driver_queue **queue);
+/* Write the queued notifications to spool_dir or, without spool_dir, start
+   sending all of them immediately. The caller must then wait for the
+   notifications being sent to finish. */
+void push_notification_driver_queue_flush(
+	struct push_notification_driver_queue *queue);
+/* Add a notification to the queue. The coalesce_key may be NULL. */
+void push_notification_driver_queue_add(
+	struct push_notification_driver_queue *queue, struct event *event,
+	const char *destination, const char *coalesce_key,
+	const string_t *payload);
+/* The notification has been sent (successfully or not). The item is freed. */
+void push_notification_driver_queue_item_sent(
+	struct push_notification_driver_queue_item **item);
+/* Returns the number of notifications queued and being sent. */
+unsigned int push_notification_driver_queue_count(
+	struct push_notification_driver_queue *queue);
+
 void ATTR_FORMAT(3, 4)
 push_notification_driver_debug(const char *label, struct mail_user *user,
 			       const char *fmt, ...);
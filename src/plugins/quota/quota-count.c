@@ -2,14 +2,36 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "str.h"
+#include "strnum.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "safe-mkstemp.h"
+#include "mkdir-parents.h"
+#include "nfs-workarounds.h"
 #include "mailbox-list-iter.h"
 #include "quota-private.h"
 
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define QUOTA_COUNT_LEDGER_FILENAME_PREFIX "dovecot-quota-count."
+/* Recount the usage in the background once the ledger is this old */
+#define QUOTA_COUNT_LEDGER_VERIFY_SECS (60*60*24)
+/* Compact the ledger once it has this many change lines */
+#define QUOTA_COUNT_LEDGER_MAX_CHANGES 1000
+#define QUOTA_COUNT_LEDGER_MAX_SIZE (1024*64)
+
 struct count_quota_root {
 	struct quota_root root;
 
 	struct timeval cache_timeval;
 	uint64_t cached_bytes, cached_count;
+
+	/* NULL if the ledger isn't used, "" until the path has been looked
+	   up. */
+	const char *ledger_path;
+	struct timeout *to_ledger_verify;
 };
 
 struct quota_mailbox_iter {
@@ -199,6 +221,299 @@ int quota_count(struct quota_root *root, uint64_t *bytes_r, uint64_t *count_r,
 	return ret;
 }
 
+static const char *count_quota_ledger_get_path(struct count_quota_root *root)
+{
+	struct mail_namespace *const *namespaces, *ns = root->root.ns;
+	unsigned int i, count;
+	const char *dir;
+
+	if (root->ledger_path == NULL || root->ledger_path[0] != '\0')
+		return root->ledger_path;
+
+	if (ns == NULL) {
+		/* use the INBOX namespace's index directory if possible */
+		namespaces = array_get(&root->root.quota->namespaces, &count);
+		for (i = 0; i < count; i++) {
+			if (!quota_root_is_namespace_visible(&root->root,
+							     namespaces[i]))
+				continue;
+			if (ns == NULL ||
+			    (namespaces[i]->flags & NAMESPACE_FLAG_INBOX_USER) != 0)
+				ns = namespaces[i];
+		}
+		if (ns == NULL)
+			return NULL;
+	}
+	if (!mailbox_list_get_root_path(ns->list, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&dir)) {
+		/* in-memory indexes */
+		e_debug(root->root.backend.event,
+			"Indexes are in memory - not using ledger");
+		root->ledger_path = NULL;
+		return NULL;
+	}
+	root->ledger_path = p_strconcat(root->root.pool, dir, "/",
+					QUOTA_COUNT_LEDGER_FILENAME_PREFIX,
+					root->root.set->set_name, NULL);
+	return root->ledger_path;
+}
+
+static int
+count_quota_ledger_write(struct count_quota_root *root, uint64_t bytes,
+			 uint64_t count, time_t verified_stamp)
+{
+	struct mail_namespace *const *namespaces;
+	struct mailbox_permissions perm;
+	const char *path, *p, *dir;
+	string_t *str, *temp_path;
+	unsigned int i, ns_count;
+	int fd;
+
+	if ((path = count_quota_ledger_get_path(root)) == NULL)
+		return 0;
+
+	/* use the same permissions as the INBOX namespace */
+	perm.file_create_mode = 0600; perm.dir_create_mode = 0700;
+	perm.file_create_gid = (gid_t)-1;
+	perm.file_create_gid_origin = "default";
+	namespaces = array_get(&root->root.quota->namespaces, &ns_count);
+	for (i = 0; i < ns_count; i++) {
+		if ((namespaces[i]->flags & NAMESPACE_FLAG_INBOX_USER) != 0) {
+			mailbox_list_get_root_permissions(namespaces[i]->list,
+							  &perm);
+			break;
+		}
+	}
+
+	temp_path = t_str_new(128);
+	str_append(temp_path, path);
+	fd = safe_mkstemp_hostpid_group(temp_path, perm.file_create_mode,
+					perm.file_create_gid,
+					perm.file_create_gid_origin);
+	if (fd == -1 && errno == ENOENT) {
+		/* the index directory doesn't exist yet? create it */
+		p = strrchr(path, '/');
+		dir = t_strdup_until(path, p);
+		if (mkdir_parents_chgrp(dir, perm.dir_create_mode,
+					perm.file_create_gid,
+					perm.file_create_gid_origin) < 0 &&
+		    errno != EEXIST) {
+			e_error(root->root.backend.event,
+				"mkdir_parents(%s) failed: %m", dir);
+			return -1;
+		}
+		fd = safe_mkstemp_hostpid_group(temp_path,
+						perm.file_create_mode,
+						perm.file_create_gid,
+						perm.file_create_gid_origin);
+	}
+	if (fd == -1) {
+		e_error(root->root.backend.event,
+			"safe_mkstemp(%s) failed: %m", path);
+		return -1;
+	}
+
+	/* <bytes> <count> <verified timestamp> */
+	str = t_str_new(64);
+	str_printfa(str, "%"PRIu64" %"PRIu64" %ld\n",
+		    bytes, count, (long)verified_stamp);
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		e_error(root->root.backend.event,
+			"write_full(%s) failed: %m", str_c(temp_path));
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		return -1;
+	}
+	i_close_fd(&fd);
+
+	/* Changes appended by other processes between reading the old ledger
+	   and the rename() are lost. The next verification fixes that. */
+	if (rename(str_c(temp_path), path) < 0) {
+		e_error(root->root.backend.event,
+			"rename(%s, %s) failed: %m", str_c(temp_path), path);
+		i_unlink_if_exists(str_c(temp_path));
+		return -1;
+	}
+	return 0;
+}
+
+static void count_quota_ledger_verify(struct count_quota_root *root)
+{
+	enum quota_get_result error_res;
+	uint64_t bytes, count;
+	const char *error;
+	int ret;
+
+	timeout_remove(&root->to_ledger_verify);
+
+	ret = quota_count(&root->root, &bytes, &count, &error_res, &error);
+	if (ret < 0) {
+		if (error_res != QUOTA_GET_RESULT_BACKGROUND_CALC) {
+			e_error(root->root.backend.event,
+				"Couldn't verify ledger: %s", error);
+		}
+	} else if (ret > 0) {
+		(void)count_quota_ledger_write(root, bytes, count, ioloop_time);
+		root->cache_timeval = ioloop_timeval;
+		root->cached_bytes = bytes;
+		root->cached_count = count;
+	}
+}
+
+static void count_quota_ledger_verify_later(struct count_quota_root *root)
+{
+	if (root->to_ledger_verify != NULL)
+		return;
+	/* Do it once the current command is finished. Use the root ioloop,
+	   because temporary ioloops may be destroyed before the timeout
+	   triggers. */
+	root->to_ledger_verify =
+		timeout_add_short_to(io_loop_get_root(), 0,
+				     count_quota_ledger_verify, root);
+}
+
+static int
+count_quota_ledger_parse(const char *data, uint64_t *bytes_r,
+			 uint64_t *count_r, time_t *verified_stamp_r,
+			 unsigned int *changes_r)
+{
+	const char *const *lines, *const *args;
+	int64_t total_bytes, total_count, bytes_diff, count_diff;
+	long stamp;
+
+	lines = t_strsplit(data, "\n");
+	if (lines[0] == NULL)
+		return -1;
+
+	/* first line: <bytes> <count> <verified timestamp> */
+	args = t_strsplit(lines[0], " ");
+	if (str_array_length(args) != 3 ||
+	    str_to_int64(args[0], &total_bytes) < 0 ||
+	    str_to_int64(args[1], &total_count) < 0 ||
+	    str_to_long(args[2], &stamp) < 0)
+		return -1;
+
+	/* rest of the lines: <bytes diff> <count diff> */
+	*changes_r = 0;
+	for (lines++; *lines != NULL; lines++) {
+		if ((*lines)[0] == '\0') {
+			/* the trailing LF, or an append was cut short by a
+			   crash. */
+			continue;
+		}
+		args = t_strsplit(*lines, " ");
+		if (str_array_length(args) != 2 ||
+		    str_to_int64(args[0], &bytes_diff) < 0 ||
+		    str_to_int64(args[1], &count_diff) < 0)
+			return -1;
+		total_bytes += bytes_diff;
+		total_count += count_diff;
+		*changes_r += 1;
+	}
+	if (total_bytes < 0 || total_count < 0)
+		return -1;
+
+	*bytes_r = total_bytes;
+	*count_r = total_count;
+	*verified_stamp_r = stamp;
+	return 0;
+}
+
+/* Returns 1 if the usage was read from the ledger, 0 if the usage needs to
+   be counted and the ledger rewritten. */
+static int
+count_quota_ledger_read(struct count_quota_root *root,
+			uint64_t *bytes_r, uint64_t *count_r)
+{
+	const char *path;
+	struct stat st;
+	unsigned int changes;
+	time_t verified_stamp;
+	char *data;
+	int fd, ret;
+
+	if ((path = count_quota_ledger_get_path(root)) == NULL)
+		return 0;
+
+	fd = nfs_safe_open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(root->root.backend.event,
+				"open(%s) failed: %m", path);
+		}
+		return 0;
+	}
+	if (fstat(fd, &st) < 0) {
+		e_error(root->root.backend.event, "fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return 0;
+	}
+	if (st.st_size > QUOTA_COUNT_LEDGER_MAX_SIZE) {
+		/* something's broken - recount */
+		i_close_fd(&fd);
+		return 0;
+	}
+	data = t_malloc0(st.st_size + 1);
+	ret = read_full(fd, data, st.st_size);
+	if (ret < 0)
+		e_error(root->root.backend.event, "read(%s) failed: %m", path);
+	i_close_fd(&fd);
+	if (ret <= 0)
+		return 0;
+
+	if (count_quota_ledger_parse(data, bytes_r, count_r,
+				     &verified_stamp, &changes) < 0) {
+		e_warning(root->root.backend.event,
+			  "Ledger %s is corrupted - recounting", path);
+		return 0;
+	}
+
+	if (verified_stamp + QUOTA_COUNT_LEDGER_VERIFY_SECS < ioloop_time)
+		count_quota_ledger_verify_later(root);
+	else if (changes >= QUOTA_COUNT_LEDGER_MAX_CHANGES) {
+		(void)count_quota_ledger_write(root, *bytes_r, *count_r,
+					       verified_stamp);
+	}
+	return 1;
+}
+
+static void
+count_quota_ledger_append(struct count_quota_root *root,
+			  int64_t bytes_diff, int64_t count_diff)
+{
+	char str[MAX_INT_STRLEN * 2 + 2];
+	const char *path;
+	int fd;
+
+	if (bytes_diff == 0 && count_diff == 0)
+		return;
+	if ((path = count_quota_ledger_get_path(root)) == NULL)
+		return;
+
+	fd = nfs_safe_open(path, O_WRONLY | O_APPEND);
+	if (fd == -1) {
+		/* If the ledger doesn't exist, the next lookup recounts */
+		if (errno != ENOENT) {
+			e_error(root->root.backend.event,
+				"open(%s) failed: %m", path);
+		}
+		return;
+	}
+	/* Each change is written with a single O_APPEND write(), so
+	   concurrent writers don't mix up their lines. */
+	if (i_snprintf(str, sizeof(str), "%"PRId64" %"PRId64"\n",
+		       bytes_diff, count_diff) < 0)
+		i_unreached();
+	if (write_full(fd, str, strlen(str)) < 0 && errno != ESTALE) {
+		e_error(root->root.backend.event,
+			"write_full(%s) failed: %m", path);
+		/* don't trust the ledger anymore */
+		i_unlink_if_exists(path);
+	}
+	if (close(fd) < 0 && errno != ESTALE)
+		e_error(root->root.backend.event, "close(%s) failed: %m", path);
+}
+
 static enum quota_get_result
 quota_count_cached(struct count_quota_root *root,
 		   uint64_t *bytes_r, uint64_t *count_r,
@@ -214,11 +529,21 @@ quota_count_cached(struct count_quota_root *root,
 		return QUOTA_GET_RESULT_LIMITED;
 	}
 
-	enum quota_get_result error_res;
-	ret = quota_count(&root->root, bytes_r, count_r, &error_res, error_r);
-	if (ret < 0) {
-		return error_res;
-	} else if (ret > 0) {
+	if (root->ledger_path != NULL &&
+	    count_quota_ledger_read(root, bytes_r, count_r) > 0)
+		ret = 1;
+	else {
+		enum quota_get_result error_res;
+		ret = quota_count(&root->root, bytes_r, count_r,
+				  &error_res, error_r);
+		if (ret < 0)
+			return error_res;
+		if (ret > 0 && root->ledger_path != NULL) {
+			(void)count_quota_ledger_write(root, *bytes_r, *count_r,
+						       ioloop_time);
+		}
+	}
+	if (ret > 0) {
 		root->cache_timeval = ioloop_timeval;
 		root->cached_bytes = *bytes_r;
 		root->cached_count = *count_r;
@@ -234,18 +559,40 @@ static struct quota_root *count_quota_alloc(void)
 	return &root->root;
 }
 
+static void handle_ledger_param(struct quota_root *_root,
+				const char *param_value ATTR_UNUSED)
+{
+	((struct count_quota_root *)_root)->ledger_path = "";
+}
+
 static int count_quota_init(struct quota_root *root, const char *args,
 			    const char **error_r)
 {
+	const struct quota_param_parser count_params[] = {
+		{.param_name = "ledger", .param_handler = handle_ledger_param},
+		quota_param_hidden,
+		quota_param_ignoreunlimited,
+		quota_param_noenforcing,
+		quota_param_ns,
+		{.param_name = NULL}
+	};
+
 	event_set_append_log_prefix(root->backend.event, "quota-count: ");
 
-	root->auto_updating = TRUE;
-	return quota_root_default_init(root, args, error_r);
+	if (quota_parse_parameters(root, &args, error_r, count_params, TRUE) < 0)
+		return -1;
+	/* The ledger needs to know the sizes of the expunged mails. */
+	root->auto_updating =
+		((struct count_quota_root *)root)->ledger_path == NULL;
+	return 0;
 }
 
 static void count_quota_deinit(struct quota_root *_root)
 {
-	i_free(_root);
+	struct count_quota_root *root = (struct count_quota_root *)_root;
+
+	timeout_remove(&root->to_ledger_verify);
+	i_free(root);
 }
 
 static const char *const *
@@ -375,6 +722,19 @@ count_quota_update(struct quota_root *root,
 	if (ctx->recalculate == QUOTA_RECALCULATE_FORCED) {
 		if (quota_count_recalculate(root, error_r) < 0)
 			return -1;
+		if (croot->ledger_path != NULL)
+			count_quota_ledger_verify(croot);
+	} else if (croot->ledger_path == NULL) {
+		/* not using ledger */
+	} else if (ctx->recalculate != QUOTA_RECALCULATE_DONT) {
+		/* Some of the expunged mails' sizes weren't known. Keep
+		   using the ledger for now, but fix it up soon. */
+		count_quota_ledger_append(croot, ctx->bytes_used,
+					  ctx->count_used);
+		count_quota_ledger_verify_later(croot);
+	} else {
+		count_quota_ledger_append(croot, ctx->bytes_used,
+					  ctx->count_used);
 	}
 	return 0;
 }
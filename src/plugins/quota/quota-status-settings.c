@@ -12,12 +12,16 @@
 
 static const struct setting_define quota_status_setting_defines[] = {
 	DEF(STR, recipient_delimiter),
+	DEF(TIME, quota_status_cache_ttl),
+	DEF(UINT, quota_status_cache_max_users),
 
 	SETTING_DEFINE_LIST_END
 };
 
 static const struct quota_status_settings quota_status_default_settings = {
 	.recipient_delimiter = "+",
+	.quota_status_cache_ttl = 0,
+	.quota_status_cache_max_users = 10000,
 };
 
 static const struct setting_parser_info *quota_status_setting_dependencies[] = {
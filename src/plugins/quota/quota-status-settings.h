@@ -3,6 +3,9 @@
 
 struct quota_status_settings {
 	const char *recipient_delimiter;
+	/* Cache the replies per user for this long (0 = disabled) */
+	unsigned int quota_status_cache_ttl;
+	unsigned int quota_status_cache_max_users;
 };
 
 extern const struct setting_parser_info quota_status_setting_parser_info;
@@ -1,6 +1,9 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
+#include "hash.h"
+#include "llist.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "ostream.h"
@@ -35,6 +38,31 @@ struct quota_client {
 	bool warned_bad_state:1;
 };
 
+enum quota_status_cache_result {
+	QUOTA_STATUS_CACHE_RESULT_NOUSER,
+	QUOTA_STATUS_CACHE_RESULT_OK,
+	QUOTA_STATUS_CACHE_RESULT_REJECT,
+};
+
+/* The quota check results are monotonic by the mail size: if a mail of some
+   size is accepted, all smaller mails are accepted too. Rejections can
+   change from "over quota" to "too large" as the size grows, so the sizes
+   between two rejections with the same reply get that reply. */
+struct quota_status_cache_user {
+	struct quota_status_cache_user *prev, *next;
+
+	char *username;
+	time_t expire_time;
+
+	bool nouser;
+	/* Mails up to this size are accepted with ok_reply (0 = unknown) */
+	uoff_t ok_max_size;
+	char *ok_reply;
+	/* Mails between these sizes are rejected with reject_reply */
+	uoff_t reject_min_size, reject_max_size;
+	char *reject_reply;
+};
+
 static struct event_category event_category_quota_status = {
 	.name = "quota-status"
 };
@@ -46,6 +74,10 @@ static struct mail_storage_service_ctx *storage_service;
 static struct connection_list *clients;
 static char *nouser_reply;
 
+/* Most recently used users are at the head */
+static HASH_TABLE(char *, struct quota_status_cache_user *) cache_users;
+static struct quota_status_cache_user *cache_head, *cache_tail;
+
 static void client_connected(struct master_service_connection *conn)
 {
 	struct quota_client *client;
@@ -68,6 +100,111 @@ static void client_reset(struct quota_client *client)
 	i_free(client->recipient);
 }
 
+static void quota_status_cache_user_free(struct quota_status_cache_user *cuser)
+{
+	hash_table_remove(cache_users, cuser->username);
+	DLLIST2_REMOVE(&cache_head, &cache_tail, cuser);
+	i_free(cuser->username);
+	i_free(cuser->ok_reply);
+	i_free(cuser->reject_reply);
+	i_free(cuser);
+}
+
+static const char *quota_status_cache_lookup(const char *username, uoff_t size)
+{
+	struct quota_status_cache_user *cuser;
+
+	if (!hash_table_is_created(cache_users))
+		return NULL;
+	cuser = hash_table_lookup(cache_users, username);
+	if (cuser == NULL)
+		return NULL;
+	if (cuser->expire_time <= ioloop_time) {
+		quota_status_cache_user_free(cuser);
+		return NULL;
+	}
+	DLLIST2_REMOVE(&cache_head, &cache_tail, cuser);
+	DLLIST2_PREPEND(&cache_head, &cache_tail, cuser);
+
+	if (cuser->nouser)
+		return nouser_reply;
+	if (size <= cuser->ok_max_size)
+		return cuser->ok_reply;
+	if (cuser->reject_reply != NULL &&
+	    size >= cuser->reject_min_size && size <= cuser->reject_max_size)
+		return cuser->reject_reply;
+	return NULL;
+}
+
+static void
+quota_status_cache_update(const char *username, uoff_t size,
+			  enum quota_status_cache_result result,
+			  const char *reply)
+{
+	struct quota_status_cache_user *cuser;
+
+	if (quota_status_settings->quota_status_cache_ttl == 0 ||
+	    quota_status_settings->quota_status_cache_max_users == 0)
+		return;
+
+	if (!hash_table_is_created(cache_users))
+		hash_table_create(&cache_users, default_pool, 0, str_hash, strcmp);
+	cuser = hash_table_lookup(cache_users, username);
+	if (cuser == NULL) {
+		if (hash_table_count(cache_users) >=
+		    quota_status_settings->quota_status_cache_max_users)
+			quota_status_cache_user_free(cache_tail);
+		cuser = i_new(struct quota_status_cache_user, 1);
+		cuser->username = i_strdup(username);
+		cuser->expire_time = ioloop_time +
+			quota_status_settings->quota_status_cache_ttl;
+		hash_table_insert(cache_users, cuser->username, cuser);
+		DLLIST2_PREPEND(&cache_head, &cache_tail, cuser);
+	}
+
+	switch (result) {
+	case QUOTA_STATUS_CACHE_RESULT_NOUSER:
+		cuser->nouser = TRUE;
+		break;
+	case QUOTA_STATUS_CACHE_RESULT_OK:
+		if (cuser->reject_reply != NULL &&
+		    size >= cuser->reject_min_size) {
+			/* quota was freed */
+			i_free(cuser->reject_reply);
+		}
+		if (cuser->ok_reply == NULL)
+			cuser->ok_reply = i_strdup(reply);
+		cuser->ok_max_size = I_MAX(cuser->ok_max_size, size);
+		break;
+	case QUOTA_STATUS_CACHE_RESULT_REJECT:
+		if (size <= cuser->ok_max_size) {
+			/* quota was used up */
+			cuser->ok_max_size = 0;
+		}
+		if (cuser->reject_reply != NULL &&
+		    strcmp(cuser->reject_reply, reply) == 0) {
+			cuser->reject_min_size =
+				I_MIN(cuser->reject_min_size, size);
+			cuser->reject_max_size =
+				I_MAX(cuser->reject_max_size, size);
+		} else {
+			i_free(cuser->reject_reply);
+			cuser->reject_reply = i_strdup(reply);
+			cuser->reject_min_size = size;
+			cuser->reject_max_size = size;
+		}
+		break;
+	}
+}
+
+static void quota_status_cache_deinit(void)
+{
+	while (cache_head != NULL)
+		quota_status_cache_user_free(cache_head);
+	if (hash_table_is_created(cache_users))
+		hash_table_destroy(&cache_users);
+}
+
 static enum quota_alloc_result
 quota_check(struct mail_user *user, uoff_t mail_size, const char **error_r)
 {
@@ -121,6 +258,7 @@ static void client_handle_request(struct quota_client *client)
 	const char *value = NULL, *error;
 	const char *detail ATTR_UNUSED;
 	char delim ATTR_UNUSED;
+	uoff_t size = I_MAX(1, client->size);
 	string_t *resp;
 	int ret;
 
@@ -148,15 +286,22 @@ static void client_handle_request(struct quota_client *client)
 	smtp_address_detail_parse_temp(quota_status_settings->recipient_delimiter,
 				       rcpt, &input.username, &delim,
 				       &detail);
-	ret = mail_storage_service_lookup_next(storage_service, &input,
-					       &user, &error);
-	restrict_access_allow_coredumps(TRUE);
-	if (ret == 0) {
+	if ((value = quota_status_cache_lookup(input.username, size)) != NULL) {
+		e_debug(client->event, "Using cached reply for user `%s'",
+			input.username);
+		ret = 1;
+	} else if ((ret = mail_storage_service_lookup_next(storage_service,
+							   &input, &user,
+							   &error)) == 0) {
+		restrict_access_allow_coredumps(TRUE);
 		e_debug(client->event, "User `%s' not found", input.username);
 		value = nouser_reply;
+		quota_status_cache_update(input.username, size,
+					  QUOTA_STATUS_CACHE_RESULT_NOUSER,
+					  value);
 	} else if (ret > 0) {
-		enum quota_alloc_result qret = quota_check(user, client->size,
-							   &error);
+		restrict_access_allow_coredumps(TRUE);
+		enum quota_alloc_result qret = quota_check(user, size, &error);
 		if (qret == QUOTA_ALLOC_RESULT_OK) {
 			e_debug(client->event,
 				"Message is acceptable");
@@ -171,6 +316,8 @@ static void client_handle_request(struct quota_client *client)
 						"quota_status_success");
 			if (value == NULL)
 				value = "OK";
+			quota_status_cache_update(input.username, size,
+				QUOTA_STATUS_CACHE_RESULT_OK, value);
 			break;
 		case QUOTA_ALLOC_RESULT_OVER_MAXSIZE:
 		/* even over maximum quota */
@@ -184,6 +331,8 @@ static void client_handle_request(struct quota_client *client)
 						"quota_status_overquota");
 			if (value == NULL)
 				value = t_strdup_printf("554 5.2.2 %s", error);
+			quota_status_cache_update(input.username, size,
+				QUOTA_STATUS_CACHE_RESULT_REJECT, value);
 			break;
 		case QUOTA_ALLOC_RESULT_TEMPFAIL:
 		case QUOTA_ALLOC_RESULT_BACKGROUND_CALC:
@@ -193,6 +342,7 @@ static void client_handle_request(struct quota_client *client)
 		value = t_strdup(value); /* user's pool is being freed */
 		mail_user_deinit(&user);
 	} else {
+		restrict_access_allow_coredumps(TRUE);
 		e_error(client->event,
 			"Failed to lookup user %s: %s", input.username, error);
 		error = "Temporary internal error";
@@ -312,6 +462,7 @@ static void main_init(void)
 
 static void main_deinit(void)
 {
+	quota_status_cache_deinit();
 	pool_unref(&quota_status_pool);
 	connection_list_deinit(&clients);
 	mail_storage_service_deinit(&storage_service);
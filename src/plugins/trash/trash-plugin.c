@@ -32,6 +32,8 @@ struct trash_mailbox {
 	struct mailbox_transaction_context *trans;
 	struct mail_search_context *search_ctx;
 	struct mail *mail;
+	/* mailbox doesn't exist, is empty or couldn't be opened */
+	bool skip;
 };
 
 struct trash_user {
@@ -53,10 +55,16 @@ static enum quota_alloc_result (*trash_next_quota_test_alloc)(
 static int trash_clean_mailbox_open(struct trash_mailbox *trash)
 {
 	struct mail_search_args *search_args;
+	struct mailbox_status status;
 
 	trash->box = mailbox_alloc(trash->ns->list, trash->name, 0);
-	if (mailbox_open(trash->box) < 0) {
+	/* Check from the mailbox list index first whether there is anything
+	   to expunge, so an empty trash mailbox doesn't need to be opened
+	   and fully synced. */
+	if (mailbox_get_status(trash->box, STATUS_MESSAGES, &status) < 0 ||
+	    status.messages == 0 || mailbox_open(trash->box) < 0) {
 		mailbox_free(&trash->box);
+		trash->skip = TRUE;
 		return 0;
 	}
 
@@ -81,6 +89,10 @@ static int trash_clean_mailbox_get_next(struct trash_mailbox *trash,
 {
 	int ret;
 
+	if (trash->skip) {
+		*received_time_r = 0;
+		return 0;
+	}
 	if (trash->mail == NULL) {
 		if (trash->box == NULL)
 			ret = trash_clean_mailbox_open(trash);
@@ -161,6 +173,7 @@ err:
 	for (i = 0; i < count; i++) {
 		struct trash_mailbox *trash = &trashes[i];
 
+		trash->skip = FALSE;
 		if (trash->box == NULL)
 			continue;
 
@@ -63,6 +63,20 @@ static void virtual_sync_set_uidvalidity(struct virtual_sync_context *ctx)
 	ctx->uid_validity = uid_validity;
 }
 
+/* The sync mail is created only when it's actually needed, so backends
+   without any changes don't get a transaction and a mail allocated on every
+   sync. */
+static void
+virtual_backend_box_sync_mail_set(struct virtual_backend_box *bbox)
+{
+	struct mailbox_transaction_context *trans;
+
+	if (bbox->sync_mail == NULL) {
+		trans = mailbox_transaction_begin(bbox->box, 0, __func__);
+		bbox->sync_mail = mail_alloc(trans, 0, NULL);
+	}
+}
+
 static void virtual_sync_external_flags(struct virtual_sync_context *ctx,
 					struct virtual_backend_box *bbox,
 					uint32_t vseq, uint32_t real_uid)
@@ -71,6 +85,7 @@ static void virtual_sync_external_flags(struct virtual_sync_context *ctx,
 	const char *const *kw_names;
 	struct mail_keywords *keywords;
 
+	virtual_backend_box_sync_mail_set(bbox);
 	if (!mail_set_uid(bbox->sync_mail, real_uid)) {
 		/* we may have reopened the mailbox, which could have
 		   caused the mail to be expunged already. */
@@ -108,17 +123,6 @@ static int virtual_sync_mail_uid_cmp(const void *p1, const void *p2)
 	return 0;
 }
 
-static void
-virtual_backend_box_sync_mail_set(struct virtual_backend_box *bbox)
-{
-	struct mailbox_transaction_context *trans;
-
-	if (bbox->sync_mail == NULL) {
-		trans = mailbox_transaction_begin(bbox->box, 0, __func__);
-		bbox->sync_mail = mail_alloc(trans, 0, NULL);
-	}
-}
-
 static int bbox_mailbox_id_cmp(struct virtual_backend_box *const *b1,
 			       struct virtual_backend_box *const *b2)
 {
@@ -1175,7 +1179,6 @@ static int virtual_sync_backend_box_sync(struct virtual_sync_context *ctx,
 	uint32_t vseq, vuid;
 
 	sync_ctx = mailbox_sync_init(bbox->box, sync_flags);
-	virtual_backend_box_sync_mail_set(bbox);
 	while (mailbox_sync_next(sync_ctx, &sync_rec)) {
 		switch (sync_rec.type) {
 		case MAILBOX_SYNC_TYPE_EXPUNGE:
@@ -1428,7 +1431,6 @@ static int virtual_sync_backend_box(struct virtual_sync_context *ctx,
 				return ret;
 		}
 
-		virtual_backend_box_sync_mail_set(bbox);
 		if ((status.uidvalidity != bbox->sync_uid_validity) ||
 		    !guid_128_equals(metadata.guid, bbox->sync_guid)) {
 			/* UID validity or GUID changed since last sync (or
@@ -895,10 +895,14 @@ cmd_uidl_init(struct client *client, uint32_t seq)
 		if ((client->uidl_keymask & UIDL_MD5) != 0)
 			wanted_fields |= MAIL_FETCH_HEADER_MD5;
 
+		/* Sorting by POP3 order is needed only if read_mailbox()
+		   found the messages to be in a different order than their
+		   sequences. Otherwise it would just look up the POP3 order
+		   of every message again for nothing. */
 		search_args = pop3_search_build(client, seq);
 		ctx->search_ctx = mailbox_search_init(client->trans, search_args,
-						      pop3_sort_program,
-						      wanted_fields, NULL);
+			seq == 0 && client->msgnum_to_seq_map != NULL ?
+			pop3_sort_program : NULL, wanted_fields, NULL);
 		mail_search_args_unref(&search_args);
 	}
 
@@ -6,6 +6,7 @@
 #include "istream.h"
 #include "ostream.h"
 #include "buffer.h"
+#include "str.h"
 #include "hash.h"
 #include "llist.h"
 #include "strescape.h"
@@ -16,6 +17,9 @@
 #define REPLICATOR_RECONNECT_MSECS 5000
 #define REPLICATOR_MEMBUF_MAX_SIZE 1024*1024
 #define REPLICATOR_HANDSHAKE "VERSION\treplicator-notify\t1\t0\n"
+/* Non-sync notifications are coalesced per user for this long before
+   they're sent to replicator. */
+#define REPLICATOR_NOTIFY_COALESCE_MSECS 100
 
 struct replicator_connection {
 	char *path;
@@ -31,6 +35,10 @@ struct replicator_connection {
 	struct timeout *to;
 
 	buffer_t *queue[REPLICATION_PRIORITY_SYNC + 1];
+	/* username => highest enum replication_priority of notifications
+	   not yet sent */
+	HASH_TABLE(char *, void *) pending_users;
+	struct timeout *to_pending;
 
 	HASH_TABLE(void *, void *) requests;
 	unsigned int request_id_counter;
@@ -38,6 +46,9 @@ struct replicator_connection {
 };
 
 static void replicator_connection_disconnect(struct replicator_connection *conn);
+static void
+replicator_send(struct replicator_connection *conn,
+		enum replication_priority priority, const char *data);
 
 static int
 replicator_input_line(struct replicator_connection *conn, const char *line)
@@ -220,6 +231,50 @@ static void replicator_connection_disconnect(struct replicator_connection *conn)
 	conn->fd = -1;
 }
 
+static void
+replicator_connection_flush_pending(struct replicator_connection *conn)
+{
+	struct hash_iterate_context *iter;
+	string_t *batch[REPLICATION_PRIORITY_SYNC + 1];
+	enum replication_priority priority;
+	char *username;
+	void *value;
+
+	timeout_remove(&conn->to_pending);
+
+	e_debug(conn->event, "Sending coalesced notifications for %u users",
+		hash_table_count(conn->pending_users));
+
+	replicator_connection_connect(conn);
+
+	T_BEGIN {
+		/* send all the notifications of the same priority in one
+		   batch */
+		for (priority = REPLICATION_PRIORITY_LOW;
+		     priority < REPLICATION_PRIORITY_SYNC; priority++)
+			batch[priority] = t_str_new(256);
+
+		iter = hash_table_iterate_init(conn->pending_users);
+		while (hash_table_iterate(iter, conn->pending_users,
+					  &username, &value)) {
+			priority = POINTER_CAST_TO(value, unsigned int);
+			str_printfa(batch[priority], "U\t%s\t%s\n",
+				    str_tabescape(username),
+				    replicator_priority_to_str(priority));
+			i_free(username);
+		}
+		hash_table_iterate_deinit(&iter);
+		hash_table_clear(conn->pending_users, TRUE);
+
+		for (priority = REPLICATION_PRIORITY_SYNC - 1;
+		     priority >= REPLICATION_PRIORITY_LOW; priority--) {
+			if (str_len(batch[priority]) > 0)
+				replicator_send(conn, priority,
+						str_c(batch[priority]));
+		}
+	} T_END;
+}
+
 static struct replicator_connection *replicator_connection_create(void)
 {
 	struct replicator_connection *conn;
@@ -229,6 +284,8 @@ static struct replicator_connection *replicator_connection_create(void)
 	conn->fd = -1;
 	conn->event = event_create(NULL);
 	hash_table_create_direct(&conn->requests, default_pool, 0);
+	hash_table_create(&conn->pending_users, default_pool, 0,
+			  str_hash, strcmp);
 	for (i = REPLICATION_PRIORITY_LOW; i <= REPLICATION_PRIORITY_SYNC; i++)
 		conn->queue[i] = buffer_create_dynamic(default_pool, 1024);
 	return conn;
@@ -270,12 +327,15 @@ void replicator_connection_destroy(struct replicator_connection **_conn)
 	unsigned int i;
 
 	*_conn = NULL;
+	if (conn->to_pending != NULL)
+		replicator_connection_flush_pending(conn);
 	replicator_connection_disconnect(conn);
 
 	for (i = REPLICATION_PRIORITY_LOW; i <= REPLICATION_PRIORITY_SYNC; i++)
 		buffer_free(&conn->queue[i]);
 
 	timeout_remove(&conn->to);
+	hash_table_destroy(&conn->pending_users);
 	hash_table_destroy(&conn->requests);
 	event_unref(&conn->event);
 	i_free(conn->ips);
@@ -308,35 +368,48 @@ void replicator_connection_notify(struct replicator_connection *conn,
 				  const char *username,
 				  enum replication_priority priority)
 {
-	const char *priority_str = "";
-
-	replicator_connection_connect(conn);
-
-	switch (priority) {
-	case REPLICATION_PRIORITY_NONE:
-	case REPLICATION_PRIORITY_SYNC:
-		i_unreached();
-	case REPLICATION_PRIORITY_LOW:
-		priority_str = "low";
-		break;
-	case REPLICATION_PRIORITY_HIGH:
-		priority_str = "high";
-		break;
+	char *orig_username;
+	void *value;
+
+	/* Coalesce the notifications for the same user, keeping the highest
+	   priority. Deliveries in bursts would otherwise cause the same user
+	   to be notified many times per second. */
+	if (hash_table_lookup_full(conn->pending_users, username,
+				   &orig_username, &value)) {
+		if (POINTER_CAST_TO(value, unsigned int) >= priority)
+			return;
+		hash_table_update(conn->pending_users, orig_username,
+				  POINTER_CAST(priority));
+	} else {
+		orig_username = i_strdup(username);
+		hash_table_insert(conn->pending_users, orig_username,
+				  POINTER_CAST(priority));
+	}
+	e_debug(conn->event, "Queueing replication of %s priority for user %s",
+		replicator_priority_to_str(priority), username);
+
+	if (conn->to_pending == NULL) {
+		conn->to_pending =
+			timeout_add_short(REPLICATOR_NOTIFY_COALESCE_MSECS,
+					  replicator_connection_flush_pending,
+					  conn);
 	}
-
-	T_BEGIN {
-		e_debug(conn->event, "Requesting replication of %s priority for user %s",
-			priority_str, username);
-		replicator_send(conn, priority, t_strdup_printf(
-			"U\t%s\t%s\n", str_tabescape(username), priority_str));
-	} T_END;
 }
 
 void replicator_connection_notify_sync(struct replicator_connection *conn,
 				       const char *username, void *context)
 {
+	char *orig_username;
+	void *value;
 	unsigned int id;
 
+	/* the sync request supersedes any pending notification */
+	if (hash_table_lookup_full(conn->pending_users, username,
+				   &orig_username, &value)) {
+		hash_table_remove(conn->pending_users, username);
+		i_free(orig_username);
+	}
+
 	replicator_connection_connect(conn);
 
 	id = ++conn->request_id_counter;
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "dsync-client.h"
 #include "replicator-settings.h"
 #include "replicator-queue.h"
@@ -23,6 +24,10 @@ struct replicator_brain {
 
 	ARRAY_TYPE(dsync_client) dsync_clients;
 
+	/* token bucket for replication_sync_rate_limit */
+	double sync_tokens;
+	struct timeval sync_tokens_refill_time;
+
 	bool deinitializing:1;
 };
 
@@ -62,6 +67,8 @@ replicator_brain_init(struct replicator_queue *queue,
 	event_add_category(brain->event, &event_category_replication);
 
 	p_array_init(&brain->dsync_clients, pool, 16);
+	brain->sync_tokens = set->replication_sync_rate_limit;
+	brain->sync_tokens_refill_time = ioloop_timeval;
 	replicator_queue_set_change_callback(queue,
 		replicator_brain_queue_changed, brain);
 	replicator_brain_fill(brain);
@@ -159,12 +166,41 @@ static void dsync_callback(enum dsync_reply reply, const char *state,
 	i_free(ctx);
 }
 
+static bool
+replicator_brain_take_sync_token(struct replicator_brain *brain,
+				 unsigned int *next_msecs_r)
+{
+	unsigned int rate = brain->set->replication_sync_rate_limit;
+	long long diff_msecs;
+
+	if (rate == 0)
+		return TRUE;
+
+	/* refill the bucket. allow bursts of up to one second's worth of
+	   syncs. */
+	diff_msecs = timeval_diff_msecs(&ioloop_timeval,
+					&brain->sync_tokens_refill_time);
+	if (diff_msecs > 0) {
+		brain->sync_tokens += diff_msecs * rate / 1000.0;
+		if (brain->sync_tokens > rate)
+			brain->sync_tokens = rate;
+		brain->sync_tokens_refill_time = ioloop_timeval;
+	}
+	if (brain->sync_tokens < 1) {
+		*next_msecs_r = (1 - brain->sync_tokens) * 1000 / rate + 1;
+		return FALSE;
+	}
+	brain->sync_tokens--;
+	return TRUE;
+}
+
 static bool
 dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
 {
 	struct replicator_sync_context *ctx;
 	struct dsync_client *conn;
 	time_t next_full_sync;
+	unsigned int next_msecs;
 	bool full;
 	struct event *event = event_create(brain->event);
 	event_set_append_log_prefix(event, t_strdup_printf(
@@ -177,6 +213,18 @@ dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
 		event_unref(&event);
 		return FALSE;
 	}
+	/* Someone is waiting for sync priority replication to finish, so
+	   don't delay it. */
+	if (user->priority != REPLICATION_PRIORITY_SYNC &&
+	    !replicator_brain_take_sync_token(brain, &next_msecs)) {
+		e_debug(event, "Delay replication - sync rate limit reached, "
+			"waiting for %u msecs", next_msecs);
+		event_unref(&event);
+		timeout_remove(&brain->to);
+		brain->to = timeout_add(next_msecs, replicator_brain_timeout,
+					brain);
+		return FALSE;
+	}
 
 	next_full_sync = user->last_full_sync +
 		brain->set->replication_full_sync_interval;
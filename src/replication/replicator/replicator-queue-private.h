@@ -14,6 +14,10 @@ struct replicator_queue {
 	unsigned int full_sync_interval;
 	unsigned int failure_resync_interval;
 
+	/* append-only log of user changes since the last export */
+	char *journal_path;
+	int journal_fd;
+
 	void (*change_callback)(void *context);
 	void *change_context;
 };
@@ -11,8 +11,10 @@
 #include "replicator-queue-private.h"
 #include "replicator-settings.h"
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 struct replicator_sync_lookup {
 	struct replicator_user *user;
@@ -87,6 +89,80 @@ static int user_priority_cmp(const void *p1, const void *p2)
 	return 0;
 }
 
+static void
+replicator_queue_export_user(struct replicator_user *user, string_t *str)
+{
+	str_append_tabescaped(str, user->username);
+	str_printfa(str, "\t%d\t%lld\t%lld\t%lld\t%d\t", (int)user->priority,
+		    (long long)user->last_update,
+		    (long long)user->last_fast_sync,
+		    (long long)user->last_full_sync,
+		    user->last_sync_failed ? 1 : 0);
+	if (user->state != NULL)
+		str_append_tabescaped(str, user->state);
+	str_printfa(str, "\t%lld\n", (long long)user->last_successful_sync);
+}
+
+static void replicator_queue_journal_close(struct replicator_queue *queue)
+{
+	i_close_fd_path(&queue->journal_fd, queue->journal_path);
+	i_free(queue->journal_path);
+}
+
+static void
+replicator_queue_journal_write(struct replicator_queue *queue,
+			       const string_t *str)
+{
+	ssize_t ret;
+
+	if (queue->journal_fd == -1)
+		return;
+
+	ret = write(queue->journal_fd, str_data(str), str_len(str));
+	if (ret == (ssize_t)str_len(str))
+		return;
+	if (ret < 0)
+		e_error(queue->event, "write(%s) failed: %m", queue->journal_path);
+	else {
+		e_error(queue->event, "write(%s) failed: Partial write",
+			queue->journal_path);
+	}
+	/* a partially written record can't be replayed, so the journal is
+	   useless until the next export. */
+	replicator_queue_journal_close(queue);
+}
+
+static void
+replicator_queue_journal_update(struct replicator_queue *queue,
+				struct replicator_user *user)
+{
+	string_t *str;
+
+	if (queue->journal_fd == -1)
+		return;
+
+	str = t_str_new(128);
+	str_append(str, "U\t");
+	replicator_queue_export_user(user, str);
+	replicator_queue_journal_write(queue, str);
+}
+
+static void
+replicator_queue_journal_remove(struct replicator_queue *queue,
+				struct replicator_user *user)
+{
+	string_t *str;
+
+	if (queue->journal_fd == -1)
+		return;
+
+	str = t_str_new(64);
+	str_append(str, "R\t");
+	str_append_tabescaped(str, user->username);
+	str_append_c(str, '\n');
+	replicator_queue_journal_write(queue, str);
+}
+
 struct replicator_queue *
 replicator_queue_init(unsigned int full_sync_interval,
 		      unsigned int failure_resync_interval)
@@ -105,6 +181,7 @@ replicator_queue_init(unsigned int full_sync_interval,
 	queue = i_new(struct replicator_queue, 1);
 	queue->full_sync_interval = full_sync_interval;
 	queue->failure_resync_interval = failure_resync_interval;
+	queue->journal_fd = -1;
 	queue->user_queue = priorityq_init(user_priority_cmp, 1024);
 	hash_table_create(&queue->user_hash, default_pool, 1024,
 			  str_hash, strcmp);
@@ -122,6 +199,8 @@ void replicator_queue_deinit(struct replicator_queue **_queue)
 	*_queue = NULL;
 
 	queue->change_callback = NULL;
+	if (queue->journal_fd != -1)
+		replicator_queue_journal_close(queue);
 
 	while ((item = priorityq_pop(queue->user_queue)) != NULL) {
 		struct replicator_user *user = (struct replicator_user *)item;
@@ -216,6 +295,9 @@ void replicator_queue_add(struct replicator_queue *queue,
 		priorityq_remove(queue->user_queue, &user->item);
 		priorityq_add(queue->user_queue, &user->item);
 	}
+	T_BEGIN {
+		replicator_queue_journal_update(queue, user);
+	} T_END;
 	if (queue->change_callback != NULL) {
 		e_debug(queue->event, "user %s: Queue changed - calling callback",
 			user->username);
@@ -251,6 +333,9 @@ void replicator_queue_remove(struct replicator_queue *queue,
 	if (!user->popped)
 		priorityq_remove(queue->user_queue, &user->item);
 	hash_table_remove(queue->user_hash, user->username);
+	T_BEGIN {
+		replicator_queue_journal_remove(queue, user);
+	} T_END;
 
 	if (queue->change_callback != NULL) {
 		e_debug(queue->event, "user %s: Queue changed - calling callback",
@@ -354,12 +439,14 @@ void replicator_queue_push(struct replicator_queue *queue,
 	user->popped = FALSE;
 
 	T_BEGIN {
+		replicator_queue_journal_update(queue, user);
 		replicator_queue_handle_sync_lookups(queue, user);
 	} T_END;
 }
 
 static int
-replicator_queue_import_line(struct replicator_queue *queue, const char *line)
+replicator_queue_import_line(struct replicator_queue *queue, const char *line,
+			     bool replay)
 {
 	const char *const *args, *username, *state;
 	unsigned int priority;
@@ -392,7 +479,10 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	}
 
 	user = hash_table_lookup(queue->user_hash, username);
-	if (user != NULL) {
+	if (user != NULL && replay) {
+		/* journal records are in the order they were written, so the
+		   latest one is always the newest state */
+	} else if (user != NULL) {
 		if (user->last_update > tmp_user.last_update) {
 			/* we already have a newer state */
 			return 0;
@@ -437,7 +527,7 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		T_BEGIN {
-			ret = replicator_queue_import_line(queue, line);
+			ret = replicator_queue_import_line(queue, line, FALSE);
 		} T_END;
 		if (ret < 0) {
 			e_error(queue->event,
@@ -453,31 +543,21 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	return ret;
 }
 
-static void
-replicator_queue_export_user(struct replicator_user *user, string_t *str)
-{
-	str_append_tabescaped(str, user->username);
-	str_printfa(str, "\t%d\t%lld\t%lld\t%lld\t%d\t", (int)user->priority,
-		    (long long)user->last_update,
-		    (long long)user->last_fast_sync,
-		    (long long)user->last_full_sync,
-		    user->last_sync_failed ? 1 : 0);
-	if (user->state != NULL)
-		str_append_tabescaped(str, user->state);
-	str_printfa(str, "\t%lld\n", (long long)user->last_successful_sync);
-}
-
 int replicator_queue_export(struct replicator_queue *queue, const char *path)
 {
 	struct replicator_queue_iter *iter;
 	struct replicator_user *user;
 	struct ostream *output;
+	const char *temp_path;
 	string_t *str;
 	int fd, ret = 0;
 
-	fd = creat(path, 0600);
+	/* write to a temp file first, so a crash during the export doesn't
+	   lose the old state file that the journal is relative to. */
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	fd = creat(temp_path, 0600);
 	if (fd == -1) {
-		e_error(queue->event, "creat(%s) failed: %m", path);
+		e_error(queue->event, "creat(%s) failed: %m", temp_path);
 		return -1;
 	}
 	output = o_stream_create_fd_file_autoclose(&fd, 0);
@@ -493,13 +573,106 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	}
 	replicator_queue_iter_deinit(&iter);
 	if (o_stream_finish(output) < 0) {
-		e_error(queue->event, "write(%s) failed: %s", path, o_stream_get_error(output));
+		e_error(queue->event, "write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
 		ret = -1;
 	}
 	o_stream_destroy(&output);
+
+	if (ret < 0)
+		i_unlink(temp_path);
+	else if (rename(temp_path, path) < 0) {
+		e_error(queue->event, "rename(%s, %s) failed: %m",
+			temp_path, path);
+		i_unlink(temp_path);
+		ret = -1;
+	} else if (queue->journal_fd != -1 &&
+		   ftruncate(queue->journal_fd, 0) < 0) {
+		e_error(queue->event, "ftruncate(%s) failed: %m",
+			queue->journal_path);
+		replicator_queue_journal_close(queue);
+	}
 	return ret;
 }
 
+static int
+replicator_queue_journal_replay_line(struct replicator_queue *queue,
+				     const char *line)
+{
+	struct replicator_user *user;
+
+	/* U <export line> | R <username> */
+	if (line[0] == 'U' && line[1] == '\t')
+		return replicator_queue_import_line(queue, line + 2, TRUE);
+	if (line[0] != 'R' || line[1] != '\t')
+		return -1;
+
+	user = hash_table_lookup(queue->user_hash, str_tabunescape(
+		t_strdup_noconst(line + 2)));
+	if (user != NULL)
+		replicator_queue_remove(queue, &user);
+	return 0;
+}
+
+int replicator_queue_journal_open(struct replicator_queue *queue,
+				  const char *path)
+{
+	struct istream *input;
+	struct stat st;
+	const char *line;
+	uoff_t valid_offset = 0;
+	int fd, ret = 0;
+
+	i_assert(queue->journal_fd == -1);
+
+	e_debug(queue->event, "Replaying queue journal %s", path);
+
+	fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0600);
+	if (fd == -1) {
+		e_error(queue->event, "open(%s) failed: %m", path);
+		return -1;
+	}
+
+	input = i_stream_create_fd(fd, SIZE_MAX);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		T_BEGIN {
+			ret = replicator_queue_journal_replay_line(queue, line);
+		} T_END;
+		if (ret < 0) {
+			e_error(queue->event,
+				"Corrupted replicator journal record in %s: %s",
+				path, line);
+			ret = 0;
+			break;
+		}
+		valid_offset = input->v_offset;
+	}
+	if (input->stream_errno != 0) {
+		e_error(queue->event, "read(%s) failed: %s", path,
+			i_stream_get_error(input));
+		ret = -1;
+	} else if (fstat(fd, &st) < 0) {
+		e_error(queue->event, "fstat(%s) failed: %m", path);
+		ret = -1;
+	} else if (valid_offset < (uoff_t)st.st_size) {
+		/* Drop the corrupted or partially written records at the end,
+		   so new records don't get appended after them. */
+		if (ftruncate(fd, valid_offset) < 0) {
+			e_error(queue->event, "ftruncate(%s) failed: %m", path);
+			ret = -1;
+		}
+	}
+	i_stream_destroy(&input);
+
+	if (ret < 0) {
+		i_close_fd_path(&fd, path);
+		return -1;
+	}
+	queue->journal_fd = fd;
+	queue->journal_path = i_strdup(path);
+	return 0;
+}
+
 struct replicator_queue_iter *
 replicator_queue_iter_init(struct replicator_queue *queue)
 {
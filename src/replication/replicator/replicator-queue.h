@@ -84,7 +84,14 @@ void replicator_queue_push(struct replicator_queue *queue,
 			   struct replicator_user *user);
 
 int replicator_queue_import(struct replicator_queue *queue, const char *path);
+/* Export all users to the given path. If journal is open, it's truncated
+   after a successful export. */
 int replicator_queue_export(struct replicator_queue *queue, const char *path);
+/* Replay changes from the journal file and keep it open for appending all
+   further changes to users. This allows the full export to be done less
+   often without losing state on crashes. */
+int replicator_queue_journal_open(struct replicator_queue *queue,
+				  const char *path);
 
 /* Returns TRUE if user replication can be started now, FALSE if not. When
    returning FALSE, next_secs_r is set to user's next replication time. */
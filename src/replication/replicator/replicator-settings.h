@@ -8,6 +8,7 @@ struct replicator_settings {
 
 	unsigned int replication_full_sync_interval;
 	unsigned int replication_max_conns;
+	unsigned int replication_sync_rate_limit;
 };
 
 extern const struct setting_parser_info replicator_setting_parser_info;
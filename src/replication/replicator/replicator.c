@@ -12,10 +12,12 @@
 #include "replicator-queue.h"
 #include "replicator-settings.h"
 
-#define REPLICATOR_DB_DUMP_INTERVAL_MSECS (1000*60*15)
+/* changes between dumps are written to the journal, so this can be long */
+#define REPLICATOR_DB_DUMP_INTERVAL_MSECS (1000*60*60)
 /* if syncing fails, try again in 5 minutes */
 #define REPLICATOR_FAILURE_RESYNC_INTERVAL_SECS (60*5)
 #define REPLICATOR_DB_FNAME "replicator.db"
+#define REPLICATOR_JOURNAL_FNAME "replicator.db.journal"
 
 static struct replicator_queue *queue;
 static struct replicator_brain *brain;
@@ -44,6 +46,10 @@ static void replication_add_users(struct replicator_queue *queue)
 	/* add updates from replicator db, if it exists */
 	path = t_strconcat(service_set->state_dir, "/"REPLICATOR_DB_FNAME, NULL);
 	(void)replicator_queue_import(queue, path);
+	/* replay the changes done after the db was last written */
+	path = t_strconcat(service_set->state_dir,
+			   "/"REPLICATOR_JOURNAL_FNAME, NULL);
+	(void)replicator_queue_journal_open(queue, path);
 }
 
 static void ATTR_NULL(1)
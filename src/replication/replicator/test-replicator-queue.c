@@ -5,8 +5,14 @@
 #include "test-common.h"
 #include "replicator-queue.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #define TEST_REPLICATION_FULL_SYNC_INTERVAL 60
 #define TEST_REPLICATION_FAILURE_RESYNC_INTERVAL 10
+#define TEST_JOURNAL_PATH ".test-replicator-queue.journal"
+#define TEST_DB_PATH ".test-replicator-queue.db"
 
 static void test_replicator_queue(void)
 {
@@ -249,11 +255,95 @@ static void test_replicator_queue_random(void)
 	test_end();
 }
 
+static void test_replicator_queue_journal(void)
+{
+	struct replicator_queue *queue;
+	struct replicator_user *user;
+	struct stat st;
+	unsigned int next_secs;
+	int fd;
+
+	test_begin("replicator queue journal");
+	i_unlink_if_exists(TEST_JOURNAL_PATH);
+	i_unlink_if_exists(TEST_DB_PATH);
+	ioloop_time = time(NULL);
+
+	queue = replicator_queue_init(TEST_REPLICATION_FULL_SYNC_INTERVAL,
+				      TEST_REPLICATION_FAILURE_RESYNC_INTERVAL);
+	test_assert(replicator_queue_journal_open(queue, TEST_JOURNAL_PATH) == 0);
+	user = replicator_queue_get(queue, "user1");
+	replicator_queue_update(queue, user, REPLICATION_PRIORITY_HIGH);
+	replicator_queue_add(queue, user);
+	user = replicator_queue_get(queue, "user2");
+	replicator_queue_update(queue, user, REPLICATION_PRIORITY_LOW);
+	replicator_queue_add(queue, user);
+	user = replicator_queue_get(queue, "user3");
+	replicator_queue_add(queue, user);
+
+	/* sync user1 */
+	user = replicator_queue_pop(queue, &next_secs);
+	test_assert(user != NULL && strcmp(user->username, "user1") == 0);
+	user->priority = REPLICATION_PRIORITY_NONE;
+	user->last_fast_sync = user->last_full_sync = ioloop_time;
+	user->state = i_strdup("state\twith tab");
+	replicator_queue_push(queue, user);
+
+	user = replicator_queue_lookup(queue, "user3");
+	replicator_queue_remove(queue, &user);
+	replicator_queue_deinit(&queue);
+
+	/* append a partially written record */
+	fd = open(TEST_JOURNAL_PATH, O_WRONLY | O_APPEND);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_JOURNAL_PATH);
+	if (write(fd, "U\tuser4", 7) != 7)
+		i_fatal("write(%s) failed: %m", TEST_JOURNAL_PATH);
+	i_close_fd(&fd);
+
+	/* replay the journal */
+	queue = replicator_queue_init(TEST_REPLICATION_FULL_SYNC_INTERVAL,
+				      TEST_REPLICATION_FAILURE_RESYNC_INTERVAL);
+	test_assert(replicator_queue_journal_open(queue, TEST_JOURNAL_PATH) == 0);
+	test_assert(replicator_queue_count(queue) == 2);
+	user = replicator_queue_lookup(queue, "user1");
+	test_assert(user != NULL &&
+		    user->priority == REPLICATION_PRIORITY_NONE &&
+		    user->last_full_sync == ioloop_time &&
+		    null_strcmp(user->state, "state\twith tab") == 0);
+	user = replicator_queue_lookup(queue, "user2");
+	test_assert(user != NULL &&
+		    user->priority == REPLICATION_PRIORITY_LOW);
+	test_assert(replicator_queue_lookup(queue, "user3") == NULL);
+	test_assert(replicator_queue_lookup(queue, "user4") == NULL);
+
+	/* export truncates the journal */
+	test_assert(replicator_queue_export(queue, TEST_DB_PATH) == 0);
+	test_assert(stat(TEST_JOURNAL_PATH, &st) == 0 && st.st_size == 0);
+	user = replicator_queue_lookup(queue, "user2");
+	replicator_queue_remove(queue, &user);
+	replicator_queue_deinit(&queue);
+
+	/* import + replay gives the latest state */
+	queue = replicator_queue_init(TEST_REPLICATION_FULL_SYNC_INTERVAL,
+				      TEST_REPLICATION_FAILURE_RESYNC_INTERVAL);
+	test_assert(replicator_queue_import(queue, TEST_DB_PATH) == 0);
+	test_assert(replicator_queue_count(queue) == 2);
+	test_assert(replicator_queue_journal_open(queue, TEST_JOURNAL_PATH) == 0);
+	test_assert(replicator_queue_count(queue) == 1);
+	test_assert(replicator_queue_lookup(queue, "user1") != NULL);
+	replicator_queue_deinit(&queue);
+
+	i_unlink(TEST_JOURNAL_PATH);
+	i_unlink(TEST_DB_PATH);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_replicator_queue,
 		test_replicator_queue_random,
+		test_replicator_queue_journal,
 		NULL
 	};
 	return test_run(test_functions);
@@ -27,6 +27,8 @@ struct stats_event {
 
 struct writer_client {
 	struct connection conn;
+	/* client aggregates the client_aggregated metrics itself */
+	bool aggregates_metrics;
 
 	struct stats_event *events;
 	HASH_TABLE(struct stats_event *, struct stats_event *) events_hash;
@@ -35,15 +37,55 @@ struct writer_client {
 static struct timeout *to_update_clients;
 static struct connection_list *writer_clients = NULL;
 
+static void
+client_writer_append_aggregated_metrics(string_t *str)
+{
+	struct stats_metrics_iter *iter;
+	const struct metric *metric;
+	string_t *value = t_str_new(128);
+
+	/* <name> <filter> <space-separated fields> for each metric */
+	iter = stats_metrics_iterate_init(stats_metrics);
+	while ((metric = stats_metrics_iterate(iter)) != NULL) {
+		if (!metric->client_aggregated)
+			continue;
+
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, metric->name);
+		str_truncate(value, 0);
+		event_filter_export(metric->set->parsed_filter, value);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, str_c(value));
+		str_truncate(value, 0);
+		for (unsigned int i = 0; i < metric->fields_count; i++) {
+			if (i > 0)
+				str_append_c(value, ' ');
+			str_append(value, metric->fields[i].field_key);
+		}
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, str_c(value));
+	}
+	stats_metrics_iterate_deinit(&iter);
+}
+
 static void client_writer_send_handshake(struct writer_client *client)
 {
 	string_t *filter = t_str_new(128);
 	string_t *str = t_str_new(128);
 
-	event_filter_export(stats_metrics_get_event_filter(stats_metrics), filter);
+	if (!client->aggregates_metrics) {
+		event_filter_export(stats_metrics_get_event_filter(stats_metrics),
+				    filter);
+	} else {
+		event_filter_export(
+			stats_metrics_get_nonaggregated_event_filter(stats_metrics),
+			filter);
+	}
 
 	str_append(str, "FILTER\t");
 	str_append_tabescaped(str, str_c(filter));
+	if (client->aggregates_metrics)
+		client_writer_append_aggregated_metrics(str);
 	str_append_c(str, '\n');
 	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
 }
@@ -69,6 +111,16 @@ void client_writer_create(int fd)
 
 	connection_init_server(writer_clients, &client->conn,
 			       "stats", fd, fd);
+}
+
+static void writer_client_handshake_ready(struct connection *conn)
+{
+	struct writer_client *client =
+		container_of(conn, struct writer_client, conn);
+
+	/* wait for the client's VERSION so we know whether it can aggregate
+	   metrics */
+	client->aggregates_metrics = conn->minor_version >= 1;
 	client_writer_send_handshake(client);
 }
 
@@ -131,7 +183,10 @@ writer_client_run_event(struct writer_client *client,
 		event_unref(&event);
 		return FALSE;
 	}
-	stats_metrics_event(stats_metrics, event, &ctx);
+	if (client->aggregates_metrics)
+		stats_metrics_event_nonaggregated(stats_metrics, event, &ctx);
+	else
+		stats_metrics_event(stats_metrics, event, &ctx);
 	*event_r = event;
 	return TRUE;
 }
@@ -291,6 +346,35 @@ writer_client_input_category(struct writer_client *client ATTR_UNUSED,
 	return TRUE;
 }
 
+static bool
+writer_client_input_metric(struct writer_client *client,
+			   const char *const *args, const char **error_r)
+{
+	unsigned int values_per_event;
+
+	/* <name> <values per event> <values> */
+	if (!client->aggregates_metrics) {
+		*error_r = "Metric aggregation not negotiated";
+		return FALSE;
+	}
+	if (args[0] == NULL || args[1] == NULL ||
+	    str_to_uint(args[1], &values_per_event) < 0) {
+		*error_r = "Invalid parameters";
+		return FALSE;
+	}
+	return stats_metrics_add_client_values(stats_metrics, args[0],
+					       values_per_event, args + 2,
+					       error_r);
+}
+
+static bool
+writer_client_input_merge(struct writer_client *client ATTR_UNUSED,
+			  const char *const *args, const char **error_r)
+{
+	/* state of a metric sent by a stats shard process */
+	return stats_metrics_merge_state(stats_metrics, args, error_r);
+}
+
 static int
 writer_client_input_args(struct connection *conn, const char *const *args)
 {
@@ -312,6 +396,10 @@ writer_client_input_args(struct connection *conn, const char *const *args)
 		ret = writer_client_input_event_end(client, args+1, &error);
 	else if (strcmp(cmd, "CATEGORY") == 0)
 		ret = writer_client_input_category(client, args+1, &error);
+	else if (strcmp(cmd, "METRIC") == 0)
+		ret = writer_client_input_metric(client, args+1, &error);
+	else if (strcmp(cmd, "MERGE") == 0)
+		ret = writer_client_input_merge(client, args+1, &error);
 	else {
 		error = "Unknown command";
 		ret = FALSE;
@@ -329,7 +417,7 @@ static struct connection_settings client_set = {
 	.service_name_in = "stats-client",
 	.service_name_out = "stats-server",
 	.major_version = 4,
-	.minor_version = 0,
+	.minor_version = 1,
 
 	.input_max_size = 1024*128, /* "big enough" */
 	.output_max_size = SIZE_MAX,
@@ -338,6 +426,7 @@ static struct connection_settings client_set = {
 
 static const struct connection_vfuncs client_vfuncs = {
 	.destroy = writer_client_destroy,
+	.handshake_ready = writer_client_handshake_ready,
 	.input_args = writer_client_input_args,
 };
 
@@ -348,7 +437,9 @@ client_writer_update_connections_internal(void *context ATTR_UNUSED)
 	for (conn = writer_clients->connections; conn != NULL; conn = conn->next) {
 		struct writer_client *client =
 			container_of(conn, struct writer_client, conn);
-		client_writer_send_handshake(client);
+		/* clients without VERSION get it from handshake_ready() */
+		if (conn->handshake_received)
+			client_writer_send_handshake(client);
 	}
 	timeout_remove(&to_update_clients);
 }
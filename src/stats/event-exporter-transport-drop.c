@@ -3,7 +3,8 @@
 #include "lib.h"
 #include "event-exporter.h"
 
-void event_export_transport_drop(const struct exporter *exporter ATTR_UNUSED,
-				 const buffer_t *buf ATTR_UNUSED)
+void event_export_transport_drop(struct exporter *exporter ATTR_UNUSED,
+				 const buffer_t *buf ATTR_UNUSED,
+				 unsigned int events_count ATTR_UNUSED)
 {
 }
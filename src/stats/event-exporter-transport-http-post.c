@@ -1,8 +1,9 @@
 /* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
-#include "ioloop.h"
 #include "str.h"
+#include "ostream.h"
+#include "compression.h"
 #include "event-exporter.h"
 #include "http-client.h"
 #include "iostream-ssl.h"
@@ -19,35 +20,72 @@ void event_export_transport_http_post_deinit(void)
 		http_client_deinit(&exporter_http_client);
 }
 
+struct http_post_request {
+	struct exporter *exporter;
+	unsigned int events_count;
+};
+
 static void response_fxn(const struct http_response *response,
-			 void *context ATTR_UNUSED)
+			 struct http_post_request *hreq)
 {
-	static time_t last_log;
-	static unsigned int suppressed;
+	struct exporter *exporter = hreq->exporter;
 
-	if (http_response_is_success(response))
-		return;
+	i_assert(exporter->pending_requests > 0);
+	exporter->pending_requests--;
 
-	if (last_log == ioloop_time) {
-		suppressed++;
-		return; /* don't spam the log */
+	if (!http_response_is_success(response)) {
+		event_export_transport_dropped(exporter, hreq->events_count,
+			t_strdup_printf("HTTP POST failed: %d %s",
+					response->status, response->reason));
 	}
+	i_free(hreq);
+}
 
-	if (suppressed == 0)
-		i_error("Failed to export event via HTTP POST: %d %s",
-			response->status, response->reason);
-	else
-		i_error("Failed to export event via HTTP POST: %d %s (%u more errors suppressed)",
-			response->status, response->reason, suppressed);
+static buffer_t *
+http_post_compress(const struct exporter *exporter, const buffer_t *buf)
+{
+	const struct compression_handler *handler = exporter->compression;
+	buffer_t *dest = t_buffer_create(buf->used / 2 + 64);
+	struct ostream *output, *comp_output;
 
-	last_log = ioloop_time;
-	suppressed = 0;
+	output = o_stream_create_buffer(dest);
+	comp_output = handler->create_ostream(output,
+					      handler->get_default_level());
+	o_stream_unref(&output);
+	o_stream_nsend(comp_output, buf->data, buf->used);
+	if (o_stream_finish(comp_output) < 0) {
+		i_error("Failed to compress exported events: %s",
+			o_stream_get_error(comp_output));
+		o_stream_destroy(&comp_output);
+		return NULL;
+	}
+	o_stream_destroy(&comp_output);
+	return dest;
 }
 
-void event_export_transport_http_post(const struct exporter *exporter,
-				      const buffer_t *buf)
+void event_export_transport_http_post(struct exporter *exporter,
+				      const buffer_t *buf,
+				      unsigned int events_count)
 {
 	struct http_client_request *req;
+	struct http_post_request *hreq;
+
+	if (exporter->max_pending > 0 &&
+	    exporter->pending_requests >= exporter->max_pending) {
+		event_export_transport_dropped(exporter, events_count,
+			t_strdup_printf("Too many pending HTTP POST requests "
+					"(transport_max_pending=%u)",
+					exporter->max_pending));
+		return;
+	}
+
+	if (exporter->compression != NULL) {
+		buf = http_post_compress(exporter, buf);
+		if (buf == NULL) {
+			exporter->dropped_events += events_count;
+			return;
+		}
+	}
 
 	if (exporter_http_client == NULL) {
 		const struct master_service_ssl_settings *master_ssl_set =
@@ -67,12 +105,30 @@ void event_export_transport_http_post(const struct exporter *exporter,
 		exporter_http_client = http_client_init(&set);
 	}
 
+	hreq = i_new(struct http_post_request, 1);
+	hreq->exporter = exporter;
+	hreq->events_count = events_count;
+
 	req = http_client_request_url_str(exporter_http_client, "POST",
 					  exporter->transport_args,
-					  response_fxn, NULL);
-	http_client_request_add_header(req, "Content-Type", exporter->format_mime_type);
+					  response_fxn, hreq);
+	if (events_count > 1) {
+		/* newline-delimited batch of events */
+		http_client_request_add_header(req, "Content-Type",
+			strcmp(exporter->format_mime_type, "application/json") == 0 ?
+			"application/x-ndjson" : exporter->format_mime_type);
+	} else {
+		http_client_request_add_header(req, "Content-Type",
+					       exporter->format_mime_type);
+	}
+	if (exporter->compression != NULL) {
+		http_client_request_add_header(req, "Content-Encoding",
+			strcmp(exporter->compression->name, "gz") == 0 ?
+			"gzip" : exporter->compression->name);
+	}
 	http_client_request_set_payload_data(req, buf->data, buf->used);
 
 	http_client_request_set_timeout_msecs(req, exporter->transport_timeout);
+	exporter->pending_requests++;
 	http_client_request_submit(req);
 }
@@ -5,8 +5,20 @@
 #include "str.h"
 #include "event-exporter.h"
 
-void event_export_transport_log(const struct exporter *exporter ATTR_UNUSED,
-				const buffer_t *buf)
+void event_export_transport_log(struct exporter *exporter ATTR_UNUSED,
+				const buffer_t *buf, unsigned int events_count)
 {
-	i_info("%.*s", (int)buf->used, (const char *)buf->data);
+	const char *data = buf->data, *end = data + buf->used, *p;
+
+	if (events_count <= 1) {
+		i_info("%.*s", (int)buf->used, data);
+		return;
+	}
+
+	/* log each event of the batch separately */
+	while ((p = memchr(data, '\n', end - data)) != NULL) {
+		i_info("%.*s", (int)(p - data), data);
+		data = p + 1;
+	}
+	i_info("%.*s", (int)(end - data), data);
 }
@@ -0,0 +1,77 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "buffer.h"
+#include "event-exporter.h"
+
+void event_export_transport_send(struct exporter *exporter,
+				 const buffer_t *buf)
+{
+	if (exporter->batch_size <= 1) {
+		/* no batching */
+		exporter->transport(exporter, buf, 1);
+		return;
+	}
+
+	if (exporter->batch == NULL)
+		exporter->batch = buffer_create_dynamic(default_pool, 1024);
+	if (exporter->batch_count > 0)
+		buffer_append_c(exporter->batch, '\n');
+	buffer_append_buf(exporter->batch, buf, 0, SIZE_MAX);
+	exporter->batch_count++;
+
+	if (exporter->batch_count >= exporter->batch_size)
+		event_export_transport_flush(exporter);
+	else if (exporter->to_batch == NULL) {
+		exporter->to_batch = timeout_add(exporter->batch_interval_msecs,
+						 event_export_transport_flush,
+						 exporter);
+	}
+}
+
+void event_export_transport_flush(struct exporter *exporter)
+{
+	timeout_remove(&exporter->to_batch);
+	if (exporter->batch_count == 0)
+		return;
+
+	T_BEGIN {
+		exporter->transport(exporter, exporter->batch,
+				    exporter->batch_count);
+	} T_END;
+	buffer_set_used_size(exporter->batch, 0);
+	exporter->batch_count = 0;
+}
+
+void event_export_transport_deinit(struct exporter *exporter)
+{
+	event_export_transport_flush(exporter);
+	buffer_free(&exporter->batch);
+}
+
+void event_export_transport_dropped(struct exporter *exporter,
+				    unsigned int events_count,
+				    const char *reason)
+{
+	static time_t last_log;
+	static unsigned int suppressed;
+
+	exporter->dropped_events += events_count;
+
+	if (last_log == ioloop_time) {
+		suppressed++;
+		return; /* don't spam the log */
+	}
+
+	if (suppressed == 0) {
+		i_error("Exporter %s dropped %u events: %s",
+			exporter->name, events_count, reason);
+	} else {
+		i_error("Exporter %s dropped %u events: %s "
+			"(%u more errors suppressed)",
+			exporter->name, events_count, reason, suppressed);
+	}
+	last_log = ioloop_time;
+	suppressed = 0;
+}
@@ -9,10 +9,29 @@ void event_export_fmt_none(const struct metric *metric, struct event *event, buf
 void event_export_fmt_tabescaped_text(const struct metric *metric, struct event *event, buffer_t *dest);
 
 /* transport functions */
-void event_export_transport_drop(const struct exporter *exporter, const buffer_t *buf);
-void event_export_transport_http_post(const struct exporter *exporter, const buffer_t *buf);
+void event_export_transport_drop(struct exporter *exporter, const buffer_t *buf,
+				 unsigned int events_count);
+void event_export_transport_http_post(struct exporter *exporter,
+				      const buffer_t *buf,
+				      unsigned int events_count);
 void event_export_transport_http_post_deinit(void);
-void event_export_transport_log(const struct exporter *exporter, const buffer_t *buf);
+void event_export_transport_log(struct exporter *exporter, const buffer_t *buf,
+				unsigned int events_count);
+
+/* Send a formatted event using the exporter's transport. The event is added
+   to the exporter's batch, which is sent when it's full or the batch
+   interval has passed. */
+void event_export_transport_send(struct exporter *exporter,
+				 const buffer_t *buf);
+/* Send the exporter's batch immediately. */
+void event_export_transport_flush(struct exporter *exporter);
+/* Flush and free the exporter's batch. */
+void event_export_transport_deinit(struct exporter *exporter);
+/* Account events_count events as dropped. This also logs an error, but
+   at most once per second. */
+void event_export_transport_dropped(struct exporter *exporter,
+				    unsigned int events_count,
+				    const char *reason);
 
 /* append a microsecond resolution RFC3339 UTC timestamp */
 void event_export_helper_fmt_rfc3339_time(string_t *dest, const struct timeval *time);
@@ -3,10 +3,13 @@
 #include "stats-common.h"
 #include "array.h"
 #include "str.h"
+#include "strescape.h"
 #include "str-sanitize.h"
+#include "hex-binary.h"
 #include "stats-dist.h"
 #include "time-util.h"
 #include "event-filter.h"
+#include "compression.h"
 #include "event-exporter.h"
 #include "stats-settings.h"
 #include "stats-metrics.h"
@@ -19,6 +22,8 @@
 struct stats_metrics {
 	pool_t pool;
 	struct event_filter *filter; /* stats & export */
+	/* metrics that aren't client_aggregated */
+	struct event_filter *nonaggregated_filter;
 	ARRAY(struct exporter *) exporters;
 	ARRAY(struct metric *) metrics;
 };
@@ -39,6 +44,16 @@ static void stats_exporters_add_set(struct stats_metrics *metrics,
 	exporter->transport_args = p_strdup(metrics->pool, set->transport_args);
 	exporter->transport_timeout = set->transport_timeout;
 	exporter->time_format = set->parsed_time_format;
+	exporter->batch_size = set->transport_batch_size;
+	exporter->batch_interval_msecs = set->transport_batch_interval;
+	exporter->max_pending = set->transport_max_pending;
+	if (set->transport_compression[0] != '\0' &&
+	    compression_lookup_handler(set->transport_compression,
+				       &exporter->compression) <= 0) {
+		i_fatal("exporter %s: transport_compression=%s: "
+			"Support not compiled in", set->name,
+			set->transport_compression);
+	}
 
 	/* TODO: The following should be plugable.
 	 *
@@ -124,6 +139,18 @@ static void stats_metrics_add_set(struct stats_metrics *metrics,
 	 * Metrics may also be exported - make sure exporter info is set
 	 */
 
+	if (set->exporter[0] == '\0') {
+		/* The duration field is added to the event only by the stats
+		   process, so the clients can't match filters using it. */
+		metric->client_aggregated = metric->group_by == NULL &&
+			!event_filter_has_field(set->parsed_filter,
+						STATS_EVENT_FIELD_NAME_DURATION);
+	}
+	if (!metric->client_aggregated) {
+		event_filter_merge_with_context(metrics->nonaggregated_filter,
+						set->parsed_filter, metric);
+	}
+
 	if (set->exporter[0] == '\0')
 		return; /* not exported */
 
@@ -168,6 +195,7 @@ stats_metric_settings_dup(pool_t pool, const struct stats_metric_settings *src)
 	set->fields = p_strdup(pool, src->fields);
 	set->group_by = p_strdup(pool, src->group_by);
 	set->filter = p_strdup(pool, src->filter);
+	set->duration_histogram = src->duration_histogram;
 	set->exporter = p_strdup(pool, src->exporter);
 	set->exporter_include = p_strdup(pool, src->exporter_include);
 
@@ -241,6 +269,8 @@ bool stats_metrics_remove_dynamic(struct stats_metrics *metrics,
 	if (m != NULL) {
 		array_delete(&metrics->metrics, m_idx, 1);
 		ret = event_filter_remove_queries_with_context(metrics->filter, m);
+		(void)event_filter_remove_queries_with_context(
+			metrics->nonaggregated_filter, m);
 		stats_metric_free(m);
 	}
 	return ret;
@@ -284,6 +314,7 @@ struct stats_metrics *stats_metrics_init(const struct stats_settings *set)
 	metrics = p_new(pool, struct stats_metrics, 1);
 	metrics->pool = pool;
 	metrics->filter = event_filter_create();
+	metrics->nonaggregated_filter = event_filter_create();
 	stats_metrics_add_from_settings(metrics, set);
 	return metrics;
 }
@@ -300,8 +331,12 @@ static void stats_metric_free(struct metric *metric)
 		stats_metric_free(sub_metric);
 }
 
-static void stats_export_deinit(void)
+static void stats_export_deinit(struct stats_metrics *metrics)
 {
+	struct exporter *exporter;
+
+	array_foreach_elem(&metrics->exporters, exporter)
+		event_export_transport_deinit(exporter);
 	/* no need for event_export_transport_drop_deinit() - no-op */
 	event_export_transport_http_post_deinit();
 	/* no need for event_export_transport_log_deinit() - no-op */
@@ -314,11 +349,12 @@ void stats_metrics_deinit(struct stats_metrics **_metrics)
 
 	*_metrics = NULL;
 
-	stats_export_deinit();
+	stats_export_deinit(metrics);
 
 	array_foreach_elem(&metrics->metrics, metric)
 		stats_metric_free(metric);
 	event_filter_unref(&metrics->filter);
+	event_filter_unref(&metrics->nonaggregated_filter);
 	pool_unref(&metrics->pool);
 }
 
@@ -348,6 +384,12 @@ stats_metrics_get_event_filter(struct stats_metrics *metrics)
 	return metrics->filter;
 }
 
+struct event_filter *
+stats_metrics_get_nonaggregated_event_filter(struct stats_metrics *metrics)
+{
+	return metrics->nonaggregated_filter;
+}
+
 static struct metric *
 stats_metric_find_sub_metric(struct metric *metric,
 			     const struct metric_value *value)
@@ -559,6 +601,24 @@ stats_metric_group_by_value_label(const struct event_field *field,
 	i_unreached();
 }
 
+static struct metric *
+stats_metric_sub_metric_create(struct metric *metric, const char *label,
+			       const struct metric_value *value, pool_t pool)
+{
+	struct metric *sub_metric;
+
+	sub_metric = stats_metric_sub_metric_alloc(metric, label, pool);
+	if (metric->group_by_count > 1) {
+		sub_metric->group_by_count = metric->group_by_count - 1;
+		sub_metric->group_by = &metric->group_by[1];
+	}
+	sub_metric->group_value.type = value->type;
+	sub_metric->group_value.intmax = value->intmax;
+	sub_metric->group_value.ip = value->ip;
+	memcpy(sub_metric->group_value.hash, value->hash, SHA1_RESULTLEN);
+	return sub_metric;
+}
+
 static struct metric *
 stats_metric_get_sub_metric(struct metric *metric,
 			    const struct event_field *field,
@@ -575,17 +635,9 @@ stats_metric_get_sub_metric(struct metric *metric,
 		const char *value_label =
 			stats_metric_group_by_value_label(field,
 				&metric->group_by[0], value);
-		sub_metric = stats_metric_sub_metric_alloc(metric, value_label,
-							   pool);
+		sub_metric = stats_metric_sub_metric_create(metric, value_label,
+							    value, pool);
 	} T_END;
-	if (metric->group_by_count > 1) {
-		sub_metric->group_by_count = metric->group_by_count - 1;
-		sub_metric->group_by = &metric->group_by[1];
-	}
-	sub_metric->group_value.type = value->type;
-	sub_metric->group_value.intmax = value->intmax;
-	sub_metric->group_value.ip = value->ip;
-	memcpy(sub_metric->group_value.hash, value->hash, SHA1_RESULTLEN);
 	return sub_metric;
 }
 
@@ -715,7 +767,7 @@ static void
 stats_export_event(struct metric *metric, struct event *oldevent)
 {
 	const struct metric_export_info *info = &metric->export_info;
-	const struct exporter *exporter = info->exporter;
+	struct exporter *exporter = info->exporter;
 	struct event *event;
 
 	i_assert(exporter != NULL);
@@ -728,14 +780,16 @@ stats_export_event(struct metric *metric, struct event *oldevent)
 		buf = t_buffer_create(128);
 
 		exporter->format(metric, event, buf);
-		exporter->transport(exporter, buf);
+		event_export_transport_send(exporter, buf);
 	} T_END;
 
 	event_unref(&event);
 }
 
-void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
-			 const struct failure_context *ctx)
+static void
+stats_metrics_event_full(struct stats_metrics *metrics, struct event *event,
+			 const struct failure_context *ctx,
+			 bool skip_client_aggregated)
 {
 	struct event_filter_match_iter *iter;
 	struct metric *metric;
@@ -750,21 +804,308 @@ void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
 	/* process stats & exports */
 	iter = event_filter_match_iter_init(metrics->filter, event, ctx);
 	while ((metric = event_filter_match_iter_next(iter)) != NULL) T_BEGIN {
-		/* every metric is fed into stats */
-		stats_metric_event(metric, event, metrics->pool);
-
-		/* some metrics are exported */
-		if (metric->export_info.exporter != NULL)
-			stats_export_event(metric, event);
+		if (skip_client_aggregated && metric->client_aggregated) {
+			/* the client sends these separately */
+		} else {
+			/* every metric is fed into stats */
+			stats_metric_event(metric, event, metrics->pool);
+
+			/* some metrics are exported */
+			if (metric->export_info.exporter != NULL)
+				stats_export_event(metric, event);
+		}
 	} T_END;
 	event_filter_match_iter_deinit(&iter);
 }
 
+void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
+			 const struct failure_context *ctx)
+{
+	stats_metrics_event_full(metrics, event, ctx, FALSE);
+}
+
+void stats_metrics_event_nonaggregated(struct stats_metrics *metrics,
+				       struct event *event,
+				       const struct failure_context *ctx)
+{
+	stats_metrics_event_full(metrics, event, ctx, TRUE);
+}
+
+static bool
+stats_metric_add_client_value(struct stats_dist *stats, const char *value,
+			      const char **error_r)
+{
+	uint64_t num;
+
+	if (value[0] == '\0') {
+		/* field didn't exist */
+		return TRUE;
+	}
+	if (str_to_uint64(value, &num) < 0) {
+		*error_r = t_strdup_printf("Invalid value: %s", value);
+		return FALSE;
+	}
+	stats_dist_add(stats, num);
+	return TRUE;
+}
+
+bool stats_metrics_add_client_values(struct stats_metrics *metrics,
+				     const char *name,
+				     unsigned int values_per_event,
+				     const char *const *values,
+				     const char **error_r)
+{
+	struct metric *metric;
+	unsigned int i, idx, count = str_array_length(values);
+
+	if (values_per_event == 0 || count % values_per_event != 0) {
+		*error_r = "Invalid number of values";
+		return FALSE;
+	}
+
+	metric = stats_metrics_find(metrics, name, &idx);
+	if (metric == NULL || !metric->client_aggregated ||
+	    metric->fields_count + 1 != values_per_event) {
+		/* metric was removed or changed after the client received
+		   the metric list */
+		return TRUE;
+	}
+
+	for (i = 0; i < count; i += values_per_event) {
+		if (!stats_metric_add_client_value(metric->duration_stats,
+						   values[i], error_r))
+			return FALSE;
+		for (unsigned int j = 0; j < metric->fields_count; j++) {
+			if (!stats_metric_add_client_value(
+					metric->fields[j].stats,
+					values[i + 1 + j], error_r))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static bool stats_metric_is_empty(const struct metric *metric)
+{
+	if (stats_dist_get_count(metric->duration_stats) > 0)
+		return FALSE;
+	for (unsigned int i = 0; i < metric->fields_count; i++) {
+		if (stats_dist_get_count(metric->fields[i].stats) > 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+stats_metric_value_export(const struct metric_value *value, string_t *dest)
+{
+	switch (value->type) {
+	case METRIC_VALUE_TYPE_STR:
+		str_append(dest, "s\t");
+		binary_to_hex_append(dest, value->hash, sizeof(value->hash));
+		break;
+	case METRIC_VALUE_TYPE_INT:
+		str_printfa(dest, "i\t%jd", value->intmax);
+		break;
+	case METRIC_VALUE_TYPE_IP:
+		str_printfa(dest, "p\t%s", net_ip2addr(&value->ip));
+		break;
+	case METRIC_VALUE_TYPE_BUCKET_INDEX:
+		str_printfa(dest, "b\t%jd", value->intmax);
+		break;
+	}
+}
+
+static void
+stats_metric_export_state(const struct metric *metric, string_t *path,
+			  unsigned int depth, string_t *dest)
+{
+	struct metric *sub_metric;
+
+	/* Events are added to all the parent metrics as well, so if this
+	   one is empty so are its sub-metrics. */
+	if (stats_metric_is_empty(metric))
+		return;
+
+	str_append(dest, "MERGE\t");
+	str_append_tabescaped(dest, metric->name);
+	str_printfa(dest, "\t%u", depth);
+	str_append_str(dest, path);
+	str_append_c(dest, '\t');
+	stats_dist_export(metric->duration_stats, dest);
+	str_printfa(dest, "\t%u", metric->fields_count);
+	for (unsigned int i = 0; i < metric->fields_count; i++) {
+		str_append_c(dest, '\t');
+		stats_dist_export(metric->fields[i].stats, dest);
+	}
+	str_append_c(dest, '\n');
+
+	if (!array_is_created(&metric->sub_metrics))
+		return;
+	array_foreach_elem(&metric->sub_metrics, sub_metric) {
+		size_t path_pos = str_len(path);
+
+		str_append_c(path, '\t');
+		stats_metric_value_export(&sub_metric->group_value, path);
+		str_append_c(path, '\t');
+		str_append_tabescaped(path, sub_metric->sub_name);
+		stats_metric_export_state(sub_metric, path, depth + 1, dest);
+		str_truncate(path, path_pos);
+	}
+}
+
+void stats_metrics_export_state(struct stats_metrics *metrics,
+				string_t *dest)
+{
+	struct metric *metric;
+	string_t *path = t_str_new(128);
+
+	array_foreach_elem(&metrics->metrics, metric)
+		stats_metric_export_state(metric, path, 0, dest);
+}
+
+static bool
+stats_metric_value_import(const char *type, const char *value,
+			  struct metric_value *value_r)
+{
+	buffer_t hash;
+
+	i_zero(value_r);
+	if (strcmp(type, "s") == 0) {
+		value_r->type = METRIC_VALUE_TYPE_STR;
+		buffer_create_from_data(&hash, value_r->hash,
+					sizeof(value_r->hash));
+		return strlen(value) == sizeof(value_r->hash) * 2 &&
+			hex_to_binary(value, &hash) == 0;
+	} else if (strcmp(type, "i") == 0) {
+		value_r->type = METRIC_VALUE_TYPE_INT;
+		return str_to_intmax(value, &value_r->intmax) == 0;
+	} else if (strcmp(type, "p") == 0) {
+		value_r->type = METRIC_VALUE_TYPE_IP;
+		return net_addr2ip(value, &value_r->ip) == 0;
+	} else if (strcmp(type, "b") == 0) {
+		value_r->type = METRIC_VALUE_TYPE_BUCKET_INDEX;
+		return str_to_intmax(value, &value_r->intmax) == 0 &&
+			value_r->intmax >= 0;
+	}
+	return FALSE;
+}
+
+static bool
+stats_metric_value_matches_group_by(
+	const struct metric_value *value,
+	const struct stats_metric_settings_group_by *group_by)
+{
+	switch (group_by->func) {
+	case STATS_METRIC_GROUPBY_DISCRETE:
+		return value->type != METRIC_VALUE_TYPE_BUCKET_INDEX;
+	case STATS_METRIC_GROUPBY_QUANTIZED:
+		return value->type == METRIC_VALUE_TYPE_BUCKET_INDEX &&
+			value->intmax < (intmax_t)group_by->num_ranges;
+	}
+	i_unreached();
+}
+
+static bool
+stats_metric_merge_state(struct stats_metrics *metrics, struct metric *metric,
+			 unsigned int depth, const char *const *path,
+			 struct stats_dist *const *dists, const char **error_r)
+{
+	struct metric *sub_metric;
+	struct metric_value value;
+
+	for (unsigned int i = 0; i < depth; i++, path += 3) {
+		if (!stats_metric_value_import(path[0], path[1], &value)) {
+			*error_r = t_strdup_printf(
+				"Invalid group_by value: %s %s",
+				path[0], path[1]);
+			return FALSE;
+		}
+		if (metric->group_by == NULL ||
+		    !stats_metric_value_matches_group_by(&value,
+							 &metric->group_by[0])) {
+			/* metric's group_by was changed */
+			return TRUE;
+		}
+		if (!array_is_created(&metric->sub_metrics))
+			p_array_init(&metric->sub_metrics, metrics->pool, 8);
+		sub_metric = stats_metric_find_sub_metric(metric, &value);
+		if (sub_metric == NULL) {
+			sub_metric = stats_metric_sub_metric_create(metric,
+					path[2], &value, metrics->pool);
+		}
+		metric = sub_metric;
+	}
+
+	stats_dist_merge(metric->duration_stats, dists[0]);
+	for (unsigned int i = 0; i < metric->fields_count; i++)
+		stats_dist_merge(metric->fields[i].stats, dists[i + 1]);
+	return TRUE;
+}
+
+bool stats_metrics_merge_state(struct stats_metrics *metrics,
+			       const char *const *args, const char **error_r)
+{
+	struct metric *metric;
+	struct stats_dist **dists;
+	const char *name = args[0], *const *path;
+	unsigned int i, idx, depth, fields_count, dists_count;
+	bool ret = TRUE;
+
+	/* <name> <depth> [<value type> <value> <label>]*depth
+	   <duration> <fields count> <fields> */
+	if (name == NULL || args[1] == NULL ||
+	    str_to_uint(args[1], &depth) < 0 ||
+	    depth > str_array_length(args + 2) / 3) {
+		*error_r = "Invalid parameters";
+		return FALSE;
+	}
+	path = args + 2;
+	args = path + depth * 3;
+	if (args[0] == NULL || args[1] == NULL ||
+	    str_to_uint(args[1], &fields_count) < 0 ||
+	    fields_count != str_array_length(args + 2)) {
+		*error_r = "Invalid number of fields";
+		return FALSE;
+	}
+
+	metric = stats_metrics_find(metrics, name, &idx);
+	if (metric == NULL || metric->fields_count != fields_count) {
+		/* metric was removed or changed */
+		return TRUE;
+	}
+
+	/* import everything before modifying the metrics */
+	dists_count = fields_count + 1;
+	dists = t_new(struct stats_dist *, dists_count);
+	for (i = 0; i < dists_count; i++)
+		dists[i] = stats_dist_init();
+	for (i = 0; i < dists_count && ret; i++) {
+		if (stats_dist_import(dists[i], args[i == 0 ? 0 : i + 1],
+				      error_r) < 0)
+			ret = FALSE;
+	}
+	if (ret) {
+		ret = stats_metric_merge_state(metrics, metric, depth, path,
+					       dists, error_r);
+	}
+	for (i = 0; i < dists_count; i++)
+		stats_dist_deinit(&dists[i]);
+	return ret;
+}
+
 struct stats_metrics_iter {
 	struct stats_metrics *metrics;
 	unsigned int idx;
 };
 
+struct exporter *const *
+stats_metrics_get_exporters(struct stats_metrics *metrics,
+			    unsigned int *count_r)
+{
+	return array_get(&metrics->exporters, count_r);
+}
+
 struct stats_metrics_iter *
 stats_metrics_iterate_init(struct stats_metrics *metrics)
 {
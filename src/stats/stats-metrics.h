@@ -4,6 +4,8 @@
 #include "stats-settings.h"
 #include "sha1.h"
 
+struct compression_handler;
+
 #define STATS_EVENT_FIELD_NAME_DURATION "duration"
 
 struct metric;
@@ -36,12 +38,34 @@ struct exporter {
 	const char *transport_args;
 	unsigned int transport_timeout;
 
-	/* function to send the event */
-	void (*transport)(const struct exporter *, const buffer_t *);
+	/* Send up to batch_size events with one transport call. The events
+	   are separated by LFs. Incomplete batches are sent after
+	   batch_interval_msecs. */
+	unsigned int batch_size;
+	unsigned int batch_interval_msecs;
+	/* Drop events instead of sending when this many transport requests
+	   are still pending. 0 = unlimited. */
+	unsigned int max_pending;
+	/* Compression for the payload, or NULL */
+	const struct compression_handler *compression;
+
+	/* function to send the events */
+	void (*transport)(struct exporter *, const buffer_t *,
+			  unsigned int events_count);
+
+	/* events waiting to be sent */
+	buffer_t *batch;
+	unsigned int batch_count;
+	struct timeout *to_batch;
+	/* number of transport requests not finished yet */
+	unsigned int pending_requests;
+	/* number of events dropped because of failures or too many pending
+	   requests */
+	uint64_t dropped_events;
 };
 
 struct metric_export_info {
-	const struct exporter *exporter;
+	struct exporter *exporter;
 
 	enum event_exporter_includes {
 		EVENT_EXPORTER_INCL_NONE       = 0,
@@ -104,6 +128,12 @@ struct metric {
 	ARRAY(struct metric *) sub_metrics;
 
 	struct metric_export_info export_info;
+
+	/* Stats clients supporting it aggregate this metric's values
+	   themselves and send them with METRIC commands, instead of sending
+	   each matching event. This is possible only for metrics that don't
+	   need anything beyond the field values. */
+	bool client_aggregated;
 };
 
 bool stats_metrics_add_dynamic(struct stats_metrics *metrics,
@@ -123,9 +153,46 @@ void stats_metrics_reset(struct stats_metrics *metrics);
 struct event_filter *
 stats_metrics_get_event_filter(struct stats_metrics *metrics);
 
+/* Returns event filter containing only the metrics that aren't aggregated by
+   the stats clients. */
+struct event_filter *
+stats_metrics_get_nonaggregated_event_filter(struct stats_metrics *metrics);
+
 /* Update metrics with given event. */
 void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
 			 const struct failure_context *ctx);
+/* Same as stats_metrics_event(), but skip the client-aggregated metrics.
+   Used for events coming from clients that aggregate those metrics
+   themselves. */
+void stats_metrics_event_nonaggregated(struct stats_metrics *metrics,
+				       struct event *event,
+				       const struct failure_context *ctx);
+/* Add values aggregated by a stats client to the named metric. The values
+   contain values_per_event values for each event: the duration followed by
+   each of the metric's fields. An empty value means the field didn't
+   exist. Returns FALSE if the values are invalid. Values for unknown or
+   changed metrics are silently ignored. */
+bool stats_metrics_add_client_values(struct stats_metrics *metrics,
+				     const char *name,
+				     unsigned int values_per_event,
+				     const char *const *values,
+				     const char **error_r);
+
+/* Append the state of all the non-empty metrics and sub-metrics to dest as
+   MERGE commands of the stats-writer protocol. Used by stats shards to send
+   their state to the main stats process. */
+void stats_metrics_export_state(struct stats_metrics *metrics,
+				string_t *dest);
+/* Merge the state sent by stats_metrics_export_state() in a MERGE command.
+   Returns FALSE if the args are invalid. States for unknown or changed
+   metrics are silently ignored. */
+bool stats_metrics_merge_state(struct stats_metrics *metrics,
+			       const char *const *args, const char **error_r);
+
+/* Returns all the configured exporters. */
+struct exporter *const *
+stats_metrics_get_exporters(struct stats_metrics *metrics,
+			    unsigned int *count_r);
 
 /* Iterate through all the tracked metrics. */
 struct stats_metrics_iter *
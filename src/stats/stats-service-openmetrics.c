@@ -16,6 +16,10 @@
 
 #define OPENMETRICS_CONTENT_VERSION "0.0.1"
 
+/* Duration histogram buckets are powers of two microseconds: 64us .. ~18min */
+#define OPENMETRICS_DURATION_HISTOGRAM_MIN_BITS 6
+#define OPENMETRICS_DURATION_HISTOGRAM_MAX_BITS 30
+
 #ifdef DOVECOT_REVISION
 #define OPENMETRICS_BUILD_INFO \
 	"version=\""DOVECOT_VERSION"\"," \
@@ -28,6 +32,7 @@
 enum openmetrics_metric_type {
 	OPENMETRICS_METRIC_TYPE_COUNT,
 	OPENMETRICS_METRIC_TYPE_DURATION,
+	OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM,
 	OPENMETRICS_METRIC_TYPE_FIELD,
 	OPENMETRICS_METRIC_TYPE_HISTOGRAM,
 };
@@ -111,6 +116,27 @@ static void openmetrics_export_dovecot(string_t *out)
 	str_append(out, "dovecot_build_info{"OPENMETRICS_BUILD_INFO"} 1\n");
 }
 
+static void openmetrics_export_exporters(string_t *out)
+{
+	struct exporter *const *exporters;
+	unsigned int i, count;
+
+	exporters = stats_metrics_get_exporters(stats_metrics, &count);
+	if (count == 0)
+		return;
+
+	str_append(out, "# HELP dovecot_exporter_dropped_events "
+			"Number of events dropped by the exporter\n");
+	str_append(out, "# TYPE dovecot_exporter_dropped_events counter\n");
+	for (i = 0; i < count; i++) {
+		str_append(out, "dovecot_exporter_dropped_events_total"
+				"{exporter=\"");
+		json_append_escaped(out, exporters[i]->name);
+		str_printfa(out, "\"} %"PRIu64"\n",
+			    exporters[i]->dropped_events);
+	}
+}
+
 static void openmetrics_export_eof(string_t *out)
 {
 	str_append(out, "# EOF\n");
@@ -144,6 +170,7 @@ openmetrics_export_metric_value(struct openmetrics_request *req, string_t *out,
 		else
 			str_printfa(out, "_%s_total", field->field_key);
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		i_unreached();
 	}
@@ -169,11 +196,62 @@ openmetrics_export_metric_value(struct openmetrics_request *req, string_t *out,
 		str_printfa(out, " %"PRIu64"\n",
 			    stats_dist_get_sum(field->stats));
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		i_unreached();
 	}
 }
 
+static void
+openmetrics_export_duration_histogram_line(struct openmetrics_request *req,
+					   string_t *out, const char *suffix,
+					   const char *le)
+{
+	str_append(out, "dovecot_");
+	str_append(out, req->metric->name);
+	str_append(out, "_duration_histogram_seconds_");
+	str_append(out, suffix);
+	if (str_len(req->labels) > 0 || le != NULL) {
+		str_append_c(out, '{');
+		str_append_str(out, req->labels);
+		if (le != NULL) {
+			if (str_len(req->labels) > 0)
+				str_append_c(out, ',');
+			str_printfa(out, "le=\"%s\"", le);
+		}
+		str_append_c(out, '}');
+	}
+}
+
+static void
+openmetrics_export_duration_histogram(struct openmetrics_request *req,
+				      string_t *out,
+				      const struct metric *metric)
+{
+	const struct stats_dist *stats = metric->duration_stats;
+	unsigned int bits;
+
+	/* The stats_dist histogram has exact counts for the power of two
+	   bucket boundaries. */
+	for (bits = OPENMETRICS_DURATION_HISTOGRAM_MIN_BITS;
+	     bits <= OPENMETRICS_DURATION_HISTOGRAM_MAX_BITS; bits++) {
+		uint64_t limit = 1ULL << bits;
+
+		/* Convert from microseconds to seconds */
+		openmetrics_export_duration_histogram_line(req, out, "bucket",
+			t_strdup_printf("%.6f", limit/1e6));
+		str_printfa(out, " %"PRIu64"\n",
+			    stats_dist_get_count_le(stats, limit));
+	}
+	openmetrics_export_duration_histogram_line(req, out, "bucket", "+Inf");
+	str_printfa(out, " %u\n", stats_dist_get_count(stats));
+
+	openmetrics_export_duration_histogram_line(req, out, "sum", NULL);
+	str_printfa(out, " %.6f\n", stats_dist_get_sum(stats)/1e6);
+	openmetrics_export_duration_histogram_line(req, out, "count", NULL);
+	str_printfa(out, " %u\n", stats_dist_get_count(stats));
+}
+
 static const struct metric *
 openmetrics_find_histogram_bucket(const struct metric *metric,
 				 unsigned int index)
@@ -296,6 +374,9 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	case OPENMETRICS_METRIC_TYPE_DURATION:
 		str_append(out, "_duration_seconds Total duration of all events of this kind");
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
+		str_append(out, "_duration_histogram_seconds Histogram of durations of all events of this kind");
+		break;
 	case OPENMETRICS_METRIC_TYPE_FIELD:
 		field = &metric->fields[req->field_pos];
 		str_printfa(out, "_%s Total of field value for events of this kind",
@@ -320,6 +401,9 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	case OPENMETRICS_METRIC_TYPE_DURATION:
 		str_append(out, "_duration_seconds counter\n");
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
+		str_append(out, "_duration_histogram_seconds histogram\n");
+		break;
 	case OPENMETRICS_METRIC_TYPE_FIELD:
 		field = &metric->fields[req->field_pos];
 		str_printfa(out, "_%s counter\n", field->field_key);
@@ -350,8 +434,10 @@ openmetrics_export_submetric(struct openmetrics_request *req, string_t *out,
 		openmetrics_export_histogram(req, out, metric);
 		return;
 	}
-
-	openmetrics_export_metric_value(req, out, metric);
+	if (req->metric_type == OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM)
+		openmetrics_export_duration_histogram(req, out, metric);
+	else
+		openmetrics_export_metric_value(req, out, metric);
 
 	req->has_submetric = TRUE;
 }
@@ -505,7 +591,10 @@ openmetrics_export_sub_metrics(struct openmetrics_request *req, string_t *out)
 static void
 openmetrics_export_metric_body(struct openmetrics_request *req, string_t *out)
 {
-	openmetrics_export_metric_value(req, out, req->metric);
+	if (req->metric_type == OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM)
+		openmetrics_export_duration_histogram(req, out, req->metric);
+	else
+		openmetrics_export_metric_value(req, out, req->metric);
 }
 
 static int
@@ -560,6 +649,16 @@ static void openmetrics_export_next(struct openmetrics_request *req)
 		req->state = OPENMETRICS_REQUEST_STATE_METRIC_HEADER;
 		break;
 	case OPENMETRICS_METRIC_TYPE_DURATION:
+		if (req->metric->set->duration_histogram) {
+			/* Continue with duration histogram output for this
+			   metric. */
+			req->metric_type =
+				OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM;
+			req->state = OPENMETRICS_REQUEST_STATE_METRIC_HEADER;
+			break;
+		}
+		/* Fall through */
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
 		if (openmetrics_export_has_histogram(req)) {
 			/* Continue with histogram output for this metric. */
 			req->metric_type = OPENMETRICS_METRIC_TYPE_HISTOGRAM;
@@ -606,6 +705,7 @@ openmetrics_export_continue(struct openmetrics_request *req, string_t *out)
 		i_assert(req->stats_iter == NULL);
 		req->stats_iter = stats_metrics_iterate_init(stats_metrics);
 		openmetrics_export_dovecot(out);
+		openmetrics_export_exporters(out);
 		req->state = OPENMETRICS_REQUEST_STATE_METRIC;
 		break;
 	case OPENMETRICS_REQUEST_STATE_METRIC:
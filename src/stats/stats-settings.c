@@ -75,6 +75,57 @@ struct service_settings stats_service_settings = {
 	.inet_listeners = ARRAY_INIT,
 };
 
+/* <settings checks> */
+static struct file_listener_settings stats_shard_unix_listeners_array[] = {
+	{
+		.path = "stats-shard-writer",
+		.type = "writer",
+		.mode = 0660,
+		.user = "",
+		.group = "$default_internal_group",
+	},
+	{
+		.path = "login/stats-shard-writer",
+		.type = "writer",
+		.mode = 0600,
+		.user = "$default_login_user",
+		.group = "",
+	},
+};
+static struct file_listener_settings *stats_shard_unix_listeners[] = {
+	&stats_shard_unix_listeners_array[0],
+	&stats_shard_unix_listeners_array[1],
+};
+static buffer_t stats_shard_unix_listeners_buf = {
+	{ { stats_shard_unix_listeners, sizeof(stats_shard_unix_listeners) } }
+};
+/* </settings checks> */
+
+struct service_settings stats_shard_service_settings = {
+	.name = "stats-shard",
+	.protocol = "",
+	.type = "",
+	.executable = "stats -s",
+	.user = "$default_internal_user",
+	.group = "",
+	.privileged_group = "",
+	.extra_groups = "",
+	.chroot = "",
+
+	.drop_priv_before_exec = FALSE,
+
+	.process_min_avail = 0,
+	.process_limit = 0,
+	.client_limit = 0,
+	.service_count = 0,
+	.idle_kill = UINT_MAX,
+	.vsz_limit = UOFF_T_MAX,
+
+	.unix_listeners = { { &stats_shard_unix_listeners_buf,
+			      sizeof(stats_shard_unix_listeners[0]) } },
+	.inet_listeners = ARRAY_INIT,
+};
+
 /*
  * event_exporter { } block settings
  */
@@ -88,6 +139,10 @@ static const struct setting_define stats_exporter_setting_defines[] = {
 	DEF(STR, transport),
 	DEF(STR, transport_args),
 	DEF(TIME_MSECS, transport_timeout),
+	DEF(UINT, transport_batch_size),
+	DEF(TIME_MSECS, transport_batch_interval),
+	DEF(UINT, transport_max_pending),
+	DEF(STR, transport_compression),
 	DEF(STR, format),
 	DEF(STR, format_args),
 	SETTING_DEFINE_LIST_END
@@ -98,6 +153,10 @@ static const struct stats_exporter_settings stats_exporter_default_settings = {
 	.transport = "",
 	.transport_args = "",
 	.transport_timeout = 250, /* ms */
+	.transport_batch_size = 1,
+	.transport_batch_interval = 1000, /* ms */
+	.transport_max_pending = 0,
+	.transport_compression = "",
 	.format = "",
 	.format_args = "",
 };
@@ -126,6 +185,7 @@ static const struct setting_define stats_metric_setting_defines[] = {
 	DEF(STR, fields),
 	DEF(STR, group_by),
 	DEF(STR, filter),
+	DEF(BOOL, duration_histogram),
 	DEF(STR, exporter),
 	DEF(STR, exporter_include),
 	DEF(STR, description),
@@ -138,6 +198,7 @@ static const struct stats_metric_settings stats_metric_default_settings = {
 	.filter = "",
 	.exporter = "",
 	.group_by = "",
+	.duration_histogram = FALSE,
 	.exporter_include = STATS_METRIC_SETTINGS_DEFAULT_EXPORTER_INCLUDE,
 	.description = "",
 };
@@ -296,6 +357,25 @@ static bool stats_exporter_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		return FALSE;
 	}
 
+	if (set->transport_batch_size == 0) {
+		*error_r = "transport_batch_size must not be 0";
+		return FALSE;
+	}
+	if (set->transport_compression[0] != '\0') {
+		if (strcmp(set->transport, "http-post") != 0) {
+			*error_r = "transport_compression can be used only "
+				"with http-post transport";
+			return FALSE;
+		}
+		if (strcmp(set->transport_compression, "gz") != 0 &&
+		    strcmp(set->transport_compression, "zstd") != 0) {
+			*error_r = t_strdup_printf(
+				"Unsupported transport_compression '%s'",
+				set->transport_compression);
+			return FALSE;
+		}
+	}
+
 	if (!parse_format_args(set, error_r))
 		return FALSE;
 
@@ -65,6 +65,10 @@ struct stats_exporter_settings {
 	const char *transport;
 	const char *transport_args;
 	unsigned int transport_timeout;
+	unsigned int transport_batch_size;
+	unsigned int transport_batch_interval;
+	unsigned int transport_max_pending;
+	const char *transport_compression;
 	const char *format;
 	const char *format_args;
 
@@ -114,6 +118,7 @@ struct stats_metric_settings {
 	const char *fields;
 	const char *group_by;
 	const char *filter;
+	bool duration_histogram;
 
 	ARRAY(struct stats_metric_settings_group_by) parsed_group_by;
 	struct event_filter *parsed_filter;
@@ -0,0 +1,122 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "stats-common.h"
+#include "ioloop.h"
+#include "net.h"
+#include "str.h"
+#include "ostream.h"
+#include "connection.h"
+#include "master-service.h"
+#include "master-service-settings.h"
+#include "stats-metrics.h"
+#include "stats-shard.h"
+
+#define STATS_SHARD_UPSTREAM_SOCKET_NAME "stats-writer"
+#define STATS_SHARD_FLUSH_INTERVAL_MSECS 1000
+/* Don't send more state while this much is still waiting to be read by the
+   main stats process. The state keeps accumulating in the shard
+   meanwhile. */
+#define STATS_SHARD_MAX_OUTPUT_BUFFER_SIZE (1024*1024)
+
+static struct connection_list *shard_connections;
+static struct connection *shard_conn;
+static struct timeout *to_shard_flush;
+
+static void stats_shard_connect(void)
+{
+	if (connection_client_connect(shard_conn) < 0) {
+		e_error(shard_conn->event, "net_connect_unix(%s) failed: %m",
+			shard_conn->name);
+	}
+}
+
+static void stats_shard_send_state(void)
+{
+	string_t *str = t_str_new(1024);
+
+	stats_metrics_export_state(stats_metrics, str);
+	/* the state was moved to the main stats process */
+	stats_metrics_reset(stats_metrics);
+	if (str_len(str) > 0)
+		o_stream_nsend(shard_conn->output, str_data(str), str_len(str));
+}
+
+static void stats_shard_flush(void *context ATTR_UNUSED)
+{
+	if (shard_conn->disconnected) {
+		stats_shard_connect();
+		if (shard_conn->disconnected)
+			return;
+	}
+	if (o_stream_get_buffer_used_size(shard_conn->output) >=
+	    STATS_SHARD_MAX_OUTPUT_BUFFER_SIZE)
+		return;
+	T_BEGIN {
+		stats_shard_send_state();
+	} T_END;
+}
+
+static void stats_shard_destroy(struct connection *conn)
+{
+	/* reconnect in the next flush */
+	connection_disconnect(conn);
+}
+
+static int
+stats_shard_input_args(struct connection *conn ATTR_UNUSED,
+		       const char *const *args ATTR_UNUSED)
+{
+	/* the event filters sent by the main stats process aren't needed */
+	return 1;
+}
+
+static const struct connection_settings stats_shard_set = {
+	.service_name_in = "stats-server",
+	.service_name_out = "stats-client",
+	.major_version = 4,
+	.minor_version = 1,
+
+	.input_max_size = SIZE_MAX,
+	.output_max_size = SIZE_MAX,
+	.client = TRUE
+};
+
+static const struct connection_vfuncs stats_shard_vfuncs = {
+	.destroy = stats_shard_destroy,
+	.input_args = stats_shard_input_args,
+};
+
+void stats_shard_init(void)
+{
+	const struct master_service_settings *set =
+		master_service_settings_get(master_service);
+	const char *path = t_strdup_printf("%s/%s", set->base_dir,
+		STATS_SHARD_UPSTREAM_SOCKET_NAME);
+
+	shard_connections = connection_list_init(&stats_shard_set,
+						 &stats_shard_vfuncs);
+	shard_conn = i_new(struct connection, 1);
+	connection_init_client_unix(shard_connections, shard_conn, path);
+	stats_shard_connect();
+	to_shard_flush = timeout_add(STATS_SHARD_FLUSH_INTERVAL_MSECS,
+				     stats_shard_flush, NULL);
+}
+
+void stats_shard_deinit(void)
+{
+	timeout_remove(&to_shard_flush);
+	if (!shard_conn->disconnected) {
+		/* send the final state */
+		T_BEGIN {
+			stats_shard_send_state();
+		} T_END;
+		net_set_nonblock(shard_conn->fd_out, FALSE);
+		if (o_stream_flush(shard_conn->output) < 0) {
+			e_error(shard_conn->event, "write() failed: %s",
+				o_stream_get_error(shard_conn->output));
+		}
+	}
+	connection_deinit(shard_conn);
+	i_free(shard_conn);
+	connection_list_deinit(&shard_connections);
+}
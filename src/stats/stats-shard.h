@@ -0,0 +1,11 @@
+#ifndef STATS_SHARD_H
+#define STATS_SHARD_H
+
+/* Stats shard processes receive the stats-writer connections instead of the
+   main stats process. They update their own metrics and send the
+   accumulated metric state to the main stats process periodically, which
+   merges it into its metrics. */
+void stats_shard_init(void);
+void stats_shard_deinit(void);
+
+#endif
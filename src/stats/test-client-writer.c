@@ -35,6 +35,23 @@ static int test_writer_server_input_args(struct connection *conn,
 	return -1;
 }
 
+static int
+test_writer_server_input_args_aggregated(struct connection *conn,
+					 const char *const *args)
+{
+	/* the metric is aggregated by the client */
+	test_assert_strcmp(args[0], "FILTER");
+	test_assert_strcmp(args[1], "");
+	test_assert_strcmp(args[2], "test");
+	test_assert_strcmp(args[3], "(event=\"test\")");
+	test_assert_strcmp(args[4], "");
+	test_assert(args[5] == NULL);
+
+	o_stream_nsend_str(conn->output, "METRIC\ttest\t1\t100\t200\n");
+	/* disconnect immediately */
+	return -1;
+}
+
 static struct connection_settings client_set = {
 	.service_name_in = "stats-server",
 	.service_name_out = "stats-client",
@@ -51,6 +68,22 @@ static const struct connection_vfuncs client_vfuncs = {
 	.destroy = test_writer_server_destroy,
 };
 
+static struct connection_settings client_set_aggregated = {
+	.service_name_in = "stats-server",
+	.service_name_out = "stats-client",
+	.major_version = 4,
+	.minor_version = 1,
+
+	.input_max_size = SIZE_MAX,
+	.output_max_size = SIZE_MAX,
+	.client = TRUE,
+};
+
+static const struct connection_vfuncs client_vfuncs_aggregated = {
+	.input_args = test_writer_server_input_args_aggregated,
+	.destroy = test_writer_server_destroy,
+};
+
 static void test_write_one(struct event *event ATTR_UNUSED)
 {
 	int fds[2];
@@ -132,6 +165,46 @@ static void test_client_writer(void)
 	test_end();
 }
 
+static void test_client_writer_aggregated(void)
+{
+	int fds[2];
+
+	test_begin("client writer aggregated metrics");
+
+	test_init(settings_blob_1);
+	/* no events are sent by this test */
+	recurse_back = TRUE;
+	client_writers_init();
+	conn_list = connection_list_init(&client_set_aggregated,
+					 &client_vfuncs_aggregated);
+
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	struct connection *conn = i_new(struct connection, 1);
+	struct ioloop *loop = io_loop_create();
+
+	client_writer_create(fds[1]);
+	connection_init_client_fd(conn_list, conn, "stats", fds[0], fds[0]);
+	io_loop_run(loop);
+	connection_deinit(conn);
+	i_free(conn);
+
+	/* client-writer needs two loops to deinit */
+	io_loop_set_running(loop);
+	io_loop_handler_run(loop);
+	io_loop_set_running(loop);
+	io_loop_handler_run(loop);
+	io_loop_destroy(&loop);
+
+	test_assert(get_stats_dist_field("test", STATS_DIST_COUNT) == 2);
+	test_assert(get_stats_dist_field("test", STATS_DIST_SUM) == 300);
+	recurse_back = FALSE;
+
+	test_deinit();
+	client_writers_deinit();
+	connection_list_deinit(&conn_list);
+	test_end();
+}
+
 int main(void) {
 	/* fake master service to pretend destroying
 	   connections. */
@@ -142,6 +215,7 @@ int main(void) {
 	};
 	void (*const test_functions[])(void) = {
 		test_client_writer,
+		test_client_writer_aggregated,
 		NULL
 	};
 
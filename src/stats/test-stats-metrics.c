@@ -1,7 +1,10 @@
 /* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
 
 #include "test-stats-common.h"
+#include "ioloop.h"
 #include "array.h"
+#include "strescape.h"
+#include "event-exporter.h"
 
 bool test_stats_callback(struct event *event,
 			 enum event_callback_type type ATTR_UNUSED,
@@ -443,12 +446,165 @@ static void test_stats_metrics_group_by_quantized(void)
 		test_stats_metrics_group_by_quantized_real(&quantized_tests[i]);
 }
 
+static const char *const settings_blob_merge[] = {
+	"metric=test",
+	"metric/test/metric_name=test",
+	"metric/test/filter=event=test",
+	"metric/test/fields=num",
+	"metric/test/group_by=test_name num",
+	NULL
+};
+
+static void test_stats_metrics_merge_lines(const char *lines)
+{
+	const char *const *line, *const *args, *error;
+
+	for (line = t_strsplit(lines, "\n"); *line != NULL; line++) {
+		if (**line == '\0')
+			continue;
+		args = t_strsplit_tabescaped(*line);
+		test_assert_strcmp(args[0], "MERGE");
+		test_assert(stats_metrics_merge_state(stats_metrics, args + 1,
+						      &error));
+	}
+}
+
+static void test_stats_metrics_merge_state(void)
+{
+	static const struct {
+		const char *name;
+		intmax_t num;
+	} events[] = {
+		{ "a", 1 }, { "a", 2 }, { "b", 1 },
+	};
+	const char *error;
+	unsigned int i;
+
+	test_begin("stats metrics (merge state)");
+	test_init(settings_blob_merge);
+
+	for (i = 0; i < N_ELEMENTS(events); i++) {
+		struct event *event = event_create(NULL);
+		event_add_category(event, &test_category);
+		event_set_name(event, "test");
+		event_add_str(event, "test_name", events[i].name);
+		event_add_int(event, "num", events[i].num);
+		test_event_send(event);
+		event_unref(&event);
+	}
+
+	/* test, test/a, test/a/1, test/a/2, test/b, test/b/1 */
+	string_t *state = t_str_new(1024);
+	stats_metrics_export_state(stats_metrics, state);
+	test_assert(strstr(str_c(state), "\ta\t") != NULL);
+	test_assert(strstr(str_c(state), "\tb\t") != NULL);
+
+	/* merging the state to empty metrics gives the same state */
+	stats_metrics_reset(stats_metrics);
+	string_t *state2 = t_str_new(1024);
+	stats_metrics_export_state(stats_metrics, state2);
+	test_assert_strcmp(str_c(state2), "");
+	test_stats_metrics_merge_lines(str_c(state));
+	stats_metrics_export_state(stats_metrics, state2);
+	test_assert_strcmp(str_c(state2), str_c(state));
+
+	/* merging again doubles the counts */
+	test_stats_metrics_merge_lines(str_c(state));
+	struct stats_metrics_iter *iter =
+		stats_metrics_iterate_init(stats_metrics);
+	const struct metric *metric = stats_metrics_iterate(iter);
+	stats_metrics_iterate_deinit(&iter);
+	test_assert(stats_dist_get_count(metric->duration_stats) == 6);
+	test_assert(stats_dist_get_sum(metric->fields[0].stats) == 8);
+	test_assert(array_count(&metric->sub_metrics) == 2);
+
+	/* unknown metrics and changed fields are ignored */
+	const char *const unknown_args[] = {
+		"unknown", "0", "1 5 5 5 1 5 4 1 1", "0", NULL
+	};
+	test_assert(stats_metrics_merge_state(stats_metrics, unknown_args,
+					      &error));
+	const char *const changed_args[] = {
+		"test", "0", "1 5 5 5 1 5 4 1 1", "0", NULL
+	};
+	test_assert(stats_metrics_merge_state(stats_metrics, changed_args,
+					      &error));
+	test_assert(stats_dist_get_count(metric->duration_stats) == 6);
+
+	/* invalid input */
+	const char *const invalid_args[][9] = {
+		{ "test", NULL },
+		{ "test", "1", "0", NULL },
+		{ "test", "0", "1 5 5 5", "1", "0 0 0 0 0 0 0", NULL },
+		{ "test", "1", "x", "y", "z", "1 5 5 5 1 5 4 1 1",
+		  "1", "1 5 5 5 1 5 4 1 1" },
+	};
+	for (i = 0; i < N_ELEMENTS(invalid_args); i++) {
+		test_assert_idx(!stats_metrics_merge_state(stats_metrics,
+				invalid_args[i], &error), i);
+	}
+	test_assert(stats_dist_get_count(metric->duration_stats) == 6);
+
+	test_deinit();
+	test_end();
+}
+
+static const char *const settings_blob_batch[] = {
+	"event_exporter=batch",
+	"event_exporter/batch/name=batch",
+	"event_exporter/batch/format=json",
+	"event_exporter/batch/format_args=time-unix",
+	"event_exporter/batch/transport=drop",
+	"event_exporter/batch/transport_batch_size=3",
+	"metric=test",
+	"metric/test/metric_name=test",
+	"metric/test/filter=event=test",
+	"metric/test/exporter=batch",
+	NULL
+};
+
+static void test_stats_metrics_export_batch(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+	struct exporter *const *exporters;
+	unsigned int i, count;
+
+	test_begin("stats metrics (export batch)");
+	test_init(settings_blob_batch);
+
+	exporters = stats_metrics_get_exporters(stats_metrics, &count);
+	test_assert(count == 1);
+	test_assert(exporters[0]->batch_size == 3);
+
+	for (i = 0; i < 4; i++) {
+		struct event *event = event_create(NULL);
+		event_add_category(event, &test_category);
+		event_set_name(event, "test");
+		test_event_send(event);
+		event_unref(&event);
+	}
+	/* the first 3 events were sent, the 4th is waiting for more */
+	test_assert(exporters[0]->batch_count == 1);
+	test_assert(exporters[0]->to_batch != NULL);
+
+	event_export_transport_flush(exporters[0]);
+	test_assert(exporters[0]->batch_count == 0);
+	test_assert(exporters[0]->to_batch == NULL);
+	test_assert(exporters[0]->dropped_events == 0);
+
+	test_deinit();
+	test_end();
+	io_loop_destroy(&ioloop);
+}
+
 int main(void) {
 	void (*const test_functions[])(void) = {
 		test_stats_metrics,
 		test_stats_metrics_filter,
 		test_stats_metrics_group_by_discrete,
 		test_stats_metrics_group_by_quantized,
+		test_stats_metrics_merge_state,
+		test_stats_metrics_export_batch,
 		NULL
 	};
 
@@ -25,6 +25,7 @@
 #include "smtp-server.h"
 #include "smtp-client.h"
 
+#include "submission-backend-relay.h"
 #include "submission-commands.h"
 
 #include <stdio.h>
@@ -460,6 +461,7 @@ int main(int argc, char *argv[])
 		master_service_run(master_service, client_connected);
 	clients_destroy_all();
 
+	submission_backend_relay_pool_deinit();
 	smtp_client_deinit(&smtp_client);
 	smtp_server_deinit(&smtp_server);
 
@@ -1,6 +1,8 @@
 /* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
 
 #include "submission-common.h"
+#include "array.h"
+#include "ioloop.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "mail-user.h"
@@ -19,12 +21,30 @@ struct submission_backend_relay {
 	struct smtp_client_connection *conn;
 	struct smtp_client_transaction *trans;
 
+	/* Key for sharing the connection with the other sessions of this
+	   process, or NULL if the connection can't be shared. */
+	const char *pool_key;
+	unsigned int idle_timeout_secs;
+	unsigned int max_transactions;
+	unsigned int transactions_count;
+
 	bool trans_started:1;
 	bool trusted:1;
 	bool quit_confirmed:1;
 };
 
+/* Idle relay connection waiting to be reused by the next session of this
+   process. */
+struct submission_backend_relay_idle_connection {
+	char *key;
+	struct smtp_client_connection *conn;
+	unsigned int transactions_count;
+	struct timeout *to_idle;
+};
+
 static struct submission_backend_vfuncs backend_relay_vfuncs;
+static ARRAY(struct submission_backend_relay_idle_connection *)
+	backend_relay_idle_conns = ARRAY_INIT;
 
 /*
  * Common
@@ -183,6 +203,7 @@ backend_relay_trans_start(struct submission_backend *backend,
 
 	if (rbackend->trans == NULL) {
 		rbackend->trans_started = TRUE;
+		rbackend->transactions_count++;
 		rbackend->trans = smtp_client_transaction_create(
 			rbackend->conn, path, params, 0,
 			backend_relay_trans_finished, rbackend);
@@ -220,6 +241,7 @@ submission_backend_relay_init_transaction(
 {
 	i_assert(rbackend->trans == NULL);
 
+	rbackend->transactions_count++;
 	rbackend->trans = smtp_client_transaction_create_empty(
 		rbackend->conn, flags,
 		backend_relay_trans_finished, rbackend);
@@ -478,6 +500,7 @@ backend_relay_cmd_mail(struct submission_backend *backend,
 	if (rbackend->trans == NULL) {
 		/* start client transaction */
 		rbackend->trans_started = TRUE;
+		rbackend->transactions_count++;
 		rbackend->trans = smtp_client_transaction_create(
 			rbackend->conn, data->path, &data->params, 0,
 			backend_relay_trans_finished, rbackend);
@@ -1018,6 +1041,13 @@ static void relay_cmd_quit_relay(struct relay_cmd_quit_context *quit_cmd)
 		smtp_server_reply_quit(cmd);
 		return;
 	}
+	if (rbackend->pool_key != NULL) {
+		/* The relay connection may still be reused by another
+		   session, so it's not closed here. */
+		quit_cmd->backend->quit_confirmed = TRUE;
+		smtp_server_reply_quit(cmd);
+		return;
+	}
 
 	/* RFC 5321, Section 4.1.1.10:
 
@@ -1068,6 +1098,141 @@ backend_relay_cmd_quit(struct submission_backend *backend,
 	return 0;
 }
 
+/*
+ * Connection pool
+ */
+
+static const char *
+backend_relay_get_pool_key(const struct submision_backend_relay_settings *set)
+{
+	string_t *key = t_str_new(128);
+
+	str_printfa(key, "%d\t%s\t%s\t%s\t%u\t%d\t%d\t",
+		    set->protocol, set->my_hostname,
+		    set->path != NULL ? set->path : "",
+		    set->host != NULL ? set->host : "", set->port,
+		    set->ssl_mode, set->ssl_verify ? 1 : 0);
+	if (set->ip.family != 0)
+		str_append(key, net_ip2addr(&set->ip));
+	str_printfa(key, "\t%s\t%s\t%s\t%p\t%u\t%u",
+		    set->user != NULL ? set->user : "",
+		    set->master_user != NULL ? set->master_user : "",
+		    set->password != NULL ? set->password : "",
+		    (const void *)set->sasl_mech,
+		    set->connect_timeout_msecs, set->command_timeout_msecs);
+	if (set->extra_capabilities != NULL) {
+		str_append_c(key, '\t');
+		str_append(key, t_strarray_join(set->extra_capabilities, " "));
+	}
+	return str_c(key);
+}
+
+static void
+backend_relay_idle_connection_free(
+	struct submission_backend_relay_idle_connection *iconn)
+{
+	timeout_remove(&iconn->to_idle);
+	if (iconn->conn != NULL)
+		smtp_client_connection_close(&iconn->conn);
+	i_free(iconn->key);
+	i_free(iconn);
+}
+
+static void
+backend_relay_idle_connection_timeout(
+	struct submission_backend_relay_idle_connection *iconn)
+{
+	struct submission_backend_relay_idle_connection *const *iconns;
+	unsigned int i, count;
+
+	iconns = array_get(&backend_relay_idle_conns, &count);
+	for (i = 0; i < count; i++) {
+		if (iconns[i] == iconn)
+			break;
+	}
+	i_assert(i < count);
+	array_delete(&backend_relay_idle_conns, i, 1);
+	backend_relay_idle_connection_free(iconn);
+}
+
+static bool
+backend_relay_connection_can_reuse(struct submission_backend_relay *rbackend)
+{
+	if (rbackend->pool_key == NULL || rbackend->conn == NULL ||
+	    rbackend->trans != NULL)
+		return FALSE;
+	if (rbackend->max_transactions > 0 &&
+	    rbackend->transactions_count >= rbackend->max_transactions)
+		return FALSE;
+	return smtp_client_connection_get_state(rbackend->conn) ==
+		SMTP_CLIENT_CONNECTION_STATE_READY;
+}
+
+static void
+backend_relay_connection_set_idle(struct submission_backend_relay *rbackend)
+{
+	struct submission_backend_relay_idle_connection *iconn;
+
+	if (!array_is_created(&backend_relay_idle_conns))
+		i_array_init(&backend_relay_idle_conns, 4);
+
+	iconn = i_new(struct submission_backend_relay_idle_connection, 1);
+	iconn->key = i_strdup(rbackend->pool_key);
+	iconn->conn = rbackend->conn;
+	rbackend->conn = NULL;
+	iconn->transactions_count = rbackend->transactions_count;
+	iconn->to_idle = timeout_add(rbackend->idle_timeout_secs * 1000,
+				     backend_relay_idle_connection_timeout,
+				     iconn);
+	array_push_back(&backend_relay_idle_conns, &iconn);
+}
+
+static bool
+backend_relay_connection_reuse_idle(struct submission_backend_relay *rbackend)
+{
+	struct submission_backend_relay_idle_connection *const *iconns, *iconn;
+	unsigned int i, count;
+
+	if (!array_is_created(&backend_relay_idle_conns))
+		return FALSE;
+
+	iconns = array_get(&backend_relay_idle_conns, &count);
+	for (i = count; i > 0; i--) {
+		/* prefer the most recently used connection */
+		if (strcmp(iconns[i-1]->key, rbackend->pool_key) == 0)
+			break;
+	}
+	if (i == 0)
+		return FALSE;
+
+	iconn = iconns[i-1];
+	array_delete(&backend_relay_idle_conns, i-1, 1);
+	if (smtp_client_connection_get_state(iconn->conn) !=
+	    SMTP_CLIENT_CONNECTION_STATE_READY) {
+		/* disconnected while idling */
+		backend_relay_idle_connection_free(iconn);
+		return FALSE;
+	}
+
+	rbackend->conn = iconn->conn;
+	iconn->conn = NULL;
+	rbackend->transactions_count = iconn->transactions_count;
+	backend_relay_idle_connection_free(iconn);
+	return TRUE;
+}
+
+void submission_backend_relay_pool_deinit(void)
+{
+	struct submission_backend_relay_idle_connection *iconn;
+
+	if (!array_is_created(&backend_relay_idle_conns))
+		return;
+
+	array_foreach_elem(&backend_relay_idle_conns, iconn)
+		backend_relay_idle_connection_free(iconn);
+	array_free(&backend_relay_idle_conns);
+}
+
 /*
  * Relay backend
  */
@@ -1102,7 +1267,23 @@ submission_backend_relay_create(
 	smtp_set.extra_capabilities = set->extra_capabilities;
 	smtp_set.ssl = &ssl_set;
 	smtp_set.debug = user->mail_debug;
-	smtp_set.event_parent = rbackend->backend.event;
+
+	/* The connection can be shared with the other sessions of this
+	   process only when it carries nothing specific to this session. */
+	if (set->connection_idle_timeout_secs > 0 &&
+	    set->rawlog_dir == NULL && !set->trusted) {
+		rbackend->pool_key =
+			p_strdup(pool, backend_relay_get_pool_key(set));
+		rbackend->idle_timeout_secs = set->connection_idle_timeout_secs;
+		rbackend->max_transactions = set->connection_max_transactions;
+		if (backend_relay_connection_reuse_idle(rbackend)) {
+			e_debug(rbackend->backend.event,
+				"Reusing idle relay connection");
+			return rbackend;
+		}
+	} else {
+		smtp_set.event_parent = rbackend->backend.event;
+	}
 
 	if (set->rawlog_dir != NULL) {
 		smtp_set.rawlog_dir =
@@ -1176,6 +1357,8 @@ static void backend_relay_destroy(struct submission_backend *backend)
 
 	if (rbackend->trans != NULL)
 		smtp_client_transaction_destroy(&rbackend->trans);
+	if (backend_relay_connection_can_reuse(rbackend))
+		backend_relay_connection_set_idle(rbackend);
 	if (rbackend->conn != NULL)
 		smtp_client_connection_close(&rbackend->conn);
 }
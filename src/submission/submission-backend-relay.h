@@ -28,6 +28,11 @@ struct submision_backend_relay_settings {
 	const char *rawlog_dir;
 	unsigned int max_idle_time;
 
+	/* Keep the connection open for reuse by the following sessions of
+	   this process for this many seconds. 0 disables reuse. */
+	unsigned int connection_idle_timeout_secs;
+	unsigned int connection_max_transactions;
+
 	unsigned int connect_timeout_msecs;
 	unsigned int command_timeout_msecs;
 
@@ -61,4 +66,7 @@ submission_backend_relay_init_transaction(
 	struct submission_backend_relay *backend,
 	enum smtp_client_transaction_flags flags);
 
+/* Closes all the idle relay connections kept for reuse. */
+void submission_backend_relay_pool_deinit(void);
+
 #endif
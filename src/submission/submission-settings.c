@@ -101,6 +101,8 @@ static const struct setting_define submission_setting_defines[] = {
 
 	DEF(STR_VARS, submission_relay_rawlog_dir),
 	DEF(TIME, submission_relay_max_idle_time),
+	DEF(TIME, submission_relay_connection_idle_timeout),
+	DEF(UINT, submission_relay_connection_max_transactions),
 
 	DEF(TIME_MSECS, submission_relay_connect_timeout),
 	DEF(TIME_MSECS, submission_relay_command_timeout),
@@ -143,6 +145,8 @@ static const struct submission_settings submission_default_settings = {
 
 	.submission_relay_rawlog_dir = "",
 	.submission_relay_max_idle_time = 60*29,
+	.submission_relay_connection_idle_timeout = 0,
+	.submission_relay_connection_max_transactions = 100,
 
 	.submission_relay_connect_timeout = 30*1000,
 	.submission_relay_command_timeout = 60*5*1000,
@@ -45,6 +45,8 @@ struct submission_settings {
 
 	const char *submission_relay_rawlog_dir;
 	unsigned int submission_relay_max_idle_time;
+	unsigned int submission_relay_connection_idle_timeout;
+	unsigned int submission_relay_connection_max_transactions;
 
 	unsigned int submission_relay_connect_timeout;
 	unsigned int submission_relay_command_timeout;
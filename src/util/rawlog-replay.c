@@ -0,0 +1,802 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "hash.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "net.h"
+#include "str.h"
+#include "strnum.h"
+#include "strescape.h"
+#include "read-full.h"
+#include "time-util.h"
+#include "stats-dist.h"
+#include "llist.h"
+#include "master-service.h"
+
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define DEFAULT_MAX_PARALLEL_SESSIONS 10
+#define REPLAY_MAX_INPUT_LINE_LEN (1024*64)
+#define REPLAY_LOGIN_TAG "replay-login"
+
+/* Replays IMAP sessions recorded with rawlog (*.in files) against a server
+   and reports the latency of each command name. The rawlogs are expected to
+   be written after login (e.g. by the imap process), so the session is
+   logged in with the given username and password first. */
+
+struct replay_chunk {
+	/* Time when the chunk was originally sent, or 0 if unknown */
+	struct timeval time;
+	/* Non-NULL if this chunk starts a new command */
+	const char *tag, *cmd_name;
+	const unsigned char *data;
+	size_t size;
+	/* Wait for a "+" continuation from server before sending the next
+	   chunk (synchronizing literal, IDLE) */
+	bool wait_continuation;
+};
+ARRAY_DEFINE_TYPE(replay_chunk, struct replay_chunk);
+
+struct replay_time_mark {
+	size_t offset;
+	struct timeval time;
+};
+
+struct replay_log {
+	const char *path;
+	ARRAY_TYPE(replay_chunk) chunks;
+	struct timeval first_time;
+};
+
+struct replay_pending_cmd {
+	const char *cmd_name;
+	struct timeval send_time;
+};
+
+struct replay_cmd_stats {
+	const char *cmd_name;
+	unsigned int failures;
+	struct stats_dist *usecs;
+};
+
+struct replay_session {
+	struct replay_session *prev, *next;
+	struct replay_ctx *ctx;
+	const struct replay_log *log;
+	unsigned int session_idx;
+
+	int fd;
+	struct io *io;
+	struct istream *input;
+	struct ostream *output;
+	struct timeout *to;
+
+	/* time when the first chunk was sent */
+	struct timeval start_time;
+	unsigned int next_chunk;
+	uoff_t literal_left;
+	HASH_TABLE(char *, struct replay_pending_cmd *) pending_cmds;
+
+	bool greeting_received:1;
+	bool logged_in:1;
+	bool waiting_continuation:1;
+};
+
+struct replay_ctx {
+	pool_t pool;
+	const char *host;
+	in_port_t port;
+	struct ip_addr ip;
+	const char *username, *password;
+	unsigned int max_parallel_sessions;
+	/* 0 = max speed */
+	double speed;
+
+	ARRAY(struct replay_log *) logs;
+	unsigned int next_log;
+	struct replay_session *sessions;
+	unsigned int sessions_count;
+	unsigned int sessions_failed;
+
+	HASH_TABLE(const char *, struct replay_cmd_stats *) cmd_stats;
+};
+
+static void replay_session_send_more(struct replay_session *session);
+static void replay_sessions_start_more(struct replay_ctx *ctx);
+
+static bool
+replay_parse_timestamp(const unsigned char **data, const unsigned char *end,
+		       struct timeval *tv_r)
+{
+	/* "<secs>.<usecs> " */
+	const unsigned char *p = *data;
+	uintmax_t secs = 0, usecs = 0;
+	unsigned int usec_digits = 0;
+
+	if (p == end || !i_isdigit(*p))
+		return FALSE;
+	for (; p < end && i_isdigit(*p); p++)
+		secs = secs * 10 + (*p - '0');
+	if (p == end || *p != '.')
+		return FALSE;
+	for (p++; p < end && i_isdigit(*p); p++, usec_digits++)
+		usecs = usecs * 10 + (*p - '0');
+	if (p == end || *p != ' ' || usec_digits != 6)
+		return FALSE;
+	tv_r->tv_sec = secs;
+	tv_r->tv_usec = usecs;
+	*data = p + 1;
+	return TRUE;
+}
+
+static bool
+replay_line_get_literal(const unsigned char *line, size_t size,
+			uoff_t *literal_size_r, bool *sync_r)
+{
+	/* line ends with "{<size>}\r\n" or "{<size>+}\r\n" */
+	const unsigned char *p, *end = line + size;
+	uoff_t num = 0, mul = 1;
+
+	if (size > 0 && end[-1] == '\n')
+		end--;
+	if (end > line && end[-1] == '\r')
+		end--;
+	if (end == line || end[-1] != '}')
+		return FALSE;
+	p = end - 1;
+	*sync_r = TRUE;
+	if (p > line && p[-1] == '+') {
+		*sync_r = FALSE;
+		p--;
+	}
+	if (p == line || !i_isdigit(p[-1]))
+		return FALSE;
+	for (; p > line && i_isdigit(p[-1]); p--) {
+		num += (p[-1] - '0') * mul;
+		mul *= 10;
+	}
+	if (p == line || p[-1] != '{')
+		return FALSE;
+	*literal_size_r = num;
+	return TRUE;
+}
+
+static void
+replay_chunk_parse_command(pool_t pool, struct replay_chunk *chunk)
+{
+	const char *line, *const *args;
+
+	line = t_strcut(t_strndup(chunk->data, chunk->size), '\r');
+	line = t_strcut(line, '\n');
+	args = t_strsplit(line, " ");
+	if (args[0] == NULL || args[1] == NULL || args[0][0] == '\0')
+		return;
+
+	chunk->tag = p_strdup(pool, args[0]);
+	if (strcasecmp(args[1], "UID") == 0 && args[2] != NULL)
+		chunk->cmd_name = p_strdup_printf(pool, "UID %s", t_str_ucase(args[2]));
+	else
+		chunk->cmd_name = p_strdup(pool, t_str_ucase(args[1]));
+	if (strcmp(chunk->cmd_name, "IDLE") == 0)
+		chunk->wait_continuation = TRUE;
+}
+
+static bool replay_chunk_is_skipped(const struct replay_chunk *chunk)
+{
+	if (chunk->cmd_name == NULL)
+		return FALSE;
+	/* the session is already logged in, and the replay can't handle
+	   compressed or TLS streams */
+	return strcmp(chunk->cmd_name, "LOGIN") == 0 ||
+		strcmp(chunk->cmd_name, "AUTHENTICATE") == 0 ||
+		strcmp(chunk->cmd_name, "COMPRESS") == 0 ||
+		strcmp(chunk->cmd_name, "STARTTLS") == 0;
+}
+
+static int
+replay_log_read(struct replay_ctx *ctx, const char *path,
+		struct replay_log **log_r)
+{
+	struct replay_log *log;
+	struct stat st;
+	unsigned char *data;
+	const unsigned char *p, *end, *line_end;
+	struct replay_chunk chunk;
+	buffer_t *stripped;
+	ARRAY(struct replay_time_mark) marks;
+	const struct replay_time_mark *mark;
+	struct replay_time_mark new_mark;
+	unsigned int mark_idx = 0;
+	uoff_t literal_left = 0, literal_size;
+	unsigned int marks_count;
+	size_t pos, line_size;
+	bool sync, cmd_start = TRUE, skip_cmd = FALSE;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		i_error("fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	data = p_malloc(ctx->pool, st.st_size + 1);
+	ret = read_full(fd, data, st.st_size);
+	if (ret <= 0) {
+		if (ret == 0)
+			i_error("read(%s) failed: Unexpected EOF", path);
+		else
+			i_error("read(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	i_close_fd(&fd);
+
+	/* Strip away the timestamps from the beginning of the lines, but
+	   remember the stripped offset where each timestamped line begins. */
+	stripped = buffer_create_dynamic(ctx->pool, st.st_size);
+	t_array_init(&marks, 128);
+	end = data + st.st_size;
+	for (p = data; p < end; p = line_end) {
+		line_end = memchr(p, '\n', end - p);
+		line_end = line_end == NULL ? end : line_end + 1;
+		new_mark.offset = stripped->used;
+		if (replay_parse_timestamp(&p, line_end, &new_mark.time))
+			array_push_back(&marks, &new_mark);
+		buffer_append(stripped, p, line_end - p);
+	}
+	mark = array_get(&marks, &marks_count);
+
+	log = p_new(ctx->pool, struct replay_log, 1);
+	log->path = p_strdup(ctx->pool, path);
+	p_array_init(&log->chunks, ctx->pool, 128);
+
+	/* Split the stream into chunks that can be sent without waiting for
+	   the server. */
+	end = CONST_PTR_OFFSET(stripped->data, stripped->used);
+	pos = 0;
+	while (pos < stripped->used) {
+		p = CONST_PTR_OFFSET(stripped->data, pos);
+		i_zero(&chunk);
+		while (mark_idx + 1 < marks_count &&
+		       mark[mark_idx + 1].offset <= pos)
+			mark_idx++;
+		if (mark_idx < marks_count && mark[mark_idx].offset <= pos)
+			chunk.time = mark[mark_idx].time;
+		chunk.data = p;
+
+		if (literal_left > 0) {
+			/* literal data, followed by the rest of the line */
+			if (literal_left >= (uoff_t)(end - p)) {
+				literal_left = end - p;
+				line_end = end;
+			} else {
+				line_end = memchr(p + literal_left, '\n',
+						  end - (p + literal_left));
+				line_end = line_end == NULL ? end : line_end + 1;
+			}
+			line_size = line_end - p;
+			literal_left = 0;
+			if (replay_line_get_literal(p, line_size,
+						    &literal_size, &sync)) {
+				literal_left = literal_size;
+				chunk.wait_continuation = sync;
+			}
+		} else {
+			line_end = memchr(p, '\n', end - p);
+			line_end = line_end == NULL ? end : line_end + 1;
+			line_size = line_end - p;
+			if (cmd_start) {
+				chunk.size = line_size;
+				replay_chunk_parse_command(ctx->pool, &chunk);
+				skip_cmd = replay_chunk_is_skipped(&chunk);
+			}
+			if (replay_line_get_literal(p, line_size,
+						    &literal_size, &sync)) {
+				literal_left = literal_size;
+				chunk.wait_continuation = sync;
+			}
+		}
+		chunk.size = line_size;
+		cmd_start = literal_left == 0;
+		pos += line_size;
+
+		if (skip_cmd)
+			continue;
+		if (log->first_time.tv_sec == 0 && chunk.time.tv_sec != 0)
+			log->first_time = chunk.time;
+		array_push_back(&log->chunks, &chunk);
+	}
+	*log_r = log;
+	return 0;
+}
+
+static int replay_add_path(struct replay_ctx *ctx, const char *path)
+{
+	struct replay_log *log;
+	struct stat st;
+	DIR *dir;
+	struct dirent *d;
+	int ret = 0;
+
+	if (stat(path, &st) < 0) {
+		i_error("stat(%s) failed: %m", path);
+		return -1;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		if (replay_log_read(ctx, path, &log) < 0)
+			return -1;
+		array_push_back(&ctx->logs, &log);
+		return 0;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		i_error("opendir(%s) failed: %m", path);
+		return -1;
+	}
+	while ((d = readdir(dir)) != NULL) {
+		size_t len = strlen(d->d_name);
+
+		if (len < 3 || strcmp(d->d_name + len - 3, ".in") != 0)
+			continue;
+		T_BEGIN {
+			ret = replay_add_path(ctx, t_strconcat(path, "/",
+							       d->d_name, NULL));
+		} T_END;
+		if (ret < 0)
+			break;
+	}
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", path);
+	return ret;
+}
+
+static void
+replay_cmd_finished(struct replay_ctx *ctx, const char *cmd_name,
+		    uint64_t usecs, bool success)
+{
+	struct replay_cmd_stats *stats;
+
+	stats = hash_table_lookup(ctx->cmd_stats, cmd_name);
+	if (stats == NULL) {
+		stats = p_new(ctx->pool, struct replay_cmd_stats, 1);
+		stats->cmd_name = p_strdup(ctx->pool, cmd_name);
+		stats->usecs = stats_dist_init();
+		hash_table_insert(ctx->cmd_stats, stats->cmd_name, stats);
+	}
+	stats_dist_add(stats->usecs, usecs);
+	if (!success)
+		stats->failures++;
+}
+
+static void replay_session_destroy(struct replay_session *session, bool failed)
+{
+	struct replay_ctx *ctx = session->ctx;
+	struct hash_iterate_context *iter;
+	struct replay_pending_cmd *cmd;
+	char *tag;
+
+	if (failed)
+		ctx->sessions_failed++;
+
+	iter = hash_table_iterate_init(session->pending_cmds);
+	while (hash_table_iterate(iter, session->pending_cmds, &tag, &cmd)) {
+		i_free(tag);
+		i_free(cmd);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&session->pending_cmds);
+
+	timeout_remove(&session->to);
+	io_remove(&session->io);
+	i_stream_destroy(&session->input);
+	o_stream_destroy(&session->output);
+	i_close_fd(&session->fd);
+
+	DLLIST_REMOVE(&ctx->sessions, session);
+	ctx->sessions_count--;
+	i_free(session);
+
+	replay_sessions_start_more(ctx);
+}
+
+static void
+replay_session_send_cmd(struct replay_session *session, const char *tag,
+			const char *cmd_name, const void *data, size_t size)
+{
+	struct replay_pending_cmd *cmd;
+	char *old_tag;
+
+	if (hash_table_lookup_full(session->pending_cmds, tag, &old_tag, &cmd)) {
+		/* same tag used again before the reply - track only the
+		   latest one */
+		hash_table_remove(session->pending_cmds, old_tag);
+		i_free(old_tag);
+		i_free(cmd);
+	}
+	cmd = i_new(struct replay_pending_cmd, 1);
+	cmd->cmd_name = cmd_name;
+	cmd->send_time = ioloop_timeval;
+	hash_table_insert(session->pending_cmds, i_strdup(tag), cmd);
+	o_stream_nsend(session->output, data, size);
+}
+
+static void
+replay_session_tagged_reply(struct replay_session *session, const char *line)
+{
+	struct replay_pending_cmd *cmd;
+	const char *tag, *p;
+	char *orig_tag;
+	bool success;
+
+	p = strchr(line, ' ');
+	if (p == NULL)
+		return;
+	tag = t_strdup_until(line, p);
+	if (!hash_table_lookup_full(session->pending_cmds, tag, &orig_tag, &cmd))
+		return;
+	hash_table_remove(session->pending_cmds, orig_tag);
+
+	success = str_begins_icase_with(p + 1, "OK");
+	if (strcmp(tag, REPLAY_LOGIN_TAG) == 0) {
+		if (!success)
+			i_error("%s: Login failed: %s", session->log->path, line);
+		else
+			session->logged_in = TRUE;
+	} else {
+		replay_cmd_finished(session->ctx, cmd->cmd_name,
+			timeval_diff_usecs(&ioloop_timeval, &cmd->send_time),
+			success);
+	}
+	/* a failed command doesn't send the continuation */
+	session->waiting_continuation = FALSE;
+	i_free(orig_tag);
+	i_free(cmd);
+}
+
+static const char *
+replay_get_username(const char *username, unsigned int session_idx)
+{
+	const char *p = strstr(username, "%n");
+
+	/* %n expands to the session number */
+	if (p == NULL)
+		return username;
+	return t_strdup_printf("%s%u%s", t_strdup_until(username, p),
+			       session_idx, p + 2);
+}
+
+static bool
+replay_session_input_line(struct replay_session *session, const char *line)
+{
+	uoff_t literal_size;
+	bool sync;
+
+	if (!session->greeting_received) {
+		session->greeting_received = TRUE;
+		if (!str_begins_with(line, "* OK")) {
+			i_error("%s: Unexpected greeting: %s",
+				session->log->path, line);
+			return FALSE;
+		}
+		string_t *cmd = t_str_new(128);
+		str_printfa(cmd, REPLAY_LOGIN_TAG" LOGIN \"%s\" \"%s\"\r\n",
+			    str_escape(replay_get_username(session->ctx->username,
+							  session->session_idx)),
+			    str_escape(session->ctx->password));
+		replay_session_send_cmd(session, REPLAY_LOGIN_TAG, "LOGIN",
+					str_data(cmd), str_len(cmd));
+		return TRUE;
+	}
+
+	if (replay_line_get_literal((const unsigned char *)line, strlen(line),
+				    &literal_size, &sync))
+		session->literal_left = literal_size;
+
+	if (line[0] == '+')
+		session->waiting_continuation = FALSE;
+	else if (line[0] != '*')
+		replay_session_tagged_reply(session, line);
+	return TRUE;
+}
+
+static void replay_session_input(struct replay_session *session)
+{
+	const unsigned char *data;
+	const char *line;
+	size_t size;
+	bool was_logged_in = session->logged_in;
+
+	for (;;) {
+		if (session->literal_left > 0) {
+			if (i_stream_read_more(session->input, &data, &size) <= 0)
+				break;
+			size = I_MIN(size, session->literal_left);
+			i_stream_skip(session->input, size);
+			session->literal_left -= size;
+			continue;
+		}
+		if ((line = i_stream_next_line(session->input)) == NULL) {
+			if (i_stream_read(session->input) <= 0)
+				break;
+			continue;
+		}
+		if (!replay_session_input_line(session, line)) {
+			replay_session_destroy(session, TRUE);
+			return;
+		}
+	}
+	if (session->input->eof || session->input->stream_errno != 0) {
+		bool finished = session->next_chunk ==
+			array_count(&session->log->chunks);
+		if (!finished) {
+			i_error("%s: Server disconnected: %s",
+				session->log->path,
+				i_stream_get_disconnect_reason(session->input));
+		}
+		replay_session_destroy(session, !finished);
+		return;
+	}
+	if (session->input->stream_errno == 0 &&
+	    i_stream_get_data_size(session->input) >= REPLAY_MAX_INPUT_LINE_LEN) {
+		/* skip over a too long line */
+		i_stream_skip(session->input,
+			      i_stream_get_data_size(session->input));
+	}
+
+	if (!was_logged_in && session->logged_in)
+		session->start_time = ioloop_timeval;
+	if (session->logged_in)
+		replay_session_send_more(session);
+}
+
+static void replay_session_send_more(struct replay_session *session)
+{
+	struct replay_ctx *ctx = session->ctx;
+	const struct replay_chunk *chunks;
+	unsigned int count;
+
+	timeout_remove(&session->to);
+	chunks = array_get(&session->log->chunks, &count);
+	for (; session->next_chunk < count; session->next_chunk++) {
+		const struct replay_chunk *chunk = &chunks[session->next_chunk];
+
+		if (session->waiting_continuation)
+			return;
+		if (chunk->tag != NULL && ctx->speed == 0 &&
+		    hash_table_count(session->pending_cmds) > 0) {
+			/* max speed: wait for the previous command to finish */
+			return;
+		}
+		if (ctx->speed > 0 && chunk->time.tv_sec != 0) {
+			long long diff = timeval_diff_usecs(&chunk->time,
+				&session->log->first_time) / ctx->speed;
+			struct timeval due = session->start_time;
+
+			timeval_add_usecs(&due, diff);
+			if (timeval_cmp(&due, &ioloop_timeval) > 0) {
+				session->to = timeout_add_absolute(&due,
+					replay_session_send_more, session);
+				return;
+			}
+		}
+
+		if (chunk->tag != NULL) {
+			replay_session_send_cmd(session, chunk->tag,
+						chunk->cmd_name,
+						chunk->data, chunk->size);
+		} else {
+			o_stream_nsend(session->output, chunk->data,
+				       chunk->size);
+		}
+		if (chunk->wait_continuation)
+			session->waiting_continuation = TRUE;
+	}
+	if (hash_table_count(session->pending_cmds) == 0) {
+		/* everything sent and replied */
+		replay_session_destroy(session, FALSE);
+	}
+}
+
+static void replay_session_start(struct replay_ctx *ctx,
+				 const struct replay_log *log,
+				 unsigned int session_idx)
+{
+	struct replay_session *session;
+	int fd;
+
+	if (ctx->host[0] == '/')
+		fd = net_connect_unix(ctx->host);
+	else
+		fd = net_connect_ip_blocking(&ctx->ip, ctx->port, NULL);
+	if (fd == -1) {
+		i_error("connect(%s) failed: %m", ctx->host);
+		ctx->sessions_failed++;
+		return;
+	}
+
+	session = i_new(struct replay_session, 1);
+	session->ctx = ctx;
+	session->log = log;
+	session->session_idx = session_idx;
+	session->fd = fd;
+	session->input = i_stream_create_fd(fd, REPLAY_MAX_INPUT_LINE_LEN);
+	session->output = o_stream_create_fd(fd, SIZE_MAX);
+	o_stream_set_no_error_handling(session->output, TRUE);
+	session->io = io_add(fd, IO_READ, replay_session_input, session);
+	hash_table_create(&session->pending_cmds, default_pool, 0,
+			  str_hash, strcmp);
+	DLLIST_PREPEND(&ctx->sessions, session);
+	ctx->sessions_count++;
+}
+
+static void replay_sessions_start_more(struct replay_ctx *ctx)
+{
+	struct replay_log *const *logs;
+	unsigned int count;
+
+	logs = array_get(&ctx->logs, &count);
+	while (ctx->sessions_count < ctx->max_parallel_sessions &&
+	       ctx->next_log < count) {
+		replay_session_start(ctx, logs[ctx->next_log],
+				     ctx->next_log + 1);
+		ctx->next_log++;
+	}
+	if (ctx->sessions_count == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static int
+replay_cmd_stats_cmp(struct replay_cmd_stats *const *s1,
+		     struct replay_cmd_stats *const *s2)
+{
+	return strcmp((*s1)->cmd_name, (*s2)->cmd_name);
+}
+
+static void replay_print_stats(struct replay_ctx *ctx)
+{
+	ARRAY(struct replay_cmd_stats *) sorted;
+	struct hash_iterate_context *iter;
+	struct replay_cmd_stats *stats;
+	const char *cmd_name;
+
+	t_array_init(&sorted, hash_table_count(ctx->cmd_stats));
+	iter = hash_table_iterate_init(ctx->cmd_stats);
+	while (hash_table_iterate(iter, ctx->cmd_stats, &cmd_name, &stats))
+		array_push_back(&sorted, &stats);
+	hash_table_iterate_deinit(&iter);
+	array_sort(&sorted, replay_cmd_stats_cmp);
+
+	printf("%-20s %8s %8s %10s %10s %10s %10s %10s\n", "command", "count",
+	       "failed", "avg_ms", "p50_ms", "p90_ms", "p99_ms", "max_ms");
+	array_foreach_elem(&sorted, stats) {
+		struct stats_dist *usecs = stats->usecs;
+
+		printf("%-20s %8u %8u %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+		       stats->cmd_name, stats_dist_get_count(usecs),
+		       stats->failures, stats_dist_get_avg(usecs) / 1000.0,
+		       stats_dist_get_median(usecs) / 1000.0,
+		       stats_dist_get_percentile(usecs, 0.90) / 1000.0,
+		       stats_dist_get_percentile(usecs, 0.99) / 1000.0,
+		       stats_dist_get_max(usecs) / 1000.0);
+	}
+	printf("sessions: %u, failed: %u\n", array_count(&ctx->logs),
+	       ctx->sessions_failed);
+}
+
+static void replay_deinit(struct replay_ctx *ctx)
+{
+	struct hash_iterate_context *iter;
+	struct replay_cmd_stats *stats;
+	const char *cmd_name;
+
+	while (ctx->sessions != NULL)
+		replay_session_destroy(ctx->sessions, TRUE);
+
+	iter = hash_table_iterate_init(ctx->cmd_stats);
+	while (hash_table_iterate(iter, ctx->cmd_stats, &cmd_name, &stats))
+		stats_dist_deinit(&stats->usecs);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&ctx->cmd_stats);
+	pool_unref(&ctx->pool);
+}
+
+int main(int argc, char *argv[])
+{
+	struct replay_ctx ctx;
+	struct ip_addr *ips;
+	unsigned int ips_count, timeout_secs = 0;
+	struct timeout *to_stop = NULL;
+	int c, ret;
+
+	i_zero(&ctx);
+	ctx.max_parallel_sessions = DEFAULT_MAX_PARALLEL_SESSIONS;
+	ctx.speed = 1;
+
+	master_service = master_service_init("rawlog-replay",
+					     MASTER_SERVICE_FLAG_STANDALONE,
+					     &argc, &argv, "c:ms:t:u:p:");
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'c':
+			if (str_to_uint(optarg, &ctx.max_parallel_sessions) < 0 ||
+			    ctx.max_parallel_sessions == 0)
+				i_fatal("Invalid -c parameter: %s", optarg);
+			break;
+		case 'm':
+			ctx.speed = 0;
+			break;
+		case 's':
+			if (sscanf(optarg, "%lf", &ctx.speed) != 1 ||
+			    ctx.speed <= 0)
+				i_fatal("Invalid -s parameter: %s", optarg);
+			break;
+		case 't':
+			if (str_to_uint(optarg, &timeout_secs) < 0)
+				i_fatal("Invalid -t parameter: %s", optarg);
+			break;
+		case 'u':
+			ctx.username = optarg;
+			break;
+		case 'p':
+			ctx.password = optarg;
+			break;
+		default:
+			return FATAL_DEFAULT;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 2 || ctx.username == NULL || ctx.password == NULL)
+		i_fatal("Usage: [-c <max sessions>] [-m | -s <speed>] [-t <secs>] -u <user> -p <password> <host[:port]|socket path> <rawlog file|dir> [...]");
+
+	master_service_init_finish(master_service);
+
+	ctx.pool = pool_alloconly_create("rawlog replay", 1024*64);
+	p_array_init(&ctx.logs, ctx.pool, 16);
+	hash_table_create(&ctx.cmd_stats, ctx.pool, 0, str_hash, strcmp);
+
+	if (argv[0][0] == '/')
+		ctx.host = argv[0];
+	else {
+		if (net_str2hostport(argv[0], 143, &ctx.host, &ctx.port) < 0)
+			i_fatal("Invalid host: %s", argv[0]);
+		ret = net_gethostbyname(ctx.host, &ips, &ips_count);
+		if (ret != 0) {
+			i_fatal("Couldn't resolve %s: %s", ctx.host,
+				net_gethosterror(ret));
+		}
+		ctx.ip = ips[0];
+	}
+	for (int i = 1; i < argc; i++) {
+		if (replay_add_path(&ctx, argv[i]) < 0)
+			i_fatal("Failed to read rawlogs");
+	}
+	if (array_count(&ctx.logs) == 0)
+		i_fatal("No rawlogs found");
+
+	replay_sessions_start_more(&ctx);
+	if (timeout_secs != 0)
+		to_stop = timeout_add(timeout_secs*1000, io_loop_stop, current_ioloop);
+	if (ctx.sessions_count > 0)
+		io_loop_run(current_ioloop);
+	timeout_remove(&to_stop);
+
+	replay_print_stats(&ctx);
+	replay_deinit(&ctx);
+	master_service_deinit(&master_service);
+	return 0;
+}